@@ -0,0 +1,221 @@
+/*
+ * Post-process anti-aliasing: SMAA in three passes and TAA with a history of its own
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "AntiAliasing.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+const char* const modeNames[] = {"off", "fxaa", "smaa", "taa"};
+
+// The radical inverse of 'index' in 'base', from 0 to 1, for the Halton sequence
+float halton(int index, int base) {
+    float result = 0.0f;
+    float fraction = 1.0f;
+    while (index > 0) {
+        fraction /= float(base);
+        result += fraction * float(index % base);
+        index /= base;
+    }
+    return result;
+}
+
+}  // namespace
+
+AntiAliasing::AntiAliasing(Mode mode)
+    : mode_(mode), width_(0), height_(0), renderwidth_(0), renderheight_(0),
+      historywidth_(0), historyheight_(0), historyvalid_(false), resolved_(false), frame_(0),
+      jitter_{0.0f, 0.0f}, lastjitter_{0.0f, 0.0f}, current_(0), framebuffers_{0, 0},
+      textures_{0, 0}, smaa_("vertex_fullscreen.glsl", "fragment_smaa.glsl"), vao_(0) {}
+
+AntiAliasing::~AntiAliasing() {
+    if (framebuffers_[0] != 0) {
+        glDeleteFramebuffers(2, framebuffers_);
+        glstate::deleteTextures(2, textures_);
+    }
+    if (vao_ != 0) {
+        glstate::deleteVertexArrays(1, &vao_);
+    }
+}
+
+bool AntiAliasing::parseMode(const std::string& name, Mode& mode) {
+    for (int i = 0; i < 4; i++) {
+        if (name == modeNames[i]) {
+            mode = static_cast<Mode>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* AntiAliasing::modeName(Mode mode) { return modeNames[static_cast<int>(mode)]; }
+
+AntiAliasing::Mode AntiAliasing::mode() const { return mode_; }
+
+void AntiAliasing::beginFrame(int width, int height, int renderwidth, int renderheight) {
+    renderwidth_ = renderwidth;
+    renderheight_ = renderheight;
+    if (mode_ != Mode::TAA) {
+        return;
+    }
+    if (width != width_ || height != height_) {
+        if (framebuffers_[0] == 0) {
+            glGenFramebuffers(2, framebuffers_);
+            glGenTextures(2, textures_);
+        }
+        width_ = width;
+        height_ = height;
+        for (int i = 0; i < 2; i++) {
+            // Bilinear, since the history is read where the motion vectors point
+            glstate::bindTexture(GL_TEXTURE_2D, textures_[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, historyFormat, width, height, 0, GL_RGBA, GL_FLOAT,
+                         nullptr);
+            gpumem::setTexture(textures_[i], gpumem::Category::RenderTarget,
+                               gpumem::textureBytes(historyFormat, width, height));
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers_[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                                   textures_[i], 0);
+            const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if (status != GL_FRAMEBUFFER_COMPLETE) {
+                std::cerr << "AntiAliasing::beginFrame(): framebuffer is not complete (status 0x"
+                          << std::hex << status << std::dec << ")\n";
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        invalidate();
+    }
+    // The frame resolved last is what this one blends into
+    historyvalid_ = resolved_;
+    if (resolved_) {
+        current_ = 1 - current_;
+    }
+    resolved_ = false;
+
+    // The Halton (2, 3) sequence, from -0.5 to 0.5 pixels, skipping its first point at 0
+    const int index = static_cast<int>(frame_ % jitterCount) + 1;
+    frame_++;
+    lastjitter_[0] = jitter_[0];
+    lastjitter_[1] = jitter_[1];
+    jitter_[0] = (halton(index, 2) - 0.5f) / float(std::max(renderwidth, 1));
+    jitter_[1] = (halton(index, 3) - 0.5f) / float(std::max(renderheight, 1));
+}
+
+void AntiAliasing::invalidate() {
+    historyvalid_ = false;
+    resolved_ = false;
+}
+
+Mat4 AntiAliasing::jitter(const Mat4& P) const {
+    if (mode_ != Mode::TAA) {
+        return P;
+    }
+    // Clip space is twice the texture coordinates, and x and y are divided by w
+    return Mat4::translation(2.0f * jitter_[0], 2.0f * jitter_[1], 0.0f) * P;
+}
+
+void AntiAliasing::applyMotion(Shader& shader) const {
+    shader.setUniform("renderSize", float(renderwidth_), float(renderheight_));
+    shader.setUniform("jitterDelta", jitter_[0] - lastjitter_[0], jitter_[1] - lastjitter_[1]);
+}
+
+void AntiAliasing::detectEdges(GLuint scene) {
+    Shader& shader = smaa_.get("EDGES");
+    shader.use();
+    glstate::activeTexture(GL_TEXTURE0);
+    glstate::bindTexture(GL_TEXTURE_2D, scene);
+    shader.setUniform("source", 0);
+    shader.setUniform("renderSize", float(renderwidth_), float(renderheight_));
+    drawFullscreen();
+}
+
+void AntiAliasing::computeWeights(GLuint edges) {
+    Shader& shader = smaa_.get("WEIGHTS");
+    shader.use();
+    glstate::activeTexture(GL_TEXTURE0);
+    glstate::bindTexture(GL_TEXTURE_2D, edges);
+    shader.setUniform("edges", 0);
+    shader.setUniform("renderSize", float(renderwidth_), float(renderheight_));
+    drawFullscreen();
+}
+
+void AntiAliasing::blend(GLuint scene, GLuint weights) {
+    Shader& shader = smaa_.get("BLEND");
+    shader.use();
+    glstate::activeTexture(GL_TEXTURE1);
+    glstate::bindTexture(GL_TEXTURE_2D, weights);
+    glstate::activeTexture(GL_TEXTURE0);
+    glstate::bindTexture(GL_TEXTURE_2D, scene);
+    shader.setUniform("source", 0);
+    shader.setUniform("weights", 1);
+    shader.setUniform("renderSize", float(renderwidth_), float(renderheight_));
+    drawFullscreen();
+}
+
+void AntiAliasing::resolve(GLuint scene, GLuint motion) {
+    if (taa_.id() == 0) {
+        taa_.createShader("vertex_fullscreen.glsl", "fragment_taa.glsl");
+    }
+    taa_.use();
+    glstate::activeTexture(GL_TEXTURE2);
+    glstate::bindTexture(GL_TEXTURE_2D, textures_[1 - current_]);
+    glstate::activeTexture(GL_TEXTURE1);
+    glstate::bindTexture(GL_TEXTURE_2D, motion);
+    glstate::activeTexture(GL_TEXTURE0);
+    glstate::bindTexture(GL_TEXTURE_2D, scene);
+    taa_.setUniform("source", 0);
+    taa_.setUniform("motion", 1);
+    taa_.setUniform("history", 2);
+    taa_.setUniform("renderSize", float(renderwidth_), float(renderheight_));
+    taa_.setUniform("historySize", float(historywidth_), float(historyheight_));
+    // Without history, the frame starts it as it is
+    taa_.setUniform("historyWeight", historyvalid_ ? 0.9f : 0.0f);
+    drawFullscreen();
+    historywidth_ = renderwidth_;
+    historyheight_ = renderheight_;
+    resolved_ = true;
+}
+
+GLuint AntiAliasing::historyFramebuffer() const { return framebuffers_[current_]; }
+
+GLuint AntiAliasing::history() const { return textures_[current_]; }
+
+void AntiAliasing::drawFullscreen() {
+    if (vao_ == 0) {
+        glGenVertexArrays(1, &vao_);
+    }
+    // The state changed below, to restore at the end
+    GLint polygonmode[2];
+    glGetIntegerv(GL_POLYGON_MODE, polygonmode);
+    const GLboolean depthtest = glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean blending = glIsEnabled(GL_BLEND);
+
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glViewport(0, 0, renderwidth_, renderheight_);
+    glstate::bindVertexArray(vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glstate::bindVertexArray(0);
+
+    glPolygonMode(GL_FRONT_AND_BACK, static_cast<GLenum>(polygonmode[0]));
+    if (depthtest) {
+        glEnable(GL_DEPTH_TEST);
+    }
+    if (blending) {
+        glEnable(GL_BLEND);
+    }
+}
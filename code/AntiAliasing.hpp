@@ -0,0 +1,126 @@
+/*
+ * Post-process anti-aliasing, as a cheaper alternative to MSAA and supersampling: FXAA,
+ * SMAA and TAA.
+ *
+ * Usage: Choose a mode, e.g. with parseMode() of "fxaa", "smaa" or "taa".
+ *          - FXAA is the effect of PostProcess (PostProcess.hpp), in its one pass after the
+ *            scene, so it only needs PostProcess::FXAA among the effects.
+ *          - SMAA, morphological anti-aliasing after Jimenez et al. 2012, in three passes
+ *            over the scene: detectEdges() finds the edges by the luma of the colors,
+ *            computeWeights() follows each edge to its ends, up to maxSearch pixels away,
+ *            and works out the area that the line through the ends covers of each pixel
+ *            along it, and blend() mixes each pixel with its neighbors by those areas. The
+ *            areas are computed in the shader, for the L, Z and U shapes of the lines,
+ *            rather than read from the area texture of SMAA, and the diagonal and corner
+ *            patterns are left out, which makes it SMAA 1x without its extras.
+ *          - TAA, temporal anti-aliasing: the projection of each frame is offset by less
+ *            than a pixel, along a Halton sequence of jitterCount offsets, with jitter(),
+ *            and resolve() blends each new frame into the history of the earlier ones,
+ *            which it finds with motion vectors. The motion vectors are those of the
+ *            reverse reprojection of ReprojectionCache (ReprojectionCache.hpp): its
+ *            setDraw() gives the vertex shader each draw's matrix of the last frame, and
+ *            vertex.glsl and fragment.glsl built with the define MOTION_VECTORS write
+ *            where each fragment was in the last frame into a motionFormat texture, after
+ *            applyMotion() to the program. The history colors are clamped to the colors
+ *            around the pixel in this frame, so that what was hidden or has changed does
+ *            not leave ghosts.
+ *        Each pass draws the 'renderwidth' x 'renderheight' texels in the lower left corner
+ *        of its input into the same corner of the bound framebuffer, with the viewport set
+ *        to them, like the other passes of a scene of DynamicResolution. The edges are an
+ *        edgesFormat texture, the weights a weightsFormat texture. The TAA history is kept
+ *        here, in two historyFormat textures that are written in turns; resolve() writes
+ *        into historyFramebuffer(), whose texture is then history().
+ *        All passes draw a full screen triangle with vertex_fullscreen.glsl and
+ *        fragment_smaa.glsl or fragment_taa.glsl, compiled on first use, and restore the GL
+ *        state they change, except the bound program and texture.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <string>
+
+#include "Mat4.hpp"
+#include "Shader.hpp"
+
+class AntiAliasing {
+public:
+    enum class Mode { Off, FXAA, SMAA, TAA };
+
+    static constexpr int maxSearch = 16;   // Pixels that SMAA follows an edge each way
+    static constexpr int jitterCount = 8;  // Offsets of TAA before they repeat
+    static constexpr GLenum edgesFormat = GL_RG8;
+    static constexpr GLenum weightsFormat = GL_RGBA8;
+    static constexpr GLenum motionFormat = GL_RG16F;
+    static constexpr GLenum historyFormat = GL_RGBA16F;
+
+    explicit AntiAliasing(Mode mode = Mode::Off);
+
+    /* Destructor: delete the history textures and framebuffers and the VAO */
+    ~AntiAliasing();
+
+    AntiAliasing(const AntiAliasing&) = delete;
+    AntiAliasing& operator=(const AntiAliasing&) = delete;
+
+    // "off", "fxaa", "smaa" or "taa". False for other names.
+    static bool parseMode(const std::string& name, Mode& mode);
+    static const char* modeName(Mode mode);
+
+    Mode mode() const;
+
+    /* Begin a frame of 'renderwidth' x 'renderheight' pixels in the lower left corner of
+     * a view of 'width' x 'height', which moves on to the next jitter offset of TAA, and
+     * resizes its history to the view */
+    void beginFrame(int width, int height, int renderwidth, int renderheight);
+
+    // Forget the history of TAA, so that the next frame starts it again
+    void invalidate();
+
+    // 'P' offset by the jitter of this frame with TAA, else 'P' itself
+    Mat4 jitter(const Mat4& P) const;
+
+    // Set the uniforms of the MOTION_VECTORS variant of fragment.glsl for this frame
+    void applyMotion(Shader& shader) const;
+
+    // SMAA: Find the edges of 'scene' into an edgesFormat texture
+    void detectEdges(GLuint scene);
+
+    // SMAA: Find the blend weights of the 'edges' into a weightsFormat texture
+    void computeWeights(GLuint edges);
+
+    // SMAA: Blend 'scene' by the 'weights' into a texture of the format of 'scene'
+    void blend(GLuint scene, GLuint weights);
+
+    // TAA: Blend 'scene' into the history by the 'motion' vectors, into
+    // historyFramebuffer()
+    void resolve(GLuint scene, GLuint motion);
+
+    // TAA: The framebuffer of the history that resolve() writes this frame, and its texture
+    GLuint historyFramebuffer() const;
+    GLuint history() const;
+
+private:
+    // Draw the full screen triangle into the render size with the depth test, blending
+    // and the polygon mode off
+    void drawFullscreen();
+
+    Mode mode_;
+    int width_;            // Of the view and of the history textures
+    int height_;
+    int renderwidth_;      // Of this frame
+    int renderheight_;
+    int historywidth_;     // Of the frame that resolve() blends into, from the last frame
+    int historyheight_;
+    bool historyvalid_;    // If there is such a frame
+    bool resolved_;        // If resolve() ran in this frame
+    long long frame_;      // Frames begun, which picks the jitter
+    float jitter_[2];      // Of this frame and the last, in texture coordinates
+    float lastjitter_[2];
+    int current_;          // The history texture that resolve() writes
+    GLuint framebuffers_[2];
+    GLuint textures_[2];
+    ShaderVariants smaa_;  // fragment_smaa.glsl with EDGES, WEIGHTS or BLEND
+    Shader taa_;           // fragment_taa.glsl
+    GLuint vao_;           // Empty VAO for the full screen triangle
+};
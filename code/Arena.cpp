@@ -0,0 +1,69 @@
+/*
+ * A linear allocator in blocks that are reused after a reset
+ *
+ * This code is in the public domain.
+ */
+#include "Arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+Arena::Arena(size_t blockbytes)
+    : blockbytes_(std::max<size_t>(blockbytes, 64)), current_(0), top_(0), used_(0) {}
+
+void* Arena::allocate(size_t bytes, size_t alignment) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Take the memory from the current block, or from the next one that is large enough
+    while (current_ < blocks_.size()) {
+        const Block& block = blocks_[current_];
+        const uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+        const size_t start = ((base + top_ + alignment - 1) & ~(uintptr_t(alignment) - 1)) - base;
+        if (start + bytes <= block.size) {
+            top_ = start + bytes;
+            used_ += bytes;
+            return block.data.get() + start;
+        }
+        current_++;
+        top_ = 0;
+    }
+
+    // A new block, with room for the alignment
+    const size_t size = std::max(blockbytes_, bytes + alignment);
+    blocks_.push_back({std::unique_ptr<unsigned char[]>(new unsigned char[size]), size});
+    current_ = blocks_.size() - 1;
+    const uintptr_t base = reinterpret_cast<uintptr_t>(blocks_.back().data.get());
+    const size_t start = ((base + alignment - 1) & ~(uintptr_t(alignment) - 1)) - base;
+    top_ = start + bytes;
+    used_ += bytes;
+    return blocks_.back().data.get() + start;
+}
+
+void Arena::reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    current_ = 0;
+    top_ = 0;
+    used_ = 0;
+}
+
+void Arena::release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    blocks_.clear();
+    blocks_.shrink_to_fit();
+    current_ = 0;
+    top_ = 0;
+    used_ = 0;
+}
+
+size_t Arena::used() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return used_;
+}
+
+size_t Arena::capacity() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t bytes = 0;
+    for (const Block& block : blocks_) {
+        bytes += block.size;
+    }
+    return bytes;
+}
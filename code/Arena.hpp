@@ -0,0 +1,98 @@
+/*
+ * A linear allocator for the temporary data of a load, released all at once.
+ *
+ * Usage: Create one Arena and pass it to the loaders, TriangleSoup::readOBJ(), the TGA
+ *        loader of Texture and readFile() of Shader.cpp. They take their temporary arrays
+ *        from it instead of the heap, and never give the memory back one array at a time.
+ *        Call reset() once the data is on the GPU. The memory is kept for the next load, so
+ *        that loading hundreds of files touches the same pages over and over instead of
+ *        allocating, faulting in and freeing new ones for every file. release() gives the
+ *        memory back to the system.
+ *        Memory is taken from blocks of 'blockbytes', 1 MB by default, and larger requests
+ *        get a block of their own. allocate() may be called from several threads at once.
+ *        The memory is not initialized, and destructors are never called, so only store
+ *        trivially destructible types. ArenaVector is a std::vector in an arena, for arrays
+ *        whose size is not known in advance. Growing one leaves the old capacity unused
+ *        until reset().
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Arena {
+public:
+    /* Constructor: no memory is allocated until the first allocate() */
+    explicit Arena(size_t blockbytes = 1 << 20);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // 'bytes' of uninitialized memory aligned to 'alignment', a power of two
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+    // An uninitialized array of 'count' objects of type T
+    template <typename T>
+    T* allocate(size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // Make all memory free for reuse. Everything allocated before becomes invalid.
+    void reset();
+
+    // Reset, and give the memory back to the system
+    void release();
+
+    // Bytes allocated since the last reset, and bytes of all blocks
+    size_t used() const;
+    size_t capacity() const;
+
+private:
+    struct Block {
+        std::unique_ptr<unsigned char[]> data;
+        size_t size;
+    };
+
+    size_t blockbytes_;
+    std::vector<Block> blocks_;
+    size_t current_;  // Block that allocate() takes memory from
+    size_t top_;      // First free byte of the current block
+    size_t used_;
+    mutable std::mutex mutex_;
+};
+
+/* A standard allocator that takes its memory from an Arena, and never frees it */
+template <typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena& arena) : arena_(&arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+    T* allocate(size_t count) { return arena_->allocate<T>(count); }
+    void deallocate(T*, size_t) {}
+
+    Arena* arena() const { return arena_; }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena_ == other.arena();
+    }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena_ != other.arena();
+    }
+
+private:
+    Arena* arena_;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
@@ -0,0 +1,348 @@
+/*
+ * Settings measured on this machine, and kept in a config file
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "Autotuner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "FrameProfiler.hpp"
+#include "Framebuffer.hpp"
+#include "Json.hpp"
+#include "Mat4.hpp"
+#include "MaterialTable.hpp"
+#include "Shader.hpp"
+#include "TriangleSoup.hpp"
+#include "UniformBuffers.hpp"
+#include "bench/Scenes.hpp"
+
+namespace {
+
+const int warmupFrames = 5;
+const int measuredFrames = 15;
+const int boxCount = 1024;  // Of the "boxes:1024" scene of tnm046-bench
+const int sphereSegments[] = {16, 32, 64, 128, 256, 512};
+const int shadowSizes[] = {512, 1024, 2048, 4096};
+// The triangle rate at which the LOD bias is 1 pixel, and the cost of a pixel of the sphere
+// at which the dynamic resolution may go down to referenceMinScale
+const double referenceTrianglesPerMs = 200000.0;
+const double referenceMsPerMegapixel = 0.1;
+const float referenceMinScale = 0.75f;
+const double frameMs = 1000.0 / 60.0;
+const float clearColor[4] = {0.3f, 0.3f, 0.3f, 0.0f};
+
+// The median CPU and GPU time in milliseconds of a frame of 'draw'
+template <typename Draw>
+void measure(Draw draw, double& cpu, double& gpu) {
+    FrameProfiler profiler(measuredFrames + 1);
+    for (int f = 0; f < warmupFrames + measuredFrames; f++) {
+        if (f >= warmupFrames) {
+            profiler.beginFrame();
+            profiler.beginScope("tune");
+        }
+        draw();
+        if (f >= warmupFrames) {
+            profiler.endScope();
+        }
+        glFlush();
+    }
+    // Wait for the GPU, and read the queries of the last frames
+    glFinish();
+    profiler.beginFrame();
+    cpu = profiler.scopeCPUPercentile("tune", 50.0);
+    gpu = profiler.scopeGPUPercentile("tune", 50.0);
+    if (!(gpu > 0.0)) {
+        gpu = cpu;  // Without timer queries
+    }
+}
+
+// What the measurements draw with, and into
+struct Scenes {
+    Shader shader;
+    Shader depthshader;
+    UniformRing uniforms{256 * (size_t(boxCount) + 2)};
+    MaterialTable materials;
+    Framebuffer framebuffer;
+    bench::Scene grid;  // The grid of boxes, unturned
+    std::vector<ptrdiff_t> objectdata;
+    int width;
+    int height;
+
+    Scenes(int w, int h) : width(w), height(h) {
+        shader.createShader("vertex.glsl", "fragment.glsl");
+        depthshader.createShader("vertex_depth.glsl", "fragment_depth.glsl");
+        materials.upload();
+        framebuffer.create(width, height);
+        bench::createScene("boxes:" + std::to_string(boxCount), std::string(), grid);
+    }
+
+    // Clear 'target' and set the frame uniforms and the material table for 'program'
+    void begin(Framebuffer& target, Shader& program) {
+        target.bind();
+        glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        program.use();
+        uniforms.beginFrame();
+        objectdata.clear();
+        const Mat4 P = bench::sceneProjection(target.width(), target.height());
+        objectdata.push_back(uniforms.push(FrameUniforms{P, Mat4::identity(), 0.0f, {}}));
+    }
+
+    // Upload the uniforms pushed since begin() and bind the frame data
+    void upload() {
+        uniforms.upload();
+        uniforms.bind(frameBlockBinding, objectdata[0], sizeof(FrameUniforms));
+        materials.bind(materialBlockBinding);
+    }
+
+    // The depth of the grid, one draw call per box with the object data of each
+    void drawBoxes(Framebuffer& target) {
+        begin(target, depthshader);
+        for (const bench::SceneDraw& draw : grid.draws) {
+            objectdata.push_back(uniforms.push(ObjectUniforms{draw.M, Mat4::identity()}));
+        }
+        upload();
+        for (size_t i = 0; i < grid.draws.size(); i++) {
+            uniforms.bind(objectBlockBinding, objectdata[1 + i], sizeof(ObjectUniforms));
+            grid.draws[i].shape->renderDepth();
+        }
+    }
+
+    // One mesh with the model-view matrix MV
+    void drawMesh(TriangleSoup& mesh, const Mat4& MV, int copies = 1) {
+        begin(framebuffer, shader);
+        objectdata.push_back(uniforms.push(ObjectUniforms{MV, Mat4::identity()}));
+        upload();
+        uniforms.bind(objectBlockBinding, objectdata[1], sizeof(ObjectUniforms));
+        for (int i = 0; i < copies; i++) {
+            mesh.render();
+        }
+    }
+};
+
+std::string escape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += (static_cast<unsigned char>(c) < 32) ? ' ' : c;
+    }
+    return escaped;
+}
+
+}  // namespace
+
+Autotuner::Autotuner(const std::string& configfile) : configfile_(configfile), loaded_(false) {}
+
+bool Autotuner::load() {
+    std::ifstream file(configfile_, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    const std::string contents = text.str();
+    json::Value root;
+    std::string error;
+    if (!json::parse(contents.data(), contents.size(), root, &error)) {
+        std::cerr << configfile_ << ": " << error << ", tuning again\n";
+        return false;
+    }
+    const json::Value& values = root["settings"];
+    for (int s = 0; s < SettingCount; s++) {
+        const json::Value& value = values[settingName(s)];
+        if (!value.isObject()) {
+            continue;
+        }
+        devices_[s] = value["device"].asString();
+        switch (s) {
+        case SphereSetting:
+            settings_.spheresegments = std::max(value["value"].asInt(32), 3);
+            break;
+        case LODSetting:
+            settings_.lodpixelerror = static_cast<float>(value["value"].asNumber(1.0));
+            break;
+        case ShadowSetting:
+            settings_.shadowsize = std::max(value["value"].asInt(1024), 64);
+            break;
+        case DynresSetting:
+            settings_.dynresminscale = static_cast<float>(value["min"].asNumber(0.5));
+            settings_.dynresmaxscale = static_cast<float>(value["max"].asNumber(1.0));
+            break;
+        }
+    }
+    loaded_ = true;
+    return true;
+}
+
+int Autotuner::tune(int width, int height, bool all, double budgetms) {
+    const std::string device = currentDevice();
+    std::vector<int> stale;
+    for (int s = 0; s < SettingCount; s++) {
+        if (all || !loaded_ || devices_[s] != device) {
+            stale.push_back(s);
+        }
+    }
+    if (stale.empty()) {
+        return 0;
+    }
+    const bool everything = all || !loaded_;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // The state changed below, to restore at the end
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const GLboolean depthtest = glIsEnabled(GL_DEPTH_TEST);
+    glEnable(GL_DEPTH_TEST);
+
+    int tuned = 0;
+    {
+        Scenes scenes(std::max(width, 64), std::max(height, 64));
+        for (int s : stale) {
+            double cpu = 0.0;
+            double gpu = 0.0;
+            if (s == SphereSetting) {
+                // The most segments within the budget, at least the fewest tried
+                settings_.spheresegments = sphereSegments[0];
+                for (int segments : sphereSegments) {
+                    bench::Scene sphere;
+                    bench::createScene("sphere:" + std::to_string(segments), std::string(),
+                                       sphere);
+                    measure([&]() { scenes.drawMesh(sphere.shapes[0], sphere.draws[0].M); },
+                            cpu, gpu);
+                    if (gpu > sphereBudgetMs) {
+                        break;
+                    }
+                    settings_.spheresegments = segments;
+                }
+            } else if (s == LODSetting) {
+                // Enough triangles for the GPU time to be well above the timer resolution
+                bench::Scene sphere;
+                bench::createScene("sphere:256", std::string(), sphere);
+                const int copies = 8;
+                measure(
+                    [&]() { scenes.drawMesh(sphere.shapes[0], sphere.draws[0].M, copies); },
+                    cpu, gpu);
+                const double triangles = double(sphere.triangles) * copies;
+                const double ratio = referenceTrianglesPerMs / (triangles / std::max(gpu, 1e-3));
+                settings_.lodpixelerror = static_cast<float>(
+                    std::min(std::max(std::exp2(std::round(std::log2(ratio))), 0.5), 8.0));
+            } else if (s == ShadowSetting) {
+                GLint maxsize = 0;
+                glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxsize);
+                settings_.shadowsize = shadowSizes[0];
+                for (int size : shadowSizes) {
+                    Framebuffer map;
+                    if (size > maxsize || !map.create(size, size)) {
+                        break;
+                    }
+                    measure([&]() { scenes.drawBoxes(map); }, cpu, gpu);
+                    if (4.0 * gpu > shadowBudgetMs) {
+                        break;
+                    }
+                    settings_.shadowsize = size;
+                }
+            } else if (s == DynresSetting) {
+                // The sphere close enough to cover the frame, mostly fill
+                bench::Scene sphere;
+                bench::createScene("sphere:64", std::string(), sphere);
+                measure(
+                    [&]() { scenes.drawMesh(sphere.shapes[0], Mat4::translation(0, 0, -1.2f)); },
+                    cpu, gpu);
+                const double megapixels = double(scenes.width) * double(scenes.height) * 1e-6;
+                const double ratio = gpu / megapixels / referenceMsPerMegapixel;
+                const float minscale = referenceMinScale / float(std::sqrt(std::max(ratio, 1.0)));
+                settings_.dynresminscale =
+                    std::round(std::min(std::max(minscale, 0.35f), referenceMinScale) * 20.0f) /
+                    20.0f;
+                settings_.dynresmaxscale = (gpu > 0.5 * frameMs) ? 0.85f : 1.0f;
+            }
+            devices_[s] = device;
+            tuned++;
+            const double elapsed = std::chrono::duration<double, std::milli>(
+                                       std::chrono::steady_clock::now() - start)
+                                       .count();
+            if (!everything && elapsed > budgetms) {
+                break;
+            }
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (!depthtest) {
+        glDisable(GL_DEPTH_TEST);
+    }
+    return tuned;
+}
+
+bool Autotuner::save() const {
+    FILE* file = fopen(configfile_.c_str(), "w");
+    if (!file) {
+        std::cerr << "Could not create " << configfile_ << "\n";
+        return false;
+    }
+    fprintf(file, "{\n  \"settings\": {\n");
+    for (int s = 0; s < SettingCount; s++) {
+        fprintf(file, "    \"%s\": {", settingName(s));
+        switch (s) {
+        case SphereSetting:
+            fprintf(file, "\"value\": %d", settings_.spheresegments);
+            break;
+        case LODSetting:
+            fprintf(file, "\"value\": %.3f", settings_.lodpixelerror);
+            break;
+        case ShadowSetting:
+            fprintf(file, "\"value\": %d", settings_.shadowsize);
+            break;
+        case DynresSetting:
+            fprintf(file, "\"min\": %.3f, \"max\": %.3f", settings_.dynresminscale,
+                    settings_.dynresmaxscale);
+            break;
+        }
+        fprintf(file, ", \"device\": \"%s\"}%s\n", escape(devices_[s]).c_str(),
+                s + 1 < SettingCount ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+    if (fclose(file) != 0) {
+        std::cerr << "Could not write " << configfile_ << "\n";
+        return false;
+    }
+    return true;
+}
+
+const Autotuner::Settings& Autotuner::settings() const { return settings_; }
+
+std::string Autotuner::summary() const {
+    std::ostringstream text;
+    text << "spheres of " << settings_.spheresegments << " segments, LOD error "
+         << settings_.lodpixelerror << " px, shadow maps of " << settings_.shadowsize
+         << ", dynamic resolution " << settings_.dynresminscale << " to "
+         << settings_.dynresmaxscale;
+    return text.str();
+}
+
+std::string Autotuner::currentDevice() {
+    const char* vendor = reinterpret_cast<const char*>(glGetString(GL_VENDOR));
+    const char* renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+    const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    return std::string(vendor ? vendor : "") + " " + (renderer ? renderer : "") + ", " +
+           (version ? version : "");
+}
+
+const char* Autotuner::settingName(int setting) {
+    static const char* names[SettingCount] = {"sphere_segments", "lod_pixel_error",
+                                              "shadow_size", "dynres_scale"};
+    return names[setting];
+}
@@ -0,0 +1,84 @@
+/*
+ * Settings measured on this machine rather than guessed: the detail of the generated
+ * spheres, the LOD bias, the size of the shadow maps and the bounds of the dynamic
+ * resolution, kept in a config file for later runs.
+ *
+ * Usage: load() the config file at startup, then call tune() with the GL context current
+ *        and nothing else drawing, and save() if it returned more than 0. Use settings()
+ *        for the objects that depend on them.
+ *        tune() draws the scenes of the benchmarks (bench/Scenes.hpp), a grid of boxes and
+ *        a sphere, into an offscreen framebuffer, and times each variant with a
+ *        FrameProfiler, the median of a few frames after a warmup:
+ *          sphere segments - the most that draw a sphere in sphereBudgetMs of GPU time.
+ *          LOD bias        - the pixel error of TriangleSoup::setLODSelection(), from
+ *                            the triangle rate of that sphere: 1 pixel at the reference
+ *                            rate, more for slower GPUs, in powers of two.
+ *          shadow size     - the largest map of which four cascades of the box grid take
+ *                            shadowBudgetMs.
+ *          dynres bounds   - the scales of DynamicResolution, from the cost of a pixel of
+ *                            the sphere filling the frame: the slower, the lower the
+ *                            least scale, and below full resolution at most when a full
+ *                            frame of it alone takes half of the frame time.
+ *        Every setting remembers the GPU and driver it was measured on. With a config file
+ *        from another GPU or driver, tune() measures again only the settings that are out
+ *        of date, and only as many as fit in 'budgetms', so that a driver update costs one
+ *        short startup or a few, and the rest keep their old values until then. Without a
+ *        config file, or with 'all', every setting is measured.
+ *        The file is JSON, one object per setting with its value and the device.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <string>
+
+class Autotuner {
+public:
+    // The settings, defaults until they are loaded or tuned
+    struct Settings {
+        int spheresegments = 32;
+        float lodpixelerror = 1.0f;
+        int shadowsize = 1024;
+        float dynresminscale = 0.5f;
+        float dynresmaxscale = 1.0f;
+    };
+
+    // GPU time of a sphere of the chosen segments, and of four shadow cascades
+    static constexpr double sphereBudgetMs = 0.5;
+    static constexpr double shadowBudgetMs = 2.0;
+
+    /* Constructor: the settings are read from and written to 'configfile' */
+    explicit Autotuner(const std::string& configfile);
+
+    /* Read the config file. False if there is none or it can not be read, which leaves the
+     * defaults and makes the next tune() measure everything. */
+    bool load();
+
+    /* Measure the settings that were not measured on the current GL context's GPU and
+     * driver, or all of them with 'all', in a 'width' x 'height' framebuffer. Stops after
+     * the setting that goes past 'budgetms' unless everything is measured. Returns the
+     * number of settings measured. */
+    int tune(int width, int height, bool all = false, double budgetms = 1500.0);
+
+    // Write the config file. False, after printing why, if it fails.
+    bool save() const;
+
+    const Settings& settings() const;
+
+    // The settings as text, for the log
+    std::string summary() const;
+
+    // The GPU and the driver of the current GL context, as the settings remember them
+    static std::string currentDevice();
+
+private:
+    // The settings, in the order they are measured
+    enum Setting { SphereSetting, LODSetting, ShadowSetting, DynresSetting, SettingCount };
+
+    static const char* settingName(int setting);
+
+    std::string configfile_;
+    Settings settings_;
+    std::string devices_[SettingCount];  // Each setting was measured on, empty if never
+    bool loaded_;
+};
@@ -0,0 +1,395 @@
+/*
+ * Bounding volume hierarchy with binned SAH builds, refitting, culling and picking
+ *
+ * This code is in the public domain.
+ */
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include "FrameProfiler.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+
+namespace {
+
+const int numBins = 16;       // Candidate splits per axis in the SAH build
+const int maxLeafSize = 8;    // Larger leaves are always split
+const int minJobSize = 4096;  // Smaller subtrees are built by the thread that split them
+const float inf = std::numeric_limits<float>::infinity();
+
+Box emptyBox() { return {{inf, inf, inf}, {-inf, -inf, -inf}}; }
+
+void grow(Box& box, const Box& other) {
+    for (int c = 0; c < 3; c++) {
+        box.min[c] = std::min(box.min[c], other.min[c]);
+        box.max[c] = std::max(box.max[c], other.max[c]);
+    }
+}
+
+// Half the surface area, which is all the SAH needs
+float halfArea(const Box& box) {
+    const float dx = std::max(box.max[0] - box.min[0], 0.0f);
+    const float dy = std::max(box.max[1] - box.min[1], 0.0f);
+    const float dz = std::max(box.max[2] - box.min[2], 0.0f);
+    return dx * dy + dy * dz + dz * dx;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+}  // namespace
+
+Box transformBounds(const mesh::Bounds& bounds, const Mat4& matrix) {
+    Box box;
+    for (int i = 0; i < 3; i++) {
+        box.min[i] = box.max[i] = matrix[12 + i];
+        for (int j = 0; j < 3; j++) {
+            const float a = matrix[4 * j + i] * bounds.min[j];
+            const float b = matrix[4 * j + i] * bounds.max[j];
+            box.min[i] += std::min(a, b);
+            box.max[i] += std::max(a, b);
+        }
+    }
+    return box;
+}
+
+BVH::BVH()
+    : nodecount_(0), buildcost_(0.0f), buildtime_(0.0), refittime_(0.0), profiler_(nullptr) {}
+
+int BVH::allocatePair() { return nodecount_.fetch_add(2); }
+
+void BVH::build(const std::vector<Box>& boxes, ThreadPool* pool) {
+    if (profiler_) {
+        profiler_->beginScope("bvh build");
+    }
+    const auto starttime = std::chrono::steady_clock::now();
+
+    const int n = static_cast<int>(boxes.size());
+    boxes_ = boxes;
+    centroids_.resize(3 * size_t(n));
+    objects_.resize(n);
+    for (int i = 0; i < n; i++) {
+        for (int c = 0; c < 3; c++) {
+            centroids_[3 * size_t(i) + c] = 0.5f * (boxes[i].min[c] + boxes[i].max[c]);
+        }
+        objects_[i] = i;
+    }
+    // A binary tree with at least one object per leaf has at most 2n - 1 nodes
+    nodes_.assign(std::max(2 * n - 1, 1), Node{emptyBox(), 0, 0});
+    nodecount_ = 1;
+
+    if (pool && pool->size() > 1 && n > 4096) {
+        // Children of more than a few thousand objects are built as jobs of their own,
+        // which idle threads steal
+        JobCounter jobs;
+        buildNode({0, 0, n}, pool, &jobs);
+        pool->wait(jobs);
+    } else {
+        buildNode({0, 0, n}, nullptr, nullptr);
+    }
+    nodes_.resize(nodecount_);
+    centroids_.clear();
+    centroids_.shrink_to_fit();
+    buildcost_ = sahCost();
+
+    buildtime_ = millisecondsSince(starttime);
+    if (profiler_) {
+        profiler_->endScope();
+    }
+}
+
+void BVH::buildNode(const BuildTask& root, ThreadPool* pool, JobCounter* jobs) {
+    std::vector<BuildTask> stack = {root};
+    while (!stack.empty()) {
+        const BuildTask task = stack.back();
+        stack.pop_back();
+        Node& node = nodes_[task.node];
+
+        // The box of the node, and the box of the centers, which is what the bins divide
+        Box centers = emptyBox();
+        node.box = emptyBox();
+        for (int i = task.begin; i < task.end; i++) {
+            const float* c = &centroids_[3 * size_t(objects_[i])];
+            grow(node.box, boxes_[objects_[i]]);
+            grow(centers, {{c[0], c[1], c[2]}, {c[0], c[1], c[2]}});
+        }
+        const int count = task.end - task.begin;
+        node.first = task.begin;
+        node.count = count;
+        if (count <= 2) {
+            continue;
+        }
+
+        int axis = 0;
+        for (int c = 1; c < 3; c++) {
+            if (centers.max[c] - centers.min[c] > centers.max[axis] - centers.min[axis]) {
+                axis = c;
+            }
+        }
+        const float extent = centers.max[axis] - centers.min[axis];
+        int mid = task.begin + count / 2;
+        if (extent > 0.0f) {
+            // Put the objects in bins by their centers along the axis
+            struct Bin {
+                Box box = emptyBox();
+                int count = 0;
+            };
+            Bin bins[numBins];
+            const float scale = numBins / extent;
+            auto binOf = [&](int object) {
+                const float c = centroids_[3 * size_t(object) + axis];
+                return std::min(static_cast<int>((c - centers.min[axis]) * scale), numBins - 1);
+            };
+            for (int i = task.begin; i < task.end; i++) {
+                Bin& bin = bins[binOf(objects_[i])];
+                grow(bin.box, boxes_[objects_[i]]);
+                bin.count++;
+            }
+            // Cost of a split after bin s: objects times area on each side
+            float rightcost[numBins];
+            Box right = emptyBox();
+            int rightcount = 0;
+            for (int s = numBins - 1; s > 0; s--) {
+                grow(right, bins[s].box);
+                rightcount += bins[s].count;
+                rightcost[s] = float(rightcount) * halfArea(right);
+            }
+            Box left = emptyBox();
+            int leftcount = 0;
+            float bestcost = inf;
+            int bestsplit = 0;
+            for (int s = 0; s < numBins - 1; s++) {
+                grow(left, bins[s].box);
+                leftcount += bins[s].count;
+                const float cost = float(leftcount) * halfArea(left) + rightcost[s + 1];
+                if (leftcount > 0 && leftcount < count && cost < bestcost) {
+                    bestcost = cost;
+                    bestsplit = s;
+                }
+            }
+            // A leaf costs one test per object, a split one more test per child
+            const float leafcost = float(count) * halfArea(node.box);
+            if (count <= maxLeafSize && bestcost + 2.0f * halfArea(node.box) >= leafcost) {
+                continue;
+            }
+            if (bestcost < inf) {
+                mid = static_cast<int>(
+                    std::partition(objects_.begin() + task.begin, objects_.begin() + task.end,
+                                   [&](int object) { return binOf(object) <= bestsplit; }) -
+                    objects_.begin());
+            }
+        } else if (count <= maxLeafSize) {
+            continue;  // All centers in one point, nothing to gain from splitting
+        }
+        if (mid == task.begin || mid == task.end) {
+            mid = task.begin + count / 2;
+        }
+
+        const int child = allocatePair();
+        node.first = child;
+        node.count = 0;
+        for (const BuildTask& subtree :
+             {BuildTask{child, task.begin, mid}, BuildTask{child + 1, mid, task.end}}) {
+            if (pool && subtree.end - subtree.begin > minJobSize) {
+                pool->run(*jobs, [this, subtree, pool, jobs] { buildNode(subtree, pool, jobs); });
+            } else {
+                stack.push_back(subtree);
+            }
+        }
+    }
+}
+
+void BVH::refit(const std::vector<Box>& boxes) {
+    if (profiler_) {
+        profiler_->beginScope("bvh refit");
+    }
+    const auto starttime = std::chrono::steady_clock::now();
+
+    boxes_ = boxes;
+    // Children always come after their parents, so one backwards pass updates all nodes
+    for (int i = static_cast<int>(nodes_.size()) - 1; i >= 0; i--) {
+        Node& node = nodes_[i];
+        if (node.count > 0) {
+            node.box = boxes_[objects_[node.first]];
+            for (int k = 1; k < node.count; k++) {
+                grow(node.box, boxes_[objects_[node.first + k]]);
+            }
+        } else if (!objects_.empty()) {
+            node.box = nodes_[node.first].box;
+            grow(node.box, nodes_[node.first + 1].box);
+        }
+    }
+
+    refittime_ = millisecondsSince(starttime);
+    if (profiler_) {
+        profiler_->endScope();
+    }
+}
+
+void BVH::cull(const Frustum& frustum, std::vector<int>& visible) const {
+    TRACE_SCOPE("cull");
+    if (objects_.empty()) {
+        return;
+    }
+    // Bit p of a mask is set if a box may cross plane p. Planes that a node is entirely
+    // inside of are not tested again for its children. Returns -1 if the box is outside.
+    auto classify = [&](const Box& box, int mask) {
+        for (int p = 0; p < 6; p++) {
+            if (!(mask & (1 << p))) {
+                continue;
+            }
+            const float* plane = frustum.planes[p];
+            // The corners farthest against the normal and farthest along it
+            float nearest = plane[3];
+            float farthest = plane[3];
+            for (int c = 0; c < 3; c++) {
+                const float a = plane[c] * box.min[c];
+                const float b = plane[c] * box.max[c];
+                nearest += std::min(a, b);
+                farthest += std::max(a, b);
+            }
+            if (farthest < 0.0f) {
+                return -1;
+            }
+            if (nearest >= 0.0f) {
+                mask &= ~(1 << p);
+            }
+        }
+        return mask;
+    };
+
+    struct Entry {
+        int node;
+        int mask;
+    };
+    std::vector<Entry> stack = {{0, 0x3F}};
+    while (!stack.empty()) {
+        const Entry entry = stack.back();
+        stack.pop_back();
+        const Node& node = nodes_[entry.node];
+        const int mask = classify(node.box, entry.mask);
+        if (mask < 0) {
+            continue;
+        }
+        if (node.count == 0) {
+            stack.push_back({node.first, mask});
+            stack.push_back({node.first + 1, mask});
+        } else if (mask == 0) {
+            // Entirely inside, so all objects are visible without further tests
+            visible.insert(visible.end(), objects_.begin() + node.first,
+                           objects_.begin() + node.first + node.count);
+        } else {
+            for (int k = node.first; k < node.first + node.count; k++) {
+                if (classify(boxes_[objects_[k]], mask) >= 0) {
+                    visible.push_back(objects_[k]);
+                }
+            }
+        }
+    }
+}
+
+int BVH::pick(const float origin[3], const float direction[3], float* distance) const {
+    if (objects_.empty()) {
+        return -1;
+    }
+    float invdir[3];
+    for (int c = 0; c < 3; c++) {
+        invdir[c] = 1.0f / direction[c];  // Infinite for axis parallel rays, which works
+    }
+    // Entry distance of the ray into a box, or infinity if it misses
+    auto hit = [&](const Box& box) {
+        float tmin = 0.0f;
+        float tmax = inf;
+        for (int c = 0; c < 3; c++) {
+            float t0 = (box.min[c] - origin[c]) * invdir[c];
+            float t1 = (box.max[c] - origin[c]) * invdir[c];
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            tmin = std::max(tmin, t0);
+            tmax = std::min(tmax, t1);
+        }
+        return (tmin <= tmax) ? tmin : inf;
+    };
+
+    int best = -1;
+    float besttime = inf;
+    struct Entry {
+        int node;
+        float time;
+    };
+    std::vector<Entry> stack;
+    const float roottime = hit(nodes_[0].box);
+    if (roottime < inf) {
+        stack.push_back({0, roottime});
+    }
+    while (!stack.empty()) {
+        const Entry entry = stack.back();
+        stack.pop_back();
+        if (entry.time >= besttime) {
+            continue;  // Something nearer was found after this node was pushed
+        }
+        const Node& node = nodes_[entry.node];
+        if (node.count > 0) {
+            for (int k = 0; k < node.count; k++) {
+                const int object = objects_[node.first + k];
+                const float t = hit(boxes_[object]);
+                if (t < besttime) {
+                    besttime = t;
+                    best = object;
+                }
+            }
+            continue;
+        }
+        // Visit the nearer child first, by pushing it last
+        float t0 = hit(nodes_[node.first].box);
+        float t1 = hit(nodes_[node.first + 1].box);
+        int near = node.first;
+        int far = node.first + 1;
+        if (t1 < t0) {
+            std::swap(t0, t1);
+            std::swap(near, far);
+        }
+        if (t1 < besttime) {
+            stack.push_back({far, t1});
+        }
+        if (t0 < besttime) {
+            stack.push_back({near, t0});
+        }
+    }
+    if (distance && best >= 0) {
+        *distance = besttime;
+    }
+    return best;
+}
+
+float BVH::sahCost() const {
+    if (nodes_.empty() || objects_.empty()) {
+        return 0.0f;
+    }
+    // Expected number of box tests for a random ray through the root box
+    double cost = 0.0;
+    for (const Node& node : nodes_) {
+        cost += double(halfArea(node.box)) * ((node.count > 0) ? node.count : 2);
+    }
+    const float rootarea = halfArea(nodes_[0].box);
+    return (rootarea > 0.0f) ? static_cast<float>(cost / rootarea) : 0.0f;
+}
+
+float BVH::degradation() const { return (buildcost_ > 0.0f) ? sahCost() / buildcost_ : 1.0f; }
+
+int BVH::objectCount() const { return static_cast<int>(objects_.size()); }
+
+int BVH::nodeCount() const { return static_cast<int>(nodes_.size()); }
+
+double BVH::buildTime() const { return buildtime_; }
+
+double BVH::refitTime() const { return refittime_; }
+
+void BVH::setProfiler(FrameProfiler* profiler) { profiler_ = profiler; }
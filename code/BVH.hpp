@@ -0,0 +1,110 @@
+/*
+ * A bounding volume hierarchy over the bounding boxes of many objects, for culling and
+ * picking without testing every object.
+ *
+ * Usage: Compute a box per object, e.g. with transformBounds() from the bounds() of its mesh
+ *        and its model-view matrix, and build() the tree once. Objects that move get new
+ *        boxes, and refit() updates the tree in linear time without changing its structure.
+ *        Refitting makes the tree less efficient as objects move apart, so build() again
+ *        when degradation() grows, e.g. above 1.5.
+ *        cull() finds the objects inside a frustum, skipping whole subtrees that are
+ *        outside or inside, and pick() finds the nearest object hit by a ray, such as the
+ *        one from MouseRotator::cursorRay().
+ *        The tree is built with the surface area heuristic (SAH) in 16 bins per split, with
+ *        the subtrees built as jobs of a ThreadPool. With setProfiler(), the times of build() and
+ *        refit() are recorded as the profiler scopes "bvh build" and "bvh refit".
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "Frustum.hpp"
+#include "Mat4.hpp"
+#include "MeshProcessing.hpp"
+
+class FrameProfiler;
+class JobCounter;
+class ThreadPool;
+
+// An axis aligned bounding box
+struct Box {
+    float min[3];
+    float max[3];
+};
+
+// The box around the bounding box of a mesh after transformation by a matrix
+// (Arvo, "Transforming Axis-Aligned Bounding Boxes", Graphics Gems, 1990)
+Box transformBounds(const mesh::Bounds& bounds, const Mat4& matrix);
+
+class BVH {
+public:
+    BVH();
+
+    /* Build the tree over 'boxes', one per object. With a pool, subtrees are built in
+     * parallel. */
+    void build(const std::vector<Box>& boxes, ThreadPool* pool = nullptr);
+
+    /* Update the boxes of the tree after the objects moved. 'boxes' has the same objects,
+     * in the same order, as in the last build(). */
+    void refit(const std::vector<Box>& boxes);
+
+    /* Append the numbers of the objects whose boxes are at least partly inside the frustum
+     * to 'visible', in no particular order */
+    void cull(const Frustum& frustum, std::vector<int>& visible) const;
+
+    /* The nearest object whose box is hit by the ray from 'origin' along 'direction',
+     * or -1 if none is. 'distance' receives the ray parameter where the box is entered. */
+    int pick(const float origin[3], const float direction[3], float* distance = nullptr) const;
+
+    // SAH cost of the tree now, relative to the cost right after the last build()
+    float degradation() const;
+
+    // Number of objects and nodes in the tree
+    int objectCount() const;
+    int nodeCount() const;
+
+    // Milliseconds spent in the last build() and refit()
+    double buildTime() const;
+    double refitTime() const;
+
+    // Record build() and refit() in this profiler, or nullptr for none
+    void setProfiler(FrameProfiler* profiler);
+
+private:
+    // Interior nodes have count == 0 and the children first and first + 1.
+    // Leaves have the objects objects_[first] ... objects_[first + count - 1].
+    struct Node {
+        Box box;
+        int first;
+        int count;
+    };
+
+    // A node to build, over objects_[begin] ... objects_[end - 1]
+    struct BuildTask {
+        int node;
+        int begin;
+        int end;
+    };
+
+    // Build the subtree of a node. With a pool, children of more than minJobSize objects
+    // are built by jobs counted in 'jobs'.
+    void buildNode(const BuildTask& task, ThreadPool* pool, JobCounter* jobs);
+
+    // Allocate two consecutive nodes, thread safe
+    int allocatePair();
+
+    float sahCost() const;
+
+    std::vector<Node> nodes_;
+    std::vector<int> objects_;        // Object numbers, in leaf order
+    std::vector<Box> boxes_;          // Boxes of the objects, for pick()
+    std::vector<float> centroids_;    // Box centers of the objects during build(), xyz
+    std::atomic<int> nodecount_;      // Nodes in use
+    float buildcost_;                 // SAH cost after the last build()
+    double buildtime_;                // Milliseconds of the last build()
+    double refittime_;                // Milliseconds of the last refit()
+    FrameProfiler* profiler_;
+};
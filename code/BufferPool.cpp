@@ -0,0 +1,356 @@
+/*
+ * GPU buffer slabs with a TLSF suballocator and fenced frees
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "BufferPool.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "GLDebug.hpp"
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+// Index of the lowest and the highest set bit of a value that is not zero
+int lowestBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(value);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<int>(index);
+#else
+    int index = 0;
+    while ((value & 1) == 0) {
+        value >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+int highestBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return static_cast<int>(index);
+#else
+    int index = 0;
+    while (value >>= 1) {
+        index++;
+    }
+    return index;
+#endif
+}
+
+}  // namespace
+
+BufferPool::BufferPool(size_t slabbytes)
+    : slabbytes_(std::max(slabbytes, alignment)), flbitmap_(0), used_(0), pendingunits_(0) {
+    std::fill(slbitmap_, slbitmap_ + flCount, 0u);
+    for (auto& lists : freelists_) {
+        std::fill(lists, lists + slCount, none);
+    }
+}
+
+BufferPool::~BufferPool() {
+    for (PendingFree& batch : pending_) {
+        if (batch.fence != nullptr) {
+            glDeleteSync(static_cast<GLsync>(batch.fence));
+        }
+    }
+    for (Slab& slab : slabs_) {
+        if (glIsBuffer(slab.buffer)) {
+            gpumem::deleteBuffers(1, &slab.buffer);
+        }
+    }
+}
+
+BufferPool& BufferPool::global() {
+    static BufferPool pool;
+    return pool;
+}
+
+/*
+ * The size classes: sizes below slCount have a list each (first level 0). Above that, each
+ * power of two is a first level, split into slCount second level lists of equal width.
+ */
+void BufferPool::mapping(size_t size, int& fl, int& sl) {
+    if (size < slCount) {
+        fl = 0;
+        sl = static_cast<int>(size);
+        return;
+    }
+    const int top = highestBit(size);
+    fl = top - slBits + 1;
+    sl = static_cast<int>(size >> (top - slBits)) - slCount;
+}
+
+uint32_t BufferPool::newBlock() {
+    if (!unusedblocks_.empty()) {
+        const uint32_t block = unusedblocks_.back();
+        unusedblocks_.pop_back();
+        return block;
+    }
+    blocks_.push_back(Block());
+    return static_cast<uint32_t>(blocks_.size() - 1);
+}
+
+void BufferPool::insertFree(uint32_t block) {
+    Block& b = blocks_[block];
+    int fl, sl;
+    mapping(b.size, fl, sl);
+    b.free = true;
+    b.prevfree = none;
+    b.nextfree = freelists_[fl][sl];
+    if (b.nextfree != none) {
+        blocks_[b.nextfree].prevfree = block;
+    }
+    freelists_[fl][sl] = block;
+    flbitmap_ |= uint64_t(1) << fl;
+    slbitmap_[fl] |= 1u << sl;
+}
+
+void BufferPool::removeFree(uint32_t block) {
+    Block& b = blocks_[block];
+    int fl, sl;
+    mapping(b.size, fl, sl);
+    if (b.prevfree != none) {
+        blocks_[b.prevfree].nextfree = b.nextfree;
+    } else {
+        freelists_[fl][sl] = b.nextfree;
+    }
+    if (b.nextfree != none) {
+        blocks_[b.nextfree].prevfree = b.prevfree;
+    }
+    b.free = false;
+    if (freelists_[fl][sl] == none) {
+        slbitmap_[fl] &= ~(1u << sl);
+        if (slbitmap_[fl] == 0) {
+            flbitmap_ &= ~(uint64_t(1) << fl);
+        }
+    }
+}
+
+uint32_t BufferPool::findFree(size_t size) {
+    // Round up to the next class, so that every block in the class found is large enough
+    if (size >= slCount) {
+        size += (size_t(1) << (highestBit(size) - slBits)) - 1;
+    }
+    int fl, sl;
+    mapping(size, fl, sl);
+    if (fl >= flCount) {
+        return none;
+    }
+    uint32_t slmap = slbitmap_[fl] & (~0u << sl);
+    if (slmap == 0) {
+        // Nothing in this first level, so take the smallest class of a larger one
+        const uint64_t flmap = (fl + 1 < 64) ? flbitmap_ & (~uint64_t(0) << (fl + 1)) : 0;
+        if (flmap == 0) {
+            return none;
+        }
+        fl = lowestBit(flmap);
+        slmap = slbitmap_[fl];
+    }
+    sl = lowestBit(slmap);
+    const uint32_t block = freelists_[fl][sl];
+    removeFree(block);
+    return block;
+}
+
+uint32_t BufferPool::createSlab(size_t size) {
+    GLuint buffer = 0;
+    if (glstate::directStateAccess() && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage)) {
+        // Immutable storage, written with glNamedBufferSubData() or through a mapping
+        glCreateBuffers(1, &buffer);
+        if (buffer == 0) {
+            return none;
+        }
+        glNamedBufferStorage(buffer, size * alignment, nullptr,
+                             GL_DYNAMIC_STORAGE_BIT | GL_MAP_WRITE_BIT);
+    } else {
+        glGenBuffers(1, &buffer);
+        if (buffer == 0) {
+            return none;
+        }
+        // GL_COPY_WRITE_BUFFER leaves the bindings of VAOs and draws alone
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, size * alignment, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    gpumem::setBuffer(buffer, gpumem::Category::Mesh, size * alignment);
+
+    uint32_t index = 0;
+    while (index < slabs_.size() && slabs_[index].buffer != 0) {
+        index++;
+    }
+    if (index == slabs_.size()) {
+        slabs_.push_back(Slab());
+    }
+    gldebug::label(GL_BUFFER, buffer, "BufferPool slab " + std::to_string(index));
+    const uint32_t block = newBlock();
+    blocks_[block] = {0, size, index, none, none, none, none, false};
+    slabs_[index] = {buffer, size, 0, block};
+    insertFree(block);
+    return block;
+}
+
+BufferAllocation BufferPool::allocate(size_t bytes) {
+    collect();
+
+    const size_t units = std::max<size_t>((bytes + alignment - 1) / alignment, 1);
+    const size_t slabunits = slabbytes_ / alignment;
+    uint32_t block = none;
+    if (units <= slabunits / 4) {
+        block = findFree(units);
+        if (block == none && createSlab(slabunits) != none) {
+            block = findFree(units);
+        }
+    } else {
+        block = createSlab(units);  // A slab of its own
+        if (block != none) {
+            removeFree(block);
+        }
+    }
+    if (block == none) {
+        std::cerr << "BufferPool: could not create a buffer for " << bytes << " bytes\n";
+        return {};
+    }
+
+    // Give back what is not needed as a block of its own
+    if (blocks_[block].size > units) {
+        const uint32_t rest = newBlock();
+        Block& b = blocks_[block];
+        blocks_[rest] = {b.offset + units, b.size - units, b.slab, block, b.next, none, none,
+                         false};
+        if (b.next != none) {
+            blocks_[b.next].prev = rest;
+        }
+        b.next = rest;
+        b.size = units;
+        insertFree(rest);
+    }
+
+    const Block& b = blocks_[block];
+    slabs_[b.slab].used += units;
+    used_ += units;
+    BufferAllocation allocation;
+    allocation.buffer = slabs_[b.slab].buffer;
+    allocation.offset = b.offset * alignment;
+    allocation.size = bytes;
+    allocation.block = block;
+    return allocation;
+}
+
+void BufferPool::free(BufferAllocation& allocation) {
+    if (!allocation) {
+        return;
+    }
+    if (pending_.empty() || pending_.back().fence != nullptr) {
+        pending_.push_back({{}, nullptr});
+    }
+    pending_.back().blocks.push_back(allocation.block);
+    pendingunits_ += blocks_[allocation.block].size;
+    allocation = BufferAllocation();
+}
+
+void BufferPool::collect() {
+    if (!pending_.empty() && pending_.back().fence == nullptr) {
+        pending_.back().fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    // The fences are passed in order, so stop at the first one that is not
+    size_t done = 0;
+    while (done < pending_.size()) {
+        GLsync fence = static_cast<GLsync>(pending_[done].fence);
+        const GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        glDeleteSync(fence);
+        for (uint32_t block : pending_[done].blocks) {
+            pendingunits_ -= blocks_[block].size;
+            release(block);
+        }
+        done++;
+    }
+    pending_.erase(pending_.begin(), pending_.begin() + static_cast<ptrdiff_t>(done));
+}
+
+void BufferPool::trim() {
+    for (Slab& slab : slabs_) {
+        // All blocks of a slab without allocations are merged into the first one
+        if (slab.buffer != 0 && slab.used == 0) {
+            removeFree(slab.first);
+            unusedblocks_.push_back(slab.first);
+            gpumem::deleteBuffers(1, &slab.buffer);
+            slab = {0, 0, 0, none};
+        }
+    }
+}
+
+void BufferPool::release(uint32_t block) {
+    Slab& slab = slabs_[blocks_[block].slab];
+    slab.used -= blocks_[block].size;
+    used_ -= blocks_[block].size;
+
+    // Merge with free neighbours
+    const uint32_t prev = blocks_[block].prev;
+    if (prev != none && blocks_[prev].free) {
+        removeFree(prev);
+        blocks_[prev].size += blocks_[block].size;
+        blocks_[prev].next = blocks_[block].next;
+        if (blocks_[block].next != none) {
+            blocks_[blocks_[block].next].prev = prev;
+        }
+        unusedblocks_.push_back(block);
+        block = prev;
+    }
+    const uint32_t next = blocks_[block].next;
+    if (next != none && blocks_[next].free) {
+        removeFree(next);
+        blocks_[block].size += blocks_[next].size;
+        blocks_[block].next = blocks_[next].next;
+        if (blocks_[next].next != none) {
+            blocks_[blocks_[next].next].prev = block;
+        }
+        unusedblocks_.push_back(next);
+    }
+
+    // A slab of a single large request goes with it
+    if (slab.used == 0 && slab.size != slabbytes_ / alignment) {
+        gpumem::deleteBuffers(1, &slab.buffer);
+        slab = {0, 0, 0, none};
+        unusedblocks_.push_back(block);
+        return;
+    }
+    insertFree(block);
+}
+
+size_t BufferPool::usedBytes() const { return used_ * alignment; }
+
+size_t BufferPool::pendingBytes() const { return pendingunits_ * alignment; }
+
+size_t BufferPool::capacity() const {
+    size_t units = 0;
+    for (const Slab& slab : slabs_) {
+        units += slab.size;
+    }
+    return units * alignment;
+}
+
+int BufferPool::slabs() const {
+    return static_cast<int>(std::count_if(slabs_.begin(), slabs_.end(),
+                                          [](const Slab& slab) { return slab.buffer != 0; }));
+}
@@ -0,0 +1,134 @@
+/*
+ * Large GPU buffers shared by many meshes, with a suballocator for the range of each mesh.
+ *
+ * Usage: allocate() a range for vertex or index data, write it with glBufferSubData() at the
+ *        offset of the allocation, and free() it when it is not drawn any more.
+ *        BufferPool::global() is the pool that TriangleSoup uses for its meshes.
+ *        The buffers are slabs of 'slabbytes' each, 64 MB by default, created when needed.
+ *        The ranges of a slab are managed by a two level segregated fit (TLSF) allocator:
+ *        the free ranges are kept in lists by size class, the first list that fits is
+ *        found in constant time with two levels of bitmaps, and a range is split when it is
+ *        allocated and merged with its free neighbours when it is freed. Requests larger
+ *        than a quarter of a slab get a slab of their own, which is deleted with them.
+ *        The GPU may still read a freed range for draw calls it has not executed yet, so a
+ *        range is only reused after a fence that follows its free() has been passed. The
+ *        frees since the last fence get a new fence at the next allocate() or collect().
+ *        Call collect() once per frame to reuse the freed ranges in time. Empty slabs are
+ *        kept for later allocations until trim() deletes them.
+ *        Use the pool only on the thread where the GL context is current.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* A range of a buffer from BufferPool::allocate() */
+struct BufferAllocation {
+    GLuint buffer = 0;   // Buffer object, 0 if there is no allocation
+    size_t offset = 0;   // Offset in the buffer, a multiple of BufferPool::alignment
+    size_t size = 0;     // Bytes requested
+    uint32_t block = 0;  // The range in the allocator
+
+    explicit operator bool() const { return buffer != 0; }
+};
+
+class BufferPool {
+public:
+    // Alignment of all ranges, enough for every vertex attribute and index type
+    static constexpr size_t alignment = 256;
+
+    /* Constructor: slabs of 'slabbytes', created on the first allocate() */
+    explicit BufferPool(size_t slabbytes = 64 << 20);
+
+    /* Destructor: delete the buffers and fences. Ranges still allocated become invalid. */
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // A range of 'bytes'. An empty allocation if the buffer cannot be created.
+    BufferAllocation allocate(size_t bytes);
+
+    // Give a range back once the GPU is done with it, and make 'allocation' empty
+    void free(BufferAllocation& allocation);
+
+    // Fence the frees since the last fence, and reuse the ranges whose fences have passed
+    void collect();
+
+    // Delete the slabs that have no ranges allocated, to give their memory back
+    void trim();
+
+    // Bytes allocated, including the alignment, and bytes freed but not reused yet
+    size_t usedBytes() const;
+    size_t pendingBytes() const;
+
+    // Bytes of all slabs, and their number
+    size_t capacity() const;
+    int slabs() const;
+
+    // The pool of the meshes
+    static BufferPool& global();
+
+private:
+    static constexpr int slBits = 4;  // log2 of the second level lists per first level
+    static constexpr int slCount = 1 << slBits;
+    static constexpr int flCount = 40;
+    static constexpr uint32_t none = ~0u;
+
+    // A range of a slab, free or used, in units of 'alignment'
+    struct Block {
+        size_t offset;
+        size_t size;
+        uint32_t slab;
+        uint32_t prev;      // Neighbours in the slab, by offset, or none
+        uint32_t next;
+        uint32_t prevfree;  // Neighbours in the free list of the size class, or none
+        uint32_t nextfree;
+        bool free;
+    };
+
+    struct Slab {
+        GLuint buffer;
+        size_t size;     // Units
+        size_t used;     // Units
+        uint32_t first;  // Block at offset 0
+    };
+
+    // Frees that wait for a fence
+    struct PendingFree {
+        std::vector<uint32_t> blocks;
+        void* fence;  // GLsync, nullptr until it is inserted
+    };
+
+    // Size class of 'size' units
+    static void mapping(size_t size, int& fl, int& sl);
+
+    // Create a slab of 'size' units. Returns its single free block, or none if it fails.
+    uint32_t createSlab(size_t size);
+
+    // A free block of at least 'size' units, removed from its list, or none
+    uint32_t findFree(size_t size);
+
+    void insertFree(uint32_t block);
+    void removeFree(uint32_t block);
+
+    uint32_t newBlock();
+
+    // Return a block to its slab, merged with free neighbours
+    void release(uint32_t block);
+
+    size_t slabbytes_;
+    std::vector<Slab> slabs_;
+    std::vector<Block> blocks_;
+    std::vector<uint32_t> unusedblocks_;  // Indices in blocks_ to reuse
+    uint64_t flbitmap_;                   // Bit fl is set if a list of that level is not empty
+    uint32_t slbitmap_[flCount];          // Bit sl is set if list (fl, sl) is not empty
+    uint32_t freelists_[flCount][slCount];
+    std::vector<PendingFree> pending_;
+    size_t used_;     // Units
+    size_t pendingunits_;
+};
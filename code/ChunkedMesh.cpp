@@ -0,0 +1,1057 @@
+/*
+ * Out-of-core meshes as a hierarchy of chunks with levels of detail, streamed to the GPU
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "ChunkedMesh.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "Trace.hpp"
+#include "Utilities.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+/*
+ * Header of the chunk file. The level data comes first, at offsets that are multiples of
+ * chunkFileAlignment, each the vertices of a level, 8 floats each as in TriangleSoup, then
+ * its indices, 16 bit for levels of at most 65535 vertices and 32 bit otherwise. The tables
+ * of the nodes and of the levels follow. The nodes of the tree are in an order where the
+ * children of a node are next to each other and after it, with the root first. All values
+ * are stored in the byte order of the writing machine, like TriangleSoup's mesh files.
+ */
+struct ChunkFileHeader {
+    char magic[8];          // "TNMCHNK" and a null
+    uint32_t version;       // chunkFileVersion
+    uint32_t numnodes;
+    uint32_t numlevels;     // Levels of detail of all nodes
+    uint32_t numtriangles;  // Triangles of the full mesh, saturated at 2^32 - 1
+    uint64_t nodeoffset;    // Offset of the ChunkFileNode table from the start of the file
+    uint64_t leveloffset;   // Offset of the ChunkFileLevel table
+    uint64_t sourcesize;    // Size of the OBJ file the chunks were made from
+    int64_t sourcetime;     // Modification time of that file
+};
+
+struct ChunkFileNode {
+    mesh::Bounds bounds;
+    int32_t firstchild;   // Index of the first child, -1 for a leaf
+    int32_t childcount;
+    uint32_t firstlevel;  // Index of the first level in the level table, the finest one
+    uint32_t levelcount;
+};
+
+struct ChunkFileLevel {
+    uint64_t offset;     // Of the vertices from the start of the file
+    uint32_t numverts;
+    uint32_t numtris;
+    uint32_t indexsize;  // Bytes per index
+    float error;         // Largest distance to the full mesh, in the units of the vertices
+};
+
+const char chunkFileMagic[8] = {'T', 'N', 'M', 'C', 'H', 'N', 'K', '\0'};
+const uint32_t chunkFileVersion = 1;
+const uint64_t chunkFileAlignment = 64;
+
+constexpr int floatsPerTriangle = 24;  // Three vertices of 8 floats
+constexpr int maxDepth = 20;           // Cells past this depth are leaves, however large
+constexpr int maxPending = 32;         // Levels asked for or loaded but not uploaded yet
+
+inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline const char* skipSpaces(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+// Advance p to the first character of the next line
+inline const char* skipLine(const char* p, const char* end) {
+    const void* eol = memchr(p, '\n', static_cast<size_t>(end - p));
+    return eol ? static_cast<const char*>(eol) + 1 : end;
+}
+
+template <typename T>
+bool parseNumber(const char*& p, const char* end, T& value) {
+    p = skipSpaces(p, end);
+    if (p < end && *p == '+') {
+        ++p;
+    }
+    const std::from_chars_result result = std::from_chars(p, end, value);
+    if (result.ec != std::errc()) {
+        return false;
+    }
+    p = result.ptr;
+    return true;
+}
+
+// Parse "x y z" or "s t" after the tag of a vertex line
+bool parseFloats(const char* p, const char* end, float* values, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!parseNumber(p, end, values[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Resolve an OBJ index, from 1 or negative from the last element so far, to count from 0
+bool resolveIndex(long long index, long long count, long long& resolved) {
+    resolved = (index < 0) ? count + index : index - 1;
+    return resolved >= 0 && resolved < count;
+}
+
+uint64_t alignChunkOffset(uint64_t offset) {
+    return (offset + chunkFileAlignment - 1) / chunkFileAlignment * chunkFileAlignment;
+}
+
+// The triangles of an octree cell in a temporary file, with the bounds of their vertices
+// and of their centroids
+struct Cell {
+    std::string filename;
+    FILE* file = nullptr;
+    uint64_t count = 0;
+    float min[3] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                    std::numeric_limits<float>::max()};
+    float max[3] = {-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(),
+                    -std::numeric_limits<float>::max()};
+    float centroidmin[3] = {std::numeric_limits<float>::max(),
+                            std::numeric_limits<float>::max(),
+                            std::numeric_limits<float>::max()};
+    float centroidmax[3] = {-std::numeric_limits<float>::max(),
+                            -std::numeric_limits<float>::max(),
+                            -std::numeric_limits<float>::max()};
+
+    bool add(const float* triangle) {
+        for (int c = 0; c < 3; c++) {
+            const float a = triangle[c];
+            const float b = triangle[8 + c];
+            const float d = triangle[16 + c];
+            min[c] = std::min(min[c], std::min(a, std::min(b, d)));
+            max[c] = std::max(max[c], std::max(a, std::max(b, d)));
+            const float centroid = (a + b + d) / 3.0f;
+            centroidmin[c] = std::min(centroidmin[c], centroid);
+            centroidmax[c] = std::max(centroidmax[c], centroid);
+        }
+        count++;
+        return fwrite(triangle, sizeof(float), floatsPerTriangle, file) == floatsPerTriangle;
+    }
+};
+
+// A mesh of 8 floats per vertex, the coarsest level of a node, to simplify its parent from
+struct Proxy {
+    std::vector<GLfloat> vertices;
+    std::vector<GLuint> indices;
+    float error = 0.0f;
+};
+
+// Weld the corners of 'triangles' that have the same 8 floats into shared vertices
+void weld(const std::vector<float>& triangles, std::vector<GLfloat>& vertices,
+          std::vector<GLuint>& indices) {
+    const GLuint empty = ~GLuint(0);
+    const size_t corners = triangles.size() / 8;
+    size_t capacity = 16;
+    while (capacity < 2 * corners) {
+        capacity *= 2;
+    }
+    std::vector<GLuint> table(capacity, empty);
+    vertices.clear();
+    indices.clear();
+    indices.reserve(corners);
+    for (size_t i = 0; i < corners; i++) {
+        const float* corner = &triangles[8 * i];
+        size_t slot = util::hashBytes(corner, 8 * sizeof(float)) & (capacity - 1);
+        while (table[slot] != empty &&
+               memcmp(&vertices[8 * size_t(table[slot])], corner, 8 * sizeof(float)) != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (table[slot] == empty) {
+            table[slot] = static_cast<GLuint>(vertices.size() / 8);
+            vertices.insert(vertices.end(), corner, corner + 8);
+        }
+        indices.push_back(table[slot]);
+    }
+}
+
+// Keep only the vertices of 'vertices' that 'indices' uses, in a cache friendly order
+void compact(std::vector<GLfloat>& vertices, std::vector<GLuint>& indices) {
+    indices = mesh::optimizeVertexCache(indices, static_cast<int>(vertices.size() / 8));
+    mesh::optimizeVertexFetch(vertices, 8, indices);
+    const GLuint used = 1 + *std::max_element(indices.begin(), indices.end());
+    vertices.resize(8 * size_t(used));
+}
+
+// The state of one build()
+struct Builder {
+    std::string tempname;       // Prefix of the temporary files
+    int tempcount = 0;
+    int chunktriangles;
+    int levels;
+    float ratio;
+    FILE* output = nullptr;
+    uint64_t position = 0;      // Bytes written to 'output'
+    std::vector<ChunkFileNode> nodes;
+    std::vector<ChunkFileLevel> levelrecords;
+    bool ok = true;
+
+    std::string nextTempName() { return tempname + std::to_string(tempcount++); }
+
+    void write(const void* data, size_t bytes) {
+        ok = ok && fwrite(data, 1, bytes, output) == bytes;
+        position += bytes;
+    }
+
+    // Append a level to the file and to the table of levels
+    void writeLevel(const std::vector<GLfloat>& vertices, const std::vector<GLuint>& indices,
+                    float error) {
+        const char padding[chunkFileAlignment] = {0};
+        const uint64_t offset = alignChunkOffset(position);
+        write(padding, offset - position);
+        ChunkFileLevel level = {};
+        level.offset = offset;
+        level.numverts = static_cast<uint32_t>(vertices.size() / 8);
+        level.numtris = static_cast<uint32_t>(indices.size() / 3);
+        level.indexsize = (level.numverts <= 65535) ? sizeof(GLushort) : sizeof(GLuint);
+        level.error = error;
+        write(vertices.data(), vertices.size() * sizeof(GLfloat));
+        if (level.indexsize == sizeof(GLushort)) {
+            const std::vector<GLushort> shortindices(indices.begin(), indices.end());
+            write(shortindices.data(), shortindices.size() * sizeof(GLushort));
+        } else {
+            write(indices.data(), indices.size() * sizeof(GLuint));
+        }
+        levelrecords.push_back(level);
+    }
+
+    // The triangles of an inner node, and of the level of each node that its parent is
+    // simplified from
+    size_t innerTriangles() const {
+        return std::max(static_cast<size_t>(float(chunktriangles) * ratio), size_t(1));
+    }
+
+    // Make the node 'index' from the triangles of 'cell', which is deleted, and return the
+    // finest level of the node with at most innerTriangles() in 'proxy', or the coarsest
+    void buildNode(Cell& cell, int index, int depth, Proxy& proxy) {
+        const float extent = std::max(cell.centroidmax[0] - cell.centroidmin[0],
+                                      std::max(cell.centroidmax[1] - cell.centroidmin[1],
+                                               cell.centroidmax[2] - cell.centroidmin[2]));
+        if (cell.count <= uint64_t(chunktriangles) || depth >= maxDepth || !(extent > 0.0f)) {
+            buildLeaf(cell, index, proxy);
+        } else {
+            buildInner(cell, index, depth, proxy);
+        }
+    }
+
+    void buildLeaf(Cell& cell, int index, Proxy& proxy) {
+        std::vector<float> triangles(cell.count * floatsPerTriangle);
+        FILE* file = fopen(cell.filename.c_str(), "rb");
+        ok = ok && file && fread(triangles.data(), sizeof(float), triangles.size(), file) ==
+                               triangles.size();
+        if (file) {
+            fclose(file);
+        }
+        std::remove(cell.filename.c_str());
+        if (!ok) {
+            return;
+        }
+
+        std::vector<GLfloat> vertices;
+        std::vector<GLuint> indices;
+        weld(triangles, vertices, indices);
+        std::vector<float>().swap(triangles);
+        compact(vertices, indices);
+
+        ChunkFileNode& node = nodes[index];
+        node.bounds = mesh::computeBounds(vertices.data(), static_cast<int>(vertices.size() / 8),
+                                          8);
+        node.firstchild = -1;
+        node.childcount = 0;
+        node.firstlevel = static_cast<uint32_t>(levelrecords.size());
+        writeLevel(vertices, indices, 0.0f);
+        const size_t proxytris = innerTriangles();
+        auto keepProxy = [&](float error) {
+            if (proxy.indices.empty() && indices.size() <= 3 * proxytris) {
+                proxy.vertices = vertices;
+                proxy.indices = indices;
+                proxy.error = error;
+            }
+        };
+        keepProxy(0.0f);
+
+        // Each level is simplified from the one before, and the errors add up, as in
+        // TriangleSoup::generateLODs(). The borders stay where they are, so that the leaves
+        // next to each other meet at every level. A level of less than a quarter of an
+        // inner node is the last, since the parent is drawn before coarser ones would be.
+        float error = 0.0f;
+        for (int level = 1; level < levels && 4 * indices.size() > 3 * proxytris; level++) {
+            const size_t previous = indices.size() / 3;
+            float levelerror = 0.0f;
+            std::vector<GLuint> coarser = mesh::simplify(
+                indices, vertices, 8, 3 * static_cast<size_t>(float(previous) * ratio),
+                &levelerror, true);
+            if (coarser.empty() || 10 * coarser.size() > 27 * previous) {
+                break;
+            }
+            indices.swap(coarser);
+            compact(vertices, indices);
+            error += levelerror;
+            writeLevel(vertices, indices, error);
+            keepProxy(error);
+        }
+        nodes[index].levelcount =
+            static_cast<uint32_t>(levelrecords.size()) - nodes[index].firstlevel;
+        if (proxy.indices.empty()) {
+            proxy.vertices.swap(vertices);
+            proxy.indices.swap(indices);
+            proxy.error = error;
+        }
+    }
+
+    void buildInner(Cell& cell, int index, int depth, Proxy& proxy) {
+        // Split the triangles by their centroids at the center of the centroids, along the
+        // axes where the cell is at least half as large as along the largest one, so that
+        // the cells of a surface stay about as wide as they are long
+        float split[3];
+        float largest = 0.0f;
+        for (int c = 0; c < 3; c++) {
+            largest = std::max(largest, cell.centroidmax[c] - cell.centroidmin[c]);
+        }
+        for (int c = 0; c < 3; c++) {
+            split[c] = (cell.centroidmax[c] - cell.centroidmin[c] >= 0.5f * largest)
+                           ? 0.5f * (cell.centroidmin[c] + cell.centroidmax[c])
+                           : std::numeric_limits<float>::max();
+        }
+        Cell children[8];
+        FILE* file = fopen(cell.filename.c_str(), "rb");
+        ok = ok && file;
+        std::vector<float> block(4096 * floatsPerTriangle);
+        for (uint64_t done = 0; ok && done < cell.count;) {
+            const size_t count = static_cast<size_t>(std::min<uint64_t>(4096, cell.count - done));
+            ok = fread(block.data(), sizeof(float) * floatsPerTriangle, count, file) == count;
+            for (size_t t = 0; ok && t < count; t++) {
+                const float* triangle = &block[floatsPerTriangle * t];
+                int octant = 0;
+                for (int c = 0; c < 3; c++) {
+                    const float centroid =
+                        (triangle[c] + triangle[8 + c] + triangle[16 + c]) / 3.0f;
+                    octant |= (centroid > split[c]) ? (1 << c) : 0;
+                }
+                Cell& child = children[octant];
+                if (!child.file) {
+                    child.filename = nextTempName();
+                    child.file = fopen(child.filename.c_str(), "wb");
+                    ok = child.file != nullptr;
+                }
+                ok = ok && child.add(triangle);
+            }
+            done += count;
+        }
+        if (file) {
+            fclose(file);
+        }
+        std::remove(cell.filename.c_str());
+        int childcount = 0;
+        for (Cell& child : children) {
+            if (child.file) {
+                ok = (fclose(child.file) == 0) && ok;
+                child.file = nullptr;
+                childcount++;
+            }
+        }
+
+        // The children are next to each other in the table, after all nodes so far
+        const int firstchild = static_cast<int>(nodes.size());
+        nodes.resize(nodes.size() + size_t(childcount));
+        nodes[index].firstchild = firstchild;
+        nodes[index].childcount = childcount;
+        std::vector<float> soup;  // The coarsest levels of the children, as triangles
+        float childerror = 0.0f;
+        int child = firstchild;
+        for (Cell& childcell : children) {
+            if (childcell.count == 0) {
+                continue;
+            }
+            Proxy childproxy;
+            if (ok) {
+                buildNode(childcell, child, depth + 1, childproxy);
+            } else {
+                std::remove(childcell.filename.c_str());
+            }
+            for (GLuint i : childproxy.indices) {
+                const GLfloat* vertex = &childproxy.vertices[8 * size_t(i)];
+                soup.insert(soup.end(), vertex, vertex + 8);
+            }
+            childerror = std::max(childerror, childproxy.error);
+            child++;
+        }
+        if (!ok || soup.empty()) {
+            ok = false;
+            return;
+        }
+
+        // The bounds around those of the children
+        mesh::Bounds& bounds = nodes[index].bounds;
+        const mesh::Bounds& first = nodes[firstchild].bounds;
+        std::copy(first.min, first.min + 3, bounds.min);
+        std::copy(first.max, first.max + 3, bounds.max);
+        for (int i = firstchild + 1; i < firstchild + childcount; i++) {
+            for (int c = 0; c < 3; c++) {
+                bounds.min[c] = std::min(bounds.min[c], nodes[i].bounds.min[c]);
+                bounds.max[c] = std::max(bounds.max[c], nodes[i].bounds.max[c]);
+            }
+        }
+        bounds.radius = 0.0f;
+        for (int c = 0; c < 3; c++) {
+            bounds.center[c] = 0.5f * (bounds.min[c] + bounds.max[c]);
+        }
+        for (int i = firstchild; i < firstchild + childcount; i++) {
+            const mesh::Bounds& b = nodes[i].bounds;
+            const float dx = b.center[0] - bounds.center[0];
+            const float dy = b.center[1] - bounds.center[1];
+            const float dz = b.center[2] - bounds.center[2];
+            bounds.radius =
+                std::max(bounds.radius, std::sqrt(dx * dx + dy * dy + dz * dz) + b.radius);
+        }
+
+        // One level from the coarsest levels of the children. Their borders are the same
+        // vertices on both sides, so the welded mesh is whole inside the node, and only
+        // its own border stays where it is.
+        Proxy merged;
+        weld(soup, merged.vertices, merged.indices);
+        std::vector<float>().swap(soup);
+        merged.error = childerror;
+        float levelerror = 0.0f;
+        std::vector<GLuint> coarser = mesh::simplify(merged.indices, merged.vertices, 8,
+                                                     3 * innerTriangles(), &levelerror, true);
+        if (!coarser.empty()) {
+            merged.indices.swap(coarser);
+            merged.error += levelerror;
+        }
+        compact(merged.vertices, merged.indices);
+        nodes[index].firstlevel = static_cast<uint32_t>(levelrecords.size());
+        nodes[index].levelcount = 1;
+        writeLevel(merged.vertices, merged.indices, merged.error);
+        proxy = std::move(merged);
+    }
+};
+
+}  // namespace
+
+/*
+ * Build a chunk file from an OBJ file, in two passes over the memory mapped OBJ file
+ */
+bool ChunkedMesh::build(const std::string& objfile, const std::string& chunkfile,
+                        int chunktriangles, int levels, float ratio) {
+    const auto starttime = std::chrono::steady_clock::now();
+    MappedFile obj(objfile);
+    if (!obj.isOpen()) {
+        std::cerr << "File not found: " << objfile << "\n";
+        return false;
+    }
+    const char* const end = obj.data() + obj.size();
+
+    Builder builder;
+    builder.tempname = chunkfile + ".tmp";
+    builder.chunktriangles = std::max(chunktriangles, 16);
+    builder.levels = std::max(levels, 1);
+    builder.ratio = std::clamp(ratio, 0.01f, 0.9f);
+
+    // The first pass writes the vertices, the normals and the texture coordinates of the
+    // file to one temporary file each
+    const std::string attributenames[3] = {builder.nextTempName(), builder.nextTempName(),
+                                           builder.nextTempName()};
+    auto removeAttributes = [&]() {
+        for (const std::string& name : attributenames) {
+            std::remove(name.c_str());
+        }
+    };
+    FILE* attributes[3];
+    long long counts[3] = {0, 0, 0};
+    const int sizes[3] = {3, 3, 2};
+    bool ok = true;
+    for (int a = 0; a < 3; a++) {
+        attributes[a] = fopen(attributenames[a].c_str(), "wb");
+        ok = ok && attributes[a];
+    }
+    long long line = 1;
+    for (const char* p = obj.data(); ok && p < end; p = skipLine(p, end), line++) {
+        p = skipSpaces(p, end);
+        if (p + 1 >= end || *p != 'v') {
+            continue;
+        }
+        const int a = isSpace(p[1]) ? 0 : (p[1] == 'n') ? 1 : (p[1] == 't') ? 2 : -1;
+        if (a < 0) {
+            continue;
+        }
+        float values[3];
+        if (!parseFloats(p + (a == 0 ? 1 : 2), end, values, sizes[a])) {
+            std::cerr << objfile << ":" << line << ": malformed vertex data\n";
+            ok = false;
+            break;
+        }
+        ok = fwrite(values, sizeof(float), size_t(sizes[a]), attributes[a]) == size_t(sizes[a]);
+        counts[a]++;
+    }
+    for (FILE* file : attributes) {
+        ok = file && (fclose(file) == 0) && ok;
+    }
+    MappedFile mapped[3];
+    for (int a = 0; ok && a < 3; a++) {
+        ok = counts[a] == 0 || mapped[a].open(attributenames[a]);
+    }
+    if (!ok) {
+        std::cerr << "ChunkedMesh::build(\"" << chunkfile << "\"): could not write "
+                  << builder.tempname << "*\n";
+        removeAttributes();
+        return false;
+    }
+
+    // The second pass expands the faces into triangles of 24 floats in the root cell
+    Cell root;
+    root.filename = builder.nextTempName();
+    root.file = fopen(root.filename.c_str(), "wb");
+    ok = root.file != nullptr;
+    long long seen[3] = {0, 0, 0};
+    line = 1;
+    for (const char* p = obj.data(); ok && p < end; p = skipLine(p, end), line++) {
+        p = skipSpaces(p, end);
+        if (p + 1 >= end) {
+            continue;
+        }
+        if (*p == 'v') {
+            const int a = isSpace(p[1]) ? 0 : (p[1] == 'n') ? 1 : (p[1] == 't') ? 2 : -1;
+            if (a >= 0) {
+                seen[a]++;
+            }
+            continue;
+        }
+        if (*p != 'f' || !isSpace(p[1])) {
+            continue;
+        }
+        // Three vertices on the form v/t/n, into x y z nx ny nz s t
+        p++;
+        float triangle[floatsPerTriangle];
+        bool valid = true;
+        for (int k = 0; k < 3 && valid; k++) {
+            long long index[3];  // In the order v, t, n of the file
+            valid = parseNumber(p, end, index[0]) && p < end && *p++ == '/' &&
+                    parseNumber(p, end, index[1]) && p < end && *p++ == '/' &&
+                    parseNumber(p, end, index[2]);
+            long long v, t, n;
+            valid = valid && resolveIndex(index[0], seen[0], v) &&
+                    resolveIndex(index[1], seen[2], t) && resolveIndex(index[2], seen[1], n);
+            if (valid) {
+                const float* data[3] = {reinterpret_cast<const float*>(mapped[0].data()),
+                                        reinterpret_cast<const float*>(mapped[1].data()),
+                                        reinterpret_cast<const float*>(mapped[2].data())};
+                std::copy_n(data[0] + 3 * v, 3, triangle + 8 * k);
+                std::copy_n(data[1] + 3 * n, 3, triangle + 8 * k + 3);
+                std::copy_n(data[2] + 2 * t, 2, triangle + 8 * k + 6);
+            }
+        }
+        p = skipSpaces(p, end);
+        if (!valid || (p < end && *p != '\n' && *p != '#')) {
+            // Only triangles, as for readOBJ()
+            std::cerr << objfile << ":" << line << ": malformed face, expected a triangle "
+                      << "with v/t/n indices\n";
+            ok = false;
+            break;
+        }
+        ok = root.add(triangle);
+    }
+    ok = root.file && (fclose(root.file) == 0) && ok;
+    root.file = nullptr;
+    for (MappedFile& file : mapped) {
+        file.close();
+    }
+    removeAttributes();
+    if (!ok || root.count == 0) {
+        if (ok) {
+            std::cerr << "ChunkedMesh::build(): " << objfile << " has no triangles\n";
+        }
+        std::remove(root.filename.c_str());
+        return false;
+    }
+
+    // The octree, written depth first with the header in front
+    builder.output = fopen(chunkfile.c_str(), "wb");
+    if (!builder.output) {
+        std::cerr << "ChunkedMesh::build(\"" << chunkfile << "\"): could not create file\n";
+        std::remove(root.filename.c_str());
+        return false;
+    }
+    ChunkFileHeader header = {};
+    builder.write(&header, sizeof(header));
+    builder.nodes.resize(1);
+    Proxy proxy;
+    builder.buildNode(root, 0, 0, proxy);
+
+    const char padding[chunkFileAlignment] = {0};
+    header.nodeoffset = alignChunkOffset(builder.position);
+    builder.write(padding, header.nodeoffset - builder.position);
+    builder.write(builder.nodes.data(), builder.nodes.size() * sizeof(ChunkFileNode));
+    header.leveloffset = builder.position;
+    builder.write(builder.levelrecords.data(),
+                  builder.levelrecords.size() * sizeof(ChunkFileLevel));
+    memcpy(header.magic, chunkFileMagic, sizeof(chunkFileMagic));
+    header.version = chunkFileVersion;
+    header.numnodes = static_cast<uint32_t>(builder.nodes.size());
+    header.numlevels = static_cast<uint32_t>(builder.levelrecords.size());
+    header.numtriangles = static_cast<uint32_t>(std::min<uint64_t>(root.count, ~uint32_t(0)));
+    util::fileStamp(objfile, header.sourcesize, header.sourcetime);
+    ok = builder.ok && fseek(builder.output, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, builder.output) == 1;
+    ok = (fclose(builder.output) == 0) && ok;
+    if (!ok) {
+        std::cerr << "ChunkedMesh::build(\"" << chunkfile << "\"): write error\n";
+        std::remove(chunkfile.c_str());
+        return false;
+    }
+
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - starttime).count();
+    std::cout << "ChunkedMesh::build(\"" << chunkfile << "\"): " << root.count
+              << " triangles in " << builder.nodes.size() << " nodes with "
+              << builder.levelrecords.size() << " levels, " << seconds << " s\n";
+    return true;
+}
+
+size_t ChunkedMesh::Level::bytes() const {
+    return size_t(numverts) * 8 * sizeof(GLfloat) + 3 * size_t(numtris) * indexsize;
+}
+
+ChunkedMesh::ChunkedMesh(size_t gpubytes, size_t uploadbytes)
+    : pixelerror_(1.0f), gpubytes_(gpubytes), limit_(gpubytes), uploadbytes_(uploadbytes),
+      residentbytes_(0), residentcount_(0), pendingcount_(0), drawntriangles_(0), frame_(0),
+      MV_(Mat4::identity()), pixelsperunit_(1.0f), scale_(1.0f), perspective_(true),
+      frustum_(), stop_(false) {}
+
+ChunkedMesh::~ChunkedMesh() { close(); }
+
+bool ChunkedMesh::open(const std::string& chunkfile, const std::string& sourcefile) {
+    close();
+    if (!file_.open(chunkfile)) {
+        return false;
+    }
+    ChunkFileHeader header;
+    bool valid = file_.size() >= sizeof(header);
+    if (valid) {
+        memcpy(&header, file_.data(), sizeof(header));
+        valid = memcmp(header.magic, chunkFileMagic, sizeof(chunkFileMagic)) == 0 &&
+                header.version == chunkFileVersion && header.numnodes > 0 &&
+                header.nodeoffset + uint64_t(header.numnodes) * sizeof(ChunkFileNode) <=
+                    file_.size() &&
+                header.leveloffset + uint64_t(header.numlevels) * sizeof(ChunkFileLevel) <=
+                    file_.size();
+    }
+    if (valid && !sourcefile.empty()) {
+        uint64_t size = 0;
+        int64_t time = 0;
+        valid = util::fileStamp(sourcefile, size, time) && size == header.sourcesize &&
+                time == header.sourcetime;
+    }
+    if (!valid) {
+        file_.close();
+        return false;
+    }
+
+    nodes_.assign(header.numnodes, Node{});
+    levels_.resize(header.numlevels);
+    for (uint32_t i = 0; valid && i < header.numlevels; i++) {
+        ChunkFileLevel record;
+        memcpy(&record, file_.data() + header.leveloffset + i * sizeof(record), sizeof(record));
+        Level& level = levels_[i];
+        level.offset = record.offset;
+        level.numverts = record.numverts;
+        level.numtris = record.numtris;
+        level.indexsize = record.indexsize;
+        level.error = record.error;
+        level.node = -1;
+        valid = (level.indexsize == sizeof(GLushort) || level.indexsize == sizeof(GLuint)) &&
+                level.offset + level.bytes() <= file_.size();
+    }
+    for (uint32_t i = 0; valid && i < header.numnodes; i++) {
+        ChunkFileNode record;
+        memcpy(&record, file_.data() + header.nodeoffset + i * sizeof(record), sizeof(record));
+        Node& node = nodes_[i];
+        node.bounds = record.bounds;
+        node.firstchild = record.firstchild;
+        node.childcount = record.childcount;
+        node.firstlevel = static_cast<int>(record.firstlevel);
+        node.levelcount = static_cast<int>(record.levelcount);
+        // Children come after their parent, so the depths are known in order
+        valid = record.levelcount > 0 &&
+                uint64_t(record.firstlevel) + record.levelcount <= header.numlevels &&
+                (record.childcount == 0 ||
+                 (record.firstchild > int32_t(i) && record.childcount > 0 &&
+                  int64_t(record.firstchild) + record.childcount <= int64_t(header.numnodes)));
+        for (int c = 0; valid && c < node.childcount; c++) {
+            nodes_[node.firstchild + c].depth = node.depth + 1;
+        }
+        for (int l = node.firstlevel; valid && l < node.firstlevel + node.levelcount; l++) {
+            levels_[l].node = static_cast<int>(i);
+        }
+    }
+    if (!valid) {
+        std::cerr << "ChunkedMesh::open(\"" << chunkfile << "\"): damaged file\n";
+        close();
+        return false;
+    }
+    startLoader();
+    return true;
+}
+
+void ChunkedMesh::close() {
+    stopLoader();
+    for (Level& level : levels_) {
+        if (level.state == State::Resident) {
+            evict(level);
+        }
+    }
+    queue_.clear();
+    loaded_.clear();
+    nodes_.clear();
+    levels_.clear();
+    drawn_.clear();
+    requests_.clear();
+    pendingcount_ = 0;
+    drawntriangles_ = 0;
+    file_.close();
+}
+
+void ChunkedMesh::setPixelError(float pixels) { pixelerror_ = std::max(pixels, 0.0f); }
+
+void ChunkedMesh::update(const Mat4& P, const Mat4& MV, int viewportheight) {
+    drawn_.clear();
+    requests_.clear();
+    drawntriangles_ = 0;
+    if (nodes_.empty()) {
+        return;
+    }
+    frame_++;
+
+    // Pixels per unit at a distance of one, as in TriangleSoup::selectLODs()
+    MV_ = MV;
+    frustum_ = Frustum::fromMatrix(P * MV);
+    perspective_ = (P.m[11] != 0.0f);
+    pixelsperunit_ = 0.5f * static_cast<float>(viewportheight) * std::fabs(P.m[5]);
+    float scale2 = 0.0f;
+    for (int column = 0; column < 3; column++) {
+        const float* c = MV.m + 4 * column;
+        scale2 = std::max(scale2, c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+    }
+    scale_ = std::sqrt(scale2);
+    select(0, 0);
+
+    // Over the budget of the meshes, do with less than gpubytes_. Freed ranges count as
+    // free room, since they are reused once the GPU is done with them.
+    limit_ = gpubytes_;
+    BufferPool& pool = BufferPool::global();
+    if (gpumem::headroom(gpumem::Category::Mesh) < 0) {
+        pool.trim();
+    }
+    const long long headroom = gpumem::headroom(gpumem::Category::Mesh);
+    if (headroom < static_cast<long long>(gpubytes_)) {
+        const long long room =
+            headroom + static_cast<long long>(pool.capacity() - pool.usedBytes()) +
+            static_cast<long long>(pool.pendingBytes());
+        limit_ = static_cast<size_t>(std::clamp(static_cast<long long>(residentbytes_) + room,
+                                                0LL, static_cast<long long>(gpubytes_)));
+        makeRoom(0);
+    }
+
+    // Upload what the loader thread has read, within the upload budget
+    size_t uploaded = 0;
+    while (true) {
+        int index;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (loaded_.empty() ||
+                (uploaded > 0 && uploaded + levels_[loaded_.front()].bytes() > uploadbytes_)) {
+                break;
+            }
+            index = loaded_.front();
+            loaded_.pop_front();
+        }
+        Level& level = levels_[index];
+        if (level.used == frame_ && !makeRoom(level.bytes())) {
+            // Wait until the levels of this frame leave room for it, without loading it again
+            std::lock_guard<std::mutex> lock(mutex_);
+            loaded_.push_front(index);
+            break;
+        }
+        // A level that is not needed any more only uses free room
+        pendingcount_--;
+        if (residentbytes_ + level.bytes() <= limit_) {
+            upload(level);
+            uploaded += level.bytes();
+        } else {
+            level.state = State::Absent;
+        }
+        std::vector<char>().swap(level.data);
+    }
+
+    // Ask for the missing levels again, coarse nodes first and then those that are
+    // largest on the screen, in place of the ones that the loader has not started
+    std::sort(requests_.begin(), requests_.end(), [](const Request& a, const Request& b) {
+        return a.depth != b.depth ? a.depth < b.depth : a.pixels > b.pixels;
+    });
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int index : queue_) {
+            levels_[index].state = State::Absent;
+            pendingcount_--;
+        }
+        queue_.clear();
+        for (const Request& request : requests_) {
+            if (pendingcount_ >= maxPending) {
+                break;
+            }
+            Level& level = levels_[request.level];
+            if (level.state == State::Absent) {
+                level.state = State::Queued;
+                queue_.push_back(request.level);
+                pendingcount_++;
+            }
+        }
+    }
+    condition_.notify_one();
+}
+
+void ChunkedMesh::render() {
+    // The vertex format of vertex.glsl, as TriangleSoup::bindForDrawing() sets it for floats
+    glVertexAttrib4f(3, 1.0f, 1.0f, 1.0f, 0.0f);
+    glVertexAttrib3f(4, 0.0f, 0.0f, 0.0f);
+    for (int index : drawn_) {
+        const Level& level = levels_[index];
+        glstate::bindVertexArray(level.vao);
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(3 * level.numtris),
+                       level.indexsize == sizeof(GLushort) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                       (void*)(level.buffer.offset + size_t(level.numverts) * 8 * sizeof(GLfloat)));
+    }
+    glstate::bindVertexArray(0);
+}
+
+const mesh::Bounds& ChunkedMesh::bounds() const {
+    static const mesh::Bounds empty;
+    return nodes_.empty() ? empty : nodes_[0].bounds;
+}
+
+int ChunkedMesh::nodeCount() const { return static_cast<int>(nodes_.size()); }
+
+int ChunkedMesh::levelCount() const { return static_cast<int>(levels_.size()); }
+
+int ChunkedMesh::residentCount() const { return residentcount_; }
+
+size_t ChunkedMesh::residentBytes() const { return residentbytes_; }
+
+int ChunkedMesh::pendingCount() const { return pendingcount_; }
+
+int ChunkedMesh::drawnTriangles() const { return drawntriangles_; }
+
+/* Choose what to draw of the node 'index' and below, and ask for what is missing */
+void ChunkedMesh::select(int index, int depth) {
+    const Node& node = nodes_[index];
+    if (!frustum_.intersects(node.bounds)) {
+        return;
+    }
+    if (node.childcount > 0 && pixelError(node, levels_[node.firstlevel].error) > pixelerror_) {
+        // The children replace the node when all of those in view have something to draw
+        bool ready = true;
+        for (int child = node.firstchild; child < node.firstchild + node.childcount; child++) {
+            if (frustum_.intersects(nodes_[child].bounds)) {
+                want(chooseLevel(child), depth + 1);
+                ready = ready && anyResident(child);
+            }
+        }
+        if (ready || !anyResident(index)) {
+            if (!ready) {
+                want(node.firstlevel, depth);
+            }
+            for (int child = node.firstchild; child < node.firstchild + node.childcount;
+                 child++) {
+                select(child, depth + 1);
+            }
+            return;
+        }
+    }
+    const int level = chooseLevel(index);
+    want(level, depth);
+    draw(index, level);
+}
+
+/* The error on the screen, in pixels, of 'error' at the nearest point of the node */
+float ChunkedMesh::pixelError(const Node& node, float error) const {
+    if (!perspective_) {
+        return error * scale_ * pixelsperunit_;
+    }
+    const float* m = MV_.m;
+    const float* c = node.bounds.center;
+    const float z = m[2] * c[0] + m[6] * c[1] + m[10] * c[2] + m[14];
+    const float distance = -z - node.bounds.radius * scale_;
+    if (distance <= 0.0f) {
+        return error > 0.0f ? std::numeric_limits<float>::max() : 0.0f;
+    }
+    return error * scale_ * pixelsperunit_ / distance;
+}
+
+/* The coarsest level of the node whose error is small enough on the screen */
+int ChunkedMesh::chooseLevel(int index) const {
+    const Node& node = nodes_[index];
+    int level = node.firstlevel;
+    while (level + 1 < node.firstlevel + node.levelcount &&
+           pixelError(node, levels_[level + 1].error) <= pixelerror_) {
+        level++;
+    }
+    return level;
+}
+
+bool ChunkedMesh::anyResident(int index) const {
+    const Node& node = nodes_[index];
+    for (int level = node.firstlevel; level < node.firstlevel + node.levelcount; level++) {
+        if (levels_[level].state == State::Resident) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Keep the level on the GPU in this frame, or ask for it */
+void ChunkedMesh::want(int index, int depth) {
+    Level& level = levels_[index];
+    if (level.state != State::Resident && level.used != frame_) {
+        const Node& node = nodes_[level.node];
+        requests_.push_back(Request{depth, pixelError(node, node.bounds.radius), index});
+    }
+    level.used = frame_;
+}
+
+/* Draw the level, or the nearest one of the node that is on the GPU, coarser ones first */
+void ChunkedMesh::draw(int index, int level) {
+    const Node& node = nodes_[index];
+    const int last = node.firstlevel + node.levelcount - 1;
+    for (int step = 0; step < node.levelcount; step++) {
+        for (const int candidate : {level + step, level - step}) {
+            if (candidate >= node.firstlevel && candidate <= last &&
+                levels_[candidate].state == State::Resident) {
+                levels_[candidate].used = frame_;
+                drawn_.push_back(candidate);
+                drawntriangles_ += static_cast<int>(levels_[candidate].numtris);
+                return;
+            }
+        }
+    }
+}
+
+/* Copy the loaded data of a level into a range of the buffer pool, with a VAO of its own */
+void ChunkedMesh::upload(Level& level) {
+    BufferPool& pool = BufferPool::global();
+    level.buffer = pool.allocate(level.data.size());
+    if (!level.buffer) {
+        level.state = State::Absent;
+        return;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, level.buffer.buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, level.buffer.offset, level.data.size(),
+                    level.data.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glGenVertexArrays(1, &level.vao);
+    glstate::bindVertexArray(level.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, level.buffer.buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, level.buffer.buffer);
+    const GLsizei stride = 8 * sizeof(GLfloat);
+    const size_t offset = level.buffer.offset;
+    glEnableVertexAttribArray(0);  // Vertex coordinates
+    glEnableVertexAttribArray(1);  // Normals
+    glEnableVertexAttribArray(2);  // Texture coordinates
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(offset + 3 * sizeof(GLfloat)));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(offset + 6 * sizeof(GLfloat)));
+    glstate::bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    level.state = State::Resident;
+    residentbytes_ += level.bytes();
+    residentcount_++;
+}
+
+void ChunkedMesh::evict(Level& level) {
+    BufferPool::global().free(level.buffer);
+    glstate::deleteVertexArrays(1, &level.vao);
+    level.vao = 0;
+    level.state = State::Absent;
+    residentbytes_ -= level.bytes();
+    residentcount_--;
+}
+
+/* Free the levels that were needed the longest time ago until 'bytes' more fit in the
+ * budget. False if the levels of this frame alone fill it. */
+bool ChunkedMesh::makeRoom(size_t bytes) {
+    while (residentbytes_ + bytes > limit_) {
+        Level* oldest = nullptr;
+        for (Level& level : levels_) {
+            if (level.state == State::Resident && level.used < frame_ &&
+                (oldest == nullptr || level.used < oldest->used)) {
+                oldest = &level;
+            }
+        }
+        if (oldest == nullptr) {
+            return false;
+        }
+        evict(*oldest);
+    }
+    return true;
+}
+
+void ChunkedMesh::startLoader() {
+    stop_ = false;
+    loader_ = std::thread(&ChunkedMesh::loaderLoop, this);
+}
+
+void ChunkedMesh::stopLoader() {
+    if (!loader_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_one();
+    loader_.join();
+}
+
+/* Copy the asked for levels out of the mapped file, so that the pages are read from the
+ * disk on this thread and not on the render thread */
+void ChunkedMesh::loaderLoop() {
+    TRACE_THREAD("mesh loader");
+    while (true) {
+        int index;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (stop_) {
+                return;
+            }
+            index = queue_.front();
+            queue_.pop_front();
+        }
+        const Level& level = levels_[index];
+        const char* begin = file_.data() + level.offset;
+        std::vector<char> data(begin, begin + level.bytes());
+        std::lock_guard<std::mutex> lock(mutex_);
+        levels_[index].data.swap(data);
+        loaded_.push_back(index);
+    }
+}
@@ -0,0 +1,185 @@
+/*
+ * Out-of-core meshes, too large for the memory, as a hierarchy of chunks in a file that are
+ * streamed to the GPU by what the view needs.
+ *
+ * Usage: build() a chunk file from an OBJ file once, then open() it and call update() once
+ *        per frame with the matrices of the mesh, and render() in the passes that draw it.
+ *        build() reads the OBJ file twice, one line at a time from a memory mapped file.
+ *        The first pass writes the vertices, normals and texture coordinates to temporary
+ *        files, which the second pass maps to expand the faces into triangles in a
+ *        temporary file. The triangles are split into an octree by their centroids, through
+ *        temporary files of each cell, until a cell holds at most 'chunktriangles'. The
+ *        cells are split in two along each axis where they are at least half as large as
+ *        along the largest one. Each leaf is welded and simplified into up to 'levels'
+ *        levels of detail with mesh::simplify(). Each inner node gets one level of about
+ *        'chunktriangles' * 'ratio' triangles, simplified from levels of that size of its
+ *        children, so that a node far away is drawn in place of all of its leaves with
+ *        about as many triangles as one of them. The borders of the chunks do not move in
+ *        any level, so chunks of different levels next to each other meet without cracks.
+ *        So the memory of build() depends on 'chunktriangles', and not on the size of the
+ *        mesh, and the temporary files need about twice the size of the triangles.
+ *        update() walks the tree: nodes outside the view frustum are skipped, an inner node
+ *        whose error on the screen is more than setPixelError() is replaced by its children
+ *        once they are loaded, and a leaf draws its coarsest level whose error is small
+ *        enough. The levels are loaded by a loader thread, which reads them from the
+ *        memory mapped file, coarse nodes and large errors first, and update() uploads at
+ *        most 'uploadbytes' of them per frame into ranges of BufferPool::global(). When the
+ *        levels on the GPU would take more than 'gpubytes', those that were not needed for
+ *        the longest time are freed first, and levels needed in this frame are never
+ *        freed. A gpumem budget of the meshes that is exceeded lowers 'gpubytes' by as much,
+ *        after the free room in the buffer pool, which is given back with
+ *        BufferPool::trim(). Until a level is loaded, the nearest level of the same node or
+ *        the parent is drawn instead. The vertices are 8 floats, as in TriangleSoup, for the
+ *        programs of vertex.glsl and vertex_depth.glsl. Call update(), render() and close()
+ *        on the thread of the OpenGL context.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BufferPool.hpp"
+#include "Frustum.hpp"
+#include "MappedFile.hpp"
+#include "Mat4.hpp"
+#include "MeshProcessing.hpp"
+
+class ChunkedMesh {
+public:
+    /* Build the chunk file 'chunkfile' from 'objfile', which has triangles with v/t/n
+     * indices like for TriangleSoup::readOBJ(). Leaves of at most 'chunktriangles'
+     * triangles get 'levels' levels, each with 'ratio' of the triangles of the one before.
+     * The temporary files are next to the chunk file. False if the OBJ file could not be
+     * read or the chunk file not written, with the errors printed. */
+    static bool build(const std::string& objfile, const std::string& chunkfile,
+                      int chunktriangles = 65536, int levels = 4, float ratio = 0.25f);
+
+    /* Constructor: keep at most 'gpubytes' on the GPU, and upload at most 'uploadbytes'
+     * per update(), but at least one level */
+    explicit ChunkedMesh(size_t gpubytes = 256 << 20, size_t uploadbytes = 16 << 20);
+
+    /* Destructor: stop the loader thread and free the buffers */
+    ~ChunkedMesh();
+
+    ChunkedMesh(const ChunkedMesh&) = delete;
+    ChunkedMesh& operator=(const ChunkedMesh&) = delete;
+
+    /* Map a chunk file. If 'sourcefile' is given, the file must have been built from it
+     * as it is now, by its size and time stamp. False if the file is missing, stale or
+     * damaged. */
+    bool open(const std::string& chunkfile, const std::string& sourcefile = "");
+
+    // Free everything and unmap the file
+    void close();
+
+    // The largest error on the screen, in pixels, of what is drawn
+    void setPixelError(float pixels);
+
+    /* Choose the levels to draw for the projection P and the model-view matrix MV in a
+     * viewport of 'viewportheight' pixels, upload the ones that have been loaded and
+     * ask for the ones that are missing */
+    void update(const Mat4& P, const Mat4& MV, int viewportheight);
+
+    // Draw the levels chosen by the last update(), with the program in use
+    void render();
+
+    // Bounds of the whole mesh, in the coordinates of the vertices
+    const mesh::Bounds& bounds() const;
+
+    // Nodes of the tree, and levels of detail of all of them
+    int nodeCount() const;
+    int levelCount() const;
+
+    // Levels on the GPU and their bytes, levels asked for that are not there yet, and the
+    // triangles that render() draws
+    int residentCount() const;
+    size_t residentBytes() const;
+    int pendingCount() const;
+    int drawnTriangles() const;
+
+private:
+    enum class State { Absent, Queued, Resident };
+
+    // A level of detail of a node, as in the file, and its state
+    struct Level {
+        uint64_t offset;    // Of the vertices in the file, followed by the indices
+        uint32_t numverts;
+        uint32_t numtris;
+        uint32_t indexsize;
+        float error;        // Largest distance to the full mesh
+        int node;
+        State state = State::Absent;
+        std::vector<char> data;      // Loaded bytes, until they are uploaded
+        BufferAllocation buffer;
+        GLuint vao = 0;
+        long long used = -1;         // Last update() that needed the level
+        size_t bytes() const;
+    };
+
+    struct Node {
+        mesh::Bounds bounds;
+        int firstchild;
+        int childcount;
+        int firstlevel;
+        int levelcount;
+        int depth;
+    };
+
+    // The order in which the missing levels are loaded
+    struct Request {
+        int depth;
+        float pixels;  // Error on the screen
+        int level;
+    };
+
+    void select(int node, int depth);
+    float pixelError(const Node& node, float error) const;
+    int chooseLevel(int node) const;
+    bool anyResident(int node) const;
+    void want(int level, int depth);
+    void draw(int node, int level);
+    void upload(Level& level);
+    void evict(Level& level);
+    bool makeRoom(size_t bytes);
+    void startLoader();
+    void stopLoader();
+    void loaderLoop();
+
+    MappedFile file_;
+    std::vector<Node> nodes_;
+    std::vector<Level> levels_;
+    float pixelerror_;
+    size_t gpubytes_;
+    size_t limit_;  // gpubytes_, or less over the gpumem budget of the meshes
+    size_t uploadbytes_;
+    size_t residentbytes_;
+    int residentcount_;
+    int pendingcount_;
+    int drawntriangles_;
+    long long frame_;
+    // The view of the last update()
+    Mat4 MV_;
+    float pixelsperunit_;
+    float scale_;        // Largest scaling of MV_
+    bool perspective_;
+    Frustum frustum_;
+    std::vector<int> drawn_;              // Levels to render()
+    std::vector<Request> requests_;
+
+    // Levels for the loader thread, and those it has loaded, by index
+    std::deque<int> queue_;
+    std::deque<int> loaded_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool stop_;
+    std::thread loader_;
+};
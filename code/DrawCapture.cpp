@@ -0,0 +1,312 @@
+/*
+ * Recording and reading of the draw stream of every frame
+ *
+ * This code is in the public domain.
+ */
+#include "DrawCapture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+
+#include "RenderQueue.hpp"
+#include "RenderThread.hpp"
+#include "TriangleSoup.hpp"
+
+namespace {
+
+const char magic[8] = {'T', 'N', 'M', 'D', 'R', 'A', 'W', '\0'};
+const uint32_t version = 1;
+
+// The types of the records
+enum RecordType : uint32_t { MeshRecord = 1, MaterialsRecord = 2, FrameRecord = 3 };
+
+// The start of a frame record, followed by the arrays of the frame in the order of
+// CapturedFrame
+struct FrameHeader {
+    int64_t frame;
+    int32_t width;
+    int32_t height;
+    uint32_t objects;
+    uint32_t lights;
+    uint32_t draws;
+    uint32_t unused;
+};
+
+static_assert(std::is_trivially_copyable<FrameUniforms>::value &&
+                  std::is_trivially_copyable<ObjectUniforms>::value &&
+                  std::is_trivially_copyable<PointLight>::value &&
+                  std::is_trivially_copyable<Material>::value,
+              "The records are written as the bytes of these");
+
+void append(std::vector<unsigned char>& record, const void* data, size_t bytes) {
+    const unsigned char* begin = static_cast<const unsigned char*>(data);
+    record.insert(record.end(), begin, begin + bytes);
+}
+
+template <typename T>
+void appendArray(std::vector<unsigned char>& record, const std::vector<T>& values) {
+    append(record, values.data(), values.size() * sizeof(T));
+}
+
+// Reads the bytes of a record in order. Reading past the end leaves 'ok' false.
+struct RecordReader {
+    const std::vector<unsigned char>& record;
+    size_t position = 0;
+    bool ok = true;
+
+    void read(void* data, size_t bytes) {
+        if (!ok || bytes > record.size() - position) {
+            ok = false;
+            return;
+        }
+        memcpy(data, record.data() + position, bytes);
+        position += bytes;
+    }
+
+    template <typename T>
+    void readArray(std::vector<T>& values, size_t count) {
+        if (!ok || count > (record.size() - position) / sizeof(T)) {
+            ok = false;
+            return;
+        }
+        values.resize(count);
+        read(values.data(), count * sizeof(T));
+    }
+};
+
+}  // namespace
+
+const uint32_t DrawCapture::noMesh = 0xFFFFFFFFu;
+
+DrawCapture::DrawCapture() : file_(nullptr), frames_(0) {}
+
+DrawCapture::~DrawCapture() { close(); }
+
+bool DrawCapture::open(const std::string& filename) {
+    close();
+    file_ = fopen(filename.c_str(), "wb");
+    if (!file_) {
+        std::cerr << "Could not create " << filename << "\n";
+        return false;
+    }
+    filename_ = filename;
+    meshids_.clear();
+    frames_ = 0;
+    fwrite(magic, sizeof(magic), 1, file_);
+    fwrite(&version, sizeof(version), 1, file_);
+    return true;
+}
+
+void DrawCapture::addMesh(const TriangleSoup* mesh, const std::string& source) {
+    if (!file_ || meshids_.count(mesh) > 0) {
+        return;
+    }
+    const uint32_t id = static_cast<uint32_t>(meshids_.size());
+    meshids_[mesh] = id;
+    record_.clear();
+    append(record_, &id, sizeof(id));
+    append(record_, source.data(), source.size());
+    writeRecord(MeshRecord);
+}
+
+void DrawCapture::setMaterials(const MaterialTable& materials) {
+    if (!file_) {
+        return;
+    }
+    record_.clear();
+    for (int i = 0; i < materials.size(); i++) {
+        append(record_, &materials.get(i), sizeof(Material));
+    }
+    writeRecord(MaterialsRecord);
+}
+
+void DrawCapture::writeFrame(const FramePacket& frame, const FrameUniforms& uniforms,
+                             const RenderQueue& queue) {
+    if (!file_) {
+        return;
+    }
+    const std::vector<RenderQueue::Draw>& draws = queue.draws();
+    FrameHeader header = {};
+    header.frame = frame.frame;
+    header.width = frame.width;
+    header.height = frame.height;
+    header.objects = static_cast<uint32_t>(frame.draws.size());
+    header.lights = static_cast<uint32_t>(frame.lights.size());
+    header.draws = static_cast<uint32_t>(draws.size());
+    record_.clear();
+    append(record_, &header, sizeof(header));
+    append(record_, &uniforms, sizeof(uniforms));
+    // The object data as the render function pushes it, then the meshes
+    for (const DrawPacket& draw : frame.draws) {
+        const ObjectUniforms object{draw.MV, draw.R, draw.material};
+        append(record_, &object, sizeof(object));
+    }
+    for (const DrawPacket& draw : frame.draws) {
+        const auto found = meshids_.find(draw.shape);
+        const uint32_t id = (found != meshids_.end()) ? found->second : noMesh;
+        append(record_, &id, sizeof(id));
+    }
+    appendArray(record_, frame.lights);
+    for (const RenderQueue::Draw& draw : draws) {
+        append(record_, &draw.key, sizeof(draw.key));
+    }
+    for (const RenderQueue::Draw& draw : draws) {
+        append(record_, &draw.payload, sizeof(draw.payload));
+    }
+    writeRecord(FrameRecord);
+    frames_++;
+}
+
+void DrawCapture::close() {
+    if (!file_) {
+        return;
+    }
+    if (fclose(file_) != 0) {
+        std::cerr << "Could not write " << filename_ << "\n";
+    }
+    file_ = nullptr;
+}
+
+bool DrawCapture::isOpen() const { return file_ != nullptr; }
+
+long long DrawCapture::framesWritten() const { return frames_; }
+
+void DrawCapture::writeRecord(uint32_t type) {
+    const uint32_t head[2] = {type, static_cast<uint32_t>(record_.size())};
+    fwrite(head, sizeof(head), 1, file_);
+    fwrite(record_.data(), 1, record_.size(), file_);
+}
+
+DrawReplay::DrawReplay() : file_(nullptr) {}
+
+DrawReplay::~DrawReplay() {
+    if (file_) {
+        fclose(file_);
+    }
+}
+
+bool DrawReplay::open(const std::string& filename) {
+    if (file_) {
+        fclose(file_);
+    }
+    file_ = fopen(filename.c_str(), "rb");
+    if (!file_) {
+        std::cerr << "Could not open " << filename << "\n";
+        return false;
+    }
+    filename_ = filename;
+    meshes_.clear();
+    materials_.clear();
+    char header[sizeof(magic)];
+    uint32_t fileversion = 0;
+    if (fread(header, sizeof(header), 1, file_) != 1 ||
+        fread(&fileversion, sizeof(fileversion), 1, file_) != 1 ||
+        memcmp(header, magic, sizeof(magic)) != 0 || fileversion != version) {
+        std::cerr << filename << " is not a draw capture of version " << version << "\n";
+        fclose(file_);
+        file_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool DrawReplay::readFrame(CapturedFrame& frame) {
+    if (!file_) {
+        return false;
+    }
+    for (;;) {
+        uint32_t head[2];
+        const size_t headbytes = fread(head, 1, sizeof(head), file_);
+        if (headbytes == 0 && feof(file_)) {
+            return false;  // The end
+        }
+        if (headbytes != sizeof(head)) {
+            break;
+        }
+        record_.resize(head[1]);
+        if (fread(record_.data(), 1, record_.size(), file_) != record_.size()) {
+            break;
+        }
+        RecordReader reader{record_};
+        if (head[0] == MeshRecord) {
+            uint32_t id = 0;
+            reader.read(&id, sizeof(id));
+            if (reader.ok && id < (1u << 20)) {
+                meshes_.resize(std::max(meshes_.size(), size_t(id) + 1));
+                meshes_[id].assign(record_.begin() + sizeof(id), record_.end());
+            }
+        } else if (head[0] == MaterialsRecord) {
+            reader.readArray(materials_, record_.size() / sizeof(Material));
+        } else if (head[0] == FrameRecord) {
+            FrameHeader header;
+            reader.read(&header, sizeof(header));
+            reader.read(&frame.uniforms, sizeof(frame.uniforms));
+            reader.readArray(frame.objects, reader.ok ? header.objects : 0);
+            reader.readArray(frame.meshes, reader.ok ? header.objects : 0);
+            reader.readArray(frame.lights, reader.ok ? header.lights : 0);
+            reader.readArray(frame.keys, reader.ok ? header.draws : 0);
+            reader.readArray(frame.payloads, reader.ok ? header.draws : 0);
+            if (!reader.ok) {
+                break;
+            }
+            frame.frame = header.frame;
+            frame.width = header.width;
+            frame.height = header.height;
+            return true;
+        }
+        // Other types are from a later version, and skipped
+    }
+    std::cerr << filename_ << " is cut short\n";
+    return false;
+}
+
+const std::vector<std::string>& DrawReplay::meshes() const { return meshes_; }
+
+const std::vector<Material>& DrawReplay::materials() const { return materials_; }
+
+bool DrawReplay::createMesh(const std::string& source, TriangleSoup& mesh) {
+    if (source.compare(0, 4, "lod ") == 0) {
+        if (!createMesh(source.substr(4), mesh)) {
+            return false;
+        }
+        if (!mesh.vertices().empty()) {
+            mesh.generateLODs();
+        }
+        return true;
+    }
+    std::istringstream in(source);
+    std::string kind;
+    in >> kind;
+    if (kind == "obj" || kind == "glb") {
+        // The rest of the line, which may have spaces in it
+        const size_t start = source.find_first_not_of(' ', kind.size());
+        if (start == std::string::npos) {
+            return false;
+        }
+        if (kind == "glb") {
+            return mesh.readGLB(source.substr(start));
+        }
+        mesh.readOBJ(source.substr(start));
+        return !mesh.vertices().empty();
+    }
+    float a = 0.0f;
+    float b = 0.0f;
+    float c = 0.0f;
+    int columns = 1;
+    int rows = 1;
+    if (kind == "box" && (in >> a >> b >> c)) {
+        mesh.createBox(a, b, c);
+    } else if (kind == "sphere" && (in >> a >> columns)) {
+        mesh.createSphere(a, columns);
+    } else if (kind == "plane" && (in >> a >> b >> columns >> rows)) {
+        mesh.createPlane(a, b, columns, rows);
+    } else if (kind == "cylinder" && (in >> a >> b >> columns >> rows)) {
+        mesh.createCylinder(a, b, columns, rows);
+    } else {
+        return false;
+    }
+    return true;
+}
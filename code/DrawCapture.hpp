@@ -0,0 +1,132 @@
+/*
+ * Recording of the draw stream of every frame to a binary file, and reading it back, so that
+ * the GPU work of a run can be replayed without its simulation and input, and profiled and
+ * compared frame for frame across builds and drivers.
+ *
+ * Usage: Recording: open() a file, and describe the resources before the first frame that
+ *        draws them: addMesh() for each mesh, with a source that DrawReplay::createMesh()
+ *        builds the same mesh from again, and setMaterials() with the MaterialTable, again
+ *        whenever it changes. Then call writeFrame() on the render thread once per frame,
+ *        after the render queue is sorted, with the frame uniforms as they were pushed.
+ *        It writes the draw packets as their object uniforms and mesh ids, the point lights,
+ *        and the keys and payloads of the sorted queue, whose payloads index the packets.
+ *        Draws of meshes that were not added get the id noMesh, and are not replayed.
+ *        The destructor or close() ends the file.
+ *        Replay: open() a file with DrawReplay, and readFrame() until it returns false. The
+ *        meshes and materials recorded before a frame are in meshes() and materials() after
+ *        it is read. tnm046-replay (bench/ReplayFrames.cpp) draws the frames this way.
+ *        The file is a header, "TNMDRAW" and a version, followed by records of a type and a
+ *        size, so that a reader can skip the types it does not know. Numbers are in the
+ *        byte order of the machine, and the uniforms in their std140 layout. A frame of n
+ *        draws in the queue of m packets takes 148 m + 12 n bytes, and a file of a few
+ *        thousand frames of the lab scenes a few MB.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "LightClusters.hpp"
+#include "MaterialTable.hpp"
+#include "UniformBuffers.hpp"
+
+class RenderQueue;
+class TriangleSoup;
+struct FramePacket;
+
+// One frame of the draw stream
+struct CapturedFrame {
+    long long frame = 0;  // Number of the frame in the recorded run
+    int width = 0;        // Size of the frame
+    int height = 0;
+    FrameUniforms uniforms;
+    std::vector<ObjectUniforms> objects;  // One per draw packet
+    std::vector<uint32_t> meshes;         // Of each packet, an id of DrawReplay::meshes()
+    std::vector<PointLight> lights;
+    std::vector<uint64_t> keys;      // The sorted queue, RenderQueue keys
+    std::vector<uint32_t> payloads;  // and the packet each draw is of
+};
+
+class DrawCapture {
+public:
+    // The mesh id of draws of meshes that were not added
+    static const uint32_t noMesh;
+
+    /* Constructor: nothing is recorded until open() */
+    DrawCapture();
+
+    /* Destructor: close() */
+    ~DrawCapture();
+
+    DrawCapture(const DrawCapture&) = delete;
+    DrawCapture& operator=(const DrawCapture&) = delete;
+
+    // Create 'filename' and write the header. False, after printing why, if it fails.
+    bool open(const std::string& filename);
+
+    /* Give 'mesh' the next id, made again in the replay from 'source': "box <x> <y> <z>",
+     * "sphere <radius> <segments>", "plane <x> <y> <columns> <rows>", "cylinder <radius>
+     * <height> <segments> <rows>", "obj <file>" or "glb <file>", after "lod " for a mesh
+     * with generateLODs(). */
+    void addMesh(const TriangleSoup* mesh, const std::string& source);
+
+    // Record all materials of 'materials', for the frames from the next one
+    void setMaterials(const MaterialTable& materials);
+
+    // Record the draws of 'frame' in the order of 'queue', with 'uniforms' as FrameData
+    void writeFrame(const FramePacket& frame, const FrameUniforms& uniforms,
+                    const RenderQueue& queue);
+
+    // End the file
+    void close();
+
+    bool isOpen() const;
+    long long framesWritten() const;
+
+private:
+    // Write a record of 'type' with the bytes of 'record_'
+    void writeRecord(uint32_t type);
+
+    FILE* file_;
+    std::string filename_;
+    std::unordered_map<const TriangleSoup*, uint32_t> meshids_;
+    std::vector<unsigned char> record_;  // Reused for every record
+    long long frames_;
+};
+
+class DrawReplay {
+public:
+    DrawReplay();
+
+    /* Destructor: close the file */
+    ~DrawReplay();
+
+    DrawReplay(const DrawReplay&) = delete;
+    DrawReplay& operator=(const DrawReplay&) = delete;
+
+    // Open a file of DrawCapture. False, after printing why, if it is not one.
+    bool open(const std::string& filename);
+
+    /* Read the next frame, and the meshes and materials recorded before it. False at the
+     * end of the file, or, after printing why, if it is cut short. */
+    bool readFrame(CapturedFrame& frame);
+
+    // The sources of the meshes by id, and the materials of the last frame read
+    const std::vector<std::string>& meshes() const;
+    const std::vector<Material>& materials() const;
+
+    // Make a mesh from a source of DrawCapture::addMesh(). False for an unknown source.
+    static bool createMesh(const std::string& source, TriangleSoup& mesh);
+
+private:
+    FILE* file_;
+    std::string filename_;
+    std::vector<std::string> meshes_;
+    std::vector<Material> materials_;
+    std::vector<unsigned char> record_;
+};
@@ -0,0 +1,97 @@
+/*
+ * Dynamic resolution from the GPU frame time, with an upscale and sharpen pass
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "DynamicResolution.hpp"
+
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Of the target time, to leave room for the frames that take longer than the last one
+constexpr double headroom = 0.9;
+
+// Of the way to a higher scale, per measured frame
+constexpr float increaseRate = 0.1f;
+
+}  // namespace
+
+DynamicResolution::DynamicResolution(double targetms, float minscale, float maxscale,
+                                     float sharpness)
+    : targetms_(targetms), minscale_(std::max(std::min(minscale, maxscale), 0.05f)),
+      maxscale_(std::max(maxscale, minscale_)), sharpness_(sharpness), scale_(maxscale_),
+      measured_(-1), vao_(0) {
+    std::fill(scales_, scales_ + historySize, scale_);
+}
+
+DynamicResolution::~DynamicResolution() {
+    if (vao_ != 0) {
+        glstate::deleteVertexArrays(1, &vao_);
+    }
+}
+
+float DynamicResolution::update(long long frame, long long measured, double gputime) {
+    if (measured > measured_ && gputime > 0.0 && frame - measured < historySize) {
+        measured_ = measured;
+        const float used = scales_[measured % historySize];
+        const float ideal = std::min(
+            std::max(used * static_cast<float>(std::sqrt(headroom * targetms_ / gputime)),
+                     minscale_),
+            maxscale_);
+        scale_ = ideal < scale_ ? ideal : scale_ + increaseRate * (ideal - scale_);
+    }
+    if (frame >= 0) {
+        scales_[frame % historySize] = scale_;
+    }
+    return scale_;
+}
+
+float DynamicResolution::scale() const { return scale_; }
+
+void DynamicResolution::renderSize(int width, int height, int& renderwidth,
+                                   int& renderheight) const {
+    renderwidth = std::max(static_cast<int>(std::lround(float(width) * scale_)), 1);
+    renderheight = std::max(static_cast<int>(std::lround(float(height) * scale_)), 1);
+}
+
+void DynamicResolution::upscale(GLuint texture, int renderwidth, int renderheight) {
+    if (shader_.id() == 0) {
+        shader_.createShader("vertex_fullscreen.glsl", "fragment_upscale.glsl");
+        glGenVertexArrays(1, &vao_);
+    }
+    // The state changed below, to restore at the end
+    GLint viewport[4], polygonmode[2];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_POLYGON_MODE, polygonmode);
+    const GLboolean depthtest = glIsEnabled(GL_DEPTH_TEST);
+
+    glDisable(GL_DEPTH_TEST);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    shader_.use();
+    glstate::activeTexture(GL_TEXTURE0);
+    glstate::bindTexture(GL_TEXTURE_2D, texture);
+    shader_.setUniform("source", 0);
+    shader_.setUniform("sourceSize", float(renderwidth), float(renderheight));
+    shader_.setUniform("targetSize", float(viewport[2]), float(viewport[3]));
+    // Nothing to sharpen at the full resolution
+    const float blur = (maxscale_ > minscale_) ? (1.0f - scale_) / (1.0f - minscale_) : 0.0f;
+    shader_.setUniform("sharpness", sharpness_ * std::min(std::max(blur, 0.0f), 1.0f));
+    glstate::bindVertexArray(vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glstate::bindVertexArray(0);
+
+    glPolygonMode(GL_FRONT_AND_BACK, static_cast<GLenum>(polygonmode[0]));
+    if (depthtest) {
+        glEnable(GL_DEPTH_TEST);
+    }
+}
+
+void DynamicResolution::setTarget(double targetms) { targetms_ = targetms; }
+
+double DynamicResolution::target() const { return targetms_; }
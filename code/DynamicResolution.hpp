@@ -0,0 +1,69 @@
+/*
+ * Dynamic resolution: the scene is drawn at a resolution that follows the GPU frame time,
+ * and scaled up to the window.
+ *
+ * Usage: Every frame, give update() the number of the frame and the latest GPU frame time
+ *        that is known, from FrameProfiler::latestGPUFrameTime(), and draw the scene with
+ *        the viewport of renderSize() into the lower left corner of a texture of the
+ *        window size. Then upscale() that texture into the window.
+ *        The GPU time of a frame is taken to grow with its pixels, so with the square of
+ *        the scale, and the scale that would have met 90 % of 'targetms' in the frame that
+ *        was measured is where the scale goes. It goes down to it at once, so that a frame
+ *        over the target is rarely followed by another one, and up a tenth of the way per
+ *        measured frame, so that it does not swing back and forth. The scale stays between
+ *        'minscale' and 'maxscale' of the window size in each direction.
+ *        upscale() filters bilinearly and sharpens, more the lower the scale, with an
+ *        unsharp mask that is limited to the colors around each pixel, so that edges do
+ *        not ring. It draws a full screen triangle with vertex_fullscreen.glsl and
+ *        fragment_upscale.glsl, loaded on first use, into the bound framebuffer and
+ *        viewport, and restores the GL state it changes.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+
+#include "Shader.hpp"
+
+class DynamicResolution {
+public:
+    /* Constructor: aim at 'targetms' of GPU time per frame */
+    explicit DynamicResolution(double targetms = 16.0, float minscale = 0.5f,
+                               float maxscale = 1.0f, float sharpness = 0.5f);
+
+    /* Destructor: delete the VAO */
+    ~DynamicResolution();
+
+    DynamicResolution(const DynamicResolution&) = delete;
+    DynamicResolution& operator=(const DynamicResolution&) = delete;
+
+    /* Choose the scale of frame 'frame' from the GPU time of frame 'measured'. A negative
+     * 'measured' or 'gputime' is unknown and keeps the scale. */
+    float update(long long frame, long long measured, double gputime);
+
+    float scale() const;
+
+    // The size to draw the scene at for a window of 'width' x 'height'
+    void renderSize(int width, int height, int& renderwidth, int& renderheight) const;
+
+    /* Scale the lower left 'renderwidth' x 'renderheight' texels of 'texture', a
+     * GL_TEXTURE_2D, up to the viewport */
+    void upscale(GLuint texture, int renderwidth, int renderheight);
+
+    void setTarget(double targetms);
+    double target() const;
+
+private:
+    static constexpr int historySize = 16;  // Frames the scales are kept for
+
+    double targetms_;
+    float minscale_;
+    float maxscale_;
+    float sharpness_;
+    float scale_;
+    float scales_[historySize];  // The scale of recent frames, by frame number
+    long long measured_;         // The last frame that update() used
+    Shader shader_;
+    GLuint vao_;                 // Empty VAO for the full screen triangle
+};
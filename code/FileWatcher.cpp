@@ -0,0 +1,153 @@
+/*
+ * Watch files for changes on a background thread
+ *
+ * This code is in the public domain.
+ */
+#include "FileWatcher.hpp"
+
+#include "Trace.hpp"
+#include "Utilities.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Time between checks for the stop flag, and between polls of the files without inotify
+constexpr int pollInterval = 250;  // milliseconds
+
+// The directory of 'filename', "." if it has none, and the name without it
+void splitPath(const std::string& filename, std::string& directory, std::string& basename) {
+    const size_t slash = filename.find_last_of("/\\");
+    if (slash == std::string::npos) {
+        directory = ".";
+        basename = filename;
+    } else {
+        directory = (slash == 0) ? filename.substr(0, 1) : filename.substr(0, slash);
+        basename = filename.substr(slash + 1);
+    }
+}
+
+}  // namespace
+
+FileWatcher::FileWatcher() : stop_(false), inotify_(-1) {
+#ifdef __linux__
+    inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+    stop_ = true;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+#ifdef __linux__
+    if (inotify_ >= 0) {
+        close(inotify_);
+    }
+#endif
+}
+
+void FileWatcher::watch(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const File& file : files_) {
+        if (file.name == filename) {
+            return;
+        }
+    }
+    File file;
+    file.name = filename;
+    std::string directory;
+    splitPath(filename, directory, file.basename);
+    file.directory = -1;
+#ifdef __linux__
+    // A directory that is watched already gives the same watch descriptor again
+    if (inotify_ >= 0) {
+        file.directory = inotify_add_watch(inotify_, directory.c_str(),
+                                           IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (file.directory < 0) {
+            std::cerr << "FileWatcher: cannot watch '" << directory << "'\n";
+        }
+    }
+#endif
+    file.size = 0;
+    file.time = 0;
+    util::fileStamp(filename, file.size, file.time);
+    files_.push_back(file);
+
+    if (!thread_.joinable()) {
+        thread_ = std::thread(&FileWatcher::run, this);
+    }
+}
+
+std::vector<std::string> FileWatcher::changes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> result;
+    result.swap(changed_);
+    return result;
+}
+
+size_t FileWatcher::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return files_.size();
+}
+
+void FileWatcher::changed(const std::string& name) {
+    if (std::find(changed_.begin(), changed_.end(), name) == changed_.end()) {
+        changed_.push_back(name);
+    }
+}
+
+void FileWatcher::run() {
+    TRACE_THREAD("file watcher");
+    while (!stop_) {
+#ifdef __linux__
+        if (inotify_ >= 0) {
+            pollfd request = {inotify_, POLLIN, 0};
+            if (poll(&request, 1, pollInterval) <= 0) {
+                continue;
+            }
+            // Events are a header and a null terminated name, aligned for the next header
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(inotify_, buffer, sizeof(buffer))) > 0) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (ssize_t offset = 0; offset < length;) {
+                    const inotify_event* event =
+                        reinterpret_cast<const inotify_event*>(buffer + offset);
+                    offset += sizeof(inotify_event) + event->len;
+                    if (event->len == 0) {
+                        continue;
+                    }
+                    for (const File& file : files_) {
+                        if (file.directory == event->wd && file.basename == event->name) {
+                            changed(file.name);
+                        }
+                    }
+                }
+            }
+            continue;
+        }
+#endif
+        // Without inotify, compare the size and modification time of every file
+        std::this_thread::sleep_for(std::chrono::milliseconds(pollInterval));
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (File& file : files_) {
+            uint64_t size = 0;
+            int64_t time = 0;
+            util::fileStamp(file.name, size, time);
+            if (size != file.size || time != file.time) {
+                file.size = size;
+                file.time = time;
+                changed(file.name);
+            }
+        }
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ * Watch files for changes on a background thread, for reloading them while the program runs.
+ *
+ * Usage: watch() each file, then call changes() once per frame. It returns the files that
+ *        were written since the last call, with the names given to watch(), and never waits.
+ *        On Linux, the directories of the files are watched with inotify, so editors that
+ *        save by renaming a new file over the old one are seen too. On other systems the
+ *        size and modification time of every file are compared a few times per second.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FileWatcher {
+public:
+    // Constructor: the thread is started by the first watch()
+    FileWatcher();
+
+    /* Destructor: stop and join the thread */
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Watch 'filename'. A file that is watched already is not added again.
+    void watch(const std::string& filename);
+
+    // The watched files that changed since the last call, each one once
+    std::vector<std::string> changes();
+
+    // Number of watched files
+    size_t size() const;
+
+private:
+    struct File {
+        std::string name;      // As given to watch()
+        std::string basename;  // Without the directory
+        int directory;         // inotify watch of the directory, or -1
+        uint64_t size;         // For polling
+        int64_t time;
+    };
+
+    // The thread: wait for changes until stop_
+    void run();
+
+    // Add 'name' to changed_ unless it is there already. mutex_ must be locked.
+    void changed(const std::string& name);
+
+    mutable std::mutex mutex_;  // For files_ and changed_
+    std::vector<File> files_;
+    std::vector<std::string> changed_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+    int inotify_;  // inotify instance, or -1
+};
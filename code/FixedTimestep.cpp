@@ -0,0 +1,92 @@
+/*
+ * A fixed timestep for a simulation, with the steps run on a thread pool
+ *
+ * This code is in the public domain.
+ */
+#include "FixedTimestep.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "Trace.hpp"
+
+FixedTimestep::FixedTimestep(double rate, int maxsteps)
+    : rate_(60.0), maxsteps_(1), accumulator_(0.0), basetime_(0.0), basestep_(0), steps_(0),
+      dropped_(0.0), steptime_(0.0), pool_(nullptr) {
+    setRate(rate);
+    setMaxSteps(maxsteps);
+}
+
+FixedTimestep::~FixedTimestep() { wait(); }
+
+void FixedTimestep::setRate(double rate) {
+    wait();
+    basetime_ = time();
+    basestep_ = steps_;
+    rate_ = std::max(rate, 1.0);
+    accumulator_ = std::min(accumulator_, stepSize());
+}
+
+double FixedTimestep::rate() const { return rate_; }
+
+double FixedTimestep::stepSize() const { return 1.0 / rate_; }
+
+void FixedTimestep::setMaxSteps(int maxsteps) { maxsteps_ = std::max(maxsteps, 1); }
+
+int FixedTimestep::maxSteps() const { return maxsteps_; }
+
+int FixedTimestep::start(double seconds, std::function<void(double)> step, ThreadPool* pool) {
+    wait();
+    accumulator_ += std::max(seconds, 0.0);
+    int count = 0;
+    while (accumulator_ >= stepSize() && count < maxsteps_) {
+        accumulator_ -= stepSize();
+        count++;
+    }
+    if (accumulator_ >= stepSize()) {
+        dropped_ += accumulator_ - std::fmod(accumulator_, stepSize());
+        accumulator_ = std::fmod(accumulator_, stepSize());
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    step_ = std::move(step);
+    auto run = [this, count]() {
+        TRACE_SCOPE("simulation steps");
+        const auto starttime = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) {
+            steps_++;
+            step_(time());
+        }
+        steptime_ +=
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - starttime).count();
+    };
+    pool_ = pool;
+    if (pool) {
+        pool->run(jobs_, run);
+    } else {
+        run();
+    }
+    return count;
+}
+
+void FixedTimestep::wait() {
+    if (pool_) {
+        pool_->wait(jobs_);
+        pool_ = nullptr;
+    }
+}
+
+double FixedTimestep::alpha() const { return std::min(accumulator_ / stepSize(), 1.0); }
+
+double FixedTimestep::time() const { return basetime_ + double(steps_ - basestep_) / rate_; }
+
+long long FixedTimestep::stepCount() const { return steps_; }
+
+double FixedTimestep::droppedTime() const { return dropped_; }
+
+double FixedTimestep::averageStepTime() const {
+    return steps_ > 0 ? 1000.0 * steptime_ / double(steps_) : 0.0;
+}
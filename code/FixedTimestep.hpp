@@ -0,0 +1,82 @@
+/*
+ * A fixed timestep for a simulation that is drawn at any frame rate: the real time is
+ * accumulated, and the simulation advances in steps of the same length, so that its motion
+ * does not depend on how long the frames take, and its cost on how many there are.
+ *
+ * Usage: Call start() once per frame with the real time since the last call and the step
+ *        function, which start() calls once for each step that is due, with the simulated
+ *        time at the end of the step. With a ThreadPool, the steps run as one job on its
+ *        threads while the caller goes on, e.g. waiting for the frame or for the render
+ *        thread, until wait(), which must come before anything reads what the steps wrote.
+ *        The simulation keeps the states of its last two steps, and the frame draws the
+ *        state between them at alpha(), from 0 at the older to 1 at the newer, which lags
+ *        the real time by one step. A frame that took so long that more than maxSteps()
+ *        steps are due runs only those, and the rest of the time is dropped, so the
+ *        simulation slows down for a moment rather than falling further and further behind.
+ *        The time that the steps take is kept, for a budget of the simulation on its own.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <functional>
+
+#include "ThreadPool.hpp"
+
+class FixedTimestep {
+public:
+    /* Constructor: 'rate' steps per simulated second, and at most 'maxsteps' per start() */
+    explicit FixedTimestep(double rate = 60.0, int maxsteps = 8);
+
+    // Waits for the steps of the last start()
+    ~FixedTimestep();
+
+    FixedTimestep(const FixedTimestep&) = delete;
+    FixedTimestep& operator=(const FixedTimestep&) = delete;
+
+    // Change the number of steps per second, from the simulated time reached so far
+    void setRate(double rate);
+    double rate() const;
+
+    // Seconds per step
+    double stepSize() const;
+
+    void setMaxSteps(int maxsteps);
+    int maxSteps() const;
+
+    /* Add 'seconds' of real time and run step(time) for each step that is due, on the
+     * threads of 'pool' if it is not null and before returning otherwise. Waits for the
+     * steps of the last call first. Returns the number of steps. */
+    int start(double seconds, std::function<void(double)> step, ThreadPool* pool = nullptr);
+
+    // Wait until the steps of the last start() have run
+    void wait();
+
+    // How far the real time is from the second last to the last step, from 0 to 1
+    double alpha() const;
+
+    // Simulated seconds at the end of the last step
+    double time() const;
+
+    // Steps run in all
+    long long stepCount() const;
+
+    // Seconds of real time that were dropped for lack of steps
+    double droppedTime() const;
+
+    // Average milliseconds that a step took
+    double averageStepTime() const;
+
+private:
+    double rate_;
+    int maxsteps_;
+    double accumulator_;  // Real time not yet simulated, less than one step after start()
+    double basetime_;     // Simulated time at the last change of rate
+    long long basestep_;  // Steps before the last change of rate
+    long long steps_;
+    double dropped_;
+    double steptime_;     // Seconds taken by all steps
+    std::function<void(double)> step_;  // The step function of the last start()
+    JobCounter jobs_;
+    ThreadPool* pool_;    // The pool of the last start()
+};
@@ -0,0 +1,374 @@
+/*
+ * Asynchronous readback of frames through a ring of pixel buffer objects
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "FrameCapture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "GpuMemory.hpp"
+
+// The PNG encoder that comes with GLFW, private to this file and without our warnings
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#elif defined(_MSC_VER)
+#pragma warning(push, 0)
+#endif
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "glfw-3.3.2/deps/stb_image_write.h"
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#elif defined(_MSC_VER)
+#pragma warning(pop)
+#endif
+
+namespace {
+
+bool endsWith(const std::string& text, const char* suffix) {
+    const size_t length = strlen(suffix);
+    return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+// Full range BT.601, as in JPEG
+unsigned char luma(const unsigned char* p) {
+    return static_cast<unsigned char>(0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2] + 0.5f);
+}
+
+}  // namespace
+
+FrameCapture::FrameCapture(const std::string& filename, int numbuffers, double framerate)
+    : filename_(filename)
+    , format_(formatOf(filename))
+    , framerate_(framerate)
+    , persistent_(false)
+    , readbacks_(std::max(numbuffers, 1))
+    , next_(0)
+    , inflight_(0)
+    , unwritten_(0)
+    , stop_(false)
+    , video_(nullptr)
+    , videowidth_(0)
+    , videoheight_(0)
+    , written_(0) {
+    // Videos are written in frame order, by one thread. Image files are independent.
+    unsigned int numencoders = 1;
+    if (format_ == Format::PNG) {
+        numencoders = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+    }
+    for (unsigned int i = 0; i < numencoders; i++) {
+        encoders_.emplace_back(&FrameCapture::encoderLoop, this);
+    }
+}
+
+FrameCapture::~FrameCapture() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    for (std::thread& encoder : encoders_) {
+        encoder.join();
+    }
+    if (video_) {
+        fclose(video_);
+    }
+    for (Readback& readback : readbacks_) {
+        if (readback.fence) {
+            glDeleteSync(static_cast<GLsync>(readback.fence));
+        }
+        if (glIsBuffer(readback.buffer)) {
+            gpumem::deleteBuffers(1, &readback.buffer);  // Also unmaps it
+        }
+    }
+}
+
+FrameCapture::Format FrameCapture::formatOf(const std::string& filename) {
+    if (endsWith(filename, ".png")) {
+        return Format::PNG;
+    }
+    if (endsWith(filename, ".y4m")) {
+        return Format::Y4M;
+    }
+    if (endsWith(filename, ".raw")) {
+        return Format::Raw;
+    }
+    return Format::PPM;
+}
+
+FrameCapture::Format FrameCapture::format() const { return format_; }
+
+void FrameCapture::capture(long long frame, int width, int height) {
+    if (readbacks_[0].buffer == 0) {
+        persistent_ = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+    }
+    // Hand over the frames that are done, oldest first, and make room for this one
+    while (inflight_ > 0 && readOldest(false)) {
+    }
+    if (inflight_ == static_cast<int>(readbacks_.size())) {
+        readOldest(true);
+    }
+    Readback& readback = readbacks_[next_];
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [&] { return readback.state == State::Free; });
+    }
+    next_ = (next_ + 1) % static_cast<int>(readbacks_.size());
+    inflight_++;
+    readback.state = State::Reading;
+    readback.frame = frame;
+    readback.width = width;
+    readback.height = height;
+
+    const size_t bytes = size_t(width) * size_t(height) * 4;
+    if (readback.bytes != bytes) {
+        // Persistent buffers can not change their size, so make a new one in any case
+        if (readback.buffer != 0) {
+            gpumem::deleteBuffers(1, &readback.buffer);
+        }
+        glGenBuffers(1, &readback.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        readback.bytes = bytes;
+        readback.mapped = nullptr;
+        if (persistent_) {
+            const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_PACK_BUFFER, bytes, nullptr, flags);
+            readback.mapped = static_cast<unsigned char*>(
+                glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, flags));
+            if (!readback.mapped) {
+                std::cerr << "FrameCapture: persistent mapping failed\n";
+            }
+        } else {
+            glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+        }
+        gpumem::setBuffer(readback.buffer, gpumem::Category::Buffer, bytes);
+    } else {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    }
+    // With a PBO bound, the last argument is an offset in it, and the call does not wait
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool FrameCapture::readOldest(bool wait) {
+    const int numbuffers = static_cast<int>(readbacks_.size());
+    const int index = (next_ - inflight_ + numbuffers) % numbuffers;
+    Readback& readback = readbacks_[index];
+    GLsync fence = static_cast<GLsync>(readback.fence);
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status == GL_TIMEOUT_EXPIRED && !wait) {
+        return false;
+    }
+    while (status == GL_TIMEOUT_EXPIRED) {
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);  // 1 ms
+    }
+    glDeleteSync(fence);
+    readback.fence = nullptr;
+    inflight_--;
+
+    Image image;
+    image.frame = readback.frame;
+    image.width = readback.width;
+    image.height = readback.height;
+    if (readback.mapped) {
+        // The encoders read the PBO itself, and free it when they are done
+        image.pixels = readback.mapped;
+        image.readback = index;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            readback.state = State::Encoding;
+            queue_.push_back(std::move(image));
+            unwritten_++;
+        }
+        condition_.notify_all();
+        return true;
+    }
+
+    {
+        // Wait if the encoders are behind, rather than piling up copies in memory
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this] { return unwritten_ < maxQueued; });
+        if (!spare_.empty()) {
+            image.copy.swap(spare_.back());
+            spare_.pop_back();
+        }
+    }
+    image.copy.resize(readback.bytes);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.bytes,
+                                          GL_MAP_READ_BIT);
+    if (pixels) {
+        memcpy(image.copy.data(), pixels, readback.bytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        std::cerr << "FrameCapture: could not map the pixels of frame " << readback.frame
+                  << "\n";
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        readback.state = State::Free;
+        if (pixels) {
+            image.pixels = image.copy.data();
+            queue_.push_back(std::move(image));
+            unwritten_++;
+        }
+    }
+    condition_.notify_all();
+    return true;
+}
+
+void FrameCapture::finish() {
+    while (inflight_ > 0) {
+        readOldest(true);
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this] { return unwritten_ == 0; });
+}
+
+long long FrameCapture::framesWritten() const { return written_; }
+
+void FrameCapture::encoderLoop() {
+    std::vector<unsigned char> rgb;
+    for (;;) {
+        Image image;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;  // Stopped, and everything is written
+            }
+            image = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        if (write(image, rgb)) {
+            written_++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (image.readback >= 0) {
+                readbacks_[image.readback].state = State::Free;
+            } else {
+                spare_.push_back(std::move(image.copy));
+            }
+            unwritten_--;
+        }
+        condition_.notify_all();
+    }
+}
+
+bool FrameCapture::write(const Image& image, std::vector<unsigned char>& rgb) {
+    const int width = image.width;
+    const int height = image.height;
+    const size_t rowbytes = size_t(width) * 4;
+    // The top row, and the step to the next row down
+    const unsigned char* top = image.pixels + size_t(height - 1) * rowbytes;
+
+    if (format_ == Format::Y4M || format_ == Format::Raw) {
+        // Only one encoder thread writes videos, so video_ needs no lock
+        if (!video_) {
+            video_ = fopen(filename_.c_str(), "wb");
+            if (!video_) {
+                std::cerr << "FrameCapture: could not create " << filename_ << "\n";
+                return false;
+            }
+            videowidth_ = width;
+            videoheight_ = height;
+            if (format_ == Format::Y4M) {
+                const int rate = static_cast<int>(framerate_ * 1000.0 + 0.5);
+                fprintf(video_, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C420jpeg\n", width, height,
+                        rate);
+            }
+        }
+        if (width != videowidth_ || height != videoheight_) {
+            std::cerr << "FrameCapture: frame " << image.frame << " is " << width << " x "
+                      << height << ", but the video is " << videowidth_ << " x "
+                      << videoheight_ << "\n";
+            return false;
+        }
+    }
+
+    if (format_ == Format::Y4M) {
+        const int chromawidth = (width + 1) / 2;
+        const int chromaheight = (height + 1) / 2;
+        const size_t lumabytes = size_t(width) * size_t(height);
+        const size_t chromabytes = size_t(chromawidth) * size_t(chromaheight);
+        rgb.resize(lumabytes + 2 * chromabytes);
+        unsigned char* y = rgb.data();
+        unsigned char* cb = y + lumabytes;
+        unsigned char* cr = cb + chromabytes;
+        for (int row = 0; row < height; row++) {
+            const unsigned char* p = top - row * rowbytes;
+            for (int x = 0; x < width; x++) {
+                y[size_t(row) * width + x] = luma(p + 4 * x);
+            }
+        }
+        // Chroma of the average color of each 2 x 2 block
+        for (int row = 0; row < chromaheight; row++) {
+            const unsigned char* p0 = top - 2 * row * rowbytes;
+            const unsigned char* p1 = (2 * row + 1 < height) ? p0 - rowbytes : p0;
+            for (int x = 0; x < chromawidth; x++) {
+                const int x0 = 8 * x;
+                const int x1 = (2 * x + 1 < width) ? x0 + 4 : x0;
+                float c[3];
+                for (int k = 0; k < 3; k++) {
+                    const int sum = p0[x0 + k] + p0[x1 + k] + p1[x0 + k] + p1[x1 + k];
+                    c[k] = 0.25f * static_cast<float>(sum);
+                }
+                const size_t i = size_t(row) * chromawidth + x;
+                cb[i] = static_cast<unsigned char>(
+                    std::clamp(128.0f - 0.168736f * c[0] - 0.331264f * c[1] + 0.5f * c[2] + 0.5f,
+                               0.0f, 255.0f));
+                cr[i] = static_cast<unsigned char>(
+                    std::clamp(128.0f + 0.5f * c[0] - 0.418688f * c[1] - 0.081312f * c[2] + 0.5f,
+                               0.0f, 255.0f));
+            }
+        }
+        fputs("FRAME\n", video_);
+        return fwrite(rgb.data(), 1, rgb.size(), video_) == rgb.size();
+    }
+
+    // All other formats are RGB, top row first
+    rgb.resize(size_t(width) * size_t(height) * 3);
+    for (int row = 0; row < height; row++) {
+        const unsigned char* p = top - row * rowbytes;
+        unsigned char* q = &rgb[size_t(row) * size_t(width) * 3];
+        for (int x = 0; x < width; x++) {
+            q[3 * x + 0] = p[4 * x + 0];
+            q[3 * x + 1] = p[4 * x + 1];
+            q[3 * x + 2] = p[4 * x + 2];
+        }
+    }
+    if (format_ == Format::Raw) {
+        return fwrite(rgb.data(), 1, rgb.size(), video_) == rgb.size();
+    }
+
+    char filename[1024];
+    snprintf(filename, sizeof(filename), filename_.c_str(), static_cast<int>(image.frame));
+    if (format_ == Format::PNG) {
+        if (!stbi_write_png(filename, width, height, 3, rgb.data(), width * 3)) {
+            std::cerr << "FrameCapture: could not write " << filename << "\n";
+            return false;
+        }
+        return true;
+    }
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        std::cerr << "FrameCapture: could not create " << filename << "\n";
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    fwrite(rgb.data(), 1, rgb.size(), file);
+    return fclose(file) == 0;
+}
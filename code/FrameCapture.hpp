@@ -0,0 +1,128 @@
+/*
+ * Reads rendered frames back from the GPU and writes them to image or video files, without
+ * stalling the rendering.
+ *
+ * Usage: Call capture() after a frame is drawn, with the framebuffer to read bound as the
+ *        read framebuffer: an offscreen Framebuffer, or the back buffer of the window before
+ *        the swap. glReadPixels() goes into one of a ring of pixel buffer objects (PBOs) and
+ *        returns at once. The PBO is only looked at again a few frames later, or as soon as
+ *        a fence says the copy is done, when the GPU has long finished with it. The pixels
+ *        are then handed to encoder threads, so neither the GPU nor the render thread waits
+ *        for the encoding or the disk. capture() waits only if all PBOs are still in flight
+ *        or being encoded.
+ *        With OpenGL 4.4 or ARB_buffer_storage, the PBOs are mapped once, persistently, and
+ *        the encoders read straight from them. Otherwise each PBO is mapped and copied on
+ *        the render thread, and the encoders hold at most maxQueued copies.
+ *        Call finish() at the end, on the thread with the GL context, to read back and
+ *        write the remaining frames.
+ *        The format follows the file name:
+ *        .png - one PNG file per frame, named from a printf pattern with the frame number,
+ *               like "frame%05d.png". Encoded with stb_image_write, which comes with GLFW,
+ *               on several threads.
+ *        .ppm - one binary PPM file per frame, named like the PNG files. Fast to write.
+ *        .y4m - one YUV4MPEG2 video of all frames, 4:2:0 full range BT.601, for ffmpeg.
+ *        .raw - one file of all frames as packed RGB, top row first: for ffmpeg, use
+ *               "-f rawvideo -pix_fmt rgb24 -s <width>x<height>".
+ *        All frames of a video must have the size of the first.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FrameCapture {
+public:
+    enum class Format { PNG, PPM, Y4M, Raw };
+
+    /* Constructor: write to 'filename', with 'numbuffers' PBOs in the ring. 'framerate' is
+     * written in the header of Y4M videos. Starts the encoder threads; the GL objects are
+     * created by the first capture(). */
+    explicit FrameCapture(const std::string& filename, int numbuffers = 4,
+                          double framerate = 60.0);
+
+    /* Destructor: write the frames already read back, stop the encoder threads and delete
+     * the PBOs. Frames still in flight are lost unless finish() was called. */
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // Start the readback of 'width' x 'height' pixels of the read framebuffer, as 'frame'
+    void capture(long long frame, int width, int height);
+
+    // Read back all frames in flight, and wait until all of them are written
+    void finish();
+
+    // Number of frames written so far
+    long long framesWritten() const;
+
+    Format format() const;
+
+    // The format for a file name, by its extension. PPM for anything unknown.
+    static Format formatOf(const std::string& filename);
+
+    // Frames copied from PBOs that may wait for the encoders before capture() waits for them
+    static constexpr int maxQueued = 8;
+
+private:
+    enum class State { Free, Reading, Encoding };
+
+    // A frame on its way back from the GPU
+    struct Readback {
+        GLuint buffer = 0;                // The PBO
+        size_t bytes = 0;                 // Its size
+        unsigned char* mapped = nullptr;  // Persistent mapping, or nullptr
+        void* fence = nullptr;            // GLsync, signalled when glReadPixels() is done
+        State state = State::Free;        // Encoding is set and cleared with mutex_ locked
+        long long frame = -1;
+        int width = 0;
+        int height = 0;
+    };
+
+    // A frame read back, for the encoders. The rows are bottom up, as in OpenGL.
+    struct Image {
+        long long frame = -1;
+        int width = 0;
+        int height = 0;
+        const unsigned char* pixels = nullptr;  // RGBA, in a PBO or in 'copy'
+        std::vector<unsigned char> copy;
+        int readback = -1;  // The PBO 'pixels' is in, or -1
+    };
+
+    // Hand the oldest readback in flight to the encoders. If 'wait' is false, only if it
+    // is done; returns false if it was not.
+    bool readOldest(bool wait);
+
+    void encoderLoop();
+
+    // Write one frame. 'rgb' is scratch memory of the calling thread.
+    bool write(const Image& image, std::vector<unsigned char>& rgb);
+
+    std::string filename_;
+    Format format_;
+    double framerate_;
+    bool persistent_;                  // PBOs are mapped persistently
+    std::vector<Readback> readbacks_;  // Ring of PBOs
+    int next_;                         // Readback for the next capture()
+    int inflight_;                     // Readbacks in the Reading state, the ones before next_
+    std::vector<std::thread> encoders_;  // One for videos, which need the frames in order
+    std::mutex mutex_;                 // For the members below
+    std::condition_variable condition_;  // Signalled when queue_ or a Readback state changes
+    std::deque<Image> queue_;          // Frames for the encoders
+    std::vector<std::vector<unsigned char>> spare_;  // Copies to use again
+    int unwritten_;                    // Frames queued or being written
+    bool stop_;
+    FILE* video_;                      // Y4M or raw file, opened by the first frame
+    int videowidth_;
+    int videoheight_;
+    std::atomic<long long> written_;
+};
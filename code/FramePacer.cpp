@@ -0,0 +1,183 @@
+/*
+ * Frame pacing for the main loop
+ *
+ * This code is in the public domain.
+ */
+#include "FramePacer.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+// Seconds that OnDemand waits for an event at most. Everything that changes the picture
+// wakes the loop, so this is only a safety net.
+const double idleTimeout = 0.5;
+
+// Limits of the time before a FixedRate deadline that is spun instead of slept
+const double minSleepMargin = 0.0002;
+const double maxSleepMargin = 0.004;
+
+double seconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+}
+
+}  // namespace
+
+FramePacer::FramePacer(Mode mode, double framerate)
+    : mode_(0), swapmode_(-1), framerate_(60.0), sleepmargin_(0.001), redraw_(true),
+      frames_(0), waittime_(0.0), lateness_(0.0) {
+    setMode(mode, framerate);
+}
+
+void FramePacer::setMode(Mode mode, double framerate) {
+    mode_ = static_cast<int>(mode);
+    framerate_ = std::max(framerate, 1.0);
+    deadline_ = Clock::now();
+    redraw_ = true;
+    frames_ = 0;
+    waittime_ = 0.0;
+    lateness_ = 0.0;
+}
+
+FramePacer::Mode FramePacer::mode() const { return static_cast<Mode>(mode_.load()); }
+
+double FramePacer::frameRate() const { return framerate_; }
+
+bool FramePacer::parseMode(const std::string& text, Mode& mode, double& framerate) {
+    const Mode modes[] = {Mode::Unlimited, Mode::VSync, Mode::AdaptiveVSync, Mode::FixedRate,
+                          Mode::OnDemand};
+    for (Mode m : modes) {
+        if (text == modeName(m)) {
+            mode = m;
+            return true;
+        }
+    }
+    if (text.compare(0, 6, "fixed:") == 0) {
+        const double fps = std::atof(text.c_str() + 6);
+        if (fps > 0.0) {
+            mode = Mode::FixedRate;
+            framerate = fps;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* FramePacer::modeName(Mode mode) {
+    switch (mode) {
+        case Mode::Unlimited:
+            return "unlimited";
+        case Mode::VSync:
+            return "vsync";
+        case Mode::AdaptiveVSync:
+            return "adaptive";
+        case Mode::FixedRate:
+            return "fixed";
+        case Mode::OnDemand:
+            return "ondemand";
+    }
+    return "";
+}
+
+void FramePacer::applySwapInterval() {
+    const int mode = mode_;
+    if (mode == swapmode_) {
+        return;
+    }
+    swapmode_ = mode;
+    switch (static_cast<Mode>(mode)) {
+        case Mode::Unlimited:
+        case Mode::FixedRate:
+            glfwSwapInterval(0);
+            break;
+        case Mode::VSync:
+        case Mode::OnDemand:
+            glfwSwapInterval(1);
+            break;
+        case Mode::AdaptiveVSync:
+            // A negative interval means adaptive vsync when one of these is supported
+            if (glfwExtensionSupported("WGL_EXT_swap_control_tear") ||
+                glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+                glfwSwapInterval(-1);
+            } else {
+                glfwSwapInterval(1);
+            }
+            break;
+    }
+}
+
+void FramePacer::waitForFrame() {
+    frames_++;
+    if (mode() != Mode::FixedRate) {
+        return;
+    }
+    const Clock::time_point start = Clock::now();
+    const Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / framerate_));
+    if (start > deadline_ + period) {
+        deadline_ = start;  // Too far behind to catch up; start over instead of rushing
+    }
+    sleepUntil(deadline_);
+    const Clock::time_point end = Clock::now();
+    waittime_ += seconds(end - start);
+    lateness_ += seconds(end - deadline_);
+    deadline_ += period;
+}
+
+void FramePacer::sleepUntil(Clock::time_point deadline) {
+    const double remaining = seconds(deadline - Clock::now());
+    if (remaining > sleepmargin_) {
+        // Sleeping wakes up late by an amount that depends on the system, so remember how
+        // late it was and stop sleeping that much earlier the next time
+        const double request = remaining - sleepmargin_;
+        const Clock::time_point before = Clock::now();
+        std::this_thread::sleep_for(std::chrono::duration<double>(request));
+        const double oversleep = seconds(Clock::now() - before) - request;
+        sleepmargin_ = std::clamp(std::max(oversleep * 1.5, sleepmargin_ * 0.99),
+                                  minSleepMargin, maxSleepMargin);
+    }
+    while (Clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+}
+
+void FramePacer::processEvents() {
+    if (mode() != Mode::OnDemand || redraw_) {
+        glfwPollEvents();
+        return;
+    }
+    const Clock::time_point start = Clock::now();
+    glfwWaitEventsTimeout(idleTimeout);
+    waittime_ += seconds(Clock::now() - start);
+}
+
+void FramePacer::requestRedraw() {
+    if (!redraw_.exchange(true) && mode() == Mode::OnDemand) {
+        glfwPostEmptyEvent();  // Wakes up a processEvents() that is waiting
+    }
+}
+
+bool FramePacer::needsFrame() {
+    return redraw_.exchange(false) || mode() != Mode::OnDemand;
+}
+
+void FramePacer::watchWindow(GLFWwindow* window) {
+    glfwSetWindowUserPointer(window, this);
+    glfwSetWindowRefreshCallback(window, [](GLFWwindow* w) {
+        static_cast<FramePacer*>(glfwGetWindowUserPointer(w))->requestRedraw();
+    });
+    glfwSetFramebufferSizeCallback(window, [](GLFWwindow* w, int, int) {
+        static_cast<FramePacer*>(glfwGetWindowUserPointer(w))->requestRedraw();
+    });
+}
+
+double FramePacer::averageWait() const {
+    return (frames_ > 0) ? 1000.0 * waittime_ / double(frames_) : 0.0;
+}
+
+double FramePacer::averageLateness() const {
+    return (frames_ > 0 && mode() == Mode::FixedRate) ? 1000.0 * lateness_ / double(frames_)
+                                                       : 0.0;
+}
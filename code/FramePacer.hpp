@@ -0,0 +1,96 @@
+/*
+ * Frame pacing for the main loop: how often frames are drawn, and how the loop waits.
+ *
+ * Usage: Choose a mode, e.g. from the command line with parseMode(). In the main loop, call
+ *        processEvents() instead of glfwPollEvents(), then requestRedraw() for everything
+ *        that changed the picture, then prepare and draw a frame only if needsFrame() is
+ *        true, starting with waitForFrame(). Call applySwapInterval() on the thread where the
+ *        GL context is current, at the start of every frame; it does nothing unless the mode
+ *        changed. watchWindow() asks for a redraw when the window is resized or uncovered.
+ *        Modes:
+ *        Unlimited     - as fast as possible, without vsync. Uses a whole core and the GPU.
+ *        VSync         - one frame per display refresh, swap interval 1.
+ *        AdaptiveVSync - vsync, but a late frame is shown at once with tearing instead of
+ *                        waiting for the next refresh (swap interval -1, with
+ *                        WGL_EXT_swap_control_tear or GLX_EXT_swap_control_tear). Plain
+ *                        vsync without the extension.
+ *        FixedRate     - 'framerate' frames per second without vsync. waitForFrame() sleeps
+ *                        until shortly before the frame is due and spins for the rest. The
+ *                        sleep margin follows how late the system's sleep wakes up.
+ *        OnDemand      - a frame only after requestRedraw(), with vsync. Until then,
+ *                        processEvents() sleeps in glfwWaitEventsTimeout(), so an idle
+ *                        scene uses next to no CPU or GPU time, and input wakes it at once.
+ *        The time waited and how late each fixed rate frame started are kept, and the frame
+ *        times themselves are measured by the FrameProfiler as for every other mode.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+class FramePacer {
+public:
+    enum class Mode { Unlimited, VSync, AdaptiveVSync, FixedRate, OnDemand };
+
+    /* Constructor: 'framerate' is used in the FixedRate mode */
+    explicit FramePacer(Mode mode = Mode::VSync, double framerate = 60.0);
+
+    // Change the mode. The swap interval changes with the next applySwapInterval().
+    void setMode(Mode mode, double framerate = 60.0);
+
+    Mode mode() const;
+    double frameRate() const;
+
+    /* A mode from "unlimited", "vsync", "adaptive", "ondemand", "fixed" or "fixed:<fps>".
+     * False for anything else. */
+    static bool parseMode(const std::string& text, Mode& mode, double& framerate);
+
+    // The name of a mode, as parseMode() reads it
+    static const char* modeName(Mode mode);
+
+    // Set the swap interval of the current context for the mode, if it changed
+    void applySwapInterval();
+
+    // Wait until the next frame should be prepared. Returns at once except for FixedRate.
+    void waitForFrame();
+
+    // Process the window events. In OnDemand mode, wait for one unless a redraw is pending.
+    void processEvents();
+
+    // Draw another frame in OnDemand mode. Thread safe.
+    void requestRedraw();
+
+    /* True if a frame should be drawn now: always, except in OnDemand mode, where only
+     * after requestRedraw(). Clears the request. */
+    bool needsFrame();
+
+    /* Request a redraw when 'window' is resized or needs to be drawn again. Sets the refresh
+     * and framebuffer size callbacks and the user pointer of the window. */
+    void watchWindow(GLFWwindow* window);
+
+    // Average milliseconds per frame spent in waitForFrame() and processEvents()
+    double averageWait() const;
+
+    // Average milliseconds that FixedRate frames started after they were due
+    double averageLateness() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Sleep until 'deadline', and spin for the last part that the sleep may overshoot
+    void sleepUntil(Clock::time_point deadline);
+
+    std::atomic<int> mode_;        // Mode, set on the main thread, read on the render thread
+    std::atomic<int> swapmode_;    // The mode applySwapInterval() last set, or -1
+    double framerate_;
+    Clock::time_point deadline_;   // When the next FixedRate frame is due
+    double sleepmargin_;           // Seconds before a deadline to stop sleeping and spin
+    std::atomic<bool> redraw_;     // OnDemand: a frame is wanted
+    long long frames_;             // Frames since the mode was set
+    double waittime_;              // Seconds waited for those frames
+    double lateness_;              // Seconds the FixedRate frames were late
+};
@@ -0,0 +1,452 @@
+/*
+ * CPU and GPU frame time measurements
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "FrameProfiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "PipelineStatistics.hpp"
+#include "Trace.hpp"
+
+namespace {
+
+const float unknown = NAN;  // History value of a scope that did not run in a frame
+
+// Column of the latency in the history, after the frame time and the scopes
+const int latencyColumn = 1 + 2 * FrameProfiler::maxScopes;
+
+double milliseconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+}  // namespace
+
+FrameProfiler::FrameProfiler(int historysize)
+    : historysize_(std::max(historysize, 1))
+    , rowsize_(latencyColumn + 1)
+    , frame_(-1)
+    , history_(size_t(historysize_ + 1) * rowsize_, unknown)
+    , histogram_(histogramBuckets, 0)
+    , gpuactive_(false)
+    , titletime_(0.0)
+    , titleframe_(0) {}
+
+FrameProfiler::~FrameProfiler() {
+    for (Scope& scope : scopes_) {
+        for (Query& query : scope.queries) {
+            if (glIsQuery(query.id)) {
+                glDeleteQueries(1, &query.id);
+            }
+        }
+    }
+    for (LatencyQuery& latency : latency_) {
+        if (glIsQuery(latency.query.id)) {
+            glDeleteQueries(1, &latency.query.id);
+        }
+    }
+}
+
+float* FrameProfiler::historyRow(long long frame) {
+    return &history_[size_t(frame % (historysize_ + 1)) * rowsize_];
+}
+
+const float* FrameProfiler::historyRow(long long frame) const {
+    return &history_[size_t(frame % (historysize_ + 1)) * rowsize_];
+}
+
+void FrameProfiler::beginFrame() {
+    const Clock::time_point now = Clock::now();
+    if (frame_ >= 0) {
+        const double frametime = milliseconds(now - framestart_);
+        historyRow(frame_)[0] = static_cast<float>(frametime);
+        const int bucket = static_cast<int>(frametime / histogramBucketWidth);
+        histogram_[std::min(bucket, histogramBuckets - 1)]++;
+    }
+    if (!scopestack_.empty()) {
+        std::cerr << "FrameProfiler::beginFrame(): " << scopestack_.size()
+                  << " scopes were not ended\n";
+        while (!scopestack_.empty()) {
+            endScope();
+        }
+    }
+    collectQueries();
+    TRACE_GPU_COLLECT();
+
+    frame_++;
+    framestart_ = now;
+    float* row = historyRow(frame_);
+    std::fill(row, row + rowsize_, unknown);
+}
+
+int FrameProfiler::scopeIndex(const char* name) {
+    for (size_t i = 0; i < scopes_.size(); i++) {
+        if (scopes_[i].name == name || strcmp(scopes_[i].name, name) == 0) {
+            return static_cast<int>(i);
+        }
+    }
+    if (scopes_.size() >= maxScopes) {
+        return -1;
+    }
+    scopes_.emplace_back();
+    scopes_.back().name = name;
+    return static_cast<int>(scopes_.size()) - 1;
+}
+
+void FrameProfiler::beginScope(const char* name) {
+    if (frame_ < 0) {
+        beginFrame();
+    }
+    TRACE_BEGIN(name);
+    TRACE_GPU_BEGIN(name);
+    PipelineStatistics& statistics = PipelineStatistics::global();
+    if (statistics.mode() == PipelineStatistics::Mode::Passes) {
+        statistics.begin(PipelineStatistics::Mode::Passes, name);
+    }
+    const int index = scopeIndex(name);
+    scopestack_.push_back(index);
+    if (index < 0) {
+        return;
+    }
+    Scope& scope = scopes_[index];
+    scope.start = Clock::now();
+
+    // Only one GL_TIME_ELAPSED query can be active at a time
+    scope.gpu = !gpuactive_;
+    if (scope.gpu) {
+        Query& query = scope.queries[frame_ % queryLatency];
+        if (query.id == 0) {
+            glGenQueries(1, &query.id);
+        }
+        // A query still in use after queryLatency frames is dropped rather than waited for
+        query.frame = frame_;
+        glBeginQuery(GL_TIME_ELAPSED, query.id);
+        gpuactive_ = true;
+    }
+}
+
+void FrameProfiler::endScope() {
+    if (scopestack_.empty()) {
+        std::cerr << "FrameProfiler::endScope(): no scope to end\n";
+        return;
+    }
+    TRACE_GPU_END();
+    TRACE_END();
+    PipelineStatistics::global().end(PipelineStatistics::Mode::Passes);
+    const int index = scopestack_.back();
+    scopestack_.pop_back();
+    if (index < 0) {
+        return;
+    }
+    Scope& scope = scopes_[index];
+    float& cputime = historyRow(frame_)[1 + 2 * index];
+    const float elapsed = static_cast<float>(milliseconds(Clock::now() - scope.start));
+    // A scope that runs several times in a frame gets the sum of the times
+    cputime = std::isnan(cputime) ? elapsed : cputime + elapsed;
+    if (scope.gpu) {
+        glEndQuery(GL_TIME_ELAPSED);
+        scope.gpu = false;
+        gpuactive_ = false;
+    }
+}
+
+void FrameProfiler::measureLatency(double inputtime) {
+    if (frame_ < 0) {
+        return;
+    }
+    LatencyQuery& latency = latency_[frame_ % queryLatency];
+    if (latency.query.id == 0) {
+        glGenQueries(1, &latency.query.id);
+    }
+    latency.query.frame = frame_;
+    latency.inputtime = inputtime;
+    glQueryCounter(latency.query.id, GL_TIMESTAMP);
+}
+
+void FrameProfiler::collectQueries() {
+    for (size_t i = 0; i < scopes_.size(); i++) {
+        for (Query& query : scopes_[i].queries) {
+            if (query.frame < 0) {
+                continue;
+            }
+            GLint available = 0;
+            glGetQueryObjectiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                continue;
+            }
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &nanoseconds);
+            if (query.frame > frame_ - historysize_) {
+                float& gputime = historyRow(query.frame)[2 + 2 * i];
+                const float elapsed = static_cast<float>(1e-6 * static_cast<double>(nanoseconds));
+                gputime = std::isnan(gputime) ? elapsed : gputime + elapsed;
+            }
+            query.frame = -1;
+        }
+    }
+
+    for (LatencyQuery& latency : latency_) {
+        if (latency.query.frame < 0) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(latency.query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            continue;
+        }
+        GLuint64 finished = 0;
+        glGetQueryObjectui64v(latency.query.id, GL_QUERY_RESULT, &finished);
+        // The GPU clock has another origin than glfwGetTime(), so go by how long ago it was
+        GLint64 gpunow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpunow);
+        const double ago = 1e-9 * static_cast<double>(gpunow - static_cast<GLint64>(finished));
+        if (latency.query.frame > frame_ - historysize_) {
+            const double seconds = glfwGetTime() - ago - latency.inputtime;
+            historyRow(latency.query.frame)[latencyColumn] = static_cast<float>(1000.0 * seconds);
+        }
+        latency.query.frame = -1;
+    }
+}
+
+long long FrameProfiler::frameCount() const { return std::max(frame_, 0LL); }
+
+int FrameProfiler::historyCount() const {
+    return static_cast<int>(std::min(frameCount(), static_cast<long long>(historysize_)));
+}
+
+double FrameProfiler::frameTimePercentile(double p) const {
+    return std::max(columnPercentile(0, p), 0.0);
+}
+
+double FrameProfiler::columnPercentile(int column, double p) const {
+    std::vector<float> times;
+    times.reserve(historyCount());
+    for (long long f = frame_ - historyCount(); f < frame_; f++) {
+        const float t = historyRow(f)[column];
+        if (!std::isnan(t)) {
+            times.push_back(t);
+        }
+    }
+    if (times.empty()) {
+        return -1.0;
+    }
+    // Nearest rank percentile
+    const double rank = std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * double(times.size()));
+    const size_t n = static_cast<size_t>(std::max(rank, 1.0)) - 1;
+    std::nth_element(times.begin(), times.begin() + n, times.end());
+    return times[n];
+}
+
+double FrameProfiler::columnAverage(int column) const {
+    double sum = 0.0;
+    int count = 0;
+    for (long long f = frame_ - historyCount(); f < frame_; f++) {
+        const float t = historyRow(f)[column];
+        if (!std::isnan(t)) {
+            sum += t;
+            count++;
+        }
+    }
+    return (count > 0) ? sum / count : -1.0;
+}
+
+int FrameProfiler::findScope(const std::string& name) const {
+    for (size_t i = 0; i < scopes_.size(); i++) {
+        if (name == scopes_[i].name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+double FrameProfiler::scopeAverage(const std::string& name, int column) const {
+    const int i = findScope(name);
+    return (i >= 0) ? columnAverage(2 * i + column) : -1.0;
+}
+
+double FrameProfiler::scopeCPUTime(const std::string& name) const { return scopeAverage(name, 1); }
+
+double FrameProfiler::scopeGPUTime(const std::string& name) const { return scopeAverage(name, 2); }
+
+double FrameProfiler::scopeCPUPercentile(const std::string& name, double p) const {
+    const int i = findScope(name);
+    return (i >= 0) ? columnPercentile(2 * i + 1, p) : -1.0;
+}
+
+double FrameProfiler::scopeGPUPercentile(const std::string& name, double p) const {
+    const int i = findScope(name);
+    return (i >= 0) ? columnPercentile(2 * i + 2, p) : -1.0;
+}
+
+bool FrameProfiler::pendingFrame(long long frame) const {
+    for (const Scope& scope : scopes_) {
+        for (const Query& query : scope.queries) {
+            if (query.frame == frame) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+double FrameProfiler::latestGPUFrameTime(long long& frame) const {
+    // Older frames have dropped out of the history, or their queries were dropped
+    for (frame = frame_ - 1; frame >= 0 && frame >= frame_ - queryLatency; frame--) {
+        if (pendingFrame(frame)) {
+            continue;
+        }
+        const float* row = historyRow(frame);
+        double milliseconds = 0.0;
+        bool known = false;
+        for (size_t i = 0; i < scopes_.size(); i++) {
+            if (!std::isnan(row[2 + 2 * i])) {
+                milliseconds += row[2 + 2 * i];
+                known = true;
+            }
+        }
+        if (known) {
+            return milliseconds;
+        }
+    }
+    frame = -1;
+    return -1.0;
+}
+
+int FrameProfiler::scopeCount() const { return static_cast<int>(scopes_.size()); }
+
+const char* FrameProfiler::scopeName(int index) const { return scopes_[index].name; }
+
+int FrameProfiler::recentFrameTimes(int count, float* cpu, float* gpu) const {
+    // The current frame is still running
+    const long long first = std::max(frame_ - count, std::max(frame_ - historysize_, 0LL));
+    int written = 0;
+    for (long long f = first; f < frame_; f++) {
+        const float* row = historyRow(f);
+        float sum = 0.0f;
+        bool known = false;
+        if (!pendingFrame(f)) {
+            for (size_t i = 0; i < scopes_.size(); i++) {
+                if (!std::isnan(row[2 + 2 * i])) {
+                    sum += row[2 + 2 * i];
+                    known = true;
+                }
+            }
+        }
+        cpu[written] = row[0];
+        gpu[written] = known ? sum : -1.0f;
+        written++;
+    }
+    return written;
+}
+
+double FrameProfiler::recentScopeGPUTime(int index, int count) const {
+    const long long first = std::max(frame_ - count, std::max(frame_ - historysize_, 0LL));
+    double sum = 0.0;
+    int known = 0;
+    for (long long f = first; f < frame_; f++) {
+        const float t = historyRow(f)[2 + 2 * index];
+        if (!std::isnan(t)) {
+            sum += t;
+            known++;
+        }
+    }
+    return (known > 0) ? sum / known : -1.0;
+}
+
+double FrameProfiler::inputLatency() const { return columnAverage(latencyColumn); }
+
+const std::vector<long long>& FrameProfiler::histogram() const { return histogram_; }
+
+void FrameProfiler::updateWindowTitle(GLFWwindow* window) {
+    std::string title;
+    if (windowTitle(title)) {
+        glfwSetWindowTitle(window, title.c_str());
+    }
+}
+
+bool FrameProfiler::windowTitle(std::string& title) {
+    const double t = glfwGetTime();
+    if (t - titletime_ < 1.0) {
+        return false;
+    }
+    const double fps = static_cast<double>(frameCount() - titleframe_) / (t - titletime_);
+    titletime_ = t;
+    titleframe_ = frameCount();
+
+    char text[201];
+    const double frametime = (fps > 0.0) ? 1000.0 / fps : 0.0;
+    snprintf(text, 200, "TNM046: %.2f ms/frame (%.1f FPS), p95 %.2f ms, p99 %.2f ms", frametime,
+             fps, frameTimePercentile(95.0), frameTimePercentile(99.0));
+    title = text;
+    const double latency = inputLatency();
+    if (latency >= 0.0) {
+        snprintf(text, 200, ", latency %.1f ms", latency);
+        title += text;
+    }
+    return true;
+}
+
+bool FrameProfiler::writeCSV(const std::string& filename) const {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file) {
+        std::cerr << "FrameProfiler::writeCSV(): could not create " << filename << "\n";
+        return false;
+    }
+    fprintf(file, "frame,frame_ms");
+    for (const Scope& scope : scopes_) {
+        fprintf(file, ",%s_cpu_ms,%s_gpu_ms", scope.name, scope.name);
+    }
+    fprintf(file, ",latency_ms\n");
+    for (long long f = frame_ - historyCount(); f < frame_; f++) {
+        const float* row = historyRow(f);
+        fprintf(file, "%lld,%.4f", f, row[0]);
+        for (size_t i = 0; i < scopes_.size(); i++) {
+            for (int k = 1; k <= 2; k++) {
+                const float t = row[2 * i + k];
+                if (std::isnan(t)) {
+                    fprintf(file, ",");
+                } else {
+                    fprintf(file, ",%.4f", t);
+                }
+            }
+        }
+        if (std::isnan(row[latencyColumn])) {
+            fprintf(file, ",\n");
+        } else {
+            fprintf(file, ",%.4f\n", row[latencyColumn]);
+        }
+    }
+    return fclose(file) == 0;
+}
+
+bool FrameProfiler::writeJSON(const std::string& filename) const {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file) {
+        std::cerr << "FrameProfiler::writeJSON(): could not create " << filename << "\n";
+        return false;
+    }
+    fprintf(file, "{\n  \"frames\": %lld,\n  \"history\": %d,\n", frameCount(), historyCount());
+    fprintf(file, "  \"frame_ms\": {\"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+            frameTimePercentile(50.0), frameTimePercentile(95.0), frameTimePercentile(99.0),
+            frameTimePercentile(100.0));
+    fprintf(file, "  \"latency_ms\": %.4f,\n", inputLatency());
+    fprintf(file, "  \"histogram_bucket_ms\": %.2f,\n  \"histogram\": [", histogramBucketWidth);
+    for (int b = 0; b < histogramBuckets; b++) {
+        fprintf(file, "%s%lld", (b > 0) ? ", " : "", histogram_[b]);
+    }
+    fprintf(file, "],\n  \"scopes\": [");
+    for (size_t i = 0; i < scopes_.size(); i++) {
+        fprintf(file, "%s\n    {\"name\": \"%s\", \"cpu_ms\": %.4f, \"gpu_ms\": %.4f}",
+                (i > 0) ? "," : "", scopes_[i].name, scopeCPUTime(scopes_[i].name),
+                scopeGPUTime(scopes_[i].name));
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0;
+}
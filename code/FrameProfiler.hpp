@@ -0,0 +1,187 @@
+/*
+ * A class to measure frame times on the CPU and the GPU.
+ *
+ * Usage: Call beginFrame() at the start of every frame. Wrap the phases of the frame in
+ *        beginScope("name") and endScope(), or in a ProfileScope object. Every scope gets a
+ *        CPU time, and a GPU time from a GL_TIME_ELAPSED query. The queries are read a few
+ *        frames later when their results are available, so the GPU is never waited for.
+ *        GL_TIME_ELAPSED queries can not be nested, so only the outermost scope gets a GPU
+ *        time when scopes are nested.
+ *        The statistics are read with frameTimePercentile(), scopeCPUTime() and
+ *        scopeGPUTime(), shown with updateWindowTitle() or graphed from recentFrameTimes()
+ *        and recentScopeGPUTime() by the Overlay, and written to a file with writeCSV() (one
+ *        row per frame) or writeJSON() (a summary).
+ *        measureLatency() right after the buffer swap measures the input to photon latency:
+ *        from the time of the input that the frame shows until the GPU has finished the
+ *        frame, found with a GL_TIMESTAMP query. The time the display takes to show the
+ *        finished frame is not included.
+ *        While a trace is recorded (Trace.hpp), the scopes are on its timeline too, on the
+ *        CPU and, with GL_TIMESTAMP queries, on the GPU. The scopes are also the passes
+ *        of PipelineStatistics in its Passes mode.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <chrono>
+#include <string>
+#include <vector>
+
+class FrameProfiler {
+public:
+    /* Constructor: keep the statistics of the last 'historysize' frames */
+    explicit FrameProfiler(int historysize = 4096);
+
+    /* Destructor: delete the GL query objects */
+    ~FrameProfiler();
+
+    FrameProfiler(const FrameProfiler&) = delete;
+    FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+    // Start a new frame. The frame time is the time between two calls.
+    void beginFrame();
+
+    // Start and end a named scope within the frame. 'name' must stay valid (a literal).
+    void beginScope(const char* name);
+    void endScope();
+
+    /* Measure the latency of the current frame from 'inputtime', the glfwGetTime() of the
+     * input it shows, until the GPU has finished the commands issued so far. */
+    void measureLatency(double inputtime);
+
+    // Number of frames measured, and the number of them kept in the history
+    long long frameCount() const;
+    int historyCount() const;
+
+    // CPU frame time in milliseconds at percentile p (0 - 100) over the history
+    double frameTimePercentile(double p) const;
+
+    // Average CPU and GPU time in milliseconds of a scope over the history (-1 if unknown)
+    double scopeCPUTime(const std::string& name) const;
+    double scopeGPUTime(const std::string& name) const;
+
+    // CPU and GPU time in milliseconds of a scope at percentile p (0 - 100) over the history,
+    // -1 if unknown
+    double scopeCPUPercentile(const std::string& name, double p) const;
+    double scopeGPUPercentile(const std::string& name, double p) const;
+
+    /* The GPU time in milliseconds of the newest frame whose GPU times have all been read,
+     * the sum of its scopes, and the number of that frame in 'frame'. -1 if there is none
+     * yet. For a controller like DynamicResolution, a few frames behind the CPU. */
+    double latestGPUFrameTime(long long& frame) const;
+
+    // Number of scopes seen so far, and their names, in the order they were first begun
+    int scopeCount() const;
+    const char* scopeName(int index) const;
+
+    /* The CPU time and the GPU time (the sum of the scopes) in milliseconds of each of the
+     * last 'count' frames, oldest first, for a graph. The GPU time is -1 until all queries
+     * of the frame are read. Returns the number of frames, fewer if fewer were measured. */
+    int recentFrameTimes(int count, float* cpu, float* gpu) const;
+
+    // Average GPU time in milliseconds of scope 'index' over the last 'count' frames in
+    // which it is known, -1 if it is in none
+    double recentScopeGPUTime(int index, int count) const;
+
+    // Average input to photon latency in milliseconds over the history (-1 if unknown)
+    double inputLatency() const;
+
+    // Histogram of all CPU frame times: the number of frames in each bucket of
+    // histogramBucketWidth milliseconds. The last bucket holds all longer frames.
+    const std::vector<long long>& histogram() const;
+
+    // Show the frame time, frame rate and percentiles in the window title once per second
+    void updateWindowTitle(GLFWwindow* window);
+
+    // The same title in 'title', for a thread that may not set it. False if it is not time yet.
+    bool windowTitle(std::string& title);
+
+    // Write the history, one line per frame, with the CPU and GPU time of every scope
+    bool writeCSV(const std::string& filename) const;
+
+    // Write a summary: percentiles, histogram and average scope times
+    bool writeJSON(const std::string& filename) const;
+
+    static constexpr double histogramBucketWidth = 0.5;  // Milliseconds
+    static constexpr int histogramBuckets = 200;         // Covers 0 - 100 ms
+    static constexpr int maxScopes = 32;                 // Scopes after this many are ignored
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Frames a GPU query may take before its result is read
+    static constexpr int queryLatency = 4;
+
+    struct Query {
+        GLuint id = 0;
+        long long frame = -1;  // Frame the query belongs to, -1 if not in use
+    };
+
+    struct Scope {
+        const char* name = nullptr;
+        Clock::time_point start;
+        bool gpu = false;  // True while its GL_TIME_ELAPSED query is active
+        Query queries[queryLatency];
+    };
+
+    struct LatencyQuery {
+        Query query;             // GL_TIMESTAMP when the frame is finished
+        double inputtime = 0.0;  // glfwGetTime() of the input
+    };
+
+    // Index of a scope by name, created on first use. -1 if there are too many scopes.
+    int scopeIndex(const char* name);
+
+    // Read the GPU queries that have results, without waiting for the rest
+    void collectQueries();
+
+    // Average over the history of column 1 (CPU) or 2 (GPU) of a scope, -1 if unknown
+    double scopeAverage(const std::string& name, int column) const;
+
+    // Average over the history of a column, ignoring unknown values. -1 if all are unknown.
+    double columnAverage(int column) const;
+
+    // Percentile p of a column over the history, ignoring unknown values. -1 if all are
+    // unknown.
+    double columnPercentile(int column, double p) const;
+
+    // Index of the scope called 'name', -1 if there is none
+    int findScope(const std::string& name) const;
+
+    // True while a GPU query of 'frame' is not read yet
+    bool pendingFrame(long long frame) const;
+
+    // Milliseconds of the frame, of the scopes (CPU and GPU) and the latency, in the history
+    float* historyRow(long long frame);
+    const float* historyRow(long long frame) const;
+
+    int historysize_;                    // Number of frames kept in history_
+    int rowsize_;                        // Floats per frame in history_
+    long long frame_;                    // Current frame number, -1 before the first frame
+    Clock::time_point framestart_;       // Start of the current frame
+    std::vector<float> history_;         // Ring buffer of rows, one more than historysize_ for
+                                         // the current frame
+    std::vector<long long> histogram_;   // CPU frame time histogram
+    std::vector<Scope> scopes_;          // All scopes seen so far
+    std::vector<int> scopestack_;        // Scopes begun but not ended (-1 for ignored scopes)
+    LatencyQuery latency_[queryLatency]; // Ring of latency queries, by frame
+    bool gpuactive_;                     // True while any scope's GL query is active
+    double titletime_;                   // Time of the last window title update (seconds)
+    long long titleframe_;               // Frame number at the last window title update
+};
+
+/* Begin a profiler scope in the constructor and end it in the destructor */
+class ProfileScope {
+public:
+    ProfileScope(FrameProfiler& profiler, const char* name) : profiler_(profiler) {
+        profiler_.beginScope(name);
+    }
+    ~ProfileScope() { profiler_.endScope(); }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    FrameProfiler& profiler_;
+};
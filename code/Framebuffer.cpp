@@ -0,0 +1,74 @@
+/*
+ * Offscreen framebuffer object
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "Framebuffer.hpp"
+
+#include <iostream>
+
+#include "GpuMemory.hpp"
+
+Framebuffer::Framebuffer() : framebuffer_(0), color_(0), depth_(0), width_(0), height_(0) {}
+
+Framebuffer::~Framebuffer() {
+    if (glIsFramebuffer(framebuffer_)) {
+        glDeleteFramebuffers(1, &framebuffer_);
+    }
+    if (glIsRenderbuffer(color_)) {
+        gpumem::deleteRenderbuffers(1, &color_);
+    }
+    if (glIsRenderbuffer(depth_)) {
+        gpumem::deleteRenderbuffers(1, &depth_);
+    }
+}
+
+bool Framebuffer::create(int width, int height) {
+    if (width <= 0 || height <= 0) {
+        std::cerr << "Framebuffer::create(): invalid size " << width << " x " << height << "\n";
+        return false;
+    }
+    if (framebuffer_ == 0) {
+        glGenFramebuffers(1, &framebuffer_);
+        glGenRenderbuffers(1, &color_);
+        glGenRenderbuffers(1, &depth_);
+    }
+    width_ = width;
+    height_ = height;
+    glBindRenderbuffer(GL_RENDERBUFFER, color_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    gpumem::setRenderbuffer(color_, gpumem::Category::RenderTarget,
+                            gpumem::textureBytes(GL_RGBA8, width, height));
+    gpumem::setRenderbuffer(depth_, gpumem::Category::RenderTarget,
+                            gpumem::textureBytes(GL_DEPTH_COMPONENT24, width, height));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Framebuffer::create(): framebuffer is not complete (status 0x" << std::hex
+                  << status << std::dec << ")\n";
+        return false;
+    }
+    return true;
+}
+
+void Framebuffer::bind() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glViewport(0, 0, width_, height_);
+}
+
+void Framebuffer::unbind() { glBindFramebuffer(GL_FRAMEBUFFER, 0); }
+
+GLuint Framebuffer::id() const { return framebuffer_; }
+
+int Framebuffer::width() const { return width_; }
+
+int Framebuffer::height() const { return height_; }
@@ -0,0 +1,47 @@
+/*
+ * An offscreen framebuffer object with a color and a depth buffer, to render into without
+ * a window, or at another size than the window.
+ *
+ * Usage: Call create() with the size, then bind() before drawing. bind() also sets the
+ *        viewport to the whole framebuffer. The color buffer is GL_RGBA8 and the depth
+ *        buffer GL_DEPTH_COMPONENT24, both renderbuffers. create() can be called again to
+ *        change the size. FrameCapture reads the frames back from the bound read
+ *        framebuffer.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+
+class Framebuffer {
+public:
+    Framebuffer();
+
+    /* Destructor: delete the framebuffer and its renderbuffers */
+    ~Framebuffer();
+
+    Framebuffer(const Framebuffer&) = delete;
+    Framebuffer& operator=(const Framebuffer&) = delete;
+
+    /* Create the buffers for 'width' x 'height' pixels. False if the framebuffer is not
+     * complete. */
+    bool create(int width, int height);
+
+    // Bind the framebuffer for drawing and reading, and set the viewport to cover it
+    void bind() const;
+
+    // Bind the default framebuffer, of the window, again
+    static void unbind();
+
+    GLuint id() const;
+    int width() const;
+    int height() const;
+
+private:
+    GLuint framebuffer_;
+    GLuint color_;  // Renderbuffers
+    GLuint depth_;
+    int width_;
+    int height_;
+};
@@ -0,0 +1,155 @@
+/*
+ * View frustum culling of bounding spheres and boxes
+ *
+ * This code is in the public domain.
+ */
+#include "Frustum.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+Frustum Frustum::fromMatrix(const Mat4& m) {
+    // Clip space x, y and z are inside when -w <= x <= w and so on. Row i of m gives the
+    // clip coordinate i, so the planes are the sum and the difference of row 3 and row i.
+    Frustum frustum;
+    for (int i = 0; i < 3; i++) {
+        for (int k = 0; k < 4; k++) {
+            frustum.planes[2 * i][k] = m[4 * k + 3] + m[4 * k + i];
+            frustum.planes[2 * i + 1][k] = m[4 * k + 3] - m[4 * k + i];
+        }
+    }
+    // Unit normals, so that the plane equation gives the distance to the plane
+    for (float* plane : frustum.planes) {
+        const float length =
+            std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (length > 0.0f) {
+            for (int k = 0; k < 4; k++) {
+                plane[k] /= length;
+            }
+        }
+    }
+    return frustum;
+}
+
+bool Frustum::intersectsSphere(const float center[3], float radius) const {
+    for (const float* plane : planes) {
+        if (plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3] <
+            -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Frustum::intersectsBox(const float min[3], const float max[3]) const {
+    for (const float* plane : planes) {
+        // The corner farthest along the plane normal is inside if any point of the box is
+        const float x = (plane[0] >= 0.0f) ? max[0] : min[0];
+        const float y = (plane[1] >= 0.0f) ? max[1] : min[1];
+        const float z = (plane[2] >= 0.0f) ? max[2] : min[2];
+        if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Frustum::intersects(const mesh::Bounds& bounds) const {
+    return intersectsSphere(bounds.center, bounds.radius) && intersectsBox(bounds.min, bounds.max);
+}
+
+namespace {
+
+// One instance at a time, for the instances left over after the SIMD loop
+bool instanceVisible(const Frustum& frustum, const mesh::Bounds& bounds, const float* m) {
+    const float* c = bounds.center;
+    const float center[3] = {m[0] * c[0] + m[4] * c[1] + m[8] * c[2] + m[12],
+                             m[1] * c[0] + m[5] * c[1] + m[9] * c[2] + m[13],
+                             m[2] * c[0] + m[6] * c[1] + m[10] * c[2] + m[14]};
+    float scale2 = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        const float* column = m + 4 * k;
+        scale2 = std::max(scale2, column[0] * column[0] + column[1] * column[1] +
+                                      column[2] * column[2]);
+    }
+    return frustum.intersectsSphere(center, bounds.radius * std::sqrt(scale2));
+}
+
+}  // namespace
+
+int cullInstances(const Mat4& P, const mesh::Bounds& bounds, const float* matrices, int count,
+                  int* visible) {
+    // The frustum in view coordinates, where the model-view matrices take the spheres
+    const Frustum frustum = Frustum::fromMatrix(P);
+    int numvisible = 0;
+    int i = 0;
+#if defined(TNM046_MAT4_SSE)
+    // The planes and the sphere, each component broadcast to all four lanes
+    __m128 planes[6][4];
+    for (int p = 0; p < 6; p++) {
+        for (int k = 0; k < 4; k++) {
+            planes[p][k] = _mm_set1_ps(frustum.planes[p][k]);
+        }
+    }
+    const __m128 cx = _mm_set1_ps(bounds.center[0]);
+    const __m128 cy = _mm_set1_ps(bounds.center[1]);
+    const __m128 cz = _mm_set1_ps(bounds.center[2]);
+    const __m128 radius = _mm_set1_ps(bounds.radius);
+
+    // Four instances at a time, one instance per lane
+    for (; i + 4 <= count; i += 4) {
+        // x[k], y[k], z[k]: rows 0 to 2 of column k of the four matrices
+        __m128 x[4], y[4], z[4];
+        for (int k = 0; k < 4; k++) {
+            const float* column = matrices + 16 * size_t(i) + 4 * k;
+            __m128 c0 = _mm_loadu_ps(column);
+            __m128 c1 = _mm_loadu_ps(column + 16);
+            __m128 c2 = _mm_loadu_ps(column + 32);
+            __m128 c3 = _mm_loadu_ps(column + 48);
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+            x[k] = c0;
+            y[k] = c1;
+            z[k] = c2;
+        }
+        // The sphere centers in view coordinates
+        const __m128 vx = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(x[0], cx), _mm_mul_ps(x[1], cy)),
+            _mm_add_ps(_mm_mul_ps(x[2], cz), x[3]));
+        const __m128 vy = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(y[0], cx), _mm_mul_ps(y[1], cy)),
+            _mm_add_ps(_mm_mul_ps(y[2], cz), y[3]));
+        const __m128 vz = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(z[0], cx), _mm_mul_ps(z[1], cy)),
+            _mm_add_ps(_mm_mul_ps(z[2], cz), z[3]));
+        // The radii, scaled by the longest of the first three columns
+        __m128 scale2 = _mm_setzero_ps();
+        for (int k = 0; k < 3; k++) {
+            const __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x[k], x[k]),
+                                                         _mm_mul_ps(y[k], y[k])),
+                                              _mm_mul_ps(z[k], z[k]));
+            scale2 = _mm_max_ps(scale2, length2);
+        }
+        const __m128 minusr = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(radius, _mm_sqrt_ps(scale2)));
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            const __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(planes[p][0], vx), _mm_mul_ps(planes[p][1], vy)),
+                _mm_add_ps(_mm_mul_ps(planes[p][2], vz), planes[p][3]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, minusr));
+        }
+        const int mask = _mm_movemask_ps(inside);
+        for (int k = 0; k < 4; k++) {
+            if (mask & (1 << k)) {
+                visible[numvisible++] = i + k;
+            }
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        if (instanceVisible(frustum, bounds, matrices + 16 * size_t(i))) {
+            visible[numvisible++] = i;
+        }
+    }
+    return numvisible;
+}
@@ -0,0 +1,46 @@
+/*
+ * View frustum culling with the bounding volumes of TriangleSoup meshes.
+ *
+ * Usage: Frustum::fromMatrix(P * MV) gives the frustum in the coordinates of a mesh, for
+ *        testing its bounds() before render(). For many objects, cullInstances() tests a whole
+ *        array of model-view matrices against the frustum of P at once, four at a time with
+ *        SSE, and returns the visible ones. MeshBatch::render(P) uses it to skip draws.
+ *        The tests are conservative: an object may be reported visible when it is just
+ *        outside a corner of the frustum, but never culled when any part of it is inside.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include "Mat4.hpp"
+#include "MeshProcessing.hpp"
+
+struct Frustum {
+    // The left, right, bottom, top, near and far planes (a, b, c, d), with unit normals
+    // pointing inwards: a x + b y + c z + d >= 0 for points inside
+    float planes[6][4];
+
+    // Extract the planes from a projection matrix, or a P * MV matrix
+    // (Gribb and Hartmann, "Fast Extraction of Viewing Frustum Planes from the
+    // World-View-Projection Matrix", 2001)
+    static Frustum fromMatrix(const Mat4& m);
+
+    // True if the sphere with the given center and radius is at least partly inside
+    bool intersectsSphere(const float center[3], float radius) const;
+
+    // True if the box is at least partly inside
+    bool intersectsBox(const float min[3], const float max[3]) const;
+
+    // True if the bounding sphere and the bounding box are both at least partly inside
+    bool intersects(const mesh::Bounds& bounds) const;
+};
+
+/*
+ * Test 'count' instances of a mesh with the given bounds against the view frustum of the
+ * projection P. Each instance has a model-view matrix of 16 floats in 'matrices', as for
+ * TriangleSoup::setInstanceTransforms(). The sphere of each instance is scaled by the largest
+ * scaling of its matrix. Writes the numbers of the visible instances, in order, to 'visible'
+ * (room for 'count' ints) and returns how many there are.
+ */
+int cullInstances(const Mat4& P, const mesh::Bounds& bounds, const float* matrices, int count,
+                  int* visible);
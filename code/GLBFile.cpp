@@ -0,0 +1,426 @@
+/*
+ * A reader of binary glTF 2.0 files
+ *
+ * This code is in the public domain.
+ */
+#include "GLBFile.hpp"
+
+#include "MeshCodec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+// The file header, "glTF" and version 2, and the types of the chunks
+const uint32_t glbMagic = 0x46546C67;
+const uint32_t glbVersion = 2;
+const uint32_t chunkJSON = 0x4E4F534A;
+const uint32_t chunkBIN = 0x004E4942;
+
+// The component types of glTF, which are the OpenGL enums
+const int componentByte = 5120;
+const int componentUnsignedByte = 5121;
+const int componentShort = 5122;
+const int componentUnsignedShort = 5123;
+const int componentUnsignedInt = 5125;
+const int componentFloat = 5126;
+
+// The extensions that open() accepts in "extensionsRequired"
+const char* const supportedExtensions[] = {"KHR_mesh_quantization", "EXT_meshopt_compression"};
+
+uint32_t readU32(const unsigned char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+size_t componentSize(int type) {
+    switch (type) {
+        case componentByte:
+        case componentUnsignedByte:
+            return 1;
+        case componentShort:
+        case componentUnsignedShort:
+            return 2;
+        case componentUnsignedInt:
+        case componentFloat:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+// The largest value of a normalized integer type, which maps to 1
+float normalizedMax(int type) {
+    switch (type) {
+        case componentByte:
+            return 127.0f;
+        case componentUnsignedByte:
+            return 255.0f;
+        case componentShort:
+            return 32767.0f;
+        case componentUnsignedShort:
+            return 65535.0f;
+        default:
+            return 1.0f;
+    }
+}
+
+// The components of the accessor types of glTF
+struct AccessorType {
+    const char* name;
+    int components;
+};
+const AccessorType accessorTypes[] = {{"SCALAR", 1}, {"VEC2", 2}, {"VEC3", 3}, {"VEC4", 4},
+                                      {"MAT2", 4},   {"MAT3", 9}, {"MAT4", 16}};
+
+int componentCount(const std::string& type) {
+    for (const AccessorType& t : accessorTypes) {
+        if (type == t.name) {
+            return t.components;
+        }
+    }
+    return 0;
+}
+
+// A size or offset of the JSON, or 'fallback' for a value that is not a count of bytes
+size_t sizeValue(const json::Value& value, size_t fallback = 0) {
+    const double number = value.asNumber(-1.0);
+    return (number >= 0.0 && number < 9.0e15) ? static_cast<size_t>(number) : fallback;
+}
+
+}  // namespace
+
+size_t GLBFile::Accessor::elementSize() const {
+    return componentSize(componenttype) * size_t(components);
+}
+
+float GLBFile::Accessor::get(size_t i, int component) const {
+    const unsigned char* p = data + i * stride + componentSize(componenttype) * component;
+    float value = 0.0f;
+    switch (componenttype) {
+        case componentByte:
+            value = float(static_cast<int8_t>(*p));
+            break;
+        case componentUnsignedByte:
+            value = float(*p);
+            break;
+        case componentShort: {
+            int16_t v;
+            std::memcpy(&v, p, sizeof(v));
+            value = float(v);
+            break;
+        }
+        case componentUnsignedShort: {
+            uint16_t v;
+            std::memcpy(&v, p, sizeof(v));
+            value = float(v);
+            break;
+        }
+        case componentUnsignedInt:
+            value = float(readU32(p));
+            break;
+        case componentFloat:
+            std::memcpy(&value, p, sizeof(value));
+            break;
+        default:
+            break;
+    }
+    // As in OpenGL, the smallest signed value is -1 as well as the one above it
+    return normalized ? std::max(value / normalizedMax(componenttype), -1.0f) : value;
+}
+
+GLBFile::GLBFile() : bin_(nullptr), binsize_(0) {}
+
+GLBFile::~GLBFile() { close(); }
+
+bool GLBFile::open(const std::string& filename) {
+    close();
+    filename_ = filename;
+    if (!file_.open(filename)) {
+        std::cerr << "File not found: " << filename << "\n";
+        return false;
+    }
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(file_.data());
+    const size_t size = file_.size();
+    // The header, and the JSON chunk that must follow it
+    if (size < 20 || readU32(data) != glbMagic || readU32(data + 4) != glbVersion ||
+        readU32(data + 8) > size || readU32(data + 16) != chunkJSON ||
+        readU32(data + 12) > size - 20) {
+        std::cerr << "GLBFile::open(\"" << filename << "\"): not a glTF 2.0 binary file\n";
+        close();
+        return false;
+    }
+    const size_t length = readU32(data + 8);
+    const size_t jsonsize = readU32(data + 12);
+    std::string error;
+    if (!json::parse(reinterpret_cast<const char*>(data + 20), jsonsize, document_, &error)) {
+        std::cerr << "GLBFile::open(\"" << filename << "\"): " << error << "\n";
+        close();
+        return false;
+    }
+    // The binary chunk, if there is one, starts at the next multiple of 4
+    const size_t binheader = 20 + ((jsonsize + 3) & ~size_t(3));
+    if (binheader + 8 <= length && readU32(data + binheader + 4) == chunkBIN &&
+        readU32(data + binheader) <= length - binheader - 8) {
+        bin_ = data + binheader + 8;
+        binsize_ = readU32(data + binheader);
+    }
+
+    const json::Value& required = document_["extensionsRequired"];
+    for (size_t i = 0; i < required.size(); i++) {
+        const std::string& name = required[i].asString();
+        if (std::none_of(std::begin(supportedExtensions), std::end(supportedExtensions),
+                         [&](const char* supported) { return name == supported; })) {
+            std::cerr << "GLBFile::open(\"" << filename << "\"): the extension " << name
+                      << " is not supported\n";
+            close();
+            return false;
+        }
+    }
+
+    // Buffers in files of their own are mapped too, next to the GLB file
+    const json::Value& buffers = document_["buffers"];
+    buffers_.resize(buffers.size());
+    const size_t slash = filename.find_last_of("/\\");
+    const std::string directory = (slash == std::string::npos) ? "" : filename.substr(0, slash + 1);
+    for (size_t i = 0; i < buffers.size(); i++) {
+        const std::string& uri = buffers[i]["uri"].asString();
+        if (uri.empty()) {
+            continue;
+        }
+        if (uri.compare(0, 5, "data:") == 0) {
+            std::cerr << "GLBFile::open(\"" << filename << "\"): data URIs are not supported\n";
+            close();
+            return false;
+        }
+        buffers_[i] = std::make_unique<MappedFile>(directory + uri);
+        if (!buffers_[i]->isOpen()) {
+            std::cerr << "GLBFile::open(\"" << filename << "\"): buffer file not found: "
+                      << directory + uri << "\n";
+            close();
+            return false;
+        }
+    }
+    decoded_.resize(document_["bufferViews"].size());
+    return true;
+}
+
+void GLBFile::close() {
+    file_.close();
+    document_ = json::Value();
+    bin_ = nullptr;
+    binsize_ = 0;
+    buffers_.clear();
+    decoded_.clear();
+}
+
+int GLBFile::meshCount() const { return static_cast<int>(document_["meshes"].size()); }
+
+int GLBFile::primitiveCount(int mesh) const {
+    return static_cast<int>(document_["meshes"][mesh]["primitives"].size());
+}
+
+bool GLBFile::primitive(int mesh, int index, Primitive& primitive) const {
+    const json::Value& p = document_["meshes"][mesh]["primitives"][index];
+    if (!p.isObject()) {
+        return false;
+    }
+    const json::Value& attributes = p["attributes"];
+    primitive.position = attributes["POSITION"].asInt(-1);
+    primitive.normal = attributes["NORMAL"].asInt(-1);
+    primitive.texcoord = attributes["TEXCOORD_0"].asInt(-1);
+    primitive.indices = p["indices"].asInt(-1);
+    primitive.mode = p["mode"].asInt(4);
+    return true;
+}
+
+const unsigned char* GLBFile::bufferData(int index, size_t& size) const {
+    const json::Value& buffer = document_["buffers"][index];
+    if (!buffer.isObject()) {
+        return nullptr;
+    }
+    size = sizeValue(buffer["byteLength"]);
+    if (buffers_[index]) {
+        const MappedFile& file = *buffers_[index];
+        return size <= file.size() ? reinterpret_cast<const unsigned char*>(file.data())
+                                   : nullptr;
+    }
+    // Only the first buffer can be the binary chunk, and may be up to 3 bytes shorter
+    return (index == 0 && bin_ != nullptr && size <= binsize_) ? bin_ : nullptr;
+}
+
+const unsigned char* GLBFile::viewData(int index, size_t& size) {
+    const json::Value& view = document_["bufferViews"][index];
+    if (!view.isObject()) {
+        return nullptr;
+    }
+    size = sizeValue(view["byteLength"]);
+    const json::Value& compression = view["extensions"]["EXT_meshopt_compression"];
+    if (compression.isObject()) {
+        if (decoded_[index].empty() && !decodeView(index, compression)) {
+            return nullptr;
+        }
+        size = decoded_[index].size();
+        return decoded_[index].data();
+    }
+    size_t buffersize = 0;
+    const unsigned char* buffer = bufferData(view["buffer"].asInt(-1), buffersize);
+    const size_t offset = sizeValue(view["byteOffset"]);
+    if (buffer == nullptr || offset > buffersize || size > buffersize - offset) {
+        return nullptr;
+    }
+    return buffer + offset;
+}
+
+bool GLBFile::decodeView(int index, const json::Value& compression) {
+    size_t buffersize = 0;
+    const unsigned char* buffer = bufferData(compression["buffer"].asInt(-1), buffersize);
+    const size_t offset = sizeValue(compression["byteOffset"]);
+    const size_t length = sizeValue(compression["byteLength"]);
+    const size_t stride = sizeValue(compression["byteStride"]);
+    const size_t count = sizeValue(compression["count"]);
+    const std::string& mode = compression["mode"].asString();
+    const std::string& filter = compression["filter"].asString();
+    if (buffer == nullptr || offset > buffersize || length > buffersize - offset ||
+        stride == 0 || stride > 256 || count > (size_t(1) << 32)) {
+        std::cerr << "GLBFile: " << filename_ << ": compressed buffer view " << index
+                  << " is outside its buffer\n";
+        return false;
+    }
+
+    std::vector<unsigned char>& decoded = decoded_[index];
+    decoded.resize(count * stride);
+    bool ok = false;
+    if (mode == "ATTRIBUTES") {
+        ok = meshcodec::decodeVertexBuffer(decoded.data(), count, stride, buffer + offset,
+                                           length);
+    } else if (mode == "TRIANGLES") {
+        ok = meshcodec::decodeIndexBuffer(decoded.data(), count, stride, buffer + offset,
+                                          length);
+    } else if (mode == "INDICES") {
+        ok = meshcodec::decodeIndexSequence(decoded.data(), count, stride, buffer + offset,
+                                            length);
+    }
+    if (ok && mode == "ATTRIBUTES") {
+        if (filter == "OCTAHEDRAL" && (stride == 4 || stride == 8)) {
+            meshcodec::decodeFilterOctahedral(decoded.data(), count, stride);
+        } else if (filter == "QUATERNION" && stride == 8) {
+            meshcodec::decodeFilterQuaternion(decoded.data(), count);
+        } else if (filter == "EXPONENTIAL" && stride % 4 == 0) {
+            meshcodec::decodeFilterExponential(decoded.data(), count * stride / 4);
+        } else if (!filter.empty() && filter != "NONE") {
+            ok = false;
+        }
+    }
+    if (!ok) {
+        std::cerr << "GLBFile: " << filename_ << ": could not decode buffer view " << index
+                  << " (mode " << mode << ", filter " << (filter.empty() ? "NONE" : filter)
+                  << ")\n";
+        decoded = std::vector<unsigned char>();
+    }
+    return ok;
+}
+
+bool GLBFile::accessor(int index, Accessor& accessor) {
+    const json::Value& a = document_["accessors"][index];
+    if (!a.isObject()) {
+        std::cerr << "GLBFile: " << filename_ << ": no accessor " << index << "\n";
+        return false;
+    }
+    accessor = Accessor();
+    accessor.count = sizeValue(a["count"]);
+    accessor.components = componentCount(a["type"].asString());
+    accessor.componenttype = a["componentType"].asInt();
+    accessor.normalized = a["normalized"].asBool();
+    accessor.view = a["bufferView"].asInt(-1);
+    const size_t elementsize = accessor.elementSize();
+    if (elementsize == 0 || accessor.view < 0 || a.has("sparse")) {
+        std::cerr << "GLBFile: " << filename_ << ": accessor " << index
+                  << " has no data of its own or an unknown type\n";
+        return false;
+    }
+
+    size_t viewsize = 0;
+    const unsigned char* view = viewData(accessor.view, viewsize);
+    if (view == nullptr) {
+        std::cerr << "GLBFile: " << filename_ << ": buffer view " << accessor.view
+                  << " of accessor " << index << " has no data\n";
+        return false;
+    }
+    const size_t offset = sizeValue(a["byteOffset"]);
+    accessor.stride = sizeValue(document_["bufferViews"][accessor.view]["byteStride"]);
+    if (accessor.stride == 0) {
+        accessor.stride = elementsize;
+    }
+    if (accessor.stride < elementsize || offset > viewsize ||
+        (accessor.count > 0 &&
+         (accessor.count - 1 > (viewsize - offset) / accessor.stride ||
+          (accessor.count - 1) * accessor.stride + elementsize > viewsize - offset))) {
+        std::cerr << "GLBFile: " << filename_ << ": accessor " << index
+                  << " is outside its buffer view\n";
+        return false;
+    }
+    accessor.data = view + offset;
+
+    const json::Value& min = a["min"];
+    const json::Value& max = a["max"];
+    const int bounded = std::min(accessor.components, 3);
+    if (min.size() >= size_t(bounded) && max.size() >= size_t(bounded)) {
+        accessor.hasbounds = true;
+        // Exporters give the bounds of normalized data as the integers or as the normalized
+        // values, and only the integers can be outside [-1,1]
+        bool integers = false;
+        for (int c = 0; c < bounded; c++) {
+            accessor.min[c] = float(min[c].asNumber());
+            accessor.max[c] = float(max[c].asNumber());
+            integers = integers || std::fabs(accessor.min[c]) > 1.0f ||
+                       std::fabs(accessor.max[c]) > 1.0f;
+        }
+        if (accessor.normalized && integers) {
+            const float scale = normalizedMax(accessor.componenttype);
+            for (int c = 0; c < bounded; c++) {
+                accessor.min[c] = std::max(accessor.min[c] / scale, -1.0f);
+                accessor.max[c] = std::max(accessor.max[c] / scale, -1.0f);
+            }
+        }
+    }
+    return true;
+}
+
+void GLBFile::meshTransform(int mesh, float translation[3], float scale[3]) const {
+    for (int c = 0; c < 3; c++) {
+        translation[c] = 0.0f;
+        scale[c] = 1.0f;
+    }
+    const json::Value& nodes = document_["nodes"];
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const json::Value& node = nodes[i];
+        if (node["mesh"].asInt(-1) != mesh) {
+            continue;
+        }
+        const json::Value& matrix = node["matrix"];
+        if (matrix.size() == 16) {
+            // Column major, with the scaling as the lengths of the first three columns
+            for (int c = 0; c < 3; c++) {
+                translation[c] = float(matrix[12 + c].asNumber());
+                const double x = matrix[4 * c].asNumber();
+                const double y = matrix[4 * c + 1].asNumber();
+                const double z = matrix[4 * c + 2].asNumber();
+                scale[c] = float(std::sqrt(x * x + y * y + z * z));
+            }
+        } else {
+            for (int c = 0; c < 3; c++) {
+                translation[c] = float(node["translation"][c].asNumber(0.0));
+                scale[c] = float(node["scale"][c].asNumber(1.0));
+            }
+        }
+        return;
+    }
+}
+
+const json::Value& GLBFile::document() const { return document_; }
@@ -0,0 +1,104 @@
+/*
+ * A reader of binary glTF 2.0 files (GLB), which gives the meshes as views of the
+ * memory mapped file, ready to be sent to OpenGL as they are.
+ *
+ * Usage: open() a GLB file, then get the accessors of a primitive of a mesh and their data
+ *        with primitive() and accessor(). An accessor points into the binary chunk of the
+ *        file, or into a buffer file next to it, with the layout that glTF gives it, so the
+ *        vertex and index data need no parsing. Buffer views compressed with
+ *        EXT_meshopt_compression are decoded the first time one of their accessors is
+ *        asked for, and kept until close(). Quantized attributes of KHR_mesh_quantization
+ *        are normal accessors with integer components, and the translation and scaling of
+ *        the node of the mesh, from meshTransform(), turn their positions into those of the
+ *        mesh. Data URIs, sparse accessors and other compression extensions are not
+ *        supported. The file must be little endian, like the machines it is read on.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Json.hpp"
+#include "MappedFile.hpp"
+
+class GLBFile {
+public:
+    // The elements of an accessor in memory
+    struct Accessor {
+        const unsigned char* data = nullptr;  // The first element
+        size_t count = 0;                     // Number of elements
+        size_t stride = 0;                    // Bytes from one element to the next
+        int components = 0;                   // 1 for SCALAR to 4 for VEC4, 16 for MAT4
+        int componenttype = 0;                // GL_BYTE to GL_FLOAT, as in glTF
+        bool normalized = false;              // Integers are mapped to [0,1] or [-1,1]
+        int view = -1;                        // The buffer view, which others may share
+        bool hasbounds = false;               // min and max were given for the elements
+        float min[3] = {0.0f, 0.0f, 0.0f};   // Of the first three components, normalized
+        float max[3] = {0.0f, 0.0f, 0.0f};   // like the data
+
+        // Bytes of one element, without the padding of the stride
+        size_t elementSize() const;
+
+        // A component of element 'i' as a float, normalized as the GPU would
+        float get(size_t i, int component) const;
+    };
+
+    // The accessors of a primitive, -1 for the attributes that it does not have
+    struct Primitive {
+        int position = -1;
+        int normal = -1;
+        int texcoord = -1;  // TEXCOORD_0
+        int indices = -1;   // -1 for a primitive without an index array
+        int mode = 4;       // GL_TRIANGLES and the other modes of glDrawArrays()
+    };
+
+    GLBFile();
+    ~GLBFile();
+
+    GLBFile(const GLBFile&) = delete;
+    GLBFile& operator=(const GLBFile&) = delete;
+
+    /* Map the file and parse its JSON chunk. False if it is not a valid GLB file or needs an
+     * extension that is not supported, with the errors printed. */
+    bool open(const std::string& filename);
+
+    // Unmap the files and free the decoded buffer views
+    void close();
+
+    int meshCount() const;
+    int primitiveCount(int mesh) const;
+
+    /* The accessors of primitive 'index' of 'mesh'. False if there is no such primitive. */
+    bool primitive(int mesh, int index, Primitive& primitive) const;
+
+    /* The data of accessor 'index', decoded first if it is compressed. False if the accessor
+     * is not there, its data is outside its buffer or can not be decoded, with the errors
+     * printed. */
+    bool accessor(int index, Accessor& accessor);
+
+    /* The translation and scaling of the first node that uses 'mesh', or zero and one if no
+     * node does. The rotation, and the nodes above it, are not included. */
+    void meshTransform(int mesh, float translation[3], float scale[3]) const;
+
+    // The JSON of the file, for everything else in it
+    const json::Value& document() const;
+
+private:
+    // The bytes of buffer 'index', nullptr if it has no data in the files
+    const unsigned char* bufferData(int index, size_t& size) const;
+    // The bytes of buffer view 'index', decoded if it is compressed
+    const unsigned char* viewData(int index, size_t& size);
+    bool decodeView(int index, const json::Value& compression);
+
+    std::string filename_;
+    MappedFile file_;
+    json::Value document_;
+    const unsigned char* bin_;  // The binary chunk, buffer 0
+    size_t binsize_;
+    std::vector<std::unique_ptr<MappedFile>> buffers_;         // Buffer files, by buffer
+    std::vector<std::vector<unsigned char>> decoded_;          // Decoded views, by view
+};
@@ -0,0 +1,243 @@
+/*
+ * Debug output of the GL driver, counted by kind, and labels on our GL objects
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "GLDebug.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#endif
+
+namespace {
+
+// The messages of one source, type and id
+struct Kind {
+    GLenum source;
+    GLenum type;
+    GLuint id;
+    GLenum severity;
+    size_t count;
+    std::string text;  // Of the first message
+    std::string site;  // Of the first message
+};
+
+using KindKey = std::tuple<GLenum, GLenum, GLuint>;
+
+struct Messages {
+    std::mutex mutex;
+    std::map<KindKey, Kind> kinds;
+    size_t count = 0;
+};
+
+// Never destroyed, for the objects that are deleted at exit
+Messages& messages() {
+    static Messages* instance = new Messages();
+    return *instance;
+}
+
+std::atomic<bool> active{false};
+GLint maxlabel = 0;
+
+const char* sourceName(GLenum source) {
+    switch (source) {
+        case GL_DEBUG_SOURCE_API:
+            return "API";
+        case GL_DEBUG_SOURCE_WINDOW_SYSTEM:
+            return "window system";
+        case GL_DEBUG_SOURCE_SHADER_COMPILER:
+            return "shader compiler";
+        case GL_DEBUG_SOURCE_THIRD_PARTY:
+            return "third party";
+        case GL_DEBUG_SOURCE_APPLICATION:
+            return "application";
+        default:
+            return "other";
+    }
+}
+
+const char* typeName(GLenum type) {
+    switch (type) {
+        case GL_DEBUG_TYPE_ERROR:
+            return "error";
+        case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
+            return "deprecated";
+        case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
+            return "undefined behavior";
+        case GL_DEBUG_TYPE_PORTABILITY:
+            return "portability";
+        case GL_DEBUG_TYPE_PERFORMANCE:
+            return "performance";
+        case GL_DEBUG_TYPE_MARKER:
+            return "marker";
+        default:
+            return "other";
+    }
+}
+
+void GLAPIENTRY receive(GLenum source, GLenum type, GLuint id, GLenum severity,
+                        GLsizei length, const GLchar* message, const void* userparam);
+
+/* The first return address on the stack that is in the program again after the driver,
+ * which is where our code made the GL call */
+std::string callSite() {
+#if defined(__GLIBC__)
+    void* frames[32];
+    const int count = backtrace(frames, 32);
+    Dl_info self;
+    if (!dladdr(reinterpret_cast<void*>(&receive), &self)) {
+        return "an unknown place";
+    }
+    bool indriver = false;
+    for (int i = 1; i < count; i++) {
+        Dl_info info;
+        if (!dladdr(frames[i], &info)) {
+            continue;
+        }
+        const bool inprogram = info.dli_fbase == self.dli_fbase;
+        if (!inprogram) {
+            indriver = true;
+            continue;
+        }
+        if (!indriver) {
+            continue;  // Still in this file, before the driver called us
+        }
+        if (info.dli_sname != nullptr) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            const std::string name = (status == 0 && demangled) ? demangled : info.dli_sname;
+            std::free(demangled);
+            return name;
+        }
+        // -1 for the call instruction rather than the one after it
+        char offset[64];
+        snprintf(offset, sizeof(offset), "+0x%lx",
+                 static_cast<unsigned long>(static_cast<const char*>(frames[i]) -
+                                            static_cast<const char*>(info.dli_fbase) - 1));
+        return std::string(info.dli_fname) + offset;
+    }
+#endif
+    return "an unknown place";
+}
+
+void GLAPIENTRY receive(GLenum source, GLenum type, GLuint id, GLenum severity,
+                        GLsizei length, const GLchar* message, const void* /*userparam*/) {
+    std::string text = length >= 0 ? std::string(message, static_cast<size_t>(length))
+                                   : std::string(message);
+    while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) {
+        text.pop_back();
+    }
+
+    Messages& m = messages();
+    std::lock_guard<std::mutex> lock(m.mutex);
+    m.count++;
+    auto inserted = m.kinds.emplace(KindKey(source, type, id), Kind());
+    Kind& kind = inserted.first->second;
+    kind.count++;
+    if (!inserted.second) {
+        return;
+    }
+    kind.source = source;
+    kind.type = type;
+    kind.id = id;
+    kind.severity = severity;
+    kind.text = text;
+    kind.site = callSite();
+    // Notifications are only counted, as some drivers send one for every buffer upload
+    if (severity != GL_DEBUG_SEVERITY_NOTIFICATION) {
+        std::cerr << "GL " << typeName(type) << " (" << sourceName(source) << ", id " << id
+                  << ") at " << kind.site << ": " << text << "\n";
+    }
+}
+
+}  // namespace
+
+namespace gldebug {
+
+bool enable(Filter filter) {
+    if (!GLEW_VERSION_4_3 && !GLEW_KHR_debug) {
+        std::cerr << "gldebug::enable(): KHR_debug is not supported\n";
+        return false;
+    }
+    glEnable(GL_DEBUG_OUTPUT);
+    // In the call that caused the message, so that the stack shows where it was
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    glDebugMessageCallback(receive, nullptr);
+    if (filter == Filter::Performance) {
+        glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+        glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE, 0, nullptr,
+                              GL_TRUE);
+        glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_PERFORMANCE, GL_DONT_CARE, 0, nullptr,
+                              GL_TRUE);
+    } else {
+        glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+        if (filter == Filter::Warnings) {
+            glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0,
+                                  nullptr, GL_FALSE);
+        }
+    }
+    glGetIntegerv(GL_MAX_LABEL_LENGTH, &maxlabel);
+    active.store(true);
+    return true;
+}
+
+bool enabled() { return active.load(std::memory_order_relaxed); }
+
+void label(GLenum identifier, GLuint name, const std::string& text) {
+    if (!enabled() || name == 0) {
+        return;
+    }
+    // Labels longer than the limit are an error, so they are cut to the end, which is the
+    // part of a path that tells most
+    const size_t limit = maxlabel > 1 ? static_cast<size_t>(maxlabel) - 1 : text.size();
+    const size_t start = text.size() > limit ? text.size() - limit : 0;
+    glObjectLabel(identifier, name, static_cast<GLsizei>(text.size() - start),
+                  text.c_str() + start);
+}
+
+size_t messageCount() {
+    Messages& m = messages();
+    std::lock_guard<std::mutex> lock(m.mutex);
+    return m.count;
+}
+
+size_t kindCount() {
+    Messages& m = messages();
+    std::lock_guard<std::mutex> lock(m.mutex);
+    return m.kinds.size();
+}
+
+void report(std::ostream& out) {
+    std::vector<Kind> kinds;
+    {
+        Messages& m = messages();
+        std::lock_guard<std::mutex> lock(m.mutex);
+        for (const auto& kind : m.kinds) {
+            kinds.push_back(kind.second);
+        }
+    }
+    std::stable_sort(kinds.begin(), kinds.end(),
+                     [](const Kind& a, const Kind& b) { return a.count > b.count; });
+    out << "GL debug messages: " << kinds.size() << " kinds\n";
+    for (const Kind& kind : kinds) {
+        out << "  " << kind.count << " x " << typeName(kind.type) << " ("
+            << sourceName(kind.source) << ", id " << kind.id << "), first at " << kind.site
+            << ": " << kind.text << "\n";
+    }
+}
+
+}  // namespace gldebug
@@ -0,0 +1,56 @@
+/*
+ * Debug output of the GL driver through KHR_debug, with the performance warnings counted by
+ * kind, and labels on our objects so that the messages and the debuggers show their names.
+ *
+ * Usage: Create the window with the hint GLFW_OPENGL_DEBUG_CONTEXT, since drivers only tell
+ *        much in a debug context, and call enable() once GLEW is initialised. The messages
+ *        then arrive on the thread that made the GL call, while it makes it: errors are
+ *        printed the first time they are seen, and the first message of each kind of
+ *        performance warning (shader recompiles, stalls on buffers in use, software
+ *        fallbacks) is printed with the place in our code that made the call. All of them
+ *        are counted by kind, and report() lists the kinds with how often each was seen.
+ *        The place is found by walking the stack up to the first return address in the
+ *        program itself, which is a function name when linked with -rdynamic, or an offset
+ *        for addr2line otherwise, and only on glibc.
+ *        label() names a buffer, vertex array, texture or program, as TriangleSoup,
+ *        BufferPool, Texture and Shader do for theirs. It does nothing when debug output is
+ *        not enabled, so that a normal run pays nothing.
+ *        Only the context that was current when enable() was called reports messages.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+namespace gldebug {
+
+enum class Filter {
+    Performance,  // Errors and performance warnings
+    Warnings,     // Every message but the notifications
+    All,          // Also the notifications, which some drivers send for every buffer
+};
+
+/* Turn on debug output for the current context. False, with a message, without
+ * KHR_debug. */
+bool enable(Filter filter = Filter::Performance);
+
+// True after enable() succeeded
+bool enabled();
+
+/* Name the object 'name' of kind 'identifier' (GL_BUFFER, GL_VERTEX_ARRAY, GL_TEXTURE or
+ * GL_PROGRAM) for the messages of the driver and for debuggers like RenderDoc */
+void label(GLenum identifier, GLuint name, const std::string& text);
+
+// Messages received, and kinds of messages
+size_t messageCount();
+size_t kindCount();
+
+/* Print every kind of message with its count, its first text and the place of the first
+ * call, most frequent first */
+void report(std::ostream& out);
+
+}  // namespace gldebug
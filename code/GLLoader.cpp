@@ -0,0 +1,164 @@
+/*
+ * Loading of the OpenGL functions that the program calls
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "GLLoader.hpp"
+
+#include <GLFW/glfw3.h>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+
+namespace {
+
+// The GL functions after OpenGL 1.1 that the sources call, each with the OpenGL version
+// that has it as 10 * major + minor, or 0 if only extensions have it, see GLLoader.hpp
+#define GLLOADER_FUNCTIONS(X) \
+    X(ActiveTexture, 13) X(AttachShader, 20) X(BeginConditionalRender, 30) X(BeginQuery, 15) \
+    X(BeginTransformFeedback, 30) X(BindBuffer, 15) X(BindBufferBase, 31) X(BindBufferRange, 31) \
+    X(BindFramebuffer, 30) X(BindImageTexture, 42) X(BindRenderbuffer, 30) X(BindVertexArray, 30) \
+    X(BlendFuncSeparate, 14) X(BlitFramebuffer, 30) X(BufferData, 15) X(BufferStorage, 44) \
+    X(BufferSubData, 15) X(CheckFramebufferStatus, 30) X(ClearBufferfv, 30) X(ClearBufferuiv, 30) \
+    X(ClientWaitSync, 32) X(CompileShader, 20) X(CompressedTexImage2D, 13) \
+    X(CompressedTexSubImage2D, 13) X(CreateBuffers, 45) X(CreateProgram, 20) X(CreateShader, 20) \
+    X(CreateVertexArrays, 45) X(DebugMessageCallback, 43) X(DebugMessageControl, 43) \
+    X(DeleteBuffers, 15) X(DeleteFramebuffers, 30) X(DeleteProgram, 20) X(DeleteQueries, 15) \
+    X(DeleteRenderbuffers, 30) X(DeleteShader, 20) X(DeleteSync, 32) X(DeleteVertexArrays, 30) \
+    X(DisableVertexArrayAttrib, 45) X(DisableVertexAttribArray, 20) X(DispatchCompute, 43) \
+    X(DrawArraysInstanced, 31) X(DrawBuffers, 20) X(DrawElementsInstanced, 31) \
+    X(DrawElementsInstancedBaseVertex, 32) X(EnableVertexArrayAttrib, 45) \
+    X(EnableVertexAttribArray, 20) X(EndConditionalRender, 30) X(EndQuery, 15) \
+    X(EndTransformFeedback, 30) X(FenceSync, 32) X(FramebufferRenderbuffer, 30) \
+    X(FramebufferTexture, 32) X(FramebufferTexture2D, 30) X(FramebufferTextureLayer, 30) \
+    X(FramebufferTextureMultiviewOVR, 0) X(GenBuffers, 15) X(GenFramebuffers, 30) \
+    X(GenQueries, 15) X(GenRenderbuffers, 30) X(GenVertexArrays, 30) X(GenerateMipmap, 30) \
+    X(GetActiveUniform, 20) X(GetCompressedTexImage, 13) X(GetInteger64v, 32) \
+    X(GetInternalformativ, 42) X(GetProgramBinary, 41) X(GetProgramInfoLog, 20) \
+    X(GetProgramiv, 20) X(GetQueryObjectiv, 15) X(GetQueryObjectui64v, 33) X(GetShaderInfoLog, 20) \
+    X(GetShaderiv, 20) X(GetStringi, 30) X(GetTextureHandleARB, 0) X(GetUniformBlockIndex, 31) \
+    X(GetUniformLocation, 20) X(IsBuffer, 15) X(IsFramebuffer, 30) X(IsQuery, 15) \
+    X(IsRenderbuffer, 30) X(IsTextureHandleResidentARB, 0) X(IsVertexArray, 30) X(LinkProgram, 20) \
+    X(MakeTextureHandleNonResidentARB, 0) X(MakeTextureHandleResidentARB, 0) X(MapBufferRange, 30) \
+    X(MaxShaderCompilerThreadsARB, 0) X(MemoryBarrier, 42) X(MultiDrawElements, 14) \
+    X(MultiDrawElementsIndirect, 43) X(NamedBufferStorage, 45) X(NamedBufferSubData, 45) \
+    X(ObjectLabel, 43) X(ProgramBinary, 41) X(ProgramParameteri, 41) X(ProgramUniform1f, 41) \
+    X(ProgramUniform1i, 41) X(ProgramUniform1ui, 41) X(ProgramUniform2fv, 41) \
+    X(ProgramUniform3fv, 41) X(ProgramUniform4fv, 41) X(ProgramUniformMatrix4fv, 41) \
+    X(QueryCounter, 33) X(RenderbufferStorage, 30) X(ShaderSource, 20) X(TexBuffer, 31) \
+    X(TexImage3D, 12) X(TexPageCommitmentARB, 0) X(TexStorage2D, 42) X(TexStorage3D, 42) \
+    X(TexSubImage3D, 12) X(TransformFeedbackVaryings, 30) X(Uniform1f, 20) X(Uniform1i, 20) \
+    X(Uniform1ui, 30) X(Uniform2f, 20) X(Uniform2fv, 20) X(Uniform3fv, 20) X(Uniform4fv, 20) \
+    X(UniformBlockBinding, 31) X(UniformMatrix4fv, 20) X(UnmapBuffer, 15) X(UseProgram, 20) \
+    X(VertexArrayAttribBinding, 45) X(VertexArrayAttribFormat, 45) X(VertexArrayElementBuffer, 45) \
+    X(VertexArrayVertexBuffer, 45) X(VertexAttrib2f, 20) X(VertexAttrib3f, 20) \
+    X(VertexAttrib4f, 20) X(VertexAttribDivisor, 33) X(VertexAttribIPointer, 30) \
+    X(VertexAttribPointer, 20) X(ViewportIndexedf, 41)
+
+// The extensions whose GLEW_ flags the sources check
+#define GLLOADER_EXTENSIONS(X) \
+    X(ARB_ES3_compatibility) X(ARB_bindless_texture) X(ARB_buffer_storage) \
+    X(ARB_direct_state_access) X(ARB_get_program_binary) X(ARB_parallel_shader_compile) \
+    X(ARB_pipeline_statistics_query) X(ARB_separate_shader_objects) \
+    X(ARB_shader_atomic_counters) X(ARB_shader_image_load_store) \
+    X(ARB_shader_viewport_layer_array) X(ARB_sparse_texture) X(ARB_texture_compression_bptc) \
+    X(ARB_texture_storage) X(ARB_viewport_array) X(ATI_meminfo) \
+    X(EXT_texture_compression_s3tc) X(EXT_texture_sRGB) X(KHR_debug) X(NVX_gpu_memory_info) \
+    X(OVR_multiview)
+
+// The GLEW_VERSION_ flags with the version they stand for
+struct Version {
+    GLboolean* flag;
+    int major;
+    int minor;
+};
+
+const Version versions[] = {
+    {&__GLEW_VERSION_1_1, 1, 1}, {&__GLEW_VERSION_1_2, 1, 2}, {&__GLEW_VERSION_1_2_1, 1, 2},
+    {&__GLEW_VERSION_1_3, 1, 3}, {&__GLEW_VERSION_1_4, 1, 4}, {&__GLEW_VERSION_1_5, 1, 5},
+    {&__GLEW_VERSION_2_0, 2, 0}, {&__GLEW_VERSION_2_1, 2, 1}, {&__GLEW_VERSION_3_0, 3, 0},
+    {&__GLEW_VERSION_3_1, 3, 1}, {&__GLEW_VERSION_3_2, 3, 2}, {&__GLEW_VERSION_3_3, 3, 3},
+    {&__GLEW_VERSION_4_0, 4, 0}, {&__GLEW_VERSION_4_1, 4, 1}, {&__GLEW_VERSION_4_2, 4, 2},
+    {&__GLEW_VERSION_4_3, 4, 3}, {&__GLEW_VERSION_4_4, 4, 4}, {&__GLEW_VERSION_4_5, 4, 5},
+};
+
+// Into the pointer that the GLEW macro of the function calls through, false with a message
+// if the context is of 'version' or later and does not have it
+template <class F>
+bool loadFunction(const char* name, F& pointer, int version, int contextversion) {
+    pointer = reinterpret_cast<F>(glfwGetProcAddress(name));
+    if (pointer == nullptr && version != 0 && version <= contextversion) {
+        std::cerr << "glloader::load(): " << name << " of OpenGL " << version / 10 << "."
+                  << version % 10 << " is missing\n";
+        return false;
+    }
+    return true;
+}
+
+bool loadMinimal() {
+    // glGetIntegerv() is of OpenGL 1.1, so it is there before anything is loaded
+    GLint major = 0;
+    GLint minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    const int contextversion = major * 10 + minor;
+    if (contextversion < 33) {
+        std::cerr << "glloader::load(): OpenGL " << major << "." << minor
+                  << " is below 3.3\n";
+        return false;
+    }
+    for (const Version& version : versions) {
+        const bool has = major > version.major ||
+                         (major == version.major && minor >= version.minor);
+        *version.flag = has ? GL_TRUE : GL_FALSE;
+    }
+
+    // All of them, to name every function that is missing
+    bool complete = true;
+#define GLLOADER_LOAD_FUNCTION(name, version) \
+    complete &= loadFunction("gl" #name, __glew##name, version, contextversion);
+    GLLOADER_FUNCTIONS(GLLOADER_LOAD_FUNCTION)
+#undef GLLOADER_LOAD_FUNCTION
+    if (!complete) {
+        return false;
+    }
+
+    std::unordered_set<std::string> names;
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+        if (name != nullptr) {
+            names.insert(name);
+        }
+    }
+#define GLLOADER_SET_EXTENSION(name) \
+    __GLEW_##name = names.count("GL_" #name) != 0 ? GL_TRUE : GL_FALSE;
+    GLLOADER_EXTENSIONS(GLLOADER_SET_EXTENSION)
+#undef GLLOADER_SET_EXTENSION
+    return true;
+}
+
+}  // namespace
+
+namespace glloader {
+
+bool load(Mode mode) {
+    if (mode == Mode::Minimal) {
+        return loadMinimal();
+    }
+    const GLenum err = glewInit();
+    if (err != GLEW_OK) {
+        std::cerr << "Error: " << glewGetErrorString(err) << "\n";
+        return false;
+    }
+    return true;
+}
+
+const char* modeName(Mode mode) {
+    return mode == Mode::Minimal ? "load GL functions" : "glewInit";
+}
+
+}  // namespace glloader
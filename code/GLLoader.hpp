@@ -0,0 +1,38 @@
+/*
+ * Loading of the OpenGL functions, either all of them by glewInit() or only the ones the
+ * program calls, which takes a fraction of the time at startup.
+ *
+ * Usage: Call load() once, with the context current, where glewInit() would be called.
+ *        Mode::Full is glewInit(), which looks up the more than 3000 functions that GLEW
+ *        knows and the extension list twice. Mode::Minimal looks up only the entry points
+ *        of the table in GLLoader.cpp, sets the GLEW_VERSION_x_y flags from the version of
+ *        the context and the GLEW_ flags of the extensions that the program checks from the
+ *        extension list. The rest of the program is written as for GLEW either way, and
+ *        includes <GL/glew.h> for the declarations.
+ *        A function that is not in the table stays a null pointer with Mode::Minimal, so a
+ *        call to a GL function that is new to the program needs its name in the table, with
+ *        the OpenGL version that has it (0 for the functions of extensions only), and so
+ *        does the GLEW_ flag of an extension that is new to the program. The functions are
+ *        the gl* identifiers in the sources that glew.h defines as macros (those of OpenGL
+ *        1.1 are plain functions of the GL library). The glloader-check target, which every
+ *        build of the program runs, fails with what differs between the tables and the
+ *        sources, see GLLoaderCheck.cmake.
+ *        Mode::Minimal needs OpenGL 3.3, as the program does, and is false below it, and it
+ *        is false with the names of the functions that a context of their version or later
+ *        does not have.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+namespace glloader {
+
+enum class Mode { Minimal, Full };
+
+// Load the GL functions for the current context, false with a message on failure
+bool load(Mode mode);
+
+// The name of 'mode' for the startup timeline
+const char* modeName(Mode mode);
+
+}  // namespace glloader
@@ -0,0 +1,125 @@
+# The check that the tables of GLLoader.cpp list what the sources use, for the glloader-check
+# target: every gl* function that glew.h defines as a macro, with the OpenGL version that
+# glew.h has it in, and every GLEW_ flag of an extension, both ways. A function that is
+# missing from the table is a null pointer with --glloader minimal, and a flag that is
+# missing is never set.
+#
+# Usage: cmake -DSOURCE_DIR=<the directory of GLLoader.cpp> -P GLLoaderCheck.cmake
+#
+# This code is in the public domain.
+
+cmake_minimum_required(VERSION 3.13.0)
+
+if(NOT SOURCE_DIR)
+	message(FATAL_ERROR "GLLoaderCheck.cmake needs -DSOURCE_DIR=<directory>")
+endif()
+
+# The functions and extension flags of glew.h, and the GL_VERSION_x_y section of the
+# functions that glew.h declares in one. The functions of the ARB extensions that became
+# core are in the sections of the extensions, so their versions can not be checked.
+file(STRINGS ${SOURCE_DIR}/glew/include/GL/glew.h GLEW_LINES
+	REGEX "^#ifndef GL_[A-Za-z0-9_]+$|^#define (gl|GLEW_)[A-Za-z0-9_]+ GLEW_GET_(FUN|VAR)")
+set(SECTION "")
+foreach(line IN LISTS GLEW_LINES)
+	if(line MATCHES "^#ifndef GL_VERSION_([0-9])_([0-9])$")
+		set(SECTION "${CMAKE_MATCH_1}${CMAKE_MATCH_2}")
+	elseif(line MATCHES "^#ifndef GL_")
+		set(SECTION "")
+	elseif(line MATCHES "^#define gl([A-Za-z0-9_]+) GLEW_GET_FUN")
+		if(NOT DEFINED GLEW_VERSION_OF_${CMAKE_MATCH_1})
+			set(GLEW_VERSION_OF_${CMAKE_MATCH_1} "${SECTION}")
+		endif()
+	elseif(line MATCHES "^#define GLEW_([A-Za-z0-9]+_[A-Za-z0-9_]+) GLEW_GET_VAR")
+		set(name ${CMAKE_MATCH_1})
+		if(NOT name MATCHES "^VERSION_")
+			set(GLEW_EXTENSION_${name} TRUE)
+		endif()
+	endif()
+endforeach()
+
+# The entries of the tables, X(name, version) and X(name), which are in this order
+file(READ ${SOURCE_DIR}/GLLoader.cpp LOADER)
+string(FIND "${LOADER}" "#define GLLOADER_FUNCTIONS" FUNCTIONS_BEGIN)
+string(FIND "${LOADER}" "#define GLLOADER_EXTENSIONS" EXTENSIONS_BEGIN)
+string(FIND "${LOADER}" "struct Version" EXTENSIONS_END)
+math(EXPR FUNCTIONS_LENGTH "${EXTENSIONS_BEGIN} - ${FUNCTIONS_BEGIN}")
+math(EXPR EXTENSIONS_LENGTH "${EXTENSIONS_END} - ${EXTENSIONS_BEGIN}")
+string(SUBSTRING "${LOADER}" ${FUNCTIONS_BEGIN} ${FUNCTIONS_LENGTH} FUNCTION_TABLE)
+string(SUBSTRING "${LOADER}" ${EXTENSIONS_BEGIN} ${EXTENSIONS_LENGTH} EXTENSION_TABLE)
+string(REGEX MATCHALL "X\\([A-Za-z0-9_]+, [0-9]+\\)" FUNCTION_ENTRIES "${FUNCTION_TABLE}")
+string(REGEX MATCHALL "X\\([A-Za-z0-9_]+\\)" EXTENSION_ENTRIES "${EXTENSION_TABLE}")
+if(NOT FUNCTION_ENTRIES OR NOT EXTENSION_ENTRIES)
+	message(FATAL_ERROR "GLLoaderCheck.cmake: the tables of GLLoader.cpp are not found")
+endif()
+
+set(ERRORS "")
+set(TABLE_FUNCTIONS "")
+foreach(entry IN LISTS FUNCTION_ENTRIES)
+	string(REGEX REPLACE "X\\(([A-Za-z0-9_]+), ([0-9]+)\\)" "\\1;\\2" entry "${entry}")
+	list(GET entry 0 name)
+	list(GET entry 1 version)
+	list(APPEND TABLE_FUNCTIONS ${name})
+	if(NOT DEFINED GLEW_VERSION_OF_${name})
+		string(APPEND ERRORS "  gl${name} is not a function of glew.h\n")
+	elseif(NOT GLEW_VERSION_OF_${name} STREQUAL "" AND NOT version EQUAL GLEW_VERSION_OF_${name})
+		string(APPEND ERRORS
+			"  gl${name} is of version ${GLEW_VERSION_OF_${name}}, not ${version}\n")
+	endif()
+endforeach()
+set(TABLE_EXTENSIONS "")
+foreach(entry IN LISTS EXTENSION_ENTRIES)
+	string(REGEX REPLACE "X\\(([A-Za-z0-9_]+)\\)" "\\1" name "${entry}")
+	list(APPEND TABLE_EXTENSIONS ${name})
+endforeach()
+
+# What the sources of the program and the benchmarks use
+file(GLOB SOURCES ${SOURCE_DIR}/*.cpp ${SOURCE_DIR}/*.hpp ${SOURCE_DIR}/bench/*.cpp
+	${SOURCE_DIR}/bench/*.hpp)
+set(USED_FUNCTIONS "")
+set(USED_EXTENSIONS "")
+foreach(source IN LISTS SOURCES)
+	file(READ ${source} TEXT)
+	string(REGEX MATCHALL "gl[A-Z][A-Za-z0-9_]*" names "${TEXT}")
+	foreach(name IN LISTS names)
+		string(SUBSTRING ${name} 2 -1 name)
+		if(DEFINED GLEW_VERSION_OF_${name})
+			list(APPEND USED_FUNCTIONS ${name})
+		endif()
+	endforeach()
+	string(REGEX MATCHALL "GLEW_[A-Za-z0-9_]+" names "${TEXT}")
+	foreach(name IN LISTS names)
+		string(SUBSTRING ${name} 5 -1 name)
+		if(GLEW_EXTENSION_${name})
+			list(APPEND USED_EXTENSIONS ${name})
+		endif()
+	endforeach()
+endforeach()
+list(REMOVE_DUPLICATES USED_FUNCTIONS)
+list(REMOVE_DUPLICATES USED_EXTENSIONS)
+
+foreach(name IN LISTS USED_FUNCTIONS)
+	if(NOT name IN_LIST TABLE_FUNCTIONS)
+		string(APPEND ERRORS "  gl${name} is called but not in GLLOADER_FUNCTIONS\n")
+	endif()
+endforeach()
+foreach(name IN LISTS TABLE_FUNCTIONS)
+	if(NOT name IN_LIST USED_FUNCTIONS)
+		string(APPEND ERRORS "  gl${name} is in GLLOADER_FUNCTIONS but not called\n")
+	endif()
+endforeach()
+foreach(name IN LISTS USED_EXTENSIONS)
+	if(NOT name IN_LIST TABLE_EXTENSIONS)
+		string(APPEND ERRORS "  GLEW_${name} is checked but not in GLLOADER_EXTENSIONS\n")
+	endif()
+endforeach()
+foreach(name IN LISTS TABLE_EXTENSIONS)
+	if(NOT GLEW_EXTENSION_${name})
+		string(APPEND ERRORS "  GL_${name} is not an extension of glew.h\n")
+	elseif(NOT name IN_LIST USED_EXTENSIONS)
+		string(APPEND ERRORS "  GLEW_${name} is in GLLOADER_EXTENSIONS but not checked\n")
+	endif()
+endforeach()
+
+if(ERRORS)
+	message(FATAL_ERROR "The tables of GLLoader.cpp do not match the sources:\n${ERRORS}")
+endif()
@@ -0,0 +1,148 @@
+/*
+ * Cache of OpenGL bindings
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "GLState.hpp"
+
+#include <atomic>
+
+#include "GpuMemory.hpp"
+
+namespace {
+
+// A binding that is not known, which no object name matches
+constexpr GLuint unknown = ~0u;
+
+struct State {
+    GLuint program = unknown;
+    GLuint array = unknown;
+    GLenum unit = 0;  // Active texture unit, 0 if unknown
+    GLuint texture2d[glstate::maxTextureUnits];
+    GLuint texturearray[glstate::maxTextureUnits];
+    uint64_t skipped = 0;
+
+    State() { forgetTextures(); }
+
+    void forgetTextures() {
+        for (int i = 0; i < glstate::maxTextureUnits; i++) {
+            texture2d[i] = unknown;
+            texturearray[i] = unknown;
+        }
+    }
+};
+
+thread_local State state;
+
+// Of setDirectStateAccess(), for all contexts
+std::atomic<bool> dsaenabled{true};
+
+// The cached binding of 'target' on the active unit, or nullptr if it is not cached
+GLuint* textureBinding(GLenum target) {
+    const GLenum index = state.unit - GL_TEXTURE0;
+    if (state.unit == 0 || index >= static_cast<GLenum>(glstate::maxTextureUnits)) {
+        return nullptr;
+    }
+    if (target == GL_TEXTURE_2D) {
+        return &state.texture2d[index];
+    }
+    if (target == GL_TEXTURE_2D_ARRAY) {
+        return &state.texturearray[index];
+    }
+    return nullptr;
+}
+
+}  // namespace
+
+namespace glstate {
+
+void useProgram(GLuint program) {
+    if (program == state.program) {
+        state.skipped++;
+        return;
+    }
+    glUseProgram(program);
+    state.program = program;
+}
+
+void bindVertexArray(GLuint array) {
+    if (array == state.array) {
+        state.skipped++;
+        return;
+    }
+    glBindVertexArray(array);
+    state.array = array;
+}
+
+void activeTexture(GLenum unit) {
+    if (unit == state.unit) {
+        state.skipped++;
+        return;
+    }
+    glActiveTexture(unit);
+    state.unit = unit;
+}
+
+void bindTexture(GLenum target, GLuint texture) {
+    GLuint* binding = textureBinding(target);
+    if (binding != nullptr && *binding == texture) {
+        state.skipped++;
+        return;
+    }
+    glBindTexture(target, texture);
+    if (binding != nullptr) {
+        *binding = texture;
+    }
+}
+
+// Deleting a bound object binds 0 in its place
+void deleteProgram(GLuint program) {
+    glDeleteProgram(program);
+    if (program == state.program) {
+        state.program = unknown;  // It stays in use until another program is used
+    }
+}
+
+void deleteVertexArrays(GLsizei count, const GLuint* arrays) {
+    glDeleteVertexArrays(count, arrays);
+    for (GLsizei i = 0; i < count; i++) {
+        if (arrays[i] == state.array) {
+            state.array = 0;
+        }
+    }
+}
+
+void deleteTextures(GLsizei count, const GLuint* textures) {
+    glDeleteTextures(count, textures);
+    gpumem::forgetTextures(count, textures);
+    for (GLsizei i = 0; i < count; i++) {
+        for (int unit = 0; unit < maxTextureUnits; unit++) {
+            if (textures[i] == state.texture2d[unit]) {
+                state.texture2d[unit] = 0;
+            }
+            if (textures[i] == state.texturearray[unit]) {
+                state.texturearray[unit] = 0;
+            }
+        }
+    }
+}
+
+void invalidate() {
+    state.program = unknown;
+    state.array = unknown;
+    state.unit = 0;
+    state.forgetTextures();
+}
+
+uint64_t skippedCalls() { return state.skipped; }
+
+bool directStateAccess() {
+    return dsaenabled.load(std::memory_order_relaxed) &&
+           (GLEW_VERSION_4_5 || GLEW_ARB_direct_state_access);
+}
+
+void setDirectStateAccess(bool enabled) { dsaenabled.store(enabled); }
+
+}  // namespace glstate
@@ -0,0 +1,51 @@
+/*
+ * A cache of the current program, vertex array and texture bindings, which drops calls
+ * that would bind what is bound already.
+ *
+ * Usage: Call glstate::useProgram(), bindVertexArray(), activeTexture() and bindTexture()
+ *        instead of the gl functions of the same names, and delete programs, vertex arrays
+ *        and textures with the functions here, so a new object that gets the name of a
+ *        deleted one is bound again. Code that binds these objects with the gl functions
+ *        directly must call invalidate() afterwards.
+ *        Only GL_TEXTURE_2D and GL_TEXTURE_2D_ARRAY bindings of the first 'maxTextureUnits'
+ *        units are cached, other targets and units always call OpenGL.
+ *        The cache is for the current context of the calling thread, like the state itself.
+ *        directStateAccess() tells the code that can edit objects without binding them
+ *        (glCreateBuffers(), glNamedBufferSubData(), glVertexArrayAttribFormat()...) to do so.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstdint>
+
+namespace glstate {
+
+constexpr int maxTextureUnits = 32;
+
+void useProgram(GLuint program);
+void bindVertexArray(GLuint array);
+// 'unit' is GL_TEXTURE0 + i, as for glActiveTexture()
+void activeTexture(GLenum unit);
+// Bind 'texture' to the active unit
+void bindTexture(GLenum target, GLuint texture);
+
+void deleteProgram(GLuint program);
+void deleteVertexArrays(GLsizei count, const GLuint* arrays);
+void deleteTextures(GLsizei count, const GLuint* textures);
+
+// Forget all cached bindings, so the next calls are all passed on to OpenGL
+void invalidate();
+
+// Number of calls that were dropped since the program started
+uint64_t skippedCalls();
+
+/* True if the context has GL 4.5 or ARB_direct_state_access and it is not turned off. Only
+ * call it once GLEW is initialised. */
+bool directStateAccess();
+
+// Turn direct state access off, or on again where it is there, say to compare the two paths
+void setDirectStateAccess(bool enabled);
+
+}  // namespace glstate
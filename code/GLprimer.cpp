@@ -34,11 +34,65 @@
 
 #include "Utilities.hpp"
 
+#include <algorithm>
 #include <vector>
-#include <array>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <utility>
+
+#include "AntiAliasing.hpp"
+#include "Autotuner.hpp"
+#include "BVH.hpp"
+#include "BufferPool.hpp"
+#include "ChunkedMesh.hpp"
+#include "DrawCapture.hpp"
+#include "DynamicResolution.hpp"
+#include "FileWatcher.hpp"
+#include "FixedTimestep.hpp"
+#include "FrameCapture.hpp"
+#include "Framebuffer.hpp"
+#include "FramePacer.hpp"
+#include "FrameProfiler.hpp"
+#include "GLDebug.hpp"
+#include "GLLoader.hpp"
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "Frustum.hpp"
+#include "LightClusters.hpp"
+#include "Mat4.hpp"
+#include "MaterialTable.hpp"
+#include "MultiView.hpp"
+#include "Overlay.hpp"
+#include "PackFile.hpp"
+#include "ParticleSystem.hpp"
+#include "PickBuffer.hpp"
+#include "PipelineStatistics.hpp"
+#include "PostProcess.hpp"
+#include "RenderGraph.hpp"
+#include "RenderQueue.hpp"
+#include "RenderThread.hpp"
+#include "ReprojectionCache.hpp"
+#include "ResourceManager.hpp"
+#include "Rotator.hpp"
 
 #include "Shader.hpp"
+#include "SceneGraph.hpp"
+#include "ShadowCascades.hpp"
+#include "Skinning.hpp"
+#include "StartupTimeline.hpp"
+#include "Stereo.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+#include "TransformArrays.hpp"
+#include "Transparency.hpp"
 #include "TriangleSoup.hpp"
+#include "UniformBuffers.hpp"
+#include "VirtualFiles.hpp"
+#include "VulkanBackend.hpp"
 
 GLuint createVertexBuffer(int location, int dimensions, const std::vector<float>& vertices) {
     GLuint bufferID;
@@ -46,6 +100,7 @@ GLuint createVertexBuffer(int location, int dimensions, const std::vector<float>
     glGenBuffers(1, &bufferID);
     glBindBuffer(GL_ARRAY_BUFFER, bufferID);
     glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    gpumem::setBuffer(bufferID, gpumem::Category::Mesh, vertices.size() * sizeof(float));
     // Tell OpenGL how the data is stored in our buffer
     // Attribute location (must match layout(location=#) statement in shader)
     // Number of dimensions (3 -> vec3 in the shader, 2-> vec2 in the shader),
@@ -66,224 +121,83 @@ GLuint createIndexBuffer(const std::vector<unsigned int>& indices) {
     // Present our vertex indices to OpenGL
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(),
                  GL_STATIC_DRAW);
+    gpumem::setBuffer(bufferID, gpumem::Category::Mesh, indices.size() * sizeof(unsigned int));
 
     return bufferID;
 }
 
-//Matrix operations
-std::array<float, 16> mat4mult(const std::array<float, 16>& m1, const std::array<float, 16>& m2) {
-    std::array<float, 16> result;
-
-    // Your code goes here: compute and set each element of result, e.g.:
-    result[0] = m1[0] * m2[0] + m1[4] * m2[1] + m1[8] * m2[2] + m1[12] * m2[3];
-	result[1] = m1[1] * m2[0] + m1[5] * m2[1] + m1[9] * m2[2] + m1[13] * m2[3];
-	result[2] = m1[2] * m2[0] + m1[6] * m2[1] + m1[10] * m2[2] + m1[14] * m2[3];
-	result[3] = m1[3] * m2[0] + m1[7] * m2[1] + m1[11] * m2[2] + m1[15] * m2[3];
-	
-	result[4] = m1[0] * m2[4] + m1[4] * m2[5] + m1[8] * m2[6] + m1[12] * m2[7];
-	result[5] = m1[1] * m2[4] + m1[5] * m2[5] + m1[9] * m2[6] + m1[13] * m2[7];
-	result[6] = m1[2] * m2[4] + m1[6] * m2[5] + m1[10] * m2[6] + m1[14] * m2[7];
-	result[7] = m1[3] * m2[4] + m1[7] * m2[5] + m1[11] * m2[6] + m1[15] * m2[7];
-	
-	result[8] = m1[0] * m2[8] + m1[4] * m2[9] + m1[8] * m2[10] + m1[12] * m2[11];
-	result[9] = m1[1] * m2[8] + m1[5] * m2[9] + m1[9] * m2[10] + m1[13] * m2[11];
-	result[10] = m1[2] * m2[8] + m1[6] * m2[9] + m1[10] * m2[10] + m1[14] * m2[11];
-	result[11] = m1[3] * m2[8] + m1[7] * m2[9] + m1[11] * m2[10] + m1[15] * m2[11];
-	
-	result[12] = m1[0] * m2[12] + m1[4] * m2[13] + m1[8] * m2[14] + m1[12] * m2[15];
-	result[13] = m1[1] * m2[12] + m1[5] * m2[13] + m1[9] * m2[14] + m1[13] * m2[15];
-	result[14] = m1[2] * m2[12] + m1[6] * m2[13] + m1[10] * m2[14] + m1[14] * m2[15];
-	result[15] = m1[3] * m2[12] + m1[7] * m2[13] + m1[11] * m2[14] + m1[15] * m2[15];
-	
-    return result;
-}
-std::array<float, 16> mat4identity() {
-	std::array<float, 16> result;
-	
-	result[0] = 1.0f;
-	result[1] = 0.0f;
-	result[2] = 0.0f;
-	result[3] = 0.0f;
-	
-	result[4] = 0.0f;
-	result[5] = 1.0f;
-	result[6] = 0.0f;
-	result[7] = 0.0f;
-	
-	result[8] = 0.0f;
-	result[9] = 0.0f;
-	result[10] = 1.0f;
-	result[11] = 0.0f;
-	
-	result[12] = 0.0f;
-	result[13] = 0.0f;
-	result[14] = 0.0f;
-	result[15] = 1.0f;
-	return result;
-}
-std::array<float, 16> mat4rotx(float angle) {
-	std::array<float, 16> result;
-	
-	result[0] = 1.0f;
-	result[1] = 0.0f;
-	result[2] = 0.0f;
-	result[3] = 0.0f;
-	
-	result[4] = 0.0f;
-	result[5] = cos(angle);
-	result[6] = sin(angle);
-	result[7] = 0.0f;
-	
-	result[8] = 0.0f;
-	result[9] = -sin(angle);
-	result[10] = cos(angle);
-	result[11] = 0.0f;
-	
-	result[12] = 0.0f;
-	result[13] = 0.0f;
-	result[14] = 0.0f;
-	result[15] = 1.0f;
-	return result;
-}
-std::array<float, 16> mat4roty(float angle) {
-	std::array<float, 16> result;
-	
-	result[0] = cos(angle);
-	result[1] = 0.0f;
-	result[2] = -sin(angle);
-	result[3] = 0.0f;
-	
-	result[4] = 0.0f;
-	result[5] = 1.0f;
-	result[6] = 0.0f;
-	result[7] = 0.0f;
-	
-	result[8] = sin(angle);
-	result[9] = 0.0f;
-	result[10] = cos(angle);
-	result[11] = 0.0f;
-	
-	result[12] = 0.0f;
-	result[13] = 0.0f;
-	result[14] = 0.0f;
-	result[15] = 1.0f;
-	return result;
-}
-std::array<float, 16> mat4rotz(float angle) {
-	std::array<float, 16> result;
-	
-	result[0] = cos(angle);
-	result[1] = sin(angle);
-	result[2] = 0.0f;
-	result[3] = 0.0f;
-	
-	result[4] = -sin(angle);
-	result[5] = cos(angle);
-	result[6] = 0.0f;
-	result[7] = 0.0f;
-	
-	result[8] = 0.0f;
-	result[9] = 0.0f;
-	result[10] = 1.0f;
-	result[11] = 0.0f;
-	
-	result[12] = 0.0f;
-	result[13] = 0.0f;
-	result[14] = 0.0f;
-	result[15] = 1.0f;
-	return result;
-}
-std::array<float, 16> mat4scale(float scale) {
-	std::array<float, 16> result;
-	
-	result[0] = scale;
-	result[1] = 0.0f;
-	result[2] = 0.0f;
-	result[3] = 0.0f;
-	
-	result[4] = 0.0f;
-	result[5] = scale;
-	result[6] = 0.0f;
-	result[7] = 0.0f;
-	
-	result[8] = 0.0f;
-	result[9] = 0.0f;
-	result[10] = scale;
-	result[11] = 0.0f;
-	
-	result[12] = 0.0f;
-	result[13] = 0.0f;
-	result[14] = 0.0f;
-	result[15] = 1.0f;
-	return result;
-}
-std::array<float, 16> mat4translate(float x, float y, float z) {
-	std::array<float, 16> result;
-	
-	result[0] = 1.0f;
-	result[1] = 0.0f;
-	result[2] = 0.0f;
-	result[3] = 0.0f;
-	
-	result[4] = 0.0f;
-	result[5] = 1.0f;
-	result[6] = 0.0f;
-	result[7] = 0.0f;
-	
-	result[8] = 0.0f;
-	result[9] = 0.0f;
-	result[10] = 1.0f;
-	result[11] = 0.0f;
-	
-	result[12] = x;
-	result[13] = y;
-	result[14] = z;
-	result[15] = 1.0f;
-	return result;
-}
-std::array<float, 16> mat4perspective(float vfov, float aspect, float znear, float zfar) {
-	std::array<float, 16> result;
-	
-	float f = 1.0f / tan(vfov / 2.0f);
-	
-	result[0] = f / aspect;
-	result[1] = 0.0f;
-	result[2] = 0.0f;
-	result[3] = 0.0f;
-	
-	result[4] = 0.0f;
-	result[5] = f;
-	result[6] = 0.0f;
-	result[7] = 0.0f;
-	
-	result[8] = 0.0f;
-	result[9] = 0.0f;
-	result[10] = -(zfar + znear) / (zfar - znear);
-	result[11] = -1.0f;
-	
-	result[12] = 0.0f;
-	result[13] = 0.0f;
-	result[14] = -(2.0f * zfar * znear) / (zfar- znear);
-	result[15] = 0.0f;
-	
-	return result;
-	
-}
-
-
-void mat4print(const std::array<float, 16>& m) {
-    printf("Matrix:\n");
-    printf("%6.2f %6.2f %6.2f %6.2f\n", m[0], m[4], m[8], m[12]);
-    printf("%6.2f %6.2f %6.2f %6.2f\n", m[1], m[5], m[9], m[13]);
-    printf("%6.2f %6.2f %6.2f %6.2f\n", m[2], m[6], m[10], m[14]);
-    printf("%6.2f %6.2f %6.2f %6.2f\n", m[3], m[7], m[11], m[15]);
-    printf("\n");
+/*
+ * Draw 'mesh' spinning under the mouse rotation with VulkanBackend, until the window is
+ * closed or 'maxframes' frames are drawn (0 for no limit). Returns false, with a message,
+ * if Vulkan can not be used, and the program then goes on with OpenGL.
+ */
+bool runVulkan(const TriangleSoup::MeshData& mesh, long long maxframes, int windowsize) {
+    if (!VulkanBackend::supported()) {
+        std::cerr << "--backend vulkan: there is no Vulkan loader, using OpenGL\n";
+        return false;
+    }
+    if (mesh.vertices.empty()) {
+        std::cerr << "--backend vulkan: draws an OBJ file given with --mesh, using OpenGL\n";
+        return false;
+    }
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    GLFWwindow* window = glfwCreateWindow(windowsize, windowsize, "GLprimer (Vulkan)", nullptr,
+                                          nullptr);
+    glfwDefaultWindowHints();
+    if (!window) {
+        std::cerr << "--backend vulkan: no window without a GL context, using OpenGL\n";
+        return false;
+    }
+    int shape = -1;
+    {
+        VulkanBackend vulkan;
+        if (vulkan.create(window, "vulkan.pipelinecache") &&
+            vulkan.createPipeline("vulkan_vertex.spv", "vulkan_fragment.spv")) {
+            shape = vulkan.addMesh(mesh.vertices, mesh.indices);
+        }
+        MouseRotator mouseRotator(window);
+        // The frame times in the title as with OpenGL, without scopes, whose GPU times would
+        // need GL queries
+        FrameProfiler profiler;
+        const Mat4 T = Mat4::translation(0.0f, 0.0f, -1.5f);  // In front of the view
+        std::vector<VulkanBackend::Draw> draws(1);
+        for (long long frame = 0; shape >= 0 && !glfwWindowShouldClose(window); frame++) {
+            if (maxframes > 0 && frame >= maxframes) {
+                break;
+            }
+            profiler.beginFrame();
+            glfwPollEvents();
+            mouseRotator.poll();
+            const float time = static_cast<float>(glfwGetTime());
+            const int height = std::max(vulkan.height(), 1);
+            const float aspect = float(vulkan.width()) / float(height);
+            draws[0] = {shape, T * Mat4::rotationX(float(mouseRotator.theta())) *
+                                   Mat4::rotationY(float(mouseRotator.phi())) *
+                                   Mat4::rotationX(time * float(M_PI) / 2.0f)};
+            if (!vulkan.drawFrame(Mat4::perspective(float(M_PI) / 2.0f, aspect, 0.1f, 100.0f),
+                                  draws)) {
+                break;  // With the error printed
+            }
+            profiler.updateWindowTitle(window);
+        }
+        if (shape >= 0) {
+            std::cout << "Vulkan device memory: " << (vulkan.memoryBytes() >> 20) << " MB\n";
+        }
+    }
+    glfwDestroyWindow(window);
+    if (shape < 0) {
+        std::cerr << "--backend vulkan: using OpenGL\n";
+    }
+    return shape >= 0;
 }
 
 /*
  * main(int argc, char* argv[]) - the standard C++ entry point for the program
  */
 int main(int argc, char* argv[]) {
+    // The time to the first frame, by phase, is printed when the frame is on the screen
+    StartupTimeline startup;
+
     // Vertex coordinates (x,y,z) for three vertices
 
 	//A cube has 6 faces with 2 triangles each (12 edges). Each face has 3 vertices. Each vertex has 3 coordinates. 
@@ -442,19 +356,330 @@ int main(int argc, char* argv[]) {
 	
     float time;
 	
-    GLint locationTime, locationP, locationR, locationMV;
+    // "--profile file.csv" or "--profile file.json" writes frame time statistics at exit
+    std::string profilefile;
+    // "--pacing unlimited|vsync|adaptive|fixed:<fps>|ondemand" chooses the frame pacing
+    FramePacer pacer(FramePacer::Mode::VSync);
+    // "--headless <width>x<height>" renders into an offscreen framebuffer without showing a
+    // window, and "--frames <n>" stops after n frames. "--output frame%05d.png" writes the
+    // frames, also from a window, as .png or .ppm files, or as one .y4m or .raw video.
+    int headlessWidth = 0;
+    int headlessHeight = 0;
+    long long maxFrames = 0;
+    std::string outputpattern;
+    // "--mesh file.obj" shows an OBJ file instead of the box, and "--mesh file.glb" the first
+    // primitive of a binary glTF file. An http:// URL of an OBJ file is shown while it
+    // downloads, with the box until the first faces are there.
+    std::string meshfile;
+    // "--stream file.obj" shows an OBJ file of any size instead, streamed in by the view from
+    // a chunk file next to it, file.obj.chunks, which is built when it is missing or stale
+    std::string streamfile;
+    // "--lights <n>" adds n point lights, shaded with clustered forward lighting
+    int lightcount = 0;
+    // "--prepass on" draws the depth first with a position only shader, and then shades
+    // only the fragments that are visible in the end, with glDepthFunc(GL_EQUAL)
+    bool prepass = false;
+    // "--shadows on" adds a wall behind the shape, and cascaded shadow maps of the light
+    bool shadows = false;
+    // "--dynres <ms>" draws the scene at a resolution that keeps the GPU time of a frame
+    // under <ms> milliseconds, and scales it up to the window
+    double dynrestarget = 0.0;
+    // "--particles <n>" adds a fountain of n particles, simulated on the GPU
+    int particlecount = 0;
+    // "--skinning on" adds a tube that bends with two bones and bulges with a morph target
+    bool skinning = false;
+    // "--transparency weighted|lists" adds three transparent spheres, blended without sorting
+    // by weighted blended order independent transparency or per pixel linked lists
+    bool transparent = false;
+    Transparency::Mode transparencymode = Transparency::Mode::WeightedBlended;
+    // "--reprojection on" reuses the shading of the last frame where the surface was visible
+    bool reprojection = false;
+    // "--post tonemap,grade,gamma,fxaa,vignette,bloom", or "all", adds those effects after the
+    // main pass, in one pass over a scene drawn in half floats, and a bloom at half resolution
+    unsigned posteffects = 0;
+    // "--aa fxaa|smaa|taa" smooths the edges after the main pass, with FXAA in the pass of
+    // --post, with SMAA, or with TAA, whose motion vectors are those of --reprojection
+    AntiAliasing::Mode aamode = AntiAliasing::Mode::Off;
+    // "--pack file.pack" reads the shaders, the textures and the mesh from one pack file, which
+    // is written from the loose files when it is missing. The pack shadows the loose files,
+    // so edits of a shader are seen after the pack is deleted, and not by the hot reload.
+    std::string packfile;
+    // "--picking on" writes the object and the triangle of each pixel to an ID buffer in the
+    // main pass, and prints what is under the cursor, or the center of a headless frame, as
+    // it is read back a frame later. "--picking bvh" prints the nearest object whose box the
+    // ray under the cursor hits instead, found in the BVH of the draws without an ID buffer.
+    bool picking = false;
+    bool bvhpicking = false;
+    // "--gpubudget <MB>" limits the GPU memory of all buffers and textures, so the streamed
+    // meshes and textures give memory back, and prints where it went at the end
+    size_t gpubudget = 0;
+    // "--trace <file.json>" records what every thread and the GPU do, for chrome://tracing
+    std::string tracefile;
+    // "--gldebug perf|warnings|all" asks for a debug context and prints the errors and the
+    // first of each kind of driver warning with where we made the call, and a count of all
+    // kinds at the end. "perf" only reports errors and performance warnings.
+    bool gldebugon = false;
+    gldebug::Filter gldebugfilter = gldebug::Filter::Performance;
+    // "--pipelinestats passes|meshes" counts the vertices, triangles and fragments of each
+    // profiler scope or of each mesh, and prints them at the end
+    PipelineStatistics::Mode statisticsmode = PipelineStatistics::Mode::Off;
+    // "--backend vulkan" draws the mesh of --mesh with VulkanBackend instead, and falls back
+    // to OpenGL without a Vulkan driver, without the SPIR-V of the shaders, or headless
+    bool vulkan = false;
+    // "--dsa off" creates the buffers and vertex arrays through binds even where direct
+    // state access is supported, to compare the two
+    bool dsa = true;
+    // "--glloader glew" loads all GL functions with glewInit() rather than the ones we call
+    glloader::Mode glloadermode = glloader::Mode::Minimal;
+    // "--wireframe shader" draws filled triangles and only their edges, found in the fragment
+    // shader, rather than lines with glPolygonMode(), which is a slow path on many GPUs. The
+    // edges are antialiased. "--wireframe overlay" draws them over the shaded surface, and
+    // "--wireframe lines" is the default. With "--prepass on" the hidden edges are not drawn.
+    std::string wireframe = "lines";
+    // "--simrate <hz>" runs the animation in fixed steps of 1/<hz> seconds on the thread pool,
+    // and draws each frame between the last two steps, whatever the frame rate
+    FixedTimestep simulation(60.0);
+    // "--overlay on" shows the frame times, the GPU time of each pass, the draw calls and the
+    // GPU memory in the window instead of the title. F1 shows and hides it.
+    bool overlay = false;
+    // "--drawcapture <file.draws>" records the render queue and the uniform data of every
+    // frame, which tnm046-replay draws again without the rest of the program
+    std::string drawcapturefile;
+    // "--autotune off", the default, keeps the settings of the tuning file, and the defaults
+    // without one. "--autotune on" measures at startup the settings that were not measured on
+    // this GPU and driver and writes them to the file, and "--autotune all" measures all of
+    // them again (Autotuner.hpp). "--tuning <file>" is the file, tnm046-tuning.json unless it
+    // says otherwise.
+    std::string autotune = "off";
+    std::string tuningfile = "tnm046-tuning.json";
+    // "--views <n>" splits the window into 2 to 4 views side by side, of cameras turned so
+    // that they continue each other like a wall of displays, drawn with one instanced draw
+    // per mesh where the GPU can (MultiView.hpp). Only the opaque scene is drawn in views.
+    int views = 1;
+    // "--stereo <separation>" draws the opaque scene for two eyes <separation> apart, in one
+    // pass where the GPU can (Stereo.hpp), side by side in the window for a stereo display.
+    // The eyes converge where the shape is.
+    float eyeseparation = 0.0f;
+    const float eyeconvergence = 1.5f;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--profile") {
+            profilefile = argv[i + 1];
+        }
+        if (std::string(argv[i]) == "--pacing") {
+            FramePacer::Mode mode;
+            double framerate = 60.0;
+            if (FramePacer::parseMode(argv[i + 1], mode, framerate)) {
+                pacer.setMode(mode, framerate);
+            } else {
+                std::cerr << "Unknown frame pacing mode '" << argv[i + 1] << "'\n";
+            }
+        }
+        if (std::string(argv[i]) == "--headless") {
+            if (sscanf(argv[i + 1], "%dx%d", &headlessWidth, &headlessHeight) != 2 ||
+                headlessWidth <= 0 || headlessHeight <= 0) {
+                std::cerr << "Invalid size '" << argv[i + 1] << "', expected e.g. 1920x1080\n";
+                headlessWidth = headlessHeight = 0;
+            }
+        }
+        if (std::string(argv[i]) == "--frames") {
+            maxFrames = std::atoll(argv[i + 1]);
+        }
+        if (std::string(argv[i]) == "--output") {
+            outputpattern = argv[i + 1];
+        }
+        if (std::string(argv[i]) == "--mesh") {
+            meshfile = argv[i + 1];
+        }
+        if (std::string(argv[i]) == "--stream") {
+            streamfile = argv[i + 1];
+        }
+        if (std::string(argv[i]) == "--lights") {
+            lightcount = std::max(std::atoi(argv[i + 1]), 0);
+        }
+        if (std::string(argv[i]) == "--prepass") {
+            prepass = std::string(argv[i + 1]) == "on";
+        }
+        if (std::string(argv[i]) == "--shadows") {
+            shadows = std::string(argv[i + 1]) == "on";
+        }
+        if (std::string(argv[i]) == "--dynres") {
+            dynrestarget = std::max(std::atof(argv[i + 1]), 0.0);
+        }
+        if (std::string(argv[i]) == "--particles") {
+            particlecount = std::max(std::atoi(argv[i + 1]), 0);
+        }
+        if (std::string(argv[i]) == "--skinning") {
+            skinning = std::string(argv[i + 1]) == "on";
+        }
+        if (std::string(argv[i]) == "--transparency") {
+            transparent = Transparency::parseMode(argv[i + 1], transparencymode);
+            if (!transparent) {
+                std::cerr << "Unknown transparency mode '" << argv[i + 1] << "'\n";
+            }
+        }
+        if (std::string(argv[i]) == "--reprojection") {
+            reprojection = std::string(argv[i + 1]) == "on";
+        }
+        if (std::string(argv[i]) == "--post" &&
+            !PostProcess::parseEffects(argv[i + 1], posteffects)) {
+            std::cerr << "Unknown post-processing effects '" << argv[i + 1] << "'\n";
+        }
+        if (std::string(argv[i]) == "--aa" && !AntiAliasing::parseMode(argv[i + 1], aamode)) {
+            std::cerr << "Unknown anti-aliasing mode '" << argv[i + 1] << "'\n";
+        }
+        if (std::string(argv[i]) == "--pack") {
+            packfile = argv[i + 1];
+        }
+        if (std::string(argv[i]) == "--picking") {
+            picking = std::string(argv[i + 1]) == "on";
+            bvhpicking = std::string(argv[i + 1]) == "bvh";
+        }
+        if (std::string(argv[i]) == "--gpubudget") {
+            gpubudget = size_t(std::max(std::atof(argv[i + 1]), 0.0) * double(1 << 20));
+            gpumem::setTotalBudget(gpubudget);
+        }
+        if (std::string(argv[i]) == "--trace") {
+            tracefile = argv[i + 1];
+        }
+        if (std::string(argv[i]) == "--pipelinestats") {
+            if (std::string(argv[i + 1]) == "passes") {
+                statisticsmode = PipelineStatistics::Mode::Passes;
+            } else if (std::string(argv[i + 1]) == "meshes") {
+                statisticsmode = PipelineStatistics::Mode::Meshes;
+            }
+        }
+        if (std::string(argv[i]) == "--backend") {
+            vulkan = std::string(argv[i + 1]) == "vulkan";
+        }
+        if (std::string(argv[i]) == "--wireframe") {
+            wireframe = argv[i + 1];
+        }
+        if (std::string(argv[i]) == "--glloader") {
+            glloadermode = std::string(argv[i + 1]) == "glew" ? glloader::Mode::Full
+                                                               : glloader::Mode::Minimal;
+        }
+        if (std::string(argv[i]) == "--simrate") {
+            simulation.setRate(std::atof(argv[i + 1]));
+        }
+        if (std::string(argv[i]) == "--overlay") {
+            overlay = std::string(argv[i + 1]) == "on";
+        }
+        if (std::string(argv[i]) == "--drawcapture") {
+            drawcapturefile = argv[i + 1];
+        }
+        if (std::string(argv[i]) == "--autotune") {
+            autotune = argv[i + 1];
+        }
+        if (std::string(argv[i]) == "--tuning") {
+            tuningfile = argv[i + 1];
+        }
+        if (std::string(argv[i]) == "--stereo") {
+            eyeseparation = std::max(static_cast<float>(std::atof(argv[i + 1])), 0.0f);
+        }
+        if (std::string(argv[i]) == "--views") {
+            views = std::min(std::max(std::atoi(argv[i + 1]), 1), MultiView::maxViews);
+        }
+        if (std::string(argv[i]) == "--dsa") {
+            dsa = std::string(argv[i + 1]) != "off";
+        }
+        if (std::string(argv[i]) == "--gldebug") {
+            const std::string filter = argv[i + 1];
+            gldebugon = filter != "off";
+            if (filter == "warnings") {
+                gldebugfilter = gldebug::Filter::Warnings;
+            } else if (filter == "all") {
+                gldebugfilter = gldebug::Filter::All;
+            }
+        }
+    }
+    TRACE_THREAD("main");
+    if (!tracefile.empty()) {
+        trace::start();
+    }
+    const bool headless = headlessWidth > 0;
+    if (headless) {
+        pacer.setMode(FramePacer::Mode::Unlimited);  // Batch rendering, as fast as possible
+        if (maxFrames <= 0) {
+            maxFrames = 100;
+        }
+    }
+    if (views > 1 && eyeseparation > 0.0f) {
+        std::cerr << "--views: not with --stereo, drawing one view for each eye\n";
+        views = 1;
+    }
+    if ((views > 1 || eyeseparation > 0.0f) &&
+        (prepass || transparent || particlecount > 0 || !streamfile.empty() ||
+         dynrestarget > 0.0 || reprojection || picking || bvhpicking || posteffects != 0 ||
+         aamode != AntiAliasing::Mode::Off)) {
+        std::cerr << "--views and --stereo: not with --prepass, --transparency, --particles, "
+                     "--stream, --dynres, --reprojection, --picking, --post or --aa, drawing "
+                     "one view\n";
+        views = 1;
+        eyeseparation = 0.0f;
+    }
 	
-    Shader myShader;
+    // The pack is mounted for all names, before anything is loaded
+    if (!packfile.empty()) {
+        std::error_code error;
+        if (!std::filesystem::exists(packfile, error)) {
+            std::vector<std::string> files;
+            for (const char* directory : {".", "textures"}) {
+                for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+                    const std::string extension = entry.path().extension().string();
+                    if (entry.is_regular_file() &&
+                        (extension == ".glsl" || extension == ".tga" || extension == ".dds")) {
+                        files.push_back(entry.path().generic_string());
+                    }
+                }
+            }
+            if (!meshfile.empty() && !vfs::isRemote(meshfile)) {
+                files.push_back(meshfile);
+            }
+            PackFile::write(packfile, files);
+        }
+        auto pack = std::make_shared<PackFile>();
+        if (pack->map(packfile)) {
+            vfs::mount("", pack);
+            std::cout << "Mounted " << packfile << " with " << pack->count() << " files\n";
+        }
+    }
+
+    const bool glb = meshfile.size() >= 4 && meshfile.compare(meshfile.size() - 4, 4, ".glb") == 0;
+    bool meshloading = !glb && vfs::isRemote(meshfile);  // Loaded by the render thread
+    // An OBJ file, loaded by the ResourceManager once there is a GL context
+    const bool meshresourcefile = !meshfile.empty() && !glb && !meshloading;
 
-    TriangleSoup myShape;
-	
     // Initialise GLFW
-    glfwInit(); 
+    int phase = startup.begin("glfwInit");
+    if (!glfwInit()) {
+        std::cerr << "Unable to initialise GLFW. Without a display, build with "
+                     "-DTNM046_HEADLESS=ON and run with --headless.\n";
+        return -1;
+    }
+    startup.end(phase);
 
-    const GLFWvidmode* vidmode;  // GLFW struct to hold information about the display
+    const GLFWvidmode* vidmode = nullptr;  // GLFW struct to hold information about the display
     GLFWwindow* window;
-    // Determine the desktop size
-    vidmode = glfwGetVideoMode(glfwGetPrimaryMonitor()); 
+    // Determine the desktop size. There is no monitor without a display.
+    GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+    if (monitor) {
+        vidmode = glfwGetVideoMode(monitor);
+    }
+
+    if (vulkan && headless) {
+        std::cerr << "--backend vulkan: does not render headless, using OpenGL\n";
+    } else if (vulkan) {
+        // Vulkan draws the arrays of the mesh, which are not OpenGL objects
+        TriangleSoup::MeshData meshdata;
+        if (meshresourcefile) {
+            StartupPhase phase(startup, "parse OBJ");
+            TriangleSoup::parseOBJ(meshfile, meshdata);
+        }
+        if (runVulkan(meshdata, maxFrames, vidmode ? vidmode->height / 2 : 512)) {
+            glfwTerminate();
+            return 0;
+        }
+    }
 
     // Make sure we are getting a GL context of at least version 3.3
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -462,9 +687,19 @@ int main(int argc, char* argv[]) {
     // Enable the OpenGL core profile
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    if (gldebugon) {
+        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+    }
 
-    // Open a square window (aspect 1:1) to fill half the screen height
-    window = glfwCreateWindow(vidmode->height / 2, vidmode->height / 2, "GLprimer", nullptr, nullptr);
+    // Open a square window (aspect 1:1) to fill half the screen height. A headless run draws
+    // into a framebuffer object instead, and the window is only there for the context.
+    int windowSize = vidmode ? vidmode->height / 2 : 512;
+    if (headless) {
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+        windowSize = 64;
+    }
+    phase = startup.begin("create window");
+    window = glfwCreateWindow(windowSize, windowSize, "GLprimer", nullptr, nullptr);
     if (!window) {
         std::cout << "Unable to open window. Terminating.\n";
         glfwTerminate();  // No window was opened, so we can't continue in any useful way
@@ -474,21 +709,69 @@ int main(int argc, char* argv[]) {
     // Make the newly created window the "current context" for OpenGL
     // (This step is strictly required or things will simply not work)
     glfwMakeContextCurrent(window);
+    startup.end(phase);
 
-    // Initialize glew
-    GLenum err = glewInit();
-	
-    if (GLEW_OK != err) {
-        std::cerr << "Error: " << glewGetErrorString(err) << "\n";
+    // Load the GL functions
+    phase = startup.begin(glloader::modeName(glloadermode));
+    if (!glloader::load(glloadermode)) {
         glfwTerminate();
         return -1;
     }
+    startup.end(phase);
+
+    // The mesh and the shaders come from a ResourceManager, whose jobs read and parse the
+    // files while the rest is set up. Only the GL objects are made on this thread.
+    ResourceManager resources;
+    ResourceHandle<TriangleSoup> meshresource;
+    if (meshresourcefile) {
+        meshresource = resources.requestMesh(meshfile);
+    }
+
+    // The settings that depend on the GPU, measured here before anything else draws. A
+    // headless run keeps them as they are, so that its frames do not depend on the machine.
+    Autotuner tuner(tuningfile);
+    tuner.load();
+    if (autotune != "off" && !headless) {
+        phase = startup.begin("autotune");
+        int framewidth = 0;
+        int frameheight = 0;
+        glfwGetFramebufferSize(window, &framewidth, &frameheight);
+        const int tuned = tuner.tune(framewidth, frameheight, autotune == "all");
+        startup.end(phase);
+        if (tuned > 0) {
+            std::cout << "Autotuned " << tuned << " settings: " << tuner.summary() << "\n";
+            tuner.save();
+        }
+    }
+    const Autotuner::Settings& tuned = tuner.settings();
+
+    // The GL objects are created after GLEW has loaded the GL functions, which their
+    // destructors also need if main() returns early
+    ResourceHandle<Shader> myShaderResource;
+    ResourceHandle<Shader> depthShaderResource;  // For the depth prepass and the shadow maps
+    ResourceHandle<Shader> transparentShaderResource;  // With transparency only
+    std::deque<Shader> localShaders;  // In place of the shaders that are not resources
+    TriangleSoup localShape;  // In place of a mesh that is not a resource
+    TriangleSoup wall;  // With shadows only
+    TriangleSoup tube;  // With skinning only
+    TriangleSoup bubble;  // With transparency only
+    if (gldebugon) {
+        gldebug::enable(gldebugfilter);
+    }
+    glstate::setDirectStateAccess(dsa);
+    // The names in the GL debug messages and in the pipeline statistics of the meshes
+    wall.setLabel("wall");
+    tube.setLabel("tube");
+    bubble.setLabel("bubble");
+    PipelineStatistics::global().setMode(statisticsmode);
+    ChunkedMesh streamed;  // With --stream only
+    Transparency transparency(transparencymode);
 
     // Generate 1 Vertex array object, put the resulting identifier in vertexArrayID
     GLuint vertexArrayID = 0;
     glGenVertexArrays(1, &vertexArrayID);
     // Activate the vertex array object
-    glBindVertexArray(vertexArrayID);
+    glstate::bindVertexArray(vertexArrayID);
 
     // Create the vertex buffer objects for attribute locations 0 and 1
     // (the list of vertex coordinates and the list of vertex colors).
@@ -498,88 +781,921 @@ int main(int argc, char* argv[]) {
     GLuint indexBufferID = createIndexBuffer(indexArrayData);
 
     // Deactivate the vertex array object again to be nice
-    glBindVertexArray(0);
+    glstate::bindVertexArray(0);
 
     // Show some useful information on the GL context
     std::cout << "GL vendor:       " << glGetString(GL_VENDOR)
               << "\nGL renderer:     " << glGetString(GL_RENDERER)
-              << "\nGL version:      " << glGetString(GL_VERSION)
-              << "\nDesktop size:    " << vidmode->width << " x " << vidmode->height << "\n";
+              << "\nGL version:      " << glGetString(GL_VERSION) << "\n";
+    if (vidmode) {
+        std::cout << "Desktop size:    " << vidmode->width << " x " << vidmode->height << "\n";
+    }
 
-	// Do not wait for screen refresh between frames
-    glfwSwapInterval(0);  
+	// The swap interval is set by the frame pacer on the render thread
     // Enable back face culling
     //glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
-    //Shaders
-    myShader.createShader("vertex.glsl", "fragment.glsl");
-
-    locationTime = glGetUniformLocation(myShader.id(), "time");
-    locationR = glGetUniformLocation(myShader.id(), "R");
-    locationP = glGetUniformLocation(myShader.id(), "P");
-    locationMV = glGetUniformLocation(myShader.id(), "MV");
-
-	
-    glUseProgram(myShader.id());  // Activate the shader to set its variables
-	
-    if (locationTime == -1) {  // If the variable is not found, -1 is returned
-        std::cout << "Unable to locate variable 'time' in shader!\n"
-                  << indexArrayData.size() * sizeof(unsigned int);
+    //Shaders, compiled by the driver while the geometry is created below
+    phase = startup.begin("begin shaders");
+    std::string defines;
+    if (lightcount > 0) {
+        defines += " CLUSTERED_LIGHTS";
+    }
+    if (shadows) {
+        defines += " SHADOWS";
+    }
+    const bool shaderwireframe = wireframe == "shader" || wireframe == "overlay";
+    const bool wireoverlay = wireframe == "overlay";
+    // The surfaces are filled for the wireframe of the shaders
+    const GLenum polygonmode = shaderwireframe ? GL_FILL : GL_LINE;
+    const std::string geometryshader = shaderwireframe ? "geometry_wireframe.glsl" : "";
+    if (shaderwireframe) {
+        defines += wireoverlay ? " WIREFRAME WIREFRAME_OVERLAY" : " WIREFRAME";
+    }
+    const bool taa = aamode == AntiAliasing::Mode::TAA;
+    // The vertex shader can not choose the viewport past a geometry shader
+    MultiView multiview(views, !shaderwireframe);
+    if (views > 1) {
+        defines += multiview.defines();
+        std::cout << "Views:           " << views << ", "
+                  << MultiView::modeName(multiview.mode()) << "\n";
+    }
+    // The same for the two eyes, neither of whose one pass modes works past a geometry shader
+    Stereo stereo(!shaderwireframe);
+    if (eyeseparation > 0.0f) {
+        defines += stereo.defines();
+        std::cout << "Stereo:          " << Stereo::modeName(stereo.mode()) << "\n";
     }
+    const std::string mydefines = defines + (reprojection ? " REPROJECTION" : "") +
+                                  (picking ? " PICKING" : "") + (taa ? " MOTION_VECTORS" : "");
+    const std::string transparentdefines = defines + " " + transparency.defines();
+    myShaderResource =
+        resources.requestShader("vertex.glsl", geometryshader, "fragment.glsl", mydefines);
+    if (prepass || shadows) {
+        depthShaderResource = resources.requestShader("vertex_depth.glsl", "fragment_depth.glsl");
+    }
+    if (transparent) {
+        transparentShaderResource = resources.requestShader("vertex.glsl", geometryshader,
+                                                            "fragment.glsl", transparentdefines);
+    }
+    resources.update();  // Starts the compiles of the shaders whose files have been read
+    startup.end(phase);
+
+    // The shader variables are in the uniform blocks FrameData and ObjectData
+    UniformRing uniforms;
+    // The materials are in the block MaterialData, and each draw has the index of its own
+    MaterialTable materials;
+    const int wallmaterial = materials.add(MaterialTable::phong(0.4f, 0.4f, 0.4f, 0.2f, 20.0f));
+    const int tubematerial = materials.add(MaterialTable::phong(0.1f, 0.3f, 0.5f, 0.6f, 30.0f));
+    const int bubblematerials[3] = {
+        materials.add(MaterialTable::phong(0.2f, 0.5f, 0.6f, 1.0f, 60.0f)),
+        materials.add(MaterialTable::phong(0.6f, 0.5f, 0.1f, 1.0f, 60.0f)),
+        materials.add(MaterialTable::phong(0.3f, 0.6f, 0.2f, 1.0f, 60.0f))};
+    LightClusters lightclusters;
+    ShadowCascades cascades(4, tuned.shadowsize);
+    ReprojectionCache reprojectioncache;
+    BonePalette bonepalette;
+    SkinCache skincache;
+    // The direction to the light in view space, as in vertex.glsl
+    const float lightdirection[3] = {1.0f, 0.8f, 1.0f};
+    // Profiler scopes, one per cascade for its GPU time
+    const char* const cascadescopes[ShadowCascades::maxCascades] = {
+        "shadow cascade 0", "shadow cascade 1", "shadow cascade 2", "shadow cascade 3"};
+    // A fountain in front of the camera, in world space
+    ParticleSystem particles(particlecount);
+    ParticleEmitter emitter;
+    emitter.position[1] = -0.8f;
+    emitter.position[2] = -1.2f;
+    particles.setEmitter(emitter);
+    float particletime = -1.0f;  // frame.time of the last update
 
 	// Lab 3 & 4
     //myShape.createSphere(1.0, 200);
-    myShape.createBox(0.2, 0.2, 1.0);
-	
-    // Main loop
-    while (!glfwWindowShouldClose(window)) {
-        // Set the clear color to a dark gray (RGBA)
-        glClearColor(0.3f, 0.3f, 0.3f, 0.0f);
-        glfwGetWindowSize(window, &width, &height);
-        glViewport(0, 0, width, height);  // Set viewport. This is the pixel rectangle we want to draw into
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear the color and depth buffers for drawing
-        
-		util::displayFPS(window);
-		
-        /* ---- Rendering code should go here ---- */
-        time = static_cast<float>(glfwGetTime());  // Number of seconds since the program was started
-        
-		glUseProgram(myShader.id());
-       
-
-		//auto composition = mat4identity();
-		auto R = mat4identity();
-        auto P = mat4identity();
-		auto MV = mat4identity();
-        
-		
-		auto S = mat4scale(0.5);
-        auto V = mat4rotx(M_PI / 10);
-        auto T = mat4translate(0.0, 0.0, 3.0);
-		
+    phase = startup.begin("resources");
+    resources.finish();  // Reads the files here if no job has started on them yet
+    startup.end(phase);
+    phase = startup.begin("mesh");
+    TriangleSoup& myShape = meshresource.ready() ? *meshresource : localShape;
+    myShape.setLabel(meshfile.empty() ? "shape" : meshfile);
+    std::string shapesource = "lod obj " + meshfile;  // For --drawcapture
+    if (!meshresource.ready() && (!glb || !myShape.readGLB(meshfile))) {
+        myShape.createBox(0.2, 0.2, 1.0);
+        shapesource = "lod box 0.2 0.2 1.0";
+    } else if (glb) {
+        shapesource = "glb " + meshfile;
+    }
+    if (meshloading) {
+        myShape.beginOBJ(meshfile);
+    }
+    startup.end(phase);
+    // Coarser versions for when the shape is small on the screen. A GLB mesh only lives on
+    // the GPU.
+    phase = startup.begin("LODs");
+    if (!myShape.vertices().empty()) {
+        myShape.generateLODs();
+    }
+    myShape.setLODSelection(tuned.lodpixelerror);
+    if (shadows) {
+        wall.createPlane(4.0f, 4.0f, 32, 32);
+    }
+    if (transparent) {
+        bubble.createSphere(0.25f, tuned.spheresegments);
+    }
+    startup.end(phase);
+    if (!streamfile.empty()) {
+        phase = startup.begin("chunks");
+        const std::string chunkfile = streamfile + ".chunks";
+        if (!streamed.open(chunkfile, streamfile) &&
+            !(ChunkedMesh::build(streamfile, chunkfile) && streamed.open(chunkfile, streamfile))) {
+            std::cerr << "Could not stream " << streamfile << "\n";
+        }
+        startup.end(phase);
+    }
+    const bool streaming = streamed.nodeCount() > 0;
 
-        auto orbit = mat4roty( time * M_PI / 8); //R1
-		auto spin = mat4rotx( time * M_PI / 2); // R2
+    // The tube along z, whose upper half follows a second bone, with a morph target that
+    // swells its middle
+    MorphTargets tubemorph;
+    if (skinning) {
+        tube.createCylinder(0.15f, 1.2f, 24, 24);
+        const std::vector<GLfloat>& vertices = tube.vertices();
+        const size_t count = vertices.size() / 8;
+        std::vector<GLubyte> bones(4 * count, 0);
+        std::vector<GLfloat> weights(4 * count, 0.0f);
+        std::vector<GLfloat> offsets(6 * count, 0.0f);
+        for (size_t i = 0; i < count; i++) {
+            const GLfloat* v = &vertices[8 * i];
+            const float t = std::min(std::max((v[2] + 0.2f) / 0.4f, 0.0f), 1.0f);
+            bones[4 * i + 1] = 1;
+            weights[4 * i + 1] = t * t * (3.0f - 2.0f * t);
+            weights[4 * i] = 1.0f - weights[4 * i + 1];
+            const float swell = 0.08f * (1.0f - v[2] * v[2] / 0.36f);
+            for (int c = 0; c < 3; c++) {
+                offsets[6 * i + c] = swell * v[3 + c];
+            }
+        }
+        tube.setSkin(bones.data(), weights.data());
+        tubemorph.create(offsets.data(), static_cast<int>(count), 1);
+    }
+    // The meshes of the draws, described so that the replay can make them again
+    DrawCapture drawcapture;
+    if (!drawcapturefile.empty() && drawcapture.open(drawcapturefile)) {
+        drawcapture.addMesh(&myShape, shapesource);
+        drawcapture.addMesh(&wall, "plane 4 4 32 32");
+        drawcapture.addMesh(&bubble, "sphere 0.25 " + std::to_string(tuned.spheresegments));
+        drawcapture.addMesh(&tube, "cylinder 0.15 1.2 24 24");
+        drawcapture.setMaterials(materials);
+    }
+    // The shaders were finished with the resources. One that did not build is made again
+    // outside of the ResourceManager, so that the file watcher builds it once more when its
+    // files are fixed, and one that is not used is an empty Shader.
+    auto resourceShader = [&](const ResourceHandle<Shader>& handle, const std::string& vertex,
+                              const std::string& geometry, const std::string& fragment,
+                              const std::string& shaderdefines) -> Shader& {
+        if (handle.ready()) {
+            return *handle;
+        }
+        localShaders.emplace_back();
+        if (handle.failed()) {
+            localShaders.back().createShader(vertex, geometry, fragment, shaderdefines);
+        }
+        return localShaders.back();
+    };
+    Shader& myShader = resourceShader(myShaderResource, "vertex.glsl", geometryshader,
+                                      "fragment.glsl", mydefines);
+    Shader& depthShader = resourceShader(depthShaderResource, "vertex_depth.glsl", "",
+                                         "fragment_depth.glsl", "");
+    Shader& transparentShader = resourceShader(transparentShaderResource, "vertex.glsl",
+                                               geometryshader, "fragment.glsl",
+                                               transparentdefines);
+    // The shaders are built again when their files are saved
+    FileWatcher shaderWatcher;
+    myShader.watch(shaderWatcher);
+    if (prepass || shadows) {
+        depthShader.watch(shaderWatcher);
+    }
+    if (transparent) {
+        transparentShader.watch(shaderWatcher);
+    }
 
-        P = mat4perspective( M_PI / 2, 1, 0.1, 100.0);
-		
-		//composition = mat4mult(V, orbit);
-		//composition = mat4mult(composition, T);
-		//composition = mat4mult(composition, spin);
-  //      R = mat4mult(spin, R);
-  //      MV = mat4mult(V, orbit);
-  //      MV = mat4mult(MV, T);
-		//MV = mat4mult(MV, spin);
-        MV = spin;
-		
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);  // rendering as lines or filled
-		
-        glUniformMatrix4fv(locationR, 1, GL_FALSE, R.data());
-        glUniformMatrix4fv(locationMV, 1, GL_FALSE, MV.data()); 
-		glUniformMatrix4fv(locationP, 1, GL_FALSE, P.data()); 
-        glUniform1f(locationTime, time); 
-        
-		myShape.render();
+    // Transformations that never change are computed at compile time
+    constexpr Mat4 R = Mat4::identity();
+    constexpr Mat4 P = Mat4::constPerspective(float(M_PI) / 2.0f, 1.0f, 0.1f, 100.0f);
+
+    // Frame times on the CPU and GPU, for each phase of the render thread
+    FrameProfiler profiler;
+
+    // The frames are drawn on a render thread, which owns the GL context from here on.
+    // This thread polls the input and prepares the next frame meanwhile.
+    std::vector<ptrdiff_t> objectdata;  // Uniform offsets of the draws
+    RenderQueue queue;                  // The draws in the view, in the order they are drawn
+    Framebuffer offscreen;              // Headless only
+    PickBuffer picker;                  // With --picking only
+    BVH bvh;                            // Over the boxes of the draws in view space
+    std::vector<Box> drawboxes;
+    std::vector<int> visibledraws;
+    bvh.setProfiler(&profiler);
+    Overlay perfoverlay;                // Created when it is first shown
+    RenderGraph graph;                  // Rebuilt every frame
+    DynamicResolution dynres(dynrestarget, tuned.dynresminscale, tuned.dynresmaxscale);
+    const bool dynamicresolution = dynrestarget > 0.0;
+    // FXAA is an effect of the post pass, the other modes have passes of their own
+    if (aamode == AntiAliasing::Mode::FXAA) {
+        posteffects |= PostProcess::FXAA;
+    }
+    AntiAliasing antialiasing(aamode);
+    const bool smaa = aamode == AntiAliasing::Mode::SMAA;
+    PostProcess postprocess;
+    postprocess.setEffects(posteffects);
+    const bool postprocessing = posteffects != 0;
+    std::unique_ptr<FrameCapture> capture;
+    if (!outputpattern.empty()) {
+        capture = std::make_unique<FrameCapture>(outputpattern);
+    }
+    bool firstframe = true;  // Only used on the render thread
+    phase = startup.begin("first frame");
+    RenderThread renderer(window, [&](FramePacket& frame) {
+        pacer.applySwapInterval();
+        profiler.beginFrame();
+        TriangleSoup::resetDrawCounts();
+        // The scale of this frame, from the last frame whose GPU time is known
+        int renderwidth = frame.width;
+        int renderheight = frame.height;
+        if (dynamicresolution) {
+            long long measured = -1;
+            const double gputime = profiler.latestGPUFrameTime(measured);
+            dynres.update(frame.frame, measured, gputime);
+            dynres.renderSize(frame.width, frame.height, renderwidth, renderheight);
+        }
+        PipelineStatistics::global().beginFrame(renderwidth * renderheight);
+        // With TAA, the scene is drawn with the projection offset by the jitter of the frame
+        antialiasing.beginFrame(frame.width, frame.height, renderwidth, renderheight);
+        const Mat4 projection = antialiasing.jitter(frame.P);
+        // A rebuilt shader replaces the old one here, between two frames
+        myShader.reloadIfChanged(frame.changedfiles);
+        myShader.ready();
+        if (prepass || shadows) {
+            depthShader.reloadIfChanged(frame.changedfiles);
+            depthShader.ready();
+        }
+        if (transparent) {
+            transparentShader.reloadIfChanged(frame.changedfiles);
+            transparentShader.ready();
+        }
+        if (myShader.pending() || depthShader.pending() || transparentShader.pending()) {
+            pacer.requestRedraw();  // Draw again when the compiler is done
+        }
+        // The faces of a mesh that is still downloading, as far as they have arrived
+        if (meshloading) {
+            meshloading = myShape.continueOBJ();
+            if (!meshloading && !myShape.vertices().empty()) {
+                myShape.generateLODs();
+            }
+            pacer.requestRedraw();
+        }
+        // What was under the cursor a frame or more ago goes back to the main thread
+        if (picking) {
+            picker.poll(frame.pick);
+        }
+        if (headless && (offscreen.width() != frame.width || offscreen.height() != frame.height)) {
+            offscreen.create(frame.width, frame.height);
+        }
+
+        profiler.beginScope("uniforms");
+		myShader.use();  // Only calls glUseProgram() if another program is in use
+        glPolygonMode(GL_FRONT_AND_BACK, polygonmode);  // rendering as lines or filled
+
+        // All uniform data of the frame goes to the GPU in one upload
+        uniforms.beginFrame();
+        const FrameUniforms frameuniforms{projection, Mat4::identity(), frame.time, {}};
+        const ptrdiff_t framedata = uniforms.push(frameuniforms);
+        objectdata.clear();
+        for (const DrawPacket& draw : frame.draws) {
+            objectdata.push_back(uniforms.push(ObjectUniforms{draw.MV, draw.R, draw.material}));
+        }
+        const ptrdiff_t particledata =
+            particlecount > 0 ? uniforms.push(ObjectUniforms{frame.V, frame.V}) : 0;
+        const ptrdiff_t streamdata =
+            streaming ? uniforms.push(ObjectUniforms{frame.streamMV, frame.V}) : 0;
+        // The projection of each shadow cascade in a FrameData block of its own, and the
+        // static draws in view space, which the cached cascades are drawn again for
+        ptrdiff_t shadowdata[ShadowCascades::maxCascades] = {};
+        if (shadows) {
+            uint64_t statickey = util::hashBytes(frame.P.m, sizeof(frame.P.m));
+            for (const DrawPacket& draw : frame.draws) {
+                if (draw.isstatic) {
+                    statickey = util::hashBytes(&draw.shape, sizeof(draw.shape), statickey);
+                    statickey = util::hashBytes(draw.MV.m, sizeof(draw.MV.m), statickey);
+                }
+            }
+            cascades.update(frame.P, lightdirection, statickey);
+            for (int c = 0; c < cascades.count(); c++) {
+                shadowdata[c] = uniforms.push(
+                    FrameUniforms{cascades.matrix(c), Mat4::identity(), frame.time, {}});
+            }
+        }
+        if (views > 1) {
+            multiview.setPanorama(projection, renderwidth, renderheight);
+            multiview.push(uniforms);
+        }
+        if (eyeseparation > 0.0f) {
+            // Each eye in half of the window, with the vertical field of view of the frame
+            stereo.setEyes(Mat4::scale(2.0f, 1.0f, 1.0f) * projection, eyeseparation,
+                           eyeconvergence, std::max(renderwidth / 2, 1), renderheight);
+            stereo.push(uniforms);
+        }
+        uniforms.upload();
+        profiler.endScope();
+
+        if (!frame.lights.empty()) {
+            profiler.beginScope("lights");
+            lightclusters.assign(frame.lights, frame.P);
+            lightclusters.upload();
+            lightclusters.apply(myShader);
+            if (transparent) {
+                lightclusters.apply(transparentShader);
+            }
+            profiler.endScope();
+        }
+        // The levels of the streamed mesh that this view needs, as far as they are loaded
+        if (streaming) {
+            profiler.beginScope("streaming");
+            streamed.update(frame.P, frame.streamMV, renderheight);
+            profiler.endScope();
+        }
+
+        // The tube is skinned once for all the passes below
+        if (skinning) {
+            profiler.beginScope("skinning");
+            const float angle = 0.8f * std::sin(frame.time);
+            const Mat4 bones[2] = {Mat4::identity(), Mat4::rotationX(angle)};
+            bonepalette.clear();
+            const int firstbone = bonepalette.add(bones, 2);
+            bonepalette.upload();
+            const float weight = 0.5f + 0.5f * std::sin(2.0f * frame.time);
+            skincache.skin(tube, bonepalette, firstbone, &tubemorph, &weight);
+            profiler.endScope();
+        }
+
+        // The near cascades with all draws in them, the far ones with the static draws
+        // only, and only when they have changed
+        if (shadows) {
+            depthShader.use();
+            for (int c = 0; c < cascades.count(); c++) {
+                if (!cascades.needsRender(c)) {
+                    continue;
+                }
+                profiler.beginScope(cascadescopes[c]);
+                cascades.beginCascade(c);
+                uniforms.bind(frameBlockBinding, shadowdata[c], sizeof(FrameUniforms));
+                for (size_t i = 0; i < frame.draws.size(); i++) {
+                    const DrawPacket& draw = frame.draws[i];
+                    if ((cascades.isCached(c) && !draw.isstatic) || draw.opacity < 1.0f ||
+                        !Frustum::fromMatrix(cascades.matrix(c) * draw.MV)
+                             .intersects(draw.shape->bounds())) {
+                        continue;
+                    }
+                    uniforms.bind(objectBlockBinding, objectdata[i], sizeof(ObjectUniforms));
+                    draw.shape->renderDepth();
+                }
+                cascades.endCascade(c);
+                profiler.endScope();
+            }
+            glPolygonMode(GL_FRONT_AND_BACK, polygonmode);
+        }
+
+        // The particles move on by the time since the last frame, at most a tenth of a second
+        if (particlecount > 0) {
+            profiler.beginScope("particles update");
+            const float timestep =
+                particletime < 0.0f ? 0.0f : std::min(std::max(frame.time - particletime, 0.0f),
+                                                      0.1f);
+            particletime = frame.time;
+            particles.update(timestep);
+            profiler.endScope();
+        }
+
+        uniforms.bind(frameBlockBinding, framedata, sizeof(FrameUniforms));
+        materials.upload();
+        materials.bind(materialBlockBinding);
+        // The draws in the view go into the queue, once for each pass they are in. The
+        // sort groups them by pass and state, front to back, so that the depth test rejects
+        // most hidden fragments early. Those outside the view are skipped. Transparent draws
+        // are only in the transparent pass, whose order does not matter.
+        profiler.beginScope("sort");
+        // The BVH of the draws is refit to where they are now, and built again when the
+        // draws change or it has degraded. Its cull() finds the draws in the view, and
+        // those of several views or eyes are tested against each of their frustums.
+        drawboxes.clear();
+        for (const DrawPacket& draw : frame.draws) {
+            drawboxes.push_back(transformBounds(draw.shape->bounds(), draw.MV));
+        }
+        if (bvh.objectCount() != static_cast<int>(drawboxes.size()) ||
+            bvh.degradation() > 1.5f) {
+            bvh.build(drawboxes);
+        } else {
+            bvh.refit(drawboxes);
+        }
+        visibledraws.clear();
+        if (views > 1 || eyeseparation > 0.0f) {
+            for (size_t i = 0; i < frame.draws.size(); i++) {
+                const DrawPacket& draw = frame.draws[i];
+                if (views > 1 ? multiview.visible(draw.MV, draw.shape->bounds())
+                              : stereo.visible(draw.MV, draw.shape->bounds())) {
+                    visibledraws.push_back(static_cast<int>(i));
+                }
+            }
+        } else {
+            bvh.cull(Frustum::fromMatrix(frame.P), visibledraws);
+        }
+        if (frame.pickray) {
+            frame.pick = PickResult();
+            frame.pick.object = bvh.pick(frame.rayorigin, frame.raydirection);
+            frame.pick.frame = frame.frame;
+        }
+        queue.clear();
+        for (const int i : visibledraws) {
+            const DrawPacket& draw = frame.draws[i];
+            // The nearest objects have the largest z in view space
+            const uint32_t mesh = uint32_t(reinterpret_cast<uintptr_t>(draw.shape) >> 4);
+            const float depth = -draw.MV.m[14];
+            const uint32_t payload = static_cast<uint32_t>(i);
+            if (draw.opacity < 1.0f) {
+                queue.push(RenderQueue::makeKey(RenderQueue::Pass::Transparent,
+                                                transparentShader.id(), 0, mesh, depth),
+                           payload);
+                continue;
+            }
+            if (prepass) {
+                queue.push(RenderQueue::makeKey(RenderQueue::Pass::Depth, depthShader.id(), 0,
+                                                mesh, depth),
+                           payload);
+            }
+            queue.push(RenderQueue::makeKey(RenderQueue::Pass::Opaque, myShader.id(), 0, mesh,
+                                            depth),
+                       payload);
+        }
+        queue.sort();
+        profiler.endScope();
+        if (drawcapture.isOpen()) {
+            profiler.beginScope("draw capture");
+            drawcapture.writeFrame(frame, frameuniforms, queue);
+            profiler.endScope();
+        }
+
+        // The passes of the frame, into the window or the offscreen framebuffer. The first
+        // one clears it, to a dark gray, and the depth buffer. With dynamic resolution, the
+        // scene goes into the corner of textures of the window size first, and a last pass
+        // scales it up into the frame. So does weighted blended transparency, whose
+        // transparent pass draws into textures of its own with the depth of the scene.
+        graph.reset();
+        const float clearcolor[4] = {0.3f, 0.3f, 0.3f, 0.0f};
+        RenderGraph::Resource target = graph.importFramebuffer(
+            "frame", headless ? offscreen.id() : 0, frame.width, frame.height, clearcolor);
+        RenderGraph::Resource scenecolor = RenderGraph::none;
+        RenderGraph::Resource scenedepth = RenderGraph::none;
+        const bool weighted =
+            transparent && transparencymode == Transparency::Mode::WeightedBlended;
+        const bool offscreenscene = dynamicresolution || weighted || reprojection || picking ||
+                                    postprocessing || smaa || taa;
+        if (offscreenscene) {
+            RenderGraph::TextureDesc color;
+            color.width = frame.width;
+            color.height = frame.height;
+            color.format = postprocessing ? GL_RGBA16F : GL_RGBA8;
+            std::copy(clearcolor, clearcolor + 4, color.clear);
+            scenecolor = graph.createTexture("scene color", color);
+            RenderGraph::TextureDesc depth;
+            depth.width = frame.width;
+            depth.height = frame.height;
+            depth.format = GL_DEPTH_COMPONENT24;
+            depth.clear[0] = 1.0f;
+            scenedepth = graph.createTexture("scene depth", depth);
+        }
+        // The object and the triangle of each pixel, 0 where there is no object
+        RenderGraph::Resource sceneids = RenderGraph::none;
+        if (picking) {
+            RenderGraph::TextureDesc ids;
+            ids.width = frame.width;
+            ids.height = frame.height;
+            ids.format = PickBuffer::format;
+            sceneids = graph.createTexture("scene ids", ids);
+        }
+        // The motion of each pixel since the last frame, for TAA, 0 where there is no object
+        RenderGraph::Resource scenemotion = RenderGraph::none;
+        if (taa) {
+            RenderGraph::TextureDesc motion;
+            motion.width = frame.width;
+            motion.height = frame.height;
+            motion.format = AntiAliasing::motionFormat;
+            scenemotion = graph.createTexture("scene motion", motion);
+        }
+        // The opaque scene of the last frame, which the shading of this one reuses
+        RenderGraph::Resource history = RenderGraph::none;
+        if (reprojection) {
+            if (reprojectioncache.width() != frame.width ||
+                reprojectioncache.height() != frame.height) {
+                reprojectioncache.resize(frame.width, frame.height);
+            } else if (!frame.changedfiles.empty()) {
+                reprojectioncache.invalidate();
+            }
+            reprojectioncache.beginFrame(renderwidth, renderheight);
+            history = graph.importFramebuffer("history", reprojectioncache.framebuffer(),
+                                              frame.width, frame.height, clearcolor);
+        } else if (taa) {
+            // Only the matrices of the last frame, for the motion vectors
+            reprojectioncache.beginFrame(renderwidth, renderheight);
+        }
+        auto writeScene = [&](RenderGraph::Builder& builder, RenderGraph::Load load) {
+            if (offscreenscene) {
+                scenecolor = builder.write(scenecolor, load);
+                scenedepth = builder.write(scenedepth, load);
+            } else {
+                target = builder.write(target, load);
+            }
+        };
+        // The draws of the depth pass come first in the queue, then those of the opaque and
+        // of the transparent pass
+        const std::vector<RenderQueue::Draw>& entries = queue.draws();
+        const auto opaque = std::partition_point(
+            entries.begin(), entries.end(), [](const RenderQueue::Draw& entry) {
+                return RenderQueue::pass(entry.key) == RenderQueue::Pass::Depth;
+            });
+        const auto transparents =
+            std::partition_point(opaque, entries.end(), [](const RenderQueue::Draw& entry) {
+                return RenderQueue::pass(entry.key) == RenderQueue::Pass::Opaque;
+            });
+        auto drawRange = [&](std::vector<RenderQueue::Draw>::const_iterator begin,
+                             std::vector<RenderQueue::Draw>::const_iterator end, bool depthonly) {
+            for (auto entry = begin; entry != end; ++entry) {
+                const DrawPacket& draw = frame.draws[entry->payload];
+                uniforms.bind(objectBlockBinding, objectdata[entry->payload],
+                              sizeof(ObjectUniforms));
+                if ((reprojection || taa) && !depthonly) {
+                    // A skinned mesh moves in ways that its matrices do not tell
+                    reprojectioncache.setDraw(myShader, entry->payload, draw.shape,
+                                              projection * draw.MV, !draw.shape->skinned());
+                }
+                if (picking && !depthonly) {
+                    PickBuffer::setObject(myShader, static_cast<int>(entry->payload));
+                }
+                if (depthonly) {
+                    draw.shape->renderLODDepth(frame.P, draw.MV.m);
+                } else {
+                    draw.shape->renderLOD(frame.P, draw.MV.m);
+                }
+            }
+        };
+        // The streamed mesh, after the opaque draws of the queue, with the id after theirs
+        auto drawStreamed = [&](bool depthonly) {
+            if (!streaming) {
+                return;
+            }
+            uniforms.bind(objectBlockBinding, streamdata, sizeof(ObjectUniforms));
+            if ((reprojection || taa) && !depthonly) {
+                reprojectioncache.setDraw(myShader, frame.draws.size(), &streamed,
+                                          projection * frame.streamMV);
+            }
+            if (picking && !depthonly) {
+                PickBuffer::setObject(myShader, static_cast<int>(frame.draws.size()));
+            }
+            streamed.render();
+        };
+        if (prepass) {
+            graph.addPass(
+                "depth prepass",
+                [&](RenderGraph::Builder& builder) {
+                    writeScene(builder, RenderGraph::Load::Clear);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("depth prepass");
+                    glViewport(0, 0, renderwidth, renderheight);
+                    depthShader.use();
+                    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                    drawRange(entries.begin(), opaque, true);
+                    drawStreamed(true);
+                    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                    profiler.endScope();
+                });
+        }
+        graph.addPass(
+            "render",
+            [&](RenderGraph::Builder& builder) {
+                writeScene(builder, prepass ? RenderGraph::Load::Keep : RenderGraph::Load::Clear);
+                if (picking) {
+                    sceneids = builder.write(sceneids, RenderGraph::Load::Clear);
+                }
+                if (taa) {
+                    scenemotion = builder.write(scenemotion, RenderGraph::Load::Clear);
+                }
+            },
+            [&](const RenderGraph&) {
+                profiler.beginScope("render");
+                glViewport(0, 0, renderwidth, renderheight);
+                myShader.use();
+                if (shadows) {
+                    cascades.apply(myShader);
+                }
+                if (reprojection) {
+                    reprojectioncache.apply(myShader);
+                }
+                if (taa) {
+                    antialiasing.applyMotion(myShader);
+                }
+                if (prepass) {
+                    // Shade only the fragments whose depth is the one in the buffer
+                    glDepthFunc(GL_EQUAL);
+                    glDepthMask(GL_FALSE);
+                }
+                // The edges of the shaders are blended by their coverage of the pixels
+                if (shaderwireframe && !wireoverlay) {
+                    glEnable(GL_BLEND);
+                    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                }
+                if (views > 1) {
+                    // All views in one pass, or one pass per view
+                    for (int pass = 0; pass < multiview.passes(); pass++) {
+                        multiview.beginPass(pass, uniforms);
+                        drawRange(opaque, transparents, false);
+                    }
+                    multiview.end(renderwidth, renderheight);
+                } else if (eyeseparation > 0.0f) {
+                    // Both eyes in one pass, or one pass per eye, then side by side
+                    for (int pass = 0; pass < stereo.passes(); pass++) {
+                        stereo.beginPass(pass, uniforms, clearcolor);
+                        drawRange(opaque, transparents, false);
+                    }
+                    stereo.end(renderwidth, renderheight);
+                } else {
+                    drawRange(opaque, transparents, false);
+                }
+                drawStreamed(false);
+                if (shaderwireframe && !wireoverlay) {
+                    glDisable(GL_BLEND);
+                }
+                if (prepass) {
+                    glDepthFunc(GL_LESS);
+                    glDepthMask(GL_TRUE);  // For the clear of the next frame
+                }
+                profiler.endScope();
+            });
+        // The pixels around the cursor, read back without waiting, and mapped a frame later
+        if (picking) {
+            graph.addPass(
+                "pick readback",
+                [&](RenderGraph::Builder& builder) {
+                    builder.read(sceneids);
+                    builder.sideEffect();
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("pick readback");
+                    picker.read(graph.texture(sceneids), renderwidth, renderheight, frame.width,
+                                frame.height, frame.pickx, frame.picky, frame.frame);
+                    profiler.endScope();
+                });
+        }
+        if (reprojection) {
+            graph.addPass(
+                "reprojection store",
+                [&](RenderGraph::Builder& builder) {
+                    builder.read(scenecolor);
+                    builder.read(scenedepth);
+                    history = builder.write(history, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("reprojection store");
+                    reprojectioncache.store(graph.texture(scenecolor), graph.texture(scenedepth));
+                    profiler.endScope();
+                });
+        }
+        // The transparent surfaces, behind the particles, which blend in any order anyway
+        RenderGraph::Resource accumulation = RenderGraph::none;
+        RenderGraph::Resource weights = RenderGraph::none;
+        if (transparent && transparents != entries.end()) {
+            if (weighted) {
+                RenderGraph::TextureDesc desc;
+                desc.width = frame.width;
+                desc.height = frame.height;
+                desc.format = GL_RGBA16F;
+                std::copy(Transparency::accumulationClear, Transparency::accumulationClear + 4,
+                          desc.clear);
+                accumulation = graph.createTexture("oit accumulation", desc);
+                desc.format = GL_R16F;
+                std::fill(desc.clear, desc.clear + 4, 0.0f);
+                weights = graph.createTexture("oit weights", desc);
+            }
+            graph.addPass(
+                "transparent",
+                [&](RenderGraph::Builder& builder) {
+                    if (weighted) {
+                        accumulation = builder.write(accumulation, RenderGraph::Load::Clear);
+                        weights = builder.write(weights, RenderGraph::Load::Clear);
+                        scenedepth = builder.write(scenedepth, RenderGraph::Load::Keep);
+                    } else {
+                        writeScene(builder, RenderGraph::Load::Keep);
+                    }
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("transparent");
+                    glViewport(0, 0, renderwidth, renderheight);
+                    if (transparency.beginTransparent(frame.width, frame.height)) {
+                        transparentShader.use();
+                        transparency.apply(transparentShader);
+                        if (shadows) {
+                            cascades.apply(transparentShader);
+                        }
+                        for (auto entry = transparents; entry != entries.end(); ++entry) {
+                            const DrawPacket& draw = frame.draws[entry->payload];
+                            transparentShader.setUniform("opacity", draw.opacity);
+                            uniforms.bind(objectBlockBinding, objectdata[entry->payload],
+                                          sizeof(ObjectUniforms));
+                            draw.shape->renderLOD(frame.P, draw.MV.m);
+                        }
+                        transparency.endTransparent();
+                    }
+                    profiler.endScope();
+                });
+            graph.addPass(
+                "transparent composite",
+                [&](RenderGraph::Builder& builder) {
+                    if (weighted) {
+                        builder.read(accumulation);
+                        builder.read(weights);
+                    }
+                    writeScene(builder, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("transparent composite");
+                    glViewport(0, 0, renderwidth, renderheight);
+                    if (weighted) {
+                        transparency.finish(graph.texture(accumulation), graph.texture(weights));
+                    } else {
+                        transparency.finish();
+                    }
+                    profiler.endScope();
+                });
+        }
+        if (particlecount > 0) {
+            graph.addPass(
+                "particles",
+                [&](RenderGraph::Builder& builder) {
+                    writeScene(builder, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("particles");
+                    glViewport(0, 0, renderwidth, renderheight);
+                    uniforms.bind(objectBlockBinding, particledata, sizeof(ObjectUniforms));
+                    particles.render(renderheight);
+                    profiler.endScope();
+                });
+        }
+        // The anti-aliased scene replaces the scene for the passes after it. SMAA finds the
+        // edges and their blend weights in textures of their own, and TAA blends the scene
+        // into its history, which is then read in place of a texture of the graph.
+        RenderGraph::Resource smaaedges = RenderGraph::none;
+        RenderGraph::Resource smaaweights = RenderGraph::none;
+        RenderGraph::Resource antialiased = RenderGraph::none;
+        if (smaa) {
+            RenderGraph::TextureDesc desc;
+            desc.width = frame.width;
+            desc.height = frame.height;
+            desc.format = AntiAliasing::edgesFormat;
+            smaaedges = graph.createTexture("smaa edges", desc);
+            desc.format = AntiAliasing::weightsFormat;
+            smaaweights = graph.createTexture("smaa weights", desc);
+            desc.format = postprocessing ? GL_RGBA16F : GL_RGBA8;
+            antialiased = graph.createTexture("smaa color", desc);
+            graph.addPass(
+                "smaa edges",
+                [&](RenderGraph::Builder& builder) {
+                    builder.read(scenecolor);
+                    smaaedges = builder.write(smaaedges, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("smaa edges");
+                    antialiasing.detectEdges(graph.texture(scenecolor));
+                    profiler.endScope();
+                });
+            graph.addPass(
+                "smaa weights",
+                [&](RenderGraph::Builder& builder) {
+                    builder.read(smaaedges);
+                    smaaweights = builder.write(smaaweights, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("smaa weights");
+                    antialiasing.computeWeights(graph.texture(smaaedges));
+                    profiler.endScope();
+                });
+            graph.addPass(
+                "smaa blend",
+                [&](RenderGraph::Builder& builder) {
+                    builder.read(scenecolor);
+                    builder.read(smaaweights);
+                    antialiased = builder.write(antialiased, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("smaa blend");
+                    antialiasing.blend(graph.texture(scenecolor), graph.texture(smaaweights));
+                    profiler.endScope();
+                });
+        } else if (taa) {
+            antialiased = graph.importFramebuffer(
+                "taa history", antialiasing.historyFramebuffer(), frame.width, frame.height);
+            graph.addPass(
+                "taa resolve",
+                [&](RenderGraph::Builder& builder) {
+                    builder.read(scenecolor);
+                    builder.read(scenemotion);
+                    antialiased = builder.write(antialiased, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("taa resolve");
+                    antialiasing.resolve(graph.texture(scenecolor), graph.texture(scenemotion));
+                    profiler.endScope();
+                });
+        }
+        // The scene as the passes below read it
+        const RenderGraph::Resource finalscene =
+            antialiased != RenderGraph::none ? antialiased : scenecolor;
+        auto sceneTexture = [&]() {
+            return taa ? antialiasing.history() : graph.texture(finalscene);
+        };
+        // The bloom, blurred across into a second texture and down back into the first
+        RenderGraph::Resource bloom = RenderGraph::none;
+        RenderGraph::Resource bloomblur = RenderGraph::none;
+        if (postprocess.effects() & PostProcess::Bloom) {
+            RenderGraph::TextureDesc desc;
+            postprocess.bloomSize(frame.width, frame.height, desc.width, desc.height);
+            desc.format = GL_RGBA16F;
+            bloom = graph.createTexture("bloom", desc);
+            bloomblur = graph.createTexture("bloom blur", desc);
+            graph.addPass(
+                "bloom downsample",
+                [&](RenderGraph::Builder& builder) {
+                    builder.read(finalscene);
+                    bloom = builder.write(bloom, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("bloom downsample");
+                    postprocess.downsample(sceneTexture(), renderwidth, renderheight);
+                    profiler.endScope();
+                });
+            graph.addPass(
+                "bloom blur",
+                [&](RenderGraph::Builder& builder) {
+                    builder.read(bloom);
+                    bloomblur = builder.write(bloomblur, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("bloom blur");
+                    postprocess.blur(graph.texture(bloom), false);
+                    profiler.endScope();
+                });
+            graph.addPass(
+                "bloom blur down",
+                [&](RenderGraph::Builder& builder) {
+                    builder.read(bloomblur);
+                    bloom = builder.write(bloom, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("bloom blur down");
+                    postprocess.blur(graph.texture(bloomblur), true);
+                    profiler.endScope();
+                });
+        }
+        if (postprocessing) {
+            graph.addPass(
+                "post",
+                [&](RenderGraph::Builder& builder) {
+                    builder.read(finalscene);
+                    if (bloom != RenderGraph::none) {
+                        builder.read(bloom);
+                    }
+                    target = builder.write(target, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("post");
+                    postprocess.apply(sceneTexture(), renderwidth, renderheight,
+                                      graph.texture(bloom));
+                    profiler.endScope();
+                });
+        } else if (offscreenscene) {
+            graph.addPass(
+                "upscale",
+                [&](RenderGraph::Builder& builder) {
+                    builder.read(finalscene);
+                    target = builder.write(target, RenderGraph::Load::Keep);
+                },
+                [&](const RenderGraph&) {
+                    profiler.beginScope("upscale");
+                    dynres.upscale(sceneTexture(), renderwidth, renderheight);
+                    profiler.endScope();
+                });
+        }
+        if (graph.compile()) {
+            graph.execute();
+        }
 		
 		// Draw the triangles
 		
@@ -592,23 +1708,340 @@ int main(int argc, char* argv[]) {
 		
         glDrawElements(GL_TRIANGLES, 12 * 3, GL_UNSIGNED_INT, nullptr);*/
 
+        // Start reading the frame back; the file is written a few frames later
+        if (capture) {
+            profiler.beginScope("capture");
+            capture->capture(frame.frame, frame.width, frame.height);
+            profiler.endScope();
+        }
+
+        // The overlay goes on top of the finished picture, and is not in the captured frames
+        if (frame.overlay) {
+            profiler.beginScope("overlay");
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(0, 0, frame.width, frame.height);
+            perfoverlay.render(profiler);
+            profiler.endScope();
+        }
+
         // Swap buffers, display the image and prepare for next frame
+        profiler.beginScope("swap");
         glfwSwapBuffers(window);
+        profiler.endScope();
+        BufferPool::global().collect();  // Reuse the mesh buffers freed a frame or more ago
+        if (firstframe) {
+            startup.end(phase);
+            startup.print(std::cout);
+            firstframe = false;
+        }
+        if (frame.inputtime >= 0.0) {
+            profiler.measureLatency(frame.inputtime);
+        }
 
-        // Poll events (read keyboard and mouse input)
-        glfwPollEvents();
+        // Only the main thread may set the title, so it goes back in the packet. The overlay
+        // shows the same without the cost of setting the title.
+        if (!frame.overlay) {
+            profiler.windowTitle(frame.title);
+        }
+    });
+
+    // The scene: the shape spins under the view rotation, and the other objects stay where
+    // they are in view space, so only the shape and the view are updated every frame
+    SceneGraph scene;
+    const SceneGraph::Node viewnode = scene.add();
+    const SceneGraph::Node shapenode = scene.add(viewnode);
+    const SceneGraph::Node tubenode = scene.add();  // Upright, to the right of the shape
+    scene.setTranslation(tubenode, 0.6f, 0.0f, -1.2f);
+    scene.setRotation(tubenode, -float(M_PI) / 2.0f, 0.0f, 0.0f);
+    const SceneGraph::Node wallnode = scene.add();  // Behind the shape
+    scene.setTranslation(wallnode, 0.0f, 0.0f, -1.5f);
+    SceneGraph::Node bubblenodes[3];  // Overlapping, across the shape
+    for (int i = 0; i < 3; i++) {
+        const float offset = float(i - 1);
+        bubblenodes[i] = scene.add();
+        scene.setTranslation(bubblenodes[i], 0.3f * offset, -0.1f * offset, -1.1f - 0.2f * offset);
+    }
+    // The streamed mesh turns with the view in front of it, scaled to a radius of 0.5
+    // around the center of its bounds
+    const SceneGraph::Node streamnode = scene.add();
+    const SceneGraph::Node streamcenter = scene.add(streamnode);
+    if (streaming) {
+        const mesh::Bounds& bounds = streamed.bounds();
+        scene.setTranslation(streamnode, 0.0f, 0.0f, -1.5f);
+        scene.setScale(streamnode, bounds.radius > 0.0f ? 0.5f / bounds.radius : 1.0f);
+        scene.setTranslation(streamcenter, -bounds.center[0], -bounds.center[1],
+                             -bounds.center[2]);
+    }
+
+    // The animation, in the fixed steps of 'simulation': the spin of the shape in object 0,
+    // and the positions of the lights in the rest. The frames blend the last two steps.
+    struct AnimationState {
+        long long steps = 0;  // Steps of animation, not counting pauses
+        TransformArrays transforms;
+    };
+    AnimationState animationstates[2];  // The second last and the last step
+    TransformArrays animated;           // Blended for the frame
+    auto animateStep = [&](AnimationState& state) {
+        const float time = static_cast<float>(double(state.steps) / simulation.rate());
+        state.transforms.resize(1 + lightcount);
+        state.transforms.setRotation(0, time * float(M_PI) / 2.0f, 0.0f, 0.0f);  // Spin
+        // Red, green and blue point lights in rings around the shape, turning with the time
+        for (int i = 0; i < lightcount; i++) {
+            const float angle = 2.0f * float(M_PI) * float(i) / float(lightcount) + 0.5f * time;
+            const float ring = 0.3f + 0.7f * float(i % 5) / 4.0f;
+            state.transforms.tx[1 + i] = ring * std::cos(angle);
+            state.transforms.ty[1 + i] = ring * std::sin(angle);
+            state.transforms.tz[1 + i] = -0.2f - 1.8f * float(i % 7) / 6.0f;
+        }
+    };
+    animateStep(animationstates[1]);
+    animationstates[0] = animationstates[1];
+
+    // Main loop. Frames are only prepared when something changed the picture, which in
+    // the "ondemand" pacing mode lets the loop sleep while the scene is still.
+    MouseRotator mouseRotator(window);
+    KeyRotator keyRotator(window);
+    pacer.watchWindow(window);
+    bool animate = true;         // Space pauses and resumes the spinning
+    bool spaceDown = false;
+    bool f1Down = false;
+    double lastTime = glfwGetTime();
+    long long framesSubmitted = 0;
+    while (!glfwWindowShouldClose(window)) {
+        // Poll events (read keyboard and mouse input), or wait for them when drawing on demand
+        pacer.processEvents();
 
         // Exit if the ESC key is pressed (and also if the window is closed)
         if (glfwGetKey(window, GLFW_KEY_ESCAPE)) {
             glfwSetWindowShouldClose(window, GL_TRUE);
         }
+
+        // Everything that changes the picture asks for a new frame
+        const bool space = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+        if (space && !spaceDown) {
+            animate = !animate;
+            pacer.requestRedraw();
+        }
+        spaceDown = space;
+        const bool f1 = glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS;
+        if (f1 && !f1Down) {
+            overlay = !overlay;
+            pacer.requestRedraw();
+        }
+        f1Down = f1;
+        // The steps that are due run on the pool while this thread waits for the frame and
+        // for the render thread. Headless frames are one step apart, the same on every run.
+        const double now = glfwGetTime();
+        if (animate && !headless) {
+            pacer.requestRedraw();
+        }
+        const bool animating = animate;
+        simulation.start(headless ? simulation.stepSize() : now - lastTime,
+                         [&animationstates, &animateStep, animating](double) {
+                             animationstates[0] = animationstates[1];
+                             animationstates[1].steps += animating ? 1 : 0;
+                             animateStep(animationstates[1]);
+                         },
+                         &ThreadPool::global());
+        lastTime = now;
+        if (mouseRotator.hasInput() || keyRotator.hasInput()) {
+            pacer.requestRedraw();
+        }
+        // The cursor moving over the picture asks for a frame to pick from
+        if ((picking || bvhpicking) && !headless) {
+            double cursorx;
+            double cursory;
+            glfwGetCursorPos(window, &cursorx, &cursory);
+            if (cursorx != mouseRotator.cursorX() || cursory != mouseRotator.cursorY()) {
+                pacer.requestRedraw();
+            }
+        }
+        std::vector<std::string> changedfiles = shaderWatcher.changes();
+        if (!changedfiles.empty()) {
+            pacer.requestRedraw();
+        }
+        if (!pacer.needsFrame()) {
+            continue;
+        }
+
+        // Sleeps until the frame is due with a fixed frame rate, returns at once otherwise
+        pacer.waitForFrame();
+        // Waits only if the render thread is two frames behind
+        FramePacket& frame = renderer.beginFrame();
+        if (!frame.title.empty()) {
+            glfwSetWindowTitle(window, frame.title.c_str());
+            frame.title.clear();
+        }
+        if (frame.pick.frame >= 0) {
+            const PickResult& last = mouseRotator.picked();
+            if (frame.pick.object != last.object || frame.pick.primitive != last.primitive) {
+                if (frame.pick.object < 0) {
+                    std::cout << "Picked nothing\n";
+                } else if (frame.pick.primitive < 0) {
+                    std::cout << "Picked object " << frame.pick.object << "\n";
+                } else {
+                    std::cout << "Picked object " << frame.pick.object << ", triangle "
+                              << frame.pick.primitive << "\n";
+                }
+            }
+            mouseRotator.setPicked(frame.pick);
+            frame.pick = PickResult();
+        }
+        glfwGetWindowSize(window, &width, &height);
+        if (headless) {
+            width = headlessWidth;
+            height = headlessHeight;
+        }
+
+        // Sample the rotation as late as possible, after any wait for the render thread
+        mouseRotator.poll();
+        keyRotator.poll();
+        double inputtime = mouseRotator.inputTime();
+        if (inputtime < 0.0 || (keyRotator.inputTime() >= 0.0 &&
+                                keyRotator.inputTime() < inputtime)) {
+            inputtime = keyRotator.inputTime();
+        }
+
+        /* ---- Rendering code should go here ---- */
+        simulation.wait();
+        const double alpha = simulation.alpha();
+        interpolateTransforms(animationstates[0].transforms, animationstates[1].transforms,
+                              float(alpha), animated);
+        const double steps = double(animationstates[0].steps) +
+                             double(animationstates[1].steps - animationstates[0].steps) * alpha;
+        time = static_cast<float>(steps / simulation.rate());  // Seconds the shape has spun
+
+		//Mat4 composition = Mat4::identity();
+		//composition = V * orbit * T * spin;
+  //      R = spin * R;
+  //      MV = V * orbit * T * spin;
+        // The view rotation from the mouse and the arrow keys, RotX(theta) * RotY(phi), as
+        // the product of the quaternions of the two half angles
+        float sx, cx, sy, cy;
+        Mat4::sincos(0.5f * float(mouseRotator.theta() + keyRotator.theta()), sx, cx);
+        Mat4::sincos(0.5f * float(mouseRotator.phi() + keyRotator.phi()), sy, cy);
+        scene.setRotation(viewnode, sx * cy, cx * sy, sx * sy, cx * cy);
+        if (streaming) {
+            scene.setRotation(streamnode, sx * cy, cx * sy, sx * sy, cx * cy);
+        }
+        scene.setRotation(shapenode, animated.qx[0], animated.qy[0], animated.qz[0],
+                          animated.qw[0]);
+        scene.update();
+
+        // Everything the render thread needs for the frame
+        frame.width = width;
+        frame.height = height;
+        frame.time = time;
+        frame.overlay = overlay && !headless;
+        frame.P = P;
+        frame.V = scene.world(viewnode);
+        frame.draws.clear();
+        if (streaming) {
+            frame.streamMV = scene.world(streamcenter);
+        } else {
+            frame.draws.push_back(DrawPacket{&myShape, scene.world(shapenode), R});
+        }
+        if (skinning) {
+            frame.draws.push_back(DrawPacket{&tube, scene.world(tubenode),
+                                             Mat4::rotationX(-float(M_PI) / 2.0f), false, 1.0f,
+                                             GLuint(tubematerial)});
+        }
+        if (shadows) {
+            // Behind the shape, and still in view space
+            frame.draws.push_back(DrawPacket{&wall, scene.world(wallnode), R, true, 1.0f,
+                                             GLuint(wallmaterial)});
+        }
+        if (transparent) {
+            for (int i = 0; i < 3; i++) {
+                frame.draws.push_back(DrawPacket{&bubble, scene.world(bubblenodes[i]), R, false,
+                                                 0.4f, GLuint(bubblematerials[i])});
+            }
+        }
+        frame.lights.clear();
+        for (int i = 0; i < lightcount; i++) {
+            PointLight light{{animated.tx[1 + i], animated.ty[1 + i], animated.tz[1 + i]},
+                             0.4f, {0.2f, 0.2f, 0.2f}, 1.0f};
+            light.color[i % 3] = 1.0f;
+            frame.lights.push_back(light);
+        }
+        frame.changedfiles.swap(changedfiles);
+        frame.inputtime = inputtime;
+        frame.pickx = -1;
+        frame.picky = -1;
+        if (picking) {
+            frame.pickx = headless ? width / 2 : static_cast<int>(mouseRotator.cursorX());
+            frame.picky = headless ? height / 2 : static_cast<int>(mouseRotator.cursorY());
+        }
+        frame.pickray = bvhpicking;
+        if (bvhpicking && !headless) {
+            mouseRotator.cursorRay(P, frame.rayorigin, frame.raydirection);
+        } else if (bvhpicking) {  // Through the center of the frame
+            frame.rayorigin[0] = frame.rayorigin[1] = frame.rayorigin[2] = 0.0f;
+            frame.raydirection[0] = P[8] / P[0];
+            frame.raydirection[1] = P[9] / P[5];
+            frame.raydirection[2] = -1.0f;
+        }
+        renderer.submit();
+        framesSubmitted++;
+        if (maxFrames > 0 && framesSubmitted >= maxFrames) {
+            glfwSetWindowShouldClose(window, GL_TRUE);
+        }
+    }
+    // Draw the last frames, and take the GL context back for the cleanup below
+    simulation.wait();
+    renderer.stop();
+    if (!tracefile.empty()) {
+        glFinish();
+        trace::collectGpu();  // The last frames
+        trace::stop();
+        if (trace::write(tracefile)) {
+            std::cout << "Wrote trace to " << tracefile << "\n";
+        }
+    }
+    if (gldebug::enabled()) {
+        gldebug::report(std::cout);
+    }
+    if (PipelineStatistics::global().mode() != PipelineStatistics::Mode::Off) {
+        PipelineStatistics::global().report(std::cout);
+    }
+    if (gpubudget > 0) {
+        gpumem::report(std::cout);
+    }
+    if (capture) {
+        capture->finish();
+        std::cout << "Wrote " << capture->framesWritten() << " frames to " << outputpattern
+                  << "\n";
+    }
+    if (drawcapture.isOpen()) {
+        drawcapture.close();
+        std::cout << "Wrote the draws of " << drawcapture.framesWritten() << " frames to "
+                  << drawcapturefile << "\n";
+    }
+
+    if (!profilefile.empty()) {
+        const bool json = profilefile.size() >= 5 &&
+                          profilefile.compare(profilefile.size() - 5, 5, ".json") == 0;
+        if (json) {
+            profiler.writeJSON(profilefile);
+        } else {
+            profiler.writeCSV(profilefile);
+        }
+        std::cout << "Frame pacing '" << FramePacer::modeName(pacer.mode()) << "': waited "
+                  << pacer.averageWait() << " ms per frame, started "
+                  << pacer.averageLateness() << " ms late\n";
+        std::cout << "Simulation: " << simulation.stepCount() << " steps at "
+                  << simulation.rate() << " Hz, " << simulation.averageStepTime()
+                  << " ms per step, " << simulation.droppedTime() << " s dropped\n";
+        if (profiler.inputLatency() >= 0.0) {
+            std::cout << "Input to photon latency: " << profiler.inputLatency() << " ms\n";
+        }
     }
 
     // Close the OpenGL window and terminate GLFW
-    glDeleteVertexArrays(1, &vertexArrayID);
-    glDeleteBuffers(1, &vertexBufferID);
-    glDeleteBuffers(1, &colorBufferID);
-    glDeleteBuffers(1, &indexBufferID);
+    glstate::deleteVertexArrays(1, &vertexArrayID);
+    gpumem::deleteBuffers(1, &vertexBufferID);
+    gpumem::deleteBuffers(1, &colorBufferID);
+    gpumem::deleteBuffers(1, &indexBufferID);
 
     glfwDestroyWindow(window);
     glfwTerminate();
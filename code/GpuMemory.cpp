@@ -0,0 +1,317 @@
+/*
+ * GPU memory accounting and budgets
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "GpuMemory.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <iomanip>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+constexpr int numCategories = static_cast<int>(gpumem::Category::Count);
+
+struct Record {
+    gpumem::Category category;
+    size_t bytes;
+};
+
+// The objects of one kind, by name
+using Records = std::unordered_map<GLuint, Record>;
+
+struct Accounts {
+    std::mutex mutex;
+    Records buffers;
+    Records textures;
+    Records renderbuffers;
+    size_t used[numCategories] = {};
+    size_t objects[numCategories] = {};
+    size_t budget[numCategories] = {};
+    size_t totalbudget = 0;
+};
+
+// Never destroyed, for the pools and caches that delete their objects at exit
+Accounts& accounts() {
+    static Accounts* instance = new Accounts();
+    return *instance;
+}
+
+void record(Records Accounts::*kind, GLuint name, gpumem::Category category, size_t bytes) {
+    if (name == 0) {
+        return;
+    }
+    Accounts& a = accounts();
+    std::lock_guard<std::mutex> lock(a.mutex);
+    Records& records = a.*kind;
+    auto found = records.find(name);
+    if (found != records.end()) {
+        a.used[static_cast<int>(found->second.category)] -= found->second.bytes;
+        a.objects[static_cast<int>(found->second.category)]--;
+        found->second = {category, bytes};
+    } else {
+        records.emplace(name, Record{category, bytes});
+    }
+    a.used[static_cast<int>(category)] += bytes;
+    a.objects[static_cast<int>(category)]++;
+}
+
+void forget(Records Accounts::*kind, GLsizei count, const GLuint* names) {
+    Accounts& a = accounts();
+    std::lock_guard<std::mutex> lock(a.mutex);
+    Records& records = a.*kind;
+    for (GLsizei i = 0; i < count; i++) {
+        auto found = records.find(names[i]);
+        if (found != records.end()) {
+            a.used[static_cast<int>(found->second.category)] -= found->second.bytes;
+            a.objects[static_cast<int>(found->second.category)]--;
+            records.erase(found);
+        }
+    }
+}
+
+// Bytes per texel of an uncompressed format, or bytes per 4x4 block of a compressed one
+size_t texelBytes(GLenum format, bool& compressed) {
+    compressed = false;
+    switch (format) {
+        case GL_R8:
+        case GL_R8UI:
+        case GL_STENCIL_INDEX8:
+            return 1;
+        case GL_RG8:
+        case GL_R16F:
+        case GL_R16UI:
+        case GL_DEPTH_COMPONENT16:
+            return 2;
+        case GL_RG16F:
+        case GL_RG16UI:
+        case GL_R32F:
+        case GL_R32UI:
+        case GL_RGB10_A2:
+        case GL_R11F_G11F_B10F:
+        case GL_DEPTH_COMPONENT24:
+        case GL_DEPTH_COMPONENT32F:
+        case GL_DEPTH24_STENCIL8:
+            return 4;
+        case GL_RGBA16F:
+        case GL_RGBA16UI:
+        case GL_RG32F:
+        case GL_RG32UI:
+        case GL_DEPTH32F_STENCIL8:
+            return 8;
+        case GL_RGB32F:
+            return 12;
+        case GL_RGBA32F:
+        case GL_RGBA32UI:
+            return 16;
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RED_RGTC1:
+        case GL_COMPRESSED_SIGNED_RED_RGTC1:
+        case GL_COMPRESSED_RGB8_ETC2:
+        case GL_COMPRESSED_SRGB8_ETC2:
+        case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+        case GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+            compressed = true;
+            return 8;
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_RG_RGTC2:
+        case GL_COMPRESSED_SIGNED_RG_RGTC2:
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+        case GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT:
+        case GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT:
+        case GL_COMPRESSED_RGBA8_ETC2_EAC:
+        case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+            compressed = true;
+            return 16;
+        default:  // GL_RGBA8, GL_SRGB8_ALPHA8, and GL_RGB8, which drivers pad to 4 bytes
+            return 4;
+    }
+}
+
+void printBytes(std::ostream& out, size_t bytes) {
+    out << std::fixed << std::setprecision(1) << double(bytes) / double(1 << 20) << " MB";
+}
+
+}  // namespace
+
+namespace gpumem {
+
+const char* categoryName(Category category) {
+    switch (category) {
+        case Category::Mesh:
+            return "meshes";
+        case Category::Texture:
+            return "textures";
+        case Category::RenderTarget:
+            return "render targets";
+        default:
+            return "buffers";
+    }
+}
+
+void setBuffer(GLuint buffer, Category category, size_t bytes) {
+    record(&Accounts::buffers, buffer, category, bytes);
+}
+
+void setTexture(GLuint texture, Category category, size_t bytes) {
+    record(&Accounts::textures, texture, category, bytes);
+}
+
+void setRenderbuffer(GLuint renderbuffer, Category category, size_t bytes) {
+    record(&Accounts::renderbuffers, renderbuffer, category, bytes);
+}
+
+void deleteBuffers(GLsizei count, const GLuint* buffers) {
+    glDeleteBuffers(count, buffers);
+    forget(&Accounts::buffers, count, buffers);
+}
+
+void deleteRenderbuffers(GLsizei count, const GLuint* renderbuffers) {
+    glDeleteRenderbuffers(count, renderbuffers);
+    forget(&Accounts::renderbuffers, count, renderbuffers);
+}
+
+void forgetTextures(GLsizei count, const GLuint* textures) {
+    forget(&Accounts::textures, count, textures);
+}
+
+size_t textureBytes(GLenum internalformat, int width, int height, int layers, int levels) {
+    bool compressed;
+    const size_t unit = texelBytes(internalformat, compressed);
+    size_t bytes = 0;
+    for (int level = 0; level < levels; level++) {
+        size_t w = static_cast<size_t>(std::max(width >> level, 1));
+        size_t h = static_cast<size_t>(std::max(height >> level, 1));
+        if (compressed) {
+            w = (w + 3) / 4;
+            h = (h + 3) / 4;
+        }
+        bytes += w * h * unit;
+    }
+    return bytes * static_cast<size_t>(std::max(layers, 1));
+}
+
+size_t usedBytes(Category category) {
+    Accounts& a = accounts();
+    std::lock_guard<std::mutex> lock(a.mutex);
+    return a.used[static_cast<int>(category)];
+}
+
+size_t objectCount(Category category) {
+    Accounts& a = accounts();
+    std::lock_guard<std::mutex> lock(a.mutex);
+    return a.objects[static_cast<int>(category)];
+}
+
+size_t totalBytes() {
+    Accounts& a = accounts();
+    std::lock_guard<std::mutex> lock(a.mutex);
+    size_t total = 0;
+    for (size_t bytes : a.used) {
+        total += bytes;
+    }
+    return total;
+}
+
+void setBudget(Category category, size_t bytes) {
+    Accounts& a = accounts();
+    std::lock_guard<std::mutex> lock(a.mutex);
+    a.budget[static_cast<int>(category)] = bytes;
+}
+
+void setTotalBudget(size_t bytes) {
+    Accounts& a = accounts();
+    std::lock_guard<std::mutex> lock(a.mutex);
+    a.totalbudget = bytes;
+}
+
+long long headroom(Category category) {
+    Accounts& a = accounts();
+    std::lock_guard<std::mutex> lock(a.mutex);
+    long long room = LLONG_MAX;
+    const int index = static_cast<int>(category);
+    if (a.budget[index] > 0) {
+        room = static_cast<long long>(a.budget[index]) - static_cast<long long>(a.used[index]);
+    }
+    if (a.totalbudget > 0) {
+        long long total = 0;
+        for (size_t bytes : a.used) {
+            total += static_cast<long long>(bytes);
+        }
+        room = std::min(room, static_cast<long long>(a.totalbudget) - total);
+    }
+    return room;
+}
+
+bool queryDevice(DeviceMemory& memory) {
+    memory = DeviceMemory();
+    GLint kilobytes[4] = {0, 0, 0, 0};
+    if (GLEW_NVX_gpu_memory_info) {
+        glGetIntegerv(GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX, &kilobytes[0]);
+        glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &kilobytes[1]);
+        memory.total = size_t(kilobytes[0]) << 10;
+        memory.available = size_t(kilobytes[1]) << 10;
+        memory.known = true;
+    } else if (GLEW_ATI_meminfo) {
+        // The free memory of the pool, the largest free block, and the same for auxiliary
+        // memory. AMD does not report the total.
+        glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, kilobytes);
+        memory.available = size_t(kilobytes[0]) << 10;
+        memory.known = true;
+    }
+    return memory.known;
+}
+
+void report(std::ostream& out) {
+    Accounts& a = accounts();
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    {
+        std::lock_guard<std::mutex> lock(a.mutex);
+        size_t total = 0;
+        for (int i = 0; i < numCategories; i++) {
+            out << "GPU memory of " << categoryName(static_cast<Category>(i)) << ": ";
+            printBytes(out, a.used[i]);
+            out << " in " << a.objects[i] << " objects";
+            if (a.budget[i] > 0) {
+                out << ", budget ";
+                printBytes(out, a.budget[i]);
+            }
+            out << "\n";
+            total += a.used[i];
+        }
+        out << "GPU memory in total: ";
+        printBytes(out, total);
+        if (a.totalbudget > 0) {
+            out << ", budget ";
+            printBytes(out, a.totalbudget);
+        }
+        out << "\n";
+    }
+    DeviceMemory device;
+    if (queryDevice(device)) {
+        out << "GPU memory available on the device: ";
+        printBytes(out, device.available);
+        if (device.total > 0) {
+            out << " of ";
+            printBytes(out, device.total);
+        }
+        out << "\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+}  // namespace gpumem
@@ -0,0 +1,77 @@
+/*
+ * Accounting of the GPU memory of all buffers, textures and renderbuffers, by category, with
+ * budgets for the systems that can give memory back.
+ *
+ * Usage: After the storage of a buffer, texture or renderbuffer is specified, record its size
+ *        with setBuffer(), setTexture() or setRenderbuffer(), which replace what was recorded
+ *        for the same name before. Delete buffers and renderbuffers with deleteBuffers() and
+ *        deleteRenderbuffers() here, and textures with glstate::deleteTextures(), which
+ *        forgets them here. The sizes are what the objects need, as textureBytes() estimates
+ *        them for textures, without the padding and the copies of the driver.
+ *        setBudget() limits a category and setTotalBudget() all of them, 0 for no limit.
+ *        Nothing is refused when a budget is exceeded: the streaming systems look at
+ *        headroom() and give memory back, ChunkedMesh by evicting chunk levels and
+ *        Texture by leaving out the largest mipmaps of the textures it loads.
+ *        queryDevice() asks the driver through GL_NVX_gpu_memory_info or GL_ATI_meminfo.
+ *        All functions may be called from any thread, for the objects of one share group.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstddef>
+#include <ostream>
+
+namespace gpumem {
+
+enum class Category { Mesh, Texture, RenderTarget, Buffer, Count };
+
+// "meshes", "textures", "render targets" or "buffers"
+const char* categoryName(Category category);
+
+void setBuffer(GLuint buffer, Category category, size_t bytes);
+void setTexture(GLuint texture, Category category, size_t bytes);
+void setRenderbuffer(GLuint renderbuffer, Category category, size_t bytes);
+
+// glDeleteBuffers() and glDeleteRenderbuffers(), which forget the objects
+void deleteBuffers(GLsizei count, const GLuint* buffers);
+void deleteRenderbuffers(GLsizei count, const GLuint* renderbuffers);
+
+// Forget textures that are deleted, for glstate::deleteTextures()
+void forgetTextures(GLsizei count, const GLuint* textures);
+
+/* Bytes of a texture of 'levels' mipmap levels from 'width' x 'height', with 'layers' layers
+ * of that size, in 'internalformat', which may be block compressed. Formats that are not
+ * known count as 4 bytes per texel. */
+size_t textureBytes(GLenum internalformat, int width, int height, int layers = 1,
+                    int levels = 1);
+
+// Bytes and objects recorded for a category, and the bytes of all categories
+size_t usedBytes(Category category);
+size_t objectCount(Category category);
+size_t totalBytes();
+
+// Limits in bytes, 0 for none
+void setBudget(Category category, size_t bytes);
+void setTotalBudget(size_t bytes);
+
+/* Bytes left before the budget of 'category' or the total budget is exceeded, whichever is
+ * less, and negative when one is. A large number when neither is set. */
+long long headroom(Category category);
+
+// Memory of the device as the driver reports it
+struct DeviceMemory {
+    size_t total = 0;      // Dedicated video memory, 0 if not reported
+    size_t available = 0;  // Free video memory, or free texture memory on AMD
+    bool known = false;    // False if neither extension is there
+};
+
+/* Ask the driver of the current context, false without GL_NVX_gpu_memory_info or
+ * GL_ATI_meminfo */
+bool queryDevice(DeviceMemory& memory);
+
+// Print the bytes of each category and the budgets to 'out'
+void report(std::ostream& out);
+
+}  // namespace gpumem
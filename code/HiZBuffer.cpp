@@ -0,0 +1,133 @@
+/*
+ * Hierarchical depth buffer built from the depth buffer with a max reduction
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "HiZBuffer.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+
+#include <algorithm>
+
+HiZBuffer::HiZBuffer()
+    : texture_(0), framebuffer_(0), vao_(0), levels_(0), width_(0), height_(0) {}
+
+HiZBuffer::~HiZBuffer() {
+    if (glIsTexture(texture_)) {
+        glstate::deleteTextures(1, &texture_);
+    }
+    if (glIsFramebuffer(framebuffer_)) {
+        glDeleteFramebuffers(1, &framebuffer_);
+    }
+    if (glIsVertexArray(vao_)) {
+        glstate::deleteVertexArrays(1, &vao_);
+    }
+}
+
+void HiZBuffer::resize(int width, int height) {
+    if (texture_ == 0) {
+        glGenTextures(1, &texture_);
+        glGenFramebuffers(1, &framebuffer_);
+        glGenVertexArrays(1, &vao_);
+    }
+    width_ = width;
+    height_ = height;
+    levels_ = 1;
+    while ((std::max(width, height) >> levels_) > 0) {
+        levels_++;
+    }
+    glstate::bindTexture(GL_TEXTURE_2D, texture_);
+    // Each level is half the size of the one below, rounded down, as for mipmaps
+    for (int level = 0; level < levels_; level++) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_DEPTH_COMPONENT24, std::max(width >> level, 1),
+                     std::max(height >> level, 1), 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    }
+    gpumem::setTexture(texture_, gpumem::Category::RenderTarget,
+                       gpumem::textureBytes(GL_DEPTH_COMPONENT24, width, height, 1, levels_));
+    // Read with texelFetch() only, so no filtering, and the depth values themselves
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_ - 1);
+
+    // Depth only
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+}
+
+void HiZBuffer::build() {
+    // The state changed below, to restore at the end
+    GLint viewport[4], drawframebuffer, readframebuffer, program, vao, activetexture, texture;
+    GLint depthfunc;
+    GLboolean depthtest, depthmask;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawframebuffer);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readframebuffer);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &activetexture);
+    glGetIntegerv(GL_DEPTH_FUNC, &depthfunc);
+    depthtest = glIsEnabled(GL_DEPTH_TEST);
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &depthmask);
+    glstate::activeTexture(GL_TEXTURE0);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+
+    if (viewport[2] != width_ || viewport[3] != height_) {
+        resize(viewport[2], viewport[3]);
+    }
+    if (shader_.id() == 0) {
+        shader_.createShader("vertex_fullscreen.glsl", "fragment_hiz.glsl");
+    }
+
+    // Level 0 is a copy of the depth buffer
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readframebuffer);
+    glstate::bindTexture(GL_TEXTURE_2D, texture_);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewport[0], viewport[1], width_, height_);
+
+    // Every other level is rendered from the one below. Limiting the texture to the level
+    // below while rendering to the next avoids a feedback loop.
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glstate::useProgram(shader_.id());
+    glstate::bindVertexArray(vao_);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
+    glDepthMask(GL_TRUE);
+    for (int level = 1; level < levels_; level++) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture_,
+                               level);
+        glViewport(0, 0, std::max(width_ >> level, 1), std::max(height_ >> level, 1));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_ - 1);
+
+    glstate::bindTexture(GL_TEXTURE_2D, texture);
+    glstate::activeTexture(activetexture);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawframebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readframebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glstate::useProgram(program);
+    glstate::bindVertexArray(vao);
+    glDepthFunc(depthfunc);
+    glDepthMask(depthmask);
+    if (!depthtest) {
+        glDisable(GL_DEPTH_TEST);
+    }
+}
+
+GLuint HiZBuffer::texture() const { return texture_; }
+
+int HiZBuffer::levels() const { return levels_; }
+
+int HiZBuffer::width() const { return width_; }
+
+int HiZBuffer::height() const { return height_; }
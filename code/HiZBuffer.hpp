@@ -0,0 +1,53 @@
+/*
+ * A hierarchical depth buffer (Hi-Z pyramid) for occlusion culling.
+ *
+ * Usage: Draw the occluders, then call build(). It copies the depth buffer of the bound read
+ *        framebuffer, in the current viewport, into level 0 of a depth texture. Every
+ *        further mipmap level holds the farthest depth of the texels it covers in the level
+ *        below, so one texel of a coarse level says whether a whole screen region is
+ *        covered by something nearer. MeshBatch::renderOcclusionCulled() tests object
+ *        bounds against it.
+ *        The shaders vertex_fullscreen.glsl and fragment_hiz.glsl are loaded on first use.
+ *        All GL state that build() changes is restored.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+
+#include "Shader.hpp"
+
+class HiZBuffer {
+public:
+    HiZBuffer();
+
+    /* Destructor: delete the texture, framebuffer and VAO */
+    ~HiZBuffer();
+
+    HiZBuffer(const HiZBuffer&) = delete;
+    HiZBuffer& operator=(const HiZBuffer&) = delete;
+
+    // Build the pyramid from the depth buffer in the current viewport
+    void build();
+
+    // The depth texture with all levels, GL_TEXTURE_2D
+    GLuint texture() const;
+
+    // Number of mipmap levels, and the size of level 0
+    int levels() const;
+    int width() const;
+    int height() const;
+
+private:
+    // Create the texture for a new viewport size
+    void resize(int width, int height);
+
+    GLuint texture_;      // Depth texture with the whole pyramid
+    GLuint framebuffer_;  // For rendering into one level at a time
+    GLuint vao_;          // Empty VAO for the full screen triangle
+    Shader shader_;       // Reduction of one level to the next
+    int levels_;
+    int width_;
+    int height_;
+};
@@ -0,0 +1,1590 @@
+/*
+ * Decoders of PNG and baseline JPEG files
+ *
+ * This code is in the public domain.
+ */
+#include "ImageDecoder.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Texture.hpp"
+#include "ThreadPool.hpp"
+
+#if !defined(TNM046_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define TNM046_DECODER_SSE2 1
+#include <emmintrin.h>
+#if defined(__SSSE3__) || defined(__AVX__)
+#define TNM046_DECODER_SSSE3 1
+#include <tmmintrin.h>
+#endif
+#elif !defined(TNM046_NO_SIMD) && (defined(__ARM_NEON) || defined(_M_ARM64))
+#define TNM046_DECODER_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const int maxSize = 1 << 16;  // Of each side of an image
+
+uint32_t readBE16(const uint8_t* bytes) { return uint32_t(bytes[0]) << 8 | bytes[1]; }
+
+uint32_t readBE32(const uint8_t* bytes) {
+    return uint32_t(bytes[0]) << 24 | uint32_t(bytes[1]) << 16 | uint32_t(bytes[2]) << 8 |
+           bytes[3];
+}
+
+// Run fn(begin, end) over [0, count) in chunks, in parallel if there is a pool
+void parallelRanges(ThreadPool* pool, int count, const std::function<void(int, int)>& fn) {
+    if (pool == nullptr || pool->size() <= 1 || count <= 1) {
+        fn(0, count);
+        return;
+    }
+    const int chunks = std::min(count, 4 * static_cast<int>(pool->size()));
+    pool->parallelFor(chunks, [&](int chunk) {
+        fn(static_cast<int>(int64_t(count) * chunk / chunks),
+           static_cast<int>(int64_t(count) * (chunk + 1) / chunks));
+    });
+}
+
+/*
+ * Inflating of zlib streams (RFC 1950 and 1951)
+ */
+
+// The bits of a DEFLATE stream, from the least significant bit of each byte
+class LSBReader {
+public:
+    LSBReader(const uint8_t* data, size_t size)
+        : next_(data), end_(data + size), bits_(0), count_(0), padding_(0) {}
+
+    uint32_t peek(int n) {
+        if (count_ < n) {
+            refill();
+        }
+        return uint32_t(bits_ & ((uint64_t(1) << n) - 1));
+    }
+
+    void consume(int n) {
+        bits_ >>= n;
+        count_ -= n;
+    }
+
+    uint32_t read(int n) {
+        const uint32_t value = peek(n);
+        consume(n);
+        return value;
+    }
+
+    void alignToByte() { consume(count_ & 7); }
+
+    // Copy 'n' bytes after alignToByte(), for stored blocks
+    bool copyBytes(uint8_t* out, size_t n) {
+        for (; n > 0 && count_ >= 8; n--) {
+            *out++ = uint8_t(read(8));
+        }
+        if (overrun() || size_t(end_ - next_) < n) {
+            return false;
+        }
+        std::memcpy(out, next_, n);
+        next_ += n;
+        return true;
+    }
+
+    // True if bits past the end of the data were used
+    bool overrun() const { return size_t(count_) < padding_ * 8; }
+
+private:
+    // Fill the buffer with whole bytes, and with zeros past the end
+    void refill() {
+        while (count_ <= 56) {
+            uint64_t byte = 0;
+            if (next_ < end_) {
+                byte = *next_++;
+            } else {
+                padding_++;
+            }
+            bits_ |= byte << count_;
+            count_ += 8;
+        }
+    }
+
+    const uint8_t* next_;
+    const uint8_t* end_;
+    uint64_t bits_;
+    int count_;       // Bits in 'bits_'
+    size_t padding_;  // Zero bytes added past the end
+};
+
+// A canonical Huffman code of DEFLATE, with a table for the codes of up to fastBits bits
+struct InflateHuffman {
+    static constexpr int fastBits = 10;
+
+    uint16_t fast[1 << fastBits];  // Symbol << 4 | length by the next bits, 0 if longer
+    uint16_t counts[16];           // Codes of each length
+    uint16_t symbols[288];         // Sorted by their codes
+
+    // False for over-subscribed codes. Incomplete codes are allowed, as DEFLATE does for a
+    // single distance code.
+    bool build(const uint8_t* lengths, int n) {
+        std::memset(counts, 0, sizeof(counts));
+        for (int i = 0; i < n; i++) {
+            counts[lengths[i]]++;
+        }
+        counts[0] = 0;
+        int left = 1;
+        for (int length = 1; length < 16; length++) {
+            left = 2 * left - counts[length];
+            if (left < 0) {
+                return false;
+            }
+        }
+        uint16_t offsets[16];
+        offsets[1] = 0;
+        for (int length = 1; length < 15; length++) {
+            offsets[length + 1] = uint16_t(offsets[length] + counts[length]);
+        }
+        for (int i = 0; i < n; i++) {
+            if (lengths[i] != 0) {
+                symbols[offsets[lengths[i]]++] = uint16_t(i);
+            }
+        }
+
+        // The codes are sent from their first bit, so the table is indexed by reversed codes
+        std::memset(fast, 0, sizeof(fast));
+        int code = 0;
+        int index = 0;
+        for (int length = 1; length <= fastBits; length++) {
+            for (int i = 0; i < counts[length]; i++, code++, index++) {
+                int reversed = 0;
+                for (int bit = 0; bit < length; bit++) {
+                    reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+                }
+                for (int j = reversed; j < (1 << fastBits); j += 1 << length) {
+                    fast[j] = uint16_t(symbols[index] << 4 | length);
+                }
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+
+    // The next symbol, or -1 for a code that is not in the table
+    int decode(LSBReader& reader) const {
+        const uint16_t entry = fast[reader.peek(fastBits)];
+        if (entry != 0) {
+            reader.consume(entry & 15);
+            return entry >> 4;
+        }
+        // Longer codes a bit at a time, from the first code of each length
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (int length = 1; length < 16; length++) {
+            code |= int(reader.read(1));
+            const int count = counts[length];
+            if (code - first < count) {
+                return symbols[index + code - first];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+};
+
+const uint16_t lengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t distanceBase[30] = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                   33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                   1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                   6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// The order of the lengths of the code length code
+const uint8_t codeLengthOrder[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                     11, 4,  12, 3, 13, 2, 14, 1, 15};
+
+// The codes of a block with dynamic Huffman codes
+bool readDynamicCodes(LSBReader& reader, InflateHuffman& literals, InflateHuffman& distances) {
+    const int literalcount = int(reader.read(5)) + 257;
+    const int distancecount = int(reader.read(5)) + 1;
+    const int lengthcount = int(reader.read(4)) + 4;
+    uint8_t codelengths[19] = {};
+    for (int i = 0; i < lengthcount; i++) {
+        codelengths[codeLengthOrder[i]] = uint8_t(reader.read(3));
+    }
+    InflateHuffman lengthcode;
+    if (!lengthcode.build(codelengths, 19)) {
+        return false;
+    }
+
+    uint8_t lengths[288 + 32] = {};
+    const int total = literalcount + distancecount;
+    for (int n = 0; n < total;) {
+        const int symbol = lengthcode.decode(reader);
+        if (symbol < 0) {
+            return false;
+        }
+        if (symbol < 16) {
+            lengths[n++] = uint8_t(symbol);
+            continue;
+        }
+        // Repeats of the last length or of zero
+        uint8_t value = 0;
+        int repeat;
+        if (symbol == 16) {
+            if (n == 0) {
+                return false;
+            }
+            value = lengths[n - 1];
+            repeat = 3 + int(reader.read(2));
+        } else if (symbol == 17) {
+            repeat = 3 + int(reader.read(3));
+        } else {
+            repeat = 11 + int(reader.read(7));
+        }
+        if (n + repeat > total) {
+            return false;
+        }
+        std::memset(lengths + n, value, size_t(repeat));
+        n += repeat;
+    }
+    if (lengths[256] == 0) {
+        return false;  // No end of block
+    }
+    return literals.build(lengths, literalcount) &&
+           distances.build(lengths + literalcount, distancecount);
+}
+
+// The codes of a block with the fixed Huffman codes
+void fixedCodes(InflateHuffman& literals, InflateHuffman& distances) {
+    uint8_t lengths[288];
+    std::memset(lengths, 8, 144);
+    std::memset(lengths + 144, 9, 112);
+    std::memset(lengths + 256, 7, 24);
+    std::memset(lengths + 280, 8, 8);
+    literals.build(lengths, 288);
+    std::memset(lengths, 5, 30);
+    distances.build(lengths, 30);
+}
+
+// Inflate the zlib stream 'in' into exactly 'size' bytes at 'out'. The checksum at the end is
+// not checked.
+bool inflateZlib(const uint8_t* in, size_t insize, uint8_t* out, size_t size) {
+    if (insize < 2) {
+        return false;
+    }
+    const uint32_t method = in[0];
+    const uint32_t flags = in[1];
+    if ((method & 15) != 8 || (method << 8 | flags) % 31 != 0 || (flags & 0x20) != 0) {
+        return false;  // Not DEFLATE, or with a preset dictionary
+    }
+    LSBReader reader(in + 2, insize - 2);
+    uint8_t* next = out;
+    uint8_t* const end = out + size;
+    InflateHuffman literals;
+    InflateHuffman distances;
+    for (bool last = false; !last;) {
+        last = reader.read(1) != 0;
+        const uint32_t type = reader.read(2);
+        if (type == 0) {
+            reader.alignToByte();
+            const uint32_t length = reader.read(16);
+            if ((length ^ 0xffff) != reader.read(16) || size_t(end - next) < length ||
+                !reader.copyBytes(next, length)) {
+                return false;
+            }
+            next += length;
+            continue;
+        } else if (type == 1) {
+            fixedCodes(literals, distances);
+        } else if (type != 2 || !readDynamicCodes(reader, literals, distances)) {
+            return false;
+        }
+
+        for (;;) {
+            int symbol = literals.decode(reader);
+            if (symbol < 256) {
+                if (symbol < 0 || next == end) {
+                    return false;
+                }
+                *next++ = uint8_t(symbol);
+                continue;
+            }
+            if (symbol == 256) {
+                break;
+            }
+            symbol -= 257;
+            if (symbol >= 29) {
+                return false;
+            }
+            const size_t length = lengthBase[symbol] + reader.read(lengthExtra[symbol]);
+            const int code = distances.decode(reader);
+            if (code < 0 || code >= 30) {
+                return false;
+            }
+            const size_t distance = distanceBase[code] + reader.read(distanceExtra[code]);
+            if (distance > size_t(next - out) || length > size_t(end - next)) {
+                return false;
+            }
+            // Matches may overlap the bytes they write
+            const uint8_t* from = next - distance;
+            if (distance >= length) {
+                std::memcpy(next, from, length);
+            } else if (distance == 1) {
+                std::memset(next, *from, length);
+            } else {
+                for (size_t i = 0; i < length; i++) {
+                    next[i] = from[i];
+                }
+            }
+            next += length;
+        }
+        if (reader.overrun()) {
+            return false;
+        }
+    }
+    return next == end;
+}
+
+/*
+ * PNG
+ */
+
+const uint8_t pngSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+struct PNGImage {
+    int width = 0;
+    int height = 0;
+    int depth = 0;      // Bits per sample
+    int colortype = 0;  // 0 gray, 2 RGB, 3 palette, 4 gray and alpha, 6 RGBA
+    bool alpha = false;
+    uint8_t palette[256 * 4];  // BGRA
+    std::vector<std::pair<const uint8_t*, size_t>> data;  // Of the IDAT chunks
+};
+
+int pngSamples(int colortype) {
+    switch (colortype) {
+        case 2:
+            return 3;
+        case 4:
+            return 2;
+        case 6:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+bool validPNGDepth(int colortype, int depth) {
+    switch (colortype) {
+        case 0:
+            return depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16;
+        case 3:
+            return depth == 1 || depth == 2 || depth == 4 || depth == 8;
+        case 2:
+        case 4:
+        case 6:
+            return depth == 8 || depth == 16;
+        default:
+            return false;
+    }
+}
+
+// Read the chunks of a PNG file. The data of the image is not read.
+bool parsePNG(const std::string& filename, const uint8_t* bytes, size_t size, PNGImage& png) {
+    for (int i = 0; i < 256; i++) {
+        std::memset(png.palette + 4 * i, 0, 3);
+        png.palette[4 * i + 3] = 255;
+    }
+    bool header = false;
+    size_t offset = sizeof(pngSignature);
+    while (offset + 12 <= size) {
+        const size_t length = readBE32(bytes + offset);
+        const uint8_t* type = bytes + offset + 4;
+        const uint8_t* data = bytes + offset + 8;
+        if (length > size - offset - 12) {
+            std::cerr << "Truncated PNG chunk ('" << filename << "')\n";
+            return false;
+        }
+        offset += 12 + length;
+        if (!header && std::memcmp(type, "IHDR", 4) != 0) {
+            std::cerr << "PNG file without header ('" << filename << "')\n";
+            return false;
+        }
+        if (std::memcmp(type, "IHDR", 4) == 0) {
+            if (length < 13) {
+                std::cerr << "Invalid PNG header ('" << filename << "')\n";
+                return false;
+            }
+            const uint32_t width = readBE32(data);
+            const uint32_t height = readBE32(data + 4);
+            png.depth = data[8];
+            png.colortype = data[9];
+            if (width == 0 || height == 0 || width > maxSize || height > maxSize) {
+                std::cerr << "Invalid image dimensions ('" << filename << "')\n";
+                return false;
+            }
+            png.width = int(width);
+            png.height = int(height);
+            if (!validPNGDepth(png.colortype, png.depth) || data[10] != 0 || data[11] != 0) {
+                std::cerr << "Unsupported PNG format (color type " << png.colortype << ", "
+                          << png.depth << " bits) ('" << filename << "')\n";
+                return false;
+            }
+            if (data[12] != 0) {
+                std::cerr << "Interlaced PNG files are not supported ('" << filename << "')\n";
+                return false;
+            }
+            header = true;
+        } else if (std::memcmp(type, "PLTE", 4) == 0) {
+            for (size_t i = 0; i < std::min<size_t>(length / 3, 256); i++) {
+                png.palette[4 * i + 0] = data[3 * i + 2];
+                png.palette[4 * i + 1] = data[3 * i + 1];
+                png.palette[4 * i + 2] = data[3 * i + 0];
+            }
+        } else if (std::memcmp(type, "tRNS", 4) == 0 && png.colortype == 3) {
+            // Alpha of the first palette entries. The color key of other types is ignored.
+            for (size_t i = 0; i < std::min<size_t>(length, 256); i++) {
+                png.palette[4 * i + 3] = data[i];
+            }
+            png.alpha = true;
+        } else if (std::memcmp(type, "IDAT", 4) == 0) {
+            png.data.emplace_back(data, length);
+        } else if (std::memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+    }
+    if (png.data.empty()) {
+        std::cerr << "PNG file without image data ('" << filename << "')\n";
+        return false;
+    }
+    return true;
+}
+
+uint8_t paeth(int a, int b, int c) {
+    const int pa = std::abs(b - c);
+    const int pb = std::abs(a - c);
+    const int pc = std::abs(a + b - 2 * c);
+    return uint8_t((pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c);
+}
+
+// The filters of 3 and 4 byte pixels, which depend on the pixel to the left, a pixel at a
+// time, and Up 16 bytes at a time. Each returns the bytes done.
+#if defined(TNM046_DECODER_SSE2)
+template <size_t bpp>
+__m128i loadPixel(const uint8_t* p) {
+    int32_t value = 0;
+    std::memcpy(&value, p, bpp);
+    return _mm_cvtsi32_si128(value);
+}
+
+template <size_t bpp>
+void storePixel(uint8_t* p, __m128i pixel) {
+    const int32_t value = _mm_cvtsi128_si32(pixel);
+    std::memcpy(p, &value, bpp);
+}
+
+__m128i choose(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+__m128i abs16(__m128i x) { return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x)); }
+
+template <size_t bpp>
+size_t unfilterSub(uint8_t* row, size_t size) {
+    __m128i a = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + bpp <= size; i += bpp) {
+        a = _mm_add_epi8(a, loadPixel<bpp>(row + i));
+        storePixel<bpp>(row + i, a);
+    }
+    return i;
+}
+
+template <size_t bpp>
+size_t unfilterAverage(uint8_t* row, const uint8_t* prior, size_t size) {
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i a = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + bpp <= size; i += bpp) {
+        // _mm_avg_epu8() rounds up, the filter rounds down
+        const __m128i b = loadPixel<bpp>(prior + i);
+        const __m128i average =
+            _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        a = _mm_add_epi8(loadPixel<bpp>(row + i), average);
+        storePixel<bpp>(row + i, a);
+    }
+    return i;
+}
+
+template <size_t bpp>
+size_t unfilterPaeth(uint8_t* row, const uint8_t* prior, size_t size) {
+    // The left, above and upper left pixels in 16 bit lanes
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = zero;
+    __m128i c = zero;
+    size_t i = 0;
+    for (; i + bpp <= size; i += bpp) {
+        const __m128i b = _mm_unpacklo_epi8(loadPixel<bpp>(prior + i), zero);
+        __m128i pa = _mm_sub_epi16(b, c);
+        __m128i pb = _mm_sub_epi16(a, c);
+        __m128i pc = _mm_add_epi16(pa, pb);
+        pa = abs16(pa);
+        pb = abs16(pb);
+        pc = abs16(pc);
+        const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+        const __m128i nearest = choose(_mm_cmpeq_epi16(smallest, pa), a,
+                                       choose(_mm_cmpeq_epi16(smallest, pb), b, c));
+        // The bytes wrap around, and the high bytes of the lanes stay zero
+        a = _mm_add_epi8(_mm_unpacklo_epi8(loadPixel<bpp>(row + i), zero), nearest);
+        storePixel<bpp>(row + i, _mm_packus_epi16(a, a));
+        c = b;
+    }
+    return i;
+}
+
+size_t unfilterUp(uint8_t* row, const uint8_t* prior, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i* p = reinterpret_cast<__m128i*>(row + i);
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i));
+        _mm_storeu_si128(p, _mm_add_epi8(_mm_loadu_si128(p), b));
+    }
+    return i;
+}
+#elif defined(TNM046_DECODER_NEON)
+template <size_t bpp>
+uint8x8_t loadPixel(const uint8_t* p) {
+    uint32_t value = 0;
+    std::memcpy(&value, p, bpp);
+    return vreinterpret_u8_u32(vdup_n_u32(value));
+}
+
+template <size_t bpp>
+void storePixel(uint8_t* p, uint8x8_t pixel) {
+    const uint32_t value = vget_lane_u32(vreinterpret_u32_u8(pixel), 0);
+    std::memcpy(p, &value, bpp);
+}
+
+int16x8_t widen(uint8x8_t x) { return vreinterpretq_s16_u16(vmovl_u8(x)); }
+
+template <size_t bpp>
+size_t unfilterSub(uint8_t* row, size_t size) {
+    uint8x8_t a = vdup_n_u8(0);
+    size_t i = 0;
+    for (; i + bpp <= size; i += bpp) {
+        a = vadd_u8(a, loadPixel<bpp>(row + i));
+        storePixel<bpp>(row + i, a);
+    }
+    return i;
+}
+
+template <size_t bpp>
+size_t unfilterAverage(uint8_t* row, const uint8_t* prior, size_t size) {
+    uint8x8_t a = vdup_n_u8(0);
+    size_t i = 0;
+    for (; i + bpp <= size; i += bpp) {
+        a = vadd_u8(loadPixel<bpp>(row + i), vhadd_u8(a, loadPixel<bpp>(prior + i)));
+        storePixel<bpp>(row + i, a);
+    }
+    return i;
+}
+
+template <size_t bpp>
+size_t unfilterPaeth(uint8_t* row, const uint8_t* prior, size_t size) {
+    // The left, above and upper left pixels in 16 bit lanes
+    int16x8_t a = vdupq_n_s16(0);
+    int16x8_t c = a;
+    size_t i = 0;
+    for (; i + bpp <= size; i += bpp) {
+        const int16x8_t b = widen(loadPixel<bpp>(prior + i));
+        const int16x8_t pa = vabsq_s16(vsubq_s16(b, c));
+        const int16x8_t pb = vabsq_s16(vsubq_s16(a, c));
+        const int16x8_t pc = vabsq_s16(vaddq_s16(vsubq_s16(b, c), vsubq_s16(a, c)));
+        const int16x8_t smallest = vminq_s16(pc, vminq_s16(pa, pb));
+        const int16x8_t nearest = vbslq_s16(vceqq_s16(smallest, pa), a,
+                                            vbslq_s16(vceqq_s16(smallest, pb), b, c));
+        const uint8x8_t pixel =
+            vadd_u8(loadPixel<bpp>(row + i), vmovn_u16(vreinterpretq_u16_s16(nearest)));
+        storePixel<bpp>(row + i, pixel);
+        a = widen(pixel);
+        c = b;
+    }
+    return i;
+}
+
+size_t unfilterUp(uint8_t* row, const uint8_t* prior, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        vst1q_u8(row + i, vaddq_u8(vld1q_u8(row + i), vld1q_u8(prior + i)));
+    }
+    return i;
+}
+#endif
+
+// Undo the filter of a row of 'size' bytes in place, with 'prior' the unfiltered row above
+// and 'bpp' bytes per pixel, or 1 for pixels of less than a byte. False for unknown filters.
+bool unfilterRow(int filter, uint8_t* row, const uint8_t* prior, size_t size, size_t bpp) {
+    size_t i = 0;
+    switch (filter) {
+        case 0:  // None
+            return true;
+        case 1:  // Sub
+#if defined(TNM046_DECODER_SSE2) || defined(TNM046_DECODER_NEON)
+            i = (bpp == 4) ? unfilterSub<4>(row, size) : (bpp == 3) ? unfilterSub<3>(row, size) : 0;
+#endif
+            for (i = std::max(i, bpp); i < size; i++) {
+                row[i] = uint8_t(row[i] + row[i - bpp]);
+            }
+            return true;
+        case 2:  // Up
+#if defined(TNM046_DECODER_SSE2) || defined(TNM046_DECODER_NEON)
+            i = unfilterUp(row, prior, size);
+#endif
+            for (; i < size; i++) {
+                row[i] = uint8_t(row[i] + prior[i]);
+            }
+            return true;
+        case 3:  // Average
+#if defined(TNM046_DECODER_SSE2) || defined(TNM046_DECODER_NEON)
+            i = (bpp == 4)   ? unfilterAverage<4>(row, prior, size)
+                : (bpp == 3) ? unfilterAverage<3>(row, prior, size)
+                             : 0;
+#endif
+            for (; i < std::min(bpp, size); i++) {
+                row[i] = uint8_t(row[i] + (prior[i] >> 1));
+            }
+            for (; i < size; i++) {
+                row[i] = uint8_t(row[i] + ((row[i - bpp] + prior[i]) >> 1));
+            }
+            return true;
+        case 4:  // Paeth
+#if defined(TNM046_DECODER_SSE2) || defined(TNM046_DECODER_NEON)
+            i = (bpp == 4)   ? unfilterPaeth<4>(row, prior, size)
+                : (bpp == 3) ? unfilterPaeth<3>(row, prior, size)
+                             : 0;
+#endif
+            for (; i < std::min(bpp, size); i++) {
+                row[i] = uint8_t(row[i] + prior[i]);
+            }
+            for (; i < size; i++) {
+                row[i] = uint8_t(row[i] + paeth(row[i - bpp], prior[i], prior[i - bpp]));
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Sample 'i' of a row of 'depth' bit samples, the high byte of 16 bit samples
+uint32_t pngSample(const uint8_t* row, size_t i, int depth) {
+    switch (depth) {
+        case 8:
+            return row[i];
+        case 16:
+            return row[2 * i];
+        default: {
+            const size_t bit = i * size_t(depth);
+            return (row[bit / 8] >> (8 - depth - int(bit % 8))) & ((1u << depth) - 1);
+        }
+    }
+}
+
+// Convert an unfiltered row to 'channels' bytes per pixel of BGR(A)
+void convertPNGRow(const PNGImage& png, const uint8_t* row, uint8_t* out, int channels) {
+    const int samples = pngSamples(png.colortype);
+    if (png.depth == 8 && (png.colortype == 2 || png.colortype == 6)) {
+        std::memcpy(out, row, size_t(png.width) * size_t(samples));
+        Texture::swapRedBlue(out, size_t(png.width), samples);
+        return;
+    }
+    const int depth = png.depth;
+    for (int x = 0; x < png.width; x++) {
+        uint8_t* pixel = out + size_t(x) * size_t(channels);
+        const size_t s = size_t(x) * size_t(samples);
+        switch (png.colortype) {
+            case 0:
+            case 4: {
+                uint32_t gray = pngSample(row, s, depth);
+                if (depth < 8) {
+                    gray *= 255 / ((1u << depth) - 1);
+                }
+                pixel[0] = pixel[1] = pixel[2] = uint8_t(gray);
+                if (png.colortype == 4) {
+                    pixel[3] = uint8_t(pngSample(row, s + 1, depth));
+                }
+                break;
+            }
+            case 2:
+            case 6:
+                pixel[0] = uint8_t(pngSample(row, s + 2, depth));
+                pixel[1] = uint8_t(pngSample(row, s + 1, depth));
+                pixel[2] = uint8_t(pngSample(row, s, depth));
+                if (png.colortype == 6) {
+                    pixel[3] = uint8_t(pngSample(row, s + 3, depth));
+                }
+                break;
+            default:
+                std::memcpy(pixel, png.palette + 4 * pngSample(row, s, depth), size_t(channels));
+                break;
+        }
+    }
+}
+
+/*
+ * JPEG (ITU T.81), baseline and extended sequential with Huffman coding
+ */
+
+// The coefficients of a block in the order of the file, as indices of the block
+const uint8_t zigzag[64] = {0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+                            12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+                            35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+                            58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+// The scale of each row and column of the AAN inverse DCT
+const float aanScale[8] = {1.0f,         1.387039845f, 1.306562965f, 1.175875602f,
+                           1.0f,         0.785694958f, 0.541196100f, 0.275899379f};
+
+// The bits of entropy coded data, from the most significant bit of each byte, without the
+// zero bytes stuffed after 0xff. The data must end before the next marker.
+class MSBReader {
+public:
+    MSBReader(const uint8_t* data, const uint8_t* end)
+        : next_(data), end_(end), bits_(0), count_(0) {}
+
+    // 1 to 16 bits
+    uint32_t peek(int n) {
+        if (count_ < n) {
+            refill();
+        }
+        return uint32_t(bits_ >> (64 - n));
+    }
+
+    void consume(int n) {
+        bits_ <<= n;
+        count_ -= n;
+    }
+
+    // A value of 's' bits, which are negative below 1 << (s - 1)
+    int receiveExtend(int s) {
+        if (s == 0) {
+            return 0;
+        }
+        const int value = int(peek(s));
+        consume(s);
+        return value < (1 << (s - 1)) ? value - (1 << s) + 1 : value;
+    }
+
+private:
+    void refill() {
+        while (count_ <= 56) {
+            uint64_t byte = 0;
+            if (next_ < end_) {
+                byte = *next_++;
+                if (byte == 0xff) {
+                    next_++;  // The stuffed zero
+                }
+            }
+            bits_ |= byte << (56 - count_);
+            count_ += 8;
+        }
+    }
+
+    const uint8_t* next_;
+    const uint8_t* end_;
+    uint64_t bits_;  // From the most significant bit
+    int count_;
+};
+
+// A Huffman table of JPEG, with a table for the codes of up to fastBits bits
+struct JPEGHuffman {
+    static constexpr int fastBits = 9;
+
+    // Empty until build(), so that a table that the file does not define decodes nothing
+    uint8_t fastlength[1 << fastBits] = {};  // Of the code by the next bits, 0 if longer
+    uint8_t fastsymbol[1 << fastBits] = {};
+    int32_t maxcode[17] = {};  // The codes of each length are below this
+    int32_t offset[17] = {};   // From the codes of each length to their symbols
+    uint8_t symbols[256] = {};
+
+    bool build(const uint8_t* counts, const uint8_t* values, int total) {
+        std::memset(fastlength, 0, sizeof(fastlength));
+        std::memcpy(symbols, values, size_t(total));
+        int32_t code = 0;
+        int index = 0;
+        for (int length = 1; length <= 16; length++) {
+            offset[length] = index - code;
+            for (int i = 0; i < counts[length - 1]; i++, code++, index++) {
+                if (length <= fastBits) {
+                    const int first = code << (fastBits - length);
+                    for (int j = 0; j < (1 << (fastBits - length)); j++) {
+                        fastlength[first + j] = uint8_t(length);
+                        fastsymbol[first + j] = values[index];
+                    }
+                }
+            }
+            maxcode[length] = code;
+            if (code > (1 << length)) {
+                return false;
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+
+    // The next symbol, or -1 for a code that is not in the table
+    int decode(MSBReader& reader) const {
+        const uint32_t bits = reader.peek(16);
+        const uint32_t index = bits >> (16 - fastBits);
+        if (fastlength[index] != 0) {
+            reader.consume(fastlength[index]);
+            return fastsymbol[index];
+        }
+        for (int length = fastBits + 1; length <= 16; length++) {
+            const int32_t code = int32_t(bits >> (16 - length));
+            if (code < maxcode[length]) {
+                reader.consume(length);
+                return symbols[code + offset[length]];
+            }
+        }
+        return -1;
+    }
+};
+
+struct JPEGComponent {
+    int id = 0;
+    int h = 1;  // Sampling factors
+    int v = 1;
+    int quant = 0;  // Tables
+    int dctable = 0;
+    int actable = 0;
+    size_t stride = 0;  // Of its plane, whole blocks of whole MCUs
+    size_t rows = 0;
+};
+
+struct JPEGImage {
+    int width = 0;
+    int height = 0;
+    int count = 0;  // Components
+    JPEGComponent components[3];
+    int hmax = 1;
+    int vmax = 1;
+    int mcusx = 0;  // MCUs in a row and in a column
+    int mcusy = 0;
+    bool rgb = false;  // Components that are RGB, not YCbCr
+    int adobetransform = -1;
+    uint16_t quant[4][64] = {};  // In the order of the file
+    JPEGHuffman dc[4];
+    JPEGHuffman ac[4];
+    int restart = 0;  // MCUs per restart interval, 0 without restart markers
+    const uint8_t* scan = nullptr;  // The entropy coded data of the scan
+    const uint8_t* end = nullptr;
+};
+
+// Read the frame header, the tables of the first scan and its header. With 'headeronly',
+// stop after the frame header.
+bool parseJPEG(const std::string& filename, const uint8_t* bytes, size_t size, JPEGImage& jpeg,
+               bool headeronly) {
+    bool frame = false;
+    size_t offset = 2;
+    for (;;) {
+        if (offset >= size || bytes[offset] != 0xff) {
+            std::cerr << "Corrupt JPEG file ('" << filename << "')\n";
+            return false;
+        }
+        while (offset < size && bytes[offset] == 0xff) {
+            offset++;  // Fill bytes
+        }
+        if (offset >= size) {
+            std::cerr << "Corrupt JPEG file ('" << filename << "')\n";
+            return false;
+        }
+        const int marker = bytes[offset++];
+        if (marker == 0xd8 || marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7)) {
+            continue;  // Without a length
+        }
+        if (marker == 0xd9 || offset + 2 > size) {
+            std::cerr << "JPEG file without image data ('" << filename << "')\n";
+            return false;
+        }
+        const size_t length = readBE16(bytes + offset);
+        if (length < 2 || length > size - offset) {
+            std::cerr << "Truncated JPEG segment ('" << filename << "')\n";
+            return false;
+        }
+        const uint8_t* data = bytes + offset + 2;
+        const size_t n = length - 2;
+        offset += length;
+
+        if (marker == 0xc0 || marker == 0xc1) {
+            if (n < 6 || data[0] != 8) {
+                std::cerr << "Unsupported JPEG precision ('" << filename << "')\n";
+                return false;
+            }
+            jpeg.height = int(readBE16(data + 1));
+            jpeg.width = int(readBE16(data + 3));
+            jpeg.count = data[5];
+            if (jpeg.width == 0 || jpeg.height == 0) {
+                std::cerr << "Invalid image dimensions ('" << filename << "')\n";
+                return false;
+            }
+            if ((jpeg.count != 1 && jpeg.count != 3) || n < 6 + 3 * size_t(jpeg.count)) {
+                std::cerr << "Unsupported number of JPEG components (" << jpeg.count << ") ('"
+                          << filename << "')\n";
+                return false;
+            }
+            jpeg.hmax = jpeg.vmax = 1;
+            for (int c = 0; c < jpeg.count; c++) {
+                JPEGComponent& component = jpeg.components[c];
+                component.id = data[6 + 3 * c];
+                component.h = data[7 + 3 * c] >> 4;
+                component.v = data[7 + 3 * c] & 15;
+                component.quant = data[8 + 3 * c];
+                if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4 ||
+                    component.quant > 3) {
+                    std::cerr << "Corrupt JPEG frame header ('" << filename << "')\n";
+                    return false;
+                }
+                if (jpeg.count == 1) {
+                    component.h = component.v = 1;  // A scan of one component has no MCUs
+                }
+                jpeg.hmax = std::max(jpeg.hmax, component.h);
+                jpeg.vmax = std::max(jpeg.vmax, component.v);
+            }
+            jpeg.mcusx = (jpeg.width + 8 * jpeg.hmax - 1) / (8 * jpeg.hmax);
+            jpeg.mcusy = (jpeg.height + 8 * jpeg.vmax - 1) / (8 * jpeg.vmax);
+            for (int c = 0; c < jpeg.count; c++) {
+                JPEGComponent& component = jpeg.components[c];
+                component.stride = size_t(jpeg.mcusx) * size_t(component.h) * 8;
+                component.rows = size_t(jpeg.mcusy) * size_t(component.v) * 8;
+            }
+            frame = true;
+            if (headeronly) {
+                return true;
+            }
+        } else if (marker >= 0xc2 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 &&
+                   marker != 0xcc) {
+            std::cerr << "Progressive, arithmetic coded and lossless JPEG files are not "
+                         "supported ('"
+                      << filename << "')\n";
+            return false;
+        } else if (marker == 0xc4) {
+            for (size_t i = 0; i < n;) {
+                if (n - i < 17) {
+                    std::cerr << "Corrupt JPEG Huffman table ('" << filename << "')\n";
+                    return false;
+                }
+                const int table = data[i] & 15;
+                const bool ac = (data[i] >> 4) != 0;
+                const uint8_t* counts = data + i + 1;
+                int total = 0;
+                for (int length = 0; length < 16; length++) {
+                    total += counts[length];
+                }
+                JPEGHuffman& huffman = ac ? jpeg.ac[table & 3] : jpeg.dc[table & 3];
+                if (table > 3 || total > 256 || n - i - 17 < size_t(total) ||
+                    !huffman.build(counts, data + i + 17, total)) {
+                    std::cerr << "Corrupt JPEG Huffman table ('" << filename << "')\n";
+                    return false;
+                }
+                i += 17 + size_t(total);
+            }
+        } else if (marker == 0xdb) {
+            for (size_t i = 0; i < n;) {
+                const bool wide = (data[i] >> 4) != 0;  // 16 bit values
+                const int table = data[i] & 15;
+                if (table > 3 || n - i < (wide ? 129u : 65u)) {
+                    std::cerr << "Corrupt JPEG quantization table ('" << filename << "')\n";
+                    return false;
+                }
+                for (int k = 0; k < 64; k++) {
+                    jpeg.quant[table][k] = uint16_t(wide ? readBE16(data + i + 1 + 2 * k)
+                                                         : data[i + 1 + k]);
+                }
+                i += wide ? 129 : 65;
+            }
+        } else if (marker == 0xdd) {
+            if (n < 2) {
+                std::cerr << "Corrupt JPEG restart interval ('" << filename << "')\n";
+                return false;
+            }
+            jpeg.restart = int(readBE16(data));
+        } else if (marker == 0xee) {
+            // Adobe, whose transform 0 means RGB
+            if (n >= 12 && std::memcmp(data, "Adobe", 5) == 0) {
+                jpeg.adobetransform = data[11];
+            }
+        } else if (marker == 0xda) {
+            if (!frame || n < 1 || data[0] != jpeg.count || n < 4 + 2 * size_t(jpeg.count)) {
+                std::cerr << "JPEG files with more than one scan are not supported ('"
+                          << filename << "')\n";
+                return false;
+            }
+            for (int i = 0; i < jpeg.count; i++) {
+                JPEGComponent* component = nullptr;
+                for (int c = 0; c < jpeg.count; c++) {
+                    if (jpeg.components[c].id == data[1 + 2 * i]) {
+                        component = &jpeg.components[c];
+                    }
+                }
+                const int dctable = data[2 + 2 * i] >> 4;
+                const int actable = data[2 + 2 * i] & 15;
+                if (component == nullptr || dctable > 3 || actable > 3) {
+                    std::cerr << "Corrupt JPEG scan header ('" << filename << "')\n";
+                    return false;
+                }
+                component->dctable = dctable;
+                component->actable = actable;
+            }
+            const uint8_t* spectral = data + 1 + 2 * jpeg.count;
+            if (spectral[0] != 0 || spectral[1] != 63) {
+                std::cerr << "Corrupt JPEG scan header ('" << filename << "')\n";
+                return false;
+            }
+            jpeg.rgb = jpeg.count == 3 &&
+                       (jpeg.adobetransform == 0 ||
+                        (jpeg.components[0].id == 'R' && jpeg.components[1].id == 'G' &&
+                         jpeg.components[2].id == 'B'));
+            jpeg.scan = bytes + offset;
+            jpeg.end = bytes + size;
+            return true;
+        }
+    }
+}
+
+// The entropy coded data between two markers
+struct Segment {
+    const uint8_t* begin;
+    const uint8_t* end;
+};
+
+// Split a scan at its restart markers, up to the marker after it
+std::vector<Segment> splitScan(const uint8_t* scan, const uint8_t* end) {
+    std::vector<Segment> segments;
+    const uint8_t* begin = scan;
+    const uint8_t* next = scan;
+    for (;;) {
+        const uint8_t* ff =
+            static_cast<const uint8_t*>(std::memchr(next, 0xff, size_t(end - next)));
+        if (ff == nullptr || ff + 1 >= end) {
+            segments.push_back({begin, end});
+            return segments;
+        }
+        if (ff[1] == 0) {
+            next = ff + 2;  // A stuffed zero
+            continue;
+        }
+        const uint8_t* marker = ff + 1;
+        while (marker < end && *marker == 0xff) {
+            marker++;  // Fill bytes
+        }
+        segments.push_back({begin, ff});
+        if (marker == end || *marker < 0xd0 || *marker > 0xd7) {
+            return segments;
+        }
+        begin = next = marker + 1;
+    }
+}
+
+// The inverse DCT of jidctflt.c of the IJG, on vectors of four columns
+#if defined(TNM046_DECODER_SSE2)
+struct Vec4 {
+    __m128 v;
+};
+
+Vec4 operator+(Vec4 a, Vec4 b) { return {_mm_add_ps(a.v, b.v)}; }
+Vec4 operator-(Vec4 a, Vec4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+Vec4 operator*(Vec4 a, float b) { return {_mm_mul_ps(a.v, _mm_set1_ps(b))}; }
+Vec4 load4(const float* p) { return {_mm_load_ps(p)}; }
+
+void transpose4(Vec4& a, Vec4& b, Vec4& c, Vec4& d) { _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v); }
+
+// Round the 8 samples in 'left' and 'right' to bytes, from -128 to 127 to 0 to 255
+void storeSamples(Vec4 left, Vec4 right, uint8_t* out) {
+    const __m128 bias = _mm_set1_ps(128.0f);
+    const __m128i words = _mm_packs_epi32(_mm_cvtps_epi32(_mm_add_ps(left.v, bias)),
+                                          _mm_cvtps_epi32(_mm_add_ps(right.v, bias)));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(words, words));
+}
+#elif defined(TNM046_DECODER_NEON)
+struct Vec4 {
+    float32x4_t v;
+};
+
+Vec4 operator+(Vec4 a, Vec4 b) { return {vaddq_f32(a.v, b.v)}; }
+Vec4 operator-(Vec4 a, Vec4 b) { return {vsubq_f32(a.v, b.v)}; }
+Vec4 operator*(Vec4 a, float b) { return {vmulq_n_f32(a.v, b)}; }
+Vec4 load4(const float* p) { return {vld1q_f32(p)}; }
+
+void transpose4(Vec4& a, Vec4& b, Vec4& c, Vec4& d) {
+    const float32x4x2_t ab = vtrnq_f32(a.v, b.v);
+    const float32x4x2_t cd = vtrnq_f32(c.v, d.v);
+    a.v = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    b.v = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    c.v = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    d.v = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+
+void storeSamples(Vec4 left, Vec4 right, uint8_t* out) {
+    // Truncated after adding 128.5, which rounds the samples that are not clamped to 0
+    const float32x4_t bias = vdupq_n_f32(128.5f);
+    const int16x8_t words = vcombine_s16(vqmovn_s32(vcvtq_s32_f32(vaddq_f32(left.v, bias))),
+                                         vqmovn_s32(vcvtq_s32_f32(vaddq_f32(right.v, bias))));
+    vst1_u8(out, vqmovun_s16(words));
+}
+#else
+struct Vec4 {
+    float v[4];
+};
+
+Vec4 operator+(Vec4 a, Vec4 b) {
+    return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+}
+
+Vec4 operator-(Vec4 a, Vec4 b) {
+    return {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}};
+}
+
+Vec4 operator*(Vec4 a, float b) { return {{a.v[0] * b, a.v[1] * b, a.v[2] * b, a.v[3] * b}}; }
+Vec4 load4(const float* p) { return {{p[0], p[1], p[2], p[3]}}; }
+
+void transpose4(Vec4& a, Vec4& b, Vec4& c, Vec4& d) {
+    std::swap(a.v[1], b.v[0]);
+    std::swap(a.v[2], c.v[0]);
+    std::swap(a.v[3], d.v[0]);
+    std::swap(b.v[2], c.v[1]);
+    std::swap(b.v[3], d.v[1]);
+    std::swap(c.v[3], d.v[2]);
+}
+
+void storeSamples(Vec4 left, Vec4 right, uint8_t* out) {
+    for (int i = 0; i < 8; i++) {
+        const float sample = (i < 4 ? left.v[i] : right.v[i - 4]) + 128.5f;
+        out[i] = uint8_t(std::min(std::max(sample, 0.0f), 255.0f));
+    }
+}
+#endif
+
+// One pass of the inverse DCT, from the frequencies in the eight vectors to samples
+void idctPass(Vec4 (&v)[8]) {
+    // Even part
+    Vec4 tmp10 = v[0] + v[4];
+    Vec4 tmp11 = v[0] - v[4];
+    const Vec4 tmp13 = v[2] + v[6];
+    Vec4 tmp12 = (v[2] - v[6]) * 1.414213562f - tmp13;
+    const Vec4 tmp0 = tmp10 + tmp13;
+    const Vec4 tmp3 = tmp10 - tmp13;
+    const Vec4 tmp1 = tmp11 + tmp12;
+    const Vec4 tmp2 = tmp11 - tmp12;
+
+    // Odd part
+    const Vec4 z13 = v[5] + v[3];
+    const Vec4 z10 = v[5] - v[3];
+    const Vec4 z11 = v[1] + v[7];
+    const Vec4 z12 = v[1] - v[7];
+    const Vec4 tmp7 = z11 + z13;
+    tmp11 = (z11 - z13) * 1.414213562f;
+    const Vec4 z5 = (z10 + z12) * 1.847759065f;
+    tmp10 = z5 - z12 * 1.082392200f;
+    tmp12 = z5 - z10 * 2.613125930f;
+    const Vec4 tmp6 = tmp12 - tmp7;
+    const Vec4 tmp5 = tmp11 - tmp6;
+    const Vec4 tmp4 = tmp10 - tmp5;
+
+    v[0] = tmp0 + tmp7;
+    v[7] = tmp0 - tmp7;
+    v[1] = tmp1 + tmp6;
+    v[6] = tmp1 - tmp6;
+    v[2] = tmp2 + tmp5;
+    v[5] = tmp2 - tmp5;
+    v[3] = tmp3 + tmp4;
+    v[4] = tmp3 - tmp4;
+}
+
+// The samples of a block of dequantized coefficients, transposed so that each row holds the
+// vertical frequencies of one horizontal frequency, into rows of 'stride' bytes
+void inverseDCT(const float* block, uint8_t* out, size_t stride) {
+    Vec4 left[8];  // Lanes 0 to 3 and 4 to 7 of each row
+    Vec4 right[8];
+    for (int r = 0; r < 8; r++) {
+        left[r] = load4(block + 8 * r);
+        right[r] = load4(block + 8 * r + 4);
+    }
+    // Horizontally, then transposed, vertically
+    idctPass(left);
+    idctPass(right);
+    transpose4(left[0], left[1], left[2], left[3]);
+    transpose4(right[4], right[5], right[6], right[7]);
+    transpose4(right[0], right[1], right[2], right[3]);
+    transpose4(left[4], left[5], left[6], left[7]);
+    for (int r = 0; r < 4; r++) {
+        std::swap(right[r], left[r + 4]);
+    }
+    idctPass(left);
+    idctPass(right);
+    for (int r = 0; r < 8; r++) {
+        storeSamples(left[r], right[r], out + size_t(r) * stride);
+    }
+}
+
+// The dequantization of each coefficient in the order of the file, scaled for idctPass()
+// and by 1/8 for its two passes, and its index in the transposed block
+struct Dequantization {
+    float scale[4][64];
+    uint8_t index[64];
+
+    explicit Dequantization(const JPEGImage& jpeg) {
+        for (int k = 0; k < 64; k++) {
+            const int row = zigzag[k] / 8;
+            const int column = zigzag[k] % 8;
+            index[k] = uint8_t(column * 8 + row);
+            for (int t = 0; t < 4; t++) {
+                scale[t][k] = float(jpeg.quant[t][k]) * aanScale[row] * aanScale[column] / 8.0f;
+            }
+        }
+    }
+};
+
+// Decode a block into 'block', with 'dc' the DC of the last block of its component
+bool decodeBlock(MSBReader& reader, const JPEGHuffman& dctable, const JPEGHuffman& actable,
+                 const float* scale, const uint8_t* index, int& dc, float* block) {
+    std::memset(block, 0, 64 * sizeof(float));
+    const int size = dctable.decode(reader);
+    if (size < 0 || size > 11) {
+        return false;
+    }
+    dc += reader.receiveExtend(size);
+    block[0] = float(dc) * scale[0];
+    for (int k = 1; k < 64;) {
+        const int symbol = actable.decode(reader);
+        if (symbol < 0) {
+            return false;
+        }
+        const int run = symbol >> 4;
+        const int bits = symbol & 15;
+        if (bits == 0) {
+            if (run != 15) {
+                break;  // End of block
+            }
+            k += 16;
+            continue;
+        }
+        k += run;
+        if (k > 63) {
+            return false;
+        }
+        block[index[k]] = float(reader.receiveExtend(bits)) * scale[k];
+        k++;
+    }
+    return true;
+}
+
+// Decode the MCUs [first, last) of one restart interval into the planes of the components
+bool decodeMCUs(const JPEGImage& jpeg, const Dequantization& dequantization,
+                const Segment& segment, int first, int last, uint8_t* const* planes) {
+    MSBReader reader(segment.begin, segment.end);
+    int dc[3] = {0, 0, 0};
+    alignas(16) float block[64];
+    for (int mcu = first; mcu < last; mcu++) {
+        const int mcux = mcu % jpeg.mcusx;
+        const int mcuy = mcu / jpeg.mcusx;
+        for (int c = 0; c < jpeg.count; c++) {
+            const JPEGComponent& component = jpeg.components[c];
+            for (int by = 0; by < component.v; by++) {
+                for (int bx = 0; bx < component.h; bx++) {
+                    if (!decodeBlock(reader, jpeg.dc[component.dctable],
+                                     jpeg.ac[component.actable],
+                                     dequantization.scale[component.quant],
+                                     dequantization.index, dc[c], block)) {
+                        return false;
+                    }
+                    const size_t x = size_t(mcux * component.h + bx) * 8;
+                    const size_t y = size_t(mcuy * component.v + by) * 8;
+                    inverseDCT(block, planes[c] + y * component.stride + x, component.stride);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// A row of 'width' samples from a row of chroma with 'h' samples to the 'hmax' of luma,
+// each repeated. Uses 'scratch' of width + 32 bytes unless the row is used as it is.
+const uint8_t* upsampleRow(const uint8_t* row, int h, int hmax, int width, uint8_t* scratch) {
+    if (h == hmax) {
+        return row;
+    }
+    int x = 0;
+    if (hmax == 2 * h) {
+        const int samples = (width + 1) / 2;
+        int i = 0;
+#if defined(TNM046_DECODER_SSE2)
+        for (; i + 16 <= samples; i += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(scratch + 2 * i), _mm_unpacklo_epi8(v, v));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(scratch + 2 * i + 16),
+                             _mm_unpackhi_epi8(v, v));
+        }
+#elif defined(TNM046_DECODER_NEON)
+        for (; i + 16 <= samples; i += 16) {
+            const uint8x16_t v = vld1q_u8(row + i);
+            vst2q_u8(scratch + 2 * i, uint8x16x2_t{{v, v}});
+        }
+#endif
+        x = 2 * i;
+    }
+    for (; x < width; x++) {
+        scratch[x] = row[x * h / hmax];
+    }
+    return scratch;
+}
+
+// YCbCr to BGR in 16 bit fixed point, with the factors of JFIF times 1 << 14
+const int16_t crToRed = 22970;     // 1.402
+const int16_t cbToGreen = 5638;    // 0.344136
+const int16_t crToGreen = 11700;   // 0.714136
+const int16_t cbToBlue = 29032;    // 1.772
+
+uint8_t clampByte(int value) { return uint8_t(std::min(std::max(value, 0), 255)); }
+
+void convertYCbCrRow(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint8_t* out,
+                     int width) {
+    int x = 0;
+#if defined(TNM046_DECODER_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i center = _mm_set1_epi16(128);
+    const __m128i alpha = _mm_set1_epi8(-1);
+    // Four pixels at a time of BGRA to BGR, the last four bytes of each store are overwritten
+#if defined(TNM046_DECODER_SSSE3)
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const int end = width - 10;
+#else
+    const int end = width - 8;
+#endif
+    for (; x <= end; x += 8) {
+        const __m128i luma =
+            _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + x)), zero);
+        // Times 4, so that the high half of the product is in whole units
+        const __m128i blue = _mm_slli_epi16(
+            _mm_sub_epi16(
+                _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(cb + x)), zero),
+                center),
+            2);
+        const __m128i red = _mm_slli_epi16(
+            _mm_sub_epi16(
+                _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(cr + x)), zero),
+                center),
+            2);
+        const __m128i r = _mm_add_epi16(luma, _mm_mulhi_epi16(red, _mm_set1_epi16(crToRed)));
+        const __m128i g =
+            _mm_sub_epi16(_mm_sub_epi16(luma, _mm_mulhi_epi16(blue, _mm_set1_epi16(cbToGreen))),
+                          _mm_mulhi_epi16(red, _mm_set1_epi16(crToGreen)));
+        const __m128i b = _mm_add_epi16(luma, _mm_mulhi_epi16(blue, _mm_set1_epi16(cbToBlue)));
+        const __m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_packus_epi16(g, g));
+        const __m128i ra = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), alpha);
+        const __m128i low = _mm_unpacklo_epi16(bg, ra);
+        const __m128i high = _mm_unpackhi_epi16(bg, ra);
+#if defined(TNM046_DECODER_SSSE3)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 3 * x), _mm_shuffle_epi8(low, pack));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 3 * x + 12),
+                         _mm_shuffle_epi8(high, pack));
+#else
+        alignas(16) uint8_t bgra[32];
+        _mm_store_si128(reinterpret_cast<__m128i*>(bgra), low);
+        _mm_store_si128(reinterpret_cast<__m128i*>(bgra + 16), high);
+        for (int i = 0; i < 8; i++) {
+            std::memcpy(out + 3 * (x + i), bgra + 4 * i, 3);
+        }
+#endif
+    }
+#elif defined(TNM046_DECODER_NEON)
+    const int16x8_t center = vdupq_n_s16(128);
+    for (; x + 8 <= width; x += 8) {
+        const int16x8_t luma = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y + x)));
+        // Times 2, for the doubling high half of vqrdmulhq
+        const int16x8_t blue = vshlq_n_s16(
+            vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cb + x))), center), 1);
+        const int16x8_t red = vshlq_n_s16(
+            vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(cr + x))), center), 1);
+        uint8x8x3_t bgr;
+        bgr.val[0] = vqmovun_s16(vaddq_s16(luma, vqrdmulhq_n_s16(blue, cbToBlue)));
+        bgr.val[1] = vqmovun_s16(vsubq_s16(vsubq_s16(luma, vqrdmulhq_n_s16(blue, cbToGreen)),
+                                           vqrdmulhq_n_s16(red, crToGreen)));
+        bgr.val[2] = vqmovun_s16(vaddq_s16(luma, vqrdmulhq_n_s16(red, crToRed)));
+        vst3_u8(out + 3 * x, bgr);
+    }
+#endif
+    for (; x < width; x++) {
+        const int blue = (cb[x] - 128) * 4;
+        const int red = (cr[x] - 128) * 4;
+        out[3 * x + 0] = clampByte(y[x] + ((blue * cbToBlue) >> 16));
+        out[3 * x + 1] = clampByte(y[x] - ((blue * cbToGreen) >> 16) - ((red * crToGreen) >> 16));
+        out[3 * x + 2] = clampByte(y[x] + ((red * crToRed) >> 16));
+    }
+}
+
+}  // namespace
+
+namespace imagedecoder {
+
+bool isPNG(const GLubyte* bytes, size_t size) {
+    return size >= sizeof(pngSignature) &&
+           std::memcmp(bytes, pngSignature, sizeof(pngSignature)) == 0;
+}
+
+bool isJPEG(const GLubyte* bytes, size_t size) {
+    return size >= 3 && bytes[0] == 0xff && bytes[1] == 0xd8 && bytes[2] == 0xff;
+}
+
+bool readPNGInfo(const std::string& filename, const GLubyte* bytes, size_t size, Info& info) {
+    PNGImage png;
+    if (!parsePNG(filename, bytes, size, png)) {
+        return false;
+    }
+    info.width = png.width;
+    info.height = png.height;
+    info.channels = (png.colortype == 4 || png.colortype == 6 || png.alpha) ? 4 : 3;
+    return true;
+}
+
+bool readJPEGInfo(const std::string& filename, const GLubyte* bytes, size_t size, Info& info) {
+    JPEGImage jpeg;
+    if (!parseJPEG(filename, bytes, size, jpeg, true)) {
+        return false;
+    }
+    info.width = jpeg.width;
+    info.height = jpeg.height;
+    info.channels = 3;
+    return true;
+}
+
+bool decodePNG(const std::string& filename, const GLubyte* bytes, size_t size,
+               const Info& info, GLubyte* pixels) {
+    PNGImage png;
+    if (!parsePNG(filename, bytes, size, png)) {
+        return false;
+    }
+    const size_t bitsperpixel = size_t(pngSamples(png.colortype)) * size_t(png.depth);
+    const size_t rowbytes = (size_t(png.width) * bitsperpixel + 7) / 8;
+    const size_t bpp = std::max<size_t>(bitsperpixel / 8, 1);
+
+    // The zlib stream may be split over many IDAT chunks
+    const uint8_t* stream = png.data[0].first;
+    size_t streamsize = png.data[0].second;
+    std::vector<uint8_t> joined;
+    if (png.data.size() > 1) {
+        for (const std::pair<const uint8_t*, size_t>& chunk : png.data) {
+            joined.insert(joined.end(), chunk.first, chunk.first + chunk.second);
+        }
+        stream = joined.data();
+        streamsize = joined.size();
+    }
+    // Each row starts with the byte of its filter
+    const size_t inflatedsize = (rowbytes + 1) * size_t(png.height);
+    std::unique_ptr<uint8_t[]> inflated(new uint8_t[inflatedsize]);
+    if (!inflateZlib(stream, streamsize, inflated.get(), inflatedsize)) {
+        std::cerr << "Could not inflate PNG image data ('" << filename << "')\n";
+        return false;
+    }
+
+    // The rows are unfiltered from the top, and stored from the bottom
+    const std::vector<uint8_t> zeros(rowbytes, 0);
+    const uint8_t* prior = zeros.data();
+    const size_t outrow = size_t(png.width) * size_t(info.channels);
+    for (int y = 0; y < png.height; y++) {
+        uint8_t* row = inflated.get() + size_t(y) * (rowbytes + 1);
+        if (!unfilterRow(row[0], row + 1, prior, rowbytes, bpp)) {
+            std::cerr << "Unknown PNG filter (" << int(row[0]) << ") ('" << filename << "')\n";
+            return false;
+        }
+        convertPNGRow(png, row + 1, pixels + size_t(png.height - 1 - y) * outrow,
+                      info.channels);
+        prior = row + 1;
+    }
+    return true;
+}
+
+bool decodeJPEG(const std::string& filename, const GLubyte* bytes, size_t size,
+                const Info& info, GLubyte* pixels, ThreadPool* pool) {
+    JPEGImage jpeg;
+    if (!parseJPEG(filename, bytes, size, jpeg, false)) {
+        return false;
+    }
+    std::unique_ptr<uint8_t[]> planes[3];
+    uint8_t* planepointers[3] = {nullptr, nullptr, nullptr};
+    for (int c = 0; c < jpeg.count; c++) {
+        const JPEGComponent& component = jpeg.components[c];
+        planes[c].reset(new uint8_t[component.stride * component.rows]);
+        planepointers[c] = planes[c].get();
+    }
+
+    // Each restart interval is a strip of MCUs that is decoded on its own
+    const int mcus = jpeg.mcusx * jpeg.mcusy;
+    const int interval = (jpeg.restart > 0) ? jpeg.restart : mcus;
+    const int intervals = (mcus + interval - 1) / interval;
+    const std::vector<Segment> segments = splitScan(jpeg.scan, jpeg.end);
+    if (int(segments.size()) < intervals) {
+        std::cerr << "Truncated JPEG image data ('" << filename << "')\n";
+        return false;
+    }
+    const Dequantization dequantization(jpeg);
+    std::atomic<bool> corrupt(false);
+    parallelRanges(pool, intervals, [&](int begin, int end) {
+        for (int i = begin; i < end && !corrupt; i++) {
+            const int first = i * interval;
+            if (!decodeMCUs(jpeg, dequantization, segments[size_t(i)], first,
+                            std::min(first + interval, mcus), planepointers)) {
+                corrupt = true;
+            }
+        }
+    });
+    if (corrupt) {
+        std::cerr << "Corrupt JPEG image data ('" << filename << "')\n";
+        return false;
+    }
+
+    // Upsample and convert bands of rows, stored from the bottom
+    const size_t outrow = size_t(info.width) * size_t(info.channels);
+    parallelRanges(pool, jpeg.height, [&](int begin, int end) {
+        const size_t scratchsize = size_t(jpeg.width) + 32;
+        std::vector<uint8_t> scratch(3 * scratchsize);
+        for (int y = begin; y < end; y++) {
+            const uint8_t* rows[3];
+            for (int c = 0; c < jpeg.count; c++) {
+                const JPEGComponent& component = jpeg.components[c];
+                const uint8_t* row = planepointers[c] +
+                                     size_t(y * component.v / jpeg.vmax) * component.stride;
+                rows[c] = upsampleRow(row, component.h, jpeg.hmax, jpeg.width,
+                                      scratch.data() + size_t(c) * scratchsize);
+            }
+            uint8_t* out = pixels + size_t(jpeg.height - 1 - y) * outrow;
+            if (jpeg.count == 1) {
+                for (int x = 0; x < jpeg.width; x++) {
+                    out[3 * x] = out[3 * x + 1] = out[3 * x + 2] = rows[0][x];
+                }
+            } else if (jpeg.rgb) {
+                for (int x = 0; x < jpeg.width; x++) {
+                    out[3 * x + 0] = rows[2][x];
+                    out[3 * x + 1] = rows[1][x];
+                    out[3 * x + 2] = rows[0][x];
+                }
+            } else {
+                convertYCbCrRow(rows[0], rows[1], rows[2], out, jpeg.width);
+            }
+        }
+    });
+    return true;
+}
+
+}  // namespace imagedecoder
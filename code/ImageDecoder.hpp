@@ -0,0 +1,58 @@
+/*
+ * Decoders of PNG and baseline JPEG files, for textures that are smaller on disk than TGA.
+ *
+ * Usage: Tell the type of a file by its first bytes with isPNG() or isJPEG(), read its
+ *        size with readPNGInfo() or readJPEGInfo(), and decode it with decodePNG() or
+ *        decodeJPEG() into a buffer of Info::width * Info::height * Info::channels bytes.
+ *        The pixels are 8 bit BGR, or BGRA for files with alpha, with the bottom row first,
+ *        as in TGA files, so they are uploaded and used like the pixels of a TGA file.
+ *        PNG: all color types and bit depths, with 16 bit samples cut to 8 bits and
+ *        transparency only from the palette. Interlaced files are not supported. The zlib
+ *        stream is inflated here, and the rows are unfiltered with SSE2 or NEON, a pixel at
+ *        a time for the filters that depend on the pixel to the left. Inflating is serial,
+ *        so a PNG file is decoded on one thread.
+ *        JPEG: baseline and extended sequential Huffman files with one scan, gray or YCbCr
+ *        with any chroma subsampling, which is upsampled by repeating samples. Progressive,
+ *        arithmetic coded and lossless files are not supported. Files with restart markers
+ *        are split into strips at the markers, which are independent of each other, and
+ *        with a pool the strips are decoded in parallel. The inverse DCT works on four
+ *        columns at a time in SSE2 or NEON registers, and YCbCr is converted to BGR eight
+ *        pixels at a time in 16 bit fixed point. The color conversion is split into bands
+ *        of rows for the pool, also for files without restart markers.
+ *        Errors are reported on std::cerr with the file name, and return false.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstddef>
+#include <string>
+
+class ThreadPool;
+
+namespace imagedecoder {
+
+// The size of an image and the channels of its decoded pixels
+struct Info {
+    int width = 0;
+    int height = 0;
+    int channels = 0;  // 3 for BGR, 4 for BGRA
+};
+
+// True if 'bytes' start with the signature of a PNG file, or the start of image marker of a
+// JPEG file
+bool isPNG(const GLubyte* bytes, size_t size);
+bool isJPEG(const GLubyte* bytes, size_t size);
+
+// Read the headers of a file up to its size. False if the file is not supported.
+bool readPNGInfo(const std::string& filename, const GLubyte* bytes, size_t size, Info& info);
+bool readJPEGInfo(const std::string& filename, const GLubyte* bytes, size_t size, Info& info);
+
+// Decode a file whose 'info' was read into 'pixels'. False if it is corrupt.
+bool decodePNG(const std::string& filename, const GLubyte* bytes, size_t size,
+               const Info& info, GLubyte* pixels);
+bool decodeJPEG(const std::string& filename, const GLubyte* bytes, size_t size,
+                const Info& info, GLubyte* pixels, ThreadPool* pool = nullptr);
+
+}  // namespace imagedecoder
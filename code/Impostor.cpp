@@ -0,0 +1,331 @@
+/*
+ * Octahedral impostors of a TriangleSoup, baked into color and normal atlases and drawn as
+ * instanced billboards
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "Impostor.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "Mat4.hpp"
+#include "TriangleSoup.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+const GLenum Impostor::atlasFormat = GL_RGBA8;
+
+namespace {
+
+// The direction of a point of the octahedral map in [-1, 1]^2, with y up. The same as
+// octahedralDecode() of vertex_impostor.glsl.
+void octahedralDecode(float u, float v, float* d) {
+    d[0] = u;
+    d[1] = 1.0f - std::fabs(u) - std::fabs(v);
+    d[2] = v;
+    if (d[1] < 0.0f) {
+        const float x = d[0];
+        d[0] = (1.0f - std::fabs(d[2])) * (x >= 0.0f ? 1.0f : -1.0f);
+        d[2] = (1.0f - std::fabs(x)) * (d[2] >= 0.0f ? 1.0f : -1.0f);
+    }
+    const float length = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    for (int i = 0; i < 3; i++) {
+        d[i] /= length;
+    }
+}
+
+void cross(const float* a, const float* b, float* c) {
+    c[0] = a[1] * b[2] - a[2] * b[1];
+    c[1] = a[2] * b[0] - a[0] * b[2];
+    c[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// The right and up axes of the view from direction 'd', as viewAxes() of
+// vertex_impostor.glsl
+void viewAxes(const float* d, float* right, float* up) {
+    const float yaxis[3] = {0.0f, 1.0f, 0.0f};
+    const float zaxis[3] = {0.0f, 0.0f, 1.0f};
+    cross(std::fabs(d[1]) < 0.999f ? yaxis : zaxis, d, right);
+    const float length =
+        std::sqrt(right[0] * right[0] + right[1] * right[1] + right[2] * right[2]);
+    for (int i = 0; i < 3; i++) {
+        right[i] /= length;
+    }
+    cross(d, right, up);
+}
+
+}  // namespace
+
+Impostor::Impostor(int views, int resolution)
+    : views_(std::max(views, 2)), resolution_(std::max(resolution, 4)),
+      switchpixels_(0.5f * float(resolution_)), fade_(0.25f), bounds_{0.0f, 0.0f, 0.0f, 0.0f},
+      atlases_{0, 0}, shaders_("vertex_impostor.glsl", "fragment_impostor.glsl"), vao_(0),
+      instancebuffer_(0), ninstances_(0), billboards_(0) {}
+
+Impostor::~Impostor() {
+    if (atlases_[0] != 0) {
+        glstate::deleteTextures(2, atlases_);
+    }
+    if (instancebuffer_ != 0) {
+        gpumem::deleteBuffers(1, &instancebuffer_);
+    }
+    if (vao_ != 0) {
+        glstate::deleteVertexArrays(1, &vao_);
+    }
+}
+
+bool Impostor::bake(TriangleSoup& mesh, GLuint texture) {
+    const mesh::Bounds& bounds = mesh.bounds();
+    const float radius = std::max(bounds.radius, 1e-6f);
+    const int size = views_ * resolution_;
+    // Mipmaps down to a texel per view
+    int levels = 1;
+    while ((resolution_ >> levels) > 0) {
+        levels++;
+    }
+
+    if (atlases_[0] == 0) {
+        glGenTextures(2, atlases_);
+    }
+    for (int i = 0; i < 2; i++) {
+        glstate::bindTexture(GL_TEXTURE_2D, atlases_[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, atlasFormat, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     nullptr);
+        gpumem::setTexture(atlases_[i], gpumem::Category::Texture,
+                           gpumem::textureBytes(atlasFormat, size, size, 1, levels));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+
+    // The state changed below, to restore at the end
+    GLint framebuffer = 0;
+    GLint viewport[4];
+    GLint polygonmode[2];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_POLYGON_MODE, polygonmode);
+    const GLboolean depthtest = glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean blending = glIsEnabled(GL_BLEND);
+    const GLboolean culling = glIsEnabled(GL_CULL_FACE);
+
+    GLuint fbo = 0;
+    GLuint depth = 0;
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, atlases_[0], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, atlases_[1], 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    const GLenum drawbuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawbuffers);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    bool complete = (status == GL_FRAMEBUFFER_COMPLETE);
+    if (!complete) {
+        std::cerr << "Impostor::bake(): framebuffer is not complete (status 0x" << std::hex
+                  << status << std::dec << ")\n";
+    } else {
+        // No coverage, and a normal of length 0, where the mesh is not
+        const GLfloat nocolor[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        const GLfloat nonormal[4] = {0.5f, 0.5f, 0.5f, 0.0f};
+        const GLfloat farthest = 1.0f;
+        glViewport(0, 0, size, size);
+        glClearBufferfv(GL_COLOR, 0, nocolor);
+        glClearBufferfv(GL_COLOR, 1, nonormal);
+        glClearBufferfv(GL_DEPTH, 0, &farthest);
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glDisable(GL_CULL_FACE);  // The views see the back of open meshes too
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+        Shader& shader = shaders_.get("BAKE");
+        shader.use();
+        glstate::activeTexture(GL_TEXTURE0);
+        glstate::bindTexture(GL_TEXTURE_2D, texture);
+        shader.setUniform("tex", 0);
+        shader.setUniform("textured", texture != 0 ? 1.0f : 0.0f);
+        const float* c = bounds.center;
+        for (int row = 0; row < views_; row++) {
+            for (int column = 0; column < views_; column++) {
+                // An orthographic view of the bounding sphere from the direction of the cell,
+                // with x and y along the axes of the view and z towards the direction
+                float d[3];
+                float right[3];
+                float up[3];
+                octahedralDecode(2.0f * float(column) / float(views_ - 1) - 1.0f,
+                                 2.0f * float(row) / float(views_ - 1) - 1.0f, d);
+                viewAxes(d, right, up);
+                Mat4 matrix = Mat4::identity();
+                const float* axes[3] = {right, up, d};
+                for (int i = 0; i < 3; i++) {
+                    // Depth grows away from the direction of the view
+                    const float sign = (i == 2) ? -1.0f : 1.0f;
+                    for (int j = 0; j < 3; j++) {
+                        matrix.m[4 * j + i] = sign * axes[i][j] / radius;
+                    }
+                    matrix.m[12 + i] =
+                        -sign * (axes[i][0] * c[0] + axes[i][1] * c[1] + axes[i][2] * c[2]) /
+                        radius;
+                }
+                glViewport(column * resolution_, row * resolution_, resolution_, resolution_);
+                shader.setUniformMatrix("bakeMatrix", matrix.m);
+                mesh.render();
+            }
+        }
+        for (int i = 0; i < 2; i++) {
+            glstate::bindTexture(GL_TEXTURE_2D, atlases_[i]);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        bounds_[0] = c[0];
+        bounds_[1] = c[1];
+        bounds_[2] = c[2];
+        bounds_[3] = radius;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(framebuffer));
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &depth);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glPolygonMode(GL_FRONT_AND_BACK, static_cast<GLenum>(polygonmode[0]));
+    if (!depthtest) {
+        glDisable(GL_DEPTH_TEST);
+    }
+    if (blending) {
+        glEnable(GL_BLEND);
+    }
+    if (culling) {
+        glEnable(GL_CULL_FACE);
+    }
+    return complete;
+}
+
+bool Impostor::baked() const { return bounds_[3] > 0.0f; }
+
+void Impostor::setSwitch(float pixels, float fade) {
+    switchpixels_ = std::max(pixels, 0.0f);
+    fade_ = std::max(fade, 0.0f);
+}
+
+/* Split the instances by their size on the screen, as TriangleSoup::selectLODs() measures
+ * it, and draw each part */
+int Impostor::render(TriangleSoup& mesh, Shader& meshshader, const Mat4& P,
+                     const GLfloat* matrices, int count) {
+    billboards_ = 0;
+    meshshader.use();
+    if (count <= 0) {
+        return 0;
+    }
+    if (!baked()) {
+        return mesh.renderInstancedLOD(P, matrices, count);
+    }
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const bool perspective = (P.m[11] != 0.0f);
+    const float pixelsperunit = 0.5f * static_cast<float>(viewport[3]) * std::fabs(P.m[5]);
+
+    meshmatrices_.clear();
+    billboardmatrices_.clear();
+    for (int i = 0; i < count; i++) {
+        const GLfloat* m = matrices + 16 * size_t(i);
+        float scale2 = 0.0f;
+        for (int column = 0; column < 3; column++) {
+            const GLfloat* c = m + 4 * column;
+            scale2 = std::max(scale2, c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+        }
+        const float radius = bounds_[3] * std::sqrt(scale2);
+        const float distance =
+            -(m[2] * bounds_[0] + m[6] * bounds_[1] + m[10] * bounds_[2] + m[14]);
+        // The mesh when the camera is within its sphere
+        float visible = 1.0f;
+        if (!perspective || distance > radius) {
+            const float pixels =
+                2.0f * radius * pixelsperunit / (perspective ? distance : 1.0f);
+            if (fade_ > 0.0f) {
+                visible = std::clamp((pixels / switchpixels_ - 1.0f) / fade_, 0.0f, 1.0f);
+            } else {
+                visible = (pixels >= switchpixels_) ? 1.0f : 0.0f;
+            }
+        }
+        // The fade of each part in the bottom row of its matrices, which is 0 0 0 1 for
+        // model-view matrices, where the shaders read it and set it back to 0
+        if (visible > 0.0f) {
+            const size_t start = meshmatrices_.size();
+            meshmatrices_.insert(meshmatrices_.end(), m, m + 16);
+            meshmatrices_[start + 3] = 1.0f - visible;
+        }
+        if (visible < 1.0f) {
+            const size_t start = billboardmatrices_.size();
+            billboardmatrices_.insert(billboardmatrices_.end(), m, m + 16);
+            billboardmatrices_[start + 3] = visible;
+        }
+    }
+
+    int triangles = 0;
+    if (!meshmatrices_.empty()) {
+        triangles += mesh.renderInstancedLOD(P, meshmatrices_.data(),
+                                             static_cast<int>(meshmatrices_.size() / 16));
+    }
+    billboards_ = static_cast<int>(billboardmatrices_.size() / 16);
+    if (billboards_ == 0) {
+        return triangles;
+    }
+
+    // One buffer of matrices for the billboards, at the attributes of the instanced meshes
+    if (vao_ == 0) {
+        glGenVertexArrays(1, &vao_);
+        glGenBuffers(1, &instancebuffer_);
+        glstate::bindVertexArray(vao_);
+        glBindBuffer(GL_ARRAY_BUFFER, instancebuffer_);
+        for (int column = 0; column < 4; column++) {
+            const GLuint location = 5 + column;
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat),
+                                  (void*)(4 * column * sizeof(GLfloat)));
+            glVertexAttribDivisor(location, 1);
+        }
+    } else {
+        glstate::bindVertexArray(vao_);
+        glBindBuffer(GL_ARRAY_BUFFER, instancebuffer_);
+    }
+    const size_t bytes = billboardmatrices_.size() * sizeof(GLfloat);
+    if (billboards_ > ninstances_) {
+        ninstances_ = std::max(billboards_, 2 * ninstances_);
+        glBufferData(GL_ARRAY_BUFFER, size_t(ninstances_) * 16 * sizeof(GLfloat), nullptr,
+                     GL_DYNAMIC_DRAW);
+        gpumem::setBuffer(instancebuffer_, gpumem::Category::Mesh,
+                          size_t(ninstances_) * 16 * sizeof(GLfloat));
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, billboardmatrices_.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    Shader& shader = shaders_.get("");
+    shader.use();
+    glstate::activeTexture(GL_TEXTURE1);
+    glstate::bindTexture(GL_TEXTURE_2D, atlases_[1]);
+    glstate::activeTexture(GL_TEXTURE0);
+    glstate::bindTexture(GL_TEXTURE_2D, atlases_[0]);
+    shader.setUniform("colorAtlas", 0);
+    shader.setUniform("normalAtlas", 1);
+    shader.setUniform("bounds", bounds_[0], bounds_[1], bounds_[2], bounds_[3]);
+    shader.setUniform("views", float(views_));
+    // A quad of two triangles, from gl_VertexID
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, billboards_);
+    glstate::bindVertexArray(0);
+    meshshader.use();
+    return triangles + 2 * billboards_;
+}
+
+int Impostor::billboardCount() const { return billboards_; }
+
+GLuint Impostor::colorAtlas() const { return atlases_[0]; }
+
+GLuint Impostor::normalAtlas() const { return atlases_[1]; }
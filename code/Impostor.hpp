@@ -0,0 +1,92 @@
+/*
+ * Octahedral impostors: a mesh drawn from many directions into an atlas once, and distant
+ * instances drawn as billboards that show the atlas view nearest to their direction, so
+ * that an object of a few pixels costs two triangles instead of a level of detail.
+ *
+ * Usage: bake() draws a TriangleSoup from views x views directions spread over the sphere
+ *        by an octahedral map, each into a square of 'resolution' texels, with an
+ *        orthographic projection around its bounding sphere. The color atlas holds the
+ *        texture color (white without a texture) and the coverage in alpha, and the normal
+ *        atlas the normal in the coordinates of the mesh. Bake once after loading, as the
+ *        views are not drawn again unless bake() is called again.
+ *        render() draws 'count' instances of the mesh with their model-view matrices, as
+ *        TriangleSoup::renderInstancedLOD() does. Instances whose bounding sphere is larger
+ *        on the screen than setSwitch() pixels are drawn as the mesh, with 'meshshader',
+ *        and smaller ones as billboards with a shader of its own. The billboard blends the
+ *        four atlas views around the direction to the camera, each reprojected onto the
+ *        billboard, and is shaded with the Phong material of ObjectData.material like
+ *        fragment.glsl. In a band above the switch size both are drawn, dithered so that
+ *        the pixels of one are the pixels missing from the other, which cross-fades the
+ *        switch without blending or sorting.
+ *        'meshshader' must be vertex_instanced.glsl with LOD_FADE defined, which reads the
+ *        fade of each instance from the bottom row of its matrix, where render() puts it.
+ *        Model-view matrices have 0 0 0 1 there, and 0 means no fade, so matrices without
+ *        a fade draw as usual. The billboards write only the color, so passes with more
+ *        outputs (PICKING, MOTION_VECTORS) leave them as they were.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <vector>
+
+#include "Shader.hpp"
+
+class TriangleSoup;
+struct Mat4;
+
+class Impostor {
+public:
+    // The format of both atlases
+    static const GLenum atlasFormat;
+
+    /* Constructor: 'views' x 'views' directions, each 'resolution' texels square. Switch to
+     * billboards below 'resolution' / 2 pixels, over a fade band of a quarter of that. */
+    explicit Impostor(int views = 8, int resolution = 64);
+
+    /* Destructor: delete the atlases, the buffer and the vertex array */
+    ~Impostor();
+
+    Impostor(const Impostor&) = delete;
+    Impostor& operator=(const Impostor&) = delete;
+
+    /* Draw 'mesh' into the atlases, multiplied by 'texture' if it is not 0. False if the
+     * framebuffer could not be created. */
+    bool bake(TriangleSoup& mesh, GLuint texture = 0);
+
+    // True after a bake()
+    bool baked() const;
+
+    /* Use billboards for instances smaller than 'pixels' on the screen, and cross-fade up to
+     * 'pixels' * (1 + 'fade') */
+    void setSwitch(float pixels, float fade = 0.25f);
+
+    /* Draw 'count' instances of the baked mesh with the model-view matrices 'matrices' (16
+     * floats each) and the projection P in the current viewport, the near ones with
+     * mesh.renderInstancedLOD() and 'meshshader', and the far ones as billboards.
+     * 'meshshader' is in use again at the end. Returns the number of triangles drawn. */
+    int render(TriangleSoup& mesh, Shader& meshshader, const Mat4& P, const GLfloat* matrices,
+               int count);
+
+    // Instances drawn as billboards by the last render(), including those fading in
+    int billboardCount() const;
+
+    GLuint colorAtlas() const;
+    GLuint normalAtlas() const;
+
+private:
+    int views_;
+    int resolution_;
+    float switchpixels_;
+    float fade_;
+    float bounds_[4];         // Center and radius of the baked mesh
+    GLuint atlases_[2];       // Color and normal
+    ShaderVariants shaders_;  // BAKE, and the billboards
+    GLuint vao_;
+    GLuint instancebuffer_;
+    int ninstances_;          // Capacity of instancebuffer_
+    int billboards_;
+    std::vector<GLfloat> meshmatrices_;
+    std::vector<GLfloat> billboardmatrices_;
+};
@@ -0,0 +1,297 @@
+/*
+ * A small JSON parser into a tree of values
+ *
+ * This code is in the public domain.
+ */
+#include "Json.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+namespace json {
+
+namespace {
+
+// Arrays and objects nested deeper than this are rejected, to bound the recursion
+constexpr int maxDepth = 256;
+
+const Value& nullValue() {
+    static const Value value;
+    return value;
+}
+
+const std::string& emptyString() {
+    static const std::string string;
+    return string;
+}
+
+const std::vector<std::pair<std::string, Value>>& noMembers() {
+    static const std::vector<std::pair<std::string, Value>> members;
+    return members;
+}
+
+// Append the code point 'c' to 'out' as UTF-8
+void appendUTF8(unsigned long c, std::string& out) {
+    if (c < 0x80) {
+        out += static_cast<char>(c);
+    } else if (c < 0x800) {
+        out += static_cast<char>(0xC0 | (c >> 6));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+        out += static_cast<char>(0xE0 | (c >> 12));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (c >> 18));
+        out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+}
+
+}  // namespace
+
+// A recursive descent parser over the text, which stops at the first error
+class Parser {
+public:
+    Parser(const char* text, size_t size) : begin_(text), p_(text), end_(text + size) {}
+
+    bool parseDocument(Value& value, std::string* error) {
+        const bool ok = parseValue(value, 0) && (skipSpace(), p_ == end_);
+        if (!ok && error != nullptr) {
+            *error = "invalid JSON at byte " + std::to_string(p_ - begin_);
+        }
+        return ok;
+    }
+
+private:
+    void skipSpace() {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+            p_++;
+        }
+    }
+
+    bool match(const char* word) {
+        const char* q = p_;
+        for (; *word != '\0'; word++, q++) {
+            if (q == end_ || *q != *word) {
+                return false;
+            }
+        }
+        p_ = q;
+        return true;
+    }
+
+    bool parseHex(unsigned long& c) {
+        if (end_ - p_ < 4) {
+            return false;
+        }
+        const std::from_chars_result result = std::from_chars(p_, p_ + 4, c, 16);
+        const bool ok = result.ptr == p_ + 4;
+        p_ += 4;
+        return ok;
+    }
+
+    bool parseString(std::string& out) {
+        p_++;  // The opening quote
+        while (p_ < end_ && *p_ != '"') {
+            const char* run = p_;
+            while (p_ < end_ && *p_ != '"' && *p_ != '\\') {
+                if (static_cast<unsigned char>(*p_) < 0x20) {
+                    return false;
+                }
+                p_++;
+            }
+            out.append(run, p_);
+            if (p_ == end_ || *p_ == '"') {
+                break;
+            }
+            if (++p_ == end_) {
+                return false;
+            }
+            const char escape = *p_++;
+            // The escapes of single characters, and then \u and four hex digits
+            const char* const escapes = "\"\\/bfnrt";
+            const char* const characters = "\"\\/\b\f\n\r\t";
+            const char* found = std::strchr(escapes, escape);
+            if (found != nullptr && escape != '\0') {
+                out += characters[found - escapes];
+                continue;
+            }
+            unsigned long c = 0;
+            if (escape != 'u' || !parseHex(c)) {
+                return false;
+            }
+            // A surrogate pair for the code points above 0xFFFF
+            unsigned long low = 0;
+            if (c >= 0xD800 && c < 0xDC00 && match("\\u") && parseHex(low) && low >= 0xDC00 &&
+                low < 0xE000) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+            }
+            appendUTF8(c, out);
+        }
+        if (p_ == end_) {
+            return false;
+        }
+        p_++;  // The closing quote
+        return true;
+    }
+
+    bool parseNumber(double& number) {
+        // from_chars() takes no leading '+', which JSON does not allow either
+        const std::from_chars_result result = std::from_chars(p_, end_, number);
+        if (result.ec != std::errc() || !std::isfinite(number)) {
+            return false;
+        }
+        p_ = result.ptr;
+        return true;
+    }
+
+    bool parseValue(Value& value, int depth) {
+        skipSpace();
+        if (p_ == end_ || depth > maxDepth) {
+            return false;
+        }
+        switch (*p_) {
+            case '{': {
+                value.type_ = Value::Type::Object;
+                p_++;
+                skipSpace();
+                if (p_ < end_ && *p_ == '}') {
+                    p_++;
+                    return true;
+                }
+                while (true) {
+                    skipSpace();
+                    if (p_ == end_ || *p_ != '"') {
+                        return false;
+                    }
+                    value.members_.emplace_back();
+                    std::pair<std::string, Value>& member = value.members_.back();
+                    if (!parseString(member.first)) {
+                        return false;
+                    }
+                    skipSpace();
+                    if (p_ == end_ || *p_++ != ':' || !parseValue(member.second, depth + 1)) {
+                        return false;
+                    }
+                    skipSpace();
+                    if (p_ < end_ && *p_ == ',') {
+                        p_++;
+                    } else {
+                        break;
+                    }
+                }
+                return p_ < end_ && *p_++ == '}';
+            }
+            case '[': {
+                value.type_ = Value::Type::Array;
+                p_++;
+                skipSpace();
+                if (p_ < end_ && *p_ == ']') {
+                    p_++;
+                    return true;
+                }
+                while (true) {
+                    value.elements_.emplace_back();
+                    if (!parseValue(value.elements_.back(), depth + 1)) {
+                        return false;
+                    }
+                    skipSpace();
+                    if (p_ < end_ && *p_ == ',') {
+                        p_++;
+                    } else {
+                        break;
+                    }
+                }
+                return p_ < end_ && *p_++ == ']';
+            }
+            case '"':
+                value.type_ = Value::Type::String;
+                return parseString(value.string_);
+            case 't':
+            case 'f':
+                value.type_ = Value::Type::Bool;
+                value.bool_ = (*p_ == 't');
+                return match(value.bool_ ? "true" : "false");
+            case 'n':
+                return match("null");
+            default:
+                value.type_ = Value::Type::Number;
+                return parseNumber(value.number_);
+        }
+    }
+
+    const char* begin_;
+    const char* p_;
+    const char* end_;
+};
+
+Value::Value() : type_(Type::Null), bool_(false), number_(0.0) {}
+
+Value::Type Value::type() const { return type_; }
+
+bool Value::isNull() const { return type_ == Type::Null; }
+
+bool Value::isNumber() const { return type_ == Type::Number; }
+
+bool Value::isString() const { return type_ == Type::String; }
+
+bool Value::isArray() const { return type_ == Type::Array; }
+
+bool Value::isObject() const { return type_ == Type::Object; }
+
+bool Value::asBool(bool fallback) const { return type_ == Type::Bool ? bool_ : fallback; }
+
+double Value::asNumber(double fallback) const {
+    return type_ == Type::Number ? number_ : fallback;
+}
+
+int Value::asInt(int fallback) const {
+    return (type_ == Type::Number && number_ >= -2147483648.0 && number_ <= 2147483647.0)
+               ? static_cast<int>(number_)
+               : fallback;
+}
+
+const std::string& Value::asString() const {
+    return type_ == Type::String ? string_ : emptyString();
+}
+
+size_t Value::size() const {
+    return type_ == Type::Array ? elements_.size()
+                                : (type_ == Type::Object ? members_.size() : 0);
+}
+
+const Value& Value::operator[](size_t index) const {
+    return (type_ == Type::Array && index < elements_.size()) ? elements_[index] : nullValue();
+}
+
+const Value& Value::operator[](int index) const {
+    return index < 0 ? nullValue() : (*this)[static_cast<size_t>(index)];
+}
+
+const Value& Value::operator[](const char* key) const {
+    if (type_ == Type::Object) {
+        for (const std::pair<std::string, Value>& member : members_) {
+            if (member.first == key) {
+                return member.second;
+            }
+        }
+    }
+    return nullValue();
+}
+
+bool Value::has(const char* key) const { return !(*this)[key].isNull(); }
+
+const std::vector<std::pair<std::string, Value>>& Value::members() const {
+    return type_ == Type::Object ? members_ : noMembers();
+}
+
+bool parse(const char* text, size_t size, Value& value, std::string* error) {
+    value = Value();
+    Parser parser(text, size);
+    return parser.parseDocument(value, error);
+}
+
+}  // namespace json
@@ -0,0 +1,68 @@
+/*
+ * A small JSON parser into a tree of values, for the JSON parts of file formats like glTF.
+ *
+ * Usage: json::parse() a text into a json::Value, then walk the tree with the accessors.
+ *        Looking up a member or an element that is not there gives a null value, so
+ *        paths like value["meshes"][0]["primitives"] need no checks on the way. The
+ *        numbers are doubles, and strings are decoded from their escapes to UTF-8.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace json {
+
+class Value {
+public:
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    Value();
+
+    Type type() const;
+    bool isNull() const;
+    bool isNumber() const;
+    bool isString() const;
+    bool isArray() const;
+    bool isObject() const;
+
+    // The value, or 'fallback' for a value of another type
+    bool asBool(bool fallback = false) const;
+    double asNumber(double fallback = 0.0) const;
+    int asInt(int fallback = 0) const;
+    const std::string& asString() const;
+
+    // Elements of an array, or members of an object, zero for other types
+    size_t size() const;
+
+    // An element of an array, or a null value
+    const Value& operator[](size_t index) const;
+    const Value& operator[](int index) const;
+
+    // A member of an object, or a null value
+    const Value& operator[](const char* key) const;
+    bool has(const char* key) const;
+
+    // The members of an object, in the order of the text
+    const std::vector<std::pair<std::string, Value>>& members() const;
+
+private:
+    friend class Parser;
+
+    Type type_;
+    bool bool_;
+    double number_;
+    std::string string_;
+    std::vector<Value> elements_;
+    std::vector<std::pair<std::string, Value>> members_;
+};
+
+/* Parse the 'size' bytes of 'text' into 'value'. False for text that is not valid JSON,
+ * with the position of the error in 'error'. */
+bool parse(const char* text, size_t size, Value& value, std::string* error = nullptr);
+
+}  // namespace json
@@ -0,0 +1,194 @@
+/*
+ * Point lights sorted into the clusters of the view frustum, for clustered forward shading
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "LightClusters.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "Shader.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+LightClusters::LightClusters(int tilesx, int tilesy, int slices)
+    : tilesx_(std::max(tilesx, 1)), tilesy_(std::max(tilesy, 1)), slices_(std::max(slices, 1)),
+      near_(0.1f), far_(100.0f), projection_(Mat4::identity()), maxclusterlights_(0),
+      buffers_{0, 0, 0}, textures_{0, 0, 0} {}
+
+LightClusters::~LightClusters() {
+    if (buffers_[0] != 0) {
+        glstate::deleteTextures(3, textures_);
+        gpumem::deleteBuffers(3, buffers_);
+    }
+}
+
+void LightClusters::computeBoxes(const Mat4& P) {
+    projection_ = P;
+    // The planes of a perspective projection, from P[2][2] and P[2][3]
+    near_ = P.m[14] / (P.m[10] - 1.0f);
+    far_ = P.m[14] / (P.m[10] + 1.0f);
+
+    // A point at the distance d in front of the camera, at x in NDC, is at
+    // d * (x + P[0][2]) / P[0][0] in view space, and the same for y
+    boxes_.resize(static_cast<size_t>(tilesx_ * tilesy_ * slices_));
+    for (int k = 0; k < slices_; k++) {
+        const float d0 = near_ * std::pow(far_ / near_, float(k) / float(slices_));
+        const float d1 = near_ * std::pow(far_ / near_, float(k + 1) / float(slices_));
+        for (int ty = 0; ty < tilesy_; ty++) {
+            const float y0 = -1.0f + 2.0f * float(ty) / float(tilesy_) + P.m[9];
+            const float y1 = -1.0f + 2.0f * float(ty + 1) / float(tilesy_) + P.m[9];
+            for (int tx = 0; tx < tilesx_; tx++) {
+                const float x0 = -1.0f + 2.0f * float(tx) / float(tilesx_) + P.m[8];
+                const float x1 = -1.0f + 2.0f * float(tx + 1) / float(tilesx_) + P.m[8];
+                Box& box = boxes_[static_cast<size_t>((k * tilesy_ + ty) * tilesx_ + tx)];
+                box.min[0] = std::min(x0 * d0, x0 * d1) / P.m[0];
+                box.max[0] = std::max(x1 * d0, x1 * d1) / P.m[0];
+                box.min[1] = std::min(y0 * d0, y0 * d1) / P.m[5];
+                box.max[1] = std::max(y1 * d0, y1 * d1) / P.m[5];
+                box.min[2] = -d1;
+                box.max[2] = -d0;
+            }
+        }
+    }
+}
+
+void LightClusters::assign(const std::vector<PointLight>& lights, const Mat4& P) {
+    if (boxes_.empty() || std::memcmp(P.m, projection_.m, sizeof(P.m)) != 0) {
+        computeBoxes(P);
+    }
+    const float logscale = float(slices_) / std::log(far_ / near_);
+    auto slice = [&](float d) {
+        return std::clamp(static_cast<int>(std::log(d / near_) * logscale), 0, slices_ - 1);
+    };
+    auto tile = [](float ndc, int tiles) {
+        return std::clamp(static_cast<int>(std::floor((ndc * 0.5f + 0.5f) * float(tiles))), 0,
+                          tiles - 1);
+    };
+
+    lightdata_.resize(8 * lights.size());
+    assignment_.clear();
+    assignedlight_.clear();
+    for (size_t i = 0; i < lights.size(); i++) {
+        const PointLight& light = lights[i];
+        std::memcpy(&lightdata_[8 * i], &light, sizeof(PointLight));
+        const float x = light.position[0];
+        const float y = light.position[1];
+        const float z = light.position[2];
+        const float r = light.radius;
+
+        // The distances in front of the camera that the light reaches, within the frustum
+        const float dmin = std::max(-z - r, near_);
+        const float dmax = std::min(-z + r, far_);
+        if (dmin > dmax) {
+            continue;
+        }
+        // The tiles that the box around the light covers. Its projection is bounded by the
+        // projections of its corners, since they are all in front of the camera.
+        float xmin = 1e30f, xmax = -1e30f, ymin = 1e30f, ymax = -1e30f;
+        for (float d : {dmin, dmax}) {
+            for (float s : {-r, r}) {
+                const float ndcx = P.m[0] * (x + s) / d - P.m[8];
+                const float ndcy = P.m[5] * (y + s) / d - P.m[9];
+                xmin = std::min(xmin, ndcx);
+                xmax = std::max(xmax, ndcx);
+                ymin = std::min(ymin, ndcy);
+                ymax = std::max(ymax, ndcy);
+            }
+        }
+        if (xmax < -1.0f || xmin > 1.0f || ymax < -1.0f || ymin > 1.0f) {
+            continue;
+        }
+        const int tx0 = tile(xmin, tilesx_), tx1 = tile(xmax, tilesx_);
+        const int ty0 = tile(ymin, tilesy_), ty1 = tile(ymax, tilesy_);
+        const int k1 = slice(dmax);
+        for (int k = slice(dmin); k <= k1; k++) {
+            for (int ty = ty0; ty <= ty1; ty++) {
+                for (int tx = tx0; tx <= tx1; tx++) {
+                    const int cluster = (k * tilesy_ + ty) * tilesx_ + tx;
+                    // Squared distance from the center of the light to the box
+                    const Box& box = boxes_[static_cast<size_t>(cluster)];
+                    float distance = 0.0f;
+                    for (int c = 0; c < 3; c++) {
+                        const float p = light.position[c];
+                        const float outside = std::max({box.min[c] - p, p - box.max[c], 0.0f});
+                        distance += outside * outside;
+                    }
+                    if (distance <= r * r) {
+                        assignment_.push_back(static_cast<uint32_t>(cluster));
+                        assignedlight_.push_back(static_cast<uint32_t>(i));
+                    }
+                }
+            }
+        }
+    }
+
+    // A counting sort of the pairs by cluster makes the light lists
+    const size_t count = boxes_.size();
+    clusters_.assign(2 * count, 0);
+    for (uint32_t cluster : assignment_) {
+        clusters_[2 * cluster + 1]++;
+    }
+    uint32_t offset = 0;
+    maxclusterlights_ = 0;
+    for (size_t c = 0; c < count; c++) {
+        clusters_[2 * c] = offset;
+        offset += clusters_[2 * c + 1];
+        maxclusterlights_ = std::max(maxclusterlights_, static_cast<int>(clusters_[2 * c + 1]));
+        clusters_[2 * c + 1] = 0;
+    }
+    indices_.resize(assignment_.size());
+    for (size_t j = 0; j < assignment_.size(); j++) {
+        uint32_t* cluster = &clusters_[2 * assignment_[j]];
+        indices_[cluster[0] + cluster[1]++] = assignedlight_[j];
+    }
+}
+
+void LightClusters::upload() {
+    const GLenum formats[3] = {GL_RGBA32F, GL_R32UI, GL_RG32UI};
+    if (buffers_[0] == 0) {
+        glGenBuffers(3, buffers_);
+        glGenTextures(3, textures_);
+    }
+    const void* data[3] = {lightdata_.data(), indices_.data(), clusters_.data()};
+    const size_t bytes[3] = {lightdata_.size() * sizeof(float),
+                             indices_.size() * sizeof(uint32_t),
+                             clusters_.size() * sizeof(uint32_t)};
+    for (int i = 0; i < 3; i++) {
+        // A new data store every frame, so that the draws of the last frame are not waited for.
+        // An empty array still gets a texel, since a buffer texture needs a store.
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers_[i]);
+        glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(std::max<size_t>(bytes[i], 16)),
+                     bytes[i] > 0 ? data[i] : nullptr, GL_STREAM_DRAW);
+        gpumem::setBuffer(buffers_[i], gpumem::Category::Buffer, std::max<size_t>(bytes[i], 16));
+        glstate::bindTexture(GL_TEXTURE_BUFFER, textures_[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers_[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::apply(Shader& shader, GLuint firstunit) const {
+    const char* names[3] = {"lightData", "lightIndices", "lightClusters"};
+    for (GLuint i = 0; i < 3; i++) {
+        glstate::activeTexture(GL_TEXTURE0 + firstunit + i);
+        glstate::bindTexture(GL_TEXTURE_BUFFER, textures_[i]);
+        shader.setUniform(names[i], static_cast<GLint>(firstunit + i));
+    }
+    glstate::activeTexture(GL_TEXTURE0);
+    // The slice of a fragment is log(distance) * x + y
+    const float logscale = float(slices_) / std::log(far_ / near_);
+    shader.setUniform("clusterGrid", float(tilesx_), float(tilesy_), float(slices_));
+    shader.setUniform("clusterDepth", logscale, -std::log(near_) * logscale);
+}
+
+int LightClusters::clusterCount() const { return tilesx_ * tilesy_ * slices_; }
+
+int LightClusters::lightCount() const { return static_cast<int>(lightdata_.size() / 8); }
+
+int LightClusters::assignedCount() const { return static_cast<int>(indices_.size()); }
+
+int LightClusters::maxClusterLights() const { return maxclusterlights_; }
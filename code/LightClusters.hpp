@@ -0,0 +1,93 @@
+/*
+ * Clustered forward shading: point lights sorted into a grid of clusters in the view frustum.
+ *
+ * Usage: Every frame, give the point lights, in view space, and the projection to assign(),
+ *        then upload() the result and apply() it to a program built with the define
+ *        CLUSTERED_LIGHTS before its draw calls. fragment.glsl then shades each fragment
+ *        with the lights of its cluster only, instead of with all lights.
+ *        The frustum is split into 'tilesx' x 'tilesy' tiles on the screen, and into
+ *        'slices' slices in depth, thinner near the camera: slice k starts at the distance
+ *        near * (far / near)^(k / slices). On the CPU, every light is tested against the
+ *        bounding boxes of the clusters that its bounding box on the screen and in depth
+ *        covers, so the work grows with the clusters that the lights touch, not with
+ *        lights times clusters. The result is one list of light indices, and an offset and
+ *        a count into it for every cluster.
+ *        The lights, the lists and the clusters go to the shader as buffer textures, which
+ *        OpenGL 3.3 has, on three texture units from 'firstunit' in apply().
+ *        assign() makes no OpenGL calls, so it may run on any thread. The perspective
+ *        projection may be off-center, but not orthographic.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstdint>
+#include <vector>
+
+#include "Mat4.hpp"
+
+class Shader;
+
+// A point light whose light falls off to zero at 'radius'
+struct PointLight {
+    float position[3];  // View space
+    float radius;
+    float color[3];
+    float intensity;
+};
+
+class LightClusters {
+public:
+    /* Constructor: a grid of tilesx x tilesy x slices clusters. The buffers are created by
+     * the first upload(). */
+    explicit LightClusters(int tilesx = 16, int tilesy = 9, int slices = 24);
+
+    /* Destructor: delete the buffers and their textures */
+    ~LightClusters();
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    // Sort 'lights' into the clusters of the view frustum of the perspective projection 'P'
+    void assign(const std::vector<PointLight>& lights, const Mat4& P);
+
+    // Send the result of the last assign() to the GPU
+    void upload();
+
+    // Bind the buffer textures to 'firstunit' and the two units after it, and set the
+    // uniforms of 'shader' that read them
+    void apply(Shader& shader, GLuint firstunit = 2) const;
+
+    int clusterCount() const;
+    int lightCount() const;
+
+    // Entries in all light lists, and the most lights in one cluster
+    int assignedCount() const;
+    int maxClusterLights() const;
+
+private:
+    struct Box {
+        float min[3];
+        float max[3];
+    };
+
+    // Bounding boxes of the clusters in view space, for the projection of 'P'
+    void computeBoxes(const Mat4& P);
+
+    int tilesx_;
+    int tilesy_;
+    int slices_;
+    float near_;
+    float far_;
+    Mat4 projection_;  // The projection of boxes_
+    std::vector<Box> boxes_;
+    std::vector<float> lightdata_;      // Two RGBA texels per light
+    std::vector<uint32_t> clusters_;    // Offset and count of each cluster
+    std::vector<uint32_t> indices_;     // The light lists of all clusters
+    std::vector<uint32_t> assignment_;  // Cluster of each (cluster, light) pair, for sorting
+    std::vector<uint32_t> assignedlight_;
+    int maxclusterlights_;
+    GLuint buffers_[3];   // Lights, indices and clusters
+    GLuint textures_[3];
+};
@@ -0,0 +1,165 @@
+/*
+ * Read-only memory mapped files
+ *
+ * This code is in the public domain.
+ */
+#include "MappedFile.hpp"
+#include "VirtualFiles.hpp"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile()
+    : data_(nullptr), size_(0), open_(false), file_(nullptr), mapping_(nullptr) {}
+#else
+MappedFile::MappedFile() : data_(nullptr), size_(0), open_(false) {}
+#endif
+
+MappedFile::MappedFile(const std::string& filename) : MappedFile() { open(filename); }
+
+MappedFile::~MappedFile() { close(); }
+
+bool MappedFile::isOpen() const { return open_; }
+
+const char* MappedFile::data() const { return data_; }
+
+size_t MappedFile::size() const { return size_; }
+
+bool MappedFile::open(const std::string& filename) {
+    if (vfs::isVirtual(filename)) {
+        close();
+        return openVirtual(filename);
+    }
+    return openLocal(filename);
+}
+
+bool MappedFile::openVirtual(const std::string& filename) {
+    virtual_ = vfs::open(filename);
+    if (!virtual_ || !virtual_->waitComplete()) {
+        virtual_.reset();
+        return false;
+    }
+    data_ = virtual_->data();
+    size_ = virtual_->size();
+    open_ = true;
+    return true;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::openLocal(const std::string& filename) {
+    close();
+
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER filesize;
+    if (!GetFileSizeEx(file, &filesize)) {
+        CloseHandle(file);
+        return false;
+    }
+    file_ = file;
+    size_ = static_cast<size_t>(filesize.QuadPart);
+    open_ = true;
+
+    if (size_ == 0) {  // Empty files can not be mapped, but they are still valid files
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        close();
+        return false;
+    }
+    mapping_ = mapping;
+
+    data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!data_) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close() {
+    if (virtual_) {
+        virtual_.reset();
+    } else if (data_) {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_) {
+        CloseHandle(mapping_);
+    }
+    if (file_) {
+        CloseHandle(file_);
+    }
+    data_ = nullptr;
+    mapping_ = nullptr;
+    file_ = nullptr;
+    size_ = 0;
+    open_ = false;
+}
+
+#else
+
+bool MappedFile::openLocal(const std::string& filename) {
+    close();
+
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat filestat;
+    if (fstat(fd, &filestat) != 0 || !S_ISREG(filestat.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+    size_ = static_cast<size_t>(filestat.st_size);
+    open_ = true;
+
+    if (size_ > 0) {  // Empty files can not be mapped, but they are still valid files
+        void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            ::close(fd);
+            close();
+            return false;
+        }
+        // The file is typically parsed from start to end, let the OS read ahead
+        madvise(addr, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(addr);
+    }
+
+    // The mapping stays valid after the file descriptor is closed
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::close() {
+    if (virtual_) {
+        virtual_.reset();
+    } else if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    open_ = false;
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * A class to map a file read-only into memory.
+ *
+ * Usage: Call open() with a file name, or use the constructor with a file name argument.
+ *        data() and size() give direct access to the file contents for as long as the
+ *        object is alive. The mapping is released by close() or by the destructor.
+ *        Uses mmap() on POSIX systems and file mappings on Windows.
+ *        Names with a prefix of the virtual file system, like http:// URLs, are opened with
+ *        vfs::open() instead, and open() waits until the whole file has arrived.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace vfs {
+class File;
+}
+
+class MappedFile {
+public:
+    /* Constructor: create an empty object, no file is mapped */
+    MappedFile();
+
+    /* Constructor to open and map a file all at once */
+    explicit MappedFile(const std::string& filename);
+
+    /* Destructor: unmap the file */
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /* Map the file read-only into memory. Returns false if the file could not be mapped. */
+    bool open(const std::string& filename);
+
+    /* Map a local file, past any backend of the virtual file system that is mounted for the
+     * name, as the backends themselves do. Returns false if the file could not be mapped. */
+    bool openLocal(const std::string& filename);
+
+    /* Unmap the file and close all handles */
+    void close();
+
+    bool isOpen() const;
+
+    // Pointer to the first byte of the file (nullptr for empty or unmapped files)
+    const char* data() const;
+    // Size of the file in bytes
+    size_t size() const;
+
+private:
+    // Open a name of the virtual file system, once all of it has arrived
+    bool openVirtual(const std::string& filename);
+
+    const char* data_;
+    size_t size_;
+    bool open_;
+    std::shared_ptr<vfs::File> virtual_;  // The file of a virtual name, which holds the data
+#ifdef _WIN32
+    void* file_;     // HANDLE of the opened file
+    void* mapping_;  // HANDLE of the file mapping object
+#endif
+};
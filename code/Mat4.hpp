@@ -0,0 +1,293 @@
+/*
+ * A 4x4 matrix type for transformations, with SIMD multiplication.
+ *
+ * Usage: Mat4 stores 16 floats in column major order, the layout OpenGL expects, so
+ *        glUniformMatrix4fv(location, 1, GL_FALSE, M.data()) works directly.
+ *        Build matrices with Mat4::identity(), rotationX(), translation(), perspective() etc,
+ *        or with Mat4::trs() for a combined translation, rotation and scaling.
+ *        Multiply with operator*. affineInverse() inverts matrices without projection.
+ *        For transformations that never change, the constexpr builders (including
+ *        constRotationX() etc, which use the compile time sine and cosine in constmath)
+ *        and Mat4::product() let the compiler compute the matrix at build time.
+ *        The multiplication uses SSE or AVX (with FMA if enabled) on x86 and NEON on ARM.
+ *        Define TNM046_NO_SIMD to use plain C++ everywhere.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+
+#if !defined(TNM046_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || \
+                                 (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define TNM046_MAT4_SSE 1
+#include <immintrin.h>
+#elif !defined(TNM046_NO_SIMD) && (defined(__ARM_NEON) || defined(_M_ARM64))
+#define TNM046_MAT4_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Trigonometry that can be evaluated at compile time, in double precision
+namespace constmath {
+
+constexpr double pi = 3.14159265358979323846;
+
+// The angle moved to [-pi, pi], where the series below converge quickly
+constexpr double reduceAngle(double x) {
+    const double turns = x / (2.0 * pi);
+    const long long k = static_cast<long long>(turns + ((turns >= 0.0) ? 0.5 : -0.5));
+    return x - static_cast<double>(k) * 2.0 * pi;
+}
+
+constexpr double sin(double x) {
+    x = reduceAngle(x);
+    double term = x;
+    double sum = x;
+    for (int n = 1; n < 20; n++) {
+        term *= -x * x / ((2.0 * n) * (2.0 * n + 1.0));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double cos(double x) {
+    x = reduceAngle(x);
+    double term = 1.0;
+    double sum = 1.0;
+    for (int n = 1; n < 20; n++) {
+        term *= -x * x / ((2.0 * n - 1.0) * (2.0 * n));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double tan(double x) { return sin(x) / cos(x); }
+
+}  // namespace constmath
+
+struct alignas(16) Mat4 {
+    float m[16];  // Column major: column c is m[4 * c] ... m[4 * c + 3]
+
+    // Sine and cosine of the same angle, with one call where the C library has sincosf()
+    static void sincos(float angle, float& sine, float& cosine) {
+#if defined(__GLIBC__)
+        __builtin_sincosf(angle, &sine, &cosine);
+#else
+        sine = std::sin(angle);
+        cosine = std::cos(angle);
+#endif
+    }
+
+    constexpr float* data() { return m; }
+    constexpr const float* data() const { return m; }
+    constexpr float& operator[](int i) { return m[i]; }
+    constexpr float operator[](int i) const { return m[i]; }
+
+    static constexpr Mat4 identity() { return scale(1.0f, 1.0f, 1.0f); }
+
+    static constexpr Mat4 scale(float s) { return scale(s, s, s); }
+
+    static constexpr Mat4 scale(float x, float y, float z) {
+        return {{x, 0.0f, 0.0f, 0.0f, 0.0f, y, 0.0f, 0.0f, 0.0f, 0.0f, z, 0.0f, 0.0f, 0.0f, 0.0f,
+                 1.0f}};
+    }
+
+    static constexpr Mat4 translation(float x, float y, float z) {
+        return {{1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, x, y, z,
+                 1.0f}};
+    }
+
+    static Mat4 rotationX(float angle) {
+        float s, c;
+        sincos(angle, s, c);
+        return rotationX(s, c);
+    }
+
+    static Mat4 rotationY(float angle) {
+        float s, c;
+        sincos(angle, s, c);
+        return rotationY(s, c);
+    }
+
+    static Mat4 rotationZ(float angle) {
+        float s, c;
+        sincos(angle, s, c);
+        return rotationZ(s, c);
+    }
+
+    // Rotations from an already known sine and cosine of the angle
+    static constexpr Mat4 rotationX(float s, float c) {
+        return {{1.0f, 0.0f, 0.0f, 0.0f, 0.0f, c, s, 0.0f, 0.0f, -s, c, 0.0f, 0.0f, 0.0f, 0.0f,
+                 1.0f}};
+    }
+
+    static constexpr Mat4 rotationY(float s, float c) {
+        return {{c, 0.0f, -s, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, s, 0.0f, c, 0.0f, 0.0f, 0.0f, 0.0f,
+                 1.0f}};
+    }
+
+    static constexpr Mat4 rotationZ(float s, float c) {
+        return {{c, s, 0.0f, 0.0f, -s, c, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+                 1.0f}};
+    }
+
+    // Perspective projection like gluPerspective(), with the vertical field of view in radians
+    static Mat4 perspective(float vfov, float aspect, float znear, float zfar) {
+        return perspectiveFromFocal(1.0f / std::tan(vfov / 2.0f), aspect, znear, zfar);
+    }
+
+    // Rotations and projections for angles known at compile time. These are slow if they
+    // are called at run time, so use rotationX() etc for angles that change.
+    static constexpr Mat4 constRotationX(float angle) {
+        return rotationX(float(constmath::sin(angle)), float(constmath::cos(angle)));
+    }
+
+    static constexpr Mat4 constRotationY(float angle) {
+        return rotationY(float(constmath::sin(angle)), float(constmath::cos(angle)));
+    }
+
+    static constexpr Mat4 constRotationZ(float angle) {
+        return rotationZ(float(constmath::sin(angle)), float(constmath::cos(angle)));
+    }
+
+    static constexpr Mat4 constPerspective(float vfov, float aspect, float znear, float zfar) {
+        return perspectiveFromFocal(float(1.0 / constmath::tan(vfov / 2.0)), aspect, znear, zfar);
+    }
+
+    // Perspective projection with f = 1 / tan(vfov / 2) already computed
+    static constexpr Mat4 perspectiveFromFocal(float f, float aspect, float znear, float zfar) {
+        return {{f / aspect, 0.0f, 0.0f, 0.0f, 0.0f, f, 0.0f, 0.0f, 0.0f, 0.0f,
+                 -(zfar + znear) / (zfar - znear), -1.0f, 0.0f, 0.0f,
+                 -(2.0f * zfar * znear) / (zfar - znear), 0.0f}};
+    }
+
+    /*
+     * translation(tx, ty, tz) * rotationZ(rz) * rotationY(ry) * rotationX(rx) * scale(sx, sy, sz)
+     * computed directly, without any matrix multiplications.
+     */
+    static Mat4 trs(float tx, float ty, float tz, float rx, float ry, float rz, float sx,
+                    float sy, float sz) {
+        float sa, ca, sb, cb, sc, cc;
+        sincos(rx, sa, ca);
+        sincos(ry, sb, cb);
+        sincos(rz, sc, cc);
+        return {{sx * cc * cb, sx * sc * cb, -sx * sb, 0.0f,
+                 sy * (cc * sb * sa - sc * ca), sy * (sc * sb * sa + cc * ca), sy * cb * sa, 0.0f,
+                 sz * (cc * sb * ca + sc * sa), sz * (sc * sb * ca - cc * sa), sz * cb * ca, 0.0f,
+                 tx, ty, tz, 1.0f}};
+    }
+
+    // The matrix product a * b without SIMD, which can be computed at compile time
+    static constexpr Mat4 product(const Mat4& a, const Mat4& b) {
+        Mat4 result = {};
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) {
+                result.m[4 * c + r] = a.m[r] * b.m[4 * c] + a.m[4 + r] * b.m[4 * c + 1] +
+                                      a.m[8 + r] * b.m[4 * c + 2] + a.m[12 + r] * b.m[4 * c + 3];
+            }
+        }
+        return result;
+    }
+
+    void print() const {
+        printf("Matrix:\n");
+        for (int row = 0; row < 4; row++) {
+            printf("%6.2f %6.2f %6.2f %6.2f\n", m[row], m[4 + row], m[8 + row], m[12 + row]);
+        }
+    }
+};
+
+// The matrix product a * b (b is applied first)
+inline Mat4 operator*(const Mat4& a, const Mat4& b) {
+    Mat4 result;
+#if defined(TNM046_MAT4_SSE) && defined(__AVX__)
+    // Two columns of the result at a time, one in each 128 bit lane
+    const __m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a.m));
+    const __m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a.m + 4));
+    const __m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a.m + 8));
+    const __m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a.m + 12));
+    for (int c = 0; c < 4; c += 2) {
+        const __m256 bc = _mm256_loadu_ps(b.m + 4 * c);
+#if defined(__FMA__)
+        __m256 columns = _mm256_mul_ps(a0, _mm256_permute_ps(bc, 0x00));
+        columns = _mm256_fmadd_ps(a1, _mm256_permute_ps(bc, 0x55), columns);
+        columns = _mm256_fmadd_ps(a2, _mm256_permute_ps(bc, 0xAA), columns);
+        columns = _mm256_fmadd_ps(a3, _mm256_permute_ps(bc, 0xFF), columns);
+#else
+        const __m256 columns =
+            _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a0, _mm256_permute_ps(bc, 0x00)),
+                                        _mm256_mul_ps(a1, _mm256_permute_ps(bc, 0x55))),
+                          _mm256_add_ps(_mm256_mul_ps(a2, _mm256_permute_ps(bc, 0xAA)),
+                                        _mm256_mul_ps(a3, _mm256_permute_ps(bc, 0xFF))));
+#endif
+        _mm256_storeu_ps(result.m + 4 * c, columns);
+    }
+#elif defined(TNM046_MAT4_SSE)
+    const __m128 a0 = _mm_load_ps(a.m);
+    const __m128 a1 = _mm_load_ps(a.m + 4);
+    const __m128 a2 = _mm_load_ps(a.m + 8);
+    const __m128 a3 = _mm_load_ps(a.m + 12);
+    // Each column of the result is a linear combination of the columns of a
+    for (int c = 0; c < 4; c++) {
+        const float* bc = b.m + 4 * c;
+#if defined(__FMA__)
+        __m128 column = _mm_mul_ps(a0, _mm_set1_ps(bc[0]));
+        column = _mm_fmadd_ps(a1, _mm_set1_ps(bc[1]), column);
+        column = _mm_fmadd_ps(a2, _mm_set1_ps(bc[2]), column);
+        column = _mm_fmadd_ps(a3, _mm_set1_ps(bc[3]), column);
+#else
+        const __m128 column = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(bc[0])), _mm_mul_ps(a1, _mm_set1_ps(bc[1]))),
+            _mm_add_ps(_mm_mul_ps(a2, _mm_set1_ps(bc[2])), _mm_mul_ps(a3, _mm_set1_ps(bc[3]))));
+#endif
+        _mm_store_ps(result.m + 4 * c, column);
+    }
+#elif defined(TNM046_MAT4_NEON)
+    const float32x4_t a0 = vld1q_f32(a.m);
+    const float32x4_t a1 = vld1q_f32(a.m + 4);
+    const float32x4_t a2 = vld1q_f32(a.m + 8);
+    const float32x4_t a3 = vld1q_f32(a.m + 12);
+    for (int c = 0; c < 4; c++) {
+        const float* bc = b.m + 4 * c;
+        float32x4_t column = vmulq_n_f32(a0, bc[0]);
+        column = vmlaq_n_f32(column, a1, bc[1]);
+        column = vmlaq_n_f32(column, a2, bc[2]);
+        column = vmlaq_n_f32(column, a3, bc[3]);
+        vst1q_f32(result.m + 4 * c, column);
+    }
+#else
+    result = Mat4::product(a, b);
+#endif
+    return result;
+}
+
+/*
+ * Inverse of an affine matrix, one with a bottom row of 0 0 0 1 (rotation, scaling,
+ * shearing and translation, but no projection). The 3x3 part is inverted with cofactors,
+ * which is much cheaper than a general 4x4 inverse. A singular matrix gives zeros.
+ */
+inline Mat4 affineInverse(const Mat4& a) {
+    const float* m = a.m;
+    // Cofactors of the 3x3 part, transposed
+    const float c00 = m[5] * m[10] - m[9] * m[6];
+    const float c01 = m[9] * m[2] - m[1] * m[10];
+    const float c02 = m[1] * m[6] - m[5] * m[2];
+    const float c10 = m[8] * m[6] - m[4] * m[10];
+    const float c11 = m[0] * m[10] - m[8] * m[2];
+    const float c12 = m[4] * m[2] - m[0] * m[6];
+    const float c20 = m[4] * m[9] - m[8] * m[5];
+    const float c21 = m[8] * m[1] - m[0] * m[9];
+    const float c22 = m[0] * m[5] - m[4] * m[1];
+    const float det = m[0] * c00 + m[4] * c01 + m[8] * c02;
+    const float d = (det != 0.0f) ? 1.0f / det : 0.0f;
+
+    Mat4 result = {{c00 * d, c01 * d, c02 * d, 0.0f, c10 * d, c11 * d, c12 * d, 0.0f, c20 * d,
+                    c21 * d, c22 * d, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f}};
+    // The inverse translation is -inverse(3x3) * translation
+    for (int r = 0; r < 3; r++) {
+        result.m[12 + r] = -(result.m[r] * m[12] + result.m[4 + r] * m[13] +
+                             result.m[8 + r] * m[14]);
+    }
+    return result;
+}
@@ -0,0 +1,114 @@
+/*
+ * Phong materials in a uniform buffer
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "MaterialTable.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "GpuMemory.hpp"
+
+namespace {
+
+// Bytes of Ia, Id and Is before the materials in the block
+const size_t illuminationBytes = 3 * 4 * sizeof(float);
+
+}  // namespace
+
+MaterialTable::MaterialTable()
+    : illumination_{{0.5f, 0.5f, 0.5f, 0.0f}, {1.0f, 1.0f, 1.0f, 0.0f}, {1.0f, 1.0f, 1.0f, 0.0f}},
+      materials_(1), buffer_(0), illuminationdirty_(true), dirtyfirst_(0), dirtylast_(0) {}
+
+MaterialTable::~MaterialTable() {
+    if (buffer_ != 0) {
+        gpumem::deleteBuffers(1, &buffer_);
+    }
+}
+
+Material MaterialTable::phong(float r, float g, float b, float specular, float shininess) {
+    Material material;
+    const float color[3] = {r, g, b};
+    for (int c = 0; c < 3; c++) {
+        material.ambient[c] = color[c];
+        material.diffuse[c] = color[c];
+        material.specular[c] = specular;
+    }
+    material.shininess = shininess;
+    return material;
+}
+
+int MaterialTable::add(const Material& material) {
+    if (size() >= maxMaterials) {
+        std::cerr << "MaterialTable::add(): the table is full with " << maxMaterials
+                  << " materials\n";
+        return -1;
+    }
+    materials_.push_back(material);
+    set(size() - 1, material);
+    return size() - 1;
+}
+
+void MaterialTable::set(int index, const Material& material) {
+    if (index < 0 || index >= size()) {
+        std::cerr << "MaterialTable::set(): no material " << index << "\n";
+        return;
+    }
+    materials_[index] = material;
+    dirtyfirst_ = std::min(dirtyfirst_, index);
+    dirtylast_ = std::max(dirtylast_, index);
+}
+
+const Material& MaterialTable::get(int index) const {
+    return materials_[std::min(std::max(index, 0), size() - 1)];
+}
+
+int MaterialTable::size() const { return static_cast<int>(materials_.size()); }
+
+void MaterialTable::setIllumination(const float ambient[3], const float diffuse[3],
+                                    const float specular[3]) {
+    for (int c = 0; c < 3; c++) {
+        illumination_[0][c] = ambient[c];
+        illumination_[1][c] = diffuse[c];
+        illumination_[2][c] = specular[c];
+    }
+    illuminationdirty_ = true;
+}
+
+void MaterialTable::upload() {
+    const bool dirty = illuminationdirty_ || dirtyfirst_ <= dirtylast_;
+    if (buffer_ == 0) {
+        const size_t bytes = illuminationBytes + size_t(maxMaterials) * sizeof(Material);
+        glGenBuffers(1, &buffer_);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+        glBufferData(GL_UNIFORM_BUFFER, bytes, nullptr, GL_DYNAMIC_DRAW);
+        gpumem::setBuffer(buffer_, gpumem::Category::Buffer, bytes);
+    } else if (dirty) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+    }
+    if (illuminationdirty_) {
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, illuminationBytes, illumination_);
+    }
+    if (dirtyfirst_ <= dirtylast_) {
+        glBufferSubData(GL_UNIFORM_BUFFER, illuminationBytes + dirtyfirst_ * sizeof(Material),
+                        (dirtylast_ - dirtyfirst_ + 1) * sizeof(Material),
+                        materials_.data() + dirtyfirst_);
+    }
+    if (dirty) {
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    illuminationdirty_ = false;
+    dirtyfirst_ = maxMaterials;
+    dirtylast_ = -1;
+}
+
+void MaterialTable::bind(GLuint binding) const {
+    if (buffer_ == 0) {
+        std::cerr << "MaterialTable::bind(): upload() the table first\n";
+        return;
+    }
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer_);
+}
@@ -0,0 +1,80 @@
+/*
+ * The Phong materials of all objects in one uniform buffer, so that a draw picks its
+ * material by an index in its object data instead of by uniforms set before it.
+ *
+ * Usage: add() the materials once and give each draw the index that add() returns as the
+ *        material of its ObjectUniforms (UniformBuffers.hpp). Call upload() before drawing,
+ *        which sends the materials changed since the last upload, and bind() the table to
+ *        materialBlockBinding, where Shader connects the MaterialData block of
+ *        materials.glsl. fragment.glsl then shades with materials[material], so draws of
+ *        different materials need no state change between them, and the render queue sorts
+ *        them as it would draws of one material.
+ *        Material 0 is there from the start, the red of the lab exercises, and is what the
+ *        draws without a material of their own get. setIllumination() sets the ambient,
+ *        diffuse and specular intensities of the light, Ia, Id and Is, for all materials.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <vector>
+
+// A material of the MaterialData block, std140 layout
+struct Material {
+    float ambient[3] = {0.5f, 0.0f, 0.0f};  // ka
+    float shininess = 10.0f;                // n
+    float diffuse[3] = {0.5f, 0.0f, 0.0f};  // kd
+    float unused0 = 0.0f;
+    float specular[3] = {1.0f, 1.0f, 1.0f};  // ks
+    float unused1 = 0.0f;
+};
+
+static_assert(sizeof(Material) == 48, "Material must match the std140 layout");
+
+class MaterialTable {
+public:
+    /* Constructor: a table of the default material only */
+    MaterialTable();
+
+    /* Destructor: delete the buffer */
+    ~MaterialTable();
+
+    MaterialTable(const MaterialTable&) = delete;
+    MaterialTable& operator=(const MaterialTable&) = delete;
+
+    // Materials in the MaterialData block, as materials.glsl declares it
+    static constexpr int maxMaterials = 256;
+
+    // A material with ka = kd = (r, g, b), and a white highlight of 'specular' and 'shininess'
+    static Material phong(float r, float g, float b, float specular = 1.0f,
+                          float shininess = 10.0f);
+
+    // Add a material and return its index, -1 if the table is full
+    int add(const Material& material);
+
+    // Change the material at 'index'
+    void set(int index, const Material& material);
+    const Material& get(int index) const;
+
+    // Number of materials in the table
+    int size() const;
+
+    // The intensities of the light, in the same colors for all materials
+    void setIllumination(const float ambient[3], const float diffuse[3],
+                         const float specular[3]);
+
+    // Send the materials changed since the last upload to the GPU
+    void upload();
+
+    // Bind the table to the uniform block binding point 'binding'
+    void bind(GLuint binding) const;
+
+private:
+    float illumination_[3][4];  // Ia, Id and Is, the vec4 at the start of the block
+    std::vector<Material> materials_;
+    GLuint buffer_;           // The uniform buffer, created on first upload
+    bool illuminationdirty_;  // illumination_ is not uploaded yet
+    int dirtyfirst_;          // Range of materials not uploaded yet, empty if first > last
+    int dirtylast_;
+};
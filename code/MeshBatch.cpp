@@ -0,0 +1,571 @@
+/*
+ * Batched drawing of many meshes from shared buffers
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "MeshBatch.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "Frustum.hpp"
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "HiZBuffer.hpp"
+#include "Trace.hpp"
+#include "TriangleSoup.hpp"
+
+MeshBatch::MeshBatch()
+    : vao_(0)
+    , vertexbuffer_(0)
+    , indexbuffer_(0)
+    , instancebuffer_(0)
+    , indirectbuffer_(0)
+    , meshesdirty_(false)
+    , drawsdirty_(false)
+    , drawcalls_(0)
+    , visibledraws_(0)
+    , cullingdirty_(true)
+    , selectedbuffer_(0)
+    , cullcommandbuffer_(0)
+    , cullindexbuffer_(0)
+    , boundsbuffer_(0)
+    , visibilitybuffer_(0)
+    , proxyvao_(0)
+    , proxybuffers_{0, 0} {}
+
+MeshBatch::~MeshBatch() { clean(); }
+
+void MeshBatch::clean() {
+    GLuint arrays[] = {vao_, proxyvao_};
+    for (GLuint array : arrays) {
+        if (glIsVertexArray(array)) {
+            glstate::deleteVertexArrays(1, &array);
+        }
+    }
+    GLuint buffers[] = {vertexbuffer_,    indexbuffer_,       instancebuffer_, indirectbuffer_,
+                        selectedbuffer_,  cullcommandbuffer_, cullindexbuffer_, boundsbuffer_,
+                        visibilitybuffer_, proxybuffers_[0],  proxybuffers_[1]};
+    for (GLuint buffer : buffers) {
+        if (glIsBuffer(buffer)) {
+            gpumem::deleteBuffers(1, &buffer);
+        }
+    }
+    if (!queries_.empty()) {
+        glDeleteQueries(static_cast<GLsizei>(queries_.size()), queries_.data());
+    }
+    vao_ = 0;
+    vertexbuffer_ = 0;
+    indexbuffer_ = 0;
+    instancebuffer_ = 0;
+    indirectbuffer_ = 0;
+    selectedbuffer_ = 0;
+    cullcommandbuffer_ = 0;
+    cullindexbuffer_ = 0;
+    boundsbuffer_ = 0;
+    visibilitybuffer_ = 0;
+    proxyvao_ = 0;
+    proxybuffers_[0] = proxybuffers_[1] = 0;
+    queries_.clear();
+    meshesdirty_ = false;
+    drawsdirty_ = false;
+    drawcalls_ = 0;
+    visibledraws_ = 0;
+    vertexarray_.clear();
+    indexarray_.clear();
+    meshes_.clear();
+    clearDraws();
+}
+
+int MeshBatch::addMesh(const TriangleSoup& mesh) {
+    if (mesh.vertices().empty() || mesh.indices().empty()) {
+        std::cerr << "MeshBatch::addMesh(): the mesh has no CPU side data\n";
+        return -1;
+    }
+    MeshRange range;
+    range.firstindex = static_cast<GLuint>(indexarray_.size());
+    range.numindices = static_cast<GLuint>(mesh.indices().size());
+    range.basevertex = static_cast<GLint>(vertexarray_.size() / 8);
+    range.bounds = mesh.bounds();
+    vertexarray_.insert(vertexarray_.end(), mesh.vertices().begin(), mesh.vertices().end());
+    indexarray_.insert(indexarray_.end(), mesh.indices().begin(), mesh.indices().end());
+    meshes_.push_back(range);
+    meshesdirty_ = true;
+    return static_cast<int>(meshes_.size()) - 1;
+}
+
+void MeshBatch::addDraw(int mesh, const GLfloat* matrix) {
+    if (mesh < 0 || mesh >= static_cast<int>(meshes_.size())) {
+        std::cerr << "MeshBatch::addDraw(): no mesh number " << mesh << "\n";
+        return;
+    }
+    draws_.push_back({mesh, static_cast<int>(draws_.size())});
+    matrices_.insert(matrices_.end(), matrix, matrix + 16);
+    drawsdirty_ = true;
+    cullingdirty_ = true;
+}
+
+void MeshBatch::clearDraws() {
+    draws_.clear();
+    matrices_.clear();
+    sortedmatrices_.clear();
+    commands_.clear();
+    commandmeshes_.clear();
+    drawsdirty_ = true;
+    cullingdirty_ = true;
+}
+
+bool MeshBatch::usesIndirect() const { return GLEW_VERSION_4_3 != 0; }
+
+int MeshBatch::drawCalls() const { return drawcalls_; }
+
+int MeshBatch::visibleDraws() const { return visibledraws_; }
+
+void MeshBatch::uploadMeshes() {
+    if (vao_ == 0) {
+        glGenVertexArrays(1, &vao_);
+        glGenBuffers(1, &vertexbuffer_);
+        glGenBuffers(1, &indexbuffer_);
+        glGenBuffers(1, &instancebuffer_);
+    }
+    glstate::bindVertexArray(vao_);
+
+    // Same vertex layout as TriangleSoup::upload(), in the float format
+    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer_);
+    glBufferData(GL_ARRAY_BUFFER, vertexarray_.size() * sizeof(GLfloat), vertexarray_.data(),
+                 GL_STATIC_DRAW);
+    gpumem::setBuffer(vertexbuffer_, gpumem::Category::Mesh, vertexarray_.size() * sizeof(GLfloat));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (void*)0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
+                          (void*)(3 * sizeof(GLfloat)));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
+                          (void*)(6 * sizeof(GLfloat)));
+
+    // One model-view matrix per instance at attributes 5 to 8, as TriangleSoup::renderInstanced()
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer_);
+    for (int column = 0; column < 4; column++) {
+        const GLuint location = 5 + column;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat),
+                              (void*)(4 * column * sizeof(GLfloat)));
+        glVertexAttribDivisor(location, 1);
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer_);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexarray_.size() * sizeof(GLuint), indexarray_.data(),
+                 GL_STATIC_DRAW);
+    gpumem::setBuffer(indexbuffer_, gpumem::Category::Mesh, indexarray_.size() * sizeof(GLuint));
+
+    glstate::bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    meshesdirty_ = false;
+}
+
+void MeshBatch::buildCommands(const Mat4* P) {
+    TRACE_SCOPE("build draw commands");
+    // Counting sort of the draws by mesh. The sort is stable, so draws of the same mesh
+    // keep their queue order.
+    std::vector<int> start(meshes_.size() + 1, 0);
+    for (const Draw& draw : draws_) {
+        start[draw.mesh + 1]++;
+    }
+    for (size_t m = 0; m < meshes_.size(); m++) {
+        start[m + 1] += start[m];
+    }
+
+    sortedmatrices_.resize(matrices_.size());
+    std::vector<int> fill(start.begin(), start.end() - 1);
+    for (const Draw& draw : draws_) {
+        std::copy_n(&matrices_[16 * size_t(draw.order)], 16,
+                    &sortedmatrices_[16 * size_t(fill[draw.mesh]++)]);
+    }
+
+    // All visible draws of a mesh become the instances of one command. Culled draws are
+    // removed by moving the visible matrices down over them.
+    commands_.clear();
+    commandmeshes_.clear();
+    std::vector<int> visible(P ? draws_.size() : 0);
+    int numdraws = 0;
+    for (size_t m = 0; m < meshes_.size(); m++) {
+        const int count = start[m + 1] - start[m];
+        GLfloat* matrices = &sortedmatrices_[16 * size_t(start[m])];
+        int numvisible = count;
+        if (P && count > 0) {
+            numvisible = cullInstances(*P, meshes_[m].bounds, matrices, count, visible.data());
+            for (int k = 0; k < numvisible; k++) {
+                std::copy_n(matrices + 16 * size_t(visible[k]), 16,
+                            &sortedmatrices_[16 * size_t(numdraws + k)]);
+            }
+        } else if (numdraws != start[m]) {
+            std::copy_n(matrices, 16 * size_t(count), &sortedmatrices_[16 * size_t(numdraws)]);
+        }
+        if (numvisible > 0) {
+            commands_.push_back({meshes_[m].numindices, static_cast<GLuint>(numvisible),
+                                 meshes_[m].firstindex, meshes_[m].basevertex,
+                                 static_cast<GLuint>(numdraws)});
+            commandmeshes_.push_back(static_cast<int>(m));
+        }
+        numdraws += numvisible;
+    }
+    sortedmatrices_.resize(16 * size_t(numdraws));
+    visibledraws_ = numdraws;
+
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer_);
+    glBufferData(GL_ARRAY_BUFFER, sortedmatrices_.size() * sizeof(GLfloat),
+                 sortedmatrices_.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    gpumem::setBuffer(instancebuffer_, gpumem::Category::Mesh,
+                      sortedmatrices_.size() * sizeof(GLfloat));
+
+    if (usesIndirect()) {
+        if (indirectbuffer_ == 0) {
+            glGenBuffers(1, &indirectbuffer_);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectbuffer_);
+        const size_t bytes = commands_.size() * sizeof(DrawElementsIndirectCommand);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, bytes, commands_.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        gpumem::setBuffer(indirectbuffer_, gpumem::Category::Buffer, bytes);
+    }
+    drawsdirty_ = false;
+}
+
+void MeshBatch::render() {
+    if (meshesdirty_) {
+        uploadMeshes();
+    }
+    if (drawsdirty_) {
+        buildCommands(nullptr);
+    }
+    draw();
+}
+
+void MeshBatch::render(const Mat4& P) {
+    if (meshesdirty_) {
+        uploadMeshes();
+    }
+    buildCommands(&P);
+    // The commands are only valid for this P, so render() must build them again
+    drawsdirty_ = true;
+    draw();
+}
+
+void MeshBatch::draw() {
+    drawcalls_ = 0;
+    if (commands_.empty()) {
+        return;
+    }
+
+    glstate::bindVertexArray(vao_);
+    // Float vertices: no position decoding, as in TriangleSoup::bindForDrawing()
+    glVertexAttrib4f(3, 1.0f, 1.0f, 1.0f, 0.0f);
+    glVertexAttrib3f(4, 0.0f, 0.0f, 0.0f);
+
+    if (usesIndirect()) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectbuffer_);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0,
+                                    static_cast<GLsizei>(commands_.size()), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        drawcalls_ = 1;
+    } else {
+        // Without base instances (OpenGL 4.2), point the matrix attributes at the first
+        // instance of each command instead. That is the only state change between draws.
+        for (const DrawElementsIndirectCommand& command : commands_) {
+            setInstancePointers(instancebuffer_,
+                                size_t(command.baseInstance) * 16 * sizeof(GLfloat));
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(command.count),
+                                              GL_UNSIGNED_INT,
+                                              (void*)(command.firstIndex * sizeof(GLuint)),
+                                              static_cast<GLsizei>(command.instanceCount),
+                                              command.baseVertex);
+            drawcalls_++;
+        }
+    }
+    glstate::bindVertexArray(0);
+}
+
+void MeshBatch::setInstancePointers(GLuint buffer, size_t offset) {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (int column = 0; column < 4; column++) {
+        glVertexAttribPointer(5 + column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat),
+                              (void*)(offset + 4 * column * sizeof(GLfloat)));
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void MeshBatch::renderOcclusionCulled(const Mat4& P, HiZBuffer& hiz) {
+    if (meshesdirty_) {
+        uploadMeshes();
+    }
+    if (!usesIndirect()) {
+        renderWithQueries(P);
+        return;
+    }
+    if (drawsdirty_) {
+        buildCommands(nullptr);
+    }
+    // The sorted order only changes with the queue, so the visibility stays valid
+    // across render() calls
+    if (cullingdirty_) {
+        uploadCullingData();
+    }
+    drawcalls_ = 0;
+    visibledraws_ = -1;
+    if (commands_.empty()) {
+        return;
+    }
+
+    // Phase 0 draws the draws that were visible in the last frame, which are most likely
+    // still visible and occlude most of the rest. Phase 1 tests everything against the
+    // depth that gives, and draws the rest of what is visible now.
+    GLint program;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    selectDraws(0, P, hiz);
+    glstate::useProgram(program);
+    drawSelected();
+    hiz.build();
+    selectDraws(1, P, hiz);
+    glstate::useProgram(program);
+    drawSelected();
+}
+
+void MeshBatch::uploadCullingData() {
+    if (cullshader_.id() == 0) {
+        cullshader_.createComputeShader("compute_occlusion.glsl");
+        GLuint buffers[5];
+        glGenBuffers(5, buffers);
+        selectedbuffer_ = buffers[0];
+        cullcommandbuffer_ = buffers[1];
+        cullindexbuffer_ = buffers[2];
+        boundsbuffer_ = buffers[3];
+        visibilitybuffer_ = buffers[4];
+    }
+
+    std::vector<GLuint> commandindex;
+    std::vector<GLfloat> bounds;
+    for (size_t c = 0; c < commands_.size(); c++) {
+        commandindex.insert(commandindex.end(), commands_[c].instanceCount, GLuint(c));
+        const mesh::Bounds& box = meshes_[commandmeshes_[c]].bounds;
+        const GLfloat corners[] = {box.min[0], box.min[1], box.min[2], 1.0f,
+                                   box.max[0], box.max[1], box.max[2], 1.0f};
+        bounds.insert(bounds.end(), corners, corners + 8);
+    }
+    // Until the first test, everything counts as visible
+    const std::vector<GLuint> visibility(commandindex.size(), 1);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, selectedbuffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sortedmatrices_.size() * sizeof(GLfloat), nullptr,
+                 GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullcommandbuffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 commands_.size() * sizeof(DrawElementsIndirectCommand), nullptr,
+                 GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullindexbuffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, commandindex.size() * sizeof(GLuint),
+                 commandindex.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsbuffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(GLfloat), bounds.data(),
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibilitybuffer_);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, visibility.size() * sizeof(GLuint),
+                 visibility.data(), GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    gpumem::setBuffer(selectedbuffer_, gpumem::Category::Buffer,
+                      sortedmatrices_.size() * sizeof(GLfloat));
+    gpumem::setBuffer(cullcommandbuffer_, gpumem::Category::Buffer,
+                      commands_.size() * sizeof(DrawElementsIndirectCommand));
+    gpumem::setBuffer(cullindexbuffer_, gpumem::Category::Buffer,
+                      commandindex.size() * sizeof(GLuint));
+    gpumem::setBuffer(boundsbuffer_, gpumem::Category::Buffer, bounds.size() * sizeof(GLfloat));
+    gpumem::setBuffer(visibilitybuffer_, gpumem::Category::Buffer,
+                      visibility.size() * sizeof(GLuint));
+    cullingdirty_ = false;
+}
+
+void MeshBatch::selectDraws(int phase, const Mat4& P, const HiZBuffer& hiz) {
+    // The commands start without instances, and the compute shader adds the selected ones
+    std::vector<DrawElementsIndirectCommand> commands(commands_);
+    for (DrawElementsIndirectCommand& command : commands) {
+        command.instanceCount = 0;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullcommandbuffer_);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                    commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instancebuffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, selectedbuffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cullcommandbuffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, cullindexbuffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, boundsbuffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, visibilitybuffer_);
+
+    const GLuint numdraws = static_cast<GLuint>(sortedmatrices_.size() / 16);
+    cullshader_.use();
+    cullshader_.setUniformMatrix("P", P.m);
+    cullshader_.setUniform("phase", phase);
+    cullshader_.setUniform("numDraws", numdraws);
+    cullshader_.setUniform("hiz", 0);
+
+    GLint activetexture, texture;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &activetexture);
+    glstate::activeTexture(GL_TEXTURE0);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    glstate::bindTexture(GL_TEXTURE_2D, hiz.texture());
+    glDispatchCompute((numdraws + 63) / 64, 1, 1);
+    glstate::bindTexture(GL_TEXTURE_2D, texture);
+    glstate::activeTexture(activetexture);
+
+    // The draw reads the commands and matrices the compute shader wrote
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+                    GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void MeshBatch::drawSelected() {
+    glstate::bindVertexArray(vao_);
+    glVertexAttrib4f(3, 1.0f, 1.0f, 1.0f, 0.0f);
+    glVertexAttrib3f(4, 0.0f, 0.0f, 0.0f);
+    setInstancePointers(selectedbuffer_, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, cullcommandbuffer_);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)0,
+                                static_cast<GLsizei>(commands_.size()), 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    setInstancePointers(instancebuffer_, 0);
+    glstate::bindVertexArray(0);
+    drawcalls_++;
+}
+
+void MeshBatch::renderWithQueries(const Mat4& P) {
+    // Frustum culling on the CPU first, as in render(P), so only the draws in view are
+    // queried
+    buildCommands(&P);
+    drawsdirty_ = true;
+    drawcalls_ = 0;
+    if (commands_.empty()) {
+        return;
+    }
+
+    if (proxyvao_ == 0) {
+        // Unit cube from (0,0,0) to (1,1,1), scaled to each box by the position decoding
+        // attributes 3 and 4 of vertex_instanced.glsl
+        const GLfloat corners[] = {0, 0, 0, 1, 0, 0, 0, 1, 0, 1, 1, 0,
+                                   0, 0, 1, 1, 0, 1, 0, 1, 1, 1, 1, 1};
+        const GLubyte faces[] = {0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4,
+                                 2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5};
+        glGenVertexArrays(1, &proxyvao_);
+        glGenBuffers(2, proxybuffers_);
+        glstate::bindVertexArray(proxyvao_);
+        glBindBuffer(GL_ARRAY_BUFFER, proxybuffers_[0]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (void*)0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, proxybuffers_[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+        gpumem::setBuffer(proxybuffers_[0], gpumem::Category::Mesh, sizeof(corners));
+        gpumem::setBuffer(proxybuffers_[1], gpumem::Category::Mesh, sizeof(faces));
+        for (int column = 0; column < 4; column++) {
+            glEnableVertexAttribArray(5 + column);
+            glVertexAttribDivisor(5 + column, 1);
+        }
+        glstate::bindVertexArray(0);
+    }
+    const size_t numdraws = sortedmatrices_.size() / 16;
+    if (queries_.size() < numdraws) {
+        const size_t first = queries_.size();
+        queries_.resize(numdraws);
+        glGenQueries(static_cast<GLsizei>(numdraws - first), &queries_[first]);
+    }
+
+    // Front to back, so that the nearest draws occlude the ones behind them
+    struct Item {
+        float depth;  // View space z of the box center, larger is nearer
+        int draw;
+        int command;
+        bool query;  // False if the eye may be inside the box, where its faces are clipped
+    };
+    // Distance to the near plane of a perspective P
+    const float nearplane = P.m[14] / (P.m[10] - 1.0f);
+    std::vector<Item> items;
+    items.reserve(numdraws);
+    for (size_t c = 0; c < commands_.size(); c++) {
+        const mesh::Bounds& bounds = meshes_[commandmeshes_[c]].bounds;
+        const float* center = bounds.center;
+        for (GLuint k = 0; k < commands_[c].instanceCount; k++) {
+            const int draw = static_cast<int>(commands_[c].baseInstance + k);
+            const GLfloat* m = &sortedmatrices_[16 * size_t(draw)];
+            float view[3], scale = 0.0f;
+            for (int i = 0; i < 3; i++) {
+                view[i] = m[i] * center[0] + m[4 + i] * center[1] + m[8 + i] * center[2] +
+                          m[12 + i];
+                const float* column = m + 4 * i;
+                scale = std::max(scale, column[0] * column[0] + column[1] * column[1] +
+                                            column[2] * column[2]);
+            }
+            const float reach = bounds.radius * std::sqrt(scale) + std::fabs(nearplane);
+            const bool query =
+                view[0] * view[0] + view[1] * view[1] + view[2] * view[2] > reach * reach;
+            items.push_back({view[2], draw, static_cast<int>(c), query});
+        }
+    }
+    std::sort(items.begin(), items.end(),
+              [](const Item& a, const Item& b) { return a.depth > b.depth; });
+
+    GLboolean colormask[4], depthmask;
+    glGetBooleanv(GL_COLOR_WRITEMASK, colormask);
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &depthmask);
+    const GLboolean cullface = glIsEnabled(GL_CULL_FACE);
+
+    for (size_t k = 0; k < items.size(); k++) {
+        const DrawElementsIndirectCommand& command = commands_[items[k].command];
+        const mesh::Bounds& box = meshes_[commandmeshes_[items[k].command]].bounds;
+        const size_t offset = size_t(items[k].draw) * 16 * sizeof(GLfloat);
+
+        // The bounding box, without writing anything, counts the samples in front
+        if (items[k].query) {
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glDepthMask(GL_FALSE);
+            glDisable(GL_CULL_FACE);  // Back faces count too, where the near plane cuts the box
+            glstate::bindVertexArray(proxyvao_);
+            setInstancePointers(instancebuffer_, offset);
+            glVertexAttrib4f(3, box.max[0] - box.min[0], box.max[1] - box.min[1],
+                             box.max[2] - box.min[2], 0.0f);
+            glVertexAttrib3f(4, box.min[0], box.min[1], box.min[2]);
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, queries_[k]);
+            glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, (void*)0, 1);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+            glColorMask(colormask[0], colormask[1], colormask[2], colormask[3]);
+            glDepthMask(depthmask);
+            if (cullface) {
+                glEnable(GL_CULL_FACE);
+            }
+        }
+
+        // The mesh itself, only if some sample of the box passed
+        glstate::bindVertexArray(vao_);
+        setInstancePointers(instancebuffer_, offset);
+        glVertexAttrib4f(3, 1.0f, 1.0f, 1.0f, 0.0f);
+        glVertexAttrib3f(4, 0.0f, 0.0f, 0.0f);
+        if (items[k].query) {
+            glBeginConditionalRender(queries_[k], GL_QUERY_WAIT);
+        }
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(command.count),
+                                          GL_UNSIGNED_INT,
+                                          (void*)(command.firstIndex * sizeof(GLuint)), 1,
+                                          command.baseVertex);
+        if (items[k].query) {
+            glEndConditionalRender();
+            drawcalls_++;
+        }
+        drawcalls_++;
+    }
+    glstate::bindVertexArray(vao_);
+    setInstancePointers(instancebuffer_, 0);
+    glstate::bindVertexArray(0);
+}
@@ -0,0 +1,161 @@
+/*
+ * A class to draw many different meshes with few draw calls.
+ *
+ * Usage: Add meshes with addMesh(). Their vertices and indices are copied into one shared
+ *        vertex buffer and one shared index buffer with a single VAO, so no VAO changes are
+ *        needed between meshes. Queue draws with addDraw(), each with its own model-view matrix,
+ *        and call render() with the shader vertex_instanced.glsl in use. The queue is kept
+ *        until clearDraws(), so a static scene only needs to be queued once.
+ *        With OpenGL 4.3, render() submits all draws with one glMultiDrawElementsIndirect().
+ *        Otherwise it issues one instanced draw per mesh.
+ *        render(P) also skips the draws whose bounding spheres are outside the view frustum
+ *        of the projection P.
+ *        renderOcclusionCulled(P, hiz) also skips the draws hidden behind others. With
+ *        OpenGL 4.3 it first draws what was visible in the last frame, builds the Hi-Z
+ *        pyramid from that depth, and then a compute shader (compute_occlusion.glsl) tests
+ *        the bounding box of every draw against it and adds the newly visible ones in a
+ *        second indirect draw. Nothing is read back to the CPU.
+ *        With OpenGL 3.3 each draw is instead tested with a GL_ANY_SAMPLES_PASSED query of
+ *        its bounding box, front to back, and drawn with conditional rendering.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <vector>
+
+#include "Mat4.hpp"
+#include "MeshProcessing.hpp"
+#include "Shader.hpp"
+
+class HiZBuffer;
+class TriangleSoup;
+
+class MeshBatch {
+public:
+    /* Constructor: create an empty batch */
+    MeshBatch();
+
+    /* Destructor: delete the GL objects */
+    ~MeshBatch();
+
+    MeshBatch(const MeshBatch&) = delete;
+    MeshBatch& operator=(const MeshBatch&) = delete;
+
+    /* Delete all meshes, draws and GL objects */
+    void clean();
+
+    /* Copy the geometry of a mesh into the batch. Returns the mesh number to use with
+     * addDraw(), or -1 if the mesh has no CPU side data (as after readBinary()). */
+    int addMesh(const TriangleSoup& mesh);
+
+    /* Queue a draw of mesh number 'mesh' with a model-view matrix of 16 floats,
+     * column major */
+    void addDraw(int mesh, const GLfloat* matrix);
+
+    /* Remove all queued draws, but keep the meshes */
+    void clearDraws();
+
+    /* Draw everything in the queue */
+    void render();
+
+    /* Draw the queued draws that are inside the view frustum of the projection P. The
+     * culling is done on the CPU every frame, with cullInstances(). */
+    void render(const Mat4& P);
+
+    /* Draw the queued draws that are inside the view frustum of P and not hidden behind
+     * other draws. 'hiz' is rebuilt from the depth buffer in between the two passes, so
+     * this must be called with the depth buffer cleared and nothing else drawn yet that
+     * should not occlude. Visibility is remembered between calls until the queue changes. */
+    void renderOcclusionCulled(const Mat4& P, HiZBuffer& hiz);
+
+    // True if render() uses glMultiDrawElementsIndirect()
+    bool usesIndirect() const;
+
+    // Number of GL draw calls made by the last render()
+    int drawCalls() const;
+
+    // Number of queued draws that were drawn by the last render(), after culling.
+    // -1 after renderOcclusionCulled() with OpenGL 4.3, where the count stays on the GPU.
+    int visibleDraws() const;
+
+private:
+    // Layout of GL_DRAW_INDIRECT_BUFFER commands, as defined by OpenGL
+    struct DrawElementsIndirectCommand {
+        GLuint count;          // Number of indices
+        GLuint instanceCount;  // Number of instances
+        GLuint firstIndex;     // First index in the index buffer
+        GLint baseVertex;      // Added to each index
+        GLuint baseInstance;   // First instance, for the instanced attributes
+    };
+
+    struct MeshRange {
+        GLuint firstindex;  // First index of the mesh in indexarray_
+        GLuint numindices;  // Number of indices of the mesh
+        GLint basevertex;   // First vertex of the mesh in vertexarray_
+        mesh::Bounds bounds;
+    };
+
+    struct Draw {
+        int mesh;
+        int order;  // Position in the queue, to keep the queue order within each mesh
+    };
+
+    // Send the meshes to OpenGL if they changed since the last render()
+    void uploadMeshes();
+
+    // Sort the queued draws by mesh and build one command per mesh, without the draws
+    // outside the view frustum of P if it is not null
+    void buildCommands(const Mat4* P);
+
+    // Draw the commands
+    void draw();
+
+    // Point the matrix attributes of the bound VAO at 'offset' bytes into 'buffer'
+    void setInstancePointers(GLuint buffer, size_t offset);
+
+    // Send the per draw data of the compute shader, and mark all draws as visible
+    void uploadCullingData();
+
+    // Run one phase of compute_occlusion.glsl into cullcommandbuffer_ and selectedbuffer_
+    void selectDraws(int phase, const Mat4& P, const HiZBuffer& hiz);
+
+    // Draw the commands in cullcommandbuffer_ with the matrices in selectedbuffer_
+    void drawSelected();
+
+    // The OpenGL 3.3 version of renderOcclusionCulled(), with occlusion queries
+    void renderWithQueries(const Mat4& P);
+
+    GLuint vao_;                         // Vertex array object of the shared buffers
+    GLuint vertexbuffer_;                // Shared vertex buffer, same format as TriangleSoup
+    GLuint indexbuffer_;                 // Shared index buffer
+    GLuint instancebuffer_;              // Matrices of all draws, sorted by mesh
+    GLuint indirectbuffer_;              // Draw commands for glMultiDrawElementsIndirect()
+    bool meshesdirty_;                   // True if meshes were added since the last upload
+    bool drawsdirty_;                    // True if draws were queued since the last render()
+    int drawcalls_;                      // Number of GL draw calls in the last render()
+    int visibledraws_;                   // Number of draws in the commands
+    std::vector<GLfloat> vertexarray_;   // All vertices, 8 floats per vertex
+    std::vector<GLuint> indexarray_;     // All indices, relative to the first vertex of each mesh
+    std::vector<MeshRange> meshes_;      // Location of each mesh in the shared arrays
+    std::vector<Draw> draws_;            // Queued draws
+    std::vector<GLfloat> matrices_;      // Matrices of the queued draws, in queue order
+
+    // Built from the queue by buildCommands()
+    std::vector<GLfloat> sortedmatrices_;                // Matrices sorted by mesh
+    std::vector<DrawElementsIndirectCommand> commands_;  // One command per drawn mesh
+    std::vector<int> commandmeshes_;                     // Mesh number of each command
+
+    // Occlusion culling, created on the first renderOcclusionCulled()
+    bool cullingdirty_;         // True if the draws changed since uploadCullingData()
+    Shader cullshader_;         // compute_occlusion.glsl
+    GLuint selectedbuffer_;     // Matrices of the draws selected by the compute shader
+    GLuint cullcommandbuffer_;  // commands_ with the instance counts of the selected draws
+    GLuint cullindexbuffer_;    // Command number of each sorted draw
+    GLuint boundsbuffer_;       // Bounding box of each command, min and max as vec4
+    GLuint visibilitybuffer_;   // 1 for each sorted draw that was visible in the last frame
+    GLuint proxyvao_;           // Unit cube for the occlusion queries with OpenGL 3.3
+    GLuint proxybuffers_[2];    // Vertices and indices of the cube
+    std::vector<GLuint> queries_;  // One GL_ANY_SAMPLES_PASSED query per draw
+};
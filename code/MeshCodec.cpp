@@ -0,0 +1,726 @@
+/*
+ * Decoders and encoders for the compressed vertex and index buffers of meshoptimizer
+ *
+ * This code is in the public domain.
+ */
+#include "MeshCodec.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace meshcodec {
+
+namespace {
+
+// The first byte of each format, with the version in the low four bits
+constexpr unsigned char vertexHeader = 0xA0;
+constexpr unsigned char indexHeader = 0xE0;
+constexpr unsigned char sequenceHeader = 0xD0;
+
+// Vertices are coded in blocks of at most this many bytes and vertices, and each byte of
+// the vertices of a block in groups of 16
+constexpr size_t vertexBlockBytes = 8192;
+constexpr size_t vertexBlockMaxSize = 256;
+constexpr size_t byteGroupSize = 16;
+// The most bytes a group can read, which the end of the data must leave room for
+constexpr size_t byteGroupDecodeLimit = 24;
+// Bits per byte of a group, by the 2 bit code in the header
+constexpr int groupBits[4] = {0, 2, 4, 8};
+// The vertex data ends with the first vertex, padded to at least this many bytes
+constexpr size_t vertexTailMinSize = 32;
+
+size_t vertexBlockSize(size_t size) {
+    const size_t count = (vertexBlockBytes / size) & ~(byteGroupSize - 1);
+    return count < vertexBlockMaxSize ? count : vertexBlockMaxSize;
+}
+
+unsigned char unzigzag8(unsigned char v) {
+    return static_cast<unsigned char>(-(v & 1) ^ (v >> 1));
+}
+
+/* Decode a group of 16 bytes with 'bits' bits each, 2 or 4. A value with all bits set is an
+ * escape, and the byte follows after the packed values. The bits are a template parameter
+ * so that the loops unroll. */
+template <int bits>
+const unsigned char* decodePackedGroup(const unsigned char* data, unsigned char* group) {
+    constexpr unsigned int mask = (1u << bits) - 1;
+    constexpr int perbyte = 8 / bits;
+    const unsigned char* escapes = data + byteGroupSize / perbyte;
+    for (size_t i = 0; i < byteGroupSize; i += perbyte) {
+        const unsigned int byte = *data++;
+        for (int k = 0; k < perbyte; k++) {
+            // The first value is in the high bits
+            const unsigned int value = (byte >> (8 - bits * (k + 1))) & mask;
+            const unsigned char escape = *escapes;
+            group[i + k] = (value == mask) ? escape : static_cast<unsigned char>(value);
+            escapes += (value == mask) ? 1 : 0;
+        }
+    }
+    return escapes;
+}
+
+// Decode a group of 16 bytes with 'bits' bits each, 0, 2, 4 or 8
+const unsigned char* decodeBytesGroup(const unsigned char* data, unsigned char* group,
+                                      int bits) {
+    if (bits == 0) {
+        std::memset(group, 0, byteGroupSize);
+        return data;
+    }
+    if (bits == 8) {
+        std::memcpy(group, data, byteGroupSize);
+        return data + byteGroupSize;
+    }
+    return (bits == 2) ? decodePackedGroup<2>(data, group) : decodePackedGroup<4>(data, group);
+}
+
+/* Decode 'count' bytes, a multiple of 16, after a header of 2 bits per group for its
+ * number of bits. Null if the data ends too early. */
+const unsigned char* decodeBytes(const unsigned char* data, const unsigned char* end,
+                                 unsigned char* bytes, size_t count) {
+    const unsigned char* header = data;
+    const size_t headersize = (count / byteGroupSize + 3) / 4;
+    if (size_t(end - data) < headersize) {
+        return nullptr;
+    }
+    data += headersize;
+    for (size_t i = 0; i < count; i += byteGroupSize) {
+        if (size_t(end - data) < byteGroupDecodeLimit) {
+            return nullptr;
+        }
+        const size_t group = i / byteGroupSize;
+        const int bitslog2 = (header[group / 4] >> ((group % 4) * 2)) & 3;
+        data = decodeBytesGroup(data, bytes + i, groupBits[bitslog2]);
+    }
+    return data;
+}
+
+/* Decode a block of 'count' vertices: each of the 'size' bytes of the vertices as the deltas
+ * from the same byte of the vertex before, zigzag coded. 'last' is the last vertex of the
+ * block before, and becomes the last one of this block. */
+const unsigned char* decodeVertexBlock(const unsigned char* data, const unsigned char* end,
+                                       unsigned char* vertices, size_t count, size_t size,
+                                       unsigned char* last) {
+    unsigned char deltas[vertexBlockMaxSize];
+    const size_t alignedcount = (count + byteGroupSize - 1) & ~(byteGroupSize - 1);
+    for (size_t k = 0; k < size; k++) {
+        data = decodeBytes(data, end, deltas, alignedcount);
+        if (data == nullptr) {
+            return nullptr;
+        }
+        unsigned char p = last[k];
+        for (size_t i = 0; i < count; i++) {
+            p = static_cast<unsigned char>(unzigzag8(deltas[i]) + p);
+            vertices[i * size + k] = p;
+        }
+        last[k] = p;
+    }
+    return data;
+}
+
+unsigned int decodeVByte(const unsigned char*& data) {
+    const unsigned char lead = *data++;
+    if (lead < 128) {
+        return lead;
+    }
+    // Up to four more groups of 7 bits, the low bits first
+    unsigned int result = lead & 127;
+    unsigned int shift = 7;
+    for (int i = 0; i < 4; i++) {
+        const unsigned char group = *data++;
+        result |= unsigned(group & 127) << shift;
+        shift += 7;
+        if (group < 128) {
+            break;
+        }
+    }
+    return result;
+}
+
+unsigned int decodeIndex(const unsigned char*& data, unsigned int last) {
+    const unsigned int v = decodeVByte(data);
+    return last + ((v >> 1) ^ (0u - (v & 1)));
+}
+
+void writeIndex(void* indices, size_t i, size_t size, unsigned int index) {
+    if (size == 2) {
+        static_cast<uint16_t*>(indices)[i] = static_cast<uint16_t>(index);
+    } else {
+        static_cast<uint32_t*>(indices)[i] = index;
+    }
+}
+
+// The FIFOs of the triangle decoder, with the same updates as in the encoder
+struct TriangleFifos {
+    unsigned int edges[16][2];
+    unsigned int vertices[16];
+    unsigned int edgeoffset = 0;
+    unsigned int vertexoffset = 0;
+
+    TriangleFifos() {
+        std::memset(edges, 0xFF, sizeof(edges));
+        std::memset(vertices, 0xFF, sizeof(vertices));
+    }
+
+    void pushEdge(unsigned int a, unsigned int b) {
+        edges[edgeoffset][0] = a;
+        edges[edgeoffset][1] = b;
+        edgeoffset = (edgeoffset + 1) & 15;
+    }
+
+    void pushVertex(unsigned int v, bool push = true) {
+        vertices[vertexoffset] = v;
+        vertexoffset = (vertexoffset + (push ? 1 : 0)) & 15;
+    }
+
+    // The vertex 'back' entries before the newest one
+    unsigned int vertex(int back) const { return vertices[(vertexoffset - 1 - back) & 15]; }
+
+    /* For the encoder: how far back an edge of the triangle abc is, times 4, plus the
+     * rotation that puts it first. -1 if none of its edges is there. */
+    int findEdge(unsigned int a, unsigned int b, unsigned int c) const {
+        for (int i = 0; i < 16; i++) {
+            const unsigned int* edge = edges[(edgeoffset - 1 - i) & 15];
+            if (edge[0] == a && edge[1] == b) {
+                return i << 2;
+            }
+            if (edge[0] == b && edge[1] == c) {
+                return (i << 2) | 1;
+            }
+            if (edge[0] == c && edge[1] == a) {
+                return (i << 2) | 2;
+            }
+        }
+        return -1;
+    }
+
+    // For the encoder: how far back vertex v is, -1 if it is not there
+    int findVertex(unsigned int v) const {
+        for (int i = 0; i < 16; i++) {
+            if (vertex(i) == v) {
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+}  // namespace
+
+bool decodeVertexBuffer(void* vertices, size_t count, size_t size, const unsigned char* data,
+                        size_t bytes) {
+    if (size == 0 || size > 256 || size % 4 != 0 || bytes < 1 + size) {
+        return false;
+    }
+    const unsigned char* end = data + bytes;
+    if ((data[0] & 0xF0) != vertexHeader || (data[0] & 0x0F) > 0) {
+        return false;
+    }
+    data++;
+
+    unsigned char last[256];
+    std::memcpy(last, end - size, size);
+    unsigned char* out = static_cast<unsigned char*>(vertices);
+    const size_t blocksize = vertexBlockSize(size);
+    // Each block is put together here and copied out whole, so that the vertices are written
+    // in order, as a mapped buffer wants them
+    unsigned char block[vertexBlockBytes];
+    for (size_t first = 0; first < count; first += blocksize) {
+        const size_t blockcount = (count - first < blocksize) ? count - first : blocksize;
+        data = decodeVertexBlock(data, end, block, blockcount, size, last);
+        if (data == nullptr) {
+            return false;
+        }
+        std::memcpy(out + first * size, block, blockcount * size);
+    }
+    const size_t tailsize = size < vertexTailMinSize ? vertexTailMinSize : size;
+    return size_t(end - data) == tailsize;
+}
+
+bool decodeIndexBuffer(void* indices, size_t count, size_t size, const unsigned char* data,
+                       size_t bytes, unsigned int firstvertex) {
+    // At least the header, one code per triangle and the table of the codes 0xF0 to 0xFD
+    if (count % 3 != 0 || (size != 2 && size != 4) || bytes < 1 + count / 3 + 16) {
+        return false;
+    }
+    const int version = data[0] & 0x0F;
+    if ((data[0] & 0xF0) != indexHeader || version > 1) {
+        return false;
+    }
+    // Version 1 codes the indices next to the last free index, the codes 13 and 14
+    const int fecmax = version >= 1 ? 13 : 15;
+
+    const unsigned char* code = data + 1;
+    const unsigned char* extra = code + count / 3;
+    const unsigned char* extraend = data + bytes - 16;
+    const unsigned char* codetable = extraend;
+    TriangleFifos fifos;
+    unsigned int next = firstvertex;  // The next new vertex
+    unsigned int last = firstvertex;  // The last free index
+    for (size_t i = 0; i < count; i += 3) {
+        // A triangle reads at most 16 bytes of 'extra', which the table leaves room for
+        if (extra > extraend) {
+            return false;
+        }
+        const unsigned char codetri = *code++;
+        unsigned int a, b, c;
+        if (codetri < 0xF0) {
+            // An edge from the FIFO, and a new, a recent or a free third vertex
+            const int fe = codetri >> 4;
+            a = fifos.edges[(fifos.edgeoffset - 1 - fe) & 15][0];
+            b = fifos.edges[(fifos.edgeoffset - 1 - fe) & 15][1];
+            const int fec = codetri & 15;
+            if (fec < fecmax) {
+                c = (fec == 0) ? next++ : fifos.vertex(fec);
+                fifos.pushVertex(c, fec == 0);
+            } else {
+                // 13 and 14 are one before and after the last free index, 15 is coded
+                last = c = (fec != 15) ? last + (fec - (fec ^ 3)) : decodeIndex(extra, last);
+                fifos.pushVertex(c);
+            }
+            fifos.pushEdge(c, b);
+            fifos.pushEdge(a, c);
+        } else {
+            // A triangle without a known edge: the codes of b and c from the table, or with
+            // 0xFE and 0xFF from the next byte, for a new or a free a
+            const bool table = codetri < 0xFE;
+            const unsigned char codeaux = table ? codetable[codetri & 15] : *extra++;
+            const int fea = (codetri == 0xFF) ? 15 : 0;
+            const int feb = codeaux >> 4;
+            const int fec = codeaux & 15;
+            // A zero code that is not from the table starts a new range of vertices
+            if (!table && codeaux == 0) {
+                next = 0;
+            }
+            a = (fea == 0) ? next++ : 0;
+            b = (feb == 0) ? next++ : fifos.vertices[(fifos.vertexoffset - feb) & 15];
+            c = (fec == 0) ? next++ : fifos.vertices[(fifos.vertexoffset - fec) & 15];
+            if (fea == 15) {
+                last = a = decodeIndex(extra, last);
+            }
+            if (feb == 15) {
+                last = b = decodeIndex(extra, last);
+            }
+            if (fec == 15) {
+                last = c = decodeIndex(extra, last);
+            }
+            fifos.pushVertex(a);
+            fifos.pushVertex(b, feb == 0 || feb == 15);
+            fifos.pushVertex(c, fec == 0 || fec == 15);
+            fifos.pushEdge(b, a);
+            fifos.pushEdge(c, b);
+            fifos.pushEdge(a, c);
+        }
+        writeIndex(indices, i + 0, size, a);
+        writeIndex(indices, i + 1, size, b);
+        writeIndex(indices, i + 2, size, c);
+    }
+    return extra == extraend;
+}
+
+bool decodeIndexSequence(void* indices, size_t count, size_t size, const unsigned char* data,
+                         size_t bytes) {
+    // At least the header, one byte per index and a tail of 4 bytes
+    if ((size != 2 && size != 4) || bytes < 1 + count + 4) {
+        return false;
+    }
+    if ((data[0] & 0xF0) != sequenceHeader || (data[0] & 0x0F) > 1) {
+        return false;
+    }
+    const unsigned char* p = data + 1;
+    const unsigned char* safeend = data + bytes - 4;
+    // Each index is a delta from the last of two baselines, chosen by its lowest bit
+    unsigned int last[2] = {0, 0};
+    for (size_t i = 0; i < count; i++) {
+        // An index reads at most 5 bytes, which the tail leaves room for
+        if (p >= safeend) {
+            return false;
+        }
+        unsigned int v = decodeVByte(p);
+        const unsigned int baseline = v & 1;
+        v >>= 1;
+        const unsigned int index = last[baseline] + ((v >> 1) ^ (0u - (v & 1)));
+        last[baseline] = index;
+        writeIndex(indices, i, size, index);
+    }
+    return p == safeend;
+}
+
+namespace {
+
+template <typename T>
+void decodeOctahedral(T* data, size_t count) {
+    const float maxvalue = float((1 << (sizeof(T) * 8 - 1)) - 1);
+    for (size_t i = 0; i < count; i++) {
+        T* v = data + 4 * i;
+        // z is stored as the 1 of the octahedron at the same precision as x and y
+        float x = float(v[0]);
+        float y = float(v[1]);
+        const float z = float(v[2]) - std::fabs(x) - std::fabs(y);
+        const float t = (z >= 0.0f) ? 0.0f : z;
+        x += (x >= 0.0f) ? t : -t;
+        y += (y >= 0.0f) ? t : -t;
+        const float s = maxvalue / std::sqrt(x * x + y * y + z * z);
+        v[0] = T(int(x * s + (x >= 0.0f ? 0.5f : -0.5f)));
+        v[1] = T(int(y * s + (y >= 0.0f ? 0.5f : -0.5f)));
+        v[2] = T(int(z * s + (z >= 0.0f ? 0.5f : -0.5f)));
+    }
+}
+
+}  // namespace
+
+void decodeFilterOctahedral(void* data, size_t count, size_t size) {
+    if (size == 4) {
+        decodeOctahedral(static_cast<int8_t*>(data), count);
+    } else if (size == 8) {
+        decodeOctahedral(static_cast<int16_t*>(data), count);
+    }
+}
+
+void decodeFilterQuaternion(void* data, size_t count) {
+    const float scale = 1.0f / std::sqrt(2.0f);
+    int16_t* q = static_cast<int16_t*>(data);
+    for (size_t i = 0; i < count; i++, q += 4) {
+        // The high bits of the fourth component are the scale of the other three
+        const float s = scale / float(q[3] | 3);
+        const float x = float(q[0]) * s;
+        const float y = float(q[1]) * s;
+        const float z = float(q[2]) * s;
+        const float ww = 1.0f - x * x - y * y - z * z;
+        const float w = std::sqrt(ww >= 0.0f ? ww : 0.0f);
+        const int largest = q[3] & 3;
+        const int16_t xq = int16_t(int(x * 32767.0f + (x >= 0.0f ? 0.5f : -0.5f)));
+        const int16_t yq = int16_t(int(y * 32767.0f + (y >= 0.0f ? 0.5f : -0.5f)));
+        const int16_t zq = int16_t(int(z * 32767.0f + (z >= 0.0f ? 0.5f : -0.5f)));
+        q[(largest + 1) & 3] = xq;
+        q[(largest + 2) & 3] = yq;
+        q[(largest + 3) & 3] = zq;
+        q[largest] = int16_t(int(w * 32767.0f + 0.5f));
+    }
+}
+
+void decodeFilterExponential(void* data, size_t count) {
+    uint32_t* values = static_cast<uint32_t*>(data);
+    for (size_t i = 0; i < count; i++) {
+        const uint32_t v = values[i];
+        // A signed 24 bit mantissa and a signed 8 bit exponent
+        const int mantissa = int32_t(v << 8) >> 8;
+        const int exponent = int32_t(v) >> 24;
+        const float value = std::ldexp(float(mantissa), exponent);
+        std::memcpy(&values[i], &value, sizeof(value));
+    }
+}
+
+namespace {
+
+unsigned char zigzag8(unsigned char v) {
+    return static_cast<unsigned char>((v << 1) ^ (static_cast<signed char>(v) >> 7));
+}
+
+// Bytes that a group of 16 values takes with 'bits' bits each, with the escapes. A group of
+// 0 bits can only hold zeros, and is made too large for any others.
+size_t groupSize(const unsigned char* group, int bits) {
+    if (bits == 0) {
+        for (size_t i = 0; i < byteGroupSize; i++) {
+            if (group[i] != 0) {
+                return byteGroupSize + 1;
+            }
+        }
+        return 0;
+    }
+    const unsigned int mask = (1u << bits) - 1;
+    size_t escapes = 0;
+    for (size_t i = 0; i < byteGroupSize; i++) {
+        escapes += (group[i] >= mask) ? 1 : 0;
+    }
+    return byteGroupSize * bits / 8 + escapes;
+}
+
+// The inverse of decodeBytesGroup()
+unsigned char* encodeBytesGroup(unsigned char* data, const unsigned char* group, int bits) {
+    if (bits == 0) {
+        return data;
+    }
+    if (bits == 8) {
+        std::memcpy(data, group, byteGroupSize);
+        return data + byteGroupSize;
+    }
+    const unsigned int mask = (1u << bits) - 1;
+    const int perbyte = 8 / bits;
+    unsigned char* escapes = data + byteGroupSize / perbyte;
+    for (size_t i = 0; i < byteGroupSize; i += perbyte) {
+        unsigned int byte = 0;
+        for (int k = 0; k < perbyte; k++) {
+            const unsigned int value = (group[i + k] >= mask) ? mask : group[i + k];
+            byte = (byte << bits) | value;
+            if (value == mask) {
+                *escapes++ = group[i + k];
+            }
+        }
+        *data++ = static_cast<unsigned char>(byte);
+    }
+    return escapes;
+}
+
+/* Encode 'count' bytes, a multiple of 16, with the fewest bits for each group. Null if they do
+ * not fit before 'end'. */
+unsigned char* encodeBytes(unsigned char* data, const unsigned char* end,
+                           const unsigned char* bytes, size_t count) {
+    unsigned char* header = data;
+    const size_t headersize = (count / byteGroupSize + 3) / 4;
+    if (size_t(end - data) < headersize) {
+        return nullptr;
+    }
+    std::memset(header, 0, headersize);
+    data += headersize;
+    for (size_t i = 0; i < count; i += byteGroupSize) {
+        if (size_t(end - data) < byteGroupSize) {
+            return nullptr;
+        }
+        int best = 3;
+        size_t bestsize = byteGroupSize;
+        for (int bitslog2 = 0; bitslog2 < 3; bitslog2++) {
+            const size_t size = groupSize(bytes + i, groupBits[bitslog2]);
+            if (size < bestsize) {
+                best = bitslog2;
+                bestsize = size;
+            }
+        }
+        const size_t group = i / byteGroupSize;
+        header[group / 4] |= static_cast<unsigned char>(best << ((group % 4) * 2));
+        data = encodeBytesGroup(data, bytes + i, groupBits[best]);
+    }
+    return data;
+}
+
+// The inverse of decodeVertexBlock()
+unsigned char* encodeVertexBlock(unsigned char* data, const unsigned char* end,
+                                 const unsigned char* vertices, size_t count, size_t size,
+                                 unsigned char* last) {
+    unsigned char deltas[vertexBlockMaxSize] = {};
+    const size_t alignedcount = (count + byteGroupSize - 1) & ~(byteGroupSize - 1);
+    for (size_t k = 0; k < size; k++) {
+        unsigned char p = last[k];
+        for (size_t i = 0; i < count; i++) {
+            const unsigned char v = vertices[i * size + k];
+            deltas[i] = zigzag8(static_cast<unsigned char>(v - p));
+            p = v;
+        }
+        data = encodeBytes(data, end, deltas, alignedcount);
+        if (data == nullptr) {
+            return nullptr;
+        }
+        last[k] = p;
+    }
+    return data;
+}
+
+void encodeVByte(unsigned char*& data, unsigned int v) {
+    // Groups of 7 bits, the low bits first, with the high bit set on all but the last
+    do {
+        *data++ = static_cast<unsigned char>((v & 127) | (v > 127 ? 128 : 0));
+        v >>= 7;
+    } while (v != 0);
+}
+
+void encodeIndex(unsigned char*& data, unsigned int index, unsigned int last) {
+    const unsigned int d = index - last;
+    encodeVByte(data, (d << 1) ^ (0u - (d >> 31)));
+}
+
+// The codes of b and c of triangles without a known edge that codes 0xF0 to 0xFD stand for,
+// the table of meshoptimizer, which it made from how often they come up in common meshes
+constexpr unsigned char codeAuxTable[16] = {0x00, 0x76, 0x87, 0x56, 0x67, 0x78, 0xA9, 0x86,
+                                            0x65, 0x89, 0x68, 0x98, 0x01, 0x69, 0x00, 0x00};
+
+}  // namespace
+
+size_t encodeVertexBufferBound(size_t count, size_t size) {
+    const size_t blocksize = vertexBlockSize(size);
+    const size_t blocks = (count + blocksize - 1) / blocksize;
+    const size_t headersize = (blocksize / byteGroupSize + 3) / 4;
+    const size_t tailsize = size < vertexTailMinSize ? vertexTailMinSize : size;
+    return 1 + blocks * size * (headersize + blocksize) + tailsize;
+}
+
+size_t encodeVertexBuffer(unsigned char* data, size_t bytes, const void* vertices, size_t count,
+                          size_t size) {
+    if (size == 0 || size > 256 || size % 4 != 0 || bytes < 1) {
+        return 0;
+    }
+    unsigned char* const begin = data;
+    const unsigned char* const end = data + bytes;
+    *data++ = vertexHeader;  // Version 0
+
+    // The deltas of the first block are from the first vertex
+    const unsigned char* in = static_cast<const unsigned char*>(vertices);
+    unsigned char first[256] = {};
+    if (count > 0) {
+        std::memcpy(first, in, size);
+    }
+    unsigned char last[256];
+    std::memcpy(last, first, size);
+    const size_t blocksize = vertexBlockSize(size);
+    for (size_t i = 0; i < count; i += blocksize) {
+        const size_t blockcount = (count - i < blocksize) ? count - i : blocksize;
+        data = encodeVertexBlock(data, end, in + i * size, blockcount, size, last);
+        if (data == nullptr) {
+            return 0;
+        }
+    }
+
+    // The first vertex at the end, after zeros up to the size of the tail
+    const size_t tailsize = size < vertexTailMinSize ? vertexTailMinSize : size;
+    if (size_t(end - data) < tailsize) {
+        return 0;
+    }
+    std::memset(data, 0, tailsize - size);
+    std::memcpy(data + tailsize - size, first, size);
+    return size_t(data + tailsize - begin);
+}
+
+size_t encodeIndexBufferBound(size_t count, size_t vertexcount) {
+    // A triangle takes at most a code, a byte for b and c and three 7 bit groups per index
+    unsigned int vertexbits = 1;
+    while (vertexbits < 32 && vertexcount > (size_t(1) << vertexbits)) {
+        vertexbits++;
+    }
+    const size_t groups = (vertexbits + 1 + 6) / 7;
+    return 1 + (count / 3) * (2 + 3 * groups) + 16;
+}
+
+size_t encodeIndexBuffer(unsigned char* data, size_t bytes, const unsigned int* indices,
+                         size_t count, unsigned int firstvertex) {
+    if (count % 3 != 0 || bytes < 1 + count / 3 + 16) {
+        return 0;
+    }
+    const unsigned char* const begin = data;
+    data[0] = indexHeader | 1;
+    const int fecmax = 13;
+
+    unsigned char* code = data + 1;
+    unsigned char* extra = code + count / 3;
+    const unsigned char* extraend = data + bytes - 16;
+    TriangleFifos fifos;
+    unsigned int next = firstvertex;
+    unsigned int last = firstvertex;
+    for (size_t i = 0; i < count; i += 3) {
+        // A triangle writes at most 16 bytes of 'extra'
+        if (extra > extraend) {
+            return 0;
+        }
+        const int fer = fifos.findEdge(indices[i], indices[i + 1], indices[i + 2]);
+        if (fer >= 0 && (fer >> 2) < 15) {
+            // Rotated so that the edge in the FIFO is ab
+            const int rotation = fer & 3;
+            const unsigned int a = indices[i + rotation];
+            const unsigned int b = indices[i + (rotation + 1) % 3];
+            const unsigned int c = indices[i + (rotation + 2) % 3];
+            const int fe = fer >> 2;
+            const int fc = fifos.findVertex(c);
+            int fec = 15;
+            if (fc >= 1 && fc < fecmax) {
+                fec = fc;
+            } else if (c == next) {
+                fec = 0;
+                next++;
+            } else if (c + 1 == last || c == last + 1) {
+                fec = (c + 1 == last) ? 13 : 14;
+                last = c;
+            }
+            *code++ = static_cast<unsigned char>((fe << 4) | fec);
+            if (fec == 15) {
+                encodeIndex(extra, c, last);
+                last = c;
+            }
+            if (fec == 0 || fec >= fecmax) {
+                fifos.pushVertex(c);
+            }
+            fifos.pushEdge(c, b);
+            fifos.pushEdge(a, c);
+        } else {
+            // Rotated so that a new vertex, if any, is a
+            const unsigned int i1 = indices[i + 1];
+            const unsigned int i2 = indices[i + 2];
+            const int rotation = (i1 == next) ? 1 : (i2 == next) ? 2 : 0;
+            const unsigned int a = indices[i + rotation];
+            const unsigned int b = indices[i + (rotation + 1) % 3];
+            const unsigned int c = indices[i + (rotation + 2) % 3];
+
+            // A triangle 0, 1, 2 restarts the numbering of new vertices
+            bool reset = false;
+            if (a == 0 && b == 1 && c == 2 && next > 0) {
+                reset = true;
+                next = 0;
+                std::memset(fifos.vertices, 0xFF, sizeof(fifos.vertices));
+            }
+            const int fb = fifos.findVertex(b);
+            const int fc = fifos.findVertex(c);
+            int fea = 15;
+            if (a == next) {
+                fea = 0;
+                next++;
+            }
+            int feb = 15;
+            if (fb >= 0 && fb < 14) {
+                feb = fb + 1;
+            } else if (b == next) {
+                feb = 0;
+                next++;
+            }
+            int fec = 15;
+            if (fc >= 0 && fc < 14) {
+                fec = fc + 1;
+            } else if (c == next) {
+                fec = 0;
+                next++;
+            }
+
+            // The codes of b and c from the table if they are there, or in a byte of their own
+            const unsigned char codeaux = static_cast<unsigned char>((feb << 4) | fec);
+            int table = -1;
+            for (int t = 0; t < 14 && table < 0; t++) {
+                table = (codeAuxTable[t] == codeaux) ? t : -1;
+            }
+            if (fea == 0 && table >= 0 && !reset) {
+                *code++ = static_cast<unsigned char>(0xF0 | table);
+            } else {
+                *code++ = static_cast<unsigned char>(0xFE | (fea == 15 ? 1 : 0));
+                *extra++ = codeaux;
+            }
+            if (fea == 15) {
+                encodeIndex(extra, a, last);
+                last = a;
+            }
+            if (feb == 15) {
+                encodeIndex(extra, b, last);
+                last = b;
+            }
+            if (fec == 15) {
+                encodeIndex(extra, c, last);
+                last = c;
+            }
+            if (fea == 0 || fea == 15) {
+                fifos.pushVertex(a);
+            }
+            if (feb == 0 || feb == 15) {
+                fifos.pushVertex(b);
+            }
+            if (fec == 0 || fec == 15) {
+                fifos.pushVertex(c);
+            }
+            fifos.pushEdge(b, a);
+            fifos.pushEdge(c, b);
+            fifos.pushEdge(a, c);
+        }
+    }
+
+    // The table, which the decoder reads the codes from and which pads the end
+    if (extra > extraend) {
+        return 0;
+    }
+    std::memcpy(extra, codeAuxTable, sizeof(codeAuxTable));
+    return size_t(extra + sizeof(codeAuxTable) - begin);
+}
+
+}  // namespace meshcodec
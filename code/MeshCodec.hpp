@@ -0,0 +1,73 @@
+/*
+ * Decoders and encoders for the compressed vertex and index buffers of meshoptimizer, as used
+ * by the glTF extension EXT_meshopt_compression and by the compressed binary mesh files of
+ * TriangleSoup.
+ *
+ * Usage: decodeVertexBuffer() decodes 'count' vertices of 'size' bytes each, which are
+ *        stored as the byte-wise deltas of blocks of vertices, transposed and packed
+ *        with 0, 2, 4 or 8 bits per byte. decodeIndexBuffer() decodes triangle lists
+ *        that were coded with FIFOs of recent edges and vertices, and
+ *        decodeIndexSequence() other index lists coded as deltas. All of them check the
+ *        size of the input and return false for damaged data. The filters then turn
+ *        decoded vertex data into its final values: octahedral normals into vectors,
+ *        quaternions from three components, and floats from a mantissa and an exponent.
+ *        The vertex format is version 0 and the index formats versions 0 and 1, as
+ *        meshoptimizer writes them for EXT_meshopt_compression.
+ *        encodeVertexBuffer() and encodeIndexBuffer() write the vertex format and the index
+ *        format version 1, into a buffer of at least the size from their bound functions.
+ *        Vertices compress well when nearby vertices are alike, and index buffers when the
+ *        vertices are numbered in the order the triangles first use them, as after welding.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <cstddef>
+
+namespace meshcodec {
+
+/* Decode 'count' vertices of 'size' bytes, a multiple of 4 up to 256, from the 'bytes'
+ * bytes of 'data' to 'vertices'. False if the data is damaged. */
+bool decodeVertexBuffer(void* vertices, size_t count, size_t size, const unsigned char* data,
+                        size_t bytes);
+
+/* Decode 'count' indices of 'size' bytes, 2 or 4, of a triangle list. 'firstvertex' is that of
+ * the encoder, 0 for the files of meshoptimizer. False if the data is damaged. */
+bool decodeIndexBuffer(void* indices, size_t count, size_t size, const unsigned char* data,
+                       size_t bytes, unsigned int firstvertex = 0);
+
+/* Decode 'count' indices of 'size' bytes, 2 or 4, of any index list. False if the data is
+ * damaged. */
+bool decodeIndexSequence(void* indices, size_t count, size_t size, const unsigned char* data,
+                         size_t bytes);
+
+/* Decode octahedral vectors in place: 'count' groups of 4 signed components of 'size' bytes
+ * together, 4 or 8, of which the first three become a unit vector and the fourth is kept */
+void decodeFilterOctahedral(void* data, size_t count, size_t size);
+
+/* Decode quaternions in place: 'count' groups of 4 16 bit components, three components of
+ * the quaternion and the index of the largest one, which is computed from them */
+void decodeFilterQuaternion(void* data, size_t count);
+
+/* Decode 'count' 32 bit floats in place from 24 bit mantissas with 8 bit exponents */
+void decodeFilterExponential(void* data, size_t count);
+
+// The most bytes that encodeVertexBuffer() writes for 'count' vertices of 'size' bytes
+size_t encodeVertexBufferBound(size_t count, size_t size);
+
+/* Encode 'count' vertices of 'size' bytes, a multiple of 4 up to 256, into the 'bytes' bytes of
+ * 'data'. Returns the number of bytes written, 0 if they do not fit. */
+size_t encodeVertexBuffer(unsigned char* data, size_t bytes, const void* vertices, size_t count,
+                          size_t size);
+
+// The most bytes that encodeIndexBuffer() writes for 'count' indices of 'vertexcount' vertices
+size_t encodeIndexBufferBound(size_t count, size_t vertexcount);
+
+/* Encode the 'count' indices of a triangle list into the 'bytes' bytes of 'data'. The
+ * vertices that the triangles use first are expected to be numbered from 'firstvertex' up,
+ * which lets a part of a larger index buffer be coded as well as a first part. Returns the
+ * number of bytes written, 0 if they do not fit. */
+size_t encodeIndexBuffer(unsigned char* data, size_t bytes, const unsigned int* indices,
+                         size_t count, unsigned int firstvertex = 0);
+
+}  // namespace meshcodec
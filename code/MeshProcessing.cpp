@@ -0,0 +1,1343 @@
+/*
+ * CPU side processing of indexed triangle meshes
+ *
+ * This code is in the public domain.
+ */
+#include "MeshProcessing.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <utility>
+
+#include "Mat4.hpp"  // For the SIMD instruction set
+#include "ThreadPool.hpp"
+
+namespace mesh {
+
+namespace {
+
+// A symmetric 4x4 matrix summing the squared distances to a set of planes, as its upper
+// triangle aa ab ac ad bb bc bd cc cd dd
+struct Quadric {
+    double q[10] = {};
+
+    void addPlane(double a, double b, double c, double d, double weight) {
+        const double plane[4] = {a, b, c, d};
+        int k = 0;
+        for (int i = 0; i < 4; i++) {
+            for (int j = i; j < 4; j++) {
+                q[k++] += weight * plane[i] * plane[j];
+            }
+        }
+    }
+
+    void add(const Quadric& other) {
+        for (int k = 0; k < 10; k++) {
+            q[k] += other.q[k];
+        }
+    }
+
+    // Sum of the squared distances from p to the planes
+    double evaluate(const float* p) const {
+        const double x = p[0], y = p[1], z = p[2];
+        return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+               q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y + q[7] * z * z +
+               2.0 * q[8] * z + q[9];
+    }
+};
+
+// Move all vertices at position 'from' to their neighbours at position 'to'
+struct Collapse {
+    float cost;
+    int from;
+    int to;
+    int fromversion;  // Versions of the positions when the cost was computed
+    int toversion;
+
+    bool operator>(const Collapse& other) const { return cost > other.cost; }
+};
+
+// Cross product of b - a and c - a
+void faceNormal(const float* a, const float* b, const float* c, double n[3]) {
+    const double u[3] = {double(b[0]) - a[0], double(b[1]) - a[1], double(b[2]) - a[2]};
+    const double v[3] = {double(c[0]) - a[0], double(c[1]) - a[1], double(c[2]) - a[2]};
+    n[0] = u[1] * v[2] - u[2] * v[1];
+    n[1] = u[2] * v[0] - u[0] * v[2];
+    n[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+// Triangles or vertices per job of the parallel loops
+const size_t blockSize = 16384;
+
+// Call fn(begin, end) for the blocks of [0, count), on the threads of 'pool' if there is one
+void forBlocks(size_t count, ThreadPool* pool, const std::function<void(size_t, size_t)>& fn) {
+    const int blocks = static_cast<int>((count + blockSize - 1) / blockSize);
+    auto block = [&](int b) {
+        const size_t begin = size_t(b) * blockSize;
+        fn(begin, std::min(begin + blockSize, count));
+    };
+    if (pool != nullptr && blocks > 1) {
+        pool->parallelFor(blocks, block);
+    } else {
+        for (int b = 0; b < blocks; b++) {
+            block(b);
+        }
+    }
+}
+
+// The normals of the triangles [begin, end) into 'normals', as the cross products of two
+// edges, which are twice as long as the area of the triangle
+void triangleNormals(const GLfloat* vertices, int stride, const GLuint* indices, size_t begin,
+                     size_t end, float* normals) {
+    size_t t = begin;
+#if defined(TNM046_MAT4_SSE)
+    // Four triangles at a time, one triangle per lane
+    for (; t + 4 <= end; t += 4) {
+        __m128 p[3][3];  // Coordinate c of corner k of the four triangles
+        for (int k = 0; k < 3; k++) {
+            const float* v0 = vertices + size_t(stride) * indices[3 * t + k];
+            const float* v1 = vertices + size_t(stride) * indices[3 * t + 3 + k];
+            const float* v2 = vertices + size_t(stride) * indices[3 * t + 6 + k];
+            const float* v3 = vertices + size_t(stride) * indices[3 * t + 9 + k];
+            for (int c = 0; c < 3; c++) {
+                p[k][c] = _mm_setr_ps(v0[c], v1[c], v2[c], v3[c]);
+            }
+        }
+        __m128 u[3], v[3];
+        for (int c = 0; c < 3; c++) {
+            u[c] = _mm_sub_ps(p[1][c], p[0][c]);
+            v[c] = _mm_sub_ps(p[2][c], p[0][c]);
+        }
+        float n[3][4];
+        _mm_storeu_ps(n[0], _mm_sub_ps(_mm_mul_ps(u[1], v[2]), _mm_mul_ps(u[2], v[1])));
+        _mm_storeu_ps(n[1], _mm_sub_ps(_mm_mul_ps(u[2], v[0]), _mm_mul_ps(u[0], v[2])));
+        _mm_storeu_ps(n[2], _mm_sub_ps(_mm_mul_ps(u[0], v[1]), _mm_mul_ps(u[1], v[0])));
+        for (int i = 0; i < 4; i++) {
+            normals[3 * (t + i)] = n[0][i];
+            normals[3 * (t + i) + 1] = n[1][i];
+            normals[3 * (t + i) + 2] = n[2][i];
+        }
+    }
+#endif
+    for (; t < end; t++) {
+        const float* a = vertices + size_t(stride) * indices[3 * t];
+        const float* b = vertices + size_t(stride) * indices[3 * t + 1];
+        const float* c = vertices + size_t(stride) * indices[3 * t + 2];
+        const float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        const float v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        normals[3 * t] = u[1] * v[2] - u[2] * v[1];
+        normals[3 * t + 1] = u[2] * v[0] - u[0] * v[2];
+        normals[3 * t + 2] = u[0] * v[1] - u[1] * v[0];
+    }
+}
+
+inline float dot3(const float* a, const float* b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Normalize 'n' if it has a length, and return whether it had
+inline bool normalize3(float* n) {
+    const float length = std::sqrt(dot3(n, n));
+    if (!(length > 0.0f)) {
+        return false;
+    }
+    n[0] /= length;
+    n[1] /= length;
+    n[2] /= length;
+    return true;
+}
+
+// A vertex with the hash of its position, to sort the vertices by position
+struct PositionKey {
+    uint64_t hash;
+    GLuint vertex;
+
+    bool operator<(const PositionKey& other) const {
+        return hash != other.hash ? hash < other.hash : vertex < other.vertex;
+    }
+};
+
+uint64_t positionHash(const float* p) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int c = 0; c < 3; c++) {
+        const float value = p[c] + 0.0f;  // -0 is the same position as 0
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        hash = (hash ^ bits) * 0x100000001b3ull;
+    }
+    return hash ^ (hash >> 29);
+}
+
+// Sort 'keys' in one part per thread of 'pool', and merge the parts pairwise
+void sortKeys(std::vector<PositionKey>& keys, ThreadPool* pool) {
+    const size_t parts = pool != nullptr ? pool->size() : 1;
+    if (parts <= 1 || keys.size() < 2 * blockSize) {
+        std::sort(keys.begin(), keys.end());
+        return;
+    }
+    std::vector<size_t> bounds(parts + 1);
+    for (size_t i = 0; i <= parts; i++) {
+        bounds[i] = keys.size() * i / parts;
+    }
+    pool->parallelFor(static_cast<int>(parts), [&](int i) {
+        std::sort(keys.begin() + bounds[i], keys.begin() + bounds[i + 1]);
+    });
+    for (size_t width = 1; width < parts; width *= 2) {
+        const int merges = static_cast<int>((parts + 2 * width - 1) / (2 * width));
+        pool->parallelFor(merges, [&](int m) {
+            const size_t first = 2 * width * size_t(m);
+            const size_t middle = std::min(first + width, parts);
+            const size_t last = std::min(first + 2 * width, parts);
+            if (middle < last) {
+                std::inplace_merge(keys.begin() + bounds[first], keys.begin() + bounds[middle],
+                                   keys.begin() + bounds[last]);
+            }
+        });
+    }
+}
+
+}  // namespace
+
+Adjacency buildAdjacency(const std::vector<GLuint>& indices, size_t numnodes,
+                         const GLuint* group, ThreadPool* pool) {
+    Adjacency adjacency;
+    adjacency.offsets.assign(numnodes + 1, 0);
+    adjacency.corners.resize(indices.size());
+    auto node = [&](size_t corner) {
+        return group != nullptr ? group[indices[corner]] : indices[corner];
+    };
+    const size_t parts = (pool != nullptr && indices.size() >= 2 * blockSize) ? pool->size() : 1;
+    if (parts <= 1) {
+        for (size_t i = 0; i < indices.size(); i++) {
+            adjacency.offsets[node(i) + 1]++;
+        }
+        std::partial_sum(adjacency.offsets.begin(), adjacency.offsets.end(),
+                         adjacency.offsets.begin());
+        std::vector<GLuint> next(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            adjacency.corners[next[node(i)]++] = GLuint(i);
+        }
+        return adjacency;
+    }
+
+    // Each part of the corners counts its corners per node, and then places them from where
+    // the corners of the earlier parts at the node end, so the corners stay in order
+    std::vector<size_t> bounds(parts + 1);
+    for (size_t p = 0; p <= parts; p++) {
+        bounds[p] = indices.size() * p / parts;
+    }
+    std::vector<std::vector<GLuint>> next(parts, std::vector<GLuint>(numnodes, 0));
+    pool->parallelFor(static_cast<int>(parts), [&](int p) {
+        std::vector<GLuint>& counts = next[p];
+        for (size_t i = bounds[p]; i < bounds[p + 1]; i++) {
+            counts[node(i)]++;
+        }
+    });
+    forBlocks(numnodes, pool, [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; n++) {
+            GLuint total = 0;
+            for (size_t p = 0; p < parts; p++) {
+                total += next[p][n];
+            }
+            adjacency.offsets[n + 1] = total;
+        }
+    });
+    std::partial_sum(adjacency.offsets.begin(), adjacency.offsets.end(),
+                     adjacency.offsets.begin());
+    forBlocks(numnodes, pool, [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; n++) {
+            GLuint at = adjacency.offsets[n];
+            for (size_t p = 0; p < parts; p++) {
+                const GLuint count = next[p][n];
+                next[p][n] = at;
+                at += count;
+            }
+        }
+    });
+    pool->parallelFor(static_cast<int>(parts), [&](int p) {
+        std::vector<GLuint>& at = next[p];
+        for (size_t i = bounds[p]; i < bounds[p + 1]; i++) {
+            adjacency.corners[at[node(i)]++] = GLuint(i);
+        }
+    });
+    return adjacency;
+}
+
+std::vector<Edge> buildEdges(const Adjacency& adjacency, const std::vector<GLuint>& indices,
+                             const GLuint* group, ThreadPool* pool) {
+    auto node = [&](size_t corner) {
+        return group != nullptr ? group[indices[corner]] : indices[corner];
+    };
+    // An edge from a node appears once in each of its triangles, as the node after or
+    // before the corner at the node, so the edges of a node are found among its corners
+    const size_t numnodes = adjacency.numNodes();
+    const size_t numblocks = (numnodes + blockSize - 1) / blockSize;
+    std::vector<std::vector<Edge>> blockedges(numblocks);
+    forBlocks(numnodes, pool, [&](size_t begin, size_t end) {
+        std::vector<std::pair<GLuint, GLuint>> neighbours;  // Node and triangle
+        std::vector<Edge>& edges = blockedges[begin / blockSize];
+        for (size_t a = begin; a < end; a++) {
+            neighbours.clear();
+            for (const GLuint* c = adjacency.begin(a); c != adjacency.end(a); c++) {
+                const GLuint t = *c / 3;
+                const GLuint k = *c % 3;
+                const GLuint after = node(3 * t + (k + 1) % 3);
+                const GLuint before = node(3 * t + (k + 2) % 3);
+                if (after > a) {
+                    neighbours.push_back({after, t});
+                }
+                if (before > a) {
+                    neighbours.push_back({before, t});
+                }
+            }
+            std::sort(neighbours.begin(), neighbours.end());
+            for (size_t i = 0; i < neighbours.size();) {
+                size_t run = i + 1;
+                while (run < neighbours.size() && neighbours[run].first == neighbours[i].first) {
+                    run++;
+                }
+                Edge edge;
+                edge.a = GLuint(a);
+                edge.b = neighbours[i].first;
+                edge.triangles = GLuint(run - i);
+                edge.triangle = neighbours[i].second;
+                edges.push_back(edge);
+                i = run;
+            }
+        }
+    });
+    std::vector<Edge> edges;
+    size_t numedges = 0;
+    for (const std::vector<Edge>& block : blockedges) {
+        numedges += block.size();
+    }
+    edges.reserve(numedges);
+    for (const std::vector<Edge>& block : blockedges) {
+        edges.insert(edges.end(), block.begin(), block.end());
+    }
+    return edges;
+}
+
+size_t groupPositions(const std::vector<GLfloat>& vertices, int stride,
+                      std::vector<GLuint>& position, ThreadPool* pool) {
+    const size_t numverts = vertices.size() / size_t(stride);
+    position.resize(numverts);
+
+    // The vertices sorted by position, so that the vertices at a position are together
+    std::vector<PositionKey> keys(numverts);
+    forBlocks(numverts, pool, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            keys[v] = {positionHash(&vertices[size_t(stride) * v]), GLuint(v)};
+        }
+    });
+    sortKeys(keys, pool);
+
+    // Each vertex first gets the first vertex at its position, so that the positions can
+    // be numbered in the order of the vertices, and the nodes of neighbouring positions
+    // are close in memory. A vertex with the hash of another position, which is rare, is
+    // not taken for it.
+    std::vector<GLuint> samehash;  // The first vertex of each position of the hash
+    for (size_t run = 0; run < numverts;) {
+        size_t end = run + 1;
+        while (end < numverts && keys[end].hash == keys[run].hash) {
+            end++;
+        }
+        samehash.clear();
+        for (size_t i = run; i < end; i++) {
+            const GLuint vertex = keys[i].vertex;
+            const float* p = &vertices[size_t(stride) * vertex];
+            auto same = [&](GLuint other) {
+                const float* q = &vertices[size_t(stride) * other];
+                return p[0] == q[0] && p[1] == q[1] && p[2] == q[2];
+            };
+            auto found = std::find_if(samehash.begin(), samehash.end(), same);
+            if (found == samehash.end()) {
+                samehash.push_back(vertex);
+                position[vertex] = vertex;
+            } else {
+                position[vertex] = *found;
+            }
+        }
+        run = end;
+    }
+    // The first vertex comes before the others at its position, so it is numbered first
+    size_t numpositions = 0;
+    for (size_t v = 0; v < numverts; v++) {
+        position[v] = position[v] == v ? GLuint(numpositions++) : position[position[v]];
+    }
+    return numpositions;
+}
+
+CacheStats analyzeVertexCache(const std::vector<GLuint>& indices, int numverts, int cachesize) {
+    CacheStats stats;
+    const size_t numtris = indices.size() / 3;
+    if (numtris == 0 || numverts == 0) {
+        return stats;
+    }
+
+    // A vertex is in the FIFO cache if it was inserted less than 'cachesize' misses ago
+    std::vector<long long> timestamp(numverts, -static_cast<long long>(cachesize) - 1);
+    long long misses = 0;
+    for (GLuint index : indices) {
+        if (misses - timestamp[index] > cachesize) {
+            timestamp[index] = misses;
+            misses++;
+        }
+    }
+
+    std::vector<bool> used(numverts, false);
+    for (GLuint index : indices) {
+        used[index] = true;
+    }
+    const auto numused = std::count(used.begin(), used.end(), true);
+
+    stats.acmr = static_cast<double>(misses) / static_cast<double>(numtris);
+    stats.atvr = static_cast<double>(misses) / static_cast<double>(numused);
+    return stats;
+}
+
+std::vector<GLuint> optimizeVertexCache(const std::vector<GLuint>& indices, int numverts,
+                                        int cachesize, std::vector<int>* clusters) {
+    const int numtris = static_cast<int>(indices.size() / 3);
+    std::vector<GLuint> result;
+    result.reserve(indices.size());
+    if (clusters) {
+        clusters->clear();
+    }
+    if (numtris == 0) {
+        return result;
+    }
+
+    const Adjacency adjacency = buildAdjacency(indices, size_t(numverts));
+    std::vector<int> live(numverts);  // Number of triangles not yet emitted, per vertex
+    for (int v = 0; v < numverts; v++) {
+        live[v] = static_cast<int>(adjacency.count(v));
+    }
+    std::vector<int> cachetime(numverts, 0);  // Time stamp of when the vertex entered the cache
+    std::vector<bool> emitted(numtris, false);
+    std::vector<int> deadend;     // Recently used vertices, to continue from at a dead end
+    std::vector<int> candidates;  // Vertices of the triangles emitted around the fanning vertex
+
+    int fanning = 0;           // The vertex whose triangles are emitted next
+    int time = cachesize + 1;  // Current time stamp
+    int cursor = 0;            // Next vertex to test when the dead-end stack is empty
+    bool flushed = true;       // True when the next emitted triangle starts a cluster
+
+    while (fanning >= 0) {
+        candidates.clear();
+        for (const GLuint* corner = adjacency.begin(fanning); corner != adjacency.end(fanning);
+             corner++) {
+            const int t = static_cast<int>(*corner / 3);
+            if (emitted[t]) {
+                continue;
+            }
+            if (flushed && clusters) {
+                clusters->push_back(static_cast<int>(result.size() / 3));
+            }
+            flushed = false;
+            for (int k = 0; k < 3; k++) {
+                const int v = static_cast<int>(indices[3 * t + k]);
+                result.push_back(static_cast<GLuint>(v));
+                deadend.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cachetime[v] > cachesize) {
+                    cachetime[v] = time;
+                    time++;
+                }
+            }
+            emitted[t] = true;
+        }
+
+        // Pick the candidate that will still be in the cache when its remaining
+        // triangles are emitted, and that entered the cache the earliest
+        int next = -1;
+        int best = -1;
+        for (int v : candidates) {
+            if (live[v] > 0) {
+                int priority = 0;
+                if (time - cachetime[v] + 2 * live[v] <= cachesize) {
+                    priority = time - cachetime[v];
+                }
+                if (priority > best) {
+                    best = priority;
+                    next = v;
+                }
+            }
+        }
+
+        if (next < 0) {
+            // Dead end: continue from a recently used vertex, or from the next vertex in
+            // input order that still has triangles left. Either way the cache is likely cold.
+            while (!deadend.empty() && next < 0) {
+                const int v = deadend.back();
+                deadend.pop_back();
+                if (live[v] > 0) {
+                    next = v;
+                }
+            }
+            while (next < 0 && cursor < numverts) {
+                if (live[cursor] > 0) {
+                    next = cursor;
+                }
+                ++cursor;
+            }
+            flushed = true;
+        }
+        fanning = next;
+    }
+
+    return result;
+}
+
+std::vector<GLuint> optimizeOverdraw(const std::vector<GLuint>& indices,
+                                     const std::vector<GLfloat>& vertices, int stride,
+                                     const std::vector<int>& clusters) {
+    const int numtris = static_cast<int>(indices.size() / 3);
+    const int numclusters = static_cast<int>(clusters.size());
+    if (numclusters < 2) {
+        return indices;
+    }
+
+    auto position = [&](GLuint index) { return &vertices[size_t(index) * stride]; };
+
+    // Area weighted centroid of the whole mesh
+    double meshcenter[3] = {0.0, 0.0, 0.0};
+    double meshweight = 0.0;
+
+    // Area weighted centroid and normal of each cluster
+    std::vector<double> center(3 * size_t(numclusters), 0.0);
+    std::vector<double> normal(3 * size_t(numclusters), 0.0);
+    std::vector<double> weight(numclusters, 0.0);
+
+    for (int c = 0; c < numclusters; c++) {
+        const int first = clusters[c];
+        const int last = (c + 1 < numclusters) ? clusters[c + 1] : numtris;
+        for (int t = first; t < last; t++) {
+            const GLfloat* p0 = position(indices[3 * t]);
+            const GLfloat* p1 = position(indices[3 * t + 1]);
+            const GLfloat* p2 = position(indices[3 * t + 2]);
+            const double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            const double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            // The cross product has the direction of the normal and twice the area as length
+            const double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                                 e1[0] * e2[1] - e1[1] * e2[0]};
+            const double area = 0.5 * std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int i = 0; i < 3; i++) {
+                const double centroid = (p0[i] + p1[i] + p2[i]) / 3.0;
+                center[3 * c + i] += area * centroid;
+                normal[3 * c + i] += n[i];
+                meshcenter[i] += area * centroid;
+            }
+            weight[c] += area;
+            meshweight += area;
+        }
+    }
+    if (meshweight > 0.0) {
+        for (double& m : meshcenter) {
+            m /= meshweight;
+        }
+    }
+
+    // Clusters far out along their own normal are likely to occlude the rest of the mesh
+    std::vector<double> occlusion(numclusters, 0.0);
+    for (int c = 0; c < numclusters; c++) {
+        if (weight[c] == 0.0) {
+            continue;
+        }
+        double dot = 0.0;
+        for (int i = 0; i < 3; i++) {
+            dot += (center[3 * c + i] / weight[c] - meshcenter[i]) * normal[3 * c + i];
+        }
+        occlusion[c] = dot;
+    }
+
+    std::vector<int> order(numclusters);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](int a, int b) { return occlusion[a] > occlusion[b]; });
+
+    std::vector<GLuint> result;
+    result.reserve(indices.size());
+    for (int c : order) {
+        const int first = clusters[c];
+        const int last = (c + 1 < numclusters) ? clusters[c + 1] : numtris;
+        result.insert(result.end(), indices.begin() + 3 * first, indices.begin() + 3 * last);
+    }
+    return result;
+}
+
+void optimizeVertexFetch(std::vector<GLfloat>& vertices, int stride,
+                         std::vector<GLuint>& indices) {
+    const size_t numverts = vertices.size() / stride;
+    const GLuint unused = ~GLuint(0);
+
+    // New index of each vertex, in order of first use
+    std::vector<GLuint> remap(numverts, unused);
+    GLuint next = 0;
+    for (GLuint& index : indices) {
+        if (remap[index] == unused) {
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+    for (GLuint& r : remap) {
+        if (r == unused) {
+            r = next++;
+        }
+    }
+
+    std::vector<GLfloat> reordered(vertices.size());
+    for (size_t v = 0; v < numverts; v++) {
+        std::copy_n(&vertices[v * stride], stride, &reordered[size_t(remap[v]) * stride]);
+    }
+    vertices.swap(reordered);
+}
+
+std::vector<GLuint> simplify(const std::vector<GLuint>& indices,
+                             const std::vector<GLfloat>& vertices, int stride,
+                             size_t targetindices, float* error, bool lockborder) {
+    const int numverts = static_cast<int>(vertices.size() / stride);
+    const size_t numtris = indices.size() / 3;
+    if (error) {
+        *error = 0.0f;
+    }
+    if (indices.size() <= targetindices || numverts == 0) {
+        return indices;
+    }
+
+    // The collapses work on positions rather than vertices, so that vertices that only
+    // differ in normal or texture coordinates stay together
+    auto position = [&](int v) { return &vertices[size_t(v) * stride]; };
+    std::vector<GLuint> posof;  // Position number of each vertex
+    const int numpos = static_cast<int>(groupPositions(vertices, stride, posof));
+    std::vector<int> posvertex(numpos);  // A vertex at each position
+    for (int v = numverts - 1; v >= 0; v--) {
+        posvertex[posof[v]] = v;
+    }
+    auto point = [&](int p) { return position(posvertex[p]); };
+
+    std::vector<GLuint> tris(indices.begin(), indices.begin() + 3 * numtris);
+    std::vector<bool> alive(numtris, true);
+    size_t numalive = numtris;
+    std::vector<Quadric> quadrics(numpos);
+    std::vector<bool> border(numpos, false);
+
+    // The triangles around each position, which the collapses merge, so each position has a
+    // list of its own starting from the adjacency
+    const Adjacency adjacency = buildAdjacency(tris, size_t(numpos), posof.data());
+    std::vector<std::vector<int>> postris(numpos);
+    for (int p = 0; p < numpos; p++) {
+        postris[p].reserve(adjacency.count(p));
+        for (const GLuint* corner = adjacency.begin(p); corner != adjacency.end(p); corner++) {
+            postris[p].push_back(static_cast<int>(*corner / 3));
+        }
+    }
+
+    // The planes of the triangles around each position
+    for (size_t t = 0; t < numtris; t++) {
+        double n[3];
+        faceNormal(position(tris[3 * t]), position(tris[3 * t + 1]), position(tris[3 * t + 2]), n);
+        const double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (!(length > 0.0)) {
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            const int p = posof[tris[3 * t + k]];
+            const float* x = point(p);
+            const double a = n[0] / length, b = n[1] / length, c = n[2] / length;
+            quadrics[p].addPlane(a, b, c, -(a * x[0] + b * x[1] + c * x[2]), 1.0);
+        }
+    }
+
+    // Edges between positions. Edges of only one triangle are on the border, and get a
+    // plane perpendicular to the triangle that keeps border vertices on the border.
+    const std::vector<Edge> edges = buildEdges(adjacency, tris, posof.data());
+    const double borderweight = 100.0;
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+    std::vector<int> version(numpos, 0);
+    auto cost = [&](int from, int to) {
+        Quadric q = quadrics[from];
+        q.add(quadrics[to]);
+        return std::max(q.evaluate(point(to)), 0.0);
+    };
+    // Only the cheaper direction of each edge is queued, which halves the queue
+    auto push = [&](int a, int b) {
+        const double ab = cost(a, b), ba = cost(b, a);
+        if (ab <= ba) {
+            heap.push({static_cast<float>(ab), a, b, version[a], version[b]});
+        } else {
+            heap.push({static_cast<float>(ba), b, a, version[b], version[a]});
+        }
+    };
+    for (const Edge& edge : edges) {
+        if (edge.triangles == 1) {
+            const GLuint t = edge.triangle;
+            double n[3];
+            faceNormal(position(tris[3 * t]), position(tris[3 * t + 1]), position(tris[3 * t + 2]),
+                       n);
+            const float* pa = point(edge.a);
+            const float* pb = point(edge.b);
+            const double d[3] = {double(pb[0]) - pa[0], double(pb[1]) - pa[1],
+                                 double(pb[2]) - pa[2]};
+            double m[3] = {d[1] * n[2] - d[2] * n[1], d[2] * n[0] - d[0] * n[2],
+                           d[0] * n[1] - d[1] * n[0]};
+            const double length = std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+            if (length > 0.0) {
+                m[0] /= length;
+                m[1] /= length;
+                m[2] /= length;
+                const double offset = -(m[0] * pa[0] + m[1] * pa[1] + m[2] * pa[2]);
+                quadrics[edge.a].addPlane(m[0], m[1], m[2], offset, borderweight);
+                quadrics[edge.b].addPlane(m[0], m[1], m[2], offset, borderweight);
+            }
+            border[edge.a] = border[edge.b] = true;
+        }
+    }
+    for (const Edge& edge : edges) {
+        push(static_cast<int>(edge.a), static_cast<int>(edge.b));
+    }
+
+    std::vector<int> mark(numpos, -1);  // Per collapse marks of neighbour positions
+    std::vector<int> partner(numverts, -1);  // The vertex at v each vertex at u moves to
+    std::vector<int> moved;                  // The vertices with a partner
+    double maxcost = 0.0;
+    int collapses = 0;
+    while (!heap.empty() && 3 * numalive > targetindices) {
+        const Collapse c = heap.top();
+        heap.pop();
+        if (c.fromversion != version[c.from] || c.toversion != version[c.to]) {
+            continue;  // Outdated, or one of the positions is gone
+        }
+        const int u = c.from, v = c.to;
+        collapses++;
+
+        // Triangles on the edge, and the positions around u and around v
+        int shared = 0;
+        for (int t : postris[u]) {
+            if (!alive[t]) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                const int p = posof[tris[3 * t + k]];
+                mark[p] = collapses;
+                shared += (p == v);
+            }
+        }
+        if (shared == 0 || (border[u] && (lockborder || shared != 1))) {
+            continue;  // No longer an edge, or border vertices would move off the border
+        }
+        // Only the two positions opposite the edge (one on the border) may be neighbours of
+        // both, or the collapse would make the mesh non-manifold
+        int common = 0;
+        for (int t : postris[v]) {
+            if (!alive[t]) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                const int p = posof[tris[3 * t + k]];
+                if (p != u && p != v && mark[p] == collapses) {
+                    common++;
+                    mark[p] = -1;
+                }
+            }
+        }
+        if (common > shared) {
+            continue;
+        }
+
+        // Every vertex at u moves to a vertex at v in one of its triangles, and no
+        // triangle may flip
+        bool valid = true;
+        moved.clear();
+        for (int t : postris[u]) {
+            if (!alive[t]) {
+                continue;
+            }
+            int at = -1, other = -1;
+            for (int k = 0; k < 3; k++) {
+                const int p = posof[tris[3 * t + k]];
+                at = (p == u) ? k : at;
+                other = (p == v) ? k : other;
+            }
+            if (other >= 0) {
+                partner[tris[3 * t + at]] = static_cast<int>(tris[3 * t + other]);
+                moved.push_back(static_cast<int>(tris[3 * t + at]));
+            }
+        }
+        for (int t : postris[u]) {
+            if (!alive[t] || !valid) {
+                continue;
+            }
+            const float* p[3];
+            int at = -1;
+            bool onedge = false;
+            for (int k = 0; k < 3; k++) {
+                p[k] = position(tris[3 * t + k]);
+                const int q = posof[tris[3 * t + k]];
+                at = (q == u) ? k : at;
+                onedge = onedge || (q == v);
+            }
+            if (onedge) {
+                continue;
+            }
+            if (partner[tris[3 * t + at]] < 0) {
+                valid = false;  // A vertex across a seam with nothing to move to
+                break;
+            }
+            double before[3], after[3];
+            faceNormal(p[0], p[1], p[2], before);
+            p[at] = point(v);
+            faceNormal(p[0], p[1], p[2], after);
+            const double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+            const double lengths =
+                std::sqrt((before[0] * before[0] + before[1] * before[1] + before[2] * before[2]) *
+                          (after[0] * after[0] + after[1] * after[1] + after[2] * after[2]));
+            valid = dot > 0.1 * lengths;
+        }
+        if (!valid) {
+            for (int w : moved) {
+                partner[w] = -1;
+            }
+            continue;
+        }
+
+        // Collapse: the triangles on the edge disappear, the others move to v
+        for (int t : postris[u]) {
+            if (!alive[t]) {
+                continue;
+            }
+            bool onedge = false;
+            for (int k = 0; k < 3; k++) {
+                onedge = onedge || (static_cast<int>(posof[tris[3 * t + k]]) == v);
+            }
+            if (onedge) {
+                alive[t] = false;
+                numalive--;
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                GLuint& index = tris[3 * t + k];
+                if (static_cast<int>(posof[index]) == u) {
+                    index = static_cast<GLuint>(partner[index]);
+                }
+            }
+            postris[v].push_back(t);
+        }
+        for (int w : moved) {
+            partner[w] = -1;
+        }
+        postris[u].clear();
+        quadrics[v].add(quadrics[u]);
+        maxcost = std::max(maxcost, double(c.cost));
+        version[u]++;
+        version[v]++;
+
+        // New costs for the edges around v, and drop the dead triangles from its list
+        std::vector<int>& around = postris[v];
+        around.erase(std::remove_if(around.begin(), around.end(), [&](int t) { return !alive[t]; }),
+                     around.end());
+        for (int t : around) {
+            for (int k = 0; k < 3; k++) {
+                const int p = posof[tris[3 * t + k]];
+                if (p != v && mark[p] != -collapses - 2) {
+                    mark[p] = -collapses - 2;
+                    push(v, p);
+                }
+            }
+        }
+    }
+
+    std::vector<GLuint> result;
+    result.reserve(3 * numalive);
+    for (size_t t = 0; t < numtris; t++) {
+        if (alive[t]) {
+            result.insert(result.end(), &tris[3 * t], &tris[3 * t] + 3);
+        }
+    }
+    if (error) {
+        *error = static_cast<float>(std::sqrt(maxcost));
+    }
+    return result;
+}
+
+std::vector<Meshlet> buildMeshlets(std::vector<GLuint>& indices,
+                                   const std::vector<GLfloat>& vertices, int stride,
+                                   int maxvertices, int maxtriangles) {
+    const size_t numtris = indices.size() / 3;
+    const size_t numverts = vertices.size() / stride;
+    std::vector<Meshlet> meshlets;
+    if (numtris == 0) {
+        return meshlets;
+    }
+    maxvertices = std::max(maxvertices, 3);
+    maxtriangles = std::max(maxtriangles, 1);
+
+    const Adjacency adjacency = buildAdjacency(indices, numverts);
+
+    std::vector<GLuint> reordered;
+    reordered.reserve(3 * numtris);
+    std::vector<bool> emitted(numtris, false);
+    std::vector<int> vertexmeshlet(numverts, -1);  // The last meshlet that used each vertex
+    std::vector<int> candidates;
+    size_t seed = 0;
+    for (size_t done = 0; done < numtris;) {
+        const int current = static_cast<int>(meshlets.size());
+        Meshlet meshlet;
+        meshlet.firstindex = static_cast<GLuint>(reordered.size());
+        candidates.clear();
+        int numtriangles = 0;
+        int numvertices = 0;
+        while (numtriangles < maxtriangles) {
+            // The neighbouring triangle with the fewest new vertices, or a new seed
+            int best = -1, bestnew = 4;
+            for (int t : candidates) {
+                if (emitted[t]) {
+                    continue;
+                }
+                int added = 0;
+                for (int k = 0; k < 3; k++) {
+                    added += (vertexmeshlet[indices[3 * t + k]] != current);
+                }
+                if (added < bestnew) {
+                    best = t;
+                    bestnew = added;
+                }
+            }
+            if (best < 0) {
+                while (seed < numtris && emitted[seed]) {
+                    seed++;
+                }
+                if (seed == numtris) {
+                    break;
+                }
+                best = static_cast<int>(seed);
+                bestnew = 0;
+                for (int k = 0; k < 3; k++) {
+                    bestnew += (vertexmeshlet[indices[3 * best + k]] != current);
+                }
+            }
+            if (numvertices + bestnew > maxvertices) {
+                break;
+            }
+
+            emitted[best] = true;
+            done++;
+            numtriangles++;
+            numvertices += bestnew;
+            for (int k = 0; k < 3; k++) {
+                const GLuint v = indices[3 * best + k];
+                reordered.push_back(v);
+                if (vertexmeshlet[v] != current) {
+                    vertexmeshlet[v] = current;
+                    for (const GLuint* corner = adjacency.begin(v); corner != adjacency.end(v);
+                         corner++) {
+                        if (!emitted[*corner / 3]) {
+                            candidates.push_back(static_cast<int>(*corner / 3));
+                        }
+                    }
+                }
+            }
+            // Drop the candidates that were used, to keep the list short
+            candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                            [&](int t) { return emitted[t]; }),
+                             candidates.end());
+        }
+        meshlet.numindices = static_cast<GLuint>(reordered.size()) - meshlet.firstindex;
+        meshlet.numvertices = static_cast<GLuint>(numvertices);
+
+        // Bounding sphere around the center of the bounding box
+        const GLuint* tri = &reordered[meshlet.firstindex];
+        float lo[3], hi[3];
+        for (int c = 0; c < 3; c++) {
+            lo[c] = hi[c] = vertices[size_t(tri[0]) * stride + c];
+        }
+        for (GLuint i = 0; i < meshlet.numindices; i++) {
+            const GLfloat* p = &vertices[size_t(tri[i]) * stride];
+            for (int c = 0; c < 3; c++) {
+                lo[c] = std::min(lo[c], p[c]);
+                hi[c] = std::max(hi[c], p[c]);
+            }
+        }
+        float radius2 = 0.0f;
+        for (int c = 0; c < 3; c++) {
+            meshlet.center[c] = 0.5f * (lo[c] + hi[c]);
+        }
+        for (GLuint i = 0; i < meshlet.numindices; i++) {
+            const GLfloat* p = &vertices[size_t(tri[i]) * stride];
+            const float dx = p[0] - meshlet.center[0];
+            const float dy = p[1] - meshlet.center[1];
+            const float dz = p[2] - meshlet.center[2];
+            radius2 = std::max(radius2, dx * dx + dy * dy + dz * dz);
+        }
+        meshlet.radius = std::sqrt(radius2);
+
+        // Normal cone: the average of the unit face normals, and the widest angle to it
+        std::vector<float> normals;
+        float axis[3] = {0.0f, 0.0f, 0.0f};
+        for (GLuint i = 0; i < meshlet.numindices; i += 3) {
+            double n[3];
+            faceNormal(&vertices[size_t(tri[i]) * stride], &vertices[size_t(tri[i + 1]) * stride],
+                       &vertices[size_t(tri[i + 2]) * stride], n);
+            const double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (length > 0.0) {
+                for (int c = 0; c < 3; c++) {
+                    normals.push_back(static_cast<float>(n[c] / length));
+                    axis[c] += normals.back();
+                }
+            }
+        }
+        const float axislength =
+            std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+        if (axislength > 0.0f) {
+            float mindot = 1.0f;
+            for (int c = 0; c < 3; c++) {
+                meshlet.coneaxis[c] = axis[c] / axislength;
+            }
+            for (size_t i = 0; i < normals.size(); i += 3) {
+                mindot = std::min(mindot, normals[i] * meshlet.coneaxis[0] +
+                                              normals[i + 1] * meshlet.coneaxis[1] +
+                                              normals[i + 2] * meshlet.coneaxis[2]);
+            }
+            // A cone wider than 90 degrees always has some triangle facing the eye, and
+            // keeps the cutoff of 1 that never culls
+            if (mindot > 0.0f) {
+                meshlet.conecutoff = std::sqrt(1.0f - mindot * mindot);
+            }
+        }
+        meshlets.push_back(meshlet);
+    }
+    indices.swap(reordered);
+    return meshlets;
+}
+
+bool meshletBackfacing(const Meshlet& meshlet, const float eye[3]) {
+    // All normals are within the cone, so all triangles face away if the direction from
+    // the eye to every point of the bounding sphere is within 90 degrees minus the cone
+    // angle of the axis, as in meshopt_computeMeshletBounds() of meshoptimizer
+    const float d[3] = {meshlet.center[0] - eye[0], meshlet.center[1] - eye[1],
+                        meshlet.center[2] - eye[2]};
+    const float distance = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    const float dot =
+        d[0] * meshlet.coneaxis[0] + d[1] * meshlet.coneaxis[1] + d[2] * meshlet.coneaxis[2];
+    return dot >= meshlet.conecutoff * distance + meshlet.radius;
+}
+
+Bounds computeBounds(const GLfloat* vertices, int numverts, int stride) {
+    Bounds bounds;
+    if (numverts <= 0) {
+        return bounds;
+    }
+    for (int c = 0; c < 3; c++) {
+        bounds.min[c] = bounds.max[c] = vertices[c];
+    }
+    for (int i = 1; i < numverts; i++) {
+        const GLfloat* p = vertices + size_t(i) * stride;
+        for (int c = 0; c < 3; c++) {
+            bounds.min[c] = std::min(bounds.min[c], p[c]);
+            bounds.max[c] = std::max(bounds.max[c], p[c]);
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        bounds.center[c] = 0.5f * (bounds.min[c] + bounds.max[c]);
+    }
+    // Tighter than half the diagonal of the box for round shapes
+    float radius2 = 0.0f;
+    for (int i = 0; i < numverts; i++) {
+        const GLfloat* p = vertices + size_t(i) * stride;
+        const float dx = p[0] - bounds.center[0];
+        const float dy = p[1] - bounds.center[1];
+        const float dz = p[2] - bounds.center[2];
+        radius2 = std::max(radius2, dx * dx + dy * dy + dz * dz);
+    }
+    bounds.radius = std::sqrt(radius2);
+    return bounds;
+}
+
+void computeNormals(std::vector<GLfloat>& vertices, int stride, std::vector<GLuint>& indices,
+                    float creaseangle, ThreadPool* pool) {
+    const size_t numverts = vertices.size() / size_t(stride);
+    const size_t numtris = indices.size() / 3;
+    if (numverts == 0 || numtris == 0) {
+        return;
+    }
+    std::vector<float> trianglenormals(3 * numtris);
+    forBlocks(numtris, pool, [&](size_t begin, size_t end) {
+        triangleNormals(vertices.data(), stride, indices.data(), begin, end,
+                        trianglenormals.data());
+    });
+
+    // The corners around each position
+    std::vector<GLuint> position;
+    const size_t numpositions = groupPositions(vertices, stride, position, pool);
+    const Adjacency adjacency = buildAdjacency(indices, numpositions, position.data(), pool);
+
+    // A vertex split off at a crease, and a corner that is moved to one
+    struct Split {
+        GLuint vertex;
+        float normal[3];
+    };
+    struct Move {
+        GLuint corner;
+        GLuint split;
+    };
+    const float mincos = std::cos(std::clamp(creaseangle, 0.0f, 180.0f) * 3.14159265f / 180.0f);
+    const bool smooth = creaseangle >= 180.0f;
+    const size_t numblocks = (numpositions + blockSize - 1) / blockSize;
+    std::vector<std::vector<Split>> splits(numblocks);
+    std::vector<std::vector<Move>> moves(numblocks);
+    forBlocks(numpositions, pool, [&](size_t begin, size_t end) {
+        std::vector<float> units;    // The unit normal of the triangle of each corner
+        std::vector<float> normals;  // The normal of each corner
+        // The normals that the vertices of the position got, with the split if it is one
+        struct Assigned {
+            GLuint vertex;
+            const float* normal;
+            int split;
+        };
+        std::vector<Assigned> assigned;
+        std::vector<Split>& blocksplits = splits[begin / blockSize];
+        std::vector<Move>& blockmoves = moves[begin / blockSize];
+        for (size_t p = begin; p < end; p++) {
+            const GLuint* corners = adjacency.begin(p);
+            const size_t count = adjacency.count(p);
+            units.resize(3 * count);
+            normals.resize(3 * count);
+            float all[3] = {0.0f, 0.0f, 0.0f};
+            for (size_t i = 0; i < count; i++) {
+                const float* n = &trianglenormals[3 * (corners[i] / 3)];
+                std::copy(n, n + 3, &units[3 * i]);
+                normalize3(&units[3 * i]);
+                all[0] += n[0];
+                all[1] += n[1];
+                all[2] += n[2];
+            }
+            for (size_t i = 0; i < count; i++) {
+                float* normal = &normals[3 * i];
+                const float* unit = &units[3 * i];
+                // A triangle without an area has no normal to compare
+                if (smooth || dot3(unit, unit) == 0.0f) {
+                    std::copy(all, all + 3, normal);
+                } else {
+                    std::fill(normal, normal + 3, 0.0f);
+                    for (size_t j = 0; j < count; j++) {
+                        if (dot3(unit, &units[3 * j]) >= mincos) {
+                            const float* n = &trianglenormals[3 * (corners[j] / 3)];
+                            normal[0] += n[0];
+                            normal[1] += n[1];
+                            normal[2] += n[2];
+                        }
+                    }
+                }
+                if (!normalize3(normal)) {
+                    normal[0] = 0.0f;
+                    normal[1] = 0.0f;
+                    normal[2] = 1.0f;
+                }
+            }
+
+            // The first normal of a vertex is written to it, and the other normals of its
+            // corners go to splits of it
+            assigned.clear();
+            for (size_t i = 0; i < count; i++) {
+                const GLuint corner = corners[i];
+                const GLuint vertex = indices[corner];
+                const float* normal = &normals[3 * i];
+                const Assigned* match = nullptr;
+                bool seen = false;
+                for (const Assigned& other : assigned) {
+                    if (other.vertex == vertex) {
+                        seen = true;
+                        if (dot3(other.normal, normal) > 0.9999f) {
+                            match = &other;
+                            break;
+                        }
+                    }
+                }
+                if (match != nullptr) {
+                    if (match->split >= 0) {
+                        blockmoves.push_back({corner, GLuint(match->split)});
+                    }
+                    continue;
+                }
+                Assigned entry = {vertex, normal, -1};
+                if (seen) {
+                    entry.split = static_cast<int>(blocksplits.size());
+                    blocksplits.push_back({vertex, {normal[0], normal[1], normal[2]}});
+                    blockmoves.push_back({corner, GLuint(entry.split)});
+                } else {
+                    std::copy(normal, normal + 3, &vertices[size_t(stride) * vertex + 3]);
+                }
+                assigned.push_back(entry);
+            }
+        }
+    });
+
+    // The splits are copies of their vertices at the end, block by block
+    size_t numsplits = 0;
+    for (const std::vector<Split>& blocksplits : splits) {
+        numsplits += blocksplits.size();
+    }
+    vertices.resize(vertices.size() + numsplits * size_t(stride));
+    size_t next = numverts;
+    for (size_t b = 0; b < numblocks; b++) {
+        const size_t base = next;
+        for (const Split& split : splits[b]) {
+            float* copy = &vertices[size_t(stride) * next++];
+            std::copy_n(&vertices[size_t(stride) * split.vertex], stride, copy);
+            std::copy(split.normal, split.normal + 3, copy + 3);
+        }
+        for (const Move& move : moves[b]) {
+            indices[move.corner] = GLuint(base + move.split);
+        }
+    }
+}
+
+void computeTangents(const std::vector<GLfloat>& vertices, int stride,
+                     const std::vector<GLuint>& indices, std::vector<GLfloat>& tangents,
+                     ThreadPool* pool) {
+    const size_t numverts = vertices.size() / size_t(stride);
+    const size_t numtris = indices.size() / 3;
+    tangents.assign(4 * numverts, 0.0f);
+
+    // The tangent of each triangle, and in w the orientation of its texture coordinates, 0 if
+    // they have no area. As in MikkTSpace, the tangent is not divided by the area of the
+    // texture coordinates, which only flips it and would blow tiny triangles up.
+    std::vector<float> triangletangents(4 * numtris);
+    forBlocks(numtris, pool, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; t++) {
+            const float* a = &vertices[size_t(stride) * indices[3 * t]];
+            const float* b = &vertices[size_t(stride) * indices[3 * t + 1]];
+            const float* c = &vertices[size_t(stride) * indices[3 * t + 2]];
+            const float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+            const float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+            const float s1[2] = {b[6] - a[6], b[7] - a[7]};
+            const float s2[2] = {c[6] - a[6], c[7] - a[7]};
+            const float area = s1[0] * s2[1] - s2[0] * s1[1];
+            const float sign = area > 0.0f ? 1.0f : -1.0f;
+            float* tangent = &triangletangents[4 * t];
+            for (int k = 0; k < 3; k++) {
+                tangent[k] = sign * (e1[k] * s2[1] - e2[k] * s1[1]);
+            }
+            tangent[3] = area != 0.0f ? sign : 0.0f;
+        }
+    });
+
+    const Adjacency adjacency = buildAdjacency(indices, numverts, nullptr, pool);
+    forBlocks(numverts, pool, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            const float* p = &vertices[size_t(stride) * v];
+            const float* n = p + 3;
+            // A vector in the plane of the normal, of unit length if it has a length
+            auto project = [n](float* x) {
+                const float d = dot3(n, x);
+                x[0] -= d * n[0];
+                x[1] -= d * n[1];
+                x[2] -= d * n[2];
+                return normalize3(x);
+            };
+            float sum[3] = {0.0f, 0.0f, 0.0f};
+            float orientation = 0.0f;
+            for (const GLuint* corner = adjacency.begin(v); corner != adjacency.end(v); corner++) {
+                const size_t t = *corner / 3;
+                const float* triangle = &triangletangents[4 * t];
+                float tangent[3] = {triangle[0], triangle[1], triangle[2]};
+                if (triangle[3] == 0.0f || !project(tangent)) {
+                    continue;
+                }
+                // The angle of the corner in the plane of the normal
+                const int k = static_cast<int>(*corner % 3);
+                const float* q = &vertices[size_t(stride) * indices[3 * t + (k + 1) % 3]];
+                const float* r = &vertices[size_t(stride) * indices[3 * t + (k + 2) % 3]];
+                float u[3] = {q[0] - p[0], q[1] - p[1], q[2] - p[2]};
+                float w[3] = {r[0] - p[0], r[1] - p[1], r[2] - p[2]};
+                if (!project(u) || !project(w)) {
+                    continue;
+                }
+                const float angle = std::acos(std::clamp(dot3(u, w), -1.0f, 1.0f));
+                sum[0] += angle * tangent[0];
+                sum[1] += angle * tangent[1];
+                sum[2] += angle * tangent[2];
+                orientation += angle * triangle[3];
+            }
+            if (!project(sum)) {
+                // Any direction in the plane of the normal, from the axis least along it
+                const int axis = std::fabs(n[0]) < std::fabs(n[1])
+                                     ? (std::fabs(n[0]) < std::fabs(n[2]) ? 0 : 2)
+                                     : (std::fabs(n[1]) < std::fabs(n[2]) ? 1 : 2);
+                std::fill(sum, sum + 3, 0.0f);
+                sum[axis] = 1.0f;
+                project(sum);
+            }
+            float* tangent = &tangents[4 * v];
+            std::copy(sum, sum + 3, tangent);
+            tangent[3] = orientation < 0.0f ? -1.0f : 1.0f;
+        }
+    });
+}
+
+uint16_t encodeHalf(float value) {
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    const uint32_t sign = (f >> 16) & 0x8000u;
+    const uint32_t absf = f & 0x7FFFFFFFu;
+
+    if (absf >= 0x47800000u) {  // Too large for a half (>= 65536), infinity or NaN
+        return static_cast<uint16_t>(sign | ((absf > 0x7F800000u) ? 0x7E00u : 0x7C00u));
+    }
+    if (absf < 0x38800000u) {  // Below the smallest normal half (2^-14): subnormal or zero
+        float a;
+        memcpy(&a, &absf, sizeof(a));
+        return static_cast<uint16_t>(sign | static_cast<uint32_t>(std::lrint(a * 16777216.0f)));
+    }
+    // Rebias the exponent from 127 to 15 and round the 23 bit mantissa to 10 bits
+    uint32_t h = (absf - 0x38000000u) >> 13;
+    const uint32_t rest = absf & 0x1FFFu;
+    if (rest > 0x1000u || (rest == 0x1000u && (h & 1u))) {
+        h++;
+    }
+    return static_cast<uint16_t>(sign | h);
+}
+
+float decodeHalf(uint16_t half) {
+    const uint32_t sign = (half & 0x8000u) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1Fu;
+    const uint32_t mantissa = half & 0x3FFu;
+    if (exponent == 0) {  // Zero or subnormal
+        const float value = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -value : value;
+    }
+    uint32_t f;
+    if (exponent == 31) {  // Infinity or NaN
+        f = sign | 0x7F800000u | (mantissa << 13);
+    } else {
+        f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float value;
+    memcpy(&value, &f, sizeof(value));
+    return value;
+}
+
+uint32_t encodeOctahedral(float nx, float ny, float nz) {
+    const float l1 = std::fabs(nx) + std::fabs(ny) + std::fabs(nz);
+    float u = (l1 > 0.0f) ? nx / l1 : 0.0f;
+    float v = (l1 > 0.0f) ? ny / l1 : 0.0f;
+    if (nz < 0.0f) {  // Fold the lower hemisphere over the diagonals
+        const float fu = (1.0f - std::fabs(v)) * ((u >= 0.0f) ? 1.0f : -1.0f);
+        const float fv = (1.0f - std::fabs(u)) * ((v >= 0.0f) ? 1.0f : -1.0f);
+        u = fu;
+        v = fv;
+    }
+    // Signed normalized 10 bit values in two's complement
+    auto snorm10 = [](float x) {
+        const long q = std::lrint(std::clamp(x, -1.0f, 1.0f) * 511.0f);
+        return static_cast<uint32_t>(q) & 0x3FFu;
+    };
+    return snorm10(u) | (snorm10(v) << 10);
+}
+
+}  // namespace mesh
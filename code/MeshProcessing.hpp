@@ -0,0 +1,208 @@
+/*
+ * Functions to process indexed triangle meshes on the CPU.
+ *
+ * Usage: The functions work on plain index arrays (3 indices per triangle) and on interleaved
+ *        vertex arrays with 'stride' floats per vertex, where the first three floats of each
+ *        vertex are the position, as in TriangleSoup.
+ *        TriangleSoup::optimize() combines them to make meshes render faster.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+namespace mesh {
+
+// Axis aligned bounding box and bounding sphere of a mesh, in the coordinates of its vertices
+struct Bounds {
+    float min[3] = {0.0f, 0.0f, 0.0f};     // Corner of the box with the smallest coordinates
+    float max[3] = {0.0f, 0.0f, 0.0f};     // Corner of the box with the largest coordinates
+    float center[3] = {0.0f, 0.0f, 0.0f};  // Center of the box and of the sphere
+    float radius = 0.0f;                   // Radius of the sphere
+};
+
+// A cluster of triangles that are consecutive in the index array, with bounds for culling
+// the cluster as a whole
+struct Meshlet {
+    GLuint firstindex = 0;   // First index of the meshlet in the index array
+    GLuint numindices = 0;   // Number of indices, three per triangle
+    GLuint numvertices = 0;  // Number of distinct vertices used by the triangles
+    float center[3] = {0.0f, 0.0f, 0.0f};  // Bounding sphere
+    float radius = 0.0f;
+    float coneaxis[3] = {0.0f, 0.0f, 1.0f};  // Normal cone: the average facing direction,
+    float conecutoff = 1.0f;                 // and the sine of the widest normal's angle to it
+};
+
+// Statistics from a simulation of a FIFO post-transform vertex cache
+struct CacheStats {
+    double acmr = 0.0;  // Average cache miss ratio: transformed vertices per triangle (0.5 - 3)
+    double atvr = 0.0;  // Average transformed vertex ratio: transformed / unique vertices (>= 1)
+};
+
+/*
+ * The corners around each node of a mesh on compact (CSR) form. Corner c is index c of the
+ * index array, corner c % 3 of triangle c / 3, and the corners around node n are
+ * corners[offsets[n]] to corners[offsets[n + 1] - 1], in increasing order. The nodes are
+ * the vertices, or groups of them, such as the positions of groupPositions().
+ */
+struct Adjacency {
+    std::vector<GLuint> offsets;  // One per node, and the number of corners at the end
+    std::vector<GLuint> corners;
+
+    size_t numNodes() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    GLuint count(size_t node) const { return offsets[node + 1] - offsets[node]; }
+    const GLuint* begin(size_t node) const { return corners.data() + offsets[node]; }
+    const GLuint* end(size_t node) const { return corners.data() + offsets[node + 1]; }
+};
+
+// An edge between two nodes of an Adjacency
+struct Edge {
+    GLuint a = 0, b = 0;     // The nodes, a < b
+    GLuint triangles = 0;    // Triangles on the edge: 1 on a border, 2 inside a manifold
+    GLuint triangle = 0;     // The first of them
+};
+
+/*
+ * Build the corners around each of 'numnodes' nodes, the vertices of 'indices', or the
+ * nodes group[v] of the vertices if 'group' is not null. A counting sort in linear time:
+ * with 'pool', each of its threads counts and places the corners of a part of the index
+ * array, and the offsets are summed over the nodes in blocks.
+ */
+Adjacency buildAdjacency(const std::vector<GLuint>& indices, size_t numnodes,
+                         const GLuint* group = nullptr, ThreadPool* pool = nullptr);
+
+/*
+ * The edges of the triangles between different nodes of 'adjacency', which was built with
+ * the same 'indices' and 'group', each once, in order of a and then b.
+ */
+std::vector<Edge> buildEdges(const Adjacency& adjacency, const std::vector<GLuint>& indices,
+                             const GLuint* group = nullptr, ThreadPool* pool = nullptr);
+
+/*
+ * Number the positions of the vertices into 'position', the same number for the vertices
+ * at the same position, as on texture seams, and return the number of positions. The
+ * positions are numbered in the order of their first vertex, with a parallel sort of the
+ * vertices by a hash of their position.
+ */
+size_t groupPositions(const std::vector<GLfloat>& vertices, int stride,
+                      std::vector<GLuint>& position, ThreadPool* pool = nullptr);
+
+// Simulate a FIFO vertex cache of the given size for the triangles in 'indices'
+CacheStats analyzeVertexCache(const std::vector<GLuint>& indices, int numverts,
+                              int cachesize = 16);
+
+/*
+ * Reorder triangles for post-transform vertex cache locality with the Tipsify algorithm
+ * (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced
+ * Overdraw", SIGGRAPH 2007). Runs in linear time.
+ * If 'clusters' is not null, it receives the start (in triangles) of each cluster of the
+ * result, a sequence of triangles that starts after a cache flush.
+ */
+std::vector<GLuint> optimizeVertexCache(const std::vector<GLuint>& indices, int numverts,
+                                        int cachesize = 16, std::vector<int>* clusters = nullptr);
+
+/*
+ * Reorder the clusters found by optimizeVertexCache() to reduce overdraw, drawing clusters
+ * on the outside of the mesh and facing outwards first. The order of triangles within each
+ * cluster is kept, so the vertex cache efficiency only changes at cluster boundaries.
+ */
+std::vector<GLuint> optimizeOverdraw(const std::vector<GLuint>& indices,
+                                     const std::vector<GLfloat>& vertices, int stride,
+                                     const std::vector<int>& clusters);
+
+/*
+ * Reorder the vertices in the order they are first used by the index array, to improve
+ * the locality of vertex fetches. The index array is updated to match. Unused vertices are
+ * moved to the end of the vertex array.
+ */
+void optimizeVertexFetch(std::vector<GLfloat>& vertices, int stride, std::vector<GLuint>& indices);
+
+/*
+ * Simplify a mesh by collapsing edges in order of increasing quadric error (Garland and
+ * Heckbert, "Surface Simplification Using Quadric Error Metrics", SIGGRAPH 1997), until at
+ * most 'targetindices' indices remain or no more edges can be collapsed. Each collapse moves
+ * one vertex onto a neighbour, so the result indexes the same vertex array, and unused
+ * vertices can be removed afterwards with optimizeVertexFetch().
+ * Vertices at the same position, as on texture seams, are collapsed together, and border
+ * vertices only move along the border. Collapses that would flip a triangle are skipped.
+ * If 'error' is not null, it receives an estimate of the largest distance between the
+ * result and the original surface. With 'lockborder' set, border vertices do not move at
+ * all, so that the pieces of a mesh that are simplified apart still meet at their borders.
+ */
+std::vector<GLuint> simplify(const std::vector<GLuint>& indices,
+                             const std::vector<GLfloat>& vertices, int stride,
+                             size_t targetindices, float* error = nullptr,
+                             bool lockborder = false);
+
+/*
+ * Partition the triangles into meshlets of at most 'maxvertices' distinct vertices and
+ * 'maxtriangles' triangles, and reorder the index array so that each meshlet is a range of
+ * it. Meshlets grow greedily over neighbouring triangles, preferring those that add the
+ * fewest new vertices, so they are compact and the vertex cache order is mostly kept.
+ */
+std::vector<Meshlet> buildMeshlets(std::vector<GLuint>& indices,
+                                   const std::vector<GLfloat>& vertices, int stride,
+                                   int maxvertices = 64, int maxtriangles = 124);
+
+/*
+ * True if all triangles of the meshlet face away from the eye at 'eye', in the coordinates
+ * of the vertices. Conservative: false when in doubt.
+ */
+bool meshletBackfacing(const Meshlet& meshlet, const float eye[3]);
+
+/*
+ * Compute the bounds of 'numverts' vertices with 'stride' floats each. The sphere is centered
+ * on the box, with the distance to the farthest vertex as radius.
+ */
+Bounds computeBounds(const GLfloat* vertices, int numverts, int stride);
+
+/*
+ * Compute smooth normals into floats 3 to 5 of each vertex: the sum of the normals of the
+ * triangles around the position of the vertex, weighted by their area, and normalized.
+ * Vertices at the same position share their normal, also across texture seams, but only
+ * over the triangles whose normals are within 'creaseangle' degrees of each other: a corner
+ * of a triangle sums the triangles at its position that are within the angle of its own,
+ * and a vertex whose corners get different normals is split, with the copies appended to
+ * 'vertices' and the indices of those corners changed to them. 180 makes all smooth, 0
+ * gives each triangle its own normal where it meets others at any angle.
+ * The triangle normals are computed four at a time with SIMD, and with 'pool' the work is
+ * spread over its threads, for meshes of millions of triangles.
+ */
+void computeNormals(std::vector<GLfloat>& vertices, int stride, std::vector<GLuint>& indices,
+                    float creaseangle = 60.0f, ThreadPool* pool = nullptr);
+
+/*
+ * Compute a tangent for each vertex, 4 floats per vertex in 'tangents', with the
+ * conventions of MikkTSpace that glTF and the normal map bakers use: xyz is the direction
+ * of increasing s in the plane of the normal, and w is the sign of the bitangent, which is
+ * w * cross(normal, tangent) for the direction of increasing t. The tangent of each
+ * triangle from its texture coordinates is projected into the plane of the vertex normal,
+ * and the triangles are weighted by the angle of their corner at the vertex. The vertices
+ * are not split where the frames of their triangles differ, as MikkTSpace does, so the
+ * result is the same as its only where the mesh is split at mirrored texture seams.
+ * The vertices have the position in floats 0 to 2, the normal in 3 to 5, and the texture
+ * coordinates in 6 and 7. Vertices without a triangle get any tangent of their normal.
+ */
+void computeTangents(const std::vector<GLfloat>& vertices, int stride,
+                     const std::vector<GLuint>& indices, std::vector<GLfloat>& tangents,
+                     ThreadPool* pool = nullptr);
+
+// Convert a float to a 16-bit IEEE half float (GL_HALF_FLOAT), rounding to nearest even
+uint16_t encodeHalf(float value);
+
+// Convert a half float back to a float
+float decodeHalf(uint16_t half);
+
+/*
+ * Encode a unit normal with the octahedral mapping into the x and y components of a signed,
+ * normalized GL_INT_2_10_10_10_REV value (z and w are zero). The shader decodes it with
+ * n = (x, y, 1 - |x| - |y|), folding the lower hemisphere back when n.z < 0.
+ */
+uint32_t encodeOctahedral(float nx, float ny, float nz);
+
+}  // namespace mesh
@@ -0,0 +1,113 @@
+/*
+ * Several views of the same scene from one submission of the draws
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "MultiView.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Frustum.hpp"
+#include "TriangleSoup.hpp"
+#include "UniformBuffers.hpp"
+
+MultiView::MultiView(int views, bool onepass)
+    : views_(std::min(std::max(views, 1), maxViews))
+    , mode_(Mode::Sequential)
+    , data_()
+    , viewports_()
+    , offsets_() {
+    if (onepass && views_ > 1 && (GLEW_VERSION_4_1 || GLEW_ARB_viewport_array) &&
+        GLEW_ARB_shader_viewport_layer_array) {
+        mode_ = Mode::Viewports;
+    }
+    for (int i = 0; i < maxViews; i++) {
+        data_.P[i] = Mat4::identity();
+        data_.offset[i] = Mat4::identity();
+    }
+}
+
+int MultiView::views() const { return views_; }
+
+MultiView::Mode MultiView::mode() const { return mode_; }
+
+const char* MultiView::modeName(Mode mode) {
+    return (mode == Mode::Viewports) ? "viewports" : "sequential";
+}
+
+std::string MultiView::defines() const {
+    return (mode_ == Mode::Viewports) ? " MULTI_VIEW MULTI_VIEW_VIEWPORTS" : " MULTI_VIEW";
+}
+
+void MultiView::setView(int view, const Mat4& P, const Mat4& offset, int x, int y, int width,
+                        int height) {
+    if (view < 0 || view >= views_) {
+        return;
+    }
+    data_.P[view] = P;
+    data_.offset[view] = offset;
+    viewports_[view] = Viewport{x, y, width, height};
+}
+
+void MultiView::setPanorama(const Mat4& P, int width, int height) {
+    // A column of 1/n of the width has n times the horizontal scale of P, and a horizontal
+    // field of view of 2 atan(1 / (n P[0][0])), which is how far apart the views turn
+    const float n = static_cast<float>(views_);
+    const Mat4 columnP = Mat4::scale(n, 1.0f, 1.0f) * P;
+    const float step = 2.0f * std::atan(1.0f / columnP.m[0]);
+    for (int i = 0; i < views_; i++) {
+        const float turn = (static_cast<float>(i) - 0.5f * (n - 1.0f)) * step;
+        const int x = width * i / views_;
+        setView(i, columnP, Mat4::rotationY(turn), x, 0, width * (i + 1) / views_ - x, height);
+    }
+}
+
+void MultiView::push(UniformRing& uniforms) {
+    if (mode_ == Mode::Viewports) {
+        data_.count = views_;
+        data_.first = 0;
+        offsets_[0] = uniforms.push(data_);
+        return;
+    }
+    for (int i = 0; i < views_; i++) {
+        data_.count = 1;
+        data_.first = i;
+        offsets_[i] = uniforms.push(data_);
+    }
+}
+
+int MultiView::passes() const { return (mode_ == Mode::Viewports) ? 1 : views_; }
+
+void MultiView::beginPass(int pass, const UniformRing& uniforms) const {
+    uniforms.bind(viewBlockBinding, offsets_[pass], sizeof(ViewUniforms));
+    if (mode_ == Mode::Viewports) {
+        for (int i = 0; i < views_; i++) {
+            const Viewport& viewport = viewports_[i];
+            glViewportIndexedf(static_cast<GLuint>(i), static_cast<GLfloat>(viewport.x),
+                               static_cast<GLfloat>(viewport.y),
+                               static_cast<GLfloat>(viewport.width),
+                               static_cast<GLfloat>(viewport.height));
+        }
+        TriangleSoup::setViewInstances(views_);
+        return;
+    }
+    const Viewport& viewport = viewports_[pass];
+    glViewport(viewport.x, viewport.y, viewport.width, viewport.height);
+}
+
+void MultiView::end(int width, int height) const {
+    TriangleSoup::setViewInstances(1);
+    glViewport(0, 0, width, height);  // Sets all viewports of a viewport array
+}
+
+bool MultiView::visible(const Mat4& MV, const mesh::Bounds& bounds) const {
+    for (int i = 0; i < views_; i++) {
+        if (Frustum::fromMatrix(data_.P[i] * data_.offset[i] * MV).intersects(bounds)) {
+            return true;
+        }
+    }
+    return false;
+}
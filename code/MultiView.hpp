@@ -0,0 +1,108 @@
+/*
+ * Several views of the same scene in one framebuffer, such as the displays of a wall or
+ * viewports side by side in one window, from one submission of the draws: each draw is one
+ * instanced draw with an instance per view, which the vertex shader puts in its view.
+ *
+ * Usage: Set the views every frame with setView(): the projection of each, the matrix from
+ *        the view space of the frame (of P and MV in the uniform blocks) to that of the view,
+ *        and its viewport. setPanorama() sets them for a wall of displays side by side.
+ *        Build the shaders that draw the views with defines(), the MULTI_VIEW variants of
+ *        vertex.glsl (views.glsl). Every frame, push() the views into the UniformRing before
+ *        its upload(), and draw the scene once for each pass in passes(), after
+ *        beginPass(), then call end(), which restores the viewport.
+ *        With viewport arrays (OpenGL 4.1) and GL_ARB_shader_viewport_layer_array, with
+ *        which the vertex shader chooses the viewport, all views are drawn in one pass, in
+ *        Mode::Viewports: beginPass() makes TriangleSoup::render() and renderDepth() draw
+ *        views() instances, and instance i goes to viewport i. Otherwise, or with a
+ *        geometry shader, which the vertex shader can not choose the viewport past, each
+ *        view is a pass of its own with its glViewport(), in Mode::Sequential.
+ *        The views share everything else: the meshes, the textures and the programs of the
+ *        context, and the uniform data of the frame and of the objects, pushed once. The
+ *        shading is that of the view of the frame, only the positions are the view's.
+ *        Cull with visible(), which tests a mesh against the frustums of all views.
+ *        Draws that do not go through render() or renderDepth(), such as renderInstanced(),
+ *        are not drawn in the other views.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstddef>
+#include <string>
+
+#include "Mat4.hpp"
+#include "MeshProcessing.hpp"
+
+class UniformRing;
+
+// The uniform block ViewData of views.glsl, std140 layout
+struct ViewUniforms {
+    Mat4 P[4];            // Projection of each view, MultiView::maxViews
+    Mat4 offset[4];       // From the view space of the frame to that of each view
+    GLint count = 1;      // Views drawn by the instances of one draw
+    GLint first = 0;      // The view of the first instance
+    GLint unused[2] = {};  // std140 pads the block to a multiple of 16 bytes
+};
+
+static_assert(sizeof(ViewUniforms) == 528, "ViewUniforms must match the std140 layout");
+
+class MultiView {
+public:
+    enum class Mode { Viewports, Sequential };
+
+    static constexpr int maxViews = 4;
+
+    /* Constructor: 'views' views, all in one pass if the GL context can and 'onepass' is
+     * true, which it is not with a geometry shader */
+    explicit MultiView(int views = 1, bool onepass = true);
+
+    int views() const;
+    Mode mode() const;
+
+    // "viewports" or "sequential"
+    static const char* modeName(Mode mode);
+
+    // The defines of the shader variants that draw the views
+    std::string defines() const;
+
+    // Set view 'view': its projection P, the matrix 'offset' to its view space from that of
+    // the frame, and its viewport in the framebuffer
+    void setView(int view, const Mat4& P, const Mat4& offset, int x, int y, int width,
+                 int height);
+
+    /* Set the views for displays side by side in a 'width' x 'height' framebuffer, each a
+     * column of the same width, for the projection P of the whole framebuffer: the views
+     * have the vertical field of view of P, and turn about the vertical axis so that they
+     * continue each other from left to right, around the view of the frame in the middle. */
+    void setPanorama(const Mat4& P, int width, int height);
+
+    // Push the data of the views for this frame, before uniforms.upload()
+    void push(UniformRing& uniforms);
+
+    // The passes to draw the scene in, 1 in Mode::Viewports
+    int passes() const;
+
+    // Bind the views of 'pass' and set their viewports, for the draws of the pass
+    void beginPass(int pass, const UniformRing& uniforms) const;
+
+    // Draw once again, in the viewport 'width' x 'height'
+    void end(int width, int height) const;
+
+    // Whether 'bounds', with the model-view matrix MV, may be seen in any view
+    bool visible(const Mat4& MV, const mesh::Bounds& bounds) const;
+
+private:
+    struct Viewport {
+        int x;
+        int y;
+        int width;
+        int height;
+    };
+
+    int views_;
+    Mode mode_;
+    ViewUniforms data_;
+    Viewport viewports_[maxViews];
+    ptrdiff_t offsets_[maxViews];  // Of the pushed data of each pass
+};
@@ -0,0 +1,328 @@
+/*
+ * A performance overlay drawn with Nuklear in one draw call per frame
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "Overlay.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <vector>
+
+#include "FrameProfiler.hpp"
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "Shader.hpp"
+#include "StreamBuffer.hpp"
+#include "TriangleSoup.hpp"
+
+// The immediate mode GUI that comes with GLFW, private to this file and without our warnings
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wunused-function"
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
+#if !defined(__clang__)
+// Which only GCC has, from its optimizer, in functions of Nuklear that it inlines
+#pragma GCC diagnostic ignored "-Wstringop-overflow"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#elif defined(_MSC_VER)
+#pragma warning(push, 0)
+#endif
+#define NK_INCLUDE_FIXED_TYPES
+#define NK_INCLUDE_STANDARD_IO
+#define NK_INCLUDE_STANDARD_VARARGS
+#define NK_INCLUDE_DEFAULT_ALLOCATOR
+#define NK_INCLUDE_VERTEX_BUFFER_OUTPUT
+#define NK_INCLUDE_FONT_BAKING
+#define NK_INCLUDE_DEFAULT_FONT
+#define NK_IMPLEMENTATION
+#include "glfw-3.3.2/deps/nuklear.h"
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#elif defined(_MSC_VER)
+#pragma warning(pop)
+#endif
+
+namespace {
+
+// The vertices of nk_convert(), as vertex_overlay.glsl reads them
+struct OverlayVertex {
+    GLfloat position[2];
+    GLfloat texcoord[2];
+    GLubyte color[4];
+};
+
+// Room per frame in the stream buffer. A frame that needs more is not drawn.
+const size_t vertexBytes = 256 * 1024;
+const size_t indexBytes = 64 * 1024;
+
+const float width = 300.0f;
+const float rowHeight = 16.0f;
+const float graphHeight = 60.0f;
+const float margin = 8.0f;  // From the corner of the viewport
+
+// Rows of rowHeight and graphs, with the padding of the window and the spacing of the rows
+float panelHeight(int rows, int graphs) {
+    return 8.0f + float(rows) * (rowHeight + 4.0f) + float(graphs) * (graphHeight + 4.0f);
+}
+
+float megabytes(double bytes) { return static_cast<float>(bytes / double(1 << 20)); }
+
+}  // namespace
+
+struct Overlay::State {
+    nk_context context;
+    nk_font_atlas atlas;
+    nk_draw_null_texture null;
+    nk_buffer commands;
+    Shader shader;
+    StreamBuffer stream{vertexBytes + indexBytes};
+    GLuint font = 0;
+    GLuint vao = 0;
+    std::vector<float> cpu;
+    std::vector<float> gpu;
+    gpumem::DeviceMemory device;
+    int frame = 0;
+    int vertices = 0;
+    int indices = 0;
+};
+
+Overlay::Overlay(int frames) : frames_(std::max(frames, 2)) {}
+
+Overlay::~Overlay() {
+    if (!state_) {
+        return;
+    }
+    nk_buffer_free(&state_->commands);
+    nk_free(&state_->context);
+    nk_font_atlas_clear(&state_->atlas);
+    glstate::deleteTextures(1, &state_->font);
+    glstate::deleteVertexArrays(1, &state_->vao);
+}
+
+void Overlay::create() {
+    state_ = std::make_unique<State>();
+    State& s = *state_;
+    s.shader.createShader("vertex_overlay.glsl", "fragment_overlay.glsl");
+
+    // The font, with the white texel for the shapes, as one coverage texture
+    nk_font_atlas_init_default(&s.atlas);
+    nk_font_atlas_begin(&s.atlas);
+    nk_font* font = nk_font_atlas_add_default(&s.atlas, 13.0f, nullptr);
+    int atlaswidth = 0;
+    int atlasheight = 0;
+    const void* pixels = nk_font_atlas_bake(&s.atlas, &atlaswidth, &atlasheight,
+                                            NK_FONT_ATLAS_ALPHA8);
+    glGenTextures(1, &s.font);
+    glstate::bindTexture(GL_TEXTURE_2D, s.font);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlaswidth, atlasheight, 0, GL_RED, GL_UNSIGNED_BYTE,
+                 pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    gpumem::setTexture(s.font, gpumem::Category::Texture,
+                       gpumem::textureBytes(GL_R8, atlaswidth, atlasheight));
+    nk_font_atlas_end(&s.atlas, nk_handle_id(static_cast<int>(s.font)), &s.null);
+    nk_init_default(&s.context, &font->handle);
+    nk_buffer_init_default(&s.commands);
+
+    // The attribute pointers are set for each frame, at its region of the stream buffer
+    glGenVertexArrays(1, &s.vao);
+    glstate::bindVertexArray(s.vao);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glstate::bindVertexArray(0);
+
+    s.cpu.resize(static_cast<size_t>(frames_));
+    s.gpu.resize(static_cast<size_t>(frames_));
+}
+
+void Overlay::render(const FrameProfiler& profiler) {
+    if (!state_) {
+        create();
+    }
+    State& s = *state_;
+    nk_context* ctx = &s.context;
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    // The graphs end at the last frame whose GPU time is known, so both lines are as long
+    int count = profiler.recentFrameTimes(frames_, s.cpu.data(), s.gpu.data());
+    while (count > 0 && s.gpu[static_cast<size_t>(count) - 1] < 0.0f) {
+        count--;
+    }
+    float highest = 1000.0f / 60.0f;
+    for (int i = 0; i < count; i++) {
+        highest = std::max(highest, std::max(s.cpu[static_cast<size_t>(i)],
+                                             s.gpu[static_cast<size_t>(i)]));
+    }
+    std::vector<int> scopes;
+    for (int i = 0; i < profiler.scopeCount(); i++) {
+        if (profiler.recentScopeGPUTime(i, frames_) >= 0.0) {
+            scopes.push_back(i);
+        }
+    }
+    // The driver is asked again once per graph, not every frame
+    if (s.frame++ % frames_ == 0) {
+        gpumem::queryDevice(s.device);
+    }
+    const int categories = static_cast<int>(gpumem::Category::Count);
+    const int rows = 3 + static_cast<int>(scopes.size()) + categories + (s.device.known ? 1 : 0);
+
+    const char* name = "Performance";
+    const struct nk_rect bounds = nk_rect(margin, margin, width, panelHeight(rows, 1));
+    nk_window_set_bounds(ctx, name, bounds);
+    if (nk_begin(ctx, name, bounds, NK_WINDOW_BORDER | NK_WINDOW_NO_SCROLLBAR)) {
+        const nk_color cpucolor = nk_rgb(90, 170, 255);
+        const nk_color gpucolor = nk_rgb(255, 150, 60);
+        nk_layout_row_dynamic(ctx, rowHeight, 2);
+        nk_labelf_colored(ctx, NK_TEXT_LEFT, cpucolor, "CPU %.2f ms",
+                          count > 0 ? s.cpu[static_cast<size_t>(count) - 1] : 0.0f);
+        nk_labelf_colored(ctx, NK_TEXT_LEFT, gpucolor, "GPU %.2f ms",
+                          count > 0 ? s.gpu[static_cast<size_t>(count) - 1] : 0.0f);
+        nk_layout_row_dynamic(ctx, graphHeight, 1);
+        if (nk_chart_begin_colored(ctx, NK_CHART_LINES, cpucolor, cpucolor, count, 0.0f,
+                                   highest)) {
+            nk_chart_add_slot_colored(ctx, NK_CHART_LINES, gpucolor, gpucolor, count, 0.0f,
+                                      highest);
+            for (int i = 0; i < count; i++) {
+                nk_chart_push_slot(ctx, s.cpu[static_cast<size_t>(i)], 0);
+                nk_chart_push_slot(ctx, std::max(s.gpu[static_cast<size_t>(i)], 0.0f), 1);
+            }
+            nk_chart_end(ctx);
+        }
+
+        // The GPU time of each pass
+        nk_layout_row_dynamic(ctx, rowHeight, 2);
+        for (int i : scopes) {
+            nk_label(ctx, profiler.scopeName(i), NK_TEXT_LEFT);
+            nk_labelf(ctx, NK_TEXT_RIGHT, "%.3f ms", profiler.recentScopeGPUTime(i, frames_));
+        }
+
+        const TriangleSoup::DrawCounts draws = TriangleSoup::drawCounts();
+        nk_labelf(ctx, NK_TEXT_LEFT, "%lld draws", draws.draws);
+        nk_labelf(ctx, NK_TEXT_RIGHT, "%lld triangles", draws.triangles);
+
+        // The memory of each category, and what is left of its budget
+        for (int i = 0; i < categories; i++) {
+            const gpumem::Category category = static_cast<gpumem::Category>(i);
+            const long long headroom = gpumem::headroom(category);
+            nk_labelf(ctx, NK_TEXT_LEFT, "%s %.1f MB", gpumem::categoryName(category),
+                      megabytes(double(gpumem::usedBytes(category))));
+            if (headroom == LLONG_MAX) {
+                nk_label(ctx, "no budget", NK_TEXT_RIGHT);
+            } else {
+                nk_labelf(ctx, NK_TEXT_RIGHT, "%.1f MB left", megabytes(double(headroom)));
+            }
+        }
+        nk_labelf(ctx, NK_TEXT_LEFT, "total %.1f MB", megabytes(double(gpumem::totalBytes())));
+        nk_label(ctx, "", NK_TEXT_LEFT);
+        if (s.device.known) {
+            nk_label(ctx, "device free", NK_TEXT_LEFT);
+            if (s.device.total > 0) {
+                nk_labelf(ctx, NK_TEXT_RIGHT, "%.0f of %.0f MB",
+                          megabytes(double(s.device.available)),
+                          megabytes(double(s.device.total)));
+            } else {
+                nk_labelf(ctx, NK_TEXT_RIGHT, "%.0f MB", megabytes(double(s.device.available)));
+            }
+        }
+    }
+    nk_end(ctx);
+
+    // Everything into this frame's region of the stream buffer, written in place
+    s.stream.beginFrame();
+    ptrdiff_t vertexoffset = 0;
+    ptrdiff_t indexoffset = 0;
+    void* vertexdata = s.stream.allocate(vertexBytes, vertexoffset);
+    void* indexdata = s.stream.allocate(indexBytes, indexoffset);
+    s.vertices = 0;
+    s.indices = 0;
+    if (vertexdata && indexdata) {
+        static const nk_draw_vertex_layout_element layout[] = {
+            {NK_VERTEX_POSITION, NK_FORMAT_FLOAT, NK_OFFSETOF(OverlayVertex, position)},
+            {NK_VERTEX_TEXCOORD, NK_FORMAT_FLOAT, NK_OFFSETOF(OverlayVertex, texcoord)},
+            {NK_VERTEX_COLOR, NK_FORMAT_R8G8B8A8, NK_OFFSETOF(OverlayVertex, color)},
+            {NK_VERTEX_LAYOUT_END}};
+        nk_convert_config config = {};
+        config.vertex_layout = layout;
+        config.vertex_size = sizeof(OverlayVertex);
+        config.vertex_alignment = NK_ALIGNOF(OverlayVertex);
+        config.null = s.null;
+        config.circle_segment_count = 12;
+        config.curve_segment_count = 12;
+        config.arc_segment_count = 12;
+        config.global_alpha = 1.0f;
+        config.shape_AA = NK_ANTI_ALIASING_ON;
+        config.line_AA = NK_ANTI_ALIASING_ON;
+        nk_buffer vertices;
+        nk_buffer indices;
+        nk_buffer_init_fixed(&vertices, vertexdata, vertexBytes);
+        nk_buffer_init_fixed(&indices, indexdata, indexBytes);
+        if (nk_convert(ctx, &s.commands, &vertices, &indices, &config) == NK_CONVERT_SUCCESS) {
+            s.vertices = static_cast<int>(vertices.allocated / sizeof(OverlayVertex));
+            s.indices = static_cast<int>(indices.allocated / sizeof(nk_draw_index));
+        }
+        s.stream.flush();
+    }
+    nk_clear(ctx);
+    nk_buffer_clear(&s.commands);
+    if (s.indices == 0) {
+        return;
+    }
+
+    // The state changed below, to restore at the end
+    GLint polygonmode[2];
+    glGetIntegerv(GL_POLYGON_MODE, polygonmode);
+    const GLboolean depthtest = glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean cullface = glIsEnabled(GL_CULL_FACE);
+    const GLboolean blend = glIsEnabled(GL_BLEND);
+
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    s.shader.use();
+    s.shader.setUniform("viewportSize", float(viewport[2]), float(viewport[3]));
+    s.shader.setUniform("font", 0);
+    glstate::activeTexture(GL_TEXTURE0);
+    glstate::bindTexture(GL_TEXTURE_2D, s.font);
+    glstate::bindVertexArray(s.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, s.stream.id());
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, s.stream.id());
+    const GLsizei stride = sizeof(OverlayVertex);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride,
+                          (void*)(vertexoffset + offsetof(OverlayVertex, position)));
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,
+                          (void*)(vertexoffset + offsetof(OverlayVertex, texcoord)));
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                          (void*)(vertexoffset + offsetof(OverlayVertex, color)));
+    glDrawElements(GL_TRIANGLES, s.indices, GL_UNSIGNED_SHORT, (void*)indexoffset);
+    glstate::bindVertexArray(0);
+
+    glPolygonMode(GL_FRONT_AND_BACK, static_cast<GLenum>(polygonmode[0]));
+    if (depthtest) {
+        glEnable(GL_DEPTH_TEST);
+    }
+    if (cullface) {
+        glEnable(GL_CULL_FACE);
+    }
+    if (!blend) {
+        glDisable(GL_BLEND);
+    }
+}
+
+int Overlay::vertexCount() const { return state_ ? state_->vertices : 0; }
+
+int Overlay::indexCount() const { return state_ ? state_->indices : 0; }
@@ -0,0 +1,55 @@
+/*
+ * A performance overlay drawn in the window with Nuklear (glfw-3.3.2/deps/nuklear.h): frame
+ * time graphs, the GPU time of the profiler scopes, draw and triangle counts, and the GPU
+ * memory of each category against its budget.
+ *
+ * Usage: Call render() on the thread of the GL context at the end of a frame, after the
+ *        last pass and before the buffer swap, with the default framebuffer bound. It
+ *        blends the panel over the upper left corner of the viewport.
+ *        The graphs show the CPU and the GPU time of the last frames from the FrameProfiler,
+ *        and the table the average GPU time of each scope over the same frames. The draw
+ *        calls and triangles are those of TriangleSoup::drawCounts(), so reset them with
+ *        TriangleSoup::resetDrawCounts() at the start of every frame. The memory comes from
+ *        gpumem, and from the driver where gpumem::queryDevice() can ask it.
+ *        All widgets are converted into one vertex buffer and one index buffer and drawn
+ *        with one glDrawElements(): the shapes use the white texel of the font atlas, so
+ *        one texture serves the whole panel. The clip rectangles of Nuklear are not used,
+ *        which is why the panel has no scrollbar and is sized to fit what it shows.
+ *        The overlay only shows, it takes no input.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <memory>
+
+class FrameProfiler;
+
+class Overlay {
+public:
+    /* Constructor: graphs of the last 'frames' frames. The font, the shader and the buffers
+     * are created by the first render(). */
+    explicit Overlay(int frames = 120);
+
+    /* Destructor: delete the font texture, the buffers and the vertex array */
+    ~Overlay();
+
+    Overlay(const Overlay&) = delete;
+    Overlay& operator=(const Overlay&) = delete;
+
+    // Draw the panel over the current viewport
+    void render(const FrameProfiler& profiler);
+
+    // Vertices and indices of the last render()
+    int vertexCount() const;
+    int indexCount() const;
+
+private:
+    struct State;
+
+    void create();
+
+    int frames_;
+    std::unique_ptr<State> state_;
+};
@@ -0,0 +1,399 @@
+/*
+ * A pack file of many asset files, served to the virtual file system
+ *
+ * This code is in the public domain.
+ */
+#include "PackFile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "ThreadPool.hpp"
+#include "Utilities.hpp"
+
+namespace {
+
+/*
+ * Header of the pack format. The header is followed by the stored files, each at a multiple
+ * of packAlignment, then by the table of contents, an array of PackFile::Entry sorted by
+ * hash and name, and last by the names, which are not null terminated.
+ */
+struct PackHeader {
+    char magic[8];         // "TNMPACK" and a null
+    uint32_t version;      // packVersion
+    uint32_t count;        // Number of entries
+    uint64_t tocoffset;    // Offset of the table from the start of the file
+    uint64_t namesoffset;  // Offset of the names from the start of the file
+    uint64_t namesbytes;   // Size of the names in bytes
+};
+
+const char packMagic[8] = {'T', 'N', 'M', 'P', 'A', 'C', 'K', '\0'};
+const uint32_t packVersion = 1;
+const uint32_t packCompressed = 1;
+
+uint64_t alignPackOffset(uint64_t offset) {
+    return (offset + PackFile::packAlignment - 1) / PackFile::packAlignment *
+           PackFile::packAlignment;
+}
+
+// The name of a file of the pack, with '/' between directories and no leading "./"
+std::string packName(const std::string& path) {
+    std::string name = path;
+    std::replace(name.begin(), name.end(), '\\', '/');
+    while (name.compare(0, 2, "./") == 0) {
+        name.erase(0, 2);
+    }
+    return name;
+}
+
+uint64_t nameHash(const char* name, size_t length) { return util::hashBytes(name, length); }
+
+/*
+ * LZ4 block compression: sequences of a token, literals that are copied and a match of
+ * earlier output, 4 bytes or more at most 64K bytes back. The encoder finds the matches
+ * greedily with a hash table of the last position of each 4 byte value. As the format
+ * requires, the last 5 bytes are literals and the last match starts 12 bytes or more before
+ * the end.
+ */
+const size_t lz4MinMatch = 4;
+const size_t lz4LastLiterals = 5;
+const size_t lz4MatchLimit = 12;
+const size_t lz4MaxOffset = 65535;
+const int lz4HashBits = 16;
+
+size_t lz4Bound(size_t size) { return size + size / 255 + 16; }
+
+uint32_t read32(const unsigned char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Write the length 'length' on top of the 4 bits of the token, as LZ4 does
+unsigned char* writeLength(unsigned char* out, size_t length) {
+    for (length -= 15; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = static_cast<unsigned char>(length);
+    return out;
+}
+
+// Compress 'size' bytes to 'out', which has room for lz4Bound() bytes. Returns the bytes written.
+size_t lz4Compress(const unsigned char* in, size_t size, unsigned char* out) {
+    unsigned char* op = out;
+    size_t anchor = 0;
+    auto emit = [&](size_t literals, size_t offset, size_t match) {
+        unsigned char* token = op++;
+        *token = static_cast<unsigned char>(std::min<size_t>(literals, 15) << 4);
+        if (literals >= 15) {
+            op = writeLength(op, literals);
+        }
+        memcpy(op, in + anchor, literals);
+        op += literals;
+        if (match == 0) {
+            return;
+        }
+        *op++ = static_cast<unsigned char>(offset & 0xFF);
+        *op++ = static_cast<unsigned char>(offset >> 8);
+        *token |= static_cast<unsigned char>(std::min<size_t>(match - lz4MinMatch, 15));
+        if (match - lz4MinMatch >= 15) {
+            op = writeLength(op, match - lz4MinMatch);
+        }
+    };
+
+    if (size > lz4MatchLimit) {
+        std::vector<uint32_t> table(size_t(1) << lz4HashBits, 0);
+        const size_t matchend = size - lz4LastLiterals;
+        size_t ip = 0;
+        while (ip < size - lz4MatchLimit) {
+            const uint32_t value = read32(in + ip);
+            uint32_t& slot = table[(value * 2654435761u) >> (32 - lz4HashBits)];
+            size_t candidate = slot;
+            slot = static_cast<uint32_t>(ip);
+            if (candidate >= ip || ip - candidate > lz4MaxOffset ||
+                read32(in + candidate) != value) {
+                ip++;
+                continue;
+            }
+            while (ip > anchor && candidate > 0 && in[ip - 1] == in[candidate - 1]) {
+                ip--;
+                candidate--;
+            }
+            size_t match = lz4MinMatch;
+            while (ip + match < matchend && in[candidate + match] == in[ip + match]) {
+                match++;
+            }
+            emit(ip - anchor, ip - candidate, match);
+            ip += match;
+            anchor = ip;
+        }
+    }
+    emit(size - anchor, 0, 0);
+    return op - out;
+}
+
+// Decompress 'bytes' bytes of 'in' to the 'size' bytes of 'out'. False if the data is damaged.
+bool lz4Decompress(const unsigned char* in, size_t bytes, unsigned char* out, size_t size) {
+    size_t ip = 0;
+    size_t op = 0;
+    auto readLength = [&](size_t& length) {
+        unsigned char byte;
+        do {
+            if (ip >= bytes) {
+                return false;
+            }
+            byte = in[ip++];
+            length += byte;
+        } while (byte == 255);
+        return true;
+    };
+    while (ip < bytes) {
+        const unsigned char token = in[ip++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(literals)) {
+            return false;
+        }
+        if (literals > bytes - ip || literals > size - op) {
+            return false;
+        }
+        memcpy(out + op, in + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == bytes) {
+            return op == size;  // The last sequence has no match
+        }
+        if (bytes - ip < 2) {
+            return false;
+        }
+        const size_t offset = in[ip] | (size_t(in[ip + 1]) << 8);
+        ip += 2;
+        size_t match = token & 15;
+        if ((match == 15 && !readLength(match)) || offset == 0 || offset > op) {
+            return false;
+        }
+        match += lz4MinMatch;
+        if (match > size - op) {
+            return false;
+        }
+        // The match may overlap the bytes it writes, which then repeat
+        if (offset >= match) {
+            memcpy(out + op, out + op - offset, match);
+        } else {
+            for (size_t i = 0; i < match; i++) {
+                out[op + i] = out[op + i - offset];
+            }
+        }
+        op += match;
+    }
+    return false;
+}
+
+}  // namespace
+
+bool PackFile::write(const std::string& packfile, const std::vector<std::string>& files,
+                     bool compress) {
+    struct Packed {
+        std::string name;
+        MappedFile file;
+        std::vector<unsigned char> compressed;  // Empty if the file is stored as it is
+    };
+    std::vector<Packed> packed(files.size());
+    std::atomic<bool> ok(true);
+    ThreadPool::global().parallelFor(static_cast<int>(files.size()), [&](int i) {
+        Packed& p = packed[i];
+        p.name = packName(files[i]);
+        if (!p.file.open(files[i])) {
+            std::cerr << "PackFile::write(\"" << packfile << "\"): could not read '" << files[i]
+                      << "'\n";
+            ok = false;
+            return;
+        }
+        const size_t size = p.file.size();
+        if (compress && size > lz4MatchLimit) {
+            p.compressed.resize(lz4Bound(size));
+            p.compressed.resize(lz4Compress(reinterpret_cast<const unsigned char*>(p.file.data()),
+                                            size, p.compressed.data()));
+            if (p.compressed.size() > size - size / 8) {
+                p.compressed = std::vector<unsigned char>();
+            }
+        }
+    });
+    if (!ok) {
+        return false;
+    }
+
+    // The table, sorted for the lookup, and the stored files in the order they were given
+    std::vector<Entry> entries(packed.size());
+    std::string names;
+    uint64_t offset = alignPackOffset(sizeof(PackHeader));
+    for (size_t i = 0; i < packed.size(); i++) {
+        const Packed& p = packed[i];
+        Entry& entry = entries[i];
+        entry = Entry{};
+        entry.hash = nameHash(p.name.data(), p.name.size());
+        entry.offset = offset;
+        entry.size = p.file.size();
+        entry.storedsize = p.compressed.empty() ? entry.size : p.compressed.size();
+        entry.flags = p.compressed.empty() ? 0 : packCompressed;
+        entry.nameoffset = static_cast<uint32_t>(names.size());
+        entry.namelength = static_cast<uint32_t>(p.name.size());
+        names += p.name;
+        offset = alignPackOffset(offset + entry.storedsize);
+    }
+    std::vector<Entry> toc = entries;
+    auto name = [&](const Entry& entry) {
+        return std::string(names, entry.nameoffset, entry.namelength);
+    };
+    std::sort(toc.begin(), toc.end(), [&](const Entry& a, const Entry& b) {
+        return a.hash != b.hash ? a.hash < b.hash : name(a) < name(b);
+    });
+    for (size_t i = 1; i < toc.size(); i++) {
+        if (toc[i].hash == toc[i - 1].hash && name(toc[i]) == name(toc[i - 1])) {
+            std::cerr << "PackFile::write(\"" << packfile << "\"): '" << name(toc[i])
+                      << "' is listed twice\n";
+            return false;
+        }
+    }
+
+    PackHeader header = {};
+    memcpy(header.magic, packMagic, sizeof(packMagic));
+    header.version = packVersion;
+    header.count = static_cast<uint32_t>(toc.size());
+    header.tocoffset = offset;
+    header.namesoffset = offset + toc.size() * sizeof(Entry);
+    header.namesbytes = names.size();
+
+    FILE* out = fopen(packfile.c_str(), "wb");
+    if (!out) {
+        std::cerr << "PackFile::write(\"" << packfile << "\"): could not create file\n";
+        return false;
+    }
+    const char padding[packAlignment] = {0};
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1;
+    uint64_t position = sizeof(header);
+    for (size_t i = 0; i < packed.size() && written; i++) {
+        const Packed& p = packed[i];
+        const void* data = p.compressed.empty() ? static_cast<const void*>(p.file.data())
+                                                : static_cast<const void*>(p.compressed.data());
+        const uint64_t skip = entries[i].offset - position;
+        written = fwrite(padding, 1, skip, out) == skip &&
+                  fwrite(data, 1, entries[i].storedsize, out) == entries[i].storedsize;
+        position = entries[i].offset + entries[i].storedsize;
+    }
+    const uint64_t skip = header.tocoffset - position;
+    written = written && fwrite(padding, 1, skip, out) == skip;
+    written = written && fwrite(toc.data(), sizeof(Entry), toc.size(), out) == toc.size();
+    written = written && fwrite(names.data(), 1, names.size(), out) == names.size();
+    written = (fclose(out) == 0) && written;
+    if (!written) {
+        std::cerr << "PackFile::write(\"" << packfile << "\"): could not write file\n";
+        remove(packfile.c_str());
+    }
+    return written;
+}
+
+bool PackFile::map(const std::string& packfile) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        decoded_.clear();
+    }
+    entries_.clear();
+    names_ = nullptr;
+    packfile_ = packfile;
+    mapped_ = std::make_shared<MappedFile>();
+    if (!mapped_->openLocal(packfile)) {
+        mapped_.reset();
+        return false;
+    }
+
+    PackHeader header;
+    const uint64_t size = mapped_->size();
+    bool ok = size >= sizeof(header);
+    if (ok) {
+        memcpy(&header, mapped_->data(), sizeof(header));
+        ok = memcmp(header.magic, packMagic, sizeof(packMagic)) == 0 &&
+             header.version == packVersion && header.tocoffset <= size &&
+             header.count <= (size - header.tocoffset) / sizeof(Entry) &&
+             header.namesoffset == header.tocoffset + header.count * sizeof(Entry) &&
+             header.namesbytes <= size - header.namesoffset;
+    }
+    if (ok) {
+        entries_.resize(header.count);
+        memcpy(entries_.data(), mapped_->data() + header.tocoffset,
+               header.count * sizeof(Entry));
+        names_ = mapped_->data() + header.namesoffset;
+        for (const Entry& entry : entries_) {
+            ok = ok && entry.offset <= size && entry.storedsize <= size - entry.offset &&
+                 entry.nameoffset <= header.namesbytes &&
+                 entry.namelength <= header.namesbytes - entry.nameoffset &&
+                 ((entry.flags & packCompressed) != 0 || entry.storedsize == entry.size);
+        }
+    }
+    if (!ok) {
+        std::cerr << "PackFile::map(\"" << packfile << "\"): not a valid pack file\n";
+        entries_.clear();
+        names_ = nullptr;
+        mapped_.reset();
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    decoded_.resize(entries_.size());
+    return true;
+}
+
+size_t PackFile::count() const { return entries_.size(); }
+
+bool PackFile::contains(const std::string& path) const { return find(path) >= 0; }
+
+int PackFile::find(const std::string& path) const {
+    const std::string name = packName(path);
+    const uint64_t hash = nameHash(name.data(), name.size());
+    auto it = std::lower_bound(entries_.begin(), entries_.end(), hash,
+                               [](const Entry& entry, uint64_t h) { return entry.hash < h; });
+    for (; it != entries_.end() && it->hash == hash; ++it) {
+        if (name.compare(0, std::string::npos, names_ + it->nameoffset, it->namelength) == 0) {
+            return static_cast<int>(it - entries_.begin());
+        }
+    }
+    return -1;
+}
+
+std::shared_ptr<vfs::File> PackFile::open(const std::string& name, const std::string& path) {
+    const int index = find(path);
+    if (index < 0) {
+        return nullptr;
+    }
+    const Entry& entry = entries_[index];
+    const char* stored = mapped_->data() + entry.offset;
+    if ((entry.flags & packCompressed) == 0) {
+        auto file = std::make_shared<vfs::File>(name);
+        file->setData(stored, entry.size, mapped_);
+        return file;
+    }
+
+    // A compressed file is decoded once for all who hold it, outside the lock, so that
+    // loaders on other threads decode other files at the same time
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (std::shared_ptr<vfs::File> file = decoded_[index].lock()) {
+            return file;
+        }
+    }
+    auto data = std::make_shared<std::vector<unsigned char>>(entry.size);
+    if (!lz4Decompress(reinterpret_cast<const unsigned char*>(stored), entry.storedsize,
+                       data->data(), data->size())) {
+        std::cerr << "PackFile: '" << path << "' is damaged in " << packfile_ << "\n";
+        return nullptr;
+    }
+    auto file = std::make_shared<vfs::File>(name);
+    file->setData(reinterpret_cast<const char*>(data->data()), data->size(), data);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (std::shared_ptr<vfs::File> first = decoded_[index].lock()) {
+        return first;
+    }
+    decoded_[index] = file;
+    return file;
+}
@@ -0,0 +1,79 @@
+/*
+ * A pack file, one archive of many asset files with a table of contents, which is mapped into
+ * memory at once and serves its files to the virtual file system.
+ *
+ * Usage: write() a pack of a list of files, then map() it and vfs::mount() it for a prefix,
+ *        "" for all names. MappedFile::open() and with it Shader, Texture and TriangleSoup
+ *        then read the files of the pack by the names they were packed with, and the names
+ *        that the pack does not have from the next mount or the local file system. A pack
+ *        mounted at "" shadows the loose files, so changes to them are not seen until the
+ *        pack is written again, and baked files in it, like the .tsmesh and .baked.dds
+ *        caches, are used when the pack holds no loose file to check them against.
+ *        The entries start at multiples of packAlignment, and a file is stored as it is,
+ *        and then opened without a copy, unless LZ4 compression makes it smaller by an
+ *        eighth or more. Compressed files are decoded when they are opened, and kept while
+ *        they are held. The table is sorted by the hashes of the names, which are looked up
+ *        with a binary search. All values are in the byte order of the writing machine.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "MappedFile.hpp"
+#include "VirtualFiles.hpp"
+
+class PackFile : public vfs::Backend {
+public:
+    // Entries start at multiples of this many bytes
+    static constexpr size_t packAlignment = 64;
+
+    /* Write 'files' to the pack 'packfile', compressed where that pays if 'compress'. The
+     * files are read through MappedFile::open(), and compressed in parallel. False if a file
+     * could not be read or the pack could not be written. */
+    static bool write(const std::string& packfile, const std::vector<std::string>& files,
+                      bool compress = true);
+
+    /* Map the pack 'packfile', after any one mapped before. False if it is missing or
+     * damaged, with the errors other than a missing file printed. */
+    bool map(const std::string& packfile);
+
+    // Number of files in the pack
+    size_t count() const;
+
+    // True if the pack has the file 'path'
+    bool contains(const std::string& path) const;
+
+    /* The file 'path' of the pack, nullptr if it has no such file. Uncompressed files are
+     * views of the mapping, which they keep alive. */
+    std::shared_ptr<vfs::File> open(const std::string& name, const std::string& path) override;
+
+private:
+    // An entry of the table of contents, as it is stored
+    struct Entry {
+        uint64_t hash;        // util::hashBytes() of the name
+        uint64_t offset;      // Of the stored bytes from the start of the pack
+        uint64_t storedsize;  // Bytes stored, compressed or not
+        uint64_t size;        // Bytes of the file
+        uint32_t nameoffset;  // Of the name in the names after the table
+        uint32_t namelength;
+        uint32_t flags;       // packCompressed
+        uint32_t reserved;
+    };
+
+    // The entry of 'path', or -1
+    int find(const std::string& path) const;
+
+    std::shared_ptr<MappedFile> mapped_;
+    std::vector<Entry> entries_;
+    const char* names_ = nullptr;
+    std::string packfile_;
+    std::mutex mutex_;                                // Of decoded_
+    std::vector<std::weak_ptr<vfs::File>> decoded_;  // The compressed files that are held
+};
@@ -0,0 +1,146 @@
+/*
+ * Particles simulated with transform feedback and drawn as point sprites
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "ParticleSystem.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace {
+
+// The state of a particle, as the vertex attributes 0 and 1 of the shaders see it
+struct Particle {
+    float position[3];
+    float age;  // Seconds, negative until the particle is born
+    float velocity[3];
+    float lifetime;
+};
+
+}  // namespace
+
+ParticleSystem::ParticleSystem(int count)
+    : count_(std::max(count, 1)), time_(0.0f), buffers_{0, 0}, arrays_{0, 0}, current_(0) {}
+
+ParticleSystem::~ParticleSystem() {
+    if (buffers_[0] != 0) {
+        glstate::deleteVertexArrays(2, arrays_);
+        gpumem::deleteBuffers(2, buffers_);
+    }
+}
+
+void ParticleSystem::create() {
+    updateshader_.createFeedbackShader("vertex_particles_update.glsl",
+                                       {"positionAge", "velocityLifetime"});
+    rendershader_.createShader("vertex_particles.glsl", "fragment_particles.glsl");
+
+    // Born one after the other over the first lifetime, at the emitter. This is the only
+    // upload of particle data.
+    std::vector<Particle> particles(static_cast<size_t>(count_));
+    for (int i = 0; i < count_; i++) {
+        Particle& particle = particles[static_cast<size_t>(i)];
+        std::copy(emitter_.position, emitter_.position + 3, particle.position);
+        particle.age = -emitter_.lifetime * float(i + 1) / float(count_);
+        std::fill(particle.velocity, particle.velocity + 3, 0.0f);
+        particle.lifetime = emitter_.lifetime;
+    }
+    glGenBuffers(2, buffers_);
+    glGenVertexArrays(2, arrays_);
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffers_[i]);
+        glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(particles.size() * sizeof(Particle)),
+                     i == 0 ? particles.data() : nullptr, GL_DYNAMIC_COPY);
+        gpumem::setBuffer(buffers_[i], gpumem::Category::Buffer,
+                          particles.size() * sizeof(Particle));
+        glstate::bindVertexArray(arrays_[i]);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Particle), nullptr);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Particle),
+                              reinterpret_cast<const void*>(offsetof(Particle, velocity)));
+    }
+    glstate::bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    current_ = 0;
+}
+
+void ParticleSystem::setEmitter(const ParticleEmitter& emitter) { emitter_ = emitter; }
+
+const ParticleEmitter& ParticleSystem::emitter() const { return emitter_; }
+
+void ParticleSystem::update(float timestep) {
+    if (buffers_[0] == 0) {
+        create();
+    }
+    time_ += timestep;
+    updateshader_.use();
+    updateshader_.setUniform("timestep", timestep);
+    updateshader_.setUniform("seed", time_);
+    updateshader_.setUniform("emitterPosition", emitter_.position[0], emitter_.position[1],
+                             emitter_.position[2]);
+    updateshader_.setUniform("emitterVelocity", emitter_.velocity[0], emitter_.velocity[1],
+                             emitter_.velocity[2]);
+    const float speed = std::sqrt(emitter_.velocity[0] * emitter_.velocity[0] +
+                                  emitter_.velocity[1] * emitter_.velocity[1] +
+                                  emitter_.velocity[2] * emitter_.velocity[2]);
+    updateshader_.setUniform("spread", emitter_.spread * std::max(speed, 1e-3f));
+    updateshader_.setUniform("gravity", emitter_.gravity[0], emitter_.gravity[1],
+                             emitter_.gravity[2]);
+    updateshader_.setUniform("lifetime", emitter_.lifetime);
+
+    // From the latest state into the other buffer, which is the latest after this
+    const int next = 1 - current_;
+    glEnable(GL_RASTERIZER_DISCARD);
+    glstate::bindVertexArray(arrays_[current_]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers_[next]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, count_);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glstate::bindVertexArray(0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    current_ = next;
+}
+
+void ParticleSystem::render(int viewportheight) {
+    if (buffers_[0] == 0) {
+        return;
+    }
+    const GLboolean blend = glIsEnabled(GL_BLEND);
+    const GLboolean pointsize = glIsEnabled(GL_PROGRAM_POINT_SIZE);
+    GLboolean depthmask = GL_TRUE;
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &depthmask);
+    GLint source = GL_ONE, destination = GL_ZERO;
+    glGetIntegerv(GL_BLEND_SRC_RGB, &source);
+    glGetIntegerv(GL_BLEND_DST_RGB, &destination);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    rendershader_.use();
+    rendershader_.setUniform("size", emitter_.size);
+    rendershader_.setUniform("viewportHeight", float(viewportheight));
+    glstate::bindVertexArray(arrays_[current_]);
+    glDrawArrays(GL_POINTS, 0, count_);
+    glstate::bindVertexArray(0);
+
+    glBlendFunc(static_cast<GLenum>(source), static_cast<GLenum>(destination));
+    glDepthMask(depthmask);
+    if (!blend) {
+        glDisable(GL_BLEND);
+    }
+    if (!pointsize) {
+        glDisable(GL_PROGRAM_POINT_SIZE);
+    }
+}
+
+int ParticleSystem::count() const { return count_; }
@@ -0,0 +1,73 @@
+/*
+ * Particles that are simulated and drawn on the GPU, with no per particle work on the CPU.
+ *
+ * Usage: Set the emitter with setEmitter() whenever it changes, call update() once per
+ *        frame with the time step, and render() the particles with the FrameData and
+ *        ObjectData uniform blocks bound, with the model-view matrix of the space that the
+ *        emitter is in.
+ *        The state of the particles, a position, a velocity, an age and a lifetime each,
+ *        lives in two vertex buffers. update() draws one of them as points with the
+ *        transform feedback program vertex_particles_update.glsl, which OpenGL 3.3 has, and
+ *        captures the next state into the other one, with the rasterizer off. render() then
+ *        draws the new state as point sprites, with vertex_particles.glsl and
+ *        fragment_particles.glsl, additively blended and without writing depth, so that
+ *        the order of the particles does not matter. Only the uniforms of the emitter go
+ *        from the CPU to the GPU after the buffers are created.
+ *        The particles start one after the other over the first lifetime, and a particle is
+ *        born again at the emitter when its lifetime is over, so 'count' particles over a
+ *        lifetime of 'lifetime' seconds are 'count' / 'lifetime' particles per second.
+ *        The buffers and programs are created by the first update().
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+
+#include "Shader.hpp"
+
+struct ParticleEmitter {
+    float position[3] = {0.0f, 0.0f, 0.0f};
+    float velocity[3] = {0.0f, 2.0f, 0.0f};  // Mean velocity of a new particle
+    float spread = 0.25f;                    // Random velocity, relative to 'velocity'
+    float gravity[3] = {0.0f, -2.5f, 0.0f};  // Acceleration
+    float lifetime = 2.0f;                   // Seconds, 75 to 100 % of it for each particle
+    float size = 0.01f;                      // Diameter of a particle
+};
+
+class ParticleSystem {
+public:
+    /* Constructor: a system of 'count' particles */
+    explicit ParticleSystem(int count = 100000);
+
+    /* Destructor: delete the buffers and vertex arrays */
+    ~ParticleSystem();
+
+    ParticleSystem(const ParticleSystem&) = delete;
+    ParticleSystem& operator=(const ParticleSystem&) = delete;
+
+    void setEmitter(const ParticleEmitter& emitter);
+    const ParticleEmitter& emitter() const;
+
+    // Advance the particles by 'timestep' seconds
+    void update(float timestep);
+
+    /* Draw the particles into a viewport 'viewportheight' pixels high, which sets the size
+     * of the point sprites. Leaves blending, the depth mask and the program point size as
+     * they were. */
+    void render(int viewportheight);
+
+    int count() const;
+
+private:
+    void create();
+
+    int count_;
+    ParticleEmitter emitter_;
+    float time_;         // Seconds simulated, which seeds the random numbers
+    GLuint buffers_[2];  // The state, of which buffers_[current_] is the latest
+    GLuint arrays_[2];   // Vertex arrays that read each buffer
+    int current_;
+    Shader updateshader_;
+    Shader rendershader_;
+};
@@ -0,0 +1,140 @@
+/*
+ * Picking from an ID buffer, read back asynchronously through pixel buffer objects
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "PickBuffer.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "GpuMemory.hpp"
+#include "Shader.hpp"
+
+const GLenum PickBuffer::format = GL_RG32UI;
+
+PickBuffer::PickBuffer(int radius, int numbuffers)
+    : radius_(std::max(radius, 0)), readbacks_(std::max(numbuffers, 1)), next_(0),
+      inflight_(0), framebuffer_(0) {}
+
+PickBuffer::~PickBuffer() {
+    for (Readback& readback : readbacks_) {
+        if (readback.fence) {
+            glDeleteSync(static_cast<GLsync>(readback.fence));
+        }
+        if (readback.buffer != 0) {
+            gpumem::deleteBuffers(1, &readback.buffer);
+        }
+    }
+    if (framebuffer_ != 0) {
+        glDeleteFramebuffers(1, &framebuffer_);
+    }
+}
+
+void PickBuffer::setObject(Shader& shader, int object) {
+    shader.setUniform("objectId", static_cast<GLuint>(object + 1));
+}
+
+void PickBuffer::read(GLuint texture, int texturewidth, int textureheight, int width,
+                      int height, int x, int y, long long frame) {
+    if (texture == 0 || x < 0 || y < 0 || x >= width || y >= height ||
+        inflight_ == static_cast<int>(readbacks_.size())) {
+        return;
+    }
+    Readback& readback = readbacks_[next_];
+    const size_t side = 2 * size_t(radius_) + 1;
+    if (readback.buffer == 0) {
+        glGenBuffers(1, &readback.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, side * side * 2 * sizeof(GLuint), nullptr,
+                     GL_STREAM_READ);
+        gpumem::setBuffer(readback.buffer, gpumem::Category::Buffer,
+                          side * side * 2 * sizeof(GLuint));
+    } else {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    }
+    if (framebuffer_ == 0) {
+        glGenFramebuffers(1, &framebuffer_);
+    }
+
+    // The pixel in the texture, which may hold the frame at a lower resolution, with y up
+    const int px = std::min(static_cast<int>(static_cast<long long>(x) * texturewidth / width),
+                            texturewidth - 1);
+    const int py = std::min(
+        static_cast<int>(static_cast<long long>(height - 1 - y) * textureheight / height),
+        textureheight - 1);
+    const int left = std::max(px - radius_, 0);
+    const int bottom = std::max(py - radius_, 0);
+    readback.width = std::min(px + radius_ + 1, texturewidth) - left;
+    readback.height = std::min(py + radius_ + 1, textureheight) - bottom;
+    readback.centerx = px - left;
+    readback.centery = py - bottom;
+    readback.pick = PickResult();
+    readback.pick.x = x;
+    readback.pick.y = y;
+    readback.pick.frame = frame;
+
+    // The read framebuffer of the frame is put back for FrameCapture
+    GLint previous = 0;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    // With a PBO bound, the last argument is an offset in it, and the call does not wait
+    glReadPixels(left, bottom, readback.width, readback.height, GL_RG_INTEGER, GL_UNSIGNED_INT,
+                 nullptr);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, static_cast<GLuint>(previous));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    next_ = (next_ + 1) % static_cast<int>(readbacks_.size());
+    inflight_++;
+}
+
+bool PickBuffer::poll(PickResult& result) {
+    const int numbuffers = static_cast<int>(readbacks_.size());
+    bool found = false;
+    while (inflight_ > 0) {
+        Readback& readback = readbacks_[(next_ - inflight_ + numbuffers) % numbuffers];
+        GLsync fence = static_cast<GLsync>(readback.fence);
+        if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        glDeleteSync(fence);
+        readback.fence = nullptr;
+        inflight_--;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        const size_t bytes =
+            size_t(readback.width) * size_t(readback.height) * 2 * sizeof(GLuint);
+        const GLuint* ids =
+            static_cast<const GLuint*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes,
+                                                        GL_MAP_READ_BIT));
+        if (!ids) {
+            std::cerr << "PickBuffer: could not map the pixels of frame " << readback.pick.frame
+                      << "\n";
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            continue;
+        }
+        // The nearest pixel to the one asked for that shows an object
+        result = readback.pick;
+        int nearest = -1;
+        for (int j = 0; j < readback.height; j++) {
+            for (int i = 0; i < readback.width; i++) {
+                const GLuint* id = ids + 2 * (size_t(j) * readback.width + i);
+                const int dx = i - readback.centerx;
+                const int dy = j - readback.centery;
+                if (id[0] != 0 && (nearest < 0 || dx * dx + dy * dy < nearest)) {
+                    nearest = dx * dx + dy * dy;
+                    result.object = static_cast<int>(id[0]) - 1;
+                    result.primitive = static_cast<int>(id[1]);
+                }
+            }
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        found = true;
+    }
+    return found;
+}
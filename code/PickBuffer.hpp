@@ -0,0 +1,80 @@
+/*
+ * Picking from an ID buffer: the main pass writes the object and the triangle of every pixel
+ * into an integer render target, and the pixels around the cursor are read back a frame
+ * later, so picking never waits for the GPU.
+ *
+ * Usage: Build the shader of the main pass with PICKING defined. It then writes its objectId
+ *        uniform, set with setObject() before each draw, and gl_PrimitiveID to the output
+ *        at location 1, a texture of PickBuffer::format next to the color buffer, cleared
+ *        to 0. read() starts the readback of the pixels within 'radius' of a pixel into one
+ *        of a ring of pixel buffer objects, with a fence after it, and poll() maps those
+ *        whose fence has passed, without waiting for the others. read() skips the request
+ *        when all buffers are still in flight. The result is the pixel nearest to the one
+ *        asked for that has an object, so thin lines are easy to hit, and the triangle is
+ *        that of the draw call, which is the triangle of the mesh when it is drawn at full
+ *        detail in one call.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <vector>
+
+class Shader;
+
+// What a pixel shows: the object and the triangle, or -1 for none
+struct PickResult {
+    int object = -1;
+    int primitive = -1;
+    int x = -1;  // The pixel that was asked for, in window coordinates with y down
+    int y = -1;
+    long long frame = -1;  // The frame it was read from, -1 if there is no result
+};
+
+class PickBuffer {
+public:
+    // The format of the ID texture, GL_RG32UI: the object + 1 and the triangle
+    static const GLenum format;
+
+    /* Constructor: read the pixels within 'radius' of the one asked for, with 'numbuffers'
+     * readbacks in flight. The GL objects are created by the first read(). */
+    explicit PickBuffer(int radius = 3, int numbuffers = 3);
+
+    /* Destructor: delete the buffers, the fences and the framebuffer */
+    ~PickBuffer();
+
+    PickBuffer(const PickBuffer&) = delete;
+    PickBuffer& operator=(const PickBuffer&) = delete;
+
+    // Set the object of the next draws of 'shader', from 0 up
+    static void setObject(Shader& shader, int object);
+
+    /* Start the readback around the pixel (x, y) of 'frame', in window coordinates of a
+     * 'width' x 'height' window with y down, from the ID texture 'texture', whose lower
+     * left 'texturewidth' x 'textureheight' pixels hold the frame. */
+    void read(GLuint texture, int texturewidth, int textureheight, int width, int height, int x,
+              int y, long long frame);
+
+    /* Map the readbacks that have arrived. True if there was one, with the newest in
+     * 'result'. */
+    bool poll(PickResult& result);
+
+private:
+    // A region on its way back from the GPU
+    struct Readback {
+        GLuint buffer = 0;
+        void* fence = nullptr;  // GLsync, when the readback is in flight
+        PickResult pick;        // Without the object and the triangle yet
+        int centerx = 0;        // The pixel asked for, within the region
+        int centery = 0;
+        int width = 0;          // Of the region
+        int height = 0;
+    };
+
+    int radius_;
+    std::vector<Readback> readbacks_;
+    int next_;      // The readback to use next
+    int inflight_;  // Readbacks before next_ that are not mapped yet
+    GLuint framebuffer_;
+};
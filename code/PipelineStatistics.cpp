@@ -0,0 +1,177 @@
+/*
+ * Pipeline statistics queries per pass and per mesh
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "PipelineStatistics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+namespace {
+
+// The query targets, in the order of PipelineStatistics::Counter
+const GLenum targets[PipelineStatistics::NumCounters] = {
+    GL_VERTICES_SUBMITTED_ARB,       GL_PRIMITIVES_SUBMITTED_ARB,
+    GL_VERTEX_SHADER_INVOCATIONS_ARB, GL_CLIPPING_INPUT_PRIMITIVES_ARB,
+    GL_CLIPPING_OUTPUT_PRIMITIVES_ARB, GL_FRAGMENT_SHADER_INVOCATIONS_ARB,
+};
+
+}  // namespace
+
+PipelineStatistics::PipelineStatistics()
+    : mode_(Mode::Off), active_(), depth_(0), activedepth_(0), frame_(-1), pixels_(0.0) {}
+
+PipelineStatistics::~PipelineStatistics() {
+    for (const Pending& pending : pending_) {
+        unused_.insert(unused_.end(), pending.queries, pending.queries + NumCounters);
+    }
+    if (!unused_.empty()) {
+        glDeleteQueries(static_cast<GLsizei>(unused_.size()), unused_.data());
+    }
+}
+
+PipelineStatistics& PipelineStatistics::global() {
+    // Never destroyed, as the GL context is gone by the time static objects are
+    static PipelineStatistics* instance = new PipelineStatistics();
+    return *instance;
+}
+
+bool PipelineStatistics::supported() { return GLEW_ARB_pipeline_statistics_query; }
+
+void PipelineStatistics::setMode(Mode mode) {
+    if (mode != Mode::Off && !supported()) {
+        std::cerr << "PipelineStatistics: ARB_pipeline_statistics_query is not supported\n";
+        mode = Mode::Off;
+    }
+    mode_ = mode;
+}
+
+PipelineStatistics::Mode PipelineStatistics::mode() const { return mode_; }
+
+int PipelineStatistics::entryIndex(const std::string& name) {
+    for (size_t i = 0; i < entries_.size(); i++) {
+        if (entries_[i].name == name) {
+            return static_cast<int>(i);
+        }
+    }
+    entries_.emplace_back();
+    entries_.back().name = name;
+    return static_cast<int>(entries_.size()) - 1;
+}
+
+void PipelineStatistics::beginFrame(int pixels) {
+    frame_++;
+    pixels_ = static_cast<double>(std::max(pixels, 0));
+    // The spans finish in order, so stop at the first that has not
+    while (!pending_.empty()) {
+        Pending& pending = pending_.front();
+        GLint available = 0;
+        glGetQueryObjectiv(pending.queries[NumCounters - 1], GL_QUERY_RESULT_AVAILABLE,
+                           &available);
+        if (!available) {
+            break;
+        }
+        Entry& entry = entries_[pending.entry];
+        for (int c = 0; c < NumCounters; c++) {
+            GLuint64 count = 0;
+            glGetQueryObjectui64v(pending.queries[c], GL_QUERY_RESULT, &count);
+            entry.totals.counts[c] += static_cast<double>(count);
+        }
+        if (entry.lastframe != pending.frame) {
+            entry.lastframe = pending.frame;
+            entry.totals.frames++;
+            entry.totals.pixels += pending.pixels;
+        }
+        unused_.insert(unused_.end(), pending.queries, pending.queries + NumCounters);
+        pending_.pop_front();
+    }
+}
+
+void PipelineStatistics::begin(Mode kind, const std::string& name) {
+    if (kind != mode_ || mode_ == Mode::Off) {
+        return;
+    }
+    depth_++;
+    if (activedepth_ != 0) {
+        return;
+    }
+    if (unused_.size() < NumCounters) {
+        unused_.resize(unused_.size() + NumCounters);
+        glGenQueries(NumCounters, &unused_[unused_.size() - NumCounters]);
+    }
+    active_.entry = entryIndex(name);
+    active_.frame = frame_;
+    active_.pixels = pixels_;
+    // A query object keeps the target it was first begun with, so the objects are taken
+    // and given back in blocks in the order of the targets
+    const size_t first = unused_.size() - NumCounters;
+    for (int c = 0; c < NumCounters; c++) {
+        active_.queries[c] = unused_[first + c];
+        glBeginQuery(targets[c], active_.queries[c]);
+    }
+    unused_.resize(first);
+    activedepth_ = depth_;
+}
+
+void PipelineStatistics::end(Mode kind) {
+    if (kind != mode_ || mode_ == Mode::Off) {
+        return;
+    }
+    if (depth_ == 0) {
+        std::cerr << "PipelineStatistics::end(): no span to end\n";
+        return;
+    }
+    if (depth_ == activedepth_) {
+        for (int c = 0; c < NumCounters; c++) {
+            glEndQuery(targets[c]);
+        }
+        pending_.push_back(active_);
+        activedepth_ = 0;
+    }
+    depth_--;
+}
+
+bool PipelineStatistics::totals(const std::string& name, Totals& totals) const {
+    for (const Entry& entry : entries_) {
+        if (entry.name == name) {
+            totals = entry.totals;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PipelineStatistics::report(std::ostream& out) const {
+    std::vector<const Entry*> entries;
+    for (const Entry& entry : entries_) {
+        // Scopes without draws are left out
+        if (entry.totals.frames > 0 && entry.totals.counts[PrimitivesSubmitted] > 0.0) {
+            entries.push_back(&entry);
+        }
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry* a, const Entry* b) {
+        return a->totals.counts[FragmentShaderInvocations] >
+               b->totals.counts[FragmentShaderInvocations];
+    });
+    out << "Pipeline statistics per frame: vertices, vertex shader runs, vertex reuse, "
+           "triangles, clipped, fragments, overdraw\n";
+    char line[256];
+    for (const Entry* entry : entries) {
+        const Totals& t = entry->totals;
+        const double frames = static_cast<double>(t.frames);
+        const double vertices = t.counts[VerticesSubmitted] / frames;
+        const double shaded = t.counts[VertexShaderInvocations] / frames;
+        const double clipin = t.counts[ClippingInputPrimitives];
+        const double clipped = clipin > 0.0 ? t.counts[ClippingOutputPrimitives] / clipin : 0.0;
+        const double fragments = t.counts[FragmentShaderInvocations] / frames;
+        snprintf(line, sizeof(line), "  %-24s %10.0f %10.0f %5.2f %10.0f %5.2f %10.0f %5.2f\n",
+                 entry->name.c_str(), vertices, shaded, shaded > 0.0 ? vertices / shaded : 0.0,
+                 t.counts[PrimitivesSubmitted] / frames, clipped, fragments,
+                 t.pixels > 0.0 ? t.counts[FragmentShaderInvocations] / t.pixels : 0.0);
+        out << line;
+    }
+}
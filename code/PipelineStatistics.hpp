@@ -0,0 +1,109 @@
+/*
+ * Counts of the work the GPU does for each pass or each mesh, from the queries of
+ * ARB_pipeline_statistics_query: vertices and triangles submitted, vertex shader runs,
+ * triangles in and out of clipping, and fragment shader runs.
+ *
+ * Usage: Choose what is measured with setMode() on the global() object: the scopes of
+ *        FrameProfiler (Passes), or the draws of TriangleSoup, by the label of the mesh
+ *        (Meshes). The queries of one counter can not be nested, so only the outermost
+ *        measured span of the mode gets counts, say the draws of a mesh and not of the
+ *        meshes it may draw inside. Call beginFrame() once per frame with the pixels of the
+ *        frame, which reads the queries that are done without waiting for the others.
+ *        report() prints the counts per frame of each name, the vertex reuse (indices
+ *        submitted per vertex shader run, up to 6 for a mesh that is well ordered), the
+ *        triangles out of clipping per triangle in (below 1 when triangles are culled, above
+ *        when clipping splits them), and the overdraw (fragment shader runs per pixel of the
+ *        frame, also for passes into smaller or larger targets).
+ *        All calls but report() are made on the thread of the GL context. The mode is Off,
+ *        and stays Off without the extension. The draws of MeshBatch and ChunkedMesh, in
+ *        multi-draw calls, are counted in the passes only.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <deque>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class PipelineStatistics {
+public:
+    enum class Mode { Off, Passes, Meshes };
+
+    enum Counter {
+        VerticesSubmitted,
+        PrimitivesSubmitted,
+        VertexShaderInvocations,
+        ClippingInputPrimitives,
+        ClippingOutputPrimitives,
+        FragmentShaderInvocations,
+        NumCounters
+    };
+
+    // Counts of one name, summed over the frames it was measured in
+    struct Totals {
+        double counts[NumCounters] = {};
+        double pixels = 0.0;    // Of the frames
+        long long frames = 0;   // Frames with at least one span of the name
+    };
+
+    PipelineStatistics();
+    ~PipelineStatistics();
+
+    PipelineStatistics(const PipelineStatistics&) = delete;
+    PipelineStatistics& operator=(const PipelineStatistics&) = delete;
+
+    // The object that FrameProfiler and TriangleSoup report to
+    static PipelineStatistics& global();
+
+    // True if the current context has the queries
+    static bool supported();
+
+    // Off, or a mode that supported() allows. Counts measured before are kept.
+    void setMode(Mode mode);
+    Mode mode() const;
+
+    // Read the queries that are done, and count 'pixels' for the overdraw of this frame
+    void beginFrame(int pixels);
+
+    /* Begin and end a span of 'kind', which is only measured when 'kind' is the mode and
+     * no other span of the mode is. Spans of other kinds are ignored, so a caller that
+     * checks mode() first may skip both calls. */
+    void begin(Mode kind, const std::string& name);
+    void end(Mode kind);
+
+    // The counts of 'name', false if it was never measured
+    bool totals(const std::string& name, Totals& totals) const;
+
+    // Print the counts per frame of every name, and their ratios, in order of fragments
+    void report(std::ostream& out) const;
+
+private:
+    struct Entry {
+        std::string name;
+        Totals totals;
+        long long lastframe = -1;
+    };
+
+    struct Pending {
+        GLuint queries[NumCounters];
+        int entry;
+        long long frame;
+        double pixels;
+    };
+
+    // Index of the entry called 'name', created on first use
+    int entryIndex(const std::string& name);
+
+    Mode mode_;
+    std::vector<Entry> entries_;
+    std::deque<Pending> pending_;          // Spans whose queries are not read yet, in order
+    std::vector<GLuint> unused_;           // Query objects to reuse, in blocks of NumCounters
+    Pending active_;                       // The span measured, if depth_ == activedepth_
+    int depth_;                            // Spans of the mode begun and not ended
+    int activedepth_;                      // Depth of the measured span, 0 for none
+    long long frame_;
+    double pixels_;
+};
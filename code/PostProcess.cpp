@@ -0,0 +1,159 @@
+/*
+ * Post-processing effects fused into one full screen pass, with a half or quarter
+ * resolution bloom
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "PostProcess.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+#include "GLState.hpp"
+
+namespace {
+
+// The names of parseEffects() and the defines of fragment_post.glsl, in the order of the bits
+const char* const effectNames[] = {"bloom", "tonemap", "grade", "gamma", "fxaa", "vignette"};
+const char* const effectDefines[] = {"BLOOM", "TONEMAP", "GRADE", "GAMMA", "FXAA", "VIGNETTE"};
+constexpr int effectCount = 6;
+
+}  // namespace
+
+PostProcess::PostProcess()
+    : effects_(0), post_("vertex_fullscreen.glsl", "fragment_post.glsl"),
+      bloom_("vertex_fullscreen.glsl", "fragment_bloom.glsl"), vao_(0) {}
+
+PostProcess::~PostProcess() {
+    if (vao_ != 0) {
+        glstate::deleteVertexArrays(1, &vao_);
+    }
+}
+
+bool PostProcess::parseEffects(const std::string& names, unsigned& effects) {
+    unsigned parsed = 0;
+    std::stringstream stream(names);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        if (name == "all") {
+            parsed |= (1u << effectCount) - 1;
+            continue;
+        }
+        const int index = static_cast<int>(
+            std::find(effectNames, effectNames + effectCount, name) - effectNames);
+        if (index == effectCount) {
+            return false;
+        }
+        parsed |= 1u << index;
+    }
+    effects = parsed;
+    return true;
+}
+
+void PostProcess::setEffects(unsigned effects) { effects_ = effects; }
+
+unsigned PostProcess::effects() const { return effects_; }
+
+void PostProcess::setSettings(const Settings& settings) {
+    settings_ = settings;
+    settings_.bloomdivisor = settings.bloomdivisor >= 4 ? 4 : 2;
+}
+
+const PostProcess::Settings& PostProcess::settings() const { return settings_; }
+
+std::string PostProcess::defines() const {
+    std::string defines;
+    for (int i = 0; i < effectCount; i++) {
+        if (effects_ & (1u << i)) {
+            defines += defines.empty() ? "" : " ";
+            defines += effectDefines[i];
+        }
+    }
+    return defines;
+}
+
+void PostProcess::bloomSize(int width, int height, int& bloomwidth, int& bloomheight) const {
+    bloomwidth = std::max(width / settings_.bloomdivisor, 1);
+    bloomheight = std::max(height / settings_.bloomdivisor, 1);
+}
+
+void PostProcess::downsample(GLuint scene, int renderwidth, int renderheight) {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    Shader& shader = bloom_.get("DOWNSAMPLE");
+    shader.use();
+    glstate::activeTexture(GL_TEXTURE0);
+    glstate::bindTexture(GL_TEXTURE_2D, scene);
+    shader.setUniform("source", 0);
+    shader.setUniform("sourceSize", float(renderwidth), float(renderheight));
+    shader.setUniform("targetSize", float(viewport[2]), float(viewport[3]));
+    shader.setUniform("threshold", settings_.bloomthreshold);
+    drawFullscreen();
+}
+
+void PostProcess::blur(GLuint source, bool vertical) {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    Shader& shader = bloom_.get("");
+    shader.use();
+    glstate::activeTexture(GL_TEXTURE0);
+    glstate::bindTexture(GL_TEXTURE_2D, source);
+    shader.setUniform("source", 0);
+    shader.setUniform("targetSize", float(viewport[2]), float(viewport[3]));
+    shader.setUniform("direction", vertical ? 0.0f : 1.0f, vertical ? 1.0f : 0.0f);
+    drawFullscreen();
+}
+
+void PostProcess::apply(GLuint scene, int renderwidth, int renderheight, GLuint bloom) {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    Shader& shader = post_.get(defines());
+    shader.use();
+    glstate::activeTexture(GL_TEXTURE0);
+    glstate::bindTexture(GL_TEXTURE_2D, scene);
+    shader.setUniform("source", 0);
+    shader.setUniform("sourceSize", float(renderwidth), float(renderheight));
+    shader.setUniform("targetSize", float(viewport[2]), float(viewport[3]));
+    if (effects_ & Bloom) {
+        glstate::activeTexture(GL_TEXTURE1);
+        glstate::bindTexture(GL_TEXTURE_2D, bloom);
+        glstate::activeTexture(GL_TEXTURE0);
+        shader.setUniform("bloom", 1);
+        shader.setUniform("bloomIntensity", settings_.bloomintensity);
+    }
+    if (effects_ & ToneMap) {
+        shader.setUniform("exposure", settings_.exposure);
+    }
+    if (effects_ & ColorGrade) {
+        shader.setUniform("gain", settings_.gain[0], settings_.gain[1], settings_.gain[2]);
+        shader.setUniform("saturation", settings_.saturation);
+        shader.setUniform("contrast", settings_.contrast);
+    }
+    if (effects_ & Vignette) {
+        shader.setUniform("vignette", settings_.vignette);
+    }
+    drawFullscreen();
+}
+
+void PostProcess::drawFullscreen() {
+    if (vao_ == 0) {
+        glGenVertexArrays(1, &vao_);
+    }
+    // The state changed below, to restore at the end
+    GLint polygonmode[2];
+    glGetIntegerv(GL_POLYGON_MODE, polygonmode);
+    const GLboolean depthtest = glIsEnabled(GL_DEPTH_TEST);
+
+    glDisable(GL_DEPTH_TEST);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glstate::bindVertexArray(vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glstate::bindVertexArray(0);
+
+    glPolygonMode(GL_FRONT_AND_BACK, static_cast<GLenum>(polygonmode[0]));
+    if (depthtest) {
+        glEnable(GL_DEPTH_TEST);
+    }
+}
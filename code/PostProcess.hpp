@@ -0,0 +1,101 @@
+/*
+ * The effects after the main pass, fused into one full screen pass: bloom, tone mapping,
+ * color grading, gamma correction, FXAA and a vignette.
+ *
+ * Usage: Choose the effects with setEffects(), e.g. from parseEffects() of a list like
+ *        "tonemap,grade,gamma,fxaa". Draw the scene into a texture, GL_RGBA16F for the
+ *        colors above 1 that tone mapping and bloom are for, and apply() it to the bound
+ *        framebuffer and viewport. apply() draws a full screen triangle with a program of
+ *        vertex_fullscreen.glsl and fragment_post.glsl, built with a define for each effect
+ *        that is on, so the scene color is read once and the final color written once
+ *        whatever the effects are, instead of once per effect in a pass of its own. The
+ *        program of each combination of effects is compiled when it is first used.
+ *        Like DynamicResolution::upscale(), apply() takes the scene from the lower left
+ *        'renderwidth' x 'renderheight' texels and scales it to the viewport, bilinearly.
+ *        FXAA works on the texels of the scene, so it smooths the edges before they are
+ *        scaled up.
+ *        Bloom, the glow around the brightest colors, is a blur too wide for one pass of
+ *        the full resolution. With Effect::Bloom, before apply(), downsample() the colors
+ *        over the threshold into a texture of bloomSize(), a half or a quarter of the
+ *        window in each direction, then blur() it into a second texture of that size and
+ *        back, once across and once down, with a separable Gaussian of 9 texels in 5 bilinear
+ *        taps. apply() adds it to the scene before tone mapping.
+ *        All passes restore the GL state they change, except the bound program and texture.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <string>
+
+#include "Shader.hpp"
+
+class PostProcess {
+public:
+    // The effects, in the order they are applied, as bits of effects()
+    enum Effect : unsigned {
+        Bloom = 1,
+        ToneMap = 2,
+        ColorGrade = 4,
+        Gamma = 8,
+        FXAA = 16,
+        Vignette = 32
+    };
+
+    struct Settings {
+        float exposure = 1.0f;                 // Scale of the colors before tone mapping
+        float bloomthreshold = 1.0f;           // Brightness where the glow starts
+        float bloomintensity = 0.5f;           // Of the blurred colors added to the scene
+        int bloomdivisor = 2;                  // Of the window size for the bloom, 2 or 4
+        float gain[3] = {1.0f, 1.0f, 1.0f};    // Color grading, the scale of each channel,
+        float saturation = 1.0f;               // then 0 for gray and above 1 for more color,
+        float contrast = 1.0f;                 // then the spread around the middle gray
+        float vignette = 0.25f;                // How much the corners darken
+    };
+
+    PostProcess();
+
+    /* Destructor: delete the VAO */
+    ~PostProcess();
+
+    PostProcess(const PostProcess&) = delete;
+    PostProcess& operator=(const PostProcess&) = delete;
+
+    /* Names separated by commas, "bloom", "tonemap", "grade", "gamma", "fxaa" and
+     * "vignette" in any order, or "all". False for other names. */
+    static bool parseEffects(const std::string& names, unsigned& effects);
+
+    void setEffects(unsigned effects);
+    unsigned effects() const;
+
+    void setSettings(const Settings& settings);
+    const Settings& settings() const;
+
+    // The defines of fragment_post.glsl for the effects
+    std::string defines() const;
+
+    // The size of the bloom textures for a window of 'width' x 'height'
+    void bloomSize(int width, int height, int& bloomwidth, int& bloomheight) const;
+
+    /* Average the lower left 'renderwidth' x 'renderheight' texels of 'scene' down to the
+     * viewport, keeping what is brighter than the threshold */
+    void downsample(GLuint scene, int renderwidth, int renderheight);
+
+    // Blur 'source', a texture of bloomSize(), across or down into the viewport
+    void blur(GLuint source, bool vertical);
+
+    /* Draw the lower left 'renderwidth' x 'renderheight' texels of 'scene' into the
+     * viewport with the effects, adding 'bloom' with Effect::Bloom */
+    void apply(GLuint scene, int renderwidth, int renderheight, GLuint bloom = 0);
+
+private:
+    // Draw the full screen triangle with the depth test and the polygon mode off
+    void drawFullscreen();
+
+    unsigned effects_;
+    Settings settings_;
+    ShaderVariants post_;   // fragment_post.glsl, a variant per combination of effects
+    ShaderVariants bloom_;  // fragment_bloom.glsl, with DOWNSAMPLE and without
+    GLuint vao_;            // Empty VAO for the full screen triangle
+};
@@ -0,0 +1,80 @@
+/*
+ * A grid of quads generated in the vertex shader from gl_VertexID
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "ProceduralGrid.hpp"
+
+#include "GLState.hpp"
+
+#include <algorithm>
+
+ProceduralGrid::ProceduralGrid()
+    : vao_(0), shape_(Shape::Plane), columns_(0), rows_(0), size_{1.0f, 1.0f}, heightmap_(0),
+      heightscale_(1.0f) {}
+
+ProceduralGrid::~ProceduralGrid() {
+    if (glIsVertexArray(vao_)) {
+        glstate::deleteVertexArrays(1, &vao_);
+    }
+}
+
+bool ProceduralGrid::create(Shape shape, int columns, int rows,
+                            const std::string& fragmentshaderfile, const std::string& defines) {
+    const char* names[] = {"PLANE", "CYLINDER", "TORUS", "HEIGHTFIELD"};
+    shader_.createShader("vertex_grid.glsl", fragmentshaderfile,
+                         std::string(names[static_cast<int>(shape)]) + " " + defines);
+    GLint linked = GL_FALSE;
+    if (shader_.id() != 0) {
+        glGetProgramiv(shader_.id(), GL_LINK_STATUS, &linked);
+    }
+    if (linked == GL_FALSE) {
+        return false;  // The errors were printed by the Shader
+    }
+    if (vao_ == 0) {
+        glGenVertexArrays(1, &vao_);
+    }
+    shape_ = shape;
+    columns_ = std::max(columns, 1);
+    rows_ = std::max(rows, 1);
+    return true;
+}
+
+void ProceduralGrid::setSize(float a, float b) {
+    size_[0] = a;
+    size_[1] = b;
+}
+
+void ProceduralGrid::setHeightmap(GLuint texture, float heightscale) {
+    heightmap_ = texture;
+    heightscale_ = heightscale;
+}
+
+void ProceduralGrid::render() {
+    if (vao_ == 0) {
+        return;
+    }
+    shader_.use();
+    shader_.setUniform("gridSize", static_cast<GLfloat>(columns_), static_cast<GLfloat>(rows_));
+    shader_.setUniform("shapeSize", size_[0], size_[1]);
+    if (shape_ == Shape::Heightfield) {
+        glstate::activeTexture(GL_TEXTURE1);
+        glstate::bindTexture(GL_TEXTURE_2D, heightmap_);
+        glstate::activeTexture(GL_TEXTURE0);
+        shader_.setUniform("heightmap", 1);
+        shader_.setUniform("heightScale", heightscale_);
+    }
+    glstate::bindVertexArray(vao_);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 2 * (columns_ + 1), rows_);
+    glstate::bindVertexArray(0);
+}
+
+Shader& ProceduralGrid::shader() { return shader_; }
+
+int ProceduralGrid::columns() const { return columns_; }
+
+int ProceduralGrid::rows() const { return rows_; }
+
+int ProceduralGrid::triangles() const { return 2 * columns_ * rows_; }
@@ -0,0 +1,77 @@
+/*
+ * A regular grid of quads that is generated on the GPU, without vertex or index buffers.
+ *
+ * Usage: Call create() with a shape and the number of columns and rows of quads, set the
+ *        size of the shape, and call render() with the matrices in the uniform blocks as for
+ *        TriangleSoup::render(). The program of create() is made current by render().
+ *        vertex_grid.glsl computes the position, normal and texture coordinates of every
+ *        vertex from gl_VertexID and gl_InstanceID. A grid of any size therefore takes no
+ *        CPU time, no memory and no upload, only vertex shading. Every row of quads is an
+ *        instance of one triangle strip, so that most vertices are shaded twice instead of
+ *        six times as for separate triangles.
+ *        Shapes, with (u, v) in [0,1]^2 over the grid and texture coordinates st = (u, v):
+ *        Plane       - setSize(width, depth) in the xy plane, facing +z.
+ *        Cylinder    - setSize(radius, height) around the z axis, without caps.
+ *        Torus       - setSize(major radius, minor radius) around the z axis.
+ *        Heightfield - a Plane moved along z by the red channel of a texture times
+ *                      setHeightmap()'s scale. With (width - 1) x (height - 1) quads for a
+ *                      texture of width x height texels, every vertex is on a texel.
+ *                      For terrains too large for one grid, Terrain (Terrain.hpp) draws
+ *                      the same heights with a level of detail.
+ *        TriangleSoup::createPlane(), createCylinder(), createTorus() and createHeightfield()
+ *        make the same shapes on the CPU, for picking, batching and everything else that
+ *        needs the vertices.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <string>
+
+#include "Shader.hpp"
+
+class ProceduralGrid {
+public:
+    enum class Shape { Plane, Cylinder, Torus, Heightfield };
+
+    ProceduralGrid();
+
+    /* Destructor: delete the VAO */
+    ~ProceduralGrid();
+
+    ProceduralGrid(const ProceduralGrid&) = delete;
+    ProceduralGrid& operator=(const ProceduralGrid&) = delete;
+
+    /* Set up a grid of columns x rows quads, and compile vertex_grid.glsl for the shape
+     * with 'fragmentshaderfile' and 'defines'. False if the program does not link. */
+    bool create(Shape shape, int columns, int rows,
+                const std::string& fragmentshaderfile = "fragment.glsl",
+                const std::string& defines = std::string());
+
+    // The two sizes of the shape, as listed above. The default is 1 x 1.
+    void setSize(float a, float b);
+
+    // The height texture of a Heightfield, bound to texture unit 1, and its scale
+    void setHeightmap(GLuint texture, float heightscale);
+
+    // Draw the grid with its program
+    void render();
+
+    // The program, for more uniforms of the fragment shader
+    Shader& shader();
+
+    int columns() const;
+    int rows() const;
+    int triangles() const;
+
+private:
+    GLuint vao_;  // Empty VAO, since there are no vertex attributes
+    Shader shader_;
+    Shape shape_;
+    int columns_;
+    int rows_;
+    float size_[2];
+    GLuint heightmap_;
+    float heightscale_;
+};
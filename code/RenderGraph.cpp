@@ -0,0 +1,513 @@
+/*
+ * A render graph with pass culling and aliased transient textures
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "RenderGraph.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+bool isDepthFormat(GLenum format) {
+    return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 ||
+           format == GL_DEPTH_COMPONENT32 || format == GL_DEPTH_COMPONENT32F ||
+           format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+bool hasStencil(GLenum format) {
+    return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+// The pixel format of the unsigned integer color formats, 0 for the others
+GLenum unsignedPixelFormat(GLenum format) {
+    switch (format) {
+        case GL_R32UI:
+            return GL_RED_INTEGER;
+        case GL_RG32UI:
+            return GL_RG_INTEGER;
+        case GL_RGBA32UI:
+            return GL_RGBA_INTEGER;
+        default:
+            return 0;
+    }
+}
+
+bool sameTexture(const RenderGraph::TextureDesc& a, const RenderGraph::TextureDesc& b) {
+    return a.width == b.width && a.height == b.height && a.format == b.format;
+}
+
+GLuint createTexture2D(const RenderGraph::TextureDesc& desc) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glstate::bindTexture(GL_TEXTURE_2D, texture);
+    // The pixel format and type only matter for the data, and there is none
+    GLenum format = GL_RGBA;
+    GLenum type = GL_FLOAT;
+    if (hasStencil(desc.format)) {
+        format = GL_DEPTH_STENCIL;
+        type = desc.format == GL_DEPTH24_STENCIL8 ? GL_UNSIGNED_INT_24_8
+                                                  : GL_FLOAT_32_UNSIGNED_INT_24_8_REV;
+    } else if (isDepthFormat(desc.format)) {
+        format = GL_DEPTH_COMPONENT;
+    } else if (unsignedPixelFormat(desc.format) != 0) {
+        format = unsignedPixelFormat(desc.format);
+        type = GL_UNSIGNED_INT;
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(desc.format), desc.width, desc.height, 0,
+                 format, type, nullptr);
+    gpumem::setTexture(texture, gpumem::Category::RenderTarget,
+                       gpumem::textureBytes(desc.format, desc.width, desc.height));
+    // Integer textures can not be filtered
+    const GLint filter = unsignedPixelFormat(desc.format) != 0 ? GL_NEAREST : GL_LINEAR;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    return texture;
+}
+
+}  // namespace
+
+void RenderGraph::Builder::read(Resource resource) {
+    if (!graph_.valid(resource)) {
+        std::cerr << "RenderGraph: pass '" << graph_.passes_[pass_].name
+                  << "' reads an invalid resource\n";
+        graph_.errors_ = true;
+        return;
+    }
+    graph_.passes_[pass_].reads.push_back(resource);
+    graph_.nodes_[resource].readers.push_back(pass_);
+}
+
+RenderGraph::Resource RenderGraph::Builder::write(Resource resource, Load load) {
+    Pass& pass = graph_.passes_[pass_];
+    if (!graph_.valid(resource) || graph_.targets_[graph_.nodes_[resource].target].latest !=
+                                       resource) {
+        std::cerr << "RenderGraph: pass '" << pass.name << "' writes "
+                  << (graph_.valid(resource) ? "an old version of a resource"
+                                             : "an invalid resource")
+                  << "\n";
+        graph_.errors_ = true;
+        return none;
+    }
+    if (load == Load::Keep) {
+        read(resource);
+    }
+    const Resource version = graph_.newNode(graph_.nodes_[resource].target, pass_);
+    pass.writes.push_back({version, resource, load});
+    return version;
+}
+
+void RenderGraph::Builder::sideEffect() { graph_.passes_[pass_].sideeffect = true; }
+
+RenderGraph::RenderGraph() : errors_(false), compiled_(false) {}
+
+RenderGraph::~RenderGraph() {
+    for (const auto& framebuffer : framebuffers_) {
+        glDeleteFramebuffers(1, &framebuffer.second);
+    }
+    for (const Allocation& allocation : pool_) {
+        glstate::deleteTextures(1, &allocation.texture);
+    }
+}
+
+void RenderGraph::reset() {
+    targets_.clear();
+    nodes_.clear();
+    passes_.clear();
+    order_.clear();
+    errors_ = false;
+    compiled_ = false;
+    stats_ = Stats();
+}
+
+RenderGraph::Resource RenderGraph::newNode(int target, int writer) {
+    Node node;
+    node.target = target;
+    node.writer = writer;
+    nodes_.push_back(node);
+    const Resource resource = static_cast<Resource>(nodes_.size() - 1);
+    targets_[target].latest = resource;
+    return resource;
+}
+
+bool RenderGraph::valid(Resource resource) const {
+    return resource >= 0 && resource < static_cast<Resource>(nodes_.size());
+}
+
+RenderGraph::Resource RenderGraph::createTexture(const std::string& name,
+                                                 const TextureDesc& desc) {
+    if (desc.width <= 0 || desc.height <= 0) {
+        std::cerr << "RenderGraph: texture '" << name << "' has the invalid size " << desc.width
+                  << " x " << desc.height << "\n";
+        errors_ = true;
+    }
+    Target target;
+    target.name = name;
+    target.desc = desc;
+    targets_.push_back(target);
+    return newNode(static_cast<int>(targets_.size() - 1), -1);
+}
+
+RenderGraph::Resource RenderGraph::importFramebuffer(const std::string& name, GLuint framebuffer,
+                                                     int width, int height,
+                                                     const float clearcolor[4]) {
+    Target target;
+    target.name = name;
+    target.desc.width = width;
+    target.desc.height = height;
+    if (clearcolor != nullptr) {
+        std::copy(clearcolor, clearcolor + 4, target.desc.clear);
+    }
+    target.imported = true;
+    target.framebuffer = framebuffer;
+    targets_.push_back(target);
+    return newNode(static_cast<int>(targets_.size() - 1), -1);
+}
+
+void RenderGraph::addPass(const std::string& name, const std::function<void(Builder&)>& setup,
+                          std::function<void(const RenderGraph&)> execute) {
+    Pass pass;
+    pass.name = name;
+    pass.execute = std::move(execute);
+    passes_.push_back(std::move(pass));
+    Builder builder(*this, static_cast<int>(passes_.size() - 1));
+    setup(builder);
+}
+
+std::vector<int> RenderGraph::dependencies(int pass) const {
+    std::vector<int> passes;
+    for (Resource resource : passes_[pass].reads) {
+        passes.push_back(nodes_[resource].writer);
+    }
+    // After the pass that wrote the version before, and before the passes that read it
+    for (const Attachment& attachment : passes_[pass].writes) {
+        const Node& previous = nodes_[attachment.previous];
+        passes.push_back(previous.writer);
+        passes.insert(passes.end(), previous.readers.begin(), previous.readers.end());
+    }
+    passes.erase(std::remove_if(passes.begin(), passes.end(),
+                                [this, pass](int other) {
+                                    return other < 0 || other == pass || passes_[other].culled;
+                                }),
+                 passes.end());
+    return passes;
+}
+
+bool RenderGraph::compile() {
+    stats_ = Stats();
+    stats_.passes = static_cast<int>(passes_.size());
+    order_.clear();
+    if (errors_) {
+        return false;
+    }
+
+    // The targets of each pass, which must be textures or one imported framebuffer
+    std::vector<std::vector<int>> passtargets(passes_.size());
+    bool ok = true;
+    for (size_t i = 0; i < passes_.size(); i++) {
+        Pass& pass = passes_[i];
+        int depths = 0;
+        int imported = 0;
+        for (const Attachment& attachment : pass.writes) {
+            const Target& target = targets_[nodes_[attachment.resource].target];
+            passtargets[i].push_back(nodes_[attachment.resource].target);
+            imported += target.imported ? 1 : 0;
+            depths += (!target.imported && isDepthFormat(target.desc.format)) ? 1 : 0;
+            if (target.desc.width != targets_[passtargets[i][0]].desc.width ||
+                target.desc.height != targets_[passtargets[i][0]].desc.height) {
+                std::cerr << "RenderGraph: the targets of pass '" << pass.name
+                          << "' have different sizes\n";
+                ok = false;
+            }
+        }
+        if (depths > 1 || (imported > 0 && pass.writes.size() > 1)) {
+            std::cerr << "RenderGraph: pass '" << pass.name << "' writes "
+                      << (depths > 1 ? "more than one depth texture"
+                                     : "an imported framebuffer together with other targets")
+                      << "\n";
+            ok = false;
+        }
+        std::sort(passtargets[i].begin(), passtargets[i].end());
+        // Imported framebuffers are the output of the frame
+        pass.refcount = static_cast<int>(pass.writes.size()) +
+                        ((pass.sideeffect || imported > 0) ? 1 : 0);
+        pass.culled = false;
+    }
+    if (!ok) {
+        return false;
+    }
+
+    // Cull the passes nothing reads from, and then those that only they read from
+    std::vector<Resource> unused;
+    for (size_t i = 0; i < nodes_.size(); i++) {
+        nodes_[i].refcount = static_cast<int>(nodes_[i].readers.size());
+        if (nodes_[i].refcount == 0 && !targets_[nodes_[i].target].imported) {
+            unused.push_back(static_cast<Resource>(i));
+        }
+    }
+    auto cull = [this, &unused](Pass& pass) {
+        pass.culled = true;
+        for (Resource resource : pass.reads) {
+            if (--nodes_[resource].refcount == 0 && !targets_[nodes_[resource].target].imported) {
+                unused.push_back(resource);
+            }
+        }
+    };
+    for (Pass& pass : passes_) {
+        if (pass.refcount == 0) {
+            cull(pass);
+        }
+    }
+    while (!unused.empty()) {
+        const Node& node = nodes_[unused.back()];
+        unused.pop_back();
+        if (node.writer >= 0 && --passes_[node.writer].refcount == 0) {
+            cull(passes_[node.writer]);
+        }
+    }
+
+    // Order the passes that are left. Of those whose dependencies have run, the first one
+    // into the same targets as the pass before goes next, or else the first one.
+    std::vector<std::vector<int>> before(passes_.size());
+    std::vector<int> waiting;
+    for (size_t i = 0; i < passes_.size(); i++) {
+        if (passes_[i].culled) {
+            stats_.culled++;
+        } else {
+            before[i] = dependencies(static_cast<int>(i));
+            waiting.push_back(static_cast<int>(i));
+        }
+    }
+    std::vector<bool> done(passes_.size(), false);
+    while (!waiting.empty()) {
+        size_t next = waiting.size();
+        for (size_t i = 0; i < waiting.size(); i++) {
+            const std::vector<int>& needs = before[waiting[i]];
+            if (!std::all_of(needs.begin(), needs.end(),
+                             [&done](int pass) { return done[pass]; })) {
+                continue;
+            }
+            if (next == waiting.size()) {
+                next = i;
+            }
+            if (!order_.empty() && passtargets[waiting[i]] == passtargets[order_.back()]) {
+                next = i;
+                break;
+            }
+        }
+        // Only a pass that reads an old version after it was written again can wait for
+        // a pass that waits for it
+        if (next == waiting.size()) {
+            std::cerr << "RenderGraph: pass '" << passes_[waiting[0]].name
+                      << "' depends on itself through an old version of a resource\n";
+            order_.clear();
+            return false;
+        }
+        done[waiting[next]] = true;
+        order_.push_back(waiting[next]);
+        waiting.erase(waiting.begin() + static_cast<ptrdiff_t>(next));
+    }
+
+    // The lifetimes of the targets, in positions of order_
+    for (Target& target : targets_) {
+        target.first = -1;
+        target.last = -1;
+        target.texture = 0;
+    }
+    for (size_t position = 0; position < order_.size(); position++) {
+        const Pass& pass = passes_[order_[position]];
+        auto use = [this, position](Resource resource) {
+            Target& target = targets_[nodes_[resource].target];
+            if (target.first < 0) {
+                target.first = static_cast<int>(position);
+            }
+            target.last = static_cast<int>(position);
+        };
+        std::for_each(pass.reads.begin(), pass.reads.end(), use);
+        for (const Attachment& attachment : pass.writes) {
+            use(attachment.resource);
+        }
+    }
+
+    // Give each transient texture an OpenGL texture that is free for its whole lifetime,
+    // in the order they are first used
+    std::vector<int> transient;
+    for (size_t i = 0; i < targets_.size(); i++) {
+        if (!targets_[i].imported && targets_[i].first >= 0) {
+            transient.push_back(static_cast<int>(i));
+        }
+    }
+    std::stable_sort(transient.begin(), transient.end(),
+                     [this](int a, int b) { return targets_[a].first < targets_[b].first; });
+    for (Allocation& allocation : pool_) {
+        allocation.busyuntil = -1;
+    }
+    std::vector<bool> used(pool_.size(), false);
+    for (int index : transient) {
+        Target& target = targets_[index];
+        size_t slot = 0;
+        while (slot < pool_.size() && (!sameTexture(pool_[slot].desc, target.desc) ||
+                                       (used[slot] && pool_[slot].busyuntil >= target.first))) {
+            slot++;
+        }
+        if (slot == pool_.size()) {
+            pool_.push_back({target.desc, createTexture2D(target.desc), -1});
+            used.push_back(false);
+        }
+        used[slot] = true;
+        pool_[slot].busyuntil = target.last;
+        target.texture = pool_[slot].texture;
+    }
+    stats_.textures = static_cast<int>(transient.size());
+
+    // Delete the textures this frame does not need, with their framebuffers
+    for (size_t slot = pool_.size(); slot-- > 0;) {
+        if (used[slot]) {
+            continue;
+        }
+        const GLuint texture = pool_[slot].texture;
+        for (auto it = framebuffers_.begin(); it != framebuffers_.end();) {
+            if (std::find(it->first.begin(), it->first.end(), texture) != it->first.end()) {
+                glDeleteFramebuffers(1, &it->second);
+                it = framebuffers_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        glstate::deleteTextures(1, &texture);
+        pool_.erase(pool_.begin() + static_cast<ptrdiff_t>(slot));
+    }
+    stats_.allocated = static_cast<int>(pool_.size());
+
+    for (int index : order_) {
+        Pass& pass = passes_[index];
+        if (pass.writes.empty()) {
+            pass.framebuffer = 0;
+            pass.width = 0;
+            continue;
+        }
+        const Target& target = targets_[nodes_[pass.writes[0].resource].target];
+        pass.framebuffer = target.imported ? target.framebuffer : framebufferFor(pass);
+        pass.width = target.desc.width;
+        pass.height = target.desc.height;
+    }
+    compiled_ = true;
+    return true;
+}
+
+GLuint RenderGraph::framebufferFor(const Pass& pass) {
+    // The color textures in the order they were written, then the depth texture or 0
+    std::vector<GLuint> key;
+    GLuint depth = 0;
+    bool stencil = false;
+    for (const Attachment& attachment : pass.writes) {
+        const Target& target = targets_[nodes_[attachment.resource].target];
+        if (isDepthFormat(target.desc.format)) {
+            depth = target.texture;
+            stencil = hasStencil(target.desc.format);
+        } else {
+            key.push_back(target.texture);
+        }
+    }
+    const size_t colors = key.size();
+    key.push_back(depth);
+    auto known = framebuffers_.find(key);
+    if (known != framebuffers_.end()) {
+        return known->second;
+    }
+
+    GLuint framebuffer = 0;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    std::vector<GLenum> buffers;
+    for (size_t i = 0; i < colors; i++) {
+        const GLenum attachment = GL_COLOR_ATTACHMENT0 + static_cast<GLenum>(i);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, key[i], 0);
+        buffers.push_back(attachment);
+    }
+    if (depth != 0) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER,
+                               stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,
+                               GL_TEXTURE_2D, depth, 0);
+    }
+    if (buffers.empty()) {
+        glDrawBuffer(GL_NONE);  // Depth only
+        glReadBuffer(GL_NONE);
+    } else {
+        glDrawBuffers(static_cast<GLsizei>(buffers.size()), buffers.data());
+    }
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "RenderGraph: the framebuffer of pass '" << pass.name
+                  << "' is not complete (status 0x" << std::hex << status << std::dec << ")\n";
+    }
+    framebuffers_[key] = framebuffer;
+    return framebuffer;
+}
+
+void RenderGraph::execute() {
+    if (!compiled_) {
+        return;
+    }
+    bool bound = false;
+    GLuint current = 0;
+    for (int index : order_) {
+        const Pass& pass = passes_[index];
+        if (!pass.writes.empty()) {
+            if (!bound || pass.framebuffer != current) {
+                glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+                glViewport(0, 0, pass.width, pass.height);
+                current = pass.framebuffer;
+                bound = true;
+                stats_.binds++;
+            }
+            GLint color = 0;
+            for (const Attachment& attachment : pass.writes) {
+                const Target& target = targets_[nodes_[attachment.resource].target];
+                const bool depth = !target.imported && isDepthFormat(target.desc.format);
+                if (attachment.load == Load::Clear) {
+                    if (!target.imported && unsignedPixelFormat(target.desc.format) != 0) {
+                        GLuint clear[4];
+                        for (int c = 0; c < 4; c++) {
+                            clear[c] = static_cast<GLuint>(target.desc.clear[c]);
+                        }
+                        glClearBufferuiv(GL_COLOR, color, clear);
+                    } else if (target.imported || !depth) {
+                        glClearBufferfv(GL_COLOR, color, target.desc.clear);
+                    }
+                    if (target.imported) {
+                        const GLfloat one = 1.0f;
+                        glClearBufferfv(GL_DEPTH, 0, &one);
+                    } else if (depth) {
+                        glClearBufferfv(GL_DEPTH, 0, target.desc.clear);
+                    }
+                }
+                color += depth ? 0 : 1;
+            }
+        }
+        pass.execute(*this);
+    }
+}
+
+GLuint RenderGraph::texture(Resource resource) const {
+    return valid(resource) ? targets_[nodes_[resource].target].texture : 0;
+}
+
+const RenderGraph::Stats& RenderGraph::stats() const { return stats_; }
+
+std::vector<std::string> RenderGraph::schedule() const {
+    std::vector<std::string> names;
+    for (int index : order_) {
+        names.push_back(passes_[index].name);
+    }
+    return names;
+}
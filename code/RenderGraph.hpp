@@ -0,0 +1,185 @@
+/*
+ * A render graph: the passes of a frame declare the textures they read and write, and the
+ * graph orders them, culls the unused ones and allocates the framebuffers.
+ *
+ * Usage: Every frame, reset() the graph, create the transient textures the frame needs
+ *        with createTexture(), import the framebuffer to present into with
+ *        importFramebuffer(), and add the passes in an order that works. A pass has a setup
+ *        function, called at once by addPass(), which declares what the pass uses with the
+ *        Builder, and an execute function, which draws. Then compile() and execute().
+ *          - read() is a texture that the pass samples. texture() gives its name in
+ *            execute.
+ *          - write() is a render target of the pass, a color or depth texture by its
+ *            format, or an imported framebuffer, which can not be mixed with textures.
+ *            It returns a new version of the resource, which later passes read or write.
+ *            With Load::Clear the pass clears it to the clear value of the texture first,
+ *            with Load::Keep it draws over what the version before holds, which is read
+ *            by the pass like read(), without binding it as a texture.
+ *          - sideEffect() keeps a pass that writes nothing the frame uses.
+ *        compile() culls the passes whose writes no live pass reads, starting from the
+ *        imported framebuffers and the passes with side effects. The passes that are left
+ *        run in an order that keeps their dependencies, and among the passes that are
+ *        ready, the next one renders into the framebuffer bound last if it can, so that
+ *        passes into the same targets run in a row without binding again.
+ *        The transient textures that are used do not exist before compile(): a texture
+ *        lives from the first to the last pass that uses it, and the textures of the same
+ *        format and size whose lifetimes do not overlap share one OpenGL texture. So a
+ *        texture that is written with Load::Keep first holds what another one left. The
+ *        OpenGL textures and the framebuffer objects of their combinations are kept from
+ *        frame to frame, and those a frame does not use are deleted.
+ *        execute() binds the framebuffer of each pass only if another one is bound, sets
+ *        the viewport to its size and clears the targets of Load::Clear, with
+ *        glClearBuffer, which obeys the color and depth write masks. It leaves the last
+ *        framebuffer bound.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+class RenderGraph {
+public:
+    // A version of a texture or an imported framebuffer, valid until reset()
+    using Resource = int;
+    static constexpr Resource none = -1;
+
+    enum class Load { Keep, Clear };
+
+    struct TextureDesc {
+        int width = 0;
+        int height = 0;
+        GLenum format = GL_RGBA8;  // A color format, or a depth format. Of the integer
+                                   // formats, GL_R32UI, GL_RG32UI and GL_RGBA32UI.
+        float clear[4] = {0.0f, 0.0f, 0.0f, 0.0f};  // Color, or the depth in clear[0]
+    };
+
+    // What the setup function of a pass declares
+    class Builder {
+    public:
+        void read(Resource resource);
+        Resource write(Resource resource, Load load = Load::Keep);
+        void sideEffect();
+
+    private:
+        friend class RenderGraph;
+        Builder(RenderGraph& graph, int pass) : graph_(graph), pass_(pass) {}
+
+        RenderGraph& graph_;
+        int pass_;
+    };
+
+    struct Stats {
+        int passes = 0;    // Passes that were added, and those culled
+        int culled = 0;
+        int textures = 0;  // Transient textures that were used, and OpenGL textures for them
+        int allocated = 0;
+        int binds = 0;     // Framebuffer binds of execute()
+    };
+
+    RenderGraph();
+
+    /* Destructor: delete the textures and framebuffers */
+    ~RenderGraph();
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    // Forget the passes and resources of the last frame, but keep the OpenGL objects
+    void reset();
+
+    Resource createTexture(const std::string& name, const TextureDesc& desc);
+
+    // A framebuffer made elsewhere, like 0 for the window. It has a color and a depth
+    // buffer, cleared to 'clearcolor' and a depth of 1.
+    Resource importFramebuffer(const std::string& name, GLuint framebuffer, int width,
+                               int height, const float clearcolor[4] = nullptr);
+
+    void addPass(const std::string& name, const std::function<void(Builder&)>& setup,
+                 std::function<void(const RenderGraph&)> execute);
+
+    /* Cull, order, and allocate the textures. False, with the errors printed, if a pass
+     * used the resources in a way that can not work. */
+    bool compile();
+
+    void execute();
+
+    // The OpenGL texture of a resource, for the execute functions
+    GLuint texture(Resource resource) const;
+
+    const Stats& stats() const;
+
+    // The passes that execute() runs, in order
+    std::vector<std::string> schedule() const;
+
+private:
+    // What the graph knows of a texture or an imported framebuffer
+    struct Target {
+        std::string name;
+        TextureDesc desc;
+        bool imported = false;
+        GLuint framebuffer = 0;  // Imported only
+        int latest = none;       // Its newest resource
+        int first = -1;          // Positions in order_ of the first and last pass using it
+        int last = -1;
+        GLuint texture = 0;
+    };
+
+    // A version of a target
+    struct Node {
+        int target;
+        int writer = -1;           // The pass that made it, -1 for the first one
+        int refcount = 0;          // Live passes that read it
+        std::vector<int> readers;  // All passes that read it
+    };
+
+    struct Attachment {
+        Resource resource;
+        Resource previous;  // The version it replaces
+        Load load;
+    };
+
+    struct Pass {
+        std::string name;
+        std::function<void(const RenderGraph&)> execute;
+        std::vector<Resource> reads;  // Also the versions that Load::Keep draws over
+        std::vector<Attachment> writes;
+        bool sideeffect = false;
+        bool culled = false;
+        int refcount = 0;
+        GLuint framebuffer = 0;
+        int width = 0;
+        int height = 0;
+    };
+
+    // An OpenGL texture of the pool
+    struct Allocation {
+        TextureDesc desc;
+        GLuint texture;
+        int busyuntil;  // Position of the last pass of the texture it holds, -1 if unused
+    };
+
+    Resource newNode(int target, int writer);
+    bool valid(Resource resource) const;
+
+    // Passes other than 'pass' that must run before it
+    std::vector<int> dependencies(int pass) const;
+
+    // The framebuffer object for the textures of a pass, from the cache or new
+    GLuint framebufferFor(const Pass& pass);
+
+    std::vector<Target> targets_;
+    std::vector<Node> nodes_;
+    std::vector<Pass> passes_;
+    std::vector<int> order_;  // The live passes, in the order they run
+    bool errors_;             // Found while the passes were added
+    bool compiled_;
+    std::vector<Allocation> pool_;
+    std::map<std::vector<GLuint>, GLuint> framebuffers_;  // By the color textures and depth
+    Stats stats_;
+};
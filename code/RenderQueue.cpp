@@ -0,0 +1,100 @@
+/*
+ * A queue of draws sorted by 64 bit keys
+ *
+ * This code is in the public domain.
+ */
+#include "RenderQueue.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Bits of the fields, from the top of the key: the pass, then in the depth and opaque
+// passes shader, texture, mesh and depth, and in the other passes the depth first
+constexpr int passBits = 4;
+constexpr int stateBits = 12;
+constexpr int depthBits = 24;
+
+// The radix sort takes a byte of the key per pass. Larger digits need fewer passes, but
+// scatter to more places at once, which is slower here.
+constexpr int digitBits = 8;
+constexpr int digitCount = (64 + digitBits - 1) / digitBits;
+constexpr size_t digitBuckets = size_t(1) << digitBits;
+constexpr uint64_t digitMask = digitBuckets - 1;
+
+// 12 bits from a state number of any size
+uint64_t fold(uint32_t value) {
+    return (value ^ (value >> 12) ^ (value >> 24)) & ((1u << stateBits) - 1);
+}
+
+}  // namespace
+
+uint64_t RenderQueue::makeKey(Pass pass, uint32_t shader, uint32_t texture, uint32_t mesh,
+                              float depth) {
+    // A positive float sorts like its bits as an integer. Without the sign, the upper 24
+    // bits hold the exponent and 16 bits of the mantissa.
+    uint32_t bits = 0;
+    depth = std::max(depth, 0.0f);
+    std::memcpy(&bits, &depth, sizeof(bits));
+    uint64_t distance = (bits >> (31 - depthBits)) & ((1u << depthBits) - 1);
+
+    const uint64_t state = (fold(shader) << (2 * stateBits)) | (fold(texture) << stateBits) |
+                           fold(mesh);
+    uint64_t key = uint64_t(pass) << (64 - passBits);
+    if (pass == Pass::Depth || pass == Pass::Opaque) {
+        key |= (state << depthBits) | distance;
+    } else {
+        distance = ((1u << depthBits) - 1) - distance;  // Back to front
+        key |= (distance << (3 * stateBits)) | state;
+    }
+    return key;
+}
+
+RenderQueue::Pass RenderQueue::pass(uint64_t key) {
+    return static_cast<Pass>(key >> (64 - passBits));
+}
+
+void RenderQueue::clear() { draws_.clear(); }
+
+void RenderQueue::push(uint64_t key, uint32_t payload) { draws_.push_back({key, payload}); }
+
+void RenderQueue::sort() {
+    const size_t count = draws_.size();
+    if (count < 2) {
+        return;
+    }
+    // The histograms of all digits in one pass over the keys
+    std::vector<uint32_t>& histograms = histograms_;
+    histograms.assign(digitCount * digitBuckets, 0);
+    for (const Draw& draw : draws_) {
+        for (int digit = 0; digit < digitCount; digit++) {
+            histograms[digit * digitBuckets + ((draw.key >> (digitBits * digit)) & digitMask)]++;
+        }
+    }
+
+    scratch_.resize(count);
+    for (int digit = 0; digit < digitCount; digit++) {
+        uint32_t* histogram = histograms.data() + digit * digitBuckets;
+        const int shift = digitBits * digit;
+        // All keys have the same digit, so they are in order for it already
+        if (histogram[(draws_[0].key >> shift) & digitMask] == count) {
+            continue;
+        }
+        uint32_t offset = 0;
+        for (size_t bucket = 0; bucket < digitBuckets; bucket++) {
+            const uint32_t size = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += size;
+        }
+        Draw* target = scratch_.data();
+        for (const Draw& draw : draws_) {
+            target[histogram[(draw.key >> shift) & digitMask]++] = draw;
+        }
+        draws_.swap(scratch_);
+    }
+}
+
+const std::vector<RenderQueue::Draw>& RenderQueue::draws() const { return draws_; }
+
+size_t RenderQueue::size() const { return draws_.size(); }
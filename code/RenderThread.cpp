@@ -0,0 +1,95 @@
+/*
+ * A thread that owns the OpenGL context and draws frames prepared by other threads
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "RenderThread.hpp"
+
+#include "GLState.hpp"
+#include "Trace.hpp"
+
+RenderThread::RenderThread(GLFWwindow* window, RenderFunction render, int framesinflight)
+    : window_(window),
+      render_(std::move(render)),
+      packets_(static_cast<size_t>(framesinflight)),
+      submitted_(static_cast<size_t>(framesinflight)),
+      free_(static_cast<size_t>(framesinflight)),
+      current_(nullptr),
+      frame_(0),
+      renderedframes_(0),
+      stop_(false) {
+    for (FramePacket& packet : packets_) {
+        free_.push(&packet);
+    }
+    // A context can only be current on one thread at a time
+    glfwMakeContextCurrent(nullptr);
+    thread_ = std::thread(&RenderThread::run, this);
+}
+
+RenderThread::~RenderThread() { stop(); }
+
+FramePacket& RenderThread::beginFrame() {
+    if (current_ == nullptr && !free_.pop(current_)) {
+        TRACE_SCOPE("wait for the render thread");
+        std::unique_lock<std::mutex> lock(mutex_);
+        freesignal_.wait(lock, [this] { return free_.pop(current_); });
+    }
+    current_->frame = frame_;
+    return *current_;
+}
+
+void RenderThread::submit() {
+    if (current_ == nullptr) {
+        return;
+    }
+    submitted_.push(current_);  // Never full, there are only as many packets as places
+    current_ = nullptr;
+    frame_++;
+    // Taking the lock orders the push before the render thread's check of the queue
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    submittedsignal_.notify_one();
+}
+
+void RenderThread::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    submittedsignal_.notify_one();
+    thread_.join();
+    glfwMakeContextCurrent(window_);
+    glstate::invalidate();  // The render thread has changed the bindings
+}
+
+long long RenderThread::renderedFrames() const { return renderedframes_; }
+
+void RenderThread::run() {
+    TRACE_THREAD("render");
+    glfwMakeContextCurrent(window_);
+    glstate::invalidate();
+    for (;;) {
+        FramePacket* packet = nullptr;
+        if (!submitted_.pop(packet)) {
+            TRACE_SCOPE("wait for a frame");
+            std::unique_lock<std::mutex> lock(mutex_);
+            submittedsignal_.wait(lock, [&] { return submitted_.pop(packet) || stop_; });
+        }
+        if (packet == nullptr) {
+            break;  // Stopped, and every submitted frame is drawn
+        }
+        {
+            TRACE_SCOPE("render frame");
+            render_(*packet);
+        }
+        renderedframes_++;
+        free_.push(packet);
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        freesignal_.notify_one();
+    }
+    glfwMakeContextCurrent(nullptr);
+}
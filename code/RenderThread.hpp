@@ -0,0 +1,118 @@
+/*
+ * A thread that owns the OpenGL context and draws frames prepared by other threads.
+ *
+ * Usage: Create the RenderThread after all GL objects the frame needs, with a function that
+ *        draws one FramePacket and swaps the buffers. The GL context moves to the render
+ *        thread. Every frame, the main thread gets a packet with beginFrame(), fills it with
+ *        the frame's matrices and draws, and hands it over with submit(). The render thread
+ *        draws it while the main thread polls input and prepares the next frame, so the
+ *        update of frame N+1 overlaps the GL calls of frame N.
+ *        'framesinflight' packets circulate between the threads through two SpscQueues, one
+ *        of submitted and one of free packets. beginFrame() waits only when all of them are
+ *        submitted and not drawn yet. Worker threads may fill the draws of a packet in
+ *        parallel, each its own elements, for example with ThreadPool::parallelFor().
+ *        The render function may write results back into the packet, like a new window
+ *        title or a picked object, which the main thread finds there when the packet comes
+ *        back from beginFrame(). GLFW functions other than glfwSwapBuffers() belong to the
+ *        main thread. stop() draws the submitted frames, ends the thread and makes the
+ *        context current on the calling thread again, for cleaning up.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LightClusters.hpp"
+#include "Mat4.hpp"
+#include "PickBuffer.hpp"
+#include "SpscQueue.hpp"
+
+class TriangleSoup;
+
+// One object to draw: a shape and its transformations
+struct DrawPacket {
+    TriangleSoup* shape;
+    Mat4 MV;  // Modelview matrix
+    Mat4 R;   // Rotation for the normals
+    bool isstatic = false;  // Static draws also cast shadows in the cached shadow cascades
+    float opacity = 1.0f;   // Below 1, drawn by the transparent pass only, without shadows
+    GLuint material = 0;    // Index in the MaterialTable
+};
+
+// Everything the render thread needs to know about a frame
+struct FramePacket {
+    long long frame = 0;        // Number of the frame, counted by submit()
+    int width = 0;              // Window size
+    int height = 0;
+    float time = 0.0f;          // Seconds since the start
+    Mat4 P = Mat4::identity();  // Projection matrix
+    Mat4 V = Mat4::identity();  // View matrix, for what is placed in world space
+    std::vector<DrawPacket> draws;
+    std::vector<PointLight> lights;  // In view space, for shaders with CLUSTERED_LIGHTS
+    Mat4 streamMV = Mat4::identity();  // Modelview matrix of a streamed ChunkedMesh
+    std::vector<std::string> changedfiles;  // Files changed since the last frame
+    double inputtime = -1.0;  // glfwGetTime() of the oldest input the frame shows, or -1
+    std::string title;  // Set by the render function to change the window title
+    bool overlay = false;  // Draw the performance Overlay over the frame
+    int pickx = -1;     // Window pixel to pick the object of, or -1
+    int picky = -1;
+    PickResult pick;    // Set by the render function when a pick has been read back
+    bool pickray = false;      // Pick the nearest draw hit by the ray, in view space
+    float rayorigin[3] = {};
+    float raydirection[3] = {};
+};
+
+class RenderThread {
+public:
+    using RenderFunction = std::function<void(FramePacket& frame)>;
+
+    /* Constructor: release the context of 'window' on this thread and start the render
+     * thread, which calls 'render' for every submitted packet */
+    RenderThread(GLFWwindow* window, RenderFunction render, int framesinflight = 2);
+
+    /* Destructor: stop() */
+    ~RenderThread();
+
+    RenderThread(const RenderThread&) = delete;
+    RenderThread& operator=(const RenderThread&) = delete;
+
+    // A free packet for the next frame, waiting for the render thread if there is none
+    FramePacket& beginFrame();
+
+    // Hand the packet from beginFrame() to the render thread
+    void submit();
+
+    // Draw the submitted frames, join the render thread and take the context back
+    void stop();
+
+    // Number of frames drawn so far
+    long long renderedFrames() const;
+
+private:
+    // The render thread: draw packets until stop_
+    void run();
+
+    GLFWwindow* window_;
+    RenderFunction render_;
+    std::vector<FramePacket> packets_;
+    SpscQueue<FramePacket*> submitted_;  // From the main thread to the render thread
+    SpscQueue<FramePacket*> free_;       // And back when they are drawn
+    FramePacket* current_;               // Between beginFrame() and submit()
+    long long frame_;
+    std::atomic<long long> renderedframes_;
+
+    // For sleeping while a queue is empty. The queues themselves need no lock.
+    std::mutex mutex_;
+    std::condition_variable submittedsignal_;
+    std::condition_variable freesignal_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+};
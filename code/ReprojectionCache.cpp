@@ -0,0 +1,181 @@
+/*
+ * A reverse reprojection cache of the shading of the last frame
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "ReprojectionCache.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+
+#include <iostream>
+
+namespace {
+
+// The order in which the pixels of each 4 x 4 block are shaded again, so that those of
+// frames in a row are far apart
+constexpr int refreshOrder[16] = {0, 10, 2, 8, 5, 15, 7, 13, 1, 11, 3, 9, 4, 14, 6, 12};
+
+}  // namespace
+
+ReprojectionCache::ReprojectionCache()
+    : width_(0), height_(0), renderwidth_(0), renderheight_(0), storedwidth_(0),
+      storedheight_(0), valid_(false), stored_(false), frame_(0), framebuffer_(0), color_(0),
+      depth_(0), vao_(0) {}
+
+ReprojectionCache::~ReprojectionCache() {
+    if (framebuffer_ != 0) {
+        glDeleteFramebuffers(1, &framebuffer_);
+        glstate::deleteTextures(1, &color_);
+        glstate::deleteTextures(1, &depth_);
+    }
+    if (vao_ != 0) {
+        glstate::deleteVertexArrays(1, &vao_);
+    }
+}
+
+void ReprojectionCache::resize(int width, int height) {
+    if (width <= 0 || height <= 0) {
+        std::cerr << "ReprojectionCache::resize(): invalid size " << width << " x " << height
+                  << "\n";
+        return;
+    }
+    if (framebuffer_ == 0) {
+        glGenFramebuffers(1, &framebuffer_);
+        glGenTextures(1, &color_);
+        glGenTextures(1, &depth_);
+    }
+    width_ = width;
+    height_ = height;
+    // Bilinear color, since the last frame is read between its pixels, and nearest depth
+    glstate::bindTexture(GL_TEXTURE_2D, color_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 nullptr);
+    gpumem::setTexture(color_, gpumem::Category::RenderTarget,
+                       gpumem::textureBytes(GL_RGBA8, width, height));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glstate::bindTexture(GL_TEXTURE_2D, depth_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT,
+                 GL_UNSIGNED_INT, nullptr);
+    gpumem::setTexture(depth_, gpumem::Category::RenderTarget,
+                       gpumem::textureBytes(GL_DEPTH_COMPONENT24, width, height));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_, 0);
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "ReprojectionCache::resize(): framebuffer is not complete (status 0x"
+                  << std::hex << status << std::dec << ")\n";
+    }
+    invalidate();
+}
+
+int ReprojectionCache::width() const { return width_; }
+
+int ReprojectionCache::height() const { return height_; }
+
+GLuint ReprojectionCache::framebuffer() const { return framebuffer_; }
+
+void ReprojectionCache::invalidate() {
+    valid_ = false;
+    stored_ = false;
+    draws_.clear();
+    storeddraws_.clear();
+}
+
+void ReprojectionCache::beginFrame(int renderwidth, int renderheight) {
+    renderwidth_ = renderwidth;
+    renderheight_ = renderheight;
+    // The draws of the last frame, whose shading is in the cache if it was stored
+    valid_ = stored_;
+    stored_ = false;
+    storeddraws_.swap(draws_);
+    draws_.clear();
+    frame_++;
+}
+
+void ReprojectionCache::apply(Shader& shader, GLuint unit) const {
+    glstate::activeTexture(GL_TEXTURE0 + unit);
+    glstate::bindTexture(GL_TEXTURE_2D, color_);
+    glstate::activeTexture(GL_TEXTURE0 + unit + 1);
+    glstate::bindTexture(GL_TEXTURE_2D, depth_);
+    glstate::activeTexture(GL_TEXTURE0);
+    shader.setUniform("historyColor", static_cast<GLint>(unit));
+    shader.setUniform("historyDepth", static_cast<GLint>(unit + 1));
+    // From the texture coordinates of the last frame to those of the cache
+    shader.setUniform("historyScale", width_ > 0 ? float(storedwidth_) / float(width_) : 0.0f,
+                      height_ > 0 ? float(storedheight_) / float(height_) : 0.0f);
+    shader.setUniform("renderSize", float(renderwidth_), float(renderheight_));
+    shader.setUniform("refreshPixel", static_cast<GLint>(refreshOrder[frame_ % refreshPeriod]));
+}
+
+void ReprojectionCache::setDraw(Shader& shader, size_t id, const void* object, const Mat4& PMV,
+                                bool reuse) {
+    if (draws_.size() <= id) {
+        draws_.resize(id + 1, Draw{nullptr, Mat4::identity(), false});
+    }
+    draws_[id] = Draw{object, PMV, reuse};
+    // The matrix of the last frame is known without the cache, for the motion vectors
+    const bool moved = reuse && id < storeddraws_.size() && storeddraws_[id].object == object;
+    shader.setUniformMatrix("reprojection", moved ? storeddraws_[id].PMV.m : PMV.m);
+    shader.setUniform("drawHistory", valid_ && moved ? 1.0f : 0.0f);
+}
+
+void ReprojectionCache::store(GLuint color, GLuint depth) {
+    if (framebuffer_ == 0) {
+        return;
+    }
+    if (shader_.id() == 0) {
+        shader_.createShader("vertex_fullscreen.glsl", "fragment_reprojection_store.glsl");
+        glGenVertexArrays(1, &vao_);
+    }
+    GLint polygonmode[2];
+    glGetIntegerv(GL_POLYGON_MODE, polygonmode);
+    GLint depthfunc = GL_LESS;
+    glGetIntegerv(GL_DEPTH_FUNC, &depthfunc);
+    GLboolean depthmask = GL_TRUE;
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &depthmask);
+    const GLboolean depthtest = glIsEnabled(GL_DEPTH_TEST);
+
+    // The depth is written by the shader, which needs the depth test on
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
+    glDepthMask(GL_TRUE);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    shader_.use();
+    glstate::activeTexture(GL_TEXTURE0);
+    glstate::bindTexture(GL_TEXTURE_2D, color);
+    glstate::activeTexture(GL_TEXTURE1);
+    glstate::bindTexture(GL_TEXTURE_2D, depth);
+    glstate::activeTexture(GL_TEXTURE0);
+    shader_.setUniform("color", 0);
+    shader_.setUniform("depth", 1);
+    glViewport(0, 0, renderwidth_, renderheight_);
+    glstate::bindVertexArray(vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glstate::bindVertexArray(0);
+
+    glPolygonMode(GL_FRONT_AND_BACK, static_cast<GLenum>(polygonmode[0]));
+    glDepthFunc(static_cast<GLenum>(depthfunc));
+    glDepthMask(depthmask);
+    if (!depthtest) {
+        glDisable(GL_DEPTH_TEST);
+    }
+
+    storedwidth_ = renderwidth_;
+    storedheight_ = renderheight_;
+    stored_ = true;
+}
@@ -0,0 +1,106 @@
+/*
+ * A reverse reprojection cache, which reuses the shading of the last frame wherever the same
+ * surface was visible in it (Nehab et al. 2007).
+ *
+ * Usage: Once per frame, beginFrame() with the part of the view that the frame draws into.
+ *        Draw the opaque surfaces with a program of vertex.glsl and fragment.glsl built with
+ *        the define REPROJECTION, after apply() to the program, and setDraw() before each
+ *        draw, which gives the vertex shader the projection and model-view matrix of the
+ *        draw in the last frame. The fragment shader finds where each fragment was in the
+ *        last frame, and if that was on the screen at the depth that the last frame has
+ *        there, it takes the color from there instead of shading the fragment. So only the
+ *        surfaces that were hidden or outside the view are shaded, and one pixel in
+ *        refreshPeriod in every frame, in an ordered 4 x 4 pattern that goes through all
+ *        of them in refreshPeriod frames, for the shading that changes without any motion,
+ *        like moving lights and highlights. Then store() the color and depth textures of
+ *        the frame, with framebuffer() bound, which the next frame reads.
+ *        A draw is known by an id that stays the same from frame to frame, like its index
+ *        in the list of draws, and the object it draws. A draw whose id drew another object
+ *        in the last frame, or nothing, has no history and is shaded everywhere, and so is
+ *        a draw with 'reuse' false, like a mesh that is deformed by skinning, whose motion
+ *        the matrices do not tell.
+ *        The cache is an RGBA8 and a 24 bit depth texture of the size of the view, and
+ *        invalidate() forgets them, for when all of the shading changes, like when a
+ *        shader is built again. store() draws a full screen triangle with
+ *        vertex_fullscreen.glsl and fragment_reprojection_store.glsl, loaded on first use.
+ *        The matrices of the last frame are kept without the cache too: with beginFrame()
+ *        and setDraw() alone, without resize(), apply() or store(), the variant with the
+ *        define MOTION_VECTORS of the shaders has where each fragment was in the last
+ *        frame, for the TAA of AntiAliasing (AntiAliasing.hpp).
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <vector>
+
+#include "Mat4.hpp"
+#include "Shader.hpp"
+
+class ReprojectionCache {
+public:
+    static constexpr int refreshPeriod = 16;  // Frames between two shadings of every pixel
+
+    ReprojectionCache();
+
+    /* Destructor: delete the textures and the framebuffer */
+    ~ReprojectionCache();
+
+    ReprojectionCache(const ReprojectionCache&) = delete;
+    ReprojectionCache& operator=(const ReprojectionCache&) = delete;
+
+    // Create the textures for a view of 'width' x 'height' pixels, which forgets the last
+    // frame
+    void resize(int width, int height);
+
+    int width() const;
+    int height() const;
+
+    // The framebuffer of the textures, to bind for store()
+    GLuint framebuffer() const;
+
+    // Forget the last frame, so that the next one is shaded everywhere
+    void invalidate();
+
+    // Begin a frame that draws into the 'renderwidth' x 'renderheight' pixels in the lower
+    // left corner of the view
+    void beginFrame(int renderwidth, int renderheight);
+
+    // Bind the last frame to 'unit' and 'unit' + 1, and set the uniforms of the frame
+    void apply(Shader& shader, GLuint unit = 8) const;
+
+    /* Set the uniforms of the draw 'id' of 'object', with the projection and model-view
+     * matrix 'PMV', and remember them for the next frame */
+    void setDraw(Shader& shader, size_t id, const void* object, const Mat4& PMV,
+                 bool reuse = true);
+
+    /* Copy this frame from the 'color' and 'depth' textures, where it is in the same
+     * corner as in the view, into the bound framebuffer(). Leaves the depth test, depth
+     * function, depth mask and polygon mode as they were. */
+    void store(GLuint color, GLuint depth);
+
+private:
+    struct Draw {
+        const void* object;  // Null for no draw
+        Mat4 PMV;
+        bool reuse;
+    };
+
+    int width_;
+    int height_;
+    int renderwidth_;    // Of this frame
+    int renderheight_;
+    int storedwidth_;    // Of the frame in the cache
+    int storedheight_;
+    bool valid_;         // If the cache holds the last frame
+    bool stored_;        // If store() ran in this frame
+    long long frame_;    // Frames begun, which picks the pixels to refresh
+    std::vector<Draw> draws_;          // Of this frame, by id
+    std::vector<Draw> storeddraws_;    // Of the last frame
+    GLuint framebuffer_;
+    GLuint color_;
+    GLuint depth_;
+    GLuint vao_;         // Empty VAO for the full screen triangle
+    Shader shader_;
+};
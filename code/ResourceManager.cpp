@@ -0,0 +1,277 @@
+/*
+ * Shared meshes, textures and shaders, loaded in the background and only once
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "ResourceManager.hpp"
+
+#include "MappedFile.hpp"
+#include "Shader.hpp"
+#include "Texture.hpp"
+#include "TriangleSoup.hpp"
+#include "Utilities.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+namespace {
+
+// Hash of the size and the contents of a mapped file
+uint64_t hashFile(const MappedFile& file) {
+    const uint64_t size = file.size();
+    return util::hashBytes(file.data(), file.size(), util::hashBytes(&size, sizeof(size)));
+}
+
+bool openFile(MappedFile& file, const std::string& filename) {
+    if (!file.open(filename)) {
+        std::cerr << "ResourceManager: could not open '" << filename << "'\n";
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+ResourceManager::ResourceManager(ThreadPool& pool) : pool_(pool), order_(0) {}
+
+ResourceManager::~ResourceManager() { finish(); }
+
+bool ResourceManager::readsAfter(const std::shared_ptr<Load>& a, const std::shared_ptr<Load>& b) {
+    return a->priority < b->priority || (a->priority == b->priority && a->order > b->order);
+}
+
+template <typename T>
+ResourceHandle<T> ResourceManager::request(Table<T>& table, const std::string& key, int priority,
+                                           std::function<bool(uint64_t&)> hash,
+                                           std::function<bool()> parse,
+                                           std::function<Step(T&, bool)> create) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::weak_ptr<ResourceEntry<T>>& known = table.bypath[key];
+    if (std::shared_ptr<ResourceEntry<T>> entry = known.lock()) {
+        return ResourceHandle<T>(entry);  // Loading or loaded already
+    }
+    auto entry = std::make_shared<ResourceEntry<T>>();
+    entry->path = key;
+    known = entry;
+
+    // What the job hands over to the render thread
+    struct Result {
+        bool ok = false;
+        uint64_t hash = 0;
+        std::shared_ptr<ResourceEntry<T>> same;  // An entry with the same contents
+    };
+    auto result = std::make_shared<Result>();
+
+    auto load = std::make_shared<Load>();
+    load->priority = priority;
+    load->order = order_++;
+    load->read = [this, &table, entry, result, hash, parse]() {
+        uint64_t contents = 0;
+        if (!hash(contents)) {
+            return;
+        }
+        result->hash = contents;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& same = table.byhash[contents];
+            same.erase(std::remove_if(same.begin(), same.end(),
+                                      [](const auto& other) { return other.expired(); }),
+                       same.end());
+            if (!same.empty()) {
+                result->same = same.front().lock();
+            }
+            same.push_back(entry);  // Its resource is shared as long as it is held
+        }
+        result->ok = result->same ? true : parse();
+    };
+    load->create = [this, &table, entry, result, create](bool wait) {
+        entry->hash = result->hash;
+        if (result->ok && result->same) {
+            if (result->same->state == ResourceEntry<T>::State::Loading) {
+                return false;
+            }
+            entry->resource = result->same->resource;
+            entry->state = result->same->state;
+            return true;
+        }
+        Step step = Step::Failed;
+        if (result->ok) {
+            if (!entry->resource) {
+                entry->resource = std::make_shared<T>();
+            }
+            step = create(*entry->resource, wait);
+            if (step == Step::Pending) {
+                return false;
+            }
+        }
+        if (step == Step::Done) {
+            entry->state = ResourceEntry<T>::State::Ready;
+            return true;
+        }
+        entry->state = ResourceEntry<T>::State::Failed;
+        entry->resource.reset();
+        std::lock_guard<std::mutex> lock(mutex_);
+        table.byhash.erase(result->hash);  // So that the next request tries again
+        return true;
+    };
+
+    queue_.push_back(load);
+    std::push_heap(queue_.begin(), queue_.end(), readsAfter);
+    loading_.push_back(load);
+    lock.unlock();
+    // A pool without workers would read the file right here, so update() reads it instead
+    if (pool_.size() > 1) {
+        pool_.run(jobs_, [this]() { readNext(); });
+    }
+    return ResourceHandle<T>(entry);
+}
+
+ResourceHandle<TriangleSoup> ResourceManager::requestMesh(const std::string& filename,
+                                                          int priority, bool weld) {
+    auto data = std::make_shared<TriangleSoup::MeshData>();
+    return request<TriangleSoup>(
+        meshes_, weld ? filename + " (welded)" : filename, priority,
+        [filename, weld](uint64_t& hash) {
+            MappedFile file;
+            if (!openFile(file, filename)) {
+                return false;
+            }
+            hash = util::hashBytes(&weld, sizeof(weld), hashFile(file));
+            return true;
+        },
+        [filename, weld, data]() { return TriangleSoup::parseOBJ(filename, *data, 0, weld); },
+        [data](TriangleSoup& mesh, bool) {
+            mesh.createFromData(std::move(*data));
+            return Step::Done;
+        });
+}
+
+ResourceHandle<Texture> ResourceManager::requestTexture(const std::string& filename,
+                                                        int priority) {
+    // The pixels of uncompressed files point into the mapping until they are uploaded
+    struct Image {
+        MappedFile file;
+        Texture::ImageData image;
+    };
+    auto image = std::make_shared<Image>();
+    return request<Texture>(
+        textures_, filename, priority,
+        [filename, image](uint64_t& hash) {
+            if (!openFile(image->file, filename)) {
+                return false;
+            }
+            hash = hashFile(image->file);
+            return true;
+        },
+        [this, filename, image]() {
+            image->image = Texture::loadImage(filename, image->file, nullptr, &pool_);
+            return image->image.pixels != nullptr || !image->image.levels.empty();
+        },
+        [filename, image](Texture& texture, bool) {
+            texture.image_ = std::move(image->image);
+            const bool ok = texture.uploadImage(filename);
+            image->file.close();
+            return ok ? Step::Done : Step::Failed;
+        });
+}
+
+ResourceHandle<Shader> ResourceManager::requestShader(const std::string& vertexshaderfile,
+                                                      const std::string& fragmentshaderfile,
+                                                      const std::string& defines, int priority) {
+    return requestShader(vertexshaderfile, std::string(), fragmentshaderfile, defines, priority);
+}
+
+ResourceHandle<Shader> ResourceManager::requestShader(const std::string& vertexshaderfile,
+                                                      const std::string& geometryshaderfile,
+                                                      const std::string& fragmentshaderfile,
+                                                      const std::string& defines, int priority) {
+    const std::string variant = Shader::variantKey(defines);
+    const std::string files = geometryshaderfile.empty()
+                                  ? vertexshaderfile + " " + fragmentshaderfile
+                                  : vertexshaderfile + " " + geometryshaderfile + " " +
+                                        fragmentshaderfile;
+    auto started = std::make_shared<bool>(false);
+    return request<Shader>(
+        shaders_, files + " [" + variant + "]", priority,
+        [vertexshaderfile, geometryshaderfile, fragmentshaderfile, variant](uint64_t& hash) {
+            MappedFile vertex, geometry, fragment;
+            if (!openFile(vertex, vertexshaderfile) || !openFile(fragment, fragmentshaderfile) ||
+                (!geometryshaderfile.empty() && !openFile(geometry, geometryshaderfile))) {
+                return false;
+            }
+            const uint64_t hashes[3] = {hashFile(vertex), hashFile(fragment),
+                                        geometryshaderfile.empty() ? 0 : hashFile(geometry)};
+            hash = util::hashBytes(variant.data(), variant.size(),
+                                   util::hashBytes(hashes, sizeof(hashes)));
+            return true;
+        },
+        []() { return true; },  // The driver compiles the shaders
+        [vertexshaderfile, geometryshaderfile, fragmentshaderfile, variant,
+         started](Shader& shader, bool wait) {
+            if (!*started) {
+                shader.beginCreateShader(vertexshaderfile, geometryshaderfile, fragmentshaderfile,
+                                         variant);
+                *started = true;
+            }
+            if (wait) {
+                shader.finish();
+            } else if (!shader.ready()) {
+                return Step::Pending;
+            }
+            GLint linked = GL_FALSE;
+            if (shader.id() != 0) {
+                glGetProgramiv(shader.id(), GL_LINK_STATUS, &linked);
+            }
+            return linked == GL_TRUE ? Step::Done : Step::Failed;  // Errors were printed
+        });
+}
+
+bool ResourceManager::readNext() {
+    Load* load = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.empty()) {
+            return false;
+        }
+        std::pop_heap(queue_.begin(), queue_.end(), readsAfter);
+        // loading_ keeps the load alive, so that it is always deleted on the render thread
+        load = queue_.back().get();
+        queue_.pop_back();
+    }
+    load->read();
+    load->readdone.store(true, std::memory_order_release);
+    return true;
+}
+
+void ResourceManager::createLoaded(bool wait) {
+    for (size_t i = 0; i < loading_.size();) {
+        Load& load = *loading_[i];
+        if (load.readdone.load(std::memory_order_acquire) && load.create(wait)) {
+            loading_.erase(loading_.begin() + static_cast<ptrdiff_t>(i));
+        } else {
+            i++;
+        }
+    }
+}
+
+void ResourceManager::update() {
+    if (pool_.size() < 2) {
+        readNext();
+    }
+    createLoaded(false);
+}
+
+void ResourceManager::finish() {
+    pool_.wait(jobs_);
+    while (readNext()) {
+    }
+    // A file with the same contents as another one is done in the pass after it
+    while (!loading_.empty()) {
+        createLoaded(true);
+    }
+}
+
+size_t ResourceManager::pendingCount() const { return loading_.size(); }
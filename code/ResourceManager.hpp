@@ -0,0 +1,178 @@
+/*
+ * Shared meshes, textures and shaders, loaded in the background and only once.
+ *
+ * Usage: Create one manager after the OpenGL context, request resources by file name with
+ *        requestMesh(), requestTexture() or requestShader(), and call update() once per
+ *        frame. A request returns a handle at once, which is ready() when the resource is
+ *        loaded. Until then, get() is nullptr.
+ *        The files are read and parsed by jobs on a ThreadPool, the OBJ parser and the
+ *        image loaders run on those threads, and update() creates the OpenGL objects on the
+ *        render thread. The jobs start the waiting requests with the highest priority
+ *        first, and requests of the same priority in order.
+ *        A request for a file that is loading, or loaded and still held by a handle, gets
+ *        a handle to the same resource. A file with the same contents as one that is
+ *        loading or loaded, found by the 64 bit FNV-1a hash and the size of the file, is
+ *        not parsed again either: its handle shares the other resource. The hash of a
+ *        shader covers its two files and the defines, not the files they include, and a
+ *        mesh is only shared at the same 'weld'.
+ *        A resource is deleted with its last handle, so release handles on the render
+ *        thread. A failed load gives a handle that is failed(), and a new request of the
+ *        file loads it again once all handles to the failed one are released.
+ *        Without worker threads in the pool, update() reads one file per call itself.
+ *        finish() waits for all loads, and the destructor calls it. Delete the manager
+ *        while the OpenGL context is current.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+class Shader;
+class Texture;
+class TriangleSoup;
+
+/* The state of a requested resource, shared by all of its handles */
+template <typename T>
+struct ResourceEntry {
+    enum class State { Loading, Ready, Failed };
+
+    std::string path;             // File name, or the files and defines of a shader
+    uint64_t hash = 0;            // Hash of the contents, 0 until they have been read
+    State state = State::Loading;
+    std::shared_ptr<T> resource;  // Shared by the entries of files with the same contents
+};
+
+/* A reference counted handle to a resource of a ResourceManager */
+template <typename T>
+class ResourceHandle {
+public:
+    using State = typename ResourceEntry<T>::State;
+
+    ResourceHandle() = default;
+
+    bool ready() const { return entry_ && entry_->state == State::Ready; }
+    bool failed() const { return entry_ && entry_->state == State::Failed; }
+    bool pending() const { return entry_ && entry_->state == State::Loading; }
+
+    // The resource when it is ready, otherwise nullptr
+    T* get() const { return ready() ? entry_->resource.get() : nullptr; }
+    T* operator->() const { return get(); }
+    T& operator*() const { return *get(); }
+    explicit operator bool() const { return ready(); }
+
+    const std::string& path() const { return entry_->path; }
+    uint64_t contentHash() const { return entry_ ? entry_->hash : 0; }
+
+    // True if both handles hold the same object, also for files with the same contents
+    bool shares(const ResourceHandle& other) const {
+        return get() != nullptr && get() == other.get();
+    }
+
+    // Release the resource, deleted with its last handle
+    void reset() { entry_.reset(); }
+
+private:
+    friend class ResourceManager;
+    explicit ResourceHandle(std::shared_ptr<ResourceEntry<T>> entry) : entry_(std::move(entry)) {}
+
+    std::shared_ptr<ResourceEntry<T>> entry_;
+};
+
+class ResourceManager {
+public:
+    /* Constructor: load with the jobs of 'pool' */
+    explicit ResourceManager(ThreadPool& pool = ThreadPool::global());
+
+    /* Destructor: finish all loads */
+    ~ResourceManager();
+
+    ResourceManager(const ResourceManager&) = delete;
+    ResourceManager& operator=(const ResourceManager&) = delete;
+
+    // A mesh from an OBJ file, read with TriangleSoup::parseOBJ()
+    ResourceHandle<TriangleSoup> requestMesh(const std::string& filename, int priority = 0,
+                                             bool weld = false);
+
+    // A texture from a TGA, DDS or KTX file
+    ResourceHandle<Texture> requestTexture(const std::string& filename, int priority = 0);
+
+    // A shader program, compiled with Shader::beginCreateShader() and polled in update()
+    ResourceHandle<Shader> requestShader(const std::string& vertexshaderfile,
+                                         const std::string& fragmentshaderfile,
+                                         const std::string& defines = std::string(),
+                                         int priority = 0);
+
+    // The same with a geometry shader, or none if 'geometryshaderfile' is empty
+    ResourceHandle<Shader> requestShader(const std::string& vertexshaderfile,
+                                         const std::string& geometryshaderfile,
+                                         const std::string& fragmentshaderfile,
+                                         const std::string& defines, int priority = 0);
+
+    // Create the OpenGL objects of the resources that have been read. Never waits.
+    void update();
+
+    // Wait for all loads and finish them
+    void finish();
+
+    // Requests that are not ready or failed yet
+    size_t pendingCount() const;
+
+private:
+    enum class Step { Pending, Done, Failed };
+
+    // A request on its way from the queue to the render thread
+    struct Load {
+        int priority;
+        uint64_t order;
+        std::function<void()> read;             // In a job: read, hash and parse the file
+        std::function<bool(bool wait)> create;  // In update(), after read: true when done
+        std::atomic<bool> readdone{false};
+    };
+
+    // The entries of one type of resource, by path, and all entries of the same contents,
+    // the first of them the one that loads them
+    template <typename T>
+    struct Table {
+        std::unordered_map<std::string, std::weak_ptr<ResourceEntry<T>>> bypath;
+        std::unordered_map<uint64_t, std::vector<std::weak_ptr<ResourceEntry<T>>>> byhash;
+    };
+
+    /* Find or start a request of 'key'. In a job, 'hash' hashes the contents and 'parse'
+     * does the work on the CPU, which is skipped if the contents are in 'table' already.
+     * Then 'create' makes the resource on the render thread, and returns Pending until it
+     * is finished. */
+    template <typename T>
+    ResourceHandle<T> request(Table<T>& table, const std::string& key, int priority,
+                              std::function<bool(uint64_t&)> hash, std::function<bool()> parse,
+                              std::function<Step(T&, bool)> create);
+
+    // Order of the heap: true if 'a' is read after 'b'
+    static bool readsAfter(const std::shared_ptr<Load>& a, const std::shared_ptr<Load>& b);
+
+    // Take the queued request with the highest priority and read it. False if there is none.
+    bool readNext();
+
+    // Finish the loads that have been read, and wait for shaders if 'wait' is true
+    void createLoaded(bool wait);
+
+    ThreadPool& pool_;
+    JobCounter jobs_;
+    mutable std::mutex mutex_;                  // For queue_ and the tables
+    std::vector<std::shared_ptr<Load>> queue_;  // Heap of the requests not read yet
+    std::vector<std::shared_ptr<Load>> loading_;  // All unfinished requests, in order
+    uint64_t order_;
+    Table<TriangleSoup> meshes_;
+    Table<Texture> textures_;
+    Table<Shader> shaders_;
+};
@@ -12,22 +12,101 @@
 #include "Rotator.hpp"
 
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <cmath>
+#include <unordered_map>
+
+#include "Mat4.hpp"
+
+namespace {
+
+// The rotator listening to each window, for the callbacks
+std::unordered_map<GLFWwindow*, KeyRotator*> keyRotators;
+std::unordered_map<GLFWwindow*, MouseRotator*> mouseRotators;
+
+// The keys of KeyRotator, in the order of held_
+const int rotatorKeys[4] = {GLFW_KEY_RIGHT, GLFW_KEY_LEFT, GLFW_KEY_UP, GLFW_KEY_DOWN};
+
+}  // namespace
 
 KeyRotator::KeyRotator(GLFWwindow* window)
-    : window_(window), phi_(0.0), theta_(0.0), lastTime_(glfwGetTime()) {}
+    : window_(window), phi_(0.0), theta_(0.0), held_{false, false, false, false},
+      since_{0.0, 0.0, 0.0, 0.0}, changed_(false), firstEvent_(-1.0), inputTime_(-1.0) {
+    const auto found = keyRotators.find(window);
+    if (found != keyRotators.end() && found->second) {
+        // Take the place of the rotator of the window until this one is destroyed. The
+        // callback is installed already, and chains to what was there before the first one.
+        previous_ = found->second;
+        previousKey_ = previous_->previousKey_;
+        found->second = this;
+        return;
+    }
+    previous_ = nullptr;
+    keyRotators[window] = this;
+    previousKey_ = glfwSetKeyCallback(window, keyCallback);
+}
 
-void KeyRotator::poll() {
-    const double currentTime = glfwGetTime();
-    const double elapsedTime = currentTime - lastTime_;
-    lastTime_ = currentTime;
+KeyRotator::~KeyRotator() {
+    const auto found = keyRotators.find(window_);
+    if (found == keyRotators.end() || !found->second) {
+        return;
+    }
+    if (found->second != this) {
+        // Replaced: leave the rotators that replaced this one listening
+        for (KeyRotator* rotator = found->second; rotator; rotator = rotator->previous_) {
+            if (rotator->previous_ == this) {
+                rotator->previous_ = previous_;
+                break;
+            }
+        }
+        return;
+    }
+    if (previous_) {
+        found->second = previous_;  // Which listens again, through the same callback
+        return;
+    }
+    keyRotators.erase(found);
+    glfwSetKeyCallback(window_, previousKey_);
+}
+
+void KeyRotator::keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    const auto found = keyRotators.find(window);
+    if (found == keyRotators.end() || !found->second) {
+        return;
+    }
+    KeyRotator* rotator = found->second;
+    if (rotator->previousKey_) {
+        rotator->previousKey_(window, key, scancode, action, mods);
+    }
+    for (int k = 0; k < 4; k++) {
+        if (key != rotatorKeys[k] || action == GLFW_REPEAT) {
+            continue;
+        }
+        const double time = glfwGetTime();
+        if (action == GLFW_PRESS) {
+            rotator->held_[k] = true;
+            rotator->since_[k] = time;
+        } else if (rotator->held_[k]) {
+            rotator->integrate(k, time);  // Up to the release, not to the next poll()
+            rotator->held_[k] = false;
+        }
+        rotator->changed_ = true;
+        if (rotator->firstEvent_ < 0.0) {
+            rotator->firstEvent_ = time;
+        }
+    }
+}
 
-    if (glfwGetKey(window_, GLFW_KEY_RIGHT)) {
+void KeyRotator::integrate(int k, double time) {
+    const double elapsedTime = time - since_[k];
+    since_[k] = time;
+
+    if (k == 0) {
         phi_ += elapsedTime * M_PI / 2.0;  // Rotate 90 degrees per second (pi/2)
         phi_ = fmod(phi_, M_PI * 2.0);     // Wrap around at 360 degrees (2*pi)
     }
 
-    if (glfwGetKey(window_, GLFW_KEY_LEFT)) {
+    if (k == 1) {
         phi_ -= elapsedTime * M_PI / 2.0;  // Rotate 90 degrees per second (pi/2)
         phi_ = fmod(phi_, M_PI * 2.0);
         if (phi_ < 0.0) {
@@ -35,14 +114,14 @@ void KeyRotator::poll() {
         }
     }
 
-    if (glfwGetKey(window_, GLFW_KEY_UP)) {
+    if (k == 2) {
         theta_ += elapsedTime * M_PI / 2.0;  // Rotate 90 degrees per second
         if (theta_ >= M_PI / 2.0) {
             theta_ = M_PI / 2.0;  // Clamp at 90
         }
     }
 
-    if (glfwGetKey(window_, GLFW_KEY_DOWN)) {
+    if (k == 3) {
         theta_ -= elapsedTime * M_PI / 2.0;  // Rotate 90 degrees per second
         if (theta_ < -M_PI / 2.0) {
             theta_ = -M_PI / 2.0;  // Clamp at -90
@@ -50,25 +129,122 @@ void KeyRotator::poll() {
     }
 }
 
+bool KeyRotator::poll() {
+    const bool changed = hasInput();
+    // Keys that are still held rotate up to now, just before the frame is submitted
+    const double currentTime = glfwGetTime();
+    for (int k = 0; k < 4; k++) {
+        if (held_[k]) {
+            integrate(k, currentTime);
+        }
+    }
+    inputTime_ = firstEvent_;
+    firstEvent_ = -1.0;
+    changed_ = false;
+    return changed;
+}
+
+bool KeyRotator::hasInput() const {
+    return changed_ || held_[0] || held_[1] || held_[2] || held_[3];
+}
+
+double KeyRotator::inputTime() const { return inputTime_; }
+
 double KeyRotator::phi() const { return phi_; }
 
 double KeyRotator::theta() const { return theta_; }
 
 MouseRotator::MouseRotator(GLFWwindow* window)
-    : window_(window), phi_(0.0), theta_(0.0), leftPressed_(false), rightPressed_(false) {
+    : window_(window), phi_(0.0), theta_(0.0), leftPressed_(false), rightPressed_(false),
+      raw_(false), changed_(false), firstEvent_(-1.0), inputTime_(-1.0) {
     glfwGetCursorPos(window, &lastX_, &lastY_);
+    rayX_ = lastX_;
+    rayY_ = lastY_;
+    const auto found = mouseRotators.find(window);
+    if (found != mouseRotators.end() && found->second) {
+        // As for KeyRotator: take the place of the rotator of the window, with its callbacks
+        previous_ = found->second;
+        previousCursor_ = previous_->previousCursor_;
+        previousButton_ = previous_->previousButton_;
+        found->second = this;
+        return;
+    }
+    previous_ = nullptr;
+    mouseRotators[window] = this;
+    previousCursor_ = glfwSetCursorPosCallback(window, cursorCallback);
+    previousButton_ = glfwSetMouseButtonCallback(window, buttonCallback);
 }
 
-void MouseRotator::poll() {
-    // Find out where the mouse pointer is, and which buttons are pressed
-    double currentX;
-    double currentY;
-    glfwGetCursorPos(window_, &currentX, &currentY);
+MouseRotator::~MouseRotator() {
+    const auto found = mouseRotators.find(window_);
+    if (found == mouseRotators.end() || !found->second) {
+        return;
+    }
+    if (raw_) {  // Destroyed during a drag
+        glfwSetInputMode(window_, GLFW_RAW_MOUSE_MOTION, GLFW_FALSE);
+        glfwSetInputMode(window_, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+    }
+    if (found->second != this) {
+        for (MouseRotator* rotator = found->second; rotator; rotator = rotator->previous_) {
+            if (rotator->previous_ == this) {
+                rotator->previous_ = previous_;
+                break;
+            }
+        }
+        return;
+    }
+    if (previous_) {
+        found->second = previous_;
+        return;
+    }
+    mouseRotators.erase(found);
+    glfwSetCursorPosCallback(window_, previousCursor_);
+    glfwSetMouseButtonCallback(window_, previousButton_);
+}
 
-    bool currentLeft = glfwGetMouseButton(window_, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
-    bool currentRight = glfwGetMouseButton(window_, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+void MouseRotator::cursorCallback(GLFWwindow* window, double x, double y) {
+    const auto found = mouseRotators.find(window);
+    if (found == mouseRotators.end() || !found->second) {
+        return;
+    }
+    MouseRotator* rotator = found->second;
+    if (rotator->previousCursor_) {
+        rotator->previousCursor_(window, x, y);
+    }
+    rotator->move(x, y);
+}
+
+void MouseRotator::buttonCallback(GLFWwindow* window, int button, int action, int mods) {
+    const auto found = mouseRotators.find(window);
+    if (found == mouseRotators.end() || !found->second) {
+        return;
+    }
+    MouseRotator* rotator = found->second;
+    if (rotator->previousButton_) {
+        rotator->previousButton_(window, button, action, mods);
+    }
+    if (button == GLFW_MOUSE_BUTTON_RIGHT) {
+        rotator->rightPressed_ = (action == GLFW_PRESS);
+    }
+    if (button != GLFW_MOUSE_BUTTON_LEFT) {
+        return;
+    }
+    rotator->leftPressed_ = (action == GLFW_PRESS);
+    // Raw motion only works with a hidden cursor; GLFW puts the cursor back afterwards
+    if (rotator->leftPressed_ && glfwRawMouseMotionSupported()) {
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+        rotator->raw_ = true;
+    } else if (!rotator->leftPressed_ && rotator->raw_) {
+        glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_FALSE);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+        rotator->raw_ = false;
+    }
+    glfwGetCursorPos(window, &rotator->lastX_, &rotator->lastY_);
+}
 
-    if (currentLeft && leftPressed_) {  // If a left button drag is in progress
+void MouseRotator::move(double currentX, double currentY) {
+    if (leftPressed_) {  // If a left button drag is in progress
         int windowWidth;
         int windowHeight;
         glfwGetWindowSize(window_, &windowWidth, &windowHeight);
@@ -90,14 +266,53 @@ void MouseRotator::poll() {
         if (theta_ < -M_PI / 2.0) {
             theta_ = -M_PI / 2.0;  // Clamp at 90
         }
+        changed_ = true;
+        if (firstEvent_ < 0.0) {
+            firstEvent_ = glfwGetTime();
+        }
     }
-
-    leftPressed_ = currentLeft;
-    rightPressed_ = currentRight;
     lastX_ = currentX;
     lastY_ = currentY;
 }
 
+bool MouseRotator::poll() {
+    const bool changed = changed_;
+    if (!raw_) {
+        rayX_ = lastX_;  // While dragging with raw motion, the cursor position is virtual
+        rayY_ = lastY_;
+    }
+    inputTime_ = firstEvent_;
+    firstEvent_ = -1.0;
+    changed_ = false;
+    return changed;
+}
+
+bool MouseRotator::hasInput() const { return changed_; }
+
+double MouseRotator::inputTime() const { return inputTime_; }
+
 double MouseRotator::phi() const { return phi_; }
 
 double MouseRotator::theta() const { return theta_; }
+
+void MouseRotator::cursorRay(const Mat4& P, float origin[3], float direction[3]) const {
+    int windowWidth;
+    int windowHeight;
+    glfwGetWindowSize(window_, &windowWidth, &windowHeight);
+    // Normalized device coordinates of the cursor, with y up
+    const float x = static_cast<float>(2.0 * rayX_ / std::max(windowWidth, 1) - 1.0);
+    const float y = static_cast<float>(1.0 - 2.0 * rayY_ / std::max(windowHeight, 1));
+    // The point at z = -1 that P projects to (x, y), also for off-center projections
+    origin[0] = origin[1] = origin[2] = 0.0f;
+    direction[0] = (x + P[8]) / P[0];
+    direction[1] = (y + P[9]) / P[5];
+    direction[2] = -1.0f;
+}
+
+double MouseRotator::cursorX() const { return rayX_; }
+
+double MouseRotator::cursorY() const { return rayY_; }
+
+const PickResult& MouseRotator::picked() const { return picked_; }
+
+void MouseRotator::setPicked(const PickResult& pick) { picked_ = pick; }
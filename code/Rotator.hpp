@@ -2,45 +2,121 @@
  * Two classes to perform viewport rotations on mouse and keyboard input with
  * GLFW
  *
- * Usage: call init() before the rendering loop, call poll() once per frame,
+ * Usage: create the rotators after the window, call poll() once per frame,
  * read public members phi and theta to construct a rotation matrix.
  * The suggested composite rotation matrix is RotX(theta)*RotY(phi).
+ * MouseRotator::cursorRay() gives the ray under the cursor, for picking with BVH::pick().
+ * MouseRotator::picked() is what a PickBuffer found under the cursor, handed over with
+ * setPicked(), a frame or more after the cursor was there.
+ * poll() returns true if the rotation changed, or may change before the next poll() because
+ * a key is held, so a loop that only draws when something changed knows when to draw.
+ * The input arrives through GLFW callbacks, which the rotators chain to the callbacks that
+ * were set before them, and which get a time stamp from glfwGetTime() when the events are
+ * processed. Every mouse movement and every key press and release is used, also when there
+ * are several between two frames, so short drags and taps are not lost. Mouse drags use raw
+ * mouse motion, without the system's pointer acceleration, where GLFW supports it. Call
+ * poll() just before the frame is submitted, and hasInput() earlier to decide whether to
+ * draw. inputTime() is the time of the oldest event that the last poll() used, for
+ * FrameProfiler::measureLatency().
+ * Only one rotator of each kind listens to a window at a time: a new one takes the place of
+ * the one before it, which listens again when the new one is destroyed.
  *
  * Authors: Stefan Gustavson (stegu@itn.liu.se) 2013-2015
  *          Martin Falk (martin.falk@liu.se) 2021
  */
 #pragma once
 
+#include "PickBuffer.hpp"
+
 struct GLFWwindow;
+struct Mat4;
 
 class KeyRotator {
 public:
     KeyRotator(GLFWwindow* window);
 
-    void poll();
+    // Hand the window back to the rotator this one replaced, or remove the callback and put
+    // the previous one back
+    ~KeyRotator();
+
+    KeyRotator(const KeyRotator&) = delete;
+    KeyRotator& operator=(const KeyRotator&) = delete;
+
+    bool poll();
+
+    // True if poll() would change the rotation
+    bool hasInput() const;
+
+    // Time of the oldest key event used by the last poll(), or -1 if there was none
+    double inputTime() const;
 
     double phi() const;
     double theta() const;
 
 private:
+    // Rotate for the time the key 'k' was held from since_[k] until 'time'
+    void integrate(int k, double time);
+
+    static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods);
+
     GLFWwindow* window_;
+    KeyRotator* previous_;  // The rotator of the window that this one replaced, or null
+    void (*previousKey_)(GLFWwindow*, int, int, int, int);
 
     double phi_;
     double theta_;
-    double lastTime_;
+    bool held_[4];      // Right, left, up and down
+    double since_[4];   // Time the rotation of each held key was integrated to
+    bool changed_;      // Key events since the last poll()
+    double firstEvent_;  // Time of the first of them, or -1
+    double inputTime_;
 };
 
 class MouseRotator {
 public:
     MouseRotator(GLFWwindow* window);
 
-    void poll();
+    // Hand the window back to the rotator this one replaced, or remove the callbacks and put
+    // the previous ones back
+    ~MouseRotator();
+
+    MouseRotator(const MouseRotator&) = delete;
+    MouseRotator& operator=(const MouseRotator&) = delete;
+
+    bool poll();
+
+    // True if poll() would change the rotation
+    bool hasInput() const;
+
+    // Time of the oldest drag movement used by the last poll(), or -1 if there was none
+    double inputTime() const;
 
     double phi() const;
     double theta() const;
 
+    // The ray through the cursor position of the last poll(), in view coordinates for the
+    // perspective projection P: from the eye at 'origin' along 'direction' (not unit length)
+    void cursorRay(const Mat4& P, float origin[3], float direction[3]) const;
+
+    // The cursor position of the last poll(), in window coordinates
+    double cursorX() const;
+    double cursorY() const;
+
+    // The object under the cursor, as the last readback of a PickBuffer found it
+    const PickResult& picked() const;
+    void setPicked(const PickResult& pick);
+
 private:
+    // Rotate for a cursor movement from the last position to (x, y)
+    void move(double x, double y);
+
+    static void cursorCallback(GLFWwindow* window, double x, double y);
+    static void buttonCallback(GLFWwindow* window, int button, int action, int mods);
+
     GLFWwindow* window_;
+    MouseRotator* previous_;  // The rotator of the window that this one replaced, or null
+    void (*previousCursor_)(GLFWwindow*, double, double);
+    void (*previousButton_)(GLFWwindow*, int, int, int);
 
     double phi_;
     double theta_;
@@ -49,4 +125,11 @@ private:
     double lastY_;
     bool leftPressed_;
     bool rightPressed_;
+    bool raw_;           // Raw mouse motion is on, during a drag
+    bool changed_;       // The rotation changed since the last poll()
+    double firstEvent_;  // Time of the first movement since the last poll(), or -1
+    double inputTime_;
+    double rayX_;        // Cursor position at the last poll(), for cursorRay()
+    double rayY_;
+    PickResult picked_;
 };
@@ -0,0 +1,246 @@
+/*
+ * A scene graph in flat arrays with incremental updates of the world matrices
+ *
+ * This code is in the public domain.
+ */
+#include "SceneGraph.hpp"
+
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Nodes of one level that one thread updates at a time
+constexpr int chunkSize = 1024;
+
+// The bounds of 'local' transformed by the affine matrix 'm': the box around the transformed
+// box (Arvo, "Transforming Axis-Aligned Bounding Boxes", 1990), and the sphere scaled by
+// the largest scaling of the matrix
+void transformBounds(const Mat4& m, const mesh::Bounds& local, mesh::Bounds& world) {
+    for (int r = 0; r < 3; r++) {
+        world.min[r] = m[12 + r];
+        world.max[r] = m[12 + r];
+        world.center[r] = m[12 + r];
+        for (int c = 0; c < 3; c++) {
+            const float a = m[4 * c + r] * local.min[c];
+            const float b = m[4 * c + r] * local.max[c];
+            world.min[r] += std::min(a, b);
+            world.max[r] += std::max(a, b);
+            world.center[r] += m[4 * c + r] * local.center[c];
+        }
+    }
+    float scale = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        scale = std::max(scale, m[4 * c] * m[4 * c] + m[4 * c + 1] * m[4 * c + 1] +
+                                    m[4 * c + 2] * m[4 * c + 2]);
+    }
+    world.radius = local.radius * std::sqrt(scale);
+}
+
+// Reorder 'values' so that the value at position i moves to position[i]
+template <typename T>
+void permute(std::vector<T>& values, const std::vector<int>& position) {
+    std::vector<T> sorted(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        sorted[position[i]] = std::move(values[i]);
+    }
+    values.swap(sorted);
+}
+
+}  // namespace
+
+SceneGraph::SceneGraph() : levels_{0}, sorted_(true), updated_(0) {}
+
+SceneGraph::Node SceneGraph::add(Node parent) {
+    const int position = size();
+    const int parentposition = (parent == none) ? none : positions_[parent];
+    const int depth = (parent == none) ? 0 : depths_[parentposition] + 1;
+    // A node at most one level deeper than the last one keeps the order, so only a new
+    // root or the child of a node above the last level needs a sort
+    if (sorted_ && position > 0 && depth < depths_.back()) {
+        sorted_ = false;
+    }
+    if (sorted_) {
+        if (depth == static_cast<int>(levels_.size()) - 1) {
+            levels_.push_back(position + 1);
+        } else {
+            levels_.back() = position + 1;
+        }
+    }
+    parents_.push_back(parentposition);
+    depths_.push_back(depth);
+    local_.resize(position + 1);
+    world_.push_back(Mat4::identity());
+    bounds_.emplace_back();
+    worldbounds_.emplace_back();
+    hasbounds_.push_back(0);
+    dirty_.push_back(1);
+    const Node node = static_cast<Node>(positions_.size());
+    nodes_.push_back(node);
+    positions_.push_back(position);
+    return node;
+}
+
+void SceneGraph::clear() {
+    parents_.clear();
+    depths_.clear();
+    local_.resize(0);
+    world_.clear();
+    bounds_.clear();
+    worldbounds_.clear();
+    hasbounds_.clear();
+    dirty_.clear();
+    levels_.assign(1, 0);
+    nodes_.clear();
+    positions_.clear();
+    sorted_ = true;
+    updated_ = 0;
+}
+
+int SceneGraph::size() const { return static_cast<int>(parents_.size()); }
+
+SceneGraph::Node SceneGraph::parent(Node node) const {
+    const int parent = parents_[positions_[node]];
+    return (parent == none) ? none : nodes_[parent];
+}
+
+void SceneGraph::markDirty(Node node) { dirty_[positions_[node]] = 1; }
+
+void SceneGraph::setTranslation(Node node, float x, float y, float z) {
+    const int i = positions_[node];
+    local_.tx[i] = x;
+    local_.ty[i] = y;
+    local_.tz[i] = z;
+    markDirty(node);
+}
+
+void SceneGraph::setRotation(Node node, float rx, float ry, float rz) {
+    local_.setRotation(positions_[node], rx, ry, rz);
+    markDirty(node);
+}
+
+void SceneGraph::setRotation(Node node, float x, float y, float z, float w) {
+    const int i = positions_[node];
+    local_.qx[i] = x;
+    local_.qy[i] = y;
+    local_.qz[i] = z;
+    local_.qw[i] = w;
+    markDirty(node);
+}
+
+void SceneGraph::setScale(Node node, float s) {
+    const int i = positions_[node];
+    local_.sx[i] = s;
+    local_.sy[i] = s;
+    local_.sz[i] = s;
+    markDirty(node);
+}
+
+void SceneGraph::setBounds(Node node, const mesh::Bounds& bounds) {
+    const int i = positions_[node];
+    bounds_[i] = bounds;
+    hasbounds_[i] = 1;
+    markDirty(node);
+}
+
+bool SceneGraph::hasBounds(Node node) const { return hasbounds_[positions_[node]] != 0; }
+
+const Mat4& SceneGraph::world(Node node) const { return world_[positions_[node]]; }
+
+const mesh::Bounds& SceneGraph::worldBounds(Node node) const {
+    return worldbounds_[positions_[node]];
+}
+
+int SceneGraph::updatedCount() const { return updated_; }
+
+void SceneGraph::sortByDepth() {
+    // A counting sort, which keeps the order of the nodes of each depth
+    const int count = size();
+    const int maxdepth = count > 0 ? *std::max_element(depths_.begin(), depths_.end()) : -1;
+    levels_.assign(size_t(maxdepth) + 2, 0);
+    for (int depth : depths_) {
+        levels_[depth + 1]++;
+    }
+    for (size_t d = 1; d < levels_.size(); d++) {
+        levels_[d] += levels_[d - 1];
+    }
+    std::vector<int> next(levels_.begin(), levels_.end() - 1);
+    std::vector<int> position(count);
+    for (int i = 0; i < count; i++) {
+        position[i] = next[depths_[i]]++;
+    }
+
+    for (int& parent : parents_) {
+        parent = (parent == none) ? none : position[parent];
+    }
+    permute(parents_, position);
+    permute(depths_, position);
+    for (std::vector<float>* a : {&local_.tx, &local_.ty, &local_.tz, &local_.qx, &local_.qy,
+                                  &local_.qz, &local_.qw, &local_.sx, &local_.sy, &local_.sz}) {
+        permute(*a, position);
+    }
+    permute(world_, position);
+    permute(bounds_, position);
+    permute(worldbounds_, position);
+    permute(hasbounds_, position);
+    permute(dirty_, position);
+    permute(nodes_, position);
+    for (int i = 0; i < count; i++) {
+        positions_[nodes_[i]] = i;
+    }
+    sorted_ = true;
+}
+
+void SceneGraph::updateRange(int begin, int end) {
+    float* matrices = reinterpret_cast<float*>(world_.data());
+    for (int i = begin; i < end;) {
+        // A node below a dirty node is dirty too, and its parent is one level up, done
+        const int parent = parents_[i];
+        const bool parentdirty = parent != none && dirty_[parent];
+        dirty_[i] |= parentdirty ? 1 : 0;
+        if (!dirty_[i]) {
+            i++;
+            continue;
+        }
+        // The dirty siblings after it are composed together
+        int last = i + 1;
+        while (last < end && parents_[last] == parent && (dirty_[last] || parentdirty)) {
+            dirty_[last] = 1;
+            last++;
+        }
+        composeTransforms(parent == none ? Mat4::identity() : world_[parent], local_, i, last,
+                          matrices);
+        for (int k = i; k < last; k++) {
+            if (hasbounds_[k]) {
+                transformBounds(world_[k], bounds_[k], worldbounds_[k]);
+            }
+        }
+        i = last;
+    }
+}
+
+void SceneGraph::update(ThreadPool* pool) {
+    if (!sorted_) {
+        sortByDepth();
+    }
+    for (size_t level = 0; level + 1 < levels_.size(); level++) {
+        const int begin = levels_[level];
+        const int end = levels_[level + 1];
+        if (pool != nullptr && end - begin > chunkSize) {
+            const int chunks = (end - begin + chunkSize - 1) / chunkSize;
+            pool->parallelFor(chunks, [this, begin, end](int chunk) {
+                updateRange(begin + chunk * chunkSize,
+                            std::min(begin + (chunk + 1) * chunkSize, end));
+            });
+        } else {
+            updateRange(begin, end);
+        }
+    }
+    updated_ = 0;
+    for (uint8_t& dirty : dirty_) {
+        updated_ += dirty;
+        dirty = 0;
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ * A scene graph of nodes with a translation, rotation and scaling relative to their parent,
+ * stored as flat arrays sorted by depth in the tree.
+ *
+ * Usage: add() the nodes, each under a parent that is already there or as a root, and set
+ *        their transformations with the set functions, which mark them dirty. Give the nodes
+ *        that are drawn the bounds of their mesh with setBounds(). update() computes the
+ *        world matrix, the parent's world matrix times translation * rotation * scaling,
+ *        and the bounds in world space, of the dirty nodes and all nodes below them, and
+ *        nothing else. world() and worldBounds() then give the results until the next
+ *        update(). With a view matrix in the roots, the world space is the view space.
+ *        The nodes are kept in the order of their depth, the roots first, so every parent
+ *        comes before its children and update() is one sweep through the arrays that
+ *        reads the parents' results from the level before. The local transformations are
+ *        a TransformArrays, and the dirty siblings that are next to each other are
+ *        composed together, four at a time with SSE. A ThreadPool splits each level that
+ *        has many nodes between its threads.
+ *        A Node is the index that add() returns, which stays the same when a new root or
+ *        the child of a deeper node sorts the arrays again, at the next update().
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Mat4.hpp"
+#include "MeshProcessing.hpp"
+#include "TransformArrays.hpp"
+
+class ThreadPool;
+
+class SceneGraph {
+public:
+    using Node = int;
+    static constexpr Node none = -1;
+
+    SceneGraph();
+
+    // Add a node with the identity transformation under 'parent', or as a root
+    Node add(Node parent = none);
+
+    // Remove all nodes
+    void clear();
+
+    int size() const;
+    Node parent(Node node) const;
+
+    void setTranslation(Node node, float x, float y, float z);
+    // Euler angles, in the order of Mat4::trs()
+    void setRotation(Node node, float rx, float ry, float rz);
+    // A unit quaternion (x, y, z, w)
+    void setRotation(Node node, float x, float y, float z, float w);
+    void setScale(Node node, float s);
+
+    // The bounds of what the node draws, in its own coordinates
+    void setBounds(Node node, const mesh::Bounds& bounds);
+    bool hasBounds(Node node) const;
+
+    /* Compute the world matrices and bounds of the dirty nodes and of the nodes below
+     * them, on the threads of 'pool' if it is not null */
+    void update(ThreadPool* pool = nullptr);
+
+    // The results of the last update()
+    const Mat4& world(Node node) const;
+    const mesh::Bounds& worldBounds(Node node) const;
+
+    // Nodes whose world matrix the last update() computed
+    int updatedCount() const;
+
+private:
+    void markDirty(Node node);
+    void sortByDepth();
+    void updateRange(int begin, int end);
+
+    // By position in the sorted arrays
+    std::vector<int> parents_;            // Position of the parent, or none
+    std::vector<int> depths_;
+    TransformArrays local_;
+    std::vector<Mat4> world_;
+    std::vector<mesh::Bounds> bounds_;    // Local, and in world space
+    std::vector<mesh::Bounds> worldbounds_;
+    std::vector<uint8_t> hasbounds_;
+    std::vector<uint8_t> dirty_;
+    std::vector<int> levels_;             // First position of each depth, and the end
+    std::vector<Node> nodes_;             // The Node at each position
+    std::vector<int> positions_;          // The position of each Node
+    bool sorted_;
+    int updated_;
+};
@@ -10,59 +10,207 @@
 #include <GLFW/glfw3.h>
 
 #include "Shader.hpp"
+#include "Arena.hpp"
+#include "FileWatcher.hpp"
+#include "GLDebug.hpp"
+#include "GLState.hpp"
+#include "MappedFile.hpp"
+#include "Trace.hpp"
+#include "UniformBuffers.hpp"
+#include "Utilities.hpp"
+#include "VirtualFiles.hpp"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <fstream>
+#include <string_view>
+#include <utility>
+#include <vector>
 
-Shader::Shader() : programID_(0) {}
+Shader::Shader()
+    : programID_(0), pendingprogram_(0), pendingshaders_{}, pendingcount_(0), key_(0),
+      sourcetypes_{}, sourcecount_(0), watcher_(nullptr) {}
 
-Shader::Shader(const std::string& vertexshaderfile, const std::string& fragmentshaderfile) {
+Shader::Shader(const std::string& vertexshaderfile, const std::string& fragmentshaderfile)
+    : Shader() {
     createShader(vertexshaderfile, fragmentshaderfile);
 }
 
 Shader::~Shader() {
+    discardPending();
     if (programID_ != 0) {
-        glDeleteProgram(programID_);  // free program resources
+        glstate::deleteProgram(programID_);  // free program resources
     }
 }
 
+Shader::Shader(Shader&& other) noexcept : Shader() { *this = std::move(other); }
+
+// Delete the programs of this object and take the ones of 'other', with all that is needed to
+// finish and reload them
+Shader& Shader::operator=(Shader&& other) noexcept {
+    if (this == &other) {
+        return *this;
+    }
+    discardPending();
+    if (programID_ != 0) {
+        glstate::deleteProgram(programID_);
+    }
+    programID_ = std::exchange(other.programID_, 0);
+    uniforms_ = std::move(other.uniforms_);
+    uniformindex_ = std::move(other.uniformindex_);
+    pendingprogram_ = std::exchange(other.pendingprogram_, 0);
+    for (int i = 0; i < maxStages; i++) {
+        pendingshaders_[i] = std::exchange(other.pendingshaders_[i], 0);
+        pendingfiles_[i] = std::move(other.pendingfiles_[i]);
+        sourcefiles_[i] = std::move(other.sourcefiles_[i]);
+        sourcetypes_[i] = other.sourcetypes_[i];
+    }
+    pendingcount_ = std::exchange(other.pendingcount_, 0);
+    binaryfile_ = std::move(other.binaryfile_);
+    key_ = other.key_;
+    sourcecount_ = std::exchange(other.sourcecount_, 0);
+    defines_ = std::move(other.defines_);
+    varyings_ = std::move(other.varyings_);
+    dependencies_ = std::move(other.dependencies_);
+    watcher_ = std::exchange(other.watcher_, nullptr);
+    other.uniforms_.clear();
+    other.uniformindex_.clear();
+    other.varyings_.clear();
+    other.dependencies_.clear();
+    return *this;
+}
+
 GLuint Shader::id() const { return programID_; }
 
-std::string readFile(const std::string& filename) {
-    std::ifstream in(filename.c_str());
-    if (!in.is_open()) {
+// Read a whole file into 'arena', followed by a null that is part of the view. An empty view
+// if the file cannot be read. The file is mapped, so it may also be a name of the virtual file
+// system, like a URL.
+std::string_view readFile(const std::string& filename, Arena& arena) {
+    MappedFile file;
+    if (!file.open(filename)) {
         std::cerr << "Error: Could not open shader file '" << filename << "'\n";
         return {};
     }
 
-    // determine length of file
-    in.seekg(0, std::ios_base::end);
-    size_t fileLength = in.tellg();
-    in.seekg(0);  // reset file stream
+    char* buffer = arena.allocate<char>(file.size() + 1);
+    std::copy_n(file.data(), file.size(), buffer);
+    buffer[file.size()] = '\0';  // make sure the string is null terminated
+    return std::string_view(buffer, file.size() + 1);
+}
+
+namespace {
 
-    std::string buffer;
-    buffer.resize(fileLength + 1);
-    in.read(buffer.data(), fileLength);
-    if (in.bad()) {
-        std::cerr << "Error: Could not read shader file '" << filename << "'\n";
+// Append 'source' to 'output' with every #include "file" line replaced by that file, found
+// relative to 'filename'. A file is included only once. #version lines of included files
+// are dropped, and #line directives keep the line numbers of each file in compile errors.
+bool expandIncludes(std::string_view source, const std::string& filename, int line,
+                    std::vector<std::string>& included, std::string& output, Arena& arena) {
+    const std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+    size_t start = 0;
+    while (start < source.size()) {
+        size_t end = source.find('\n', start);
+        if (end == std::string::npos) {
+            end = source.size();
+        }
+        const std::string_view text = source.substr(start, end - start);
+        const size_t first = text.find_first_not_of(" \t");
+        start = end + 1;
+        line++;
+
+        if (first != std::string::npos && text.compare(first, 8, "#include") == 0) {
+            const size_t open = text.find('"', first);
+            const size_t close = (open == std::string::npos) ? open : text.find('"', open + 1);
+            if (close == std::string::npos) {
+                std::cerr << "Shader include error ('" << filename << "'): " << text << "\n";
+                return false;
+            }
+            const std::string includefile =
+                directory + std::string(text.substr(open + 1, close - open - 1));
+            if (std::find(included.begin(), included.end(), includefile) == included.end()) {
+                included.push_back(includefile);
+                std::string_view includesource = readFile(includefile, arena);
+                if (includesource.empty()) {
+                    return false;
+                }
+                includesource.remove_suffix(1);  // The null added by readFile()
+                output += "#line 1\n";
+                if (!expandIncludes(includesource, includefile, 1, included, output, arena)) {
+                    return false;
+                }
+                output += "#line " + std::to_string(line) + "\n";
+            } else {
+                output += "\n";
+            }
+        } else if (first != std::string::npos && text.compare(first, 8, "#version") == 0 &&
+                   !included.empty() && filename != included.front()) {
+            output += "\n";
+        } else {
+            output.append(text.data(), text.size());
+            output += "\n";
+        }
+    }
+    return true;
+}
+
+// The source of a shader file with its includes, and a #define after the #version line
+// for each name or name=value in 'defines'. The files read are added to 'dependencies'.
+// The files are read into 'arena'.
+std::string preprocessShader(const std::string& filename, const std::string& defines,
+                             std::vector<std::string>& dependencies, Arena& arena) {
+    std::string_view source = readFile(filename, arena);
+    if (source.empty()) {
         return {};
     }
+    source.remove_suffix(1);  // The null added by readFile()
 
-    buffer[fileLength] = '\0';  // make sure the string is null terminated
-    in.close();
+    std::string definelines;
+    size_t start = 0;
+    while ((start = defines.find_first_not_of(' ', start)) != std::string::npos) {
+        size_t end = std::min(defines.find(' ', start), defines.size());
+        std::string define = defines.substr(start, end - start);
+        const size_t equals = define.find('=');
+        if (equals != std::string::npos) {
+            define[equals] = ' ';
+        } else {
+            define += " 1";
+        }
+        definelines += "#define " + define + "\n";
+        start = end;
+    }
 
-    return buffer;
+    size_t versionline = 0;
+    if (source.compare(0, 8, "#version") == 0) {
+        versionline = std::min(source.find('\n'), source.size() - 1) + 1;
+    }
+    std::string output(source.substr(0, versionline));
+    const int firstline = (versionline > 0) ? 2 : 1;
+    if (!definelines.empty()) {
+        output += definelines + "#line " + std::to_string(firstline) + "\n";
+    }
+    std::vector<std::string> included = {filename};
+    const bool expanded =
+        expandIncludes(source.substr(versionline), filename, firstline, included, output, arena);
+    dependencies.insert(dependencies.end(), included.begin(), included.end());
+    return expanded ? output : std::string();
 }
 
-GLuint loadShader(GLenum shaderType, const std::string& filename) {
+}  // namespace
+
+// Start compiling a shader. The result is checked by checkShader().
+GLuint compileShader(GLenum shaderType, const std::string& shaderSource) {
     GLuint shader = glCreateShader(shaderType);
-    std::string shaderSource = readFile(filename);
     if (!shaderSource.empty()) {
         const char* source = shaderSource.c_str();
         glShaderSource(shader, 1, &source, nullptr);
         glCompileShader(shader);
     }
+    return shader;
+}
 
+// Print the log of a shader that did not compile
+void checkShader(GLuint shader, const std::string& filename) {
     GLint shaderCompiled = GL_FALSE;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &shaderCompiled);
 
@@ -72,29 +220,334 @@ GLuint loadShader(GLenum shaderType, const std::string& filename) {
         glGetShaderInfoLog(shader, sizeof(buf), nullptr, buf);
         std::cerr << "Shader compile error ('" << filename << "'):\n" << buf << "\n";
     }
+}
 
-    return shader;
+namespace {
+
+/*
+ * A program binary from glGetProgramBinary(), saved next to the shader files. A binary is
+ * only valid for the driver that made it, so it is stored with a hash of the shader sources
+ * and the driver's vendor, renderer and version strings, and is used only if they all match.
+ */
+struct ProgramFileHeader {
+    char magic[8];          // "TNMPROG" and a null
+    uint32_t version;       // programFileVersion
+    uint32_t binaryformat;  // Format from glGetProgramBinary()
+    uint64_t key;           // programKey() of the sources and the driver
+    uint64_t binarysize;    // Bytes of binary data after the header
+};
+
+const char programFileMagic[8] = {'T', 'N', 'M', 'P', 'R', 'O', 'G', '\0'};
+const uint32_t programFileVersion = 1;
+
+// Hash of the sources of all stages and of the driver that compiles them
+uint64_t programKey(const std::string* sources, int count) {
+    uint64_t key = util::hashBytes(&count, sizeof(count));
+    for (int i = 0; i < count; i++) {
+        const uint64_t size = sources[i].size();
+        key = util::hashBytes(&size, sizeof(size), key);
+        key = util::hashBytes(sources[i].data(), sources[i].size(), key);
+    }
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        const char* string = reinterpret_cast<const char*>(glGetString(name));
+        if (string != nullptr) {
+            key = util::hashBytes(string, strlen(string) + 1, key);
+        }
+    }
+    return key;
+}
+
+// The binary cache file of a program, named after its shader files and variant key
+std::string programFile(const std::string* shaderfiles, int count, const std::string& defines) {
+    std::string filename = shaderfiles[0];
+    for (int i = 1; i < count; i++) {
+        filename += "." + shaderfiles[i].substr(shaderfiles[i].find_last_of("/\\") + 1);
+    }
+    if (!defines.empty()) {
+        char variant[24];
+        snprintf(variant, sizeof(variant), ".%016llx",
+                 static_cast<unsigned long long>(util::hashBytes(defines.data(), defines.size())));
+        filename += variant;
+    }
+    return filename + ".glbin";
 }
 
+bool programBinarySupported() {
+    if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) {
+        return false;
+    }
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+// A program object from a binary cache file, or 0 if the file is missing, stale or rejected
+GLuint loadProgramBinary(const std::string& filename, uint64_t key) {
+    MappedFile file;
+    if (!file.open(filename) || file.size() < sizeof(ProgramFileHeader)) {
+        return 0;
+    }
+    ProgramFileHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, programFileMagic, sizeof(programFileMagic)) != 0 ||
+        header.version != programFileVersion || header.key != key ||
+        header.binarysize > file.size() - sizeof(header)) {
+        return 0;
+    }
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.binaryformat, file.data() + sizeof(header),
+                    static_cast<GLsizei>(header.binarysize));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked == GL_FALSE) {
+        // The driver may reject its own binaries, for example after an update
+        glstate::deleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void saveProgramBinary(const std::string& filename, uint64_t key, GLuint program) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+    std::vector<char> binary(length);
+    GLenum binaryformat = 0;
+    glGetProgramBinary(program, length, &length, &binaryformat, binary.data());
+
+    ProgramFileHeader header = {};
+    memcpy(header.magic, programFileMagic, sizeof(programFileMagic));
+    header.version = programFileVersion;
+    header.binaryformat = binaryformat;
+    header.key = key;
+    header.binarysize = static_cast<uint64_t>(length);
+
+    FILE* output = fopen(filename.c_str(), "wb");
+    if (!output) {
+        return;  // Not an error, the program is compiled again next time
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, output) == 1;
+    ok = ok && fwrite(binary.data(), 1, header.binarysize, output) == header.binarysize;
+    ok = (fclose(output) == 0) && ok;
+    if (!ok) {
+        std::cerr << "Could not write shader binary file '" << filename << "'\n";
+        std::remove(filename.c_str());
+    }
+}
+
+// True if the driver compiles in the background and can be polled for completion. The KHR
+// and ARB extensions share GL_COMPLETION_STATUS.
+bool parallelCompileSupported() {
+    static const bool supported = [] {
+        if (GLEW_ARB_parallel_shader_compile) {
+            return true;
+        }
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++) {
+            const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if (name != nullptr && strcmp(name, "GL_KHR_parallel_shader_compile") == 0) {
+                return true;
+            }
+        }
+        return false;
+    }();
+    return supported;
+}
+
+}  // namespace
+
 void Shader::createShader(const std::string& vertexshaderfile,
-                          const std::string& fragmentshaderfile) {
-    // If a program is already stored in this object, delete it
-    if (programID_ != 0) {
-        glDeleteProgram(programID_);
+                          const std::string& fragmentshaderfile, const std::string& defines) {
+    TRACE_SCOPE("createShader");
+    beginCreateShader(vertexshaderfile, fragmentshaderfile, defines);
+    finish();
+}
+
+void Shader::createShader(const std::string& vertexshaderfile,
+                          const std::string& geometryshaderfile,
+                          const std::string& fragmentshaderfile, const std::string& defines) {
+    TRACE_SCOPE("createShader");
+    beginCreateShader(vertexshaderfile, geometryshaderfile, fragmentshaderfile, defines);
+    finish();
+}
+
+void Shader::createComputeShader(const std::string& computeshaderfile,
+                                 const std::string& defines) {
+    TRACE_SCOPE("createComputeShader");
+    beginCreateComputeShader(computeshaderfile, defines);
+    finish();
+}
+
+void Shader::createFeedbackShader(const std::string& vertexshaderfile,
+                                  const std::vector<std::string>& varyings,
+                                  const std::string& defines) {
+    TRACE_SCOPE("createFeedbackShader");
+    beginCreateFeedbackShader(vertexshaderfile, varyings, defines);
+    finish();
+}
+
+void Shader::beginCreateShader(const std::string& vertexshaderfile,
+                               const std::string& fragmentshaderfile,
+                               const std::string& defines) {
+    varyings_.clear();
+    const std::string files[] = {vertexshaderfile, fragmentshaderfile};
+    const GLenum types[] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+    beginProgram(files, types, 2, variantKey(defines));
+}
+
+void Shader::beginCreateShader(const std::string& vertexshaderfile,
+                               const std::string& geometryshaderfile,
+                               const std::string& fragmentshaderfile,
+                               const std::string& defines) {
+    if (geometryshaderfile.empty()) {
+        beginCreateShader(vertexshaderfile, fragmentshaderfile, defines);
+        return;
     }
+    varyings_.clear();
+    const std::string files[] = {vertexshaderfile, geometryshaderfile, fragmentshaderfile};
+    const GLenum types[] = {GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER};
+    beginProgram(files, types, 3, variantKey(defines));
+}
+
+void Shader::beginCreateComputeShader(const std::string& computeshaderfile,
+                                      const std::string& defines) {
+    const GLenum type = GL_COMPUTE_SHADER;
+    varyings_.clear();
+    beginProgram(&computeshaderfile, &type, 1, variantKey(defines));
+}
+
+void Shader::beginCreateFeedbackShader(const std::string& vertexshaderfile,
+                                       const std::vector<std::string>& varyings,
+                                       const std::string& defines) {
+    const GLenum type = GL_VERTEX_SHADER;
+    varyings_ = varyings;
+    beginProgram(&vertexshaderfile, &type, 1, variantKey(defines));
+}
+
+std::string Shader::variantKey(const std::string& defines) {
+    std::vector<std::string> names;
+    size_t start = 0;
+    while ((start = defines.find_first_not_of(' ', start)) != std::string::npos) {
+        const size_t end = std::min(defines.find(' ', start), defines.size());
+        names.push_back(defines.substr(start, end - start));
+        start = end;
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    std::string key;
+    for (const std::string& name : names) {
+        key += (key.empty() ? "" : " ") + name;
+    }
+    return key;
+}
+
+/*
+ * Use the cached binary of the program if there is a valid one. Otherwise start to compile
+ * the shaders and link the program, without asking for the results, which would wait for
+ * the compiler. finish() checks them and saves the binary for the next time.
+ */
+void Shader::beginProgram(const std::string* files, const GLenum* types, int count,
+                          const std::string& defines) {
+    TRACE_SCOPE("compile shader");
+    discardPending();
+    // Remembered for reloadIfChanged(), also when the files could not be read
+    for (int i = 0; i < count; i++) {
+        sourcefiles_[i] = files[i];
+        sourcetypes_[i] = types[i];
+    }
+    sourcecount_ = count;
+    defines_ = defines;
+    dependencies_.clear();
 
-    // Create the vertex shader.
-    GLuint vertexShader = loadShader(GL_VERTEX_SHADER, vertexshaderfile);
-    GLuint fragmentShader = loadShader(GL_FRAGMENT_SHADER, fragmentshaderfile);
+    // The files are only needed until they are expanded into the sources
+    Arena arena(64 << 10);
+    std::string sources[maxStages];
+    bool sourcesread = true;
+    for (int i = 0; i < count; i++) {
+        sources[i] = preprocessShader(files[i], defines, dependencies_, arena);
+        if (sources[i].empty()) {
+            dependencies_.push_back(files[i]);  // To see when the file is there again
+        }
+        sourcesread = sourcesread && !sources[i].empty();
+    }
 
-    // Create a program object and attach the two compiled shaders.
-    GLuint programObject = glCreateProgram();
-    glAttachShader(programObject, vertexShader);
-    glAttachShader(programObject, fragmentShader);
+    if (watcher_ != nullptr) {
+        for (const std::string& file : dependencies_) {
+            watcher_->watch(file);
+        }
+    }
 
-    // Link the program object and print out the info log.
-    glLinkProgram(programObject);
+    // The binary is kept next to a local shader file, and not next to a URL
+    const bool usebinary = sourcesread && !vfs::isRemote(files[0]) && programBinarySupported();
+    binaryfile_ = usebinary ? programFile(files, count, defines) : std::string();
+    key_ = usebinary ? programKey(sources, count) : 0;
+    // The captured outputs are part of the linked program
+    for (const std::string& varying : varyings_) {
+        key_ = usebinary ? util::hashBytes(varying.c_str(), varying.size() + 1, key_) : 0;
+    }
+    if (usebinary) {
+        const GLuint program = loadProgramBinary(binaryfile_, key_);
+        if (program != 0) {
+            bindUniformBlocks(program);
+            setProgram(program);
+            return;
+        }
+    }
 
+    // Create a program object and attach the shaders.
+    pendingprogram_ = glCreateProgram();
+    pendingcount_ = count;
+    for (int i = 0; i < count; i++) {
+        pendingshaders_[i] = compileShader(types[i], sources[i]);
+        pendingfiles_[i] = files[i];
+        glAttachShader(pendingprogram_, pendingshaders_[i]);
+    }
+    if (!varyings_.empty()) {
+        std::vector<const char*> names;
+        for (const std::string& varying : varyings_) {
+            names.push_back(varying.c_str());
+        }
+        glTransformFeedbackVaryings(pendingprogram_, static_cast<GLsizei>(names.size()),
+                                    names.data(), GL_INTERLEAVED_ATTRIBS);
+    }
+    if (usebinary) {
+        glProgramParameteri(pendingprogram_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(pendingprogram_);
+}
+
+bool Shader::pending() const { return pendingprogram_ != 0; }
+
+bool Shader::ready() {
+    if (pendingprogram_ == 0) {
+        return true;
+    }
+    if (parallelCompileSupported()) {
+        GLint completed = GL_FALSE;
+        glGetProgramiv(pendingprogram_, GL_COMPLETION_STATUS_ARB, &completed);
+        if (completed == GL_FALSE) {
+            return false;
+        }
+    }
+    finish();
+    return true;
+}
+
+void Shader::finish() {
+    if (pendingprogram_ == 0) {
+        return;
+    }
+    TRACE_SCOPE("link shader");
+    const GLuint programObject = pendingprogram_;
+    pendingprogram_ = 0;
+    for (int i = 0; i < pendingcount_; i++) {
+        checkShader(pendingshaders_[i], pendingfiles_[i]);
+    }
+
+    // Print out the info log if the program did not link.
     GLint shadersLinked = GL_FALSE;
     glGetProgramiv(programObject, GL_LINK_STATUS, &shadersLinked);
 
@@ -103,8 +556,253 @@ void Shader::createShader(const std::string& vertexshaderfile,
         glGetProgramInfoLog(programObject, sizeof(buf), nullptr, buf);
         std::cerr << "Shader program linker error:\n" << buf << "\n";
     }
-    glDeleteShader(vertexShader);    // After successful linking,
-    glDeleteShader(fragmentShader);  // these are no longer needed
+    bindUniformBlocks(programObject);
+
+    // After successful linking, these are no longer needed
+    for (int i = 0; i < pendingcount_; i++) {
+        glDeleteShader(pendingshaders_[i]);
+    }
+    pendingcount_ = 0;
+
+    // A program that worked before is better than one that does not
+    if (shadersLinked == GL_FALSE && programID_ != 0) {
+        std::cerr << "Keeping the previous program of '" << pendingfiles_[0] << "'\n";
+        glstate::deleteProgram(programObject);
+        return;
+    }
+
+    setProgram(programObject);  // Save this value in the class variable
+
+    if (shadersLinked == GL_TRUE && !binaryfile_.empty()) {
+        saveProgramBinary(binaryfile_, key_, programID_);
+    }
+}
+
+void Shader::setCompilerThreads(unsigned int count) {
+    if (GLEW_ARB_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsARB(count);
+    }
+}
+
+// Delete a program that was started but not finished
+void Shader::watch(FileWatcher& watcher) {
+    watcher_ = &watcher;
+    for (const std::string& file : dependencies_) {
+        watcher.watch(file);
+    }
+}
+
+bool Shader::reloadIfChanged(const std::vector<std::string>& changed) {
+    if (sourcecount_ == 0) {
+        return false;
+    }
+    for (const std::string& file : changed) {
+        if (std::find(dependencies_.begin(), dependencies_.end(), file) !=
+            dependencies_.end()) {
+            // Copies, as beginProgram() assigns to the members
+            std::string files[maxStages];
+            GLenum types[maxStages];
+            std::copy(sourcefiles_, sourcefiles_ + sourcecount_, files);
+            std::copy(sourcetypes_, sourcetypes_ + sourcecount_, types);
+            const std::string defines = defines_;
+            beginProgram(files, types, sourcecount_, defines);
+            return true;
+        }
+    }
+    return false;
+}
+
+const std::vector<std::string>& Shader::dependencies() const { return dependencies_; }
+
+void Shader::discardPending() {
+    if (pendingprogram_ != 0) {
+        glstate::deleteProgram(pendingprogram_);
+        pendingprogram_ = 0;
+    }
+    for (int i = 0; i < pendingcount_; i++) {
+        glDeleteShader(pendingshaders_[i]);
+    }
+    pendingcount_ = 0;
+}
+
+void Shader::setProgram(GLuint program) {
+    // If a program is already stored in this object, delete it
+    if (programID_ != 0) {
+        glstate::deleteProgram(programID_);
+    }
+    programID_ = program;
+    if (gldebug::enabled()) {
+        std::string label = sourcefiles_[0];
+        for (int i = 1; i < sourcecount_; i++) {
+            label += " + " + sourcefiles_[i];
+        }
+        gldebug::label(GL_PROGRAM, program, defines_.empty() ? label : label + " " + defines_);
+    }
+
+    uniforms_.clear();
+    uniformindex_.clear();
+    GLint count = 0, maxlength = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxlength);
+    std::vector<char> name(std::max(maxlength, 1));
+    for (GLint i = 0; i < count; i++) {
+        Uniform uniform = {};
+        glGetActiveUniform(program, static_cast<GLuint>(i), maxlength, nullptr, &uniform.size,
+                           &uniform.type, name.data());
+        uniform.location = glGetUniformLocation(program, name.data());
+        if (uniform.location < 0) {
+            continue;  // In a uniform block
+        }
+        // Arrays are listed as "name[0]", and can also be set as "name"
+        std::string uniformname(name.data());
+        uniformindex_[uniformname] = uniforms_.size();
+        if (uniformname.size() > 3 && uniformname.compare(uniformname.size() - 3, 3, "[0]") == 0) {
+            uniformindex_[uniformname.substr(0, uniformname.size() - 3)] = uniforms_.size();
+        }
+        uniforms_.push_back(uniform);
+    }
+}
+
+void Shader::use() const { glstate::useProgram(programID_); }
+
+GLint Shader::uniformLocation(const std::string& name) const {
+    const auto found = uniformindex_.find(name);
+    return (found != uniformindex_.end()) ? uniforms_[found->second].location : -1;
+}
+
+Shader::Uniform* Shader::changedUniform(const std::string& name, const void* value,
+                                        size_t size) {
+    const auto found = uniformindex_.find(name);
+    if (found == uniformindex_.end()) {
+        return nullptr;
+    }
+    Uniform& uniform = uniforms_[found->second];
+    if (uniform.known && memcmp(uniform.value, value, size) == 0) {
+        return nullptr;
+    }
+    memcpy(uniform.value, value, size);
+    uniform.known = true;
+    // Without glProgramUniform*(), the program must be current for glUniform*()
+    if (!GLEW_VERSION_4_1 && !GLEW_ARB_separate_shader_objects) {
+        use();
+    }
+    return &uniform;
+}
+
+void Shader::setUniform(const std::string& name, GLint value) {
+    if (const Uniform* uniform = changedUniform(name, &value, sizeof(value))) {
+        if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects) {
+            glProgramUniform1i(programID_, uniform->location, value);
+        } else {
+            glUniform1i(uniform->location, value);
+        }
+    }
+}
 
-    programID_ = programObject;  // Save this value in the class variable
+void Shader::setUniform(const std::string& name, GLuint value) {
+    if (const Uniform* uniform = changedUniform(name, &value, sizeof(value))) {
+        if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects) {
+            glProgramUniform1ui(programID_, uniform->location, value);
+        } else {
+            glUniform1ui(uniform->location, value);
+        }
+    }
+}
+
+void Shader::setUniform(const std::string& name, GLfloat value) {
+    if (const Uniform* uniform = changedUniform(name, &value, sizeof(value))) {
+        if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects) {
+            glProgramUniform1f(programID_, uniform->location, value);
+        } else {
+            glUniform1f(uniform->location, value);
+        }
+    }
+}
+
+void Shader::setUniform(const std::string& name, GLfloat x, GLfloat y) {
+    const GLfloat value[] = {x, y};
+    if (const Uniform* uniform = changedUniform(name, value, sizeof(value))) {
+        if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects) {
+            glProgramUniform2fv(programID_, uniform->location, 1, value);
+        } else {
+            glUniform2fv(uniform->location, 1, value);
+        }
+    }
+}
+
+void Shader::setUniform(const std::string& name, GLfloat x, GLfloat y, GLfloat z) {
+    const GLfloat value[] = {x, y, z};
+    if (const Uniform* uniform = changedUniform(name, value, sizeof(value))) {
+        if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects) {
+            glProgramUniform3fv(programID_, uniform->location, 1, value);
+        } else {
+            glUniform3fv(uniform->location, 1, value);
+        }
+    }
 }
+
+void Shader::setUniform(const std::string& name, GLfloat x, GLfloat y, GLfloat z, GLfloat w) {
+    const GLfloat value[] = {x, y, z, w};
+    if (const Uniform* uniform = changedUniform(name, value, sizeof(value))) {
+        if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects) {
+            glProgramUniform4fv(programID_, uniform->location, 1, value);
+        } else {
+            glUniform4fv(uniform->location, 1, value);
+        }
+    }
+}
+
+void Shader::setUniformMatrix(const std::string& name, const GLfloat* matrix) {
+    if (const Uniform* uniform = changedUniform(name, matrix, 16 * sizeof(GLfloat))) {
+        if (GLEW_VERSION_4_1 || GLEW_ARB_separate_shader_objects) {
+            glProgramUniformMatrix4fv(programID_, uniform->location, 1, GL_FALSE, matrix);
+        } else {
+            glUniformMatrix4fv(uniform->location, 1, GL_FALSE, matrix);
+        }
+    }
+}
+
+// Connect the uniform blocks to their binding points once, see UniformBuffers.hpp
+void Shader::bindUniformBlocks(GLuint program) {
+    const GLuint frameBlock = glGetUniformBlockIndex(program, "FrameData");
+    if (frameBlock != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, frameBlock, frameBlockBinding);
+    }
+    const GLuint objectBlock = glGetUniformBlockIndex(program, "ObjectData");
+    if (objectBlock != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, objectBlock, objectBlockBinding);
+    }
+    const GLuint textureBlock = glGetUniformBlockIndex(program, "TextureData");
+    if (textureBlock != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, textureBlock, textureBlockBinding);
+    }
+    const GLuint materialBlock = glGetUniformBlockIndex(program, "MaterialData");
+    if (materialBlock != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, materialBlock, materialBlockBinding);
+    }
+    const GLuint viewBlock = glGetUniformBlockIndex(program, "ViewData");
+    if (viewBlock != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, viewBlock, viewBlockBinding);
+    }
+}
+
+ShaderVariants::ShaderVariants(const std::string& vertexshaderfile,
+                               const std::string& fragmentshaderfile)
+    : vertexshaderfile_(vertexshaderfile), fragmentshaderfile_(fragmentshaderfile) {}
+
+Shader& ShaderVariants::get(const std::string& defines) {
+    prepare(defines);
+    Shader& variant = variants_[Shader::variantKey(defines)];
+    variant.finish();
+    return variant;
+}
+
+void ShaderVariants::prepare(const std::string& defines) {
+    const std::string key = Shader::variantKey(defines);
+    const auto inserted = variants_.try_emplace(key);
+    if (inserted.second) {
+        inserted.first->second.beginCreateShader(vertexshaderfile_, fragmentshaderfile_, key);
+    }
+}
+
+size_t ShaderVariants::size() const { return variants_.size(); }
@@ -4,6 +4,30 @@
  * Usage: call createShader() to load and compile a program object
  * or use the constructor with two filenames.
  * Call glUseProgram() with the public member programID as argument.
+ * The binary of each linked program is saved in a file next to the first shader file,
+ * named after all the shader files with the extension .glbin. It is loaded instead of
+ * compiling the shaders again, as long as the sources and the driver are the same.
+ * To build many programs at once, call beginCreateShader() on each of them first, then
+ * do other work, like loading meshes and textures, and call finish() or poll ready()
+ * before id(). With KHR_parallel_shader_compile or ARB_parallel_shader_compile, the
+ * driver compiles in its own threads meanwhile, and ready() does not wait for it.
+ * Variants of a program are made with 'defines', a list of names or name=value pairs
+ * separated by spaces, which become #define lines after the #version line of every
+ * shader. Lines like #include "file.glsl" are replaced by that file, relative to the
+ * including file. ShaderVariants keeps the variants of a pair of shader files.
+ * The overloads with a geometry shader file, which take the defines always, put that
+ * shader between the other two, unless the name is empty.
+ * createFeedbackShader() makes a program of a vertex shader alone, whose outputs in
+ * 'varyings' are captured interleaved, in that order, into the buffer bound to
+ * GL_TRANSFORM_FEEDBACK_BUFFER index 0 between glBeginTransformFeedback() and
+ * glEndTransformFeedback().
+ * The active uniforms are listed once when the program is linked, so uniformLocation()
+ * needs no call to OpenGL. setUniform() remembers the values it sets, and does not upload
+ * a value that the program already has. Values set with glUniform() directly are not seen.
+ * For editing shaders while the program runs, watch() the files with a FileWatcher, and
+ * once per frame pass its changes() to reloadIfChanged() and poll ready(). The program is
+ * compiled again in the background and replaces the old one when it is finished. If it does
+ * not compile or link, the errors are printed and the old program stays.
  *
  * Authors: Stefan Gustavson (stegu@itn.liu.se) 2014
  *          Martin Falk (martin.falk@liu.se) 2021
@@ -13,7 +37,14 @@
 #pragma once
 
 #include <GLFW/glfw3.h>
+#include <cstdint>
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+class FileWatcher;
 
 class Shader {
 public:
@@ -23,14 +54,164 @@ public:
     // Constructor to create, load and compile a Shader program in one blow.
     Shader(const std::string& vertexshaderfile, const std::string& fragmentshaderfile);
 
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
+
+    // Move the program, and a program being built, to a new object, and leave 'other' empty
+    Shader(Shader&& other) noexcept;
+    Shader& operator=(Shader&& other) noexcept;
+
     // Destructor
     ~Shader();
 
     // createShader() - create, load, compile and link the GLSL shader objects.
-    void createShader(const std::string& vertexshaderfile, const std::string& fragmentshaderfile);
+    void createShader(const std::string& vertexshaderfile, const std::string& fragmentshaderfile,
+                      const std::string& defines = std::string());
+    void createShader(const std::string& vertexshaderfile, const std::string& geometryshaderfile,
+                      const std::string& fragmentshaderfile, const std::string& defines);
+
+    // createComputeShader() - the same for a compute shader program (OpenGL 4.3)
+    void createComputeShader(const std::string& computeshaderfile,
+                             const std::string& defines = std::string());
+
+    /* createFeedbackShader() - the same for a transform feedback program of a vertex shader
+     * alone, which captures the outputs 'varyings' */
+    void createFeedbackShader(const std::string& vertexshaderfile,
+                              const std::vector<std::string>& varyings,
+                              const std::string& defines = std::string());
+
+    /* Start to compile and link a program, without waiting for the driver. The previous
+     * program, if any, is kept in id() until the new one is finished. */
+    void beginCreateShader(const std::string& vertexshaderfile,
+                           const std::string& fragmentshaderfile,
+                           const std::string& defines = std::string());
+    void beginCreateShader(const std::string& vertexshaderfile,
+                           const std::string& geometryshaderfile,
+                           const std::string& fragmentshaderfile, const std::string& defines);
+    void beginCreateComputeShader(const std::string& computeshaderfile,
+                                  const std::string& defines = std::string());
+    void beginCreateFeedbackShader(const std::string& vertexshaderfile,
+                                   const std::vector<std::string>& varyings,
+                                   const std::string& defines = std::string());
+
+    /* True when the program started by beginCreateShader() is finished, or when there is no
+     * such program. A program that the driver has completed is finished by this call. */
+    bool ready();
+
+    // True between beginCreateShader() and the ready() or finish() that completes it
+    bool pending() const;
+
+    /* Wait for the program started by beginCreateShader(), and print any errors. A program
+     * that does not link is only kept if there was no program before. */
+    void finish();
+
+    /* Watch the shader files and the files they include, now and after every rebuild.
+     * 'watcher' must live longer than this object. */
+    void watch(FileWatcher& watcher);
+
+    /* Start to build the program again if one of its files is in 'changed'. It replaces
+     * the current program in ready() or finish(), unless it fails. True if it was started. */
+    bool reloadIfChanged(const std::vector<std::string>& changed);
+
+    // The shader files of the program and the files they include
+    const std::vector<std::string>& dependencies() const;
+
+    // Number of threads the driver may use for compiling, with ARB_parallel_shader_compile
+    static void setCompilerThreads(unsigned int count);
+
+    // 'defines' sorted and without duplicates, the same for every order of the same names
+    static std::string variantKey(const std::string& defines);
 
     GLuint id() const;
 
+    // Make the program current, through glstate::useProgram()
+    void use() const;
+
+    // Location of an active uniform outside the uniform blocks, or -1
+    GLint uniformLocation(const std::string& name) const;
+
+    /* Set a uniform of the program unless it has the value already. With OpenGL 4.1 or
+     * ARB_separate_shader_objects the current program stays the same, otherwise this
+     * program is made current. Unknown names are ignored, like location -1 in OpenGL. */
+    void setUniform(const std::string& name, GLint value);
+    void setUniform(const std::string& name, GLuint value);
+    void setUniform(const std::string& name, GLfloat value);
+    void setUniform(const std::string& name, GLfloat x, GLfloat y);
+    void setUniform(const std::string& name, GLfloat x, GLfloat y, GLfloat z);
+    void setUniform(const std::string& name, GLfloat x, GLfloat y, GLfloat z, GLfloat w);
+    // A mat4 from 16 floats in column major order
+    void setUniformMatrix(const std::string& name, const GLfloat* matrix);
+
 private:
+    // Shaders of one program at most: vertex, geometry and fragment
+    static const int maxStages = 3;
+
+    struct Uniform {
+        GLint location;
+        GLenum type;
+        GLint size;          // Array elements
+        bool known;          // True when 'value' is what the program has
+        GLfloat value[16];   // The last value set by setUniform(), of the first element
+    };
+    // Load the program from its binary file, or start compiling and linking it
+    void beginProgram(const std::string* files, const GLenum* types, int count,
+                      const std::string& defines);
+
+    // Delete the program and shaders of an unfinished beginCreateShader()
+    void discardPending();
+
+    // Make programID_ 'program', and list its uniforms
+    void setProgram(GLuint program);
+
+    // The uniform 'name' if its value differs from the 'size' bytes at 'value', else nullptr.
+    // The new value is remembered, as it is uploaded next.
+    Uniform* changedUniform(const std::string& name, const void* value, size_t size);
+
+    // Bind the FrameData, ObjectData, TextureData and MaterialData blocks of 'program' to
+    // their binding points
+    static void bindUniformBlocks(GLuint program);
+
     GLuint programID_;
+    std::vector<Uniform> uniforms_;
+    std::unordered_map<std::string, size_t> uniformindex_;  // Index in uniforms_ by name
+
+    // The program being compiled and linked, until finish()
+    GLuint pendingprogram_;
+    GLuint pendingshaders_[maxStages];
+    std::string pendingfiles_[maxStages];
+    int pendingcount_;
+    std::string binaryfile_;  // Binary cache file to save, or empty
+    uint64_t key_;            // Hash of the sources and driver for binaryfile_
+
+    // The arguments of the last beginCreateShader(), for reloadIfChanged()
+    std::string sourcefiles_[maxStages];
+    GLenum sourcetypes_[maxStages];
+    int sourcecount_;
+    std::string defines_;
+    std::vector<std::string> varyings_;  // Transform feedback outputs, if any
+    std::vector<std::string> dependencies_;
+    FileWatcher* watcher_;
+};
+
+/*
+ * The variants of a vertex and fragment shader pair, compiled when they are first used and
+ * kept by their variant key
+ */
+class ShaderVariants {
+public:
+    ShaderVariants(const std::string& vertexshaderfile, const std::string& fragmentshaderfile);
+
+    // The program with 'defines', compiled now if it was not before
+    Shader& get(const std::string& defines);
+
+    // Start to compile a variant that get() will be asked for later
+    void prepare(const std::string& defines);
+
+    // Number of variants compiled or being compiled
+    size_t size() const;
+
+private:
+    std::string vertexshaderfile_;
+    std::string fragmentshaderfile_;
+    std::map<std::string, Shader> variants_;
 };
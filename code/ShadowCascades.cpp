@@ -0,0 +1,197 @@
+/*
+ * Cascaded shadow maps for a directional light
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "ShadowCascades.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "Shader.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+namespace {
+
+// How far the splits are from even towards logarithmic
+constexpr float logarithmicSplits = 0.75f;
+
+}  // namespace
+
+ShadowCascades::ShadowCascades(int cascades, int size, int dynamiccascades, float maxdistance)
+    : cascades_(std::min(std::max(cascades, 1), maxCascades)), size_(std::max(size, 16)),
+      dynamiccascades_(std::max(dynamiccascades, 0)), maxdistance_(maxdistance), texture_(0),
+      framebuffer_(0), statickey_(0), rendered_(0) {
+    for (int i = 0; i < maxCascades; i++) {
+        matrices_[i] = Mat4::identity();
+        cachedmatrices_[i] = Mat4::identity();
+        splits_[i] = 0.0f;
+        cachedkeys_[i] = 0;
+        cached_[i] = false;
+    }
+}
+
+ShadowCascades::~ShadowCascades() {
+    if (texture_ != 0) {
+        glstate::deleteTextures(1, &texture_);
+        glDeleteFramebuffers(1, &framebuffer_);
+    }
+}
+
+void ShadowCascades::create() {
+    glGenTextures(1, &texture_);
+    glstate::bindTexture(GL_TEXTURE_2D_ARRAY, texture_);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size_, size_, cascades_, 0,
+                 GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    gpumem::setTexture(texture_, gpumem::Category::RenderTarget,
+                       gpumem::textureBytes(GL_DEPTH_COMPONENT24, size_, size_, cascades_));
+    // Linear filtering of a depth comparison gives 2 x 2 percentage closer filtering
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+    glGenFramebuffers(1, &framebuffer_);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glDrawBuffer(GL_NONE);  // Depth only
+    glReadBuffer(GL_NONE);
+}
+
+void ShadowCascades::update(const Mat4& P, const float lightdirection[3], uint64_t statickey) {
+    if (texture_ == 0) {
+        create();
+    }
+    statickey_ = statickey;
+    rendered_ = 0;
+
+    // The rotation into light space, which looks along -lightdirection
+    float z[3] = {lightdirection[0], lightdirection[1], lightdirection[2]};
+    const float length = std::sqrt(z[0] * z[0] + z[1] * z[1] + z[2] * z[2]);
+    for (float& value : z) {
+        value /= length;
+    }
+    const float up[3] = {0.0f, std::abs(z[1]) < 0.99f ? 1.0f : 0.0f,
+                         std::abs(z[1]) < 0.99f ? 0.0f : 1.0f};
+    float x[3] = {up[1] * z[2] - up[2] * z[1], up[2] * z[0] - up[0] * z[2],
+                  up[0] * z[1] - up[1] * z[0]};
+    const float xlength = std::sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+    for (float& value : x) {
+        value /= xlength;
+    }
+    const float y[3] = {z[1] * x[2] - z[2] * x[1], z[2] * x[0] - z[0] * x[2],
+                        z[0] * x[1] - z[1] * x[0]};
+    const Mat4 light = {{x[0], y[0], z[0], 0.0f, x[1], y[1], z[1], 0.0f, x[2], y[2], z[2], 0.0f,
+                         0.0f, 0.0f, 0.0f, 1.0f}};
+
+    // The planes of the perspective projection, from P[2][2] and P[2][3], as in
+    // LightClusters
+    const float znear = P.m[14] / (P.m[10] - 1.0f);
+    const float zfar = std::min(P.m[14] / (P.m[10] + 1.0f), maxdistance_);
+    // The half size of the view at distance 1, of an off-center projection too
+    const float sx = (1.0f + std::abs(P.m[8])) / P.m[0];
+    const float sy = (1.0f + std::abs(P.m[9])) / P.m[5];
+
+    float start = znear;
+    for (int i = 0; i < cascades_; i++) {
+        const float t = float(i + 1) / float(cascades_);
+        const float end = logarithmicSplits * znear * std::pow(zfar / znear, t) +
+                          (1.0f - logarithmicSplits) * (znear + (zfar - znear) * t);
+        splits_[i] = end;
+
+        // The bounding sphere of the slice, centered on the view axis where the corners of
+        // the near and the far end are equally far away
+        const float r0 = start * start * (sx * sx + sy * sy);
+        const float r1 = end * end * (sx * sx + sy * sy);
+        const float center =
+            std::min((r1 - r0) / (2.0f * (end - start)) + (start + end) / 2.0f, end);
+        float radius =
+            std::sqrt(std::max(r1 + (end - center) * (end - center),
+                               r0 + (center - start) * (center - start)));
+        // Round up, so that the radius is the same in every frame
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+        start = end;
+
+        // The center in light space, moved in whole texels
+        const float texel = 2.0f * radius / float(size_);
+        float cx = -center * light.m[8];
+        float cy = -center * light.m[9];
+        const float cz = -center * light.m[10];
+        cx = std::round(cx / texel) * texel;
+        cy = std::round(cy / texel) * texel;
+
+        // Depth from the casters towards the light down to the far side of the sphere
+        const float zmax = cz + radius + maxdistance_;
+        const float zmin = cz - radius;
+        const Mat4 ortho = {{1.0f / radius, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f / radius, 0.0f, 0.0f,
+                             0.0f, 0.0f, -2.0f / (zmax - zmin), 0.0f, -cx / radius, -cy / radius,
+                             (zmax + zmin) / (zmax - zmin), 1.0f}};
+        matrices_[i] = ortho * light;
+    }
+}
+
+int ShadowCascades::count() const { return cascades_; }
+
+bool ShadowCascades::needsRender(int cascade) const {
+    if (!isCached(cascade)) {
+        return true;
+    }
+    return !cached_[cascade] || cachedkeys_[cascade] != statickey_ ||
+           std::memcmp(cachedmatrices_[cascade].m, matrices_[cascade].m,
+                       sizeof(matrices_[cascade].m)) != 0;
+}
+
+bool ShadowCascades::isCached(int cascade) const { return cascade >= dynamiccascades_; }
+
+const Mat4& ShadowCascades::matrix(int cascade) const { return matrices_[cascade]; }
+
+float ShadowCascades::split(int cascade) const { return splits_[cascade]; }
+
+void ShadowCascades::beginCascade(int cascade) {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture_, 0, cascade);
+    glViewport(0, 0, size_, size_);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+}
+
+void ShadowCascades::endCascade(int cascade) {
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    if (isCached(cascade)) {
+        cachedmatrices_[cascade] = matrices_[cascade];
+        cachedkeys_[cascade] = statickey_;
+        cached_[cascade] = true;
+    }
+    rendered_++;
+}
+
+void ShadowCascades::apply(Shader& shader, GLuint unit) const {
+    glstate::activeTexture(GL_TEXTURE0 + unit);
+    glstate::bindTexture(GL_TEXTURE_2D_ARRAY, texture_);
+    glstate::activeTexture(GL_TEXTURE0);
+    shader.setUniform("shadowMap", static_cast<GLint>(unit));
+    // From view space to texture coordinates and depth in [0, 1]
+    constexpr Mat4 bias = Mat4::product(Mat4::translation(0.5f, 0.5f, 0.5f), Mat4::scale(0.5f));
+    for (int i = 0; i < maxCascades; i++) {
+        const Mat4 matrix = bias * matrices_[std::min(i, cascades_ - 1)];
+        shader.setUniformMatrix("shadowMatrix" + std::to_string(i), matrix.m);
+    }
+    float splits[maxCascades];
+    for (int i = 0; i < maxCascades; i++) {
+        splits[i] = i < cascades_ ? splits_[i] : splits_[cascades_ - 1];
+    }
+    shader.setUniform("cascadeEnds", splits[0], splits[1], splits[2], splits[3]);
+    shader.setUniform("cascadeCount", float(cascades_));
+}
+
+GLuint ShadowCascades::texture() const { return texture_; }
+
+int ShadowCascades::renderedCount() const { return rendered_; }
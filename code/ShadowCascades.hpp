@@ -0,0 +1,101 @@
+/*
+ * Cascaded shadow maps for a directional light, with the far cascades cached.
+ *
+ * Usage: Every frame, call update() with the projection, the direction to the light in
+ *        view space and a key of the static geometry. Then draw the shadow casters of
+ *        every cascade that needsRender(), between beginCascade() and endCascade(), with
+ *        the position only shader vertex_depth.glsl, matrix() as the projection and the
+ *        usual model-view matrices of the draws. apply() the result to a program built
+ *        with the define SHADOWS before its draw calls.
+ *        The view frustum is split into 'cascades' slices in depth, up to 'maxdistance',
+ *        between logarithmic and even splits. Each slice gets its own layer of a depth
+ *        texture array of 'size' x 'size' texels. The shadow map of a slice covers its
+ *        bounding sphere, so its size does not change as the view turns, and it moves in
+ *        whole texels, so that the shadow edges do not shimmer. Casters up to
+ *        'maxdistance' towards the light from the slice are included.
+ *        The first 'dynamiccascades' cascades are drawn every frame, with all casters. The
+ *        cascades after them hold the static casters only, and are drawn again only when
+ *        'statickey' or their matrix changes, which is when the static geometry or the
+ *        light moves in view space. Moving objects cast no shadows beyond the near
+ *        cascades.
+ *        beginCascade() sets the polygon mode to GL_FILL and a polygon offset against
+ *        shadow acne, and endCascade() turns the offset off again. The cascade framebuffer
+ *        stays bound.
+ *        A shader can use at most maxCascades cascades.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstdint>
+
+#include "Mat4.hpp"
+
+class Shader;
+
+class ShadowCascades {
+public:
+    static constexpr int maxCascades = 4;
+
+    /* Constructor: the texture is created by the first update() */
+    explicit ShadowCascades(int cascades = 4, int size = 1024, int dynamiccascades = 2,
+                            float maxdistance = 20.0f);
+
+    /* Destructor: delete the texture and the framebuffer */
+    ~ShadowCascades();
+
+    ShadowCascades(const ShadowCascades&) = delete;
+    ShadowCascades& operator=(const ShadowCascades&) = delete;
+
+    /* Fit the cascades to the view frustum of the perspective projection 'P', for a light
+     * from 'lightdirection' in view space. 'statickey' must change whenever the static
+     * geometry changes in view space. */
+    void update(const Mat4& P, const float lightdirection[3], uint64_t statickey);
+
+    int count() const;
+
+    // True if the cascade must be drawn this frame
+    bool needsRender(int cascade) const;
+
+    // True if the cascade holds the static casters only
+    bool isCached(int cascade) const;
+
+    // The projection of a cascade, from view space to the clip space of the light
+    const Mat4& matrix(int cascade) const;
+
+    // Distance from the camera where a cascade ends
+    float split(int cascade) const;
+
+    // Bind the framebuffer of a cascade, set the viewport and clear it
+    void beginCascade(int cascade);
+
+    // Finish the drawing of a cascade, which is then cached if isCached()
+    void endCascade(int cascade);
+
+    // Bind the shadow maps to 'unit' and set the uniforms of 'shader' that read them
+    void apply(Shader& shader, GLuint unit = 5) const;
+
+    // The GL_TEXTURE_2D_ARRAY with one depth layer per cascade
+    GLuint texture() const;
+
+    // Cascades drawn since the last update()
+    int renderedCount() const;
+
+private:
+    void create();
+
+    int cascades_;
+    int size_;
+    int dynamiccascades_;
+    float maxdistance_;
+    GLuint texture_;
+    GLuint framebuffer_;
+    Mat4 matrices_[maxCascades];
+    float splits_[maxCascades];
+    Mat4 cachedmatrices_[maxCascades];  // What the cached cascades were drawn with
+    uint64_t cachedkeys_[maxCascades];
+    bool cached_[maxCascades];          // False until a cached cascade has been drawn
+    uint64_t statickey_;
+    int rendered_;
+};
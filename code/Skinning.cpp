@@ -0,0 +1,174 @@
+/*
+ * Bone palettes, morph targets and a transform feedback skinning pass
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "Skinning.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "TriangleSoup.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+BonePalette::BonePalette() : buffer_(0), texture_(0) {}
+
+BonePalette::~BonePalette() {
+    if (buffer_ != 0) {
+        glstate::deleteTextures(1, &texture_);
+        gpumem::deleteBuffers(1, &buffer_);
+    }
+}
+
+void BonePalette::clear() { matrices_.clear(); }
+
+int BonePalette::add(const Mat4* matrices, int count) {
+    const int first = size();
+    for (int i = 0; i < count; i++) {
+        matrices_.insert(matrices_.end(), matrices[i].m, matrices[i].m + 16);
+    }
+    return first;
+}
+
+int BonePalette::size() const { return static_cast<int>(matrices_.size() / 16); }
+
+void BonePalette::upload() {
+    if (buffer_ == 0) {
+        glGenBuffers(1, &buffer_);
+        glGenTextures(1, &texture_);
+    }
+    // An empty palette still gets a texel, since a buffer texture needs a store
+    const size_t bytes = matrices_.size() * sizeof(float);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer_);
+    glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(std::max<size_t>(bytes, 16)),
+                 bytes > 0 ? matrices_.data() : nullptr, GL_STREAM_DRAW);
+    gpumem::setBuffer(buffer_, gpumem::Category::Buffer, std::max<size_t>(bytes, 16));
+    glstate::bindTexture(GL_TEXTURE_BUFFER, texture_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer_);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void BonePalette::apply(Shader& shader, int firstbone, GLuint unit) const {
+    glstate::activeTexture(GL_TEXTURE0 + unit);
+    glstate::bindTexture(GL_TEXTURE_BUFFER, texture_);
+    glstate::activeTexture(GL_TEXTURE0);
+    shader.setUniform("bones", static_cast<GLint>(unit));
+    shader.setUniform("firstBone", static_cast<GLint>(firstbone));
+}
+
+GLuint BonePalette::texture() const { return texture_; }
+
+MorphTargets::MorphTargets() : vertices_(0), count_(0), buffer_(0), texture_(0) {}
+
+MorphTargets::~MorphTargets() {
+    if (buffer_ != 0) {
+        glstate::deleteTextures(1, &texture_);
+        gpumem::deleteBuffers(1, &buffer_);
+    }
+}
+
+void MorphTargets::create(const GLfloat* offsets, int vertices, int count) {
+    vertices_ = std::max(vertices, 0);
+    count_ = std::min(std::max(count, 0), maxMorphTargets);
+    // Two RGBA32F texels per vertex and target, the position and the normal offset
+    std::vector<float> texels(8 * size_t(vertices_) * size_t(count_), 0.0f);
+    for (size_t i = 0; i < size_t(vertices_) * size_t(count_); i++) {
+        std::copy_n(&offsets[6 * i], 3, &texels[8 * i]);
+        std::copy_n(&offsets[6 * i + 3], 3, &texels[8 * i + 4]);
+    }
+    if (buffer_ == 0) {
+        glGenBuffers(1, &buffer_);
+        glGenTextures(1, &texture_);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer_);
+    glBufferData(GL_TEXTURE_BUFFER,
+                 static_cast<GLsizeiptr>(std::max<size_t>(texels.size() * sizeof(float), 16)),
+                 texels.empty() ? nullptr : texels.data(), GL_STATIC_DRAW);
+    gpumem::setBuffer(buffer_, gpumem::Category::Mesh,
+                      std::max<size_t>(texels.size() * sizeof(float), 16));
+    glstate::bindTexture(GL_TEXTURE_BUFFER, texture_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer_);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+int MorphTargets::count() const { return count_; }
+
+void MorphTargets::apply(Shader& shader, const float* weights, GLuint unit) const {
+    glstate::activeTexture(GL_TEXTURE0 + unit);
+    glstate::bindTexture(GL_TEXTURE_BUFFER, texture_);
+    glstate::activeTexture(GL_TEXTURE0);
+    float w[maxMorphTargets] = {};
+    std::copy_n(weights, count_, w);
+    shader.setUniform("morphTargets", static_cast<GLint>(unit));
+    shader.setUniform("morphWeights", w[0], w[1], w[2], w[3]);
+    shader.setUniform("morphVertexCount", static_cast<GLint>(vertices_));
+}
+
+SkinCache::SkinCache() = default;
+
+SkinCache::~SkinCache() {
+    for (auto& [mesh, entry] : entries_) {
+        mesh->setSkinnedVertices(0);
+        gpumem::deleteBuffers(1, &entry.buffer);
+    }
+}
+
+void SkinCache::skin(TriangleSoup& mesh, const BonePalette& palette, int firstbone,
+                     const MorphTargets* morph, const float* weights) {
+    if (!mesh.skinned()) {
+        std::cerr << "SkinCache: the mesh has no bones\n";
+        return;
+    }
+    const bool morphed = morph != nullptr && weights != nullptr && morph->count() > 0;
+    Shader& program = programs_[morphed ? 1 : 0];
+    if (program.id() == 0) {
+        program.createFeedbackShader("vertex_skin.glsl",
+                                     {"skinnedPosition", "skinnedNormal", "skinnedTexCoord"},
+                                     morphed ? "SKINNED MORPHED" : "SKINNED");
+    }
+
+    // Room for the Float vertices of the mesh, 8 floats each
+    Entry& entry = entries_.try_emplace(&mesh, Entry{0, 0}).first->second;
+    const int vertices = mesh.vertexCount();
+    if (entry.buffer == 0) {
+        glGenBuffers(1, &entry.buffer);
+    }
+    if (entry.vertices != vertices) {
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, entry.buffer);
+        glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER,
+                     static_cast<GLsizeiptr>(size_t(vertices) * 8 * sizeof(GLfloat)), nullptr,
+                     GL_DYNAMIC_COPY);
+        glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+        gpumem::setBuffer(entry.buffer, gpumem::Category::Mesh,
+                          size_t(vertices) * 8 * sizeof(GLfloat));
+        entry.vertices = vertices;
+        mesh.setSkinnedVertices(0);  // The VAO points at the old store
+    }
+
+    program.use();
+    palette.apply(program, firstbone);
+    if (morphed) {
+        morph->apply(program, weights);
+    }
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, entry.buffer);
+    glBeginTransformFeedback(GL_POINTS);
+    mesh.renderVertices();
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    mesh.setSkinnedVertices(entry.buffer);
+}
+
+void SkinCache::release(TriangleSoup& mesh) {
+    auto entry = entries_.find(&mesh);
+    if (entry == entries_.end()) {
+        return;
+    }
+    mesh.setSkinnedVertices(0);
+    gpumem::deleteBuffers(1, &entry->second.buffer);
+    entries_.erase(entry);
+}
@@ -0,0 +1,132 @@
+/*
+ * Skinning and morph target animation of TriangleSoup meshes on the GPU.
+ *
+ * Usage: Give the mesh its bones with TriangleSoup::setSkin(), and its morph targets, the
+ *        offsets of the positions and normals of every vertex, to a MorphTargets.
+ *        Every frame, clear() the BonePalette, add() the bone matrices of each skinned
+ *        draw, which gives the index of its first bone, and upload() them. A matrix takes
+ *        a bone from the bind pose, in which the mesh was made, to its pose in the frame,
+ *        in the space of the mesh.
+ *        Then either draw with a program of vertex.glsl built with the define SKINNED,
+ *        and MORPHED for morph targets, after apply() of the palette with the first bone
+ *        and of the morph targets with their weights. Each pass that draws the mesh skins
+ *        its vertices again.
+ *        Or skin() the mesh with a SkinCache, which does it once with transform feedback
+ *        into a buffer that the mesh draws instead of its own vertices from then on, with
+ *        any program and in any number of passes, until release().
+ *        The matrices and the offsets are buffer textures, which OpenGL 3.3 has, so a
+ *        palette has no limit on the bones but the 256 of one mesh. A mesh blends at most
+ *        maxMorphTargets targets, with one weight each.
+ *        The bounds of a mesh stay those of the bind pose, which culling goes by.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+
+#include <map>
+#include <vector>
+
+#include "Mat4.hpp"
+#include "Shader.hpp"
+
+class TriangleSoup;
+
+// The bone matrices of the skinned draws of a frame
+class BonePalette {
+public:
+    BonePalette();
+
+    /* Destructor: delete the buffer and its texture */
+    ~BonePalette();
+
+    BonePalette(const BonePalette&) = delete;
+    BonePalette& operator=(const BonePalette&) = delete;
+
+    // Remove all matrices, before the draws of a new frame are added
+    void clear();
+
+    // Add 'count' bone matrices, and return the index of the first one
+    int add(const Mat4* matrices, int count);
+
+    // Number of matrices added since clear()
+    int size() const;
+
+    // Send the matrices to the GPU, in a new buffer store, so that the draws of the last
+    // frame are not waited for
+    void upload();
+
+    // Bind the matrices to 'unit' and set the uniforms of 'shader' that read them, for a
+    // draw whose bones start at 'firstbone'
+    void apply(Shader& shader, int firstbone, GLuint unit = 6) const;
+
+    // The GL_TEXTURE_BUFFER with the matrices, four RGBA32F texels each
+    GLuint texture() const;
+
+private:
+    std::vector<float> matrices_;  // 16 floats each, in column major order
+    GLuint buffer_;
+    GLuint texture_;
+};
+
+// The morph targets of a mesh
+class MorphTargets {
+public:
+    static constexpr int maxMorphTargets = 4;
+
+    MorphTargets();
+
+    /* Destructor: delete the buffer and its texture */
+    ~MorphTargets();
+
+    MorphTargets(const MorphTargets&) = delete;
+    MorphTargets& operator=(const MorphTargets&) = delete;
+
+    /* Create 'count' targets of 'vertices' vertices each, from 6 floats per vertex and
+     * target in 'offsets': the offset of the position and the offset of the normal. The
+     * targets follow one after the other. Only the first maxMorphTargets are kept. */
+    void create(const GLfloat* offsets, int vertices, int count);
+
+    int count() const;
+
+    /* Bind the offsets to 'unit' and set the uniforms of 'shader' that blend them, with
+     * the count() weights in 'weights' */
+    void apply(Shader& shader, const float* weights, GLuint unit = 7) const;
+
+private:
+    int vertices_;
+    int count_;
+    GLuint buffer_;
+    GLuint texture_;
+};
+
+// Skinned vertices of meshes, computed once per frame for all the passes that draw them
+class SkinCache {
+public:
+    SkinCache();
+
+    /* Destructor: delete the buffers. The meshes draw their own vertices again. */
+    ~SkinCache();
+
+    SkinCache(const SkinCache&) = delete;
+    SkinCache& operator=(const SkinCache&) = delete;
+
+    /* Skin 'mesh' with the bones from 'firstbone' in 'palette', after the morph targets
+     * 'morph' with 'weights' if 'morph' is not null. The mesh draws the result until it
+     * is skinned again or released. The palette must be uploaded. */
+    void skin(TriangleSoup& mesh, const BonePalette& palette, int firstbone,
+              const MorphTargets* morph = nullptr, const float* weights = nullptr);
+
+    // Delete the buffer of 'mesh', which draws its own vertices again
+    void release(TriangleSoup& mesh);
+
+private:
+    struct Entry {
+        GLuint buffer;
+        int vertices;  // Room in 'buffer'
+    };
+
+    Shader programs_[2];  // Skinning only, and with morph targets
+    std::map<TriangleSoup*, Entry> entries_;
+};
@@ -0,0 +1,58 @@
+/*
+ * A fixed size queue for one producer thread and one consumer thread, without locks.
+ *
+ * Usage: One thread calls push(), another calls pop(). Neither ever waits: push() returns
+ *        false when the queue is full and pop() returns false when it is empty. The head and
+ *        the tail are atomic counters, each written by one thread only, and on separate
+ *        cache lines so the two threads do not slow each other down.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+template <class T>
+class SpscQueue {
+public:
+    /* Constructor: room for 'capacity' elements */
+    explicit SpscQueue(size_t capacity) : items_(capacity + 1), head_(0), tail_(0) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Add an element at the tail. False if the queue is full. Producer thread only.
+    bool push(const T& item) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t next = (tail + 1 == items_.size()) ? 0 : tail + 1;
+        if (next == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        items_[tail] = item;
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Remove the element at the head into 'item'. False if the queue is empty. Consumer only.
+    bool pop(T& item) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items_[head];
+        head_.store((head + 1 == items_.size()) ? 0 : head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // True if there is nothing to pop, at the moment of the call. Any thread.
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> items_;  // One more than the capacity, so that full and empty differ
+    alignas(64) std::atomic<size_t> head_;  // Next element to pop
+    alignas(64) std::atomic<size_t> tail_;  // Next free element to push into
+};
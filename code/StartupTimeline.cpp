@@ -0,0 +1,81 @@
+/*
+ * A timeline of the phases of program startup
+ *
+ * This code is in the public domain.
+ */
+#include "StartupTimeline.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+StartupTimeline::StartupTimeline() : start_(Clock::now()) {
+    threads_.push_back(std::this_thread::get_id());
+}
+
+int StartupTimeline::begin(const char* name) {
+    const double now = elapsed();
+    std::lock_guard<std::mutex> lock(mutex_);
+    phases_.push_back({name, now, -1.0, threadNumber()});
+    return static_cast<int>(phases_.size() - 1);
+}
+
+void StartupTimeline::end(int phase) {
+    const double now = elapsed();
+    std::lock_guard<std::mutex> lock(mutex_);
+    phases_[static_cast<size_t>(phase)].end = now;
+}
+
+void StartupTimeline::mark(const char* name) {
+    const double now = elapsed();
+    std::lock_guard<std::mutex> lock(mutex_);
+    phases_.push_back({name, now, now, threadNumber()});
+}
+
+double StartupTimeline::elapsed() const {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start_).count();
+}
+
+int StartupTimeline::threadNumber() {
+    const std::thread::id id = std::this_thread::get_id();
+    auto found = std::find(threads_.begin(), threads_.end(), id);
+    if (found == threads_.end()) {
+        threads_.push_back(id);
+        found = threads_.end() - 1;
+    }
+    return static_cast<int>(found - threads_.begin());
+}
+
+void StartupTimeline::print(std::ostream& out) const {
+    std::vector<Phase> phases;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        phases = phases_;
+    }
+    std::stable_sort(phases.begin(), phases.end(),
+                     [](const Phase& a, const Phase& b) { return a.start < b.start; });
+    const double now = elapsed();
+    double total = 0.0;
+    for (Phase& phase : phases) {
+        if (phase.end < 0.0) {
+            phase.end = now;  // Still running
+        }
+        total = std::max(total, phase.end);
+    }
+
+    // Bars of up to 'columns' characters for the whole timeline
+    const int columns = 40;
+    const double scale = total > 0.0 ? columns / total : 0.0;
+    char line[160];
+    out << "Startup timeline      start (ms)  time (ms)  thread\n";
+    for (const Phase& phase : phases) {
+        const int first = std::min(static_cast<int>(phase.start * scale), columns - 1);
+        const int last = std::min(static_cast<int>(phase.end * scale), columns);
+        const std::string bar(static_cast<size_t>(std::max(last - first, 1)),
+                              phase.end > phase.start ? '#' : '|');
+        std::snprintf(line, sizeof(line), "  %-20s %9.1f %10.1f %7d  %*s%s\n", phase.name,
+                      phase.start, phase.end - phase.start, phase.thread, first, "",
+                      bar.c_str());
+        out << line;
+    }
+}
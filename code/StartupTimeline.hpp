@@ -0,0 +1,72 @@
+/*
+ * A timeline of the phases of program startup, to see where the time to the first frame goes.
+ *
+ * Usage: Create one timeline as the first thing in main(), which is time 0. Wrap each step
+ *        of the startup in begin() and end(), or in a StartupPhase object, on any thread.
+ *        mark() notes a moment, like the first frame on the screen. print() lists the
+ *        phases by their start, with the time they started, how long they took and the
+ *        thread they ran on, and a bar for each phase, so that steps that overlap other
+ *        steps on other threads stand out.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+class StartupTimeline {
+public:
+    /* Constructor: time 0 of the timeline is now */
+    StartupTimeline();
+
+    // Start a phase on the calling thread, and return its number for end().
+    // 'name' must stay valid (a literal).
+    int begin(const char* name);
+    void end(int phase);
+
+    // A phase of no duration
+    void mark(const char* name);
+
+    // Milliseconds since the timeline was created
+    double elapsed() const;
+
+    // Print the phases in the order they started
+    void print(std::ostream& out) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Phase {
+        const char* name;
+        double start;  // Milliseconds
+        double end;    // Milliseconds, negative while the phase runs
+        int thread;    // 0 for the thread that created the timeline, then in order of use
+    };
+
+    // Number of the calling thread. mutex_ must be locked.
+    int threadNumber();
+
+    Clock::time_point start_;
+    std::vector<Phase> phases_;
+    std::vector<std::thread::id> threads_;
+    mutable std::mutex mutex_;
+};
+
+/* A phase from construction to destruction */
+class StartupPhase {
+public:
+    StartupPhase(StartupTimeline& timeline, const char* name)
+        : timeline_(timeline), phase_(timeline.begin(name)) {}
+    ~StartupPhase() { timeline_.end(phase_); }
+
+    StartupPhase(const StartupPhase&) = delete;
+    StartupPhase& operator=(const StartupPhase&) = delete;
+
+private:
+    StartupTimeline& timeline_;
+    int phase_;
+};
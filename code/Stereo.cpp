@@ -0,0 +1,204 @@
+/*
+ * Stereo rendering of both eyes with one submission of the draws
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "Stereo.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "Frustum.hpp"
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "TriangleSoup.hpp"
+#include "UniformBuffers.hpp"
+
+Stereo::Stereo(bool onepass)
+    : mode_(Mode::Sequential)
+    , data_()
+    , offsets_()
+    , framebuffer_(0)
+    , readframebuffer_(0)
+    , color_(0)
+    , depth_(0)
+    , width_(0)
+    , height_(0)
+    , target_(0) {
+    if (onepass && GLEW_OVR_multiview) {
+        mode_ = Mode::Multiview;
+    } else if (onepass && GLEW_ARB_shader_viewport_layer_array) {
+        mode_ = Mode::Layers;
+    }
+    for (int i = 0; i < MultiView::maxViews; i++) {
+        data_.P[i] = Mat4::identity();
+        data_.offset[i] = Mat4::identity();
+    }
+}
+
+Stereo::~Stereo() {
+    if (color_ != 0) {
+        glstate::deleteTextures(1, &color_);
+        glstate::deleteTextures(1, &depth_);
+        glDeleteFramebuffers(1, &framebuffer_);
+        glDeleteFramebuffers(1, &readframebuffer_);
+    }
+}
+
+Stereo::Mode Stereo::mode() const { return mode_; }
+
+const char* Stereo::modeName(Mode mode) {
+    switch (mode) {
+    case Mode::Multiview:
+        return "multiview";
+    case Mode::Layers:
+        return "layers";
+    default:
+        return "sequential";
+    }
+}
+
+std::string Stereo::defines() const {
+    switch (mode_) {
+    case Mode::Multiview:
+        return " MULTI_VIEW MULTI_VIEW_OVR=2";
+    case Mode::Layers:
+        return " MULTI_VIEW MULTI_VIEW_LAYERS";
+    default:
+        return " MULTI_VIEW";
+    }
+}
+
+void Stereo::setEyes(const Mat4& P, float separation, float convergence, int width,
+                     int height) {
+    for (int eye = 0; eye < eyes; eye++) {
+        // The eye at x = e sees the view space moved by -e, and its frustum is sheared so
+        // that x at the convergence distance is where the view of the frame has it
+        const float e = (eye == 0 ? -0.5f : 0.5f) * separation;
+        Mat4 eyeP = P;
+        eyeP.m[8] -= P.m[0] * e / std::max(convergence, 1e-3f);
+        data_.P[eye] = eyeP;
+        data_.offset[eye] = Mat4::translation(-e, 0.0f, 0.0f);
+    }
+    if (width != width_ || height != height_) {
+        create(width, height);
+    }
+}
+
+bool Stereo::create(int width, int height) {
+    width_ = std::max(width, 1);
+    height_ = std::max(height, 1);
+    if (color_ == 0) {
+        glGenTextures(1, &color_);
+        glGenTextures(1, &depth_);
+        glGenFramebuffers(1, &framebuffer_);
+        glGenFramebuffers(1, &readframebuffer_);
+    }
+    glstate::bindTexture(GL_TEXTURE_2D_ARRAY, color_);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width_, height_, eyes, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+    gpumem::setTexture(color_, gpumem::Category::RenderTarget,
+                       gpumem::textureBytes(GL_RGBA8, width_, height_, eyes));
+    glstate::bindTexture(GL_TEXTURE_2D_ARRAY, depth_);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, width_, height_, eyes, 0,
+                 GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+    gpumem::setTexture(depth_, gpumem::Category::RenderTarget,
+                       gpumem::textureBytes(GL_DEPTH_COMPONENT24, width_, height_, eyes));
+    glstate::bindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // Both layers at once, in the way of the mode. Mode::Sequential attaches one layer
+    // per pass instead.
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    if (mode_ == Mode::Multiview) {
+        glFramebufferTextureMultiviewOVR(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_, 0, 0,
+                                         eyes);
+        glFramebufferTextureMultiviewOVR(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_, 0, 0,
+                                         eyes);
+    } else if (mode_ == Mode::Layers) {
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_, 0);
+    } else {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_, 0, 0);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_, 0, 0);
+    }
+    const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Stereo: the " << modeName(mode_)
+                  << " framebuffer is not complete (status 0x" << std::hex << status
+                  << std::dec << ")\n";
+        return false;
+    }
+    return true;
+}
+
+void Stereo::push(UniformRing& uniforms) {
+    if (mode_ != Mode::Sequential) {
+        data_.count = eyes;
+        data_.first = 0;
+        offsets_[0] = uniforms.push(data_);
+        return;
+    }
+    for (int eye = 0; eye < eyes; eye++) {
+        data_.count = 1;
+        data_.first = eye;
+        offsets_[eye] = uniforms.push(data_);
+    }
+}
+
+int Stereo::passes() const { return (mode_ == Mode::Sequential) ? eyes : 1; }
+
+void Stereo::beginPass(int pass, const UniformRing& uniforms, const float clearcolor[4]) {
+    if (pass == 0) {
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target_);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+    if (mode_ == Mode::Sequential) {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_, 0, pass);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_, 0, pass);
+    }
+    glViewport(0, 0, width_, height_);
+    // A clear of a layered or multiview framebuffer clears all of its layers
+    glClearColor(clearcolor[0], clearcolor[1], clearcolor[2], clearcolor[3]);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    uniforms.bind(viewBlockBinding, offsets_[pass], sizeof(ViewUniforms));
+    if (mode_ == Mode::Layers) {
+        TriangleSoup::setViewInstances(eyes);
+    }
+}
+
+void Stereo::end(int width, int height) {
+    TriangleSoup::setViewInstances(1);
+    // Each layer in its half, scaled to it
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, static_cast<GLuint>(target_));
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readframebuffer_);
+    for (int eye = 0; eye < eyes; eye++) {
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_, 0, eye);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        const int x0 = width * eye / eyes;
+        const int x1 = width * (eye + 1) / eyes;
+        glBlitFramebuffer(0, 0, width_, height_, x0, 0, x1, height, GL_COLOR_BUFFER_BIT,
+                          GL_LINEAR);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(target_));
+    glViewport(0, 0, width, height);
+}
+
+bool Stereo::visible(const Mat4& MV, const mesh::Bounds& bounds) const {
+    for (int eye = 0; eye < eyes; eye++) {
+        if (Frustum::fromMatrix(data_.P[eye] * data_.offset[eye] * MV).intersects(bounds)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+GLuint Stereo::texture() const { return color_; }
@@ -0,0 +1,105 @@
+/*
+ * Stereo rendering of both eyes with one submission of the draws, for stereo displays and
+ * VR: the eyes are the two layers of a layered render target, and the vertex shader puts
+ * each draw in both.
+ *
+ * Usage: Every frame, setEyes() with the size of the image of each eye, which (re)creates
+ *        the target, the projection of such an image from the view of the frame, and the
+ *        distance between the eyes and the distance at which they converge, in the units of
+ *        the view space. Build the shaders
+ *        that draw the eyes with defines(), the MULTI_VIEW variants of vertex.glsl
+ *        (views.glsl), push() the eyes into the UniformRing before its upload(), and draw the
+ *        scene once for each pass in passes(), after beginPass(). end() then shows the eyes
+ *        side by side in the framebuffer that was bound before, the left eye on the left,
+ *        as stereo displays take them. texture() is the GL_TEXTURE_2D_ARRAY of the eyes, for
+ *        displays that take them some other way.
+ *        With GL_OVR_multiview (Mode::Multiview), the target is a multiview framebuffer, and
+ *        the driver runs the vertex shader of each draw for both eyes, with gl_ViewID_OVR.
+ *        Otherwise, with GL_ARB_shader_viewport_layer_array (Mode::Layers), the target is
+ *        layered, beginPass() makes TriangleSoup::render() and renderDepth() draw two
+ *        instances, and the vertex shader sends instance i to layer i with gl_Layer.
+ *        Without either, or with a geometry shader, which neither works with, each eye is a
+ *        pass of its own into its layer (Mode::Sequential).
+ *        The eyes look in parallel, offset sideways by half the distance between them, each
+ *        with an asymmetric frustum that meets the other at the convergence distance, so
+ *        that what is there is in the plane of the display. The shading is that of the
+ *        view of the frame, only the positions are the eye's.
+ *        Cull with visible(), which tests a mesh against the frustums of both eyes.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstddef>
+#include <string>
+
+#include "Mat4.hpp"
+#include "MeshProcessing.hpp"
+#include "MultiView.hpp"
+
+class UniformRing;
+
+class Stereo {
+public:
+    enum class Mode { Multiview, Layers, Sequential };
+
+    static constexpr int eyes = 2;
+
+    /* Constructor: both eyes in one pass if the GL context can and 'onepass' is true, which
+     * it is not with a geometry shader. The target is created by setEyes(). */
+    explicit Stereo(bool onepass = true);
+
+    /* Destructor: delete the target */
+    ~Stereo();
+
+    Stereo(const Stereo&) = delete;
+    Stereo& operator=(const Stereo&) = delete;
+
+    Mode mode() const;
+
+    // "multiview", "layers" or "sequential"
+    static const char* modeName(Mode mode);
+
+    // The defines of the shader variants that draw the eyes
+    std::string defines() const;
+
+    /* Set the eyes for images of 'width' x 'height' and the projection P of an image of
+     * that size from the view of the frame, 'separation' apart, converging at 'convergence'
+     * in front of the view */
+    void setEyes(const Mat4& P, float separation, float convergence, int width, int height);
+
+    // Push the data of the eyes for this frame, before uniforms.upload()
+    void push(UniformRing& uniforms);
+
+    // The passes to draw the scene in, 1 unless Mode::Sequential
+    int passes() const;
+
+    // Bind the target and the eyes of 'pass', and clear what the pass draws to 'clearcolor'
+    void beginPass(int pass, const UniformRing& uniforms, const float clearcolor[4]);
+
+    // Draw once again, and show the eyes side by side in the framebuffer bound before the
+    // first pass, 'width' x 'height', which is also the viewport after
+    void end(int width, int height);
+
+    // Whether 'bounds', with the model-view matrix MV, may be seen by either eye
+    bool visible(const Mat4& MV, const mesh::Bounds& bounds) const;
+
+    // The images of the eyes, a GL_TEXTURE_2D_ARRAY of 2 layers, 0 before setEyes()
+    GLuint texture() const;
+
+private:
+    // (Re)create the target for images of 'width' x 'height'
+    bool create(int width, int height);
+
+    Mode mode_;
+    ViewUniforms data_;
+    ptrdiff_t offsets_[eyes];  // Of the pushed data of each pass
+    GLuint framebuffer_;
+    GLuint readframebuffer_;  // For end(), with one layer at a time
+    GLuint color_;            // 2D array textures of 2 layers
+    GLuint depth_;
+    int width_;
+    int height_;
+    GLint target_;  // The framebuffer bound before the first pass
+};
@@ -0,0 +1,136 @@
+/*
+ * A ring buffer for data that is streamed to the GPU every frame
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "StreamBuffer.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "GpuMemory.hpp"
+
+StreamBuffer::StreamBuffer(size_t framebytes, int numframes)
+    : framebytes_(framebytes)
+    , numframes_(std::max(numframes, 1))
+    , frame_(-1)
+    , buffer_(0)
+    , persistent_(false)
+    , mapped_(nullptr)
+    , mappedoffset_(0)
+    , used_(0)
+    , fences_(numframes_, nullptr) {}
+
+StreamBuffer::~StreamBuffer() {
+    for (void* fence : fences_) {
+        if (fence) {
+            glDeleteSync(static_cast<GLsync>(fence));
+        }
+    }
+    if (glIsBuffer(buffer_)) {
+        if (mapped_) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+        gpumem::deleteBuffers(1, &buffer_);
+    }
+}
+
+void StreamBuffer::createBuffer() {
+    // Regions start at multiples of 256 bytes, which suits any use of the buffer
+    framebytes_ = (framebytes_ + 255) / 256 * 256;
+    const size_t totalbytes = framebytes_ * numframes_;
+    glGenBuffers(1, &buffer_);
+    // GL_COPY_WRITE_BUFFER does not disturb the bindings of a VAO
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+    persistent_ = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+    if (persistent_) {
+        // Coherent, so writes are seen by the GPU without explicit flushes
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, totalbytes, nullptr, flags);
+        mapped_ = static_cast<unsigned char*>(
+            glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, totalbytes, flags));
+        mappedoffset_ = 0;
+        if (!mapped_) {
+            std::cerr << "StreamBuffer: persistent mapping failed\n";
+        }
+    } else {
+        glBufferData(GL_COPY_WRITE_BUFFER, totalbytes, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    gpumem::setBuffer(buffer_, gpumem::Category::Buffer, totalbytes);
+}
+
+void StreamBuffer::beginFrame() {
+    if (buffer_ == 0) {
+        createBuffer();
+    }
+    flush();
+    // The commands using the previous region have been issued; fence them
+    if (frame_ >= 0) {
+        fences_[frame_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    frame_ = (frame_ + 1) % numframes_;
+
+    // Normally the GPU finished with this region long ago, and this does not wait
+    if (fences_[frame_]) {
+        GLsync fence = static_cast<GLsync>(fences_[frame_]);
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (status == GL_TIMEOUT_EXPIRED) {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);  // 1 ms
+        }
+        glDeleteSync(fence);
+        fences_[frame_] = nullptr;
+    }
+    used_ = 0;
+}
+
+void* StreamBuffer::allocate(size_t bytes, ptrdiff_t& offset, size_t alignment) {
+    if (frame_ < 0) {
+        beginFrame();
+    }
+    alignment = std::max<size_t>(alignment, 1);
+    const size_t regionstart = frame_ * framebytes_;
+    const size_t start = (regionstart + used_ + alignment - 1) / alignment * alignment;
+    if (start + bytes > regionstart + framebytes_) {
+        std::cerr << "StreamBuffer::allocate(): more than " << framebytes_
+                  << " bytes of data in one frame\n";
+        return nullptr;
+    }
+    if (!mapped_ && !persistent_) {
+        // The fence guarantees that the GPU is done with this region, so the driver does not
+        // need to synchronize, and the old content of the rest of the region is not needed
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+        mapped_ = static_cast<unsigned char*>(glMapBufferRange(
+            GL_COPY_WRITE_BUFFER, start, regionstart + framebytes_ - start,
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT));
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        mappedoffset_ = start;
+    }
+    if (!mapped_) {
+        return nullptr;
+    }
+    used_ = start + bytes - regionstart;
+    offset = static_cast<ptrdiff_t>(start);
+    return mapped_ + (start - mappedoffset_);
+}
+
+void StreamBuffer::flush() {
+    if (persistent_ || !mapped_) {
+        return;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_);
+    if (glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_FALSE) {
+        // The buffer content was lost (rare, e.g. on a display mode change)
+        std::cerr << "StreamBuffer::flush(): streamed data was corrupted\n";
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    mapped_ = nullptr;
+}
+
+GLuint StreamBuffer::id() const { return buffer_; }
+
+bool StreamBuffer::persistent() const { return persistent_; }
@@ -0,0 +1,63 @@
+/*
+ * A buffer for data that is written by the CPU every frame, like deforming meshes or
+ * particles.
+ *
+ * Usage: Call beginFrame() once per frame, allocate() room for the data of the frame and
+ *        write it through the returned pointer, then call flush() before the draw calls
+ *        that read it. The buffer is divided into one region per frame in flight, and a
+ *        fence per region makes sure a region is not written while the GPU may still read
+ *        it. With OpenGL 4.4 or ARB_buffer_storage, the buffer is mapped once, persistently,
+ *        and flush() does nothing. Otherwise each region is mapped unsynchronized.
+ *        TriangleSoup::setVertexStream() draws a mesh with vertices from the buffer.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstddef>
+#include <vector>
+
+class StreamBuffer {
+public:
+    /* Constructor: 'framebytes' of data per frame, for 'numframes' frames in flight.
+     * The buffer is created when it is first used. */
+    explicit StreamBuffer(size_t framebytes, int numframes = 3);
+
+    /* Destructor: unmap and delete the buffer, and delete the fences */
+    ~StreamBuffer();
+
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+    // Move to the next region. Waits only if the GPU is still using it, numframes frames later.
+    void beginFrame();
+
+    // Make room for 'bytes' of data in this frame's region and return a pointer to write it
+    // to. 'offset' receives its offset in the buffer, for glVertexAttribPointer() and the
+    // like. Returns nullptr if the region is full.
+    void* allocate(size_t bytes, ptrdiff_t& offset, size_t alignment = 16);
+
+    // Make the data written since the last flush() visible to the GPU
+    void flush();
+
+    // The buffer ID
+    GLuint id() const;
+
+    // True if the buffer is persistently mapped
+    bool persistent() const;
+
+private:
+    void createBuffer();
+
+    size_t framebytes_;          // Size of the region of each frame
+    int numframes_;              // Number of regions
+    int frame_;                  // Region of the current frame, -1 before the first
+    GLuint buffer_;              // The buffer
+    bool persistent_;            // Mapped once with GL_MAP_PERSISTENT_BIT
+    unsigned char* mapped_;      // Start of the mapped range, or nullptr when not mapped
+    size_t mappedoffset_;        // Offset of mapped_ in the buffer
+    size_t used_;                // Bytes allocated in the current region
+    std::vector<void*> fences_;  // GLsync objects, signalled when the GPU is done with
+                                 // each region
+};
@@ -0,0 +1,308 @@
+/*
+ * CDLOD terrain: quadtree selection on the CPU, one instanced grid for all patches
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "Terrain.hpp"
+
+#include "Frustum.hpp"
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "Mat4.hpp"
+#include "Shader.hpp"
+#include "Texture.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Where the morph of a level starts, as a part of its range. A patch of the next finer level
+// is within half of the range, and its diagonal is at most a fifth of the range
+// (setLODDistance()), so the vertices that it shares with this level are never moved.
+const float morphStart = 0.75f;
+
+}  // namespace
+
+Terrain::Terrain(int gridsize, int levels)
+    : gridsize_(std::clamp((gridsize + 3) / 4 * 4, 4, 252)), levels_(std::clamp(levels, 1, 16)),
+      size_{1.0f, 1.0f, 1.0f}, heightmap_(nullptr), lodDistance_(0.0f), camera_{0.0f, 0.0f, 0.0f},
+      vao_(0), indexbuffer_(0), instancebuffer_(0), ninstances_(0) {
+    setLODDistance(0.0f);
+}
+
+Terrain::~Terrain() {
+    if (vao_ != 0) {
+        const GLuint buffers[2] = {indexbuffer_, instancebuffer_};
+        gpumem::deleteBuffers(2, buffers);
+        glstate::deleteVertexArrays(1, &vao_);
+    }
+}
+
+void Terrain::setSize(float width, float depth, float heightscale) {
+    size_[0] = std::max(width, 1e-6f);
+    size_[1] = std::max(depth, 1e-6f);
+    size_[2] = heightscale;
+    setLODDistance(lodDistance_);
+}
+
+void Terrain::setHeightmap(const Texture* heightmap) { heightmap_ = heightmap; }
+
+/* Keep the lowest and highest height of every node, from the texels that its bilinear
+ * heights are interpolated from */
+void Terrain::setHeights(const float* heights, int width, int height) {
+    heightranges_.assign(levels_, std::vector<float>());
+    if (heights == nullptr || width < 2 || height < 2) {
+        heightranges_.clear();
+        return;
+    }
+    const int finest = 1 << (levels_ - 1);
+    std::vector<float>& nodes = heightranges_[0];
+    nodes.resize(2 * size_t(finest) * size_t(finest));
+    for (int y = 0; y < finest; y++) {
+        const int row0 = y * (height - 1) / finest;
+        const int row1 = std::min(((y + 1) * (height - 1) + finest - 1) / finest, height - 1);
+        for (int x = 0; x < finest; x++) {
+            const int column0 = x * (width - 1) / finest;
+            const int column1 =
+                std::min(((x + 1) * (width - 1) + finest - 1) / finest, width - 1);
+            float low = heights[size_t(row0) * width + column0];
+            float high = low;
+            for (int row = row0; row <= row1; row++) {
+                for (int column = column0; column <= column1; column++) {
+                    const float h = heights[size_t(row) * width + column];
+                    low = std::min(low, h);
+                    high = std::max(high, h);
+                }
+            }
+            nodes[2 * (size_t(y) * finest + x)] = low;
+            nodes[2 * (size_t(y) * finest + x) + 1] = high;
+        }
+    }
+    // Each coarser node from its four children
+    for (int level = 1; level < levels_; level++) {
+        const int count = finest >> level;
+        const std::vector<float>& children = heightranges_[level - 1];
+        std::vector<float>& parents = heightranges_[level];
+        parents.resize(2 * size_t(count) * size_t(count));
+        for (int y = 0; y < count; y++) {
+            for (int x = 0; x < count; x++) {
+                float low = children[2 * (size_t(2 * y) * (2 * count) + 2 * x)];
+                float high = low;
+                for (int child = 0; child < 4; child++) {
+                    const size_t index = size_t(2 * y + (child >> 1)) * (2 * count) +
+                                         size_t(2 * x + (child & 1));
+                    low = std::min(low, children[2 * index]);
+                    high = std::max(high, children[2 * index + 1]);
+                }
+                parents[2 * (size_t(y) * count + x)] = low;
+                parents[2 * (size_t(y) * count + x) + 1] = high;
+            }
+        }
+    }
+}
+
+void Terrain::setLODDistance(float distance) {
+    // The diagonal of the smallest node, with its height
+    const int finest = 1 << (levels_ - 1);
+    const float dx = size_[0] / float(finest);
+    const float dy = size_[1] / float(finest);
+    const float diagonal = std::sqrt(dx * dx + dy * dy + size_[2] * size_[2]);
+    lodDistance_ = std::max(distance, 2.5f * diagonal);
+    lodranges_.resize(levels_);
+    for (int level = 0; level < levels_; level++) {
+        lodranges_[level] = lodDistance_ * float(1 << level);
+    }
+}
+
+float Terrain::lodRange(int level) const {
+    return lodranges_[std::clamp(level, 0, levels_ - 1)];
+}
+
+int Terrain::select(const Mat4& P, const Mat4& MV) {
+    for (std::vector<Patch>& patches : patches_) {
+        patches.clear();
+    }
+    // The camera is at the origin of the view
+    const Mat4 inverse = affineInverse(MV);
+    camera_[0] = inverse.m[12];
+    camera_[1] = inverse.m[13];
+    camera_[2] = inverse.m[14];
+    const Frustum frustum = Frustum::fromMatrix(P * MV);
+    if (!selectNode(frustum, levels_ - 1, 0, 0)) {
+        // Beyond the range of the coarsest level, but visible
+        patches_[0].push_back(patch(levels_ - 1, 0, 0));
+    }
+    return patchCount();
+}
+
+/* A node within the range of its level is split if it is also within the range of the next
+ * finer level, and its children that are not are drawn as quadrants of this node */
+bool Terrain::selectNode(const Frustum& frustum, int level, int x, int y) {
+    float min[3];
+    float max[3];
+    nodeBox(level, x, y, min, max);
+    if (!frustum.intersectsBox(min, max)) {
+        return true;  // Nothing to draw, and nothing for the parent to draw either
+    }
+    float distance2 = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        const float d = std::max({min[i] - camera_[i], camera_[i] - max[i], 0.0f});
+        distance2 += d * d;
+    }
+    const float distance = std::sqrt(distance2);
+    if (distance > lodranges_[level]) {
+        return false;
+    }
+    if (level == 0 || distance > lodranges_[level - 1]) {
+        patches_[0].push_back(patch(level, x, y));
+        return true;
+    }
+    for (int quadrant = 0; quadrant < 4; quadrant++) {
+        if (!selectNode(frustum, level - 1, 2 * x + (quadrant & 1), 2 * y + (quadrant >> 1))) {
+            patches_[1 + quadrant].push_back(patch(level, x, y));
+        }
+    }
+    return true;
+}
+
+Terrain::Patch Terrain::patch(int level, int x, int y) const {
+    const int count = 1 << (levels_ - 1 - level);
+    const float width = size_[0] / float(count);
+    const float depth = size_[1] / float(count);
+    Patch result;
+    result.rect[0] = -0.5f * size_[0] + float(x) * width;
+    result.rect[1] = -0.5f * size_[1] + float(y) * depth;
+    result.rect[2] = width;
+    result.rect[3] = depth;
+    result.morph[0] = morphStart * lodranges_[level];
+    result.morph[1] = lodranges_[level];
+    result.morph[2] = 0.0f;
+    result.morph[3] = 0.0f;
+    return result;
+}
+
+void Terrain::nodeBox(int level, int x, int y, float* min, float* max) const {
+    const Patch p = patch(level, x, y);
+    min[0] = p.rect[0];
+    min[1] = p.rect[1];
+    max[0] = p.rect[0] + p.rect[2];
+    max[1] = p.rect[1] + p.rect[3];
+    if (heightranges_.empty()) {
+        min[2] = std::min(size_[2], 0.0f);
+        max[2] = std::max(size_[2], 0.0f);
+    } else {
+        const int count = 1 << (levels_ - 1 - level);
+        const float* range = &heightranges_[level][2 * (size_t(y) * count + x)];
+        min[2] = std::min(range[0] * size_[2], range[1] * size_[2]);
+        max[2] = std::max(range[0] * size_[2], range[1] * size_[2]);
+    }
+}
+
+/* The grid as an index buffer only, with the quads of each quadrant together, and the
+ * patch attributes */
+void Terrain::createBuffers() {
+    const int n = gridsize_;
+    const int half = n / 2;
+    std::vector<GLushort> indices;
+    indices.reserve(6 * size_t(n) * size_t(n));
+    for (int quadrant = 0; quadrant < 4; quadrant++) {
+        const int x0 = (quadrant & 1) * half;
+        const int y0 = (quadrant >> 1) * half;
+        for (int y = y0; y < y0 + half; y++) {
+            for (int x = x0; x < x0 + half; x++) {
+                // Counterclockwise seen from +z, all split along the same diagonal, so
+                // that the odd vertices moved onto the even ones leave the coarser grid
+                const GLushort corner = static_cast<GLushort>(y * (n + 1) + x);
+                const GLushort right = static_cast<GLushort>(corner + 1);
+                const GLushort above = static_cast<GLushort>(corner + n + 1);
+                const GLushort diagonal = static_cast<GLushort>(above + 1);
+                indices.insert(indices.end(), {corner, right, diagonal, corner, diagonal, above});
+            }
+        }
+    }
+    glGenVertexArrays(1, &vao_);
+    glGenBuffers(1, &indexbuffer_);
+    glGenBuffers(1, &instancebuffer_);
+    glstate::bindVertexArray(vao_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer_);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(),
+                 GL_STATIC_DRAW);
+    gpumem::setBuffer(indexbuffer_, gpumem::Category::Mesh, indices.size() * sizeof(GLushort));
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer_);
+    for (GLuint location = 5; location <= 6; location++) {
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    }
+    glstate::bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+int Terrain::render(Shader& shader, int unit) {
+    const int count = patchCount();
+    if (count == 0) {
+        return 0;
+    }
+    if (vao_ == 0) {
+        createBuffers();
+    }
+    glstate::bindVertexArray(vao_);
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer_);
+    if (count > ninstances_) {
+        ninstances_ = std::max(count, 2 * ninstances_);
+        glBufferData(GL_ARRAY_BUFFER, size_t(ninstances_) * sizeof(Patch), nullptr,
+                     GL_DYNAMIC_DRAW);
+        gpumem::setBuffer(instancebuffer_, gpumem::Category::Mesh,
+                          size_t(ninstances_) * sizeof(Patch));
+    }
+    size_t offset = 0;
+    for (const std::vector<Patch>& patches : patches_) {
+        glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(Patch), patches.size() * sizeof(Patch),
+                        patches.data());
+        offset += patches.size();
+    }
+
+    shader.use();
+    glstate::activeTexture(GL_TEXTURE0 + unit);
+    glstate::bindTexture(GL_TEXTURE_2D, heightmap_ != nullptr ? heightmap_->id() : 0);
+    glstate::activeTexture(GL_TEXTURE0);
+    shader.setUniform("heightmap", unit);
+    shader.setUniform("terrainSize", size_[0], size_[1], size_[2], float(gridsize_));
+    shader.setUniform("cameraPosition", camera_[0], camera_[1], camera_[2]);
+
+    // The whole grid for whole patches, then a quarter of it for each quadrant. Without a
+    // base instance in OpenGL 3.3, the attributes point at the patches of each draw.
+    const GLsizei quads = gridsize_ * gridsize_;
+    int triangles = 0;
+    offset = 0;
+    for (int group = 0; group < 5; group++) {
+        const GLsizei instances = static_cast<GLsizei>(patches_[group].size());
+        if (instances > 0) {
+            const size_t first = offset * sizeof(Patch);
+            glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(Patch), (void*)first);
+            glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Patch),
+                                  (void*)(first + 4 * sizeof(GLfloat)));
+            const GLsizei indices = (group == 0) ? 6 * quads : 6 * quads / 4;
+            const size_t start = (group == 0) ? 0 : size_t(group - 1) * indices;
+            glDrawElementsInstanced(GL_TRIANGLES, indices, GL_UNSIGNED_SHORT,
+                                    (void*)(start * sizeof(GLushort)), instances);
+            triangles += instances * indices / 3;
+        }
+        offset += patches_[group].size();
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glstate::bindVertexArray(0);
+    return triangles;
+}
+
+int Terrain::patchCount() const {
+    size_t count = 0;
+    for (const std::vector<Patch>& patches : patches_) {
+        count += patches.size();
+    }
+    return static_cast<int>(count);
+}
+
+int Terrain::levels() const { return levels_; }
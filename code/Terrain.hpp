@@ -0,0 +1,112 @@
+/*
+ * Heightfield terrain with continuous distance-dependent level of detail (CDLOD, Strugar
+ * 2010): a quadtree of square patches, all drawn with one small grid that is instanced per
+ * patch, with the heights read from a heightmap texture in the vertex shader.
+ *
+ * Usage: Set the size of the terrain, which lies in the xy plane around the origin and
+ *        faces +z like the Heightfield of ProceduralGrid, and the heightmap, a Texture with
+ *        the heights from 0 to 1 in its red channel. The texture may be streamed with
+ *        Texture::createTextureAsync(), as its id() is read at every render(), and the
+ *        terrain is flat at half the height scale until it is ready.
+ *        Each frame, select() walks the quadtree with the projection and the model-view
+ *        matrix of the terrain, and render() draws the patches it chose with 'shader', which
+ *        must be vertex.glsl with TERRAIN defined, with the uniform blocks set for the
+ *        terrain as for TriangleSoup::render().
+ *        The finest level covers setLODDistance() units from the camera, and each coarser
+ *        level twice the distance of the one before. A node nearer than the range of its
+ *        level is split into its four children, and those children that are beyond the
+ *        range of theirs are drawn as quadrants of the parent, so that the patches of a
+ *        level have the same grid spacing everywhere. Nodes outside the view frustum are
+ *        skipped. The patches are drawn in at most five instanced draw calls, one for
+ *        whole patches and one for each quadrant, as ranges of one index buffer.
+ *        In the outer part of each range, vertex.glsl moves the odd vertices of the grid
+ *        onto the even ones, so that the patch has the grid of the next coarser level where
+ *        it meets it, and levels blend without seams or popping.
+ *        The grid has no vertex buffer: its vertices come from the index, gl_VertexID, and
+ *        each patch is two vec4 attributes per instance. The CPU only walks the quadtree.
+ *        The boxes of the nodes go from 0 to the height scale, unless setHeights() gives
+ *        the heights on the CPU too, e.g. from the same file as the heightmap, from which
+ *        the lowest and highest point of each node are kept for tighter boxes.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <vector>
+
+class Shader;
+class Texture;
+struct Frustum;
+struct Mat4;
+
+class Terrain {
+public:
+    /* Constructor: patches of 'gridsize' x 'gridsize' quads, rounded to a multiple of 4, in
+     * a quadtree of 'levels' levels. The GL objects are created by the first render(). */
+    explicit Terrain(int gridsize = 32, int levels = 8);
+
+    /* Destructor: delete the buffers and the vertex array */
+    ~Terrain();
+
+    Terrain(const Terrain&) = delete;
+    Terrain& operator=(const Terrain&) = delete;
+
+    // Width along x, depth along y, and the height of 1.0 in the heightmap. Default 1 x 1 x 1.
+    void setSize(float width, float depth, float heightscale);
+
+    // The heightmap texture, which must outlive the terrain or be set again
+    void setHeightmap(const Texture* heightmap);
+
+    /* Heights from 0 to 1 of a 'width' x 'height' heightmap, with the first row at the -y
+     * edge, for the boxes of the nodes. They are not kept. */
+    void setHeights(const float* heights, int width, int height);
+
+    /* Distance from the camera covered by the finest level. At least 2.5 times the diagonal
+     * of the smallest node, so that every patch meets only patches one level apart. */
+    void setLODDistance(float distance);
+
+    // The distance covered by a level, from 0 for the finest
+    float lodRange(int level) const;
+
+    /* Choose the patches to draw for the projection P and the model-view matrix MV of the
+     * terrain. Returns the number of patches. */
+    int select(const Mat4& P, const Mat4& MV);
+
+    /* Draw the patches of the last select() with 'shader', with the heightmap on texture
+     * unit 'unit'. Returns the number of triangles drawn. */
+    int render(Shader& shader, int unit = 1);
+
+    int patchCount() const;
+    int levels() const;
+
+private:
+    // A patch for vertex.glsl: the corner and the size of its node, and the distances where
+    // its morph starts and ends
+    struct Patch {
+        GLfloat rect[4];
+        GLfloat morph[4];
+    };
+
+    // Choose the patches of a node and its children. False if the node is beyond the range
+    // of its level, for the parent to draw.
+    bool selectNode(const Frustum& frustum, int level, int x, int y);
+    Patch patch(int level, int x, int y) const;
+    void nodeBox(int level, int x, int y, float* min, float* max) const;
+    void createBuffers();
+
+    int gridsize_;
+    int levels_;
+    float size_[3];
+    const Texture* heightmap_;
+    float lodDistance_;
+    float camera_[3];  // In the coordinates of the terrain, at the last select()
+    std::vector<float> lodranges_;
+    // The lowest and highest height of each node, per level from the finest
+    std::vector<std::vector<float>> heightranges_;
+    std::vector<Patch> patches_[5];  // Whole patches, and the quadrants
+    GLuint vao_;
+    GLuint indexbuffer_;
+    GLuint instancebuffer_;
+    int ninstances_;  // Capacity of instancebuffer_
+};
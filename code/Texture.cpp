@@ -1,5 +1,5 @@
 /*
- * OpenGL texture, and load texture data from a TGA file.
+ * OpenGL texture, and load texture data from a TGA, DDS or KTX file.
  *
  * Authors: Stefan Gustavson (stegu@itn.liu.se) 2014
  *          Martin Falk (martin.falk@liu.se) 2021
@@ -9,22 +9,248 @@
 #include <cstdio>   // For file I/O
 #include <cstring>  // For memcmp()
 #include <iostream>
-#include <fstream>
 #include <algorithm>
 #include <array>
+#include <functional>
+#include <utility>
+#include <cmath>
+#include <cstdint>
 
 #include <GL/glew.h>
 
 #include "Texture.hpp"
 
+#include "Arena.hpp"
+#include "GLDebug.hpp"
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "ImageDecoder.hpp"
+#include "MappedFile.hpp"
+#include "TextureStreamer.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+#include "Utilities.hpp"
+#include "VirtualFiles.hpp"
+
+#if !defined(TNM046_NO_SIMD) && (defined(__SSSE3__) || defined(__AVX__))
+#define TNM046_TEXTURE_SSSE3 1
+#include <immintrin.h>
+#elif !defined(TNM046_NO_SIMD) && (defined(__ARM_NEON) || defined(_M_ARM64))
+#define TNM046_TEXTURE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Bytes per 4x4 block of a compressed format, or 0 for unsupported formats
+GLsizei blockBytes(GLuint format) {
+    switch (format) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGB8_ETC2:
+        case GL_COMPRESSED_SRGB8_ETC2:
+        case GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+        case GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2:
+            return 8;
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+        case GL_COMPRESSED_RGBA8_ETC2_EAC:
+        case GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+// True if the OpenGL implementation can sample textures of a compressed format
+bool formatSupported(GLuint format) {
+    switch (format) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return GLEW_EXT_texture_compression_s3tc;
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+            return GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+            return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+        default:  // ETC2
+            return GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility;
+    }
+}
+
+// GL_RGB for compressed formats without alpha, GL_RGBA otherwise
+GLuint baseFormat(GLuint format) {
+    switch (format) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGB8_ETC2:
+        case GL_COMPRESSED_SRGB8_ETC2:
+            return GL_RGB;
+        default:
+            return GL_RGBA;
+    }
+}
+
+uint32_t readUint32(const char* bytes) {
+    uint32_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+// The first bytes of KTX version 1 files
+const std::array<char, 12> ktxIdentifier = {
+    {'\xAB', 'K', 'T', 'X', ' ', '1', '1', '\xBB', '\r', '\n', '\x1A', '\n'}};
+
+// Fixed fields of a DDS file, after the magic "DDS "
+const size_t ddsHeaderSize = 124;
+const uint32_t ddsFlagsTexture = 0x1007;  // Caps, height, width and pixel format are set
+const uint32_t ddsFlagMipmapCount = 0x20000;
+const uint32_t ddsFlagLinearSize = 0x80000;
+const uint32_t ddsPixelFlagAlpha = 0x1;
+const uint32_t ddsPixelFlagFourCC = 0x4;
+const uint32_t ddsPixelFlagRGB = 0x40;
+const uint32_t ddsCapsTexture = 0x1000;
+const uint32_t ddsCapsMipmap = 0x400008;  // Mipmapped, and complex (more than one surface)
+
+uint32_t fourCC(const char* code) { return readUint32(code); }
+
+// Tag in the reserved words of DDS files from Texture::bakeTGA(), followed by the size and
+// time stamp of the TGA file
+const uint32_t ddsBakedTag = 0x424d4e54;  // "TNMB"
+
+// Run fn(begin, end) over [0, count) in chunks, in parallel if there is a pool
+void parallelRows(ThreadPool* pool, int count, const std::function<void(int, int)>& fn) {
+    if (pool == nullptr || pool->size() <= 1) {
+        fn(0, count);
+        return;
+    }
+    const int chunks = std::min(count, 4 * static_cast<int>(pool->size()));
+    pool->parallelFor(chunks, [&](int chunk) {
+        fn(static_cast<int>(int64_t(count) * chunk / chunks),
+           static_cast<int>(int64_t(count) * (chunk + 1) / chunks));
+    });
+}
+
+// The source texels of a box filter from 'size' texels to 'newsize', with the part of each
+// texel covered by a new texel as its weight. New texels are at most 3 texels wide for
+// halved sizes, so they touch at most 4.
+struct BoxFilter {
+    std::vector<int> first;
+    std::vector<std::array<float, 4>> weights;
+
+    BoxFilter(int size, int newsize) : first(newsize), weights(newsize) {
+        const double scale = double(size) / newsize;
+        for (int i = 0; i < newsize; i++) {
+            const double begin = i * scale;
+            const double end = (i + 1) * scale;
+            first[i] = static_cast<int>(begin);
+            for (int k = 0; k < 4; k++) {
+                const double texel = first[i] + k;
+                const double covered = std::min(end, texel + 1.0) - std::max(begin, texel);
+                weights[i][k] = static_cast<float>(std::max(covered, 0.0) / scale);
+            }
+        }
+    }
+};
+
+// Filter one level of premultiplied linear RGBA to a level of half the size, rounded down.
+// Rows are filtered first into 'rows', then columns.
+void downsample(const std::vector<float>& level, int width, int height,
+                std::vector<float>& newlevel, int newwidth, int newheight, ThreadPool* pool) {
+    const BoxFilter horizontal(width, newwidth);
+    const BoxFilter vertical(height, newheight);
+    std::vector<float> rows(size_t(newwidth) * size_t(height) * 4);
+    parallelRows(pool, height, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            const float* in = &level[size_t(y) * size_t(width) * 4];
+            float* out = &rows[size_t(y) * size_t(newwidth) * 4];
+            for (int x = 0; x < newwidth; x++) {
+                float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                for (int k = 0; k < 4 && horizontal.first[x] + k < width; k++) {
+                    const float* texel = in + size_t(horizontal.first[x] + k) * 4;
+                    for (int c = 0; c < 4; c++) {
+                        sum[c] += horizontal.weights[x][k] * texel[c];
+                    }
+                }
+                std::copy(sum, sum + 4, out + size_t(x) * 4);
+            }
+        }
+    });
+    newlevel.assign(size_t(newwidth) * size_t(newheight) * 4, 0.0f);
+    parallelRows(pool, newheight, [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            float* out = &newlevel[size_t(y) * size_t(newwidth) * 4];
+            for (int k = 0; k < 4 && vertical.first[y] + k < height; k++) {
+                const float weight = vertical.weights[y][k];
+                const float* in = &rows[size_t(vertical.first[y] + k) * size_t(newwidth) * 4];
+                for (size_t i = 0; i < size_t(newwidth) * 4; i++) {
+                    out[i] += weight * in[i];
+                }
+            }
+        }
+    });
+}
+
+// sRGB encoding of linear values in [0, 1], to 8 bits
+GLubyte encodeSRGB(float linear) {
+    const double value = std::clamp(double(linear), 0.0, 1.0);
+    const double encoded =
+        (value <= 0.0031308) ? 12.92 * value : 1.055 * std::pow(value, 1.0 / 2.4) - 0.055;
+    return static_cast<GLubyte>(encoded * 255.0 + 0.5);
+}
+
+}  // namespace
+
 /* Constructor to load and intialize the texture all at once */
-Texture::Texture(const std::string& filename) : textureID_(0) { createTexture(filename); }
+Texture::Texture(const std::string& filename)
+    : textureID_(0), levels_(0), streamer_(nullptr) {
+    if (!filename.empty()) {
+        createTexture(filename);
+    }
+}
 
 /* Destructor */
-Texture::~Texture() {
-    if (textureID_ != 0) {
-        glDeleteTextures(1, &textureID_);
+Texture::~Texture() { release(); }
+
+/* Move constructor: take over the texture of 'other' */
+Texture::Texture(Texture&& other) noexcept : Texture() { *this = std::move(other); }
+
+/* Move assignment: delete this texture and take over the texture of 'other' */
+Texture& Texture::operator=(Texture&& other) noexcept {
+    if (this == &other) {
+        return *this;
+    }
+    release();
+    textureID_ = std::exchange(other.textureID_, 0);
+    image_ = std::move(other.image_);
+    other.image_ = {};
+    levels_ = std::exchange(other.levels_, 0);
+    streamer_ = std::exchange(other.streamer_, nullptr);
+    if (streamer_) {
+        streamer_->retarget(&other, this);  // The streamer hands the texture over to us
+    }
+    return *this;
+}
+
+void Texture::release() {
+    if (streamer_) {
+        streamer_->cancel(this);  // The ID is the placeholder of the streamer
+        streamer_ = nullptr;
+    } else if (textureID_ != 0) {
+        glstate::deleteTextures(1, &textureID_);
     }
+    textureID_ = 0;
 }
 
 GLuint Texture::id() const { return textureID_; }
@@ -35,47 +261,132 @@ GLuint Texture::height() const { return image_.height; }
 
 GLuint Texture::type() const { return image_.type; }
 
+GLuint Texture::internalFormat() const { return image_.internalformat; }
+
+int Texture::levels() const { return levels_; }
+
+bool Texture::pending() const { return streamer_ != nullptr; }
+
+bool Texture::ready() const { return streamer_ == nullptr && textureID_ != 0; }
+
 /*
- * Open and test the file to make sure it is a valid TGA file
- *
- * roughly based on NeHe's TGA loading code
+ * Swap red and blue of 'count' pixels, with 16 byte shuffles for the bulk of the pixels
  */
-Texture::ImageData Texture::loadUncompressedTGA(const std::string& filename) const {
-    std::ifstream in(filename, std::ios_base::in | std::ios_base::binary);
-
-    if (!in.is_open()) {
-        std::cerr << "Could not open texture file ('" << filename << "')\n";
-        return {};  // return an empty image
+void Texture::swapRedBlue(GLubyte* pixels, size_t count, int bytesperpixel) {
+    const size_t size = count * static_cast<size_t>(bytesperpixel);
+    size_t i = 0;
+#if defined(TNM046_TEXTURE_SSSE3)
+    if (bytesperpixel == 3) {
+        // 5 pixels, and one byte that is kept, per load. The next load starts at that byte.
+        const __m128i mask =
+            _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+        for (; i + 16 <= size; i += 15) {
+            __m128i* p = reinterpret_cast<__m128i*>(pixels + i);
+            _mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), mask));
+        }
+    } else {
+        const __m128i mask =
+            _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        for (; i + 16 <= size; i += 16) {
+            __m128i* p = reinterpret_cast<__m128i*>(pixels + i);
+            _mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), mask));
+        }
+    }
+#elif defined(TNM046_TEXTURE_NEON)
+    // 16 pixels per load, split into one register per channel
+    if (bytesperpixel == 3) {
+        for (; i + 48 <= size; i += 48) {
+            uint8x16x3_t rgb = vld3q_u8(pixels + i);
+            const uint8x16_t first = rgb.val[0];
+            rgb.val[0] = rgb.val[2];
+            rgb.val[2] = first;
+            vst3q_u8(pixels + i, rgb);
+        }
+    } else {
+        for (; i + 64 <= size; i += 64) {
+            uint8x16x4_t rgba = vld4q_u8(pixels + i);
+            const uint8x16_t first = rgba.val[0];
+            rgba.val[0] = rgba.val[2];
+            rgba.val[2] = first;
+            vst4q_u8(pixels + i, rgba);
+        }
+    }
+#endif
+    for (; i + 2 < size; i += static_cast<size_t>(bytesperpixel)) {
+        std::swap(pixels[i], pixels[i + 2]);
     }
+}
 
-    // Attempt to read 12 byte file header
-    std::array<char, 12> tgaheader;
+/*
+ * Decode RLE packets. Each packet starts with a byte that holds the number of pixels minus
+ * one in the low 7 bits. With the high bit set, one pixel follows that is repeated that many
+ * times, otherwise that many raw pixels follow.
+ */
+bool Texture::decodeRLE(const GLubyte* in, size_t size, size_t bytesperpixel, GLubyte* out,
+                        size_t count) {
+    const GLubyte* end = in + size;
+    GLubyte* const outend = out + count * bytesperpixel;
+    while (out < outend) {
+        if (in == end) {
+            return false;
+        }
+        const GLubyte packet = *in++;
+        const size_t pixels = static_cast<size_t>(packet & 0x7f) + 1;
+        const size_t bytes = pixels * bytesperpixel;
+        if (static_cast<size_t>(outend - out) < bytes) {
+            return false;
+        }
+        if (packet & 0x80) {
+            // A run: copy the pixel once, then double the copied part until the run is full
+            if (static_cast<size_t>(end - in) < bytesperpixel) {
+                return false;
+            }
+            std::memcpy(out, in, bytesperpixel);
+            in += bytesperpixel;
+            size_t copied = bytesperpixel;
+            while (copied < bytes) {
+                const size_t n = std::min(copied, bytes - copied);
+                std::memcpy(out + copied, out, n);
+                copied += n;
+            }
+        } else {
+            // Raw pixels
+            if (static_cast<size_t>(end - in) < bytes) {
+                return false;
+            }
+            std::memcpy(out, in, bytes);
+            in += bytes;
+        }
+        out += bytes;
+    }
+    return true;
+}
 
-    in.read(tgaheader.data(), sizeof(tgaheader));
-    if (in.fail()) {
+/*
+ * Open and test the file to make sure it is a valid TGA file
+ *
+ * roughly based on NeHe's TGA loading code
+ */
+Texture::ImageData Texture::loadTGA(const std::string& filename, const MappedFile& file,
+                                    Arena* arena) {
+    // 12 byte file header, followed by 6 useful bytes and the image data
+    const GLubyte* bytes = reinterpret_cast<const GLubyte*>(file.data());
+    if (file.size() < 18) {
         std::cerr << "Could not read file header ('" << filename << "')\n";
         return {};  // return an empty image
     }
 
     // headers for compressed and uncompressed TGAs
-    const std::array<char, 12> uncompressedTGA = {{0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
-    const std::array<char, 12> compressedTGA = {{0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
+    const std::array<GLubyte, 12> uncompressedTGA = {{0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
+    const std::array<GLubyte, 12> compressedTGA = {{0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
 
-    if (tgaheader == compressedTGA) {
-        std::cerr << "RLE compressed TGA files are not supported ('" << filename << "')\n";
-        return {};
-    } else if (tgaheader != uncompressedTGA) {
+    const bool compressed = std::memcmp(bytes, compressedTGA.data(), compressedTGA.size()) == 0;
+    if (!compressed && std::memcmp(bytes, uncompressedTGA.data(), uncompressedTGA.size()) != 0) {
         std::cerr << "Unsupported image file format ('" << filename << "')\n";
         return {};
     }
 
-    std::array<GLubyte, 6> header;  // First 6 useful bytes from the header
-    // std::ifstream::read() only reads 'char', thus we need a type cast for tga.header
-    in.read(reinterpret_cast<char*>(header.data()), sizeof(header));
-    if (in.fail()) {
-        std::cerr << "Could not read TGA header ('" << filename << "')\n";
-        return {};
-    }
+    const GLubyte* header = bytes + 12;  // First 6 useful bytes from the header
 
     ImageData image;
 
@@ -93,18 +404,21 @@ Texture::ImageData Texture::loadUncompressedTGA(const std::string& filename) con
     // Determine the bits per pixel
     const GLuint bpp = header[4];
     // Compute the number of BYTES per pixel
-    const GLuint bytesPerPixel = (bpp / 8);
+    const size_t bytesPerPixel = (bpp / 8);
     // Compute the total amount of memory needed
-    const GLuint imageSize = (bytesPerPixel * image.width * image.height);
+    const size_t imageSize = (bytesPerPixel * image.width * image.height);
 
+    // The pixels are stored as BGR(A), which OpenGL reads without conversion
     switch (bpp) {
         case 24:
             image.type = GL_RGB;
+            image.format = GL_BGR;
             std::cout << "Texture type is GL_RGB ('" << filename << "')\n";
             break;
         case 32:
             image.type = GL_RGBA;
-            std::cout << "Texture type is GL_RGB ('" << filename << "')\n";
+            image.format = GL_BGRA;
+            std::cout << "Texture type is GL_RGBA ('" << filename << "')\n";
             break;
         default:
             std::cerr << "Unsupported number of bits per pixel (" << bpp << ") ('" << filename
@@ -112,53 +426,658 @@ Texture::ImageData Texture::loadUncompressedTGA(const std::string& filename) con
             return {};
     }
 
-    image.data.resize(imageSize);  // Allocate memory for image data
+    if (compressed) {
+        // Allocate memory for the decoded image data
+        GLubyte* decoded = nullptr;
+        if (arena != nullptr) {
+            decoded = arena->allocate<GLubyte>(imageSize);
+        } else {
+            image.data.resize(imageSize);
+            decoded = image.data.data();
+        }
+        if (!decodeRLE(bytes + 18, file.size() - 18, bytesPerPixel, decoded,
+                       static_cast<size_t>(image.width) * image.height)) {
+            std::cerr << "Could not decode RLE image data ('" << filename << "')\n";
+            return {};
+        }
+        image.pixels = decoded;
+    } else {
+        if (file.size() - 18 < imageSize) {
+            std::cerr << "Could not read image data ('" << filename << "')\n";
+            return {};
+        }
+        image.pixels = bytes + 18;
+    }
+
+    return image;
+}
 
-    // Attempt to read image data
-    // std::ifstream::read() only reads 'char', thus we need a type cast for tga.header
-    in.read(reinterpret_cast<char*>(image.data.data()), imageSize);
-    if (in.gcount() != imageSize) {
-        std::cerr << "Could not read image data ('" << filename << "')\n";
+/*
+ * The levels of a texture from a DDS file, block compressed or with 8 bit BGR(A) pixels.
+ * Other uncompressed formats, cube maps, volumes and arrays are not supported.
+ */
+Texture::ImageData Texture::loadDDS(const std::string& filename, const MappedFile& file) {
+    const char* bytes = file.data();
+    size_t offset = 4 + ddsHeaderSize;
+    if (file.size() < offset || readUint32(bytes + 4) != ddsHeaderSize) {
+        std::cerr << "Could not read DDS header ('" << filename << "')\n";
         return {};
     }
+    const uint32_t flags = readUint32(bytes + 8);
+    const uint32_t height = readUint32(bytes + 12);
+    const uint32_t width = readUint32(bytes + 16);
+    const uint32_t mipmaps = readUint32(bytes + 28);
+    const uint32_t pixelflags = readUint32(bytes + 80);
+    const uint32_t code = readUint32(bytes + 84);
+    const uint32_t bitcount = readUint32(bytes + 88);
 
-    // Swap the BGR(A) byte order in the TGA file to the standard RGB(A) byte order for OpenGL.
-    for (size_t cswap = 0; cswap < imageSize; cswap += bytesPerPixel) {
-        std::swap(image.data[cswap], image.data[cswap + 2]);
+    GLuint format = 0;
+    size_t bytesperpixel = 0;  // Uncompressed pixels only
+    if (!(pixelflags & ddsPixelFlagFourCC)) {
+        // Uncompressed, with the red, green, blue and alpha masks of BGR(A) byte order
+        const bool alpha = (pixelflags & ddsPixelFlagAlpha) != 0;
+        if ((pixelflags & ddsPixelFlagRGB) && (bitcount == 24 || (bitcount == 32 && alpha)) &&
+            readUint32(bytes + 92) == 0xff0000 && readUint32(bytes + 96) == 0xff00 &&
+            readUint32(bytes + 100) == 0xff && (!alpha || readUint32(bytes + 104) == 0xff000000)) {
+            format = alpha ? GL_BGRA : GL_BGR;
+            bytesperpixel = bitcount / 8;
+        }
+    } else if (code == fourCC("DXT1")) {
+        format = (pixelflags & ddsPixelFlagAlpha) ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+                                                  : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    } else if (code == fourCC("DXT2") || code == fourCC("DXT3")) {
+        format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+    } else if (code == fourCC("DXT4") || code == fourCC("DXT5")) {
+        format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    } else if (code == fourCC("DX10")) {
+        // Extended header with a DXGI_FORMAT, and the resource dimension and array size
+        if (file.size() < offset + 20) {
+            std::cerr << "Could not read DDS header ('" << filename << "')\n";
+            return {};
+        }
+        const uint32_t dxgiformat = readUint32(bytes + offset);
+        const uint32_t arraysize = readUint32(bytes + offset + 12);
+        offset += 20;
+        switch (dxgiformat) {
+            case 70:  // DXGI_FORMAT_BC1_TYPELESS
+            case 71:  // DXGI_FORMAT_BC1_UNORM
+                format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+                break;
+            case 72:  // DXGI_FORMAT_BC1_UNORM_SRGB
+                format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT;
+                break;
+            case 73:  // DXGI_FORMAT_BC2_TYPELESS
+            case 74:  // DXGI_FORMAT_BC2_UNORM
+                format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+                break;
+            case 75:  // DXGI_FORMAT_BC2_UNORM_SRGB
+                format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT;
+                break;
+            case 76:  // DXGI_FORMAT_BC3_TYPELESS
+            case 77:  // DXGI_FORMAT_BC3_UNORM
+                format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+                break;
+            case 78:  // DXGI_FORMAT_BC3_UNORM_SRGB
+                format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+                break;
+            case 97:  // DXGI_FORMAT_BC7_TYPELESS
+            case 98:  // DXGI_FORMAT_BC7_UNORM
+                format = GL_COMPRESSED_RGBA_BPTC_UNORM;
+                break;
+            case 99:  // DXGI_FORMAT_BC7_UNORM_SRGB
+                format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+                break;
+            default:
+                format = 0;
+        }
+        if (arraysize > 1) {
+            format = 0;
+        }
+    }
+    if (format == 0) {
+        std::cerr << "Unsupported DDS pixel format ('" << filename << "')\n";
+        return {};
     }
 
+    ImageData image;
+    image.width = width;
+    image.height = height;
+    if (bytesperpixel > 0) {
+        image.type = (format == GL_BGRA) ? GL_RGBA : GL_RGB;
+        image.format = format;
+    } else {
+        image.type = baseFormat(format);
+        image.internalformat = format;
+    }
+    const uint32_t levels = (flags & ddsFlagMipmapCount) ? std::max(mipmaps, 1u) : 1u;
+    const GLsizei blockbytes = blockBytes(format);
+    for (uint32_t level = 0; level < levels; level++) {
+        ImageData::Level mip;
+        mip.width = static_cast<GLsizei>(std::max(width >> level, 1u));
+        mip.height = static_cast<GLsizei>(std::max(height >> level, 1u));
+        if (bytesperpixel > 0) {
+            mip.size = mip.width * mip.height * static_cast<GLsizei>(bytesperpixel);
+        } else {
+            mip.size = ((mip.width + 3) / 4) * ((mip.height + 3) / 4) * blockbytes;
+        }
+        if (width == 0 || height == 0 || offset > file.size() ||
+            file.size() - offset < static_cast<size_t>(mip.size)) {
+            std::cerr << "Could not read DDS image data ('" << filename << "')\n";
+            return {};
+        }
+        mip.data = reinterpret_cast<const GLubyte*>(bytes + offset);
+        image.levels.push_back(mip);
+        offset += static_cast<size_t>(mip.size);
+    }
     return image;
 }
 
 /*
- * Load and activate a 2D texture from a TGA file
+ * The levels of a block compressed texture from a KTX version 1 file. The file gives the
+ * OpenGL internal format directly. Uncompressed data, cube maps and arrays are not supported.
  */
-void Texture::createTexture(const std::string& filename) {
-    image_ = loadUncompressedTGA(filename);
+Texture::ImageData Texture::loadKTX(const std::string& filename, const MappedFile& file) {
+    const char* bytes = file.data();
+    size_t offset = 64;  // Identifier and 13 fields of 4 bytes
+    if (file.size() < offset || readUint32(bytes + 12) != 0x04030201) {
+        std::cerr << "Could not read KTX header ('" << filename << "')\n";
+        return {};
+    }
+    const uint32_t gltype = readUint32(bytes + 16);
+    const uint32_t format = readUint32(bytes + 28);
+    const uint32_t width = readUint32(bytes + 36);
+    const uint32_t height = readUint32(bytes + 40);
+    const uint32_t depth = readUint32(bytes + 44);
+    const uint32_t elements = readUint32(bytes + 48);
+    const uint32_t faces = readUint32(bytes + 52);
+    const uint32_t mipmaps = readUint32(bytes + 56);
+    offset += readUint32(bytes + 60);  // Skip the key and value data
+    if (gltype != 0 || blockBytes(format) == 0 || depth > 1 || elements > 0 || faces != 1) {
+        std::cerr << "Unsupported KTX texture format ('" << filename << "')\n";
+        return {};
+    }
+
+    ImageData image;
+    image.width = width;
+    image.height = height;
+    image.type = baseFormat(format);
+    image.internalformat = format;
+    const uint32_t levels = std::max(mipmaps, 1u);
+    const GLsizei blockbytes = blockBytes(format);
+    for (uint32_t level = 0; level < levels; level++) {
+        // Each level is its size in bytes followed by the data, padded to 4 bytes
+        ImageData::Level mip;
+        mip.width = static_cast<GLsizei>(std::max(width >> level, 1u));
+        mip.height = static_cast<GLsizei>(std::max(height >> level, 1u));
+        mip.size = ((mip.width + 3) / 4) * ((mip.height + 3) / 4) * blockbytes;
+        if (offset > file.size() || file.size() - offset < 4 + static_cast<size_t>(mip.size) ||
+            readUint32(bytes + offset) != static_cast<uint32_t>(mip.size)) {
+            std::cerr << "Could not read KTX image data ('" << filename << "')\n";
+            return {};
+        }
+        mip.data = reinterpret_cast<const GLubyte*>(bytes + offset + 4);
+        image.levels.push_back(mip);
+        offset += 4 + ((static_cast<size_t>(mip.size) + 3) & ~size_t(3));
+    }
+    return image;
+}
 
-    if (image_.data.empty()) {
+/*
+ * Set up an image for the pixels of a decoded file, like those of a TGA file
+ */
+GLubyte* Texture::allocateDecoded(const std::string& filename, const imagedecoder::Info& info,
+                                  ImageData& image, Arena* arena) {
+    image.width = static_cast<GLuint>(info.width);
+    image.height = static_cast<GLuint>(info.height);
+    if (info.channels == 4) {
+        image.type = GL_RGBA;
+        image.format = GL_BGRA;
+        std::cout << "Texture type is GL_RGBA ('" << filename << "')\n";
+    } else {
+        image.type = GL_RGB;
+        image.format = GL_BGR;
+        std::cout << "Texture type is GL_RGB ('" << filename << "')\n";
+    }
+    const size_t imageSize = size_t(info.channels) * image.width * image.height;
+    GLubyte* pixels = nullptr;
+    if (arena != nullptr) {
+        pixels = arena->allocate<GLubyte>(imageSize);
+    } else {
+        image.data.resize(imageSize);
+        pixels = image.data.data();
+    }
+    image.pixels = pixels;
+    return pixels;
+}
+
+/*
+ * Decode a PNG file into BGR(A) pixels, bottom row first
+ */
+Texture::ImageData Texture::loadPNG(const std::string& filename, const MappedFile& file,
+                                    Arena* arena) {
+    const GLubyte* bytes = reinterpret_cast<const GLubyte*>(file.data());
+    imagedecoder::Info info;
+    if (!imagedecoder::readPNGInfo(filename, bytes, file.size(), info)) {
+        return {};
+    }
+    ImageData image;
+    GLubyte* pixels = allocateDecoded(filename, info, image, arena);
+    if (!imagedecoder::decodePNG(filename, bytes, file.size(), info, pixels)) {
+        return {};
+    }
+    return image;
+}
+
+/*
+ * Decode a JPEG file into BGR pixels, bottom row first
+ */
+Texture::ImageData Texture::loadJPEG(const std::string& filename, const MappedFile& file,
+                                     Arena* arena, ThreadPool* pool) {
+    const GLubyte* bytes = reinterpret_cast<const GLubyte*>(file.data());
+    imagedecoder::Info info;
+    if (!imagedecoder::readJPEGInfo(filename, bytes, file.size(), info)) {
+        return {};
+    }
+    ImageData image;
+    GLubyte* pixels = allocateDecoded(filename, info, image, arena);
+    if (!imagedecoder::decodeJPEG(filename, bytes, file.size(), info, pixels, pool)) {
+        return {};
+    }
+    return image;
+}
+
+/*
+ * Load the image from a mapped file of any supported type, told by its first bytes
+ */
+Texture::ImageData Texture::loadImage(const std::string& filename, const MappedFile& file,
+                                      Arena* arena, ThreadPool* pool) {
+    const GLubyte* bytes = reinterpret_cast<const GLubyte*>(file.data());
+    if (file.size() >= 4 && std::memcmp(file.data(), "DDS ", 4) == 0) {
+        return loadDDS(filename, file);
+    } else if (file.size() >= ktxIdentifier.size() &&
+               std::memcmp(file.data(), ktxIdentifier.data(), ktxIdentifier.size()) == 0) {
+        return loadKTX(filename, file);
+    } else if (imagedecoder::isPNG(bytes, file.size())) {
+        return loadPNG(filename, file, arena);
+    } else if (imagedecoder::isJPEG(bytes, file.size())) {
+        return loadJPEG(filename, file, arena, pool);
+    }
+    return loadTGA(filename, file, arena);
+}
+
+/*
+ * Load and activate a 2D texture from a TGA, PNG, JPEG, DDS or KTX file
+ */
+void Texture::createTexture(const std::string& filename) {
+    TRACE_SCOPE("createTexture");
+    if (streamer_) {
+        streamer_->cancel(this);
+        streamer_ = nullptr;
+        textureID_ = 0;
+    }
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Could not open texture file ('" << filename << "')\n";
+        image_ = {};
         return;
     }
+    image_ = loadImage(filename, file, nullptr, &ThreadPool::global());
+    if (image_.pixels != nullptr || !image_.levels.empty()) {
+        uploadImage(filename);
+    }
+}
+
+/*
+ * Load a texture on the loader thread of a streamer, with a placeholder until it is ready
+ */
+void Texture::createTextureAsync(const std::string& filename, TextureStreamer& streamer) {
+    if (streamer_) {
+        streamer_->cancel(this);
+    } else if (textureID_ != 0) {
+        glstate::deleteTextures(1, &textureID_);
+    }
+    image_ = {};
+    levels_ = 1;
+    textureID_ = streamer.placeholder();
+    streamer_ = &streamer;
+    streamer.request(this, filename);
+}
+
+/*
+ * Create the texture and upload the loaded image to it
+ */
+bool Texture::uploadImage(const std::string& filename) {
+    if (blockBytes(image_.internalformat) > 0 && !formatSupported(image_.internalformat)) {
+        std::cerr << "Compressed texture format not supported by OpenGL ('" << filename
+                  << "')\n";
+        image_ = {};
+        return false;
+    }
 
+    // Immutable storage can not be specified again, so a reloaded texture gets a new ID
+    const bool immutable = GLEW_VERSION_4_2 || GLEW_ARB_texture_storage;
+    if (textureID_ != 0 && immutable) {
+        glstate::deleteTextures(1, &textureID_);
+        textureID_ = 0;
+    }
     if (textureID_ == 0) {
         glGenTextures(1, &textureID_);  // Create the texture ID if it does not exist
     }
 
-    glBindTexture(GL_TEXTURE_2D, textureID_);
+    glstate::bindTexture(GL_TEXTURE_2D, textureID_);
+    gldebug::label(GL_TEXTURE, textureID_, filename);
     // Set parameters to determine how the texture is resized
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     // Set parameters to determine how the texture wraps at edges
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // Read the texture data from file and upload it to the GPU
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image_.width, image_.height, 0, image_.type,
-                 GL_UNSIGNED_BYTE, image_.data.data());
 
-    glEnable(GL_TEXTURE_2D);  // Required for glGenerateMipmap() to work
-    glGenerateMipmap(GL_TEXTURE_2D);
+    // The levels in the file, or a full chain to generate for TGA files
+    if (image_.levels.empty()) {
+        levels_ = 1;
+        while ((std::max(image_.width, image_.height) >> levels_) > 0) {
+            levels_++;
+        }
+    } else {
+        // Over the texture budget, leave out the largest levels that do not fit, down to
+        // the smallest one
+        const long long headroom = gpumem::headroom(gpumem::Category::Texture);
+        size_t skip = 0;
+        while (skip + 1 < image_.levels.size() &&
+               static_cast<long long>(gpumem::textureBytes(
+                   image_.internalformat, image_.levels[skip].width, image_.levels[skip].height,
+                   1, static_cast<int>(image_.levels.size() - skip))) > headroom) {
+            skip++;
+        }
+        if (skip > 0) {
+            std::cerr << "Texture: over the GPU memory budget, leaving out " << skip
+                      << " levels of '" << filename << "'\n";
+            image_.levels.erase(image_.levels.begin(),
+                                image_.levels.begin() + static_cast<ptrdiff_t>(skip));
+            image_.width = static_cast<GLuint>(image_.levels[0].width);
+            image_.height = static_cast<GLuint>(image_.levels[0].height);
+        }
+        levels_ = static_cast<int>(image_.levels.size());
+    }
+    const GLsizei width = static_cast<GLsizei>(image_.width);
+    const GLsizei height = static_cast<GLsizei>(image_.height);
+    if (immutable) {
+        glTexStorage2D(GL_TEXTURE_2D, levels_, image_.internalformat, width, height);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_ - 1);
+    if (levels_ == 1) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    }
+
+    // Upload the texture data straight from the mapped file, or the decoded data. Rows of
+    // 3 byte pixels are not padded to 4 bytes in TGA and DDS files.
+    GLint alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (image_.levels.empty()) {
+        if (immutable) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, image_.format,
+                            GL_UNSIGNED_BYTE, image_.pixels);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(image_.internalformat), width,
+                         height, 0, image_.format, GL_UNSIGNED_BYTE, image_.pixels);
+        }
+        glGenerateMipmap(GL_TEXTURE_2D);
+    } else {
+        const bool compressed = blockBytes(image_.internalformat) > 0;
+        for (int level = 0; level < levels_; level++) {
+            const ImageData::Level& mip = image_.levels[level];
+            if (compressed && immutable) {
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, mip.width, mip.height,
+                                          image_.internalformat, mip.size, mip.data);
+            } else if (compressed) {
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, image_.internalformat, mip.width,
+                                       mip.height, 0, mip.size, mip.data);
+            } else if (immutable) {
+                glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, mip.width, mip.height,
+                                image_.format, GL_UNSIGNED_BYTE, mip.data);
+            } else {
+                glTexImage2D(GL_TEXTURE_2D, level, static_cast<GLint>(image_.internalformat),
+                             mip.width, mip.height, 0, image_.format, GL_UNSIGNED_BYTE, mip.data);
+            }
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    gpumem::setTexture(textureID_, gpumem::Category::Texture,
+                       gpumem::textureBytes(image_.internalformat, width, height, 1, levels_));
 
-    // Image data was copied to the GPU, release contents of the std::vector
+    // Image data was copied to the GPU, the mapping is released when 'file' goes out of scope.
     // When using clear() the std::vector would still hold on to the memory.
+    image_.pixels = nullptr;
     image_.data = std::vector<GLubyte>();
+    image_.levels.clear();
+    return true;
+}
+
+/*
+ * Compress a TGA file to a DDS file with the encoder of the OpenGL driver
+ */
+bool Texture::compressTGA(const std::string& tganame, const std::string& ddsname) {
+    Texture source(tganame);
+    if (source.id() == 0) {
+        return false;
+    }
+    if (!GLEW_EXT_texture_compression_s3tc) {
+        std::cerr << "BC1 and BC3 compression not supported by OpenGL ('" << ddsname << "')\n";
+        return false;
+    }
+    const bool alpha = source.type() == GL_RGBA;
+    const GLuint format =
+        alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+
+    // Each level of the source, with its mipmaps from glGenerateMipmap(), is compressed by
+    // uploading it to a level of a compressed texture and reading back the blocks
+    GLuint compressed;
+    glGenTextures(1, &compressed);
+    std::vector<GLubyte> pixels;
+    std::vector<GLubyte> blocks;
+    size_t firstsize = 0;
+    bool ok = true;
+    for (int level = 0; level < source.levels() && ok; level++) {
+        const GLsizei width = std::max(static_cast<GLsizei>(source.width() >> level), 1);
+        const GLsizei height = std::max(static_cast<GLsizei>(source.height() >> level), 1);
+        pixels.resize(static_cast<size_t>(width) * static_cast<size_t>(height) * 4);
+        glstate::bindTexture(GL_TEXTURE_2D, source.id());
+        glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        glstate::bindTexture(GL_TEXTURE_2D, compressed);
+        glTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     pixels.data());
+        GLint iscompressed = 0, size = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &iscompressed);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+        ok = iscompressed && size == ((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+        if (ok) {
+            const size_t start = blocks.size();
+            blocks.resize(start + static_cast<size_t>(size));
+            glGetCompressedTexImage(GL_TEXTURE_2D, level, blocks.data() + start);
+            if (level == 0) {
+                firstsize = static_cast<size_t>(size);
+            }
+        }
+    }
+    glstate::bindTexture(GL_TEXTURE_2D, 0);
+    glstate::deleteTextures(1, &compressed);
+    if (!ok) {
+        std::cerr << "Could not compress texture ('" << tganame << "')\n";
+        return false;
+    }
+
+    // DDS header with a FourCC code, then all levels from the largest
+    std::array<uint32_t, 1 + ddsHeaderSize / 4> header{};
+    header[0] = fourCC("DDS ");
+    header[1] = ddsHeaderSize;
+    header[2] = ddsFlagsTexture | ddsFlagMipmapCount | ddsFlagLinearSize;
+    header[3] = source.height();
+    header[4] = source.width();
+    header[5] = static_cast<uint32_t>(firstsize);
+    header[7] = static_cast<uint32_t>(source.levels());
+    header[19] = 32;  // Size of the pixel format
+    header[20] = ddsPixelFlagFourCC;
+    header[21] = fourCC(alpha ? "DXT5" : "DXT1");
+    header[27] = ddsCapsTexture | ddsCapsMipmap;
+
+    FILE* ddsfile = fopen(ddsname.c_str(), "wb");
+    if (!ddsfile) {
+        std::cerr << "Could not create texture file ('" << ddsname << "')\n";
+        return false;
+    }
+    ok = fwrite(header.data(), sizeof(header), 1, ddsfile) == 1;
+    ok = ok && fwrite(blocks.data(), 1, blocks.size(), ddsfile) == blocks.size();
+    ok = (fclose(ddsfile) == 0) && ok;
+    if (!ok) {
+        std::cerr << "Could not write texture file ('" << ddsname << "')\n";
+    }
+    return ok;
+}
+
+/*
+ * Bake the mipmaps of a TGA file, and write all levels to an uncompressed DDS file
+ */
+bool Texture::bakeTGA(const std::string& tganame, const std::string& ddsname, ThreadPool* pool) {
+    MappedFile file;
+    if (!file.open(tganame)) {
+        std::cerr << "Could not open texture file ('" << tganame << "')\n";
+        return false;
+    }
+    const ImageData image = loadTGA(tganame, file);
+    if (image.pixels == nullptr) {
+        return false;
+    }
+    const bool alpha = image.type == GL_RGBA;
+    const size_t bytesperpixel = alpha ? 4 : 3;
+
+    // Decode to linear RGB, premultiplied by alpha, so transparent pixels do not bleed
+    float tolinear[256];
+    for (int i = 0; i < 256; i++) {
+        const double value = i / 255.0;
+        tolinear[i] = static_cast<float>(
+            (value <= 0.04045) ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4));
+    }
+    int width = static_cast<int>(image.width);
+    int height = static_cast<int>(image.height);
+    std::vector<float> level(size_t(width) * size_t(height) * 4);
+    parallelRows(pool, height, [&](int begin, int end) {
+        for (size_t i = size_t(begin) * size_t(width); i < size_t(end) * size_t(width); i++) {
+            const GLubyte* pixel = image.pixels + i * bytesperpixel;
+            const float a = alpha ? pixel[3] / 255.0f : 1.0f;
+            level[4 * i + 0] = tolinear[pixel[2]] * a;  // BGR(A) to RGBA
+            level[4 * i + 1] = tolinear[pixel[1]] * a;
+            level[4 * i + 2] = tolinear[pixel[0]] * a;
+            level[4 * i + 3] = a;
+        }
+    });
+
+    // The image as it is, then each smaller level encoded from its filtered linear colors
+    std::vector<GLubyte> output(image.pixels,
+                                image.pixels + size_t(width) * size_t(height) * bytesperpixel);
+    uint32_t levels = 1;
+    std::vector<float> newlevel;
+    while (width > 1 || height > 1) {
+        const int newwidth = std::max(width / 2, 1);
+        const int newheight = std::max(height / 2, 1);
+        downsample(level, width, height, newlevel, newwidth, newheight, pool);
+        std::swap(level, newlevel);
+        width = newwidth;
+        height = newheight;
+
+        const size_t start = output.size();
+        output.resize(start + size_t(width) * size_t(height) * bytesperpixel);
+        parallelRows(pool, height, [&](int begin, int end) {
+            for (size_t i = size_t(begin) * size_t(width); i < size_t(end) * size_t(width);
+                 i++) {
+                const float* texel = &level[4 * i];
+                const float a = texel[3];
+                const float unpremultiply = (a > 0.0f) ? 1.0f / a : 0.0f;
+                GLubyte* pixel = &output[start + i * bytesperpixel];
+                pixel[0] = encodeSRGB(texel[2] * unpremultiply);
+                pixel[1] = encodeSRGB(texel[1] * unpremultiply);
+                pixel[2] = encodeSRGB(texel[0] * unpremultiply);
+                if (alpha) {
+                    pixel[3] = static_cast<GLubyte>(std::clamp(a, 0.0f, 1.0f) * 255.0f + 0.5f);
+                }
+            }
+        });
+        levels++;
+    }
+
+    // DDS header with BGR(A) masks, and the stamp of the TGA file in the reserved words
+    std::array<uint32_t, 1 + ddsHeaderSize / 4> header{};
+    header[0] = fourCC("DDS ");
+    header[1] = ddsHeaderSize;
+    header[2] = ddsFlagsTexture | ddsFlagMipmapCount;
+    header[3] = image.height;
+    header[4] = image.width;
+    header[5] = image.width * static_cast<uint32_t>(bytesperpixel);  // Pitch
+    header[7] = levels;
+    uint64_t sourcesize = 0;
+    int64_t sourcetime = 0;
+    util::fileStamp(tganame, sourcesize, sourcetime);
+    header[8] = ddsBakedTag;
+    std::memcpy(&header[9], &sourcesize, sizeof(sourcesize));
+    std::memcpy(&header[11], &sourcetime, sizeof(sourcetime));
+    header[19] = 32;  // Size of the pixel format
+    header[20] = ddsPixelFlagRGB | (alpha ? ddsPixelFlagAlpha : 0);
+    header[22] = static_cast<uint32_t>(bytesperpixel * 8);
+    header[23] = 0xff0000;
+    header[24] = 0xff00;
+    header[25] = 0xff;
+    header[26] = alpha ? 0xff000000 : 0;
+    header[27] = ddsCapsTexture | (levels > 1 ? ddsCapsMipmap : 0);
+
+    FILE* ddsfile = fopen(ddsname.c_str(), "wb");
+    if (!ddsfile) {
+        std::cerr << "Could not create texture file ('" << ddsname << "')\n";
+        return false;
+    }
+    bool ok = fwrite(header.data(), sizeof(header), 1, ddsfile) == 1;
+    ok = ok && fwrite(output.data(), 1, output.size(), ddsfile) == output.size();
+    ok = (fclose(ddsfile) == 0) && ok;
+    if (!ok) {
+        std::cerr << "Could not write texture file ('" << ddsname << "')\n";
+    }
+    return ok;
+}
+
+/*
+ * Load a TGA file through a DDS file with baked mipmaps, and bake it if it is missing or stale
+ */
+void Texture::createCachedTexture(const std::string& filename) {
+    TRACE_SCOPE("createCachedTexture");
+    // Baked files are kept next to local files, and not next to URLs. One in a mounted pack
+    // file is used when the pack has no loose file next to it to check it against.
+    if (vfs::isRemote(filename)) {
+        createTexture(filename);
+        return;
+    }
+    const std::string bakedfile = filename + ".baked.dds";
+
+    uint64_t sourcesize = 0;
+    int64_t sourcetime = 0;
+    const bool sourcefound = util::fileStamp(filename, sourcesize, sourcetime);
+
+    bool fresh = false;
+    {
+        MappedFile ddsfile(bakedfile);
+        if (ddsfile.isOpen() && ddsfile.size() >= 4 + ddsHeaderSize &&
+            std::memcmp(ddsfile.data(), "DDS ", 4) == 0 &&
+            readUint32(ddsfile.data() + 32) == ddsBakedTag) {
+            uint64_t bakedsize;
+            int64_t bakedtime;
+            std::memcpy(&bakedsize, ddsfile.data() + 36, sizeof(bakedsize));
+            std::memcpy(&bakedtime, ddsfile.data() + 44, sizeof(bakedtime));
+            fresh = !sourcefound || (bakedsize == sourcesize && bakedtime == sourcetime);
+        }
+    }
+    if (!fresh && !bakeTGA(filename, bakedfile, &ThreadPool::global())) {
+        createTexture(filename);
+        return;
+    }
+    createTexture(bakedfile);
 }
@@ -1,11 +1,35 @@
 /*
- * A class to manage an OpenGL texture, and load texture data from a TGA file.
+ * A class to manage an OpenGL texture, and load texture data from a TGA, PNG, JPEG, DDS or
+ * KTX file.
  *
  * Modified, stripped-down and cleaned-up version of the TGA loader from NeHe tutorial 33.
  *
  * Usage: Call createTexture() with a TGA file as argument to load a texture,
- *        or use the constructor with a file name argument. Uncompressed RGB or RGBA only.
- *        Call glBindTexture() with the public member textureID as argument.
+ *        or use the constructor with a file name argument. RGB or RGBA, uncompressed or
+ *        RLE compressed. Call glBindTexture() with the public member textureID as argument.
+ *        The file is memory mapped and its pixels are uploaded straight from the mapping
+ *        as GL_BGR(A), the byte order of TGA files, so they are neither copied nor swizzled.
+ *        RLE compressed pixels are decoded from the mapping into one buffer, a whole run or
+ *        raw packet at a time.
+ *        PNG and JPEG files are decoded by ImageDecoder (ImageDecoder.hpp) into BGR(A) with
+ *        the bottom row first, like TGA files. The strips between the restart markers of
+ *        JPEG files are decoded in parallel on the shared ThreadPool.
+ *        DDS and KTX (version 1) files hold block compressed textures, BC1, BC2, BC3, BC7 or
+ *        ETC2, whose mipmaps are uploaded as they are with glCompressedTexImage2D().
+ *        The file type is told by its first bytes. The first row of blocks in the file is
+ *        the bottom row of the texture, as in TGA files, so DDS files from other tools,
+ *        which start at the top, must be exported vertically flipped.
+ *        compressTGA() converts a TGA file to a DDS file with BC1 or BC3 and all mipmaps.
+ *        Mipmaps of DDS and KTX files are used as they are. Mipmaps of TGA files are made by
+ *        glGenerateMipmap(), unless they are baked: bakeTGA() filters the mipmaps on the CPU,
+ *        in linear color, and writes them with the image to an uncompressed DDS file.
+ *        createCachedTexture() loads a TGA file through such a file, which is baked on
+ *        first use and again when the TGA file changes.
+ *        With OpenGL 4.2 or ARB_texture_storage, the texture has immutable storage.
+ *        createTextureAsync() loads the file in the background with a TextureStreamer,
+ *        and the texture is a gray placeholder until it is ready().
+ *        Files with mipmaps are loaded without their largest levels while the textures
+ *        are over their gpumem budget, so width() and height() are those of the level used.
  *
  * Authors: Stefan Gustavson (stegu@itn.liu.se) 2014
  *          Martin Falk (martin.falk@liu.se) 2021
@@ -15,9 +39,19 @@
 #pragma once
 
 #include <GLFW/glfw3.h>
+#include <cstddef>
 #include <string>
 #include <vector>
 
+namespace imagedecoder {
+struct Info;
+}
+
+class Arena;
+class MappedFile;
+class TextureStreamer;
+class ThreadPool;
+
 class Texture {
 public:
 
@@ -27,9 +61,33 @@ public:
     /* Destructor */
     ~Texture();
 
+    /* Move the texture to a new object, also while a TextureStreamer loads it, and leave
+     * 'other' empty. Copies are not allowed, since only one object may delete the texture. */
+    Texture(Texture&& other) noexcept;
+    Texture& operator=(Texture&& other) noexcept;
+
+    Texture(const Texture&) = delete;
+    Texture& operator=(const Texture&) = delete;
+
     // The external entry point for loading a texture from a TGA file
     void createTexture(const std::string& filename);  // Load GL texture from file
 
+    /* Load a texture from a TGA file through a DDS file with baked mipmaps, named as the
+     * TGA file followed by ".baked.dds". It is baked with bakeTGA() if it does not exist,
+     * or if it is older than the TGA file. */
+    void createCachedTexture(const std::string& filename);
+
+    /* Load a texture from a TGA, DDS or KTX file in the background. The streamer reads the
+     * file on its loader thread and uploads it through a pixel buffer object. Until then,
+     * id() is a placeholder texture of one gray texel. */
+    void createTextureAsync(const std::string& filename, TextureStreamer& streamer);
+
+    // True while a TextureStreamer loads the texture
+    bool pending() const;
+
+    // True if the texture holds its image, false while pending or if loading failed
+    bool ready() const;
+
     // returns the OpenGL texture ID
     GLuint id() const;
 
@@ -39,17 +97,98 @@ public:
     // returns the type of the texture (GL_RGB or GL_RGBA)
     GLuint type() const;
 
+    // returns the internal format on the GPU (GL_RGBA8, or a compressed format)
+    GLuint internalFormat() const;
+
+    // Number of mipmap levels in the texture
+    int levels() const;
+
+    /* Compress the TGA file 'tganame' to BC1 (RGB) or BC3 (RGBA) with the encoder of the
+     * OpenGL driver, with mipmaps, and write it to the DDS file 'ddsname'. Needs a current
+     * OpenGL context. Returns false if a file could not be read or written. */
+    static bool compressTGA(const std::string& tganame, const std::string& ddsname);
+
+    /* Compute all mipmaps of the TGA file 'tganame' and write them with the image to the
+     * uncompressed DDS file 'ddsname'. The mipmaps are box filtered in linear color from the
+     * sRGB pixels, with the colors weighted by alpha. With a pool, rows are filtered in
+     * parallel. No OpenGL context is needed. Returns false if a file could not be read or
+     * written. */
+    static bool bakeTGA(const std::string& tganame, const std::string& ddsname,
+                        ThreadPool* pool = nullptr);
+
+    /* Swap the first and third byte of 'count' pixels of 3 or 4 bytes in place, converting
+     * BGR(A) to RGB(A) and back, for pixels that must be converted on the CPU after all.
+     * Uses SSSE3 or NEON shuffles where available. */
+    static void swapRedBlue(GLubyte* pixels, size_t count, int bytesperpixel);
+
 private:
+    friend class ResourceManager;
+    friend class TextureArray;
+    friend class TextureStreamer;
+    friend class VirtualTexture;
+    friend struct TextureBenchmark;  // bench/MicroBenchmarks.cpp
+
     struct ImageData {
         GLuint width = 0;                // Image width
         GLuint height = 0;               // Image height
         GLuint type = 0;                 // Image type (3 bytes per pixel: GL_RGB, 4 bytes: GL_RGBA)
-        std::vector<GLubyte> data;  // Image data (3 or 4 bytes per pixel)
+        GLuint format = 0;               // Byte order of the pixels (GL_BGR or GL_BGRA)
+        const GLubyte* pixels = nullptr;  // Image data (3 or 4 bytes per pixel)
+        std::vector<GLubyte> data;        // Decoded image data, if the file is compressed
+        GLuint internalformat = GL_RGBA8;  // Format on the GPU
+        // Levels in the file, from the largest, or empty for TGA files. The levels are block
+        // compressed if 'internalformat' is compressed, otherwise of 'format'.
+        struct Level {
+            const GLubyte* data;
+            GLsizei size;
+            GLsizei width;
+            GLsizei height;
+        };
+        std::vector<Level> levels;
     };
 
-    // Load data from an uncompressed TGA file
-    ImageData loadUncompressedTGA(const std::string& filename) const;
+    // Load data from an uncompressed or RLE compressed TGA file mapped by 'file'. The pixels
+    // of an uncompressed image point into the mapping, and are valid as long as it is open.
+    // The pixels of a compressed image are decoded into 'arena' if given, and into 'data'
+    // otherwise.
+    static ImageData loadTGA(const std::string& filename, const MappedFile& file,
+                             Arena* arena = nullptr);
+
+    // Load the levels of a DDS or a KTX file mapped by 'file'. The levels point into the
+    // mapping.
+    static ImageData loadDDS(const std::string& filename, const MappedFile& file);
+    static ImageData loadKTX(const std::string& filename, const MappedFile& file);
+
+    // Decode a PNG or JPEG file mapped by 'file', into 'arena' if given, and into 'data'
+    // otherwise. The strips of a JPEG file are decoded in parallel if there is a pool.
+    static ImageData loadPNG(const std::string& filename, const MappedFile& file,
+                             Arena* arena = nullptr);
+    static ImageData loadJPEG(const std::string& filename, const MappedFile& file,
+                              Arena* arena = nullptr, ThreadPool* pool = nullptr);
+
+    // Set the size and format of 'image' for the pixels of a decoded file, and allocate them
+    // in 'arena' if given, and in 'data' otherwise
+    static GLubyte* allocateDecoded(const std::string& filename, const imagedecoder::Info& info,
+                                    ImageData& image, Arena* arena);
+
+    // Load the image of a TGA, PNG, JPEG, DDS or KTX file, told by its first bytes
+    static ImageData loadImage(const std::string& filename, const MappedFile& file,
+                               Arena* arena = nullptr, ThreadPool* pool = nullptr);
+
+    // Delete the texture, or hand it back to the streamer while it is pending
+    void release();
+
+    // Create the texture and upload 'image_' to it, from the bound pixel unpack buffer if
+    // there is one. Returns false if the format is not supported.
+    bool uploadImage(const std::string& filename);
+
+    // Decode the RLE packets in 'size' bytes at 'in' to 'count' pixels at 'out'. Returns
+    // false if the packets end early or if they hold more pixels than 'count'.
+    static bool decodeRLE(const GLubyte* in, size_t size, size_t bytesperpixel, GLubyte* out,
+                          size_t count);
 
-    GLuint textureID_;  // Texture ID for OpenGL
+    GLuint textureID_;           // Texture ID for OpenGL
     ImageData image_;
+    int levels_;                 // Mipmap levels of the texture
+    TextureStreamer* streamer_;  // The streamer that loads the texture, or nullptr
 };
@@ -0,0 +1,211 @@
+/*
+ * Texture array with shelf packed layers
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "TextureArray.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "MappedFile.hpp"
+#include "Texture.hpp"
+
+TextureArray::TextureArray(int layersize, int gutter)
+    : layersize_(layersize), gutter_(std::max(gutter, 0)), textureID_(0), layers_(0) {}
+
+TextureArray::~TextureArray() {
+    if (textureID_ != 0) {
+        glstate::deleteTextures(1, &textureID_);
+    }
+}
+
+int TextureArray::add(const std::string& filename) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Could not open texture file ('" << filename << "')\n";
+        return -1;
+    }
+    decoded_.reset();  // The pixels of the previous file were copied
+    const Texture::ImageData image = Texture::loadImage(filename, file, &decoded_);
+    const GLubyte* pixels = image.pixels;
+    if (!image.levels.empty()) {
+        pixels = (image.format != 0) ? image.levels[0].data : nullptr;
+    }
+    if (pixels == nullptr) {
+        if (!image.levels.empty()) {
+            std::cerr << "Compressed images can not be packed ('" << filename << "')\n";
+        }
+        return -1;
+    }
+    const int width = static_cast<int>(image.width);
+    const int height = static_cast<int>(image.height);
+    if (width > layersize_ || height > layersize_) {
+        std::cerr << "Image larger than a layer (" << layersize_ << ") ('" << filename
+                  << "')\n";
+        return -1;
+    }
+
+    // Expand to BGRA
+    Image packed;
+    packed.width = width;
+    packed.height = height;
+    const size_t count = size_t(width) * size_t(height);
+    if (image.format == GL_BGRA) {
+        packed.pixels.assign(pixels, pixels + count * 4);
+    } else {
+        packed.pixels.resize(count * 4);
+        for (size_t i = 0; i < count; i++) {
+            packed.pixels[4 * i + 0] = pixels[3 * i + 0];
+            packed.pixels[4 * i + 1] = pixels[3 * i + 1];
+            packed.pixels[4 * i + 2] = pixels[3 * i + 2];
+            packed.pixels[4 * i + 3] = 255;
+        }
+    }
+    images_.push_back(std::move(packed));
+    return static_cast<int>(images_.size()) - 1;
+}
+
+bool TextureArray::build() {
+    if (images_.empty()) {
+        return false;
+    }
+
+    // Mipmaps of shared layers stop where the gutter is one texel wide, and places are
+    // aligned to that level so the gutter is not split between texels there
+    int maxlevel = 0;
+    while ((2 << maxlevel) <= gutter_) {
+        maxlevel++;
+    }
+    const int align = 1 << maxlevel;
+    const auto alignUp = [align](int size) { return (size + align - 1) / align * align; };
+
+    // Shelf packing, highest images first
+    std::vector<int> order(images_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [this](int a, int b) { return images_[a].height > images_[b].height; });
+    struct Place {
+        int layer, x, y, gutter;
+    };
+    std::vector<Place> places(images_.size());
+    bool shared = false;  // True if some layer holds more than one image
+    int layer = -1, x = 0, y = 0, shelfheight = 0;
+    for (int index : order) {
+        const Image& image = images_[index];
+        if (image.width == layersize_ && image.height == layersize_) {
+            places[index] = {++layer, 0, 0, 0};  // A layer of its own, without gutter
+            x = layersize_;
+            y = layersize_;
+            continue;
+        }
+        const int width = std::min(alignUp(image.width + 2 * gutter_), layersize_);
+        const int height = std::min(alignUp(image.height + 2 * gutter_), layersize_);
+        if (x + width > layersize_) {
+            // Next shelf
+            x = 0;
+            y += shelfheight;
+            shelfheight = 0;
+        }
+        if (layer < 0 || y + height > layersize_) {
+            layer++;
+            x = 0;
+            y = 0;
+            shelfheight = 0;
+        }
+        // Images that fill a layer in one direction get the gutter that is left
+        const int gutter = std::min(gutter_, (std::min(width - image.width,
+                                                       height - image.height)) / 2);
+        places[index] = {layer, x, y, gutter};
+        shared = shared || x > 0 || y > 0;
+        x += width;
+        shelfheight = std::max(shelfheight, height);
+    }
+    layers_ = layer + 1;
+
+    int levels = 1;
+    while ((layersize_ >> levels) > 0 && (!shared || levels <= maxlevel)) {
+        levels++;
+    }
+
+    // Compose and upload one layer at a time
+    GLint texture;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D_ARRAY, &texture);
+    if (textureID_ != 0) {
+        glstate::deleteTextures(1, &textureID_);
+    }
+    glGenTextures(1, &textureID_);
+    glstate::bindTexture(GL_TEXTURE_2D_ARRAY, textureID_);
+    if (GLEW_VERSION_4_2 || GLEW_ARB_texture_storage) {
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, layersize_, layersize_, layers_);
+    } else {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, layersize_, layersize_, layers_, 0,
+                     GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    gpumem::setTexture(textureID_, gpumem::Category::Texture,
+                       gpumem::textureBytes(GL_RGBA8, layersize_, layersize_, layers_, levels));
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, shared ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, shared ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+
+    const size_t rowbytes = size_t(layersize_) * 4;
+    std::vector<GLubyte> pixels(rowbytes * size_t(layersize_));
+    entries_.assign(images_.size(), Entry());
+    for (int l = 0; l < layers_; l++) {
+        std::fill(pixels.begin(), pixels.end(), GLubyte(0));
+        for (size_t index = 0; index < images_.size(); index++) {
+            const Place& place = places[index];
+            if (place.layer != l) {
+                continue;
+            }
+            // The image, with its edge texels copied into the gutter around it
+            const Image& image = images_[index];
+            const int g = place.gutter;
+            for (int row = -g; row < image.height + g; row++) {
+                const int sourcerow = std::clamp(row, 0, image.height - 1);
+                const GLubyte* source = &image.pixels[size_t(sourcerow) * image.width * 4];
+                GLubyte* dest = &pixels[size_t(place.y + g + row) * rowbytes +
+                                        size_t(place.x) * 4];
+                for (int i = 0; i < g; i++) {
+                    std::copy(source, source + 4, dest + size_t(i) * 4);
+                    std::copy(source + size_t(image.width - 1) * 4,
+                              source + size_t(image.width) * 4,
+                              dest + size_t(g + image.width + i) * 4);
+                }
+                std::copy(source, source + size_t(image.width) * 4, dest + size_t(g) * 4);
+            }
+            Entry& entry = entries_[index];
+            entry.layer = l;
+            entry.scale[0] = float(image.width) / float(layersize_);
+            entry.scale[1] = float(image.height) / float(layersize_);
+            entry.offset[0] = float(place.x + g) / float(layersize_);
+            entry.offset[1] = float(place.y + g) / float(layersize_);
+            entry.width = image.width;
+            entry.height = image.height;
+        }
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, l, layersize_, layersize_, 1, GL_BGRA,
+                        GL_UNSIGNED_BYTE, pixels.data());
+    }
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glstate::bindTexture(GL_TEXTURE_2D_ARRAY, static_cast<GLuint>(texture));
+
+    // The images are on the GPU now
+    images_ = std::vector<Image>();
+    return true;
+}
+
+const TextureArray::Entry& TextureArray::entry(int index) const { return entries_[index]; }
+
+int TextureArray::entryCount() const { return static_cast<int>(entries_.size()); }
+
+GLuint TextureArray::id() const { return textureID_; }
+
+int TextureArray::layers() const { return layers_; }
@@ -0,0 +1,81 @@
+/*
+ * Many small textures packed into the layers of one GL_TEXTURE_2D_ARRAY, so that draws with
+ * different textures can share one binding.
+ *
+ * Usage: add() the image files (TGA, or uncompressed DDS), then build() the array, once.
+ *        Each image gets a place in a layer, found by shelf packing: images are sorted by
+ *        height and placed left to right in rows, a new row starts when one is full, and a
+ *        new layer when the layer is full. Images of exactly the layer size fill a layer of
+ *        their own, and can repeat. Other images are surrounded by a gutter of copied edge
+ *        texels, and mipmaps stop at the level where the gutter is one texel wide, so
+ *        neighbours do not bleed into each other.
+ *        An image is found by its entry(): sample the array at
+ *            vec3(st * entry.scale + entry.offset, entry.layer)
+ *        in a shader with a sampler2DArray, where st are the texture coordinates of the
+ *        original texture in [0, 1]. The layer and the scale and offset can be given per
+ *        instance, or per draw through an array in a uniform block.
+ *        All images are expanded to 8 bit BGRA on the CPU. Compressed images are not
+ *        supported.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <string>
+#include <vector>
+
+#include "Arena.hpp"
+
+class TextureArray {
+public:
+    // Where an image is in the array: st * scale + offset in the layer
+    struct Entry {
+        int layer;
+        float scale[2];
+        float offset[2];
+        int width;   // Size of the image in texels
+        int height;
+    };
+
+    /* Constructor: layers of 'layersize' x 'layersize' texels, and gutters of 'gutter'
+     * texels around images that share a layer */
+    explicit TextureArray(int layersize = 2048, int gutter = 4);
+
+    /* Destructor: delete the texture */
+    ~TextureArray();
+
+    TextureArray(const TextureArray&) = delete;
+    TextureArray& operator=(const TextureArray&) = delete;
+
+    /* Load an image to pack with the others. Returns its entry number, or -1 if it could
+     * not be loaded or is larger than a layer. */
+    int add(const std::string& filename);
+
+    /* Pack all added images and upload them, with mipmaps. The images are not kept on the
+     * CPU afterwards. Returns false if no image was added. */
+    bool build();
+
+    // The placement of an added image, valid after build()
+    const Entry& entry(int index) const;
+    int entryCount() const;
+
+    // The GL_TEXTURE_2D_ARRAY texture, and its number of layers
+    GLuint id() const;
+    int layers() const;
+
+private:
+    struct Image {
+        int width;
+        int height;
+        std::vector<GLubyte> pixels;  // BGRA
+    };
+
+    int layersize_;
+    int gutter_;
+    GLuint textureID_;
+    int layers_;
+    std::vector<Image> images_;
+    std::vector<Entry> entries_;
+    Arena decoded_;  // Decoded pixels of the file being added, reused by every add()
+};
@@ -0,0 +1,288 @@
+/*
+ * Background loading of textures through pixel buffer objects
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "TextureStreamer.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "MappedFile.hpp"
+#include "Texture.hpp"
+#include "Trace.hpp"
+
+struct TextureStreamer::Job {
+    // Steps of a job. A job on the pool works on Decode and Copy, the render thread on the
+    // others.
+    enum Stage { Decode, Decoded, Copy, Copied, Uploading, Failed };
+
+    Texture* texture = nullptr;  // nullptr when the texture was deleted
+    std::string filename;
+    MappedFile file;
+    Texture::ImageData image;
+    std::atomic<int> stage{Decode};
+    GLuint buffer = 0;            // Pixel buffer object
+    size_t bytes = 0;             // Size of the PBO
+    GLubyte* mapped = nullptr;    // Mapped PBO during Copy
+    GLuint textureid = 0;         // The texture, until it is ready
+    int levels = 0;
+    GLsync fence = nullptr;
+
+    // The pixels of the image, or of each level, in the order they have in the PBO
+    std::vector<std::pair<const GLubyte*, size_t>> parts() const {
+        std::vector<std::pair<const GLubyte*, size_t>> parts;
+        if (image.levels.empty()) {
+            const size_t bytesperpixel = (image.type == GL_RGBA) ? 4 : 3;
+            parts.emplace_back(image.pixels, size_t(image.width) * image.height * bytesperpixel);
+        }
+        for (const Texture::ImageData::Level& level : image.levels) {
+            parts.emplace_back(level.data, static_cast<size_t>(level.size));
+        }
+        return parts;
+    }
+
+    // The image with the pixels at their offsets in the PBO, to upload from it
+    Texture::ImageData imageInBuffer() const {
+        Texture::ImageData inbuffer;
+        inbuffer.width = image.width;
+        inbuffer.height = image.height;
+        inbuffer.type = image.type;
+        inbuffer.format = image.format;
+        inbuffer.internalformat = image.internalformat;
+        size_t offset = 0;
+        if (image.levels.empty()) {
+            inbuffer.pixels = reinterpret_cast<const GLubyte*>(offset);
+        }
+        for (const Texture::ImageData::Level& level : image.levels) {
+            Texture::ImageData::Level atoffset = level;
+            atoffset.data = reinterpret_cast<const GLubyte*>(offset);
+            inbuffer.levels.push_back(atoffset);
+            offset += static_cast<size_t>(level.size);
+        }
+        return inbuffer;
+    }
+};
+
+TextureStreamer::TextureStreamer(size_t uploadbytes, ThreadPool& pool)
+    : pool_(pool), uploadbytes_(uploadbytes), placeholder_(0) {
+    const GLubyte gray[4] = {128, 128, 128, 255};
+    GLint texture;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    glGenTextures(1, &placeholder_);
+    glstate::bindTexture(GL_TEXTURE_2D, placeholder_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, gray);
+    gpumem::setTexture(placeholder_, gpumem::Category::Texture, sizeof(gray));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glstate::bindTexture(GL_TEXTURE_2D, static_cast<GLuint>(texture));
+}
+
+TextureStreamer::~TextureStreamer() {
+    pool_.wait(loading_);
+
+    for (std::unique_ptr<Job>& job : jobs_) {
+        if (job->texture) {
+            job->texture->textureID_ = 0;
+            job->texture->streamer_ = nullptr;
+        }
+        if (job->buffer != 0) {
+            if (job->mapped) {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job->buffer);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+            gpumem::deleteBuffers(1, &job->buffer);
+        }
+        if (job->textureid != 0) {
+            glstate::deleteTextures(1, &job->textureid);
+        }
+        if (job->fence) {
+            glDeleteSync(job->fence);
+        }
+    }
+    glstate::deleteTextures(1, &placeholder_);
+}
+
+void TextureStreamer::request(Texture* texture, const std::string& filename) {
+    std::unique_ptr<Job> job = std::make_unique<Job>();
+    job->texture = texture;
+    job->filename = filename;
+    enqueue(job.get());
+    jobs_.push_back(std::move(job));
+}
+
+void TextureStreamer::cancel(Texture* texture) {
+    for (std::unique_ptr<Job>& job : jobs_) {
+        if (job->texture == texture) {
+            job->texture = nullptr;
+        }
+    }
+}
+
+void TextureStreamer::retarget(Texture* from, Texture* to) {
+    for (std::unique_ptr<Job>& job : jobs_) {
+        if (job->texture == from) {
+            job->texture = to;
+        }
+    }
+}
+
+void TextureStreamer::enqueue(Job* job) {
+    pool_.run(loading_, [this, job]() { load(*job); });
+}
+
+void TextureStreamer::load(Job& job) {
+    if (job.stage == Job::Decode) {
+        TRACE_SCOPE("decode texture");
+        // The file stays mapped until the pixels are copied
+        if (!job.file.open(job.filename)) {
+            std::cerr << "Could not open texture file ('" << job.filename << "')\n";
+            job.stage = Job::Failed;
+            return;
+        }
+        job.image = Texture::loadImage(job.filename, job.file, nullptr, &pool_);
+        const bool loaded = job.image.pixels != nullptr || !job.image.levels.empty();
+        job.stage = loaded ? Job::Decoded : Job::Failed;
+    } else if (job.stage == Job::Copy) {
+        GLubyte* out = job.mapped;
+        for (const std::pair<const GLubyte*, size_t>& part : job.parts()) {
+            std::memcpy(out, part.first, part.second);
+            out += part.second;
+        }
+        job.file.close();
+        job.image.data = std::vector<GLubyte>();
+        job.stage = Job::Copied;
+    }
+}
+
+void TextureStreamer::update() {
+    GLint texture, unpackbuffer;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &unpackbuffer);
+
+    size_t uploaded = 0;
+    for (size_t i = 0; i < jobs_.size();) {
+        Job& job = *jobs_[i];
+        bool done = false;
+        int stage = job.stage.load();
+        if (stage == Job::Copied && job.texture && uploaded > 0 &&
+            uploaded + job.bytes > uploadbytes_) {
+            stage = Job::Copy;  // Wait for the next update()
+        }
+        switch (stage) {
+            case Job::Decoded: {
+                if (!job.texture) {
+                    done = true;
+                    break;
+                }
+                // Map a PBO for a job on the pool to copy the pixels into
+                size_t bytes = 0;
+                for (const std::pair<const GLubyte*, size_t>& part : job.parts()) {
+                    bytes += part.second;
+                }
+                job.bytes = bytes;
+                glGenBuffers(1, &job.buffer);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job.buffer);
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(bytes), nullptr,
+                             GL_STREAM_DRAW);
+                gpumem::setBuffer(job.buffer, gpumem::Category::Buffer, bytes);
+                job.mapped = static_cast<GLubyte*>(
+                    glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(bytes),
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+                if (!job.mapped) {
+                    std::cerr << "Could not map pixel buffer ('" << job.filename << "')\n";
+                    job.stage = Job::Failed;
+                    break;
+                }
+                job.stage = Job::Copy;
+                enqueue(&job);
+                break;
+            }
+            case Job::Copied: {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job.buffer);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                job.mapped = nullptr;
+                if (!job.texture) {
+                    done = true;
+                    break;
+                }
+                // Upload from the PBO into a new texture, which the Texture gets once the
+                // fence is signalled
+                Texture& target = *job.texture;
+                target.textureID_ = 0;
+                target.image_ = job.imageInBuffer();
+                const bool ok = target.uploadImage(job.filename);
+                job.textureid = target.textureID_;
+                job.levels = target.levels_;
+                target.textureID_ = placeholder_;
+                target.levels_ = 1;
+                if (!ok) {
+                    job.stage = Job::Failed;
+                    break;
+                }
+                uploaded += job.bytes;
+                job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                glFlush();  // Make sure the fence is signalled without a later flush
+                job.stage = Job::Uploading;
+                break;
+            }
+            case Job::Uploading: {
+                const GLenum status = glClientWaitSync(job.fence, 0, 0);
+                if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                    break;
+                }
+                if (job.texture) {
+                    job.texture->textureID_ = job.textureid;
+                    job.texture->levels_ = job.levels;
+                    job.texture->streamer_ = nullptr;
+                    job.textureid = 0;
+                }
+                done = true;
+                break;
+            }
+            case Job::Failed:
+                if (job.texture) {
+                    job.texture->textureID_ = 0;
+                    job.texture->levels_ = 0;
+                    job.texture->streamer_ = nullptr;
+                }
+                done = true;
+                break;
+            default:  // Decode and Copy, on the pool
+                break;
+        }
+
+        if (!done) {
+            i++;
+            continue;
+        }
+        if (job.mapped) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job.buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        if (job.buffer != 0) {
+            gpumem::deleteBuffers(1, &job.buffer);
+        }
+        if (job.textureid != 0) {
+            glstate::deleteTextures(1, &job.textureid);
+        }
+        if (job.fence) {
+            glDeleteSync(job.fence);
+        }
+        jobs_[i] = std::move(jobs_.back());
+        jobs_.pop_back();
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, static_cast<GLuint>(unpackbuffer));
+    glstate::bindTexture(GL_TEXTURE_2D, static_cast<GLuint>(texture));
+}
+
+int TextureStreamer::pendingCount() const { return static_cast<int>(jobs_.size()); }
+
+GLuint TextureStreamer::placeholder() const { return placeholder_; }
@@ -0,0 +1,86 @@
+/*
+ * Loading of textures in the background, without stalling the render thread.
+ *
+ * Usage: Create one streamer after the OpenGL context, and call Texture::createTextureAsync()
+ *        with it. Call update() once per frame on the render thread. A texture goes through
+ *        these steps, and update() moves it on when the previous step is done:
+ *          - a job on the pool maps and decodes the file,
+ *          - the render thread creates the texture and maps a pixel buffer object (PBO),
+ *          - a job on the pool copies the pixels into the PBO,
+ *          - the render thread unmaps the PBO, starts the upload from it with
+ *            glTexSubImage2D() and places a fence after it,
+ *          - the render thread polls the fence, and when the GPU has the data, the texture
+ *            replaces the placeholder and its PBO is deleted.
+ *        No step blocks the render thread. Until a texture is ready, its id() is a shared
+ *        placeholder texture of one gray texel. Each update() starts uploads of at most
+ *        'uploadbytes' bytes, but at least one, to spread the cost of many large textures
+ *        over several frames.
+ *        The files are decoded by jobs on a ThreadPool, one per file, so many files decode
+ *        at once, and the strips of a JPEG file with restart markers are spread over the
+ *        pool as well (ImageDecoder.hpp).
+ *        Textures that are deleted while they load are dropped by the streamer.
+ *        The streamer must be deleted while the OpenGL context is current, and textures
+ *        still pending then are left empty.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+class Texture;
+
+class TextureStreamer {
+public:
+    /* Constructor: load files with jobs on 'pool' */
+    explicit TextureStreamer(size_t uploadbytes = 64 << 20,
+                             ThreadPool& pool = ThreadPool::global());
+
+    /* Destructor: wait for the jobs on the pool, and delete the buffers, fences, textures
+     * not yet handed over, and the placeholder */
+    ~TextureStreamer();
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    // Move every texture on to its next step, on the render thread
+    void update();
+
+    // Number of textures still loading
+    int pendingCount() const;
+
+    // The placeholder texture, one gray texel
+    GLuint placeholder() const;
+
+private:
+    friend class Texture;
+
+    struct Job;
+
+    // Called by Texture::createTextureAsync()
+    void request(Texture* texture, const std::string& filename);
+
+    // Called by the destructor of a pending Texture
+    void cancel(Texture* texture);
+
+    // Called when a pending Texture is moved from 'from' to 'to'
+    void retarget(Texture* from, Texture* to);
+
+    // Start the next step of a job on the pool
+    void enqueue(Job* job);
+
+    // Decode or copy, on the pool
+    void load(Job& job);
+
+    std::vector<std::unique_ptr<Job>> jobs_;  // All jobs, used by the render thread only
+    ThreadPool& pool_;
+    JobCounter loading_;                      // Steps running on the pool
+    size_t uploadbytes_;                      // Upload limit of one update()
+    GLuint placeholder_;
+};
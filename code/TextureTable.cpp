@@ -0,0 +1,137 @@
+/*
+ * Bindless texture handles in a uniform buffer
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "TextureTable.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+#include "GpuMemory.hpp"
+
+TextureTable::TextureTable(int capacity)
+    : capacity_(std::min(std::max(capacity, 1), maxCapacity))
+    , buffer_(0)
+    , handles_(capacity_, 0)
+    , count_(0)
+    , dirtyfirst_(capacity_)
+    , dirtylast_(-1) {
+    for (int i = capacity_ - 1; i >= 0; i--) {
+        free_.push_back(i);
+    }
+}
+
+TextureTable::~TextureTable() {
+    for (uint64_t handle : handles_) {
+        if (handle != 0) {
+            glMakeTextureHandleNonResidentARB(handle);
+        }
+    }
+    if (buffer_ != 0) {
+        gpumem::deleteBuffers(1, &buffer_);
+    }
+}
+
+bool TextureTable::supported() {
+    // GLEW with glewExperimental reports the extension when the driver only has its
+    // functions, as Mesa does without the shader side, so the list is asked as well
+    static const bool supported = [] {
+        if (!GLEW_ARB_bindless_texture) {
+            return false;
+        }
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++) {
+            const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if (name != nullptr && strcmp(name, "GL_ARB_bindless_texture") == 0) {
+                return true;
+            }
+        }
+        return false;
+    }();
+    return supported;
+}
+
+int TextureTable::add(GLuint texture) {
+    if (!supported()) {
+        std::cerr << "TextureTable::add(): ARB_bindless_texture is not supported\n";
+        return -1;
+    }
+    if (free_.empty()) {
+        std::cerr << "TextureTable::add(): the table is full (" << capacity_ << " textures)\n";
+        return -1;
+    }
+    const GLuint64 handle = glGetTextureHandleARB(texture);
+    if (handle == 0) {
+        std::cerr << "TextureTable::add(): texture " << texture << " has no handle\n";
+        return -1;
+    }
+    // The same texture may be in the table twice, and its handle is resident from the
+    // first add() until the last remove()
+    if (!glIsTextureHandleResidentARB(handle)) {
+        glMakeTextureHandleResidentARB(handle);
+    }
+    const int index = free_.back();
+    free_.pop_back();
+    handles_[index] = handle;
+    count_++;
+    dirtyfirst_ = std::min(dirtyfirst_, index);
+    dirtylast_ = std::max(dirtylast_, index);
+    return index;
+}
+
+void TextureTable::remove(int index) {
+    if (index < 0 || index >= capacity_ || handles_[index] == 0) {
+        std::cerr << "TextureTable::remove(): no texture at index " << index << "\n";
+        return;
+    }
+    const uint64_t handle = handles_[index];
+    handles_[index] = 0;
+    if (std::find(handles_.begin(), handles_.end(), handle) == handles_.end()) {
+        glMakeTextureHandleNonResidentARB(handle);
+    }
+    // Lowest index last, so that the table stays packed at the start
+    free_.insert(std::upper_bound(free_.begin(), free_.end(), index, std::greater<int>()),
+                 index);
+    count_--;
+    dirtyfirst_ = std::min(dirtyfirst_, index);
+    dirtylast_ = std::max(dirtylast_, index);
+}
+
+int TextureTable::size() const { return count_; }
+
+void TextureTable::upload() {
+    if (buffer_ == 0) {
+        // uvec4 per two handles in std140, which is what the block of fragment.glsl is
+        const size_t bytes = size_t(maxCapacity) * sizeof(uint64_t);
+        glGenBuffers(1, &buffer_);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+        glBufferData(GL_UNIFORM_BUFFER, bytes, nullptr, GL_DYNAMIC_DRAW);
+        gpumem::setBuffer(buffer_, gpumem::Category::Buffer, bytes);
+        dirtyfirst_ = 0;
+        dirtylast_ = capacity_ - 1;
+    } else if (dirtyfirst_ <= dirtylast_) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+    }
+    if (dirtyfirst_ <= dirtylast_) {
+        glBufferSubData(GL_UNIFORM_BUFFER, dirtyfirst_ * sizeof(uint64_t),
+                        (dirtylast_ - dirtyfirst_ + 1) * sizeof(uint64_t),
+                        handles_.data() + dirtyfirst_);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    dirtyfirst_ = capacity_;
+    dirtylast_ = -1;
+}
+
+void TextureTable::bind(GLuint binding) const {
+    if (buffer_ == 0) {
+        std::cerr << "TextureTable::bind(): upload() the table first\n";
+        return;
+    }
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer_);
+}
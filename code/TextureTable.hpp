@@ -0,0 +1,66 @@
+/*
+ * A table of bindless texture handles in a uniform buffer, so that a shader picks its
+ * texture by an index instead of by the texture unit it is bound to.
+ *
+ * Usage: add() a texture once it is complete, which makes its ARB_bindless_texture handle
+ *        resident and returns its index in the table. Call upload() before drawing, which
+ *        sends the entries changed since the last upload, and bind() the table to
+ *        textureBlockBinding, where Shader connects the TextureData block of the shaders.
+ *        A shader compiled with BINDLESS (fragment.glsl) then reads the texture of the
+ *        uniform textureIndex, and draws of different textures need no glBindTexture()
+ *        between them. The parameters of a texture can not change once it has a handle.
+ *        remove() makes the handle non-resident again and frees the index for reuse.
+ *        Without the extension, supported() is false and add() fails, and the callers
+ *        bind their textures to units as before.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstdint>
+#include <vector>
+
+class TextureTable {
+public:
+    /* Constructor: room for 'capacity' handles, at most what the uniform block of
+     * fragment.glsl holds (maxCapacity) */
+    explicit TextureTable(int capacity = maxCapacity);
+
+    /* Destructor: make the handles non-resident and delete the buffer */
+    ~TextureTable();
+
+    TextureTable(const TextureTable&) = delete;
+    TextureTable& operator=(const TextureTable&) = delete;
+
+    // Handles in the TextureData block, 16 KB, the smallest GL_MAX_UNIFORM_BLOCK_SIZE allowed
+    static constexpr int maxCapacity = 2048;
+
+    // True if the current context has ARB_bindless_texture
+    static bool supported();
+
+    // Make the handle of 'texture' resident and return its index, -1 if the table is full
+    // or handles are not supported
+    int add(GLuint texture);
+
+    // Make the handle at 'index' non-resident and free the index
+    void remove(int index);
+
+    // Number of textures in the table
+    int size() const;
+
+    // Send the entries changed since the last upload to the GPU
+    void upload();
+
+    // Bind the table to the uniform block binding point 'binding'
+    void bind(GLuint binding) const;
+
+private:
+    int capacity_;
+    GLuint buffer_;                  // The uniform buffer, created on first upload
+    std::vector<uint64_t> handles_;  // 0 for free entries
+    std::vector<int> free_;          // Free indices, the lowest last
+    int count_;
+    int dirtyfirst_;                 // Range of entries not uploaded yet, empty if first > last
+    int dirtylast_;
+};
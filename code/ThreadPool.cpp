@@ -0,0 +1,164 @@
+/*
+ * A pool of worker threads with work stealing, for jobs and data parallel loops
+ *
+ * This code is in the public domain.
+ */
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+#include "Trace.hpp"
+
+namespace {
+
+// The pool and queue of a worker thread, for run() and wait() on that thread
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local unsigned int currentQueue = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(unsigned int numthreads) : queued_(0), stop_(false) {
+    if (numthreads == 0) {
+        numthreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (unsigned int i = 0; i < numthreads; i++) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    // The thread calling parallelFor() takes part in the work, so start one thread less
+    for (unsigned int i = 1; i < numthreads; i++) {
+        workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+unsigned int ThreadPool::size() const { return static_cast<unsigned int>(workers_.size()) + 1; }
+
+ThreadPool& ThreadPool::global() {
+    static ThreadPool pool;
+    return pool;
+}
+
+unsigned int ThreadPool::queueIndex() const { return (currentPool == this) ? currentQueue : 0; }
+
+void ThreadPool::workerLoop(unsigned int index) {
+    currentPool = this;
+    currentQueue = index;
+    TRACE_THREAD("worker");
+    for (;;) {
+        if (runOneJob(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this] { return stop_ || queued_ > 0; });
+        if (stop_ && queued_ == 0) {
+            return;  // No work is left
+        }
+    }
+}
+
+bool ThreadPool::runOneJob(unsigned int index) {
+    if (queued_ == 0) {
+        return false;
+    }
+    Job job;
+    bool found = false;
+    {
+        Queue& own = *queues_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            found = true;
+        }
+    }
+    const size_t numqueues = queues_.size();
+    for (size_t k = 1; k < numqueues && !found; k++) {
+        Queue& other = *queues_[(index + k) % numqueues];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.jobs.empty()) {
+            job = std::move(other.jobs.front());
+            other.jobs.pop_front();
+            found = true;
+        }
+    }
+    if (!found) {
+        return false;
+    }
+    queued_--;
+
+    job.fn();
+    if (job.counter->count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        // The last job of the counter: wake the threads in wait(). Taking the lock orders
+        // this with their check of the counter.
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        condition_.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::run(JobCounter& counter, std::function<void()> job) {
+    counter.count_.fetch_add(1, std::memory_order_relaxed);
+    if (workers_.empty()) {
+        job();  // Nobody else would run it
+        counter.count_.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+    {
+        Queue& queue = *queues_[queueIndex()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back({std::move(job), &counter});
+    }
+    queued_++;
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    condition_.notify_one();
+}
+
+void ThreadPool::wait(JobCounter& counter) {
+    const unsigned int index = queueIndex();
+    while (!counter.done()) {
+        if (runOneJob(index)) {
+            continue;
+        }
+        // The remaining jobs run on other threads. Sleep until one finishes or is queued.
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [&] { return counter.done() || queued_ > 0; });
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& fn) {
+    if (count <= 0) {
+        return;
+    }
+    if (count == 1 || workers_.empty()) {
+        for (int i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    // All threads grab indices from a shared counter until the range is exhausted
+    std::atomic<int> next(0);
+    auto work = [&]() {
+        for (int i = next++; i < count; i = next++) {
+            fn(i);
+        }
+    };
+
+    JobCounter helpers;
+    const int numhelpers = std::min(static_cast<int>(workers_.size()), count - 1);
+    for (int i = 0; i < numhelpers; i++) {
+        run(helpers, work);
+    }
+    work();
+    wait(helpers);
+}
@@ -0,0 +1,102 @@
+/*
+ * A pool of worker threads for jobs and data parallel loops, shared by the whole program.
+ *
+ * Usage: Call parallelFor() with a count and a function taking an index. The function is
+ *        called once for every index in [0, count), spread over the worker threads and the
+ *        calling thread. parallelFor() returns when all calls have finished.
+ *        For work that is not a loop, run() starts a job and counts it in a JobCounter, and
+ *        wait() returns when all jobs of the counter have finished. A job may run() child
+ *        jobs on the same counter, so that waiting for the parent includes the children,
+ *        or on a counter of its own to wait for in the middle of the job.
+ *        ThreadPool::global() returns a pool shared by the whole program with one thread
+ *        per hardware core.
+ *        Each thread has a queue of its own. Jobs started on a worker go to its queue, and
+ *        the worker takes the newest job first, which keeps recursive work in the cache.
+ *        A thread whose queue is empty steals the oldest job of another queue, which is
+ *        usually the largest. A thread that waits in wait() or parallelFor() runs other jobs
+ *        meanwhile instead of blocking, so jobs may wait for their children and loops may be
+ *        nested.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* The number of unfinished jobs started with ThreadPool::run() */
+class JobCounter {
+public:
+    JobCounter() : count_(0) {}
+
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    // True when all jobs have finished
+    bool done() const { return count_.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class ThreadPool;
+    std::atomic<int> count_;
+};
+
+class ThreadPool {
+public:
+    /* Constructor: start numthreads worker threads (0 means one per hardware core) */
+    explicit ThreadPool(unsigned int numthreads = 0);
+
+    /* Destructor: finish queued work and join all worker threads */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that work on a parallelFor(), including the calling thread
+    unsigned int size() const;
+
+    // Call fn(i) for all i in [0, count) in parallel, and wait for all calls to finish
+    void parallelFor(int count, const std::function<void(int)>& fn);
+
+    // Start 'job' on some thread of the pool, counted in 'counter' until it has finished
+    void run(JobCounter& counter, std::function<void()> job);
+
+    // Run jobs until all jobs of 'counter' have finished
+    void wait(JobCounter& counter);
+
+    // The pool shared by the whole program
+    static ThreadPool& global();
+
+private:
+    struct Job {
+        std::function<void()> fn;
+        JobCounter* counter;
+    };
+
+    // The jobs of one thread. The owner pushes and pops at the back, thieves at the front.
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    void workerLoop(unsigned int index);
+
+    // Queue of the calling thread: its own for a worker, queue 0 for all other threads
+    unsigned int queueIndex() const;
+
+    // Take a job from queue 'index', or steal one from another queue, and run it.
+    // False if all queues were empty.
+    bool runOneJob(unsigned int index);
+
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<Queue>> queues_;  // One per thread, workers from 1
+    std::atomic<int> queued_;  // Jobs in all queues
+    std::mutex mutex_;         // For sleeping in condition_
+    std::condition_variable condition_;  // Signalled for new jobs and for finished counters
+    bool stop_;
+};
@@ -0,0 +1,221 @@
+/*
+ * A timeline of the threads and the GPU in per-thread buffers, written as a Chrome trace
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "Trace.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Time 0 of the trace
+const Clock::time_point epoch = Clock::now();
+
+int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+}
+
+struct Event {
+    const char* name;
+    int64_t time;  // Nanoseconds since the epoch
+    char phase;    // 'B' or 'E', as in trace_event JSON
+};
+
+// Events in the order they were recorded, published by 'count'
+struct Chunk {
+    static constexpr size_t capacity = 4096;
+    Event events[capacity];
+    std::atomic<size_t> count{0};
+    std::atomic<Chunk*> next{nullptr};
+};
+
+// The events of one thread, written only by that thread
+struct ThreadBuffer {
+    int id = 0;
+    std::atomic<const char*> name{nullptr};
+    Chunk first;
+    Chunk* last = &first;  // Of the writing thread
+
+    void append(const char* eventname, int64_t time, char phase) {
+        Chunk* chunk = last;
+        size_t count = chunk->count.load(std::memory_order_relaxed);
+        if (count == Chunk::capacity) {
+            Chunk* next = new Chunk();
+            chunk->next.store(next, std::memory_order_release);
+            last = next;
+            chunk = next;
+            count = 0;
+        }
+        chunk->events[count] = {eventname, time, phase};
+        chunk->count.store(count + 1, std::memory_order_release);
+    }
+};
+
+// All buffers, which live as long as the program, so threads that ended still show up
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadBuffer*> buffers;
+
+    ThreadBuffer* add() {
+        ThreadBuffer* buffer = new ThreadBuffer();
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer->id = static_cast<int>(buffers.size()) + 1;
+        buffers.push_back(buffer);
+        return buffer;
+    }
+};
+
+Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+thread_local ThreadBuffer* threadbuffer = nullptr;
+
+ThreadBuffer& buffer() {
+    if (threadbuffer == nullptr) {
+        threadbuffer = registry().add();
+    }
+    return *threadbuffer;
+}
+
+// A timestamp query on its way back from the GPU
+struct Query {
+    GLuint query;
+    const char* name;
+    char phase;
+};
+
+// The GPU timeline, written by the thread of the context under the lock
+struct Gpu {
+    std::mutex mutex;
+    std::deque<Query> pending;
+    std::vector<GLuint> unused;
+    ThreadBuffer* buffer = nullptr;
+
+    void query(const char* name, char phase) {
+        std::lock_guard<std::mutex> lock(mutex);
+        GLuint query = 0;
+        if (unused.empty()) {
+            glGenQueries(1, &query);
+        } else {
+            query = unused.back();
+            unused.pop_back();
+        }
+        glQueryCounter(query, GL_TIMESTAMP);
+        pending.push_back({query, name, phase});
+    }
+};
+
+Gpu& gpu() {
+    static Gpu* instance = new Gpu();
+    return *instance;
+}
+
+}  // namespace
+
+namespace trace {
+
+namespace detail {
+std::atomic<bool> recording{false};
+}
+
+void start() { detail::recording.store(true); }
+
+void stop() { detail::recording.store(false); }
+
+void begin(const char* name) { buffer().append(name, now(), 'B'); }
+
+void end() { buffer().append("", now(), 'E'); }
+
+void setThreadName(const char* name) { buffer().name.store(name); }
+
+void gpuBegin(const char* name) { gpu().query(name, 'B'); }
+
+void gpuEnd() { gpu().query("", 'E'); }
+
+void collectGpu() {
+    Gpu& g = gpu();
+    std::lock_guard<std::mutex> lock(g.mutex);
+    if (g.pending.empty()) {
+        return;
+    }
+    if (g.buffer == nullptr) {
+        g.buffer = registry().add();
+        g.buffer->name.store("GPU");
+    }
+    // The GPU clock at about the same moment as the CPU clock, which gives the offset
+    GLint64 gputime = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gputime);
+    const int64_t offset = now() - static_cast<int64_t>(gputime);
+
+    // The queries finish in order, so stop at the first that has not
+    while (!g.pending.empty()) {
+        const Query& query = g.pending.front();
+        GLint available = 0;
+        glGetQueryObjectiv(query.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break;
+        }
+        GLuint64 time = 0;
+        glGetQueryObjectui64v(query.query, GL_QUERY_RESULT, &time);
+        g.buffer->append(query.name, static_cast<int64_t>(time) + offset, query.phase);
+        g.unused.push_back(query.query);
+        g.pending.pop_front();
+    }
+}
+
+bool write(const std::string& filename) {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file) {
+        std::cerr << "trace::write(): could not create " << filename << "\n";
+        return false;
+    }
+    std::vector<ThreadBuffer*> buffers;
+    {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        buffers = r.buffers;
+    }
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    const char* separator = "\n";
+    for (const ThreadBuffer* thread : buffers) {
+        const char* name = thread->name.load();
+        if (name != nullptr) {
+            fprintf(file,
+                    "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                    "\"args\": {\"name\": \"%s\"}}",
+                    separator, thread->id, name);
+            separator = ",\n";
+        }
+        // Only the events that the writing thread has published
+        for (const Chunk* chunk = &thread->first; chunk != nullptr;
+             chunk = chunk->next.load(std::memory_order_acquire)) {
+            const size_t count = chunk->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++) {
+                const Event& event = chunk->events[i];
+                fprintf(file,
+                        "%s{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, "
+                        "\"tid\": %d}",
+                        separator, event.name, event.phase, double(event.time) / 1000.0,
+                        thread->id);
+                separator = ",\n";
+            }
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+}  // namespace trace
@@ -0,0 +1,99 @@
+/*
+ * A timeline of what every thread and the GPU did, written as a Chrome trace to look at in
+ * chrome://tracing or ui.perfetto.dev, to see stalls and how busy the threads are.
+ *
+ * Usage: Put TRACE_SCOPE("name") at the start of a block to record the block on the timeline
+ *        of its thread, or TRACE_BEGIN("name") and TRACE_END() around a span that is not a
+ *        block. TRACE_GPU_BEGIN() and TRACE_GPU_END(), on the thread of the GL context, put
+ *        GL_TIMESTAMP queries around GL commands, which TRACE_GPU_COLLECT(), once per frame,
+ *        reads once they are done and puts on a "GPU" timeline, moved to the CPU clock by
+ *        reading the GPU clock and the CPU clock together. TRACE_THREAD("name") names the
+ *        timeline of the calling thread. Nothing is recorded until start(), and write()
+ *        writes what was recorded, in trace_event JSON, which Tracy can import too.
+ *        Each thread appends its events to a buffer of its own, a list of fixed size
+ *        chunks, without locks: only the thread itself writes, and write() reads the
+ *        events that a chunk has published with an atomic count. When the program is built
+ *        with TNM046_NO_TRACE, the macros compile to nothing. Names must stay valid
+ *        (literals).
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <atomic>
+#include <string>
+
+namespace trace {
+
+namespace detail {
+extern std::atomic<bool> recording;
+}
+
+// Start and stop recording, which is off when the program starts
+void start();
+void stop();
+
+// True while recording
+inline bool enabled() { return detail::recording.load(std::memory_order_relaxed); }
+
+// Spans of the calling thread, which end in the reverse order they began
+void begin(const char* name);
+void end();
+
+// Name the timeline of the calling thread
+void setThreadName(const char* name);
+
+// Spans of GL commands, on the thread of the context
+void gpuBegin(const char* name);
+void gpuEnd();
+
+/* Put the GPU spans whose queries are done on the GPU timeline, without waiting for the
+ * others. Call once per frame on the thread of the context. */
+void collectGpu();
+
+/* Write everything recorded so far to 'filename' as Chrome trace_event JSON. False if the
+ * file can not be written. */
+bool write(const std::string& filename);
+
+// A span for the life of the object
+class Scope {
+public:
+    explicit Scope(const char* name) : active_(enabled()) {
+        if (active_) {
+            begin(name);
+        }
+    }
+    ~Scope() {
+        if (active_) {
+            end();
+        }
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    bool active_;  // A span that began before stop() still ends
+};
+
+}  // namespace trace
+
+#if defined(TNM046_NO_TRACE)
+#define TRACE_SCOPE(name) static_cast<void>(0)
+#define TRACE_BEGIN(name) static_cast<void>(0)
+#define TRACE_END() static_cast<void>(0)
+#define TRACE_GPU_BEGIN(name) static_cast<void>(0)
+#define TRACE_GPU_END() static_cast<void>(0)
+#define TRACE_GPU_COLLECT() static_cast<void>(0)
+#define TRACE_THREAD(name) static_cast<void>(0)
+#else
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(tracescope, __LINE__)(name)
+#define TRACE_BEGIN(name) (trace::enabled() ? trace::begin(name) : static_cast<void>(0))
+#define TRACE_END() (trace::enabled() ? trace::end() : static_cast<void>(0))
+#define TRACE_GPU_BEGIN(name) (trace::enabled() ? trace::gpuBegin(name) : static_cast<void>(0))
+#define TRACE_GPU_END() (trace::enabled() ? trace::gpuEnd() : static_cast<void>(0))
+#define TRACE_GPU_COLLECT() trace::collectGpu()
+#define TRACE_THREAD(name) trace::setThreadName(name)
+#endif
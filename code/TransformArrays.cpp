@@ -0,0 +1,168 @@
+/*
+ * Batched computation of model-view matrices from structure of arrays transformations
+ *
+ * This code is in the public domain.
+ */
+#include "TransformArrays.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+int TransformArrays::size() const { return static_cast<int>(tx.size()); }
+
+void TransformArrays::resize(int count) {
+    for (std::vector<float>* a : {&tx, &ty, &tz, &qx, &qy, &qz}) {
+        a->resize(count, 0.0f);
+    }
+    for (std::vector<float>* a : {&qw, &sx, &sy, &sz}) {
+        a->resize(count, 1.0f);
+    }
+}
+
+void TransformArrays::set(int i, float x, float y, float z, float rx, float ry, float rz,
+                          float s) {
+    tx[i] = x;
+    ty[i] = y;
+    tz[i] = z;
+    setRotation(i, rx, ry, rz);
+    sx[i] = s;
+    sy[i] = s;
+    sz[i] = s;
+}
+
+void TransformArrays::setRotation(int i, float rx, float ry, float rz) {
+    // The product of the quaternions for rz, ry and rx, in that order, from half angles
+    float sa, ca, sb, cb, sc, cc;
+    Mat4::sincos(0.5f * rx, sa, ca);
+    Mat4::sincos(0.5f * ry, sb, cb);
+    Mat4::sincos(0.5f * rz, sc, cc);
+    qx[i] = cc * cb * sa - sc * sb * ca;
+    qy[i] = cc * sb * ca + sc * cb * sa;
+    qz[i] = sc * cb * ca - cc * sb * sa;
+    qw[i] = cc * cb * ca + sc * sb * sa;
+}
+
+namespace {
+
+// One object at a time, for the objects left over after the SIMD loop
+void composeOne(const Mat4& view, const TransformArrays& nodes, int i, float* matrix) {
+    const float x = nodes.qx[i], y = nodes.qy[i], z = nodes.qz[i], w = nodes.qw[i];
+    // Columns of the model matrix: rotation * scaling, and the translation
+    const float model[4][4] = {
+        {nodes.sx[i] * (1.0f - 2.0f * (y * y + z * z)), nodes.sx[i] * 2.0f * (x * y + w * z),
+         nodes.sx[i] * 2.0f * (x * z - w * y), 0.0f},
+        {nodes.sy[i] * 2.0f * (x * y - w * z), nodes.sy[i] * (1.0f - 2.0f * (x * x + z * z)),
+         nodes.sy[i] * 2.0f * (y * z + w * x), 0.0f},
+        {nodes.sz[i] * 2.0f * (x * z + w * y), nodes.sz[i] * 2.0f * (y * z - w * x),
+         nodes.sz[i] * (1.0f - 2.0f * (x * x + y * y)), 0.0f},
+        {nodes.tx[i], nodes.ty[i], nodes.tz[i], 1.0f}};
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            matrix[4 * c + r] = view[r] * model[c][0] + view[4 + r] * model[c][1] +
+                                view[8 + r] * model[c][2] + view[12 + r] * model[c][3];
+        }
+    }
+}
+
+}  // namespace
+
+void composeTransforms(const Mat4& view, const TransformArrays& nodes, int begin, int end,
+                       float* matrices) {
+    int i = begin;
+#if defined(TNM046_MAT4_SSE)
+    // The view matrix elements, each broadcast to all four lanes
+    __m128 v[16];
+    for (int k = 0; k < 16; k++) {
+        v[k] = _mm_set1_ps(view[k]);
+    }
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+
+    // Four objects at a time, one object per lane
+    for (; i + 4 <= end; i += 4) {
+        const __m128 x = _mm_loadu_ps(&nodes.qx[i]);
+        const __m128 y = _mm_loadu_ps(&nodes.qy[i]);
+        const __m128 z = _mm_loadu_ps(&nodes.qz[i]);
+        const __m128 w = _mm_loadu_ps(&nodes.qw[i]);
+        const __m128 sx = _mm_loadu_ps(&nodes.sx[i]);
+        const __m128 sy = _mm_loadu_ps(&nodes.sy[i]);
+        const __m128 sz = _mm_loadu_ps(&nodes.sz[i]);
+
+        const __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        const __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        const __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+        // model[c][r]: row r of column c of the model matrix, for four objects
+        __m128 model[4][4];
+        model[0][0] = _mm_mul_ps(sx, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))));
+        model[0][1] = _mm_mul_ps(sx, _mm_mul_ps(two, _mm_add_ps(xy, wz)));
+        model[0][2] = _mm_mul_ps(sx, _mm_mul_ps(two, _mm_sub_ps(xz, wy)));
+        model[1][0] = _mm_mul_ps(sy, _mm_mul_ps(two, _mm_sub_ps(xy, wz)));
+        model[1][1] = _mm_mul_ps(sy, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))));
+        model[1][2] = _mm_mul_ps(sy, _mm_mul_ps(two, _mm_add_ps(yz, wx)));
+        model[2][0] = _mm_mul_ps(sz, _mm_mul_ps(two, _mm_add_ps(xz, wy)));
+        model[2][1] = _mm_mul_ps(sz, _mm_mul_ps(two, _mm_sub_ps(yz, wx)));
+        model[2][2] = _mm_mul_ps(sz, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))));
+        model[3][0] = _mm_loadu_ps(&nodes.tx[i]);
+        model[3][1] = _mm_loadu_ps(&nodes.ty[i]);
+        model[3][2] = _mm_loadu_ps(&nodes.tz[i]);
+
+        for (int c = 0; c < 4; c++) {
+            // Row r of column c of view * model. The bottom row of the model is 0 0 0 1.
+            __m128 rows[4];
+            for (int r = 0; r < 4; r++) {
+                rows[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v[r], model[c][0]),
+                                                _mm_mul_ps(v[4 + r], model[c][1])),
+                                     _mm_mul_ps(v[8 + r], model[c][2]));
+                if (c == 3) {
+                    rows[r] = _mm_add_ps(rows[r], v[12 + r]);
+                }
+            }
+            // From one row per register to one object per register
+            _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+            for (int k = 0; k < 4; k++) {
+                _mm_storeu_ps(matrices + 16 * size_t(i + k) + 4 * c, rows[k]);
+            }
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        composeOne(view, nodes, i, matrices + 16 * size_t(i));
+    }
+}
+
+void composeTransforms(const Mat4& view, const TransformArrays& nodes, float* matrices) {
+    composeTransforms(view, nodes, 0, nodes.size(), matrices);
+}
+
+void interpolateTransforms(const TransformArrays& from, const TransformArrays& to, float alpha,
+                           TransformArrays& result) {
+    if (alpha <= 0.0f || alpha >= 1.0f) {
+        result = alpha <= 0.0f ? from : to;
+        return;
+    }
+    const int count = std::min(from.size(), to.size());
+    result.resize(count);
+    auto mix = [alpha](float a, float b) { return a + (b - a) * alpha; };
+    for (int i = 0; i < count; i++) {
+        result.tx[i] = mix(from.tx[i], to.tx[i]);
+        result.ty[i] = mix(from.ty[i], to.ty[i]);
+        result.tz[i] = mix(from.tz[i], to.tz[i]);
+        result.sx[i] = mix(from.sx[i], to.sx[i]);
+        result.sy[i] = mix(from.sy[i], to.sy[i]);
+        result.sz[i] = mix(from.sz[i], to.sz[i]);
+        // q and -q are the same rotation, and the one nearer 'from' is the shorter way
+        const float dot = from.qx[i] * to.qx[i] + from.qy[i] * to.qy[i] +
+                          from.qz[i] * to.qz[i] + from.qw[i] * to.qw[i];
+        const float sign = dot < 0.0f ? -1.0f : 1.0f;
+        const float x = mix(from.qx[i], sign * to.qx[i]);
+        const float y = mix(from.qy[i], sign * to.qy[i]);
+        const float z = mix(from.qz[i], sign * to.qz[i]);
+        const float w = mix(from.qw[i], sign * to.qw[i]);
+        const float scale = 1.0f / std::sqrt(x * x + y * y + z * z + w * w);
+        result.qx[i] = x * scale;
+        result.qy[i] = y * scale;
+        result.qz[i] = z * scale;
+        result.qw[i] = w * scale;
+    }
+}
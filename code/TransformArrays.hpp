@@ -0,0 +1,57 @@
+/*
+ * Translation, rotation and scaling of many objects, stored as a structure of arrays,
+ * and a batch function to turn them all into model-view matrices.
+ *
+ * Usage: resize() the arrays to the number of objects and set the components of each
+ *        object, or use set(). Rotations are unit quaternions (x, y, z, w), so no sines or
+ *        cosines are needed per frame. setRotation() converts from Euler angles.
+ *        composeTransforms() writes view * translation * rotation * scaling for every object
+ *        as 16 floats in column major order, e.g. into the pointer returned by
+ *        TriangleSoup::mapInstanceTransforms(). It handles 4 objects at a time with SSE.
+ *        To use several threads, split the objects into ranges, one per thread.
+ *        interpolateTransforms() blends two sets of the same objects, e.g. the last two
+ *        steps of a FixedTimestep simulation, for a frame drawn between them.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <vector>
+
+#include "Mat4.hpp"
+
+struct TransformArrays {
+    std::vector<float> tx, ty, tz;      // Translation
+    std::vector<float> qx, qy, qz, qw;  // Rotation quaternion, which must have unit length
+    std::vector<float> sx, sy, sz;      // Scaling
+
+    int size() const;
+
+    // Change the number of objects. New objects get the identity transformation.
+    void resize(int count);
+
+    // Set all components of object i
+    void set(int i, float x, float y, float z, float rx, float ry, float rz, float s);
+
+    // Set the rotation of object i from Euler angles, with the same order as Mat4::trs()
+    void setRotation(int i, float rx, float ry, float rz);
+};
+
+/*
+ * Write view * translation * rotation * scaling for objects begin ... end - 1 of 'nodes'
+ * to matrices[16 * i] ... matrices[16 * i + 15]. 'matrices' need no particular alignment.
+ */
+void composeTransforms(const Mat4& view, const TransformArrays& nodes, int begin, int end,
+                       float* matrices);
+
+// Write the matrices of all objects
+void composeTransforms(const Mat4& view, const TransformArrays& nodes, float* matrices);
+
+/*
+ * Blend the objects of 'from' and 'to' into 'result', by 'alpha' from 0 for 'from' to 1 for
+ * 'to': linearly for the translation and the scaling, and along the shorter way for the
+ * rotation, normalized after the linear blend, which is close to a slerp for the small
+ * angles of one step. 0 and 1 copy the arrays exactly.
+ */
+void interpolateTransforms(const TransformArrays& from, const TransformArrays& to, float alpha,
+                           TransformArrays& result);
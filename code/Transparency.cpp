@@ -0,0 +1,230 @@
+/*
+ * Weighted blended and linked list order independent transparency
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "Transparency.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+// The end of a list, which every head holds when there are no fragments
+constexpr GLuint listEnd = 0xffffffffu;
+
+// The units of the head image and the fragment image buffer
+constexpr GLuint headUnit = 0;
+constexpr GLuint nodeUnit = 1;
+
+}  // namespace
+
+Transparency::Transparency(Mode mode, int fragmentsperpixel)
+    : mode_(mode), fragmentsperpixel_(std::max(fragmentsperpixel, 1)), width_(0), height_(0),
+      heads_(0), nodes_(0), nodetexture_(0), counter_(0), maxnodes_(0), vao_(0),
+      blend_(GL_FALSE), cullface_(GL_FALSE), depthmask_(GL_TRUE),
+      blendfunctions_{GL_ONE, GL_ZERO, GL_ONE, GL_ZERO} {}
+
+Transparency::~Transparency() {
+    if (heads_ != 0) {
+        glstate::deleteTextures(1, &heads_);
+        glstate::deleteTextures(1, &nodetexture_);
+        gpumem::deleteBuffers(1, &nodes_);
+        gpumem::deleteBuffers(1, &counter_);
+    }
+    if (vao_ != 0) {
+        glstate::deleteVertexArrays(1, &vao_);
+    }
+}
+
+bool Transparency::linkedListsSupported() {
+    return GLEW_ARB_shader_image_load_store && GLEW_ARB_shader_atomic_counters;
+}
+
+bool Transparency::parseMode(const std::string& name, Mode& mode) {
+    if (name == "weighted") {
+        mode = Mode::WeightedBlended;
+        return true;
+    }
+    if (name == "lists") {
+        mode = Mode::LinkedLists;
+        return true;
+    }
+    return false;
+}
+
+Transparency::Mode Transparency::mode() const { return mode_; }
+
+const char* Transparency::defines() const {
+    return mode_ == Mode::LinkedLists ? "OIT_LISTS" : "OIT_WEIGHTED";
+}
+
+void Transparency::createLists(int width, int height) {
+    if (heads_ == 0) {
+        glGenTextures(1, &heads_);
+        glGenTextures(1, &nodetexture_);
+        glGenBuffers(1, &nodes_);
+        glGenBuffers(1, &counter_);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counter_);
+        glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+        gpumem::setBuffer(counter_, gpumem::Category::Buffer, sizeof(GLuint));
+    }
+    width_ = width;
+    height_ = height;
+    // All lists start empty, and finish() empties them again
+    const std::vector<GLuint> empty(size_t(width) * size_t(height), listEnd);
+    glstate::bindTexture(GL_TEXTURE_2D, heads_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                 empty.data());
+    gpumem::setTexture(heads_, gpumem::Category::RenderTarget,
+                       gpumem::textureBytes(GL_R32UI, width, height));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    // A fragment is its color, its depth and the next fragment in the list
+    maxnodes_ = GLuint(width) * GLuint(height) * GLuint(fragmentsperpixel_);
+    glBindBuffer(GL_TEXTURE_BUFFER, nodes_);
+    glBufferData(GL_TEXTURE_BUFFER, GLsizeiptr(maxnodes_) * 4 * sizeof(GLuint), nullptr,
+                 GL_DYNAMIC_COPY);
+    glstate::bindTexture(GL_TEXTURE_BUFFER, nodetexture_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, nodes_);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    gpumem::setBuffer(nodes_, gpumem::Category::RenderTarget,
+                      size_t(maxnodes_) * 4 * sizeof(GLuint));
+}
+
+bool Transparency::beginTransparent(int width, int height) {
+    if (mode_ == Mode::LinkedLists) {
+        if (!linkedListsSupported()) {
+            std::cerr << "Transparency: linked lists need image load store and atomic "
+                         "counters\n";
+            return false;
+        }
+        if (width != width_ || height != height_) {
+            createLists(width, height);
+        }
+        const GLuint zero = 0;
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counter_);
+        glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(zero), &zero);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+        glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, counter_);
+        glBindImageTexture(headUnit, heads_, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+        glBindImageTexture(nodeUnit, nodetexture_, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+    }
+
+    blend_ = glIsEnabled(GL_BLEND);
+    cullface_ = glIsEnabled(GL_CULL_FACE);
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &depthmask_);
+    glGetIntegerv(GL_BLEND_SRC_RGB, &blendfunctions_[0]);
+    glGetIntegerv(GL_BLEND_DST_RGB, &blendfunctions_[1]);
+    glGetIntegerv(GL_BLEND_SRC_ALPHA, &blendfunctions_[2]);
+    glGetIntegerv(GL_BLEND_DST_ALPHA, &blendfunctions_[3]);
+
+    // Tested against the opaque surfaces, without hiding each other
+    glDepthMask(GL_FALSE);
+    glDisable(GL_CULL_FACE);
+    if (mode_ == Mode::WeightedBlended) {
+        // The weighted colors and weights add up, in RGB and in the second target, and
+        // the alpha of the first target becomes the product of the transparencies. OpenGL
+        // 3.3 has one blend function for all targets.
+        glEnable(GL_BLEND);
+        glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    } else {
+        glDisable(GL_BLEND);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    }
+    return true;
+}
+
+void Transparency::apply(Shader& shader) const {
+    if (mode_ == Mode::LinkedLists) {
+        shader.setUniform("oitHeads", static_cast<GLint>(headUnit));
+        shader.setUniform("oitNodes", static_cast<GLint>(nodeUnit));
+        shader.setUniform("oitMaxNodes", maxnodes_);
+    }
+}
+
+void Transparency::endTransparent() {
+    if (mode_ == Mode::LinkedLists) {
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        // The lists are read by finish()
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glDepthMask(depthmask_);
+    if (cullface_) {
+        glEnable(GL_CULL_FACE);
+    }
+    if (!blend_) {
+        glDisable(GL_BLEND);
+    }
+    glBlendFuncSeparate(static_cast<GLenum>(blendfunctions_[0]),
+                        static_cast<GLenum>(blendfunctions_[1]),
+                        static_cast<GLenum>(blendfunctions_[2]),
+                        static_cast<GLenum>(blendfunctions_[3]));
+}
+
+void Transparency::finish(GLuint accumulation, GLuint weights) {
+    if (mode_ == Mode::LinkedLists && (heads_ == 0 || !linkedListsSupported())) {
+        return;
+    }
+    if (shader_.id() == 0) {
+        shader_.createShader("vertex_fullscreen.glsl", mode_ == Mode::LinkedLists
+                                                           ? "fragment_oit_lists.glsl"
+                                                           : "fragment_oit_weighted.glsl");
+        glGenVertexArrays(1, &vao_);
+    }
+    GLint polygonmode[2];
+    glGetIntegerv(GL_POLYGON_MODE, polygonmode);
+    const GLboolean depthtest = glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean blend = glIsEnabled(GL_BLEND);
+    GLint functions[4];
+    glGetIntegerv(GL_BLEND_SRC_RGB, &functions[0]);
+    glGetIntegerv(GL_BLEND_DST_RGB, &functions[1]);
+    glGetIntegerv(GL_BLEND_SRC_ALPHA, &functions[2]);
+    glGetIntegerv(GL_BLEND_DST_ALPHA, &functions[3]);
+
+    // The shaders give the transparent color, premultiplied, and what shows through
+    glDisable(GL_DEPTH_TEST);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+    shader_.use();
+    if (mode_ == Mode::WeightedBlended) {
+        glstate::activeTexture(GL_TEXTURE0);
+        glstate::bindTexture(GL_TEXTURE_2D, accumulation);
+        glstate::activeTexture(GL_TEXTURE1);
+        glstate::bindTexture(GL_TEXTURE_2D, weights);
+        glstate::activeTexture(GL_TEXTURE0);
+        shader_.setUniform("accumulation", 0);
+        shader_.setUniform("weights", 1);
+    } else {
+        glBindImageTexture(headUnit, heads_, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+        glBindImageTexture(nodeUnit, nodetexture_, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32UI);
+        shader_.setUniform("heads", static_cast<GLint>(headUnit));
+        shader_.setUniform("nodes", static_cast<GLint>(nodeUnit));
+    }
+    glstate::bindVertexArray(vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glstate::bindVertexArray(0);
+    if (mode_ == Mode::LinkedLists) {
+        // The emptied heads are written by the next frame
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    glPolygonMode(GL_FRONT_AND_BACK, static_cast<GLenum>(polygonmode[0]));
+    if (depthtest) {
+        glEnable(GL_DEPTH_TEST);
+    }
+    if (!blend) {
+        glDisable(GL_BLEND);
+    }
+    glBlendFuncSeparate(static_cast<GLenum>(functions[0]), static_cast<GLenum>(functions[1]),
+                        static_cast<GLenum>(functions[2]), static_cast<GLenum>(functions[3]));
+}
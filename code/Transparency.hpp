@@ -0,0 +1,97 @@
+/*
+ * Order independent transparency, so that transparent surfaces need no sorting.
+ *
+ * Usage: Draw the opaque surfaces first. Then draw the transparent ones with a program of
+ *        vertex.glsl and fragment.glsl built with the defines() of the mode, after apply()
+ *        to the program, and with the uniform 'opacity', between beginTransparent() and
+ *        endTransparent(), against the depth buffer of the opaque ones, and finish() them
+ *        into their color buffer.
+ *          - Mode::WeightedBlended (McGuire and Bavoil 2013) adds up the colors weighted
+ *            by their opacity and depth into two textures of the size of the view, an
+ *            RGBA16F texture cleared to accumulationClear and an R16F texture cleared to 0,
+ *            color attachments 0 and 1 of the framebuffer of the transparent draws, with
+ *            the depth buffer of the opaque surfaces. finish() divides the sums into the
+ *            opaque colors, which is exact for surfaces of the same color or opacity and a
+ *            close guess otherwise. It needs OpenGL 3.3, and 10 bytes per pixel.
+ *          - Mode::LinkedLists puts every transparent fragment into a list per pixel in
+ *            image buffers, with the color writes off, so any framebuffer with the opaque
+ *            depth will do. finish() sorts each list by depth and blends it over the opaque
+ *            colors, which is exact up to 'maxfragments' fragments per pixel, of which the
+ *            nearest are kept. The lists hold at most 'fragmentsperpixel' fragments per
+ *            pixel on average, 16 bytes each, and fragments past that are dropped, so the
+ *            memory is bounded. It needs the image load store and atomic counter
+ *            extensions, which OpenGL 4.2 has, see linkedListsSupported().
+ *        finish() draws a full screen triangle with vertex_fullscreen.glsl and
+ *        fragment_oit_weighted.glsl or fragment_oit_lists.glsl, loaded on first use.
+ *        beginTransparent() sets the depth test without depth writes, no face culling and
+ *        the blending of the mode, and endTransparent() and finish() restore them.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <string>
+
+#include "Shader.hpp"
+
+class Transparency {
+public:
+    enum class Mode { WeightedBlended, LinkedLists };
+
+    static constexpr float accumulationClear[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    static constexpr int maxfragments = 16;  // The deepest list that finish() blends
+
+    /* Constructor: the buffers are made by the first beginTransparent() */
+    explicit Transparency(Mode mode = Mode::WeightedBlended, int fragmentsperpixel = 8);
+
+    /* Destructor: delete the buffers and textures */
+    ~Transparency();
+
+    Transparency(const Transparency&) = delete;
+    Transparency& operator=(const Transparency&) = delete;
+
+    // True if OpenGL has what Mode::LinkedLists needs
+    static bool linkedListsSupported();
+
+    // "weighted" or "lists". False for other names.
+    static bool parseMode(const std::string& name, Mode& mode);
+
+    Mode mode() const;
+
+    // The defines of the programs that draw transparent surfaces in this mode
+    const char* defines() const;
+
+    /* Set the state for the transparent draws in a view of 'width' x 'height' pixels, and
+     * bind the lists of Mode::LinkedLists. False if the mode can not work here. */
+    bool beginTransparent(int width, int height);
+
+    // Set the uniforms of a program built with defines(), after beginTransparent()
+    void apply(Shader& shader) const;
+
+    void endTransparent();
+
+    /* Blend the transparent surfaces over the opaque ones in the bound framebuffer. For
+     * Mode::WeightedBlended, 'accumulation' and 'weights' are its two textures. */
+    void finish(GLuint accumulation = 0, GLuint weights = 0);
+
+private:
+    void createLists(int width, int height);
+
+    Mode mode_;
+    int fragmentsperpixel_;
+    int width_;              // Of the lists
+    int height_;
+    GLuint heads_;           // R32UI texture with the first fragment of each pixel
+    GLuint nodes_;           // Buffer of the fragments, and its RGBA32UI buffer texture
+    GLuint nodetexture_;
+    GLuint counter_;         // Atomic counter buffer with the number of fragments
+    GLuint maxnodes_;
+    GLuint vao_;             // Empty VAO for the full screen triangle
+    Shader shader_;
+    // The state that beginTransparent() changes
+    GLboolean blend_;
+    GLboolean cullface_;
+    GLboolean depthmask_;
+    GLint blendfunctions_[4];  // Source and destination of RGB, then of alpha
+};
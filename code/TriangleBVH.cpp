@@ -0,0 +1,639 @@
+/*
+ * Bounding volume hierarchy over triangles, with binned SAH builds and ray queries
+ *
+ * This code is in the public domain.
+ */
+#include "TriangleBVH.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+
+#include "Mat4.hpp"  // For the SIMD instruction set
+#include "ThreadPool.hpp"
+
+namespace {
+
+const int numBins = 16;       // Candidate splits per axis in the SAH build
+const int maxLeafSize = 8;    // Larger leaves are always split
+const int blockWidth = 4;     // Triangles per block, tested together
+const int minJobSize = 4096;  // Smaller subtrees are built by the thread that split them
+const int medianDepth = 96;   // Deeper nodes are split at the median, to bound the depth
+const int maxDepth = 128;     // More than the depth of the tree, with the median splits
+const int stackSize = 3 * maxDepth + 1;  // Each node adds at most 3 entries to the stack
+const float inf = std::numeric_limits<float>::infinity();
+
+struct Aabb {
+    float min[3];
+    float max[3];
+};
+
+Aabb emptyBox() { return {{inf, inf, inf}, {-inf, -inf, -inf}}; }
+
+void grow(Aabb& box, const float* min, const float* max) {
+    for (int c = 0; c < 3; c++) {
+        box.min[c] = std::min(box.min[c], min[c]);
+        box.max[c] = std::max(box.max[c], max[c]);
+    }
+}
+
+// Half the surface area, which is all the SAH needs
+float halfArea(const Aabb& box) {
+    const float dx = std::max(box.max[0] - box.min[0], 0.0f);
+    const float dy = std::max(box.max[1] - box.min[1], 0.0f);
+    const float dz = std::max(box.max[2] - box.min[2], 0.0f);
+    return dx * dy + dy * dz + dz * dx;
+}
+
+// Blocks that 'count' triangles take
+int blocksOf(int count) { return (count + blockWidth - 1) / blockWidth; }
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+#if defined(TNM046_MAT4_SSE)
+// A corner of the box of a Reference, with zero in the lane after z rather than the
+// triangle number, whose bits are a denormal float, which is slow to compute with
+__m128 loadCorner(const float* corner) {
+    return _mm_and_ps(_mm_load_ps(corner), _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)));
+}
+#endif
+
+// Call fn(i) for the chunks [0, count), on the threads of 'pool' if there is one
+void forChunks(int count, ThreadPool* pool, const std::function<void(int)>& fn) {
+    if (pool != nullptr && count > 1) {
+        pool->parallelFor(count, fn);
+    } else {
+        for (int i = 0; i < count; i++) {
+            fn(i);
+        }
+    }
+}
+
+}  // namespace
+
+TriangleBVH::TriangleBVH() : nodecount_(0), numtriangles_(0), buildtime_(0.0) {}
+
+bool TriangleBVH::build(const GLfloat* positions, int stride, size_t numverts,
+                        const std::vector<GLuint>& indices, ThreadPool* pool) {
+    const auto starttime = std::chrono::steady_clock::now();
+    clear();
+    const int n = static_cast<int>(indices.size() / 3);
+    if (std::any_of(indices.begin(), indices.begin() + 3 * size_t(n),
+                    [numverts](GLuint index) { return index >= numverts; })) {
+        std::cerr << "TriangleBVH::build(): index out of range\n";
+        return false;
+    }
+    if (n == 0) {
+        return true;
+    }
+    auto corner = [&](int t, int k) {
+        return positions + size_t(stride) * indices[3 * size_t(t) + k];
+    };
+
+    // The box of each triangle
+    references_.resize(n);
+    const int numchunks = (n + minJobSize - 1) / minJobSize;
+    forChunks(numchunks, pool, [&](int chunk) {
+        const int end = std::min((chunk + 1) * minJobSize, n);
+        for (int t = chunk * minJobSize; t < end; t++) {
+            Reference& reference = references_[t];
+            for (int c = 0; c < 3; c++) {
+                const float a = corner(t, 0)[c], b = corner(t, 1)[c], d = corner(t, 2)[c];
+                reference.min[c] = std::min({a, b, d});
+                reference.max[c] = std::max({a, b, d});
+            }
+            reference.triangle = t;
+        }
+    });
+
+    // A binary tree with at least one triangle per leaf has at most 2n - 1 nodes
+    buildnodes_.assign(2 * size_t(n) - 1, BuildNode());
+    nodecount_ = 1;
+    if (pool && pool->size() > 1 && n > minJobSize) {
+        JobCounter jobs;
+        buildNode({0, 0, n, 0}, pool, &jobs);
+        pool->wait(jobs);
+    } else {
+        buildNode({0, 0, n, 0}, nullptr, nullptr);
+    }
+    buildnodes_.resize(nodecount_);
+
+    // The triangles of each leaf go to blocks of their own, in the order of the leaves
+    std::vector<uint32_t> firstblock(buildnodes_.size());
+    size_t numblocks = 0;
+    for (size_t i = 0; i < buildnodes_.size(); i++) {
+        if (buildnodes_[i].count > 0) {
+            firstblock[i] = static_cast<uint32_t>(numblocks);
+            numblocks += blocksOf(static_cast<int>(buildnodes_[i].count));
+        }
+    }
+    blocks_.resize(numblocks);
+    const int numnodes = static_cast<int>(buildnodes_.size());
+    forChunks((numnodes + minJobSize - 1) / minJobSize, pool, [&](int chunk) {
+        const int end = std::min((chunk + 1) * minJobSize, numnodes);
+        for (int i = chunk * minJobSize; i < end; i++) {
+            BuildNode& node = buildnodes_[i];
+            if (node.count == 0) {
+                continue;
+            }
+            for (uint32_t k = 0; k < uint32_t(blocksOf(int(node.count))) * blockWidth; k++) {
+                Block& block = blocks_[firstblock[i] + k / blockWidth];
+                const int lane = static_cast<int>(k % blockWidth);
+                if (k >= node.count) {
+                    block.triangle[lane] = -1;
+                    continue;
+                }
+                const int t = references_[node.first + k].triangle;
+                const float* a = corner(t, 0);
+                const float* b = corner(t, 1);
+                const float* c = corner(t, 2);
+                for (int j = 0; j < 3; j++) {
+                    block.v0[j][lane] = a[j];
+                    block.e1[j][lane] = b[j] - a[j];
+                    block.e2[j][lane] = c[j] - a[j];
+                }
+                block.triangle[lane] = t;
+            }
+            node.first = firstblock[i];
+        }
+    });
+
+    // Collapse the binary tree top down: each node takes the children of its binary node,
+    // and opens the interior child with the largest box until it has four children
+    nodes_.reserve(buildnodes_.size() / 2 + 1);
+    std::vector<std::pair<uint32_t, uint32_t>> collapse = {{0, 0}};  // Binary and wide node
+    nodes_.emplace_back();
+    while (!collapse.empty()) {
+        const uint32_t binary = collapse.back().first;
+        const uint32_t wide = collapse.back().second;
+        collapse.pop_back();
+        uint32_t children[4] = {binary};
+        int numchildren = 1;
+        if (buildnodes_[binary].count == 0) {
+            children[0] = buildnodes_[binary].first;
+            children[1] = buildnodes_[binary].first + 1;
+            numchildren = 2;
+        }
+        while (numchildren < 4) {
+            int open = -1;
+            float largest = -1.0f;
+            for (int k = 0; k < numchildren; k++) {
+                const BuildNode& child = buildnodes_[children[k]];
+                const Aabb box = {{child.min[0], child.min[1], child.min[2]},
+                                  {child.max[0], child.max[1], child.max[2]}};
+                if (child.count == 0 && halfArea(box) > largest) {
+                    largest = halfArea(box);
+                    open = k;
+                }
+            }
+            if (open < 0) {
+                break;
+            }
+            const uint32_t first = buildnodes_[children[open]].first;
+            children[open] = first;
+            children[numchildren++] = first + 1;
+        }
+        for (int k = 0; k < 4; k++) {
+            const BuildNode* child = k < numchildren ? &buildnodes_[children[k]] : nullptr;
+            uint32_t index = 0;
+            if (child != nullptr && child->count == 0) {
+                index = static_cast<uint32_t>(nodes_.size());
+                nodes_.emplace_back();
+                collapse.push_back({children[k], index});
+            } else if (child != nullptr) {
+                index = child->first;
+            }
+            Node& node = nodes_[wide];
+            for (int c = 0; c < 3; c++) {
+                node.min[c][k] = child != nullptr ? child->min[c] : inf;
+                node.max[c][k] = child != nullptr ? child->max[c] : -inf;
+            }
+            node.child[k] = index;
+            node.count[k] = child != nullptr ? child->count : 0;
+        }
+    }
+    nodes_.shrink_to_fit();
+    numtriangles_ = n;
+    buildnodes_ = std::vector<BuildNode>();
+    references_ = std::vector<Reference>();
+
+    buildtime_ = millisecondsSince(starttime);
+    return true;
+}
+
+void TriangleBVH::buildNode(const BuildTask& root, ThreadPool* pool, JobCounter* jobs) {
+    std::vector<BuildTask> stack = {root};
+    while (!stack.empty()) {
+        const BuildTask task = stack.back();
+        stack.pop_back();
+        BuildNode& node = buildnodes_[task.node];
+
+        // The box of the node, and the box of the centers, which is what the bins divide
+        Aabb box = emptyBox();
+        Aabb centers = emptyBox();
+#if defined(TNM046_MAT4_SSE)
+        __m128 boxmin = _mm_set1_ps(inf), boxmax = _mm_set1_ps(-inf);
+        __m128 centermin = boxmin, centermax = boxmax;
+        for (int i = task.begin; i < task.end; i++) {
+            const __m128 min = loadCorner(references_[i].min);
+            const __m128 max = loadCorner(references_[i].max);
+            const __m128 center = _mm_mul_ps(_mm_add_ps(min, max), _mm_set1_ps(0.5f));
+            boxmin = _mm_min_ps(boxmin, min);
+            boxmax = _mm_max_ps(boxmax, max);
+            centermin = _mm_min_ps(centermin, center);
+            centermax = _mm_max_ps(centermax, center);
+        }
+        alignas(16) float lanes[4][4];
+        _mm_store_ps(lanes[0], boxmin);
+        _mm_store_ps(lanes[1], boxmax);
+        _mm_store_ps(lanes[2], centermin);
+        _mm_store_ps(lanes[3], centermax);
+        box = {{lanes[0][0], lanes[0][1], lanes[0][2]}, {lanes[1][0], lanes[1][1], lanes[1][2]}};
+        centers = {{lanes[2][0], lanes[2][1], lanes[2][2]},
+                   {lanes[3][0], lanes[3][1], lanes[3][2]}};
+#else
+        for (int i = task.begin; i < task.end; i++) {
+            const Reference& reference = references_[i];
+            grow(box, reference.min, reference.max);
+            const float center[3] = {reference.center(0), reference.center(1),
+                                     reference.center(2)};
+            grow(centers, center, center);
+        }
+#endif
+        std::copy_n(box.min, 3, node.min);
+        std::copy_n(box.max, 3, node.max);
+        const int count = task.end - task.begin;
+        node.first = static_cast<uint32_t>(task.begin);
+        node.count = static_cast<uint32_t>(count);
+        // One block costs less than the two of any split
+        if (count <= blockWidth) {
+            continue;
+        }
+
+        // The cheapest split after a bin along any of the axes, with the triangles counted
+        // in blocks, as they are tested. The bins of all three axes are filled in one pass,
+        // and small nodes use fewer bins, no more than their triangles.
+        const int numbins = std::min(count, numBins);
+        struct alignas(16) Bin {
+            float min[4] = {inf, inf, inf, inf};
+            float max[4] = {-inf, -inf, -inf, -inf};
+            int count = 0;
+        };
+        Bin bins[3][numBins];
+        alignas(16) float scale[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int axis = 0; axis < 3; axis++) {
+            const float extent = centers.max[axis] - centers.min[axis];
+            scale[axis] = extent > 0.0f ? float(numbins) / extent : 0.0f;
+        }
+        // The bin of a triangle along an axis, from twice its center as the SIMD code has it
+        auto binOf = [&](const Reference& reference, int axis) {
+            const float center2 = reference.min[axis] + reference.max[axis];
+            const float offset2 = centers.min[axis] + centers.min[axis];
+            return std::min(static_cast<int>((center2 - offset2) * (scale[axis] * 0.5f)),
+                            numbins - 1);
+        };
+#if defined(TNM046_MAT4_SSE)
+        // The bins of the three axes of a triangle at once, with its box in one register
+        const __m128 offset = _mm_setr_ps(centers.min[0], centers.min[1], centers.min[2], 0.0f);
+        const __m128 factor = _mm_mul_ps(_mm_load_ps(scale), _mm_set1_ps(0.5f));
+        for (int i = task.begin; i < task.end; i++) {
+            const Reference& reference = references_[i];
+            const __m128 min = loadCorner(reference.min);
+            const __m128 max = loadCorner(reference.max);
+            const __m128 center2 = _mm_sub_ps(_mm_add_ps(min, max), _mm_add_ps(offset, offset));
+            alignas(16) int index[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(index),
+                            _mm_cvttps_epi32(_mm_mul_ps(center2, factor)));
+            for (int axis = 0; axis < 3; axis++) {
+                Bin& bin = bins[axis][std::min(index[axis], numbins - 1)];
+                _mm_store_ps(bin.min, _mm_min_ps(_mm_load_ps(bin.min), min));
+                _mm_store_ps(bin.max, _mm_max_ps(_mm_load_ps(bin.max), max));
+                bin.count++;
+            }
+        }
+#else
+        for (int i = task.begin; i < task.end; i++) {
+            const Reference& reference = references_[i];
+            for (int axis = 0; axis < 3; axis++) {
+                Bin& bin = bins[axis][binOf(reference, axis)];
+                for (int k = 0; k < 3; k++) {
+                    bin.min[k] = std::min(bin.min[k], reference.min[k]);
+                    bin.max[k] = std::max(bin.max[k], reference.max[k]);
+                }
+                bin.count++;
+            }
+        }
+#endif
+        float bestcost = inf;
+        int bestaxis = -1;
+        int bestsplit = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (scale[axis] == 0.0f) {
+                continue;
+            }
+            float rightcost[numBins];
+            Aabb right = emptyBox();
+            int rightcount = 0;
+            for (int s = numbins - 1; s > 0; s--) {
+                grow(right, bins[axis][s].min, bins[axis][s].max);
+                rightcount += bins[axis][s].count;
+                rightcost[s] = float(blocksOf(rightcount)) * halfArea(right);
+            }
+            Aabb left = emptyBox();
+            int leftcount = 0;
+            for (int s = 0; s < numbins - 1; s++) {
+                grow(left, bins[axis][s].min, bins[axis][s].max);
+                leftcount += bins[axis][s].count;
+                const float cost = float(blocksOf(leftcount)) * halfArea(left) + rightcost[s + 1];
+                if (leftcount > 0 && leftcount < count && cost < bestcost) {
+                    bestcost = cost;
+                    bestaxis = axis;
+                    bestsplit = s;
+                }
+            }
+        }
+        // A leaf costs one test per block, a split one more test for the children
+        const float area = halfArea(box);
+        if (count <= maxLeafSize &&
+            (bestaxis < 0 || bestcost + area >= float(blocksOf(count)) * area)) {
+            continue;
+        }
+
+        auto first = references_.begin() + task.begin;
+        auto last = references_.begin() + task.end;
+        int mid = task.begin + count / 2;
+        if (bestaxis >= 0 && task.depth < medianDepth) {
+            mid = static_cast<int>(
+                std::partition(first, last, [&](const Reference& reference) {
+                    return binOf(reference, bestaxis) <= bestsplit;
+                }) -
+                references_.begin());
+        } else {
+            // The median along the longest axis of the centers, which halves the triangles
+            // also when all centers are in one point
+            int axis = 0;
+            for (int c = 1; c < 3; c++) {
+                if (centers.max[c] - centers.min[c] > centers.max[axis] - centers.min[axis]) {
+                    axis = c;
+                }
+            }
+            std::nth_element(first, references_.begin() + mid, last,
+                             [axis](const Reference& a, const Reference& b) {
+                                 return a.center(axis) < b.center(axis);
+                             });
+        }
+        if (mid == task.begin || mid == task.end) {
+            mid = task.begin + count / 2;
+        }
+
+        const int child = nodecount_.fetch_add(2);
+        node.first = static_cast<uint32_t>(child);
+        node.count = 0;
+        for (const BuildTask& subtree : {BuildTask{child, task.begin, mid, task.depth + 1},
+                                         BuildTask{child + 1, mid, task.end, task.depth + 1}}) {
+            if (pool && subtree.end - subtree.begin > minJobSize) {
+                pool->run(*jobs, [this, subtree, pool, jobs] { buildNode(subtree, pool, jobs); });
+            } else {
+                stack.push_back(subtree);
+            }
+        }
+    }
+}
+
+void TriangleBVH::clear() {
+    nodes_ = std::vector<Node>();
+    blocks_ = std::vector<Block>();
+    nodecount_ = 0;
+    numtriangles_ = 0;
+}
+
+bool TriangleBVH::intersect(const float origin[3], const float direction[3], Hit& hit,
+                            float maxdistance) const {
+    return traverse(origin, direction, hit, maxdistance, false);
+}
+
+bool TriangleBVH::occluded(const float origin[3], const float direction[3],
+                           float maxdistance) const {
+    Hit hit;
+    return traverse(origin, direction, hit, maxdistance, true);
+}
+
+bool TriangleBVH::traverse(const float origin[3], const float direction[3], Hit& hit,
+                           float maxdistance, bool anyhit) const {
+    hit = Hit();
+    if (nodes_.empty()) {
+        return false;
+    }
+    float invdir[3];
+    for (int c = 0; c < 3; c++) {
+        invdir[c] = 1.0f / direction[c];  // Infinite for axis parallel rays, which works
+    }
+    float best = maxdistance;  // Distance of the nearest hit so far
+
+    // The entry distances of the ray into the boxes of the children of a node into
+    // 'times', and bit k set for each child k that the ray enters before the nearest hit.
+    // The planes nearer to the origin come first along the ray, so empty boxes are missed.
+    // NaN distances, of rays in the plane of a box side, do not limit the others.
+    const int nearside[3] = {invdir[0] < 0.0f, invdir[1] < 0.0f, invdir[2] < 0.0f};
+#if defined(TNM046_MAT4_SSE)
+    const __m128 scaled[3] = {_mm_set1_ps(invdir[0]), _mm_set1_ps(invdir[1]),
+                              _mm_set1_ps(invdir[2])};
+    const __m128 start[3] = {_mm_set1_ps(origin[0]), _mm_set1_ps(origin[1]),
+                             _mm_set1_ps(origin[2])};
+    auto enterChildren = [&](const Node& node, float* times) {
+        __m128 tnear[3], tfar[3];
+        for (int c = 0; c < 3; c++) {
+            const __m128 nearplane = _mm_load_ps(nearside[c] ? node.max[c] : node.min[c]);
+            const __m128 farplane = _mm_load_ps(nearside[c] ? node.min[c] : node.max[c]);
+            tnear[c] = _mm_mul_ps(_mm_sub_ps(nearplane, start[c]), scaled[c]);
+            tfar[c] = _mm_mul_ps(_mm_sub_ps(farplane, start[c]), scaled[c]);
+        }
+        // In pairs, for a shorter chain of dependent instructions
+        const __m128 tmin = _mm_max_ps(_mm_max_ps(tnear[0], tnear[1]),
+                                       _mm_max_ps(tnear[2], _mm_setzero_ps()));
+        const __m128 tmax = _mm_min_ps(_mm_min_ps(tfar[0], tfar[1]),
+                                       _mm_min_ps(tfar[2], _mm_set1_ps(best)));
+        _mm_store_ps(times, tmin);
+        return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+    };
+#else
+    auto enterChildren = [&](const Node& node, float* times) {
+        int lanes = 0;
+        for (int k = 0; k < 4; k++) {
+            float tmin = 0.0f;
+            float tmax = best;
+            for (int c = 0; c < 3; c++) {
+                const float nearplane = nearside[c] ? node.max[c][k] : node.min[c][k];
+                const float farplane = nearside[c] ? node.min[c][k] : node.max[c][k];
+                const float t0 = (nearplane - origin[c]) * invdir[c];
+                const float t1 = (farplane - origin[c]) * invdir[c];
+                tmin = t0 > tmin ? t0 : tmin;
+                tmax = t1 < tmax ? t1 : tmax;
+            }
+            times[k] = tmin;
+            lanes |= (tmin <= tmax) << k;
+        }
+        return lanes;
+    };
+#endif
+
+    // Moller and Trumbore, "Fast, Minimum Storage Ray/Triangle Intersection", 1997, for the
+    // four triangles of a block. True if one is hit nearer than 'best'.
+#if defined(TNM046_MAT4_SSE)
+    const __m128 o[3] = {_mm_set1_ps(origin[0]), _mm_set1_ps(origin[1]), _mm_set1_ps(origin[2])};
+    const __m128 d[3] = {_mm_set1_ps(direction[0]), _mm_set1_ps(direction[1]),
+                         _mm_set1_ps(direction[2])};
+    auto testBlock = [&](const Block& block) {
+        __m128 e1[3], e2[3], s[3];
+        for (int c = 0; c < 3; c++) {
+            e1[c] = _mm_load_ps(block.e1[c]);
+            e2[c] = _mm_load_ps(block.e2[c]);
+            s[c] = _mm_sub_ps(o[c], _mm_load_ps(block.v0[c]));
+        }
+        // p = d x e2, q = s x e1
+        const __m128 p[3] = {_mm_sub_ps(_mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1])),
+                             _mm_sub_ps(_mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2])),
+                             _mm_sub_ps(_mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0]))};
+        const __m128 q[3] = {_mm_sub_ps(_mm_mul_ps(s[1], e1[2]), _mm_mul_ps(s[2], e1[1])),
+                             _mm_sub_ps(_mm_mul_ps(s[2], e1[0]), _mm_mul_ps(s[0], e1[2])),
+                             _mm_sub_ps(_mm_mul_ps(s[0], e1[1]), _mm_mul_ps(s[1], e1[0]))};
+        auto dot = [](const __m128* a, const __m128* b) {
+            return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])),
+                              _mm_mul_ps(a[2], b[2]));
+        };
+        const __m128 det = dot(e1, p);
+        const __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), det);
+        const __m128 u = _mm_mul_ps(dot(s, p), inv);
+        const __m128 v = _mm_mul_ps(dot(d, q), inv);
+        const __m128 t = _mm_mul_ps(dot(e2, q), inv);
+        const __m128 zero = _mm_setzero_ps();
+        __m128 mask = _mm_cmpneq_ps(det, zero);
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(t, zero));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(best)));
+        const int lanes = _mm_movemask_ps(mask);
+        if (lanes == 0) {
+            return false;
+        }
+        alignas(16) float ts[4], us[4], vs[4];
+        _mm_store_ps(ts, t);
+        _mm_store_ps(us, u);
+        _mm_store_ps(vs, v);
+        for (int lane = 0; lane < blockWidth; lane++) {
+            if ((lanes & (1 << lane)) && ts[lane] < best) {
+                best = ts[lane];
+                hit = {block.triangle[lane], ts[lane], us[lane], vs[lane]};
+            }
+        }
+        return true;
+    };
+#else
+    auto testBlock = [&](const Block& block) {
+        bool found = false;
+        for (int lane = 0; lane < blockWidth; lane++) {
+            float e1[3], e2[3], s[3];
+            for (int c = 0; c < 3; c++) {
+                e1[c] = block.e1[c][lane];
+                e2[c] = block.e2[c][lane];
+                s[c] = origin[c] - block.v0[c][lane];
+            }
+            const float p[3] = {direction[1] * e2[2] - direction[2] * e2[1],
+                                direction[2] * e2[0] - direction[0] * e2[2],
+                                direction[0] * e2[1] - direction[1] * e2[0]};
+            const float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2],
+                                s[0] * e1[1] - s[1] * e1[0]};
+            const float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+            if (det == 0.0f) {
+                continue;
+            }
+            const float inv = 1.0f / det;
+            const float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+            const float v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * inv;
+            const float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+            if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t < best) {
+                best = t;
+                hit = {block.triangle[lane], t, u, v};
+                found = true;
+            }
+        }
+        return found;
+    };
+#endif
+
+    // Leaves and nodes to visit, with the distances where the ray enters them
+    struct Entry {
+        uint32_t index;  // Node, or first block of a leaf
+        uint32_t count;  // Triangles of a leaf, 0 for a node
+        float time;
+    };
+    Entry stack[stackSize];
+    int top = 0;
+    Entry current = {0, 0, 0.0f};
+    bool found = false;
+    for (;;) {
+        if (current.count > 0) {
+            const uint32_t end = current.index + uint32_t(blocksOf(int(current.count)));
+            for (uint32_t b = current.index; b < end; b++) {
+                if (testBlock(blocks_[b])) {
+                    found = true;
+                    if (anyhit) {
+                        return true;
+                    }
+                }
+            }
+        } else {
+            const Node& node = nodes_[current.index];
+            alignas(16) float times[4];
+            const int lanes = enterChildren(node, times);
+            if (lanes != 0) {
+                // The children in order of the distance where the ray enters them. The
+                // nearest is visited next, and the others are pushed, the farthest first.
+                int order[4];
+                int numentered = 0;
+                for (int k = 0; k < 4; k++) {
+                    if (lanes & (1 << k)) {
+                        int i = numentered++;
+                        for (; i > 0 && times[order[i - 1]] < times[k]; i--) {
+                            order[i] = order[i - 1];
+                        }
+                        order[i] = k;
+                    }
+                }
+                for (int i = 0; i < numentered - 1; i++) {
+                    const int k = order[i];
+                    stack[top++] = {node.child[k], node.count[k], times[k]};
+                }
+                const int k = order[numentered - 1];
+                current = {node.child[k], node.count[k], times[k]};
+                continue;
+            }
+        }
+        // The next entry that the ray may enter before the nearest hit found since it was
+        // pushed
+        do {
+            if (top == 0) {
+                return found;
+            }
+            current = stack[--top];
+        } while (current.time > best);
+    }
+}
+
+bool TriangleBVH::empty() const { return numtriangles_ == 0; }
+
+int TriangleBVH::triangleCount() const { return numtriangles_; }
+
+int TriangleBVH::nodeCount() const { return static_cast<int>(nodes_.size()); }
+
+size_t TriangleBVH::memoryBytes() const {
+    return nodes_.capacity() * sizeof(Node) + blocks_.capacity() * sizeof(Block);
+}
+
+double TriangleBVH::buildTime() const { return buildtime_; }
@@ -0,0 +1,142 @@
+/*
+ * A bounding volume hierarchy over the triangles of a mesh, for ray queries on the CPU:
+ * precise picking, collision and measurements against the surface rather than the boxes of
+ * whole objects, which is what BVH answers.
+ *
+ * Usage: build() the tree from the positions and the index array of a mesh, as
+ *        TriangleSoup::setRayQueries() does before the CPU copies are dropped. The tree
+ *        keeps copies of the triangles of its own, so the arrays may go away afterwards.
+ *        intersect() finds the nearest triangle hit by a ray, with the barycentric
+ *        coordinates of the hit, and occluded() tells whether any triangle is hit closer
+ *        than a distance, which stops at the first hit it finds. Both are thread safe and
+ *        allocate nothing, so many rays can be traced on the threads of a ThreadPool.
+ *        The tree is built with the surface area heuristic (SAH) in 16 bins on each axis,
+ *        with the subtrees built as jobs of a ThreadPool, and then collapsed into a tree of
+ *        4 children per node, whose boxes a ray is tested against together with SSE. Each
+ *        child takes 32 bytes. The triangles of each leaf are stored in blocks of 4, as a
+ *        corner and two edges, which are also tested together.
+ *        The rays are in the coordinates of the vertices, and do not need to be normalized:
+ *        distances are ray parameters, in units of the length of the direction.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class JobCounter;
+class ThreadPool;
+
+class TriangleBVH {
+public:
+    // The nearest hit of a ray
+    struct Hit {
+        int triangle = -1;      // Triangle number in the index array, -1 if nothing was hit
+        float distance = 0.0f;  // Ray parameter of the hit
+        float u = 0.0f;         // Barycentric coordinates of corners 1 and 2 of the triangle
+        float v = 0.0f;         // at the hit, 1 - u - v for corner 0
+    };
+
+    TriangleBVH();
+
+    /* Build the tree over the triangles of 'indices', with the positions of 'numverts'
+     * vertices 'stride' floats apart. With a pool, subtrees are built in parallel. False,
+     * with an empty tree, if an index is out of range. */
+    bool build(const GLfloat* positions, int stride, size_t numverts,
+               const std::vector<GLuint>& indices, ThreadPool* pool = nullptr);
+
+    // Drop the tree and release its memory
+    void clear();
+
+    /* The nearest triangle hit by the ray from 'origin' along 'direction' before
+     * 'maxdistance', into 'hit'. False, with hit.triangle = -1, if none is. Both sides of
+     * the triangles are hit. */
+    bool intersect(const float origin[3], const float direction[3], Hit& hit,
+                   float maxdistance = std::numeric_limits<float>::infinity()) const;
+
+    // True if any triangle is hit by the ray before 'maxdistance'
+    bool occluded(const float origin[3], const float direction[3], float maxdistance) const;
+
+    // True if there are no triangles in the tree
+    bool empty() const;
+
+    // Number of triangles and nodes in the tree
+    int triangleCount() const;
+    int nodeCount() const;
+
+    // Bytes of memory taken by the nodes and the triangles
+    size_t memoryBytes() const;
+
+    // Milliseconds spent in the last build()
+    double buildTime() const;
+
+private:
+    // Four children with their boxes, one per lane. Child k is the node child[k] if
+    // count[k] == 0, and otherwise a leaf of count[k] triangles in the blocks from
+    // blocks_[child[k]] on. Unused children have empty boxes, which no ray enters.
+    struct alignas(16) Node {
+        float min[3][4];
+        float max[3][4];
+        uint32_t child[4];
+        uint32_t count[4];
+    };
+
+    // A node of the binary tree of the build. Interior nodes have count == 0 and the
+    // children first and first + 1. Leaves have 'count' triangles from references_[first].
+    struct BuildNode {
+        float min[3];
+        uint32_t first;
+        float max[3];
+        uint32_t count;
+    };
+
+    // Four triangles as their corner 0 and the edges to corners 1 and 2, one per lane.
+    // Unused lanes have triangle -1, and edges of zero length, which no ray hits.
+    struct alignas(16) Block {
+        float v0[3][4];
+        float e1[3][4];
+        float e2[3][4];
+        int triangle[4];
+    };
+
+    // A triangle and its box during the build, which moves with the triangle as the nodes
+    // are split, so that each node reads its triangles in one range
+    struct alignas(16) Reference {
+        float min[3];
+        int triangle;
+        float max[3];
+        float unused;
+
+        float center(int axis) const { return 0.5f * (min[axis] + max[axis]); }
+    };
+
+    // A node to build, over references_[begin] ... references_[end - 1]
+    struct BuildTask {
+        int node;
+        int begin;
+        int end;
+        int depth;
+    };
+
+    // Build the subtree of a node. With a pool, children of more than minJobSize triangles
+    // are built by jobs counted in 'jobs'.
+    void buildNode(const BuildTask& task, ThreadPool* pool, JobCounter* jobs);
+
+    // The traversal of intersect() and occluded(), which returns at the first hit if
+    // 'anyhit' is set
+    bool traverse(const float origin[3], const float direction[3], Hit& hit, float maxdistance,
+                  bool anyhit) const;
+
+    std::vector<Node> nodes_;
+    std::vector<Block> blocks_;
+    std::vector<BuildNode> buildnodes_;  // The binary tree during build()
+    std::vector<Reference> references_;  // The triangles in leaf order, during build()
+    std::atomic<int> nodecount_;         // Nodes of buildnodes_ in use
+    int numtriangles_;
+    double buildtime_;                   // Milliseconds of the last build()
+};
@@ -14,38 +14,521 @@
 #include <GL/glew.h>
 
 #include <cstdio>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <utility>
 
 #include "TriangleSoup.hpp"
+#include "Arena.hpp"
+#include "BufferPool.hpp"
+#include "Frustum.hpp"
+#include "GLBFile.hpp"
+#include "GLDebug.hpp"
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "MappedFile.hpp"
+#include "Mat4.hpp"
+#include "MeshCodec.hpp"
+#include "MeshProcessing.hpp"
+#include "PipelineStatistics.hpp"
+#include "StreamBuffer.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+#include "TriangleBVH.hpp"
+#include "Utilities.hpp"
+#include "VirtualFiles.hpp"
+
+namespace {
+
+// The draws of all meshes since resetDrawCounts()
+TriangleSoup::DrawCounts drawcounts;
+
+// Instances of render() and renderDepth(), one per view of MultiView
+int viewinstances = 1;
+
+// Meshes with at most this many vertices use 16 bit indices on the GPU
+const int maxShortIndexVerts = 65536;
+
+// The crease angle in degrees of the normals of OBJ files that have none, as in most tools
+const float objCreaseAngle = 60.0f;
+
+// Generated meshes with fewer vertices per band are not worth starting the threads for
+const int minBandVerts = 16384;
+
+// Call fn(first, last) for bands of the rows [0, numrows) of a generated mesh. Large meshes
+// of 'numverts' vertices are generated in parallel, with a few bands per thread to even out
+// the load.
+void forRowBands(int numrows, int numverts, const std::function<void(int, int)>& fn) {
+    ThreadPool& pool = ThreadPool::global();
+    const int maxbands = std::max(std::min(numrows, 4 * int(pool.size())), 1);
+    const int numbands = std::clamp(numverts / minBandVerts, 1, maxbands);
+    if (numbands == 1) {
+        fn(0, numrows);
+        return;
+    }
+    pool.parallelFor(numbands, [&](int band) {
+        fn(static_cast<int>(int64_t(numrows) * band / numbands),
+           static_cast<int>(int64_t(numrows) * (band + 1) / numbands));
+    });
+}
+
+}  // namespace
+
+// The state of an OBJ file that is parsed while it arrives, between calls of continueOBJ()
+struct TriangleSoup::OBJStream {
+    std::shared_ptr<vfs::File> file;
+    Retention retention = Retention::Keep;  // To apply once the whole file is loaded
+    bool started = false;  // The geometry from before beginOBJ() has been replaced
+    size_t parsed = 0;     // Bytes parsed so far, up to the end of a line
+    std::vector<float> verts;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+    int numfaces = 0;
+    Arena arena;  // The chunk of one continueOBJ()
+};
 
 /* Constructor: initialize a TriangleSoup object to an empty object */
-TriangleSoup::TriangleSoup() : vao_(0), vertexbuffer_(0), indexbuffer_(0), nverts_(0), ntris_(0) {}
+TriangleSoup::TriangleSoup()
+    : vao_(0)
+    , depthvao_(0)
+    , nverts_(0)
+    , ntris_(0)
+    , nunweldedverts_(0)
+    , unoptimizedacmr_(0.0f)
+    , unoptimizedatvr_(0.0f)
+    , indextype_(GL_UNSIGNED_INT)
+    , instancebuffer_(0)
+    , ninstances_(0)
+    , skinbuffer_(0)
+    , skinnedvao_(0)
+    , retention_(Retention::Keep)
+    , vertexformat_(VertexFormat::Float)
+    , vertexlayout_(VertexLayout::Interleaved)
+    , vertexstreamed_(false)
+    , gltfattributes_(0)
+    , positionscale_{1.0f, 1.0f, 1.0f}
+    , positionoffset_{0.0f, 0.0f, 0.0f}
+    , sphereradius_(0.0f)
+    , spheresegments_(0)
+    , lodpixelerror_(1.0f)
+    , lodbudget_(0) {}
 
 /* Destructor: clean up allocated data in a TriangleSoup object */
 TriangleSoup::~TriangleSoup() { clean(); }
 
+/* Move constructor: take over the data of 'other' */
+TriangleSoup::TriangleSoup(TriangleSoup&& other) noexcept : TriangleSoup() {
+    *this = std::move(other);
+}
+
+/* Move assignment: delete the data of this object and take over the data of 'other'. The GL
+ * object names are taken from 'other', so that it does not delete them. */
+TriangleSoup& TriangleSoup::operator=(TriangleSoup&& other) noexcept {
+    if (this == &other) {
+        return *this;
+    }
+    clean();
+    vao_ = std::exchange(other.vao_, 0);
+    depthvao_ = std::exchange(other.depthvao_, 0);
+    nverts_ = other.nverts_;
+    ntris_ = other.ntris_;
+    nunweldedverts_ = other.nunweldedverts_;
+    unoptimizedacmr_ = other.unoptimizedacmr_;
+    unoptimizedatvr_ = other.unoptimizedatvr_;
+    vertexbuffer_ = std::exchange(other.vertexbuffer_, BufferAllocation());
+    indexbuffer_ = std::exchange(other.indexbuffer_, BufferAllocation());
+    indextype_ = other.indextype_;
+    instancebuffer_ = std::exchange(other.instancebuffer_, 0);
+    ninstances_ = other.ninstances_;
+    skinbuffer_ = std::exchange(other.skinbuffer_, 0);
+    skinnedvao_ = std::exchange(other.skinnedvao_, 0);
+    vertexarray_ = std::move(other.vertexarray_);
+    indexarray_ = std::move(other.indexarray_);
+    positions_ = std::move(other.positions_);
+    retention_ = other.retention_;
+    vertexformat_ = other.vertexformat_;
+    vertexlayout_ = other.vertexlayout_;
+    vertexstreamed_ = other.vertexstreamed_;
+    gltfattributes_ = other.gltfattributes_;
+    std::copy_n(other.positionscale_, 3, positionscale_);
+    std::copy_n(other.positionoffset_, 3, positionoffset_);
+    bounds_ = other.bounds_;
+    sphereradius_ = other.sphereradius_;
+    spheresegments_ = other.spheresegments_;
+    lods_ = std::move(other.lods_);
+    loderrors_ = std::move(other.loderrors_);
+    lodpixelerror_ = other.lodpixelerror_;
+    lodbudget_ = other.lodbudget_;
+    meshlets_ = std::move(other.meshlets_);
+    meshletcounts_ = std::move(other.meshletcounts_);
+    meshletoffsets_ = std::move(other.meshletoffsets_);
+    objstream_ = std::move(other.objstream_);
+    raytree_ = std::move(other.raytree_);
+    label_ = other.label_;
+    other.clean();  // Only resets the counts, as the GL objects are gone
+    return *this;
+}
+
 /* Clean up, remembering to de-allocate arrays and GL resources */
 void TriangleSoup::clean() {
     if (glIsVertexArray(vao_)) {
-        glDeleteVertexArrays(1, &vao_);
+        glstate::deleteVertexArrays(1, &vao_);
         vao_ = 0;
     }
 
-    if (glIsBuffer(vertexbuffer_)) {
-        glDeleteBuffers(1, &vertexbuffer_);
-        vertexbuffer_ = 0;
+    if (glIsVertexArray(depthvao_)) {
+        glstate::deleteVertexArrays(1, &depthvao_);
+        depthvao_ = 0;
+    }
+
+    // The ranges are reused once the GPU has finished the draws that may read them
+    BufferPool::global().free(vertexbuffer_);
+    BufferPool::global().free(indexbuffer_);
+
+    if (glIsBuffer(instancebuffer_)) {
+        gpumem::deleteBuffers(1, &instancebuffer_);
+        instancebuffer_ = 0;
+    }
+
+    if (glIsBuffer(skinbuffer_)) {
+        gpumem::deleteBuffers(1, &skinbuffer_);
+        skinbuffer_ = 0;
     }
 
-    if (glIsBuffer(indexbuffer_)) {
-        glDeleteBuffers(1, &indexbuffer_);
-        indexbuffer_ = 0;
+    if (glIsVertexArray(skinnedvao_)) {
+        glstate::deleteVertexArrays(1, &skinnedvao_);
+        skinnedvao_ = 0;
     }
 
     vertexarray_.clear();
     indexarray_.clear();
+    positions_.clear();
     nverts_ = 0;
     ntris_ = 0;
+    nunweldedverts_ = 0;
+    unoptimizedacmr_ = 0.0f;
+    unoptimizedatvr_ = 0.0f;
+    indextype_ = GL_UNSIGNED_INT;
+    ninstances_ = 0;
+    gltfattributes_ = 0;
+    bounds_ = mesh::Bounds();
+    sphereradius_ = 0.0f;
+    spheresegments_ = 0;
+    lods_.clear();
+    loderrors_.clear();
+    meshlets_.clear();
+    if (raytree_) {
+        raytree_->clear();
+    }
+    if (objstream_) {
+        retention_ = objstream_->retention;
+        objstream_.reset();
+    }
+}
+
+/*
+ * Create the vertex array object and buffers if they do not exist yet, and present the
+ * vertex and index arrays to OpenGL. Called by all methods that create geometry, and
+ * again by methods that change the arrays of an existing object.
+ * For the packed vertex formats, the float data in vertexarray_ is converted here,
+ * and only the packed data is sent to OpenGL. Likewise, the indices are converted to
+ * 16 bits for meshes with few enough vertices.
+ */
+void TriangleSoup::upload() {
+    bounds_ = mesh::computeBounds(vertexarray_.data(), nverts_, 8);
+    buildRayTree(vertexarray_.data(), 8);
+
+    std::vector<GLushort> shortindices;
+    const void* indexdata = indexarray_.data();
+    size_t indexbytes = indexarray_.size() * sizeof(GLuint);
+    GLenum indextype = GL_UNSIGNED_INT;
+    if (nverts_ <= maxShortIndexVerts) {
+        shortindices.assign(indexarray_.begin(), indexarray_.end());
+        indexdata = shortindices.data();
+        indexbytes = shortindices.size() * sizeof(GLushort);
+        indextype = GL_UNSIGNED_SHORT;
+    }
+
+    if (vertexformat_ == VertexFormat::Float) {
+        upload(vertexarray_.data(), vertexarray_.size() * sizeof(GLfloat), indexdata,
+               indexbytes, vertexformat_, indextype);
+        applyRetention();
+        return;
+    }
+
+    // Quantized positions cover the bounding box with 16 bits
+    const bool quantized = (vertexformat_ == VertexFormat::PackedQuantized);
+    for (int c = 0; c < 3; c++) {
+        positionscale_[c] = quantized ? std::max(bounds_.max[c] - bounds_.min[c], 1e-20f) : 1.0f;
+        positionoffset_[c] = quantized ? bounds_.min[c] : 0.0f;
+    }
+
+    // 16 bytes per vertex: position (3 x 16 bits + padding), normal (32 bits),
+    // texture coordinates (2 x 16 bits)
+    std::vector<uint32_t> packed(4 * size_t(nverts_));
+    for (int i = 0; i < nverts_; i++) {
+        const GLfloat* v = &vertexarray_[8 * i];
+        uint16_t position[3];
+        for (int c = 0; c < 3; c++) {
+            if (quantized) {
+                const float t = (v[c] - positionoffset_[c]) / positionscale_[c];
+                const long q = std::lrint(std::clamp(t, 0.0f, 1.0f) * 65535.0f);
+                position[c] = static_cast<uint16_t>(q);
+            } else {
+                position[c] = mesh::encodeHalf(v[c]);
+            }
+        }
+        uint32_t* p = &packed[4 * size_t(i)];
+        p[0] = position[0] | (uint32_t(position[1]) << 16);
+        p[1] = position[2];
+        p[2] = mesh::encodeOctahedral(v[3], v[4], v[5]);
+        p[3] = mesh::encodeHalf(v[6]) | (uint32_t(mesh::encodeHalf(v[7])) << 16);
+    }
+    upload(packed.data(), packed.size() * sizeof(uint32_t), indexdata, indexbytes, vertexformat_,
+           indextype);
+    applyRetention();
+}
+
+/* Drop the CPU side arrays that are not kept. Assigning empty vectors releases their memory,
+ * which clear() would not. */
+void TriangleSoup::applyRetention() {
+    if (retention_ == Retention::Keep) {
+        return;
+    }
+    if (retention_ == Retention::Picking && !vertexarray_.empty()) {
+        positions_.resize(3 * size_t(nverts_));
+        for (size_t i = 0; i < size_t(nverts_); i++) {
+            std::copy_n(&vertexarray_[8 * i], 3, &positions_[3 * i]);
+        }
+    }
+    vertexarray_ = std::vector<GLfloat>();
+    if (retention_ == Retention::Discard) {
+        indexarray_ = std::vector<GLuint>();
+        positions_ = std::vector<GLfloat>();
+    }
+}
+
+/* Set the attribute pointers of 'vao' to vertices of 'format' and 'layout' at 'offset' in
+ * 'buffer'. The normals and texture coordinates follow the position of each vertex in the
+ * Interleaved layout, and the positions of all nverts_ vertices in the Split layout.
+ * With direct state access nothing is bound, and otherwise 'vao' and 'buffer' are left
+ * bound. */
+void TriangleSoup::setVertexPointers(GLuint vao, GLuint buffer, VertexFormat format,
+                                     VertexLayout layout, size_t offset, bool positiononly) {
+    const bool packed = (format != VertexFormat::Float);
+    const GLsizei vertexsize = packed ? 16 : 8 * GLsizei(sizeof(GLfloat));
+    const GLsizei positionsize = packed ? 8 : 3 * GLsizei(sizeof(GLfloat));
+    const bool split = (layout == VertexLayout::Split);
+    const GLsizei positionstride = split ? positionsize : vertexsize;
+    const GLsizei attributestride = split ? vertexsize - positionsize : vertexsize;
+    const size_t attributes = offset + (split ? size_t(nverts_) * positionsize : positionsize);
+
+    // With direct state access, each attribute reads a binding point of its own, with the
+    // same number, which is what glVertexAttribPointer() sets up as well. The instance and
+    // skin attributes of the same VAO can then still be set with glVertexAttribPointer().
+    const bool dsa = glstate::directStateAccess();
+    if (!dsa) {
+        glstate::bindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    }
+    auto attribute = [&](GLuint index, GLint size, GLenum type, GLboolean normalized,
+                         GLsizei stride, size_t start) {
+        if (dsa) {
+            glEnableVertexArrayAttrib(vao, index);
+            glVertexArrayVertexBuffer(vao, index, buffer, static_cast<GLintptr>(start), stride);
+            glVertexArrayAttribFormat(vao, index, size, type, normalized, 0);
+            glVertexArrayAttribBinding(vao, index, index);
+        } else {
+            glEnableVertexAttribArray(index);
+            glVertexAttribPointer(index, size, type, normalized, stride, (void*)start);
+        }
+    };
+    if (positiononly) {
+        if (dsa) {
+            glDisableVertexArrayAttrib(vao, 1);
+            glDisableVertexArrayAttrib(vao, 2);
+        } else {
+            glDisableVertexAttribArray(1);
+            glDisableVertexAttribArray(2);
+        }
+    }
+    if (!packed) {
+        // Specify how OpenGL should interpret the vertex buffer data:
+        // Attributes 0, 1, 2 (must match the layout in the shader)
+        // Number of dimensions (3 means vec3 in the shader, 2 means vec2)
+        // Type GL_FLOAT
+        // Not normalized (GL_FALSE)
+        // Stride 8 floats for interleaved arrays with 8 floats per vertex, or 3 and 5 floats
+        // for the positions and the other attributes of split arrays
+        // Buffer offset of the first vertex
+        attribute(0, 3, GL_FLOAT, GL_FALSE, positionstride, offset);  // xyz coordinates
+        if (!positiononly) {
+            attribute(1, 3, GL_FLOAT, GL_FALSE, attributestride, attributes);  // normals
+            attribute(2, 2, GL_FLOAT, GL_FALSE, attributestride,
+                      attributes + 3 * sizeof(GLfloat));  // texcoords
+        }
+    } else {
+        // Packed formats, 16 bytes per vertex, of which 8 are the position. Quantized
+        // positions are normalized to [0,1], and the octahedral normal is normalized to
+        // [-1,1]. vertex.glsl decodes both.
+        const GLenum positiontype =
+            (format == VertexFormat::PackedQuantized) ? GL_UNSIGNED_SHORT : GL_HALF_FLOAT;
+        attribute(0, 3, positiontype, positiontype == GL_UNSIGNED_SHORT, positionstride,
+                  offset);  // xyz coordinates
+        if (!positiononly) {
+            attribute(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, attributestride,
+                      attributes);  // octahedral normals
+            attribute(2, 2, GL_HALF_FLOAT, GL_FALSE, attributestride,
+                      attributes + 4);  // texcoords
+        }
+    }
+}
+
+/* Upload vertex and index data from any memory, e.g. a memory mapped file */
+void TriangleSoup::upload(const void* vertexdata, size_t vertexbytes, const void* indexdata,
+                          size_t indexbytes, VertexFormat format, GLenum indextype) {
+    // Generate one vertex array object (VAO), and bind it unless it can be edited unbound
+    const bool dsa = glstate::directStateAccess();
+    if (vao_ == 0) {
+        if (dsa) {
+            glCreateVertexArrays(1, &vao_);
+        } else {
+            glGenVertexArrays(1, &vao_);
+        }
+    }
+    if (!dsa) {
+        glstate::bindVertexArray(vao_);
+    }
+
+    // The Split layout moves the positions of the interleaved data to the front
+    const bool split = (vertexlayout_ == VertexLayout::Split);
+    std::vector<unsigned char> splitdata;
+    if (split && nverts_ > 0) {
+        const size_t vertexsize = vertexbytes / size_t(nverts_);
+        const size_t positionsize = (format == VertexFormat::Float) ? 3 * sizeof(GLfloat) : 8;
+        const size_t attributesize = vertexsize - positionsize;
+        splitdata.resize(vertexbytes);
+        const unsigned char* vertex = static_cast<const unsigned char*>(vertexdata);
+        unsigned char* position = splitdata.data();
+        unsigned char* attributes = position + size_t(nverts_) * positionsize;
+        for (int i = 0; i < nverts_; i++, vertex += vertexsize) {
+            std::memcpy(position + i * positionsize, vertex, positionsize);
+            std::memcpy(attributes + i * attributesize, vertex + positionsize, attributesize);
+        }
+        vertexdata = splitdata.data();
+    }
+
+    // Get ranges of the shared buffers for the vertices and indices. The old ones may still
+    // be in use by the GPU, so new ones are taken instead of writing over them.
+    BufferPool& pool = BufferPool::global();
+    pool.free(vertexbuffer_);
+    pool.free(indexbuffer_);
+    vertexbuffer_ = pool.allocate(vertexbytes);
+    indexbuffer_ = pool.allocate(indexbytes);
+    if (!vertexbuffer_ || !indexbuffer_) {
+        pool.free(vertexbuffer_);
+        pool.free(indexbuffer_);
+        glstate::bindVertexArray(0);
+        return;
+    }
+
+    // Present our vertex coordinates to OpenGL (8 * nverts_), at the offset of the range.
+    // Without data, the caller writes the ranges, as readBinary() does.
+    if (dsa) {
+        if (vertexdata != nullptr) {
+            glNamedBufferSubData(vertexbuffer_.buffer, vertexbuffer_.offset, vertexbytes,
+                                 vertexdata);
+        }
+        if (indexdata != nullptr) {
+            glNamedBufferSubData(indexbuffer_.buffer, indexbuffer_.offset, indexbytes,
+                                 indexdata);
+        }
+    } else {
+        if (vertexdata != nullptr) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, vertexbuffer_.buffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, vertexbuffer_.offset, vertexbytes,
+                            vertexdata);
+        }
+        // Present our vertex indices to OpenGL (3 * ntris_, of type indextype)
+        if (indexdata != nullptr) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, indexbuffer_.buffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, indexbuffer_.offset, indexbytes, indexdata);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    // Point the attributes at the vertex buffer
+    setVertexPointers(vao_, vertexbuffer_.buffer, format, vertexlayout_, vertexbuffer_.offset);
+    vertexstreamed_ = false;
+    gltfattributes_ = 0;
+    if (format == VertexFormat::Float || format == VertexFormat::PackedHalf) {
+        for (int c = 0; c < 3; c++) {
+            positionscale_[c] = 1.0f;
+            positionoffset_[c] = 0.0f;
+        }
+    }
+    vertexformat_ = format;
+    indextype_ = indextype;
+
+    // Activate the index buffer
+    if (dsa) {
+        glVertexArrayElementBuffer(vao_, indexbuffer_.buffer);
+    } else {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer_.buffer);
+    }
+
+    // A second VAO for depth passes, with the same buffers but only the positions
+    if (split) {
+        if (depthvao_ == 0) {
+            if (dsa) {
+                glCreateVertexArrays(1, &depthvao_);
+            } else {
+                glGenVertexArrays(1, &depthvao_);
+            }
+            // These take the VAO from the binding
+            if (instancebuffer_ != 0 || skinbuffer_ != 0) {
+                glstate::bindVertexArray(depthvao_);
+            }
+            if (instancebuffer_ != 0) {
+                setInstancePointers();
+            }
+            if (skinbuffer_ != 0) {
+                setSkinPointers();
+            }
+        }
+        setVertexPointers(depthvao_, vertexbuffer_.buffer, format, vertexlayout_,
+                          vertexbuffer_.offset, true);
+        if (dsa) {
+            glVertexArrayElementBuffer(depthvao_, indexbuffer_.buffer);
+        } else {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer_.buffer);
+        }
+    } else if (depthvao_ != 0) {
+        glstate::deleteVertexArrays(1, &depthvao_);
+        depthvao_ = 0;
+    }
+    // Holds the old index buffer
+    if (skinnedvao_ != 0) {
+        glstate::deleteVertexArrays(1, &skinnedvao_);
+        skinnedvao_ = 0;
+    }
+
+    applyLabel();
+    if (dsa && instancebuffer_ == 0 && skinbuffer_ == 0) {
+        return;  // Nothing was bound
+    }
+
+    // Deactivate (unbind) the VAO and the buffers again.
+    // Do NOT unbind the index buffer while the VAO is still bound.
+    // The index buffer is an essential part of the VAO state.
+    glstate::bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
 /* Create a demo object with a single triangle */
@@ -78,49 +561,8 @@ void TriangleSoup::createTriangle() {
         indexarray_[i] = index_array_data[i];
     }
 
-    // Generate one vertex array object (VAO) and bind it
-    glGenVertexArrays(1, &(vao_));
-    glBindVertexArray(vao_);
-
-    // Generate two buffer IDs
-    glGenBuffers(1, &vertexbuffer_);
-    glGenBuffers(1, &indexbuffer_);
-
-    // Activate the vertex buffer
-    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer_);
-    // Present our vertex coordinates to OpenGL (8 * nverts_)
-    glBufferData(GL_ARRAY_BUFFER, vertexarray_.size() * sizeof(GLfloat), vertexarray_.data(),
-                 GL_STATIC_DRAW);
-    // Specify how many attribute arrays we have in our VAO
-    glEnableVertexAttribArray(0);  // Vertex coordinates
-    glEnableVertexAttribArray(1);  // Normals
-    glEnableVertexAttribArray(2);  // Texture coordinates
-    // Specify how OpenGL should interpret the vertex buffer data:
-    // Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-    // Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-    // Type GL_FLOAT
-    // Not normalized (GL_FALSE)
-    // Stride 8 floats (interleaved array with 8 floats per vertex)
-    // Array buffer offset 0, 3 or 6 floats (offset into first vertex)
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)0);  // xyz coordinates
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)(3 * sizeof(GLfloat)));  // normals
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)(6 * sizeof(GLfloat)));  // texcoords
-
-    // Activate the index buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer_);
-    // Present our vertex indices to OpenGL (3 * ntris_)
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexarray_.size() * sizeof(GLuint), indexarray_.data(),
-                 GL_STATIC_DRAW);
-
-    // Deactivate (unbind) the VAO and the buffers again.
-    // Do NOT unbind the index buffer while the VAO is still bound.
-    // The index buffer is an essential part of the VAO state.
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    // Create the vertex array object and buffers, and send the arrays to OpenGL
+    upload();
 }
 
 /* Create a simple box geometry */
@@ -253,7 +695,7 @@ void TriangleSoup::createBox(float xsize, float ysize, float zsize) {
     const GLuint index_array_data[] = {0, 3, 1, 0, 2, 3, 1, 4, 0, 1, 5, 4, 4, 2, 0, 4, 6, 2,
                                        1, 3, 7, 1, 7, 5, 7, 2, 6, 7, 3, 2, 4, 5, 7, 4, 7, 6};
 
-    nverts_ = 24;
+    nverts_ = 8;
     ntris_ = 12;
 
     vertexarray_.resize(8 * nverts_);
@@ -266,49 +708,8 @@ void TriangleSoup::createBox(float xsize, float ysize, float zsize) {
         indexarray_[i] = index_array_data[i];
     }
 
-    // Generate one vertex array object (VAO) and bind it
-    glGenVertexArrays(1, &(vao_));
-    glBindVertexArray(vao_);
-
-    // Generate two buffer IDs
-    glGenBuffers(1, &vertexbuffer_);
-    glGenBuffers(1, &indexbuffer_);
-
-    // Activate the vertex buffer
-    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer_);
-    // Present our vertex coordinates to OpenGL (8 * nverts_)
-    glBufferData(GL_ARRAY_BUFFER, vertexarray_.size() * sizeof(GLfloat), vertexarray_.data(),
-                 GL_STATIC_DRAW);
-    // Specify how many attribute arrays we have in our VAO
-    glEnableVertexAttribArray(0);  // Vertex coordinates
-    glEnableVertexAttribArray(1);  // Normals
-    glEnableVertexAttribArray(2);  // Texture coordinates
-    // Specify how OpenGL should interpret the vertex buffer data:
-    // Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-    // Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-    // Type GL_FLOAT
-    // Not normalized (GL_FALSE)
-    // Stride 8 floats (interleaved array with 8 floats per vertex)
-    // Array buffer offset 0, 3 or 6 floats (offset into first vertex)
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)0);  // xyz coordinates
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)(3 * sizeof(GLfloat)));  // normals
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)(6 * sizeof(GLfloat)));  // texcoords
-
-    // Activate the index buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer_);
-    // Present our vertex indices to OpenGL (3 * ntris_)
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexarray_.size() * sizeof(GLuint), indexarray_.data(),
-                 GL_STATIC_DRAW);
-
-    // Deactivate (unbind) the VAO and the buffers again.
-    // Do NOT unbind the index buffer while the VAO is still bound.
-    // The index buffer is an essential part of the VAO state.
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    // Create the vertex array object and buffers, and send the arrays to OpenGL
+    upload();
 }
 
 /*
@@ -328,6 +729,7 @@ void TriangleSoup::createBox(float xsize, float ysize, float zsize) {
  * This code is in the public domain.
  */
 void TriangleSoup::createSphere(float radius, int segments) {
+    TRACE_SCOPE("createSphere");
     // Delete any previous content in the TriangleSoup object
     clean();
 
@@ -370,27 +772,58 @@ void TriangleSoup::createSphere(float radius, int segments) {
     // vsegs-1 latitude rings of hsegs+1 vertices each
     // (duplicates at texture seam s=0 / s=1)
 
-    for (int j = 0; j < vsegs - 1; j++) {  // vsegs-1 latitude rings of vertices
-        const double theta = static_cast<double>(j + 1) / vsegs * M_PI;
-        const float z = static_cast<float>(std::cos(theta));
-        const float R = static_cast<float>(std::sin(theta));
+    // Every ring has the same longitudes, so compute their sines and cosines only once
+    std::vector<float> cosphi(hsegs + 1);
+    std::vector<float> sinphi(hsegs + 1);
+    for (int i = 0; i <= hsegs; i++) {
+        const double phi = static_cast<double>(i) / hsegs * 2.0 * M_PI;
+        cosphi[i] = static_cast<float>(std::cos(phi));
+        sinphi[i] = static_cast<float>(std::sin(phi));
+    }
+
+    // The rings j in [first, last), and the middle part triangles below them
+    auto generateRings = [&](int first, int last) {
+        GLfloat* vertices = vertexarray_.data();
+        GLuint* indices = indexarray_.data();
+        for (int j = first; j < last; j++) {  // vsegs-1 latitude rings of vertices
+            const double theta = static_cast<double>(j + 1) / vsegs * M_PI;
+            const float z = static_cast<float>(std::cos(theta));
+            const float R = static_cast<float>(std::sin(theta));
+            const float t = 1.0f - (float)(j + 1) / float(vsegs);
+
+            GLfloat* v = vertices + size_t(1 + j * (hsegs + 1)) * stride;
+            for (int i = 0; i <= hsegs; i++, v += stride) {  // hsegs+1 vertices in each ring
+                const float x = R * cosphi[i];
+                const float y = R * sinphi[i];
+                v[0] = radius * x;
+                v[1] = radius * y;
+                v[2] = radius * z;
+                v[3] = x;
+                v[4] = y;
+                v[5] = z;
+                v[6] = (float)i / float(hsegs);
+                v[7] = t;
+            }
 
-        for (int i = 0; i <= hsegs;
-             i++) {  // hsegs+1 vertices in each ring (duplicate for texcoords)
-            const double phi = static_cast<double>(i) / hsegs * 2.0 * M_PI;
-            const float x = R * static_cast<float>(std::cos(phi));
-            const float y = R * static_cast<float>(std::sin(phi));
-            base = (1 + j * (hsegs + 1) + i) * stride;
-            vertexarray_[base] = radius * x;
-            vertexarray_[base + 1] = radius * y;
-            vertexarray_[base + 2] = radius * z;
-            vertexarray_[base + 3] = x;
-            vertexarray_[base + 4] = y;
-            vertexarray_[base + 5] = z;
-            vertexarray_[base + 6] = (float)i / hsegs;
-            vertexarray_[base + 7] = 1.0f - (float)(j + 1) / vsegs;
+            // Middle part (possibly empty if vsegs=2): the quads between ring j and j+1
+            if (j >= vsegs - 2) {
+                continue;
+            }
+            GLuint* tri = indices + size_t(3) * (hsegs + 2 * j * hsegs);
+            for (int i = 0; i < hsegs; i++, tri += 6) {
+                const GLuint i0 = 1 + j * (hsegs + 1) + i;
+                tri[0] = i0;
+                tri[1] = i0 + hsegs + 1;
+                tri[2] = i0 + 1;
+                tri[3] = i0 + 1;
+                tri[4] = i0 + hsegs + 1;
+                tri[5] = i0 + hsegs + 2;
+            }
         }
-    }
+    };
+
+    // Large spheres are generated in bands of rings in parallel
+    forRowBands(vsegs - 1, nverts_, generateRings);
 
     // The index array: triplets of integers, one for each triangle
     // Top cap
@@ -399,19 +832,6 @@ void TriangleSoup::createSphere(float radius, int segments) {
         indexarray_[3 * i + 1] = 1 + i;
         indexarray_[3 * i + 2] = 2 + i;
     }
-    // Middle part (possibly empty if vsegs=2)
-    for (int j = 0; j < vsegs - 2; j++) {
-        for (int i = 0; i < hsegs; i++) {
-            base = 3 * (hsegs + 2 * (j * hsegs + i));
-            const int i0 = 1 + j * (hsegs + 1) + i;
-            indexarray_[base] = i0;
-            indexarray_[base + 1] = i0 + hsegs + 1;
-            indexarray_[base + 2] = i0 + 1;
-            indexarray_[base + 3] = i0 + 1;
-            indexarray_[base + 4] = i0 + hsegs + 1;
-            indexarray_[base + 5] = i0 + hsegs + 2;
-        }
-    }
     // Bottom cap
     base = 3 * (hsegs + 2 * (vsegs - 2) * hsegs);
     for (int i = 0; i < hsegs; i++) {
@@ -420,323 +840,2491 @@ void TriangleSoup::createSphere(float radius, int segments) {
         indexarray_[base + 3 * i + 2] = nverts_ - 3 - i;
     }
 
-    // Generate one vertex array object (VAO) and bind it
-    glGenVertexArrays(1, &(vao_));
-    glBindVertexArray(vao_);
-
-    // Generate two buffer IDs
-    glGenBuffers(1, &vertexbuffer_);
-    glGenBuffers(1, &indexbuffer_);
-
-    // Activate the vertex buffer
-    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer_);
-    // Present our vertex coordinates to OpenGL
-    glBufferData(GL_ARRAY_BUFFER, vertexarray_.size() * sizeof(GLfloat), vertexarray_.data(),
-                 GL_STATIC_DRAW);
-    // Specify how many attribute arrays we have in our VAO
-    glEnableVertexAttribArray(0);  // Vertex coordinates
-    glEnableVertexAttribArray(1);  // Normals
-    glEnableVertexAttribArray(2);  // Texture coordinates
-    // Specify how OpenGL should interpret the vertex buffer data:
-    // Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-    // Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-    // Type GL_FLOAT
-    // Not normalized (GL_FALSE)
-    // Stride 8 (interleaved array with 8 floats per vertex)
-    // Array buffer offset 0, 3, 6 (offset into first vertex)
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)0);  // xyz coordinates
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)(3 * sizeof(GLfloat)));  // normals
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)(6 * sizeof(GLfloat)));  // texcoords
+    // Remembered to create the levels of detail in the same way
+    sphereradius_ = radius;
+    spheresegments_ = vsegs;
 
-    // Activate the index buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer_);
-    // Present our vertex indices to OpenGL
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexarray_.size() * sizeof(GLuint), indexarray_.data(),
-                 GL_STATIC_DRAW);
-
-    // Deactivate (unbind) the VAO and the buffers again.
-    // Note that the order of these operations matter:
-    // do NOT unbind the buffers while the VAO is still bound.
-    // The index buffer is an essential part of the VAO state.
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    // Create the vertex array object and buffers, and send the arrays to OpenGL
+    upload();
 }
 
 /*
- * readObj(const char* filename)
- *
- * Load TriangleSoup geometry data from an OBJ file.
- * The vertex array is on interleaved format. For each vertex, there
- * are 8 floats: three for the vertex coordinates (x, y, z), three
- * for the normal vector (n_x, n_y, n_z) and finally two for texture
- * coordinates (s, t). The arrays are allocated by "new" inside the
- * function and should be disposed of using "delete" when they are no longer
- * needed. This is done by the method clean() called by the destructor.
- *
- * Author: Stefan Gustavson (stegu@itn.liu.se) 2014.
- * This code is in the public domain.
+ * A grid of columns x rows quads with (columns+1) * (rows+1) vertices, row by row. The
+ * vertices of the last column and row are duplicates for closed shapes, with their own
+ * texture coordinates, as for the seam of the sphere.
  */
-void TriangleSoup::readOBJ(const std::string& filename) {
-    FILE* objfile = fopen(filename.c_str(), "r");
+void TriangleSoup::createGrid(int columns, int rows,
+                              const std::function<void(int i, int j, GLfloat* v)>& vertex) {
+    clean();
 
-    if (!objfile) {
-        std::cerr << "File not found: " << filename << "\n";
+    columns = std::max(columns, 1);
+    rows = std::max(rows, 1);
+    const int rowverts = columns + 1;
+    nverts_ = rowverts * (rows + 1);
+    ntris_ = 2 * columns * rows;
+    vertexarray_.resize(8 * size_t(nverts_));
+    indexarray_.resize(3 * size_t(ntris_));
+
+    // The vertices of rows [first, last), and the quads above them
+    auto generateRows = [&](int first, int last) {
+        for (int j = first; j < last; j++) {
+            GLfloat* v = &vertexarray_[8 * size_t(j) * rowverts];
+            for (int i = 0; i <= columns; i++, v += 8) {
+                vertex(i, j, v);
+            }
+            if (j == rows) {
+                continue;
+            }
+            GLuint* tri = &indexarray_[6 * size_t(j) * columns];
+            for (int i = 0; i < columns; i++, tri += 6) {
+                const GLuint i0 = j * rowverts + i;
+                tri[0] = i0;
+                tri[1] = i0 + 1;
+                tri[2] = i0 + rowverts + 1;
+                tri[3] = i0;
+                tri[4] = i0 + rowverts + 1;
+                tri[5] = i0 + rowverts;
+            }
+        }
+    };
+    forRowBands(rows + 1, nverts_, generateRows);
+
+    // Create the vertex array object and buffers, and send the arrays to OpenGL
+    upload();
+}
+
+/* The shapes below use the same formulas as vertex_grid.glsl */
+void TriangleSoup::createPlane(float xsize, float ysize, int columns, int rows) {
+    columns = std::max(columns, 1);
+    rows = std::max(rows, 1);
+    createGrid(columns, rows, [=](int i, int j, GLfloat* v) {
+        const float s = float(i) / float(columns);
+        const float t = float(j) / float(rows);
+        const GLfloat vertex[8] = {
+            (s - 0.5f) * xsize, (t - 0.5f) * ysize, 0.0f, 0.0f, 0.0f, 1.0f, s, t};
+        std::memcpy(v, vertex, sizeof(vertex));
+    });
+}
+
+void TriangleSoup::createCylinder(float radius, float height, int segments, int rows) {
+    segments = std::max(segments, 3);
+    rows = std::max(rows, 1);
+    createGrid(segments, rows, [=](int i, int j, GLfloat* v) {
+        const float s = float(i) / float(segments);
+        const float t = float(j) / float(rows);
+        const double phi = 2.0 * M_PI * s;
+        const float x = static_cast<float>(std::cos(phi));
+        const float y = static_cast<float>(std::sin(phi));
+        const GLfloat vertex[8] = {radius * x, radius * y, (t - 0.5f) * height, x, y, 0.0f, s, t};
+        std::memcpy(v, vertex, sizeof(vertex));
+    });
+}
+
+void TriangleSoup::createTorus(float majorradius, float minorradius, int majorsegments,
+                               int minorsegments) {
+    majorsegments = std::max(majorsegments, 3);
+    minorsegments = std::max(minorsegments, 3);
+    createGrid(majorsegments, minorsegments, [=](int i, int j, GLfloat* v) {
+        const float s = float(i) / float(majorsegments);
+        const float t = float(j) / float(minorsegments);
+        const double phi = 2.0 * M_PI * s;    // Around the z axis
+        const double theta = 2.0 * M_PI * t;  // Around the tube
+        const float radial[2] = {static_cast<float>(std::cos(phi)),
+                                 static_cast<float>(std::sin(phi))};
+        const float costheta = static_cast<float>(std::cos(theta));
+        const float nx = costheta * radial[0];
+        const float ny = costheta * radial[1];
+        const float nz = static_cast<float>(std::sin(theta));
+        const GLfloat vertex[8] = {majorradius * radial[0] + minorradius * nx,
+                                   majorradius * radial[1] + minorradius * ny,
+                                   minorradius * nz,
+                                   nx,
+                                   ny,
+                                   nz,
+                                   s,
+                                   t};
+        std::memcpy(v, vertex, sizeof(vertex));
+    });
+}
+
+void TriangleSoup::createHeightfield(const float* heights, int width, int height, float xsize,
+                                     float ysize, float zscale) {
+    if (heights == nullptr || width < 2 || height < 2) {
+        std::cerr << "A heightfield needs at least 2 x 2 heights\n";
+        clean();
         return;
     }
+    const int columns = width - 1;
+    const int rows = height - 1;
+    auto h = [=](int i, int j) {
+        return zscale * heights[size_t(std::clamp(j, 0, rows)) * width + std::clamp(i, 0, columns)];
+    };
+    createGrid(columns, rows, [=](int i, int j, GLfloat* v) {
+        const float s = float(i) / float(columns);
+        const float t = float(j) / float(rows);
+        // Central differences, one grid cell apart, of the heights clamped at the edges
+        const float dhdx = (h(i + 1, j) - h(i - 1, j)) * float(columns) / (2.0f * xsize);
+        const float dhdy = (h(i, j + 1) - h(i, j - 1)) * float(rows) / (2.0f * ysize);
+        const float length = std::sqrt(dhdx * dhdx + dhdy * dhdy + 1.0f);
+        const GLfloat vertex[8] = {(s - 0.5f) * xsize, (t - 0.5f) * ysize, h(i, j),
+                                   -dhdx / length,     -dhdy / length,     1.0f / length,
+                                   s,                  t};
+        std::memcpy(v, vertex, sizeof(vertex));
+    });
+}
 
-    // Scan through the file to count the number of data elements
-    char line[256];
-    char tag[3];
+/*
+ * A minimal tokenizer for the OBJ parser in readOBJ(). The functions work directly on the
+ * memory mapped file contents, advance the pointer p past what they consume, and never
+ * read beyond the end pointer. The file contents are not null terminated.
+ */
+namespace {
 
-    int numverts = 0;
-    int numnormals = 0;
-    int numtexcoords = 0;
-    int numfaces = 0;
-    while (fgets(line, 256, objfile)) {
-        sscanf(line, "%2s ", tag);
-        if (!strcmp(tag, "v")) {
-            numverts++;
-        } else if (!strcmp(tag, "vn")) {
-            numnormals++;
-        } else if (!strcmp(tag, "vt")) {
-            numtexcoords++;
-        } else if (!strcmp(tag, "f")) {
-            numfaces++;
-        }
-        // else {
-        //     std::cout << "Ignoring line starting with \"" << tag << "\"\n";
-        // }
-    }
+inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
 
-    std::cout << "loadObj(\"" << filename << "\"): found " << numverts << " vertices, "
-              << numnormals << " normals, " << numtexcoords << " texcoords, " << numfaces
-              << " faces.\n";
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
 
-    std::vector<float> verts(3 * numverts);
-    std::vector<float> normals(3 * numnormals);
-    std::vector<float> texcoords(2 * numtexcoords);
+inline const char* skipSpaces(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) {
+        ++p;
+    }
+    return p;
+}
 
-    vertexarray_.resize(8 * 3 * numfaces);
-    indexarray_.resize(3 * numfaces);
-    nverts_ = 3 * numfaces;
-    ntris_ = numfaces;
+// Advance p to the first character of the next line
+inline const char* skipLine(const char* p, const char* end) {
+    const void* eol = memchr(p, '\n', static_cast<size_t>(end - p));
+    return eol ? static_cast<const char*>(eol) + 1 : end;
+}
 
-    rewind(objfile);  // Start from the top again to read data
+// True if only whitespace or a comment remains on the current line
+inline bool atEndOfLine(const char* p, const char* end) {
+    p = skipSpaces(p, end);
+    return p == end || *p == '\n' || *p == '#';
+}
 
-    int i_v = 0;
-    int i_n = 0;
-    int i_t = 0;
-    int i_f = 0;
+inline bool expectChar(const char*& p, const char* end, char c) {
+    if (p < end && *p == c) {
+        ++p;
+        return true;
+    }
+    return false;
+}
 
-    int readerror = 0;
-    while (fgets(line, 256, objfile)) {
-        tag[0] = '\0';
-        sscanf(line, "%2s ", tag);
-        if (!strcmp(tag, "v")) {
-            // A vertex with three coordinates
-            // std::cout << "Reading vertex " << i_v + 1 << "\n";
+bool parseInt(const char*& p, const char* end, int& value) {
+    p = skipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        ++p;
+    }
+    if (p == end || !isDigit(*p)) {
+        return false;
+    }
+    int result = 0;
+    while (p < end && isDigit(*p)) {
+        result = 10 * result + (*p - '0');
+        ++p;
+    }
+    value = negative ? -result : result;
+    return true;
+}
 
-            int numargs = sscanf(line, "v %f %f %f", &verts[3 * i_v], &verts[3 * i_v + 1],
-                                 &verts[3 * i_v + 2]);
-            if (numargs != 3) {
-                std::cerr << "Malformed vertex data found at vertex " << i_v + 1 << "\nAborting\n";
-                readerror = 1;
-                break;
-            }
-            i_v++;
-        } else if (!strcmp(tag, "vn")) {
-            // A vertex normal with three components
-            // std::cout << "Reading normal " << i_n + 1 << "\n";
+// Parse a decimal floating point number, e.g. "-1.5", "2", ".25" or "1.0e-3"
+bool parseFloat(const char*& p, const char* end, float& value) {
+    // Exactly representable powers of ten
+    static const double powersOf10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                        1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                        1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    p = skipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        ++p;
+    }
 
-            int numargs = sscanf(line, "vn %f %f %f", &normals[3 * i_n], &normals[3 * i_n + 1],
-                                 &normals[3 * i_n + 2]);
-            if (numargs != 3) {
-                std::cerr << "Malformed normal data found at normal" << i_n + 1 << "\nAborting\n";
-                readerror = 1;
-                break;
+    // Collect up to 18 significant digits in an integer, count the decimal exponent
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool anydigits = false;
+    while (p < end && isDigit(*p)) {
+        if (mantissa < 100000000000000000ull) {
+            mantissa = 10 * mantissa + static_cast<uint64_t>(*p - '0');
+        } else {
+            ++exponent;
+        }
+        anydigits = true;
+        ++p;
+    }
+    if (p < end && *p == '.') {
+        ++p;
+        while (p < end && isDigit(*p)) {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = 10 * mantissa + static_cast<uint64_t>(*p - '0');
+                --exponent;
             }
-            i_n++;
-        } else if (!strcmp(tag, "vt")) {
-            // A vertex texture coordinate, two components
-            // std::cout << "Reading texcoord " << i_t + 1 << "\n";
+            anydigits = true;
+            ++p;
+        }
+    }
+    if (!anydigits) {
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        int e;
+        if (!parseInt(p, end, e)) {
+            return false;
+        }
+        exponent += e;
+    }
 
-            int numargs = sscanf(line, "vt %f %f", &texcoords[2 * i_t], &texcoords[2 * i_t + 1]);
-            if (numargs != 2) {
-                std::cerr << "Malformed texcoord data found at texcoord " << i_t + 1
-                          << "\nAborting\n";
-                readerror = 1;
-                break;
-            }
-            i_t++;
-        } else if (!strcmp(tag, "f")) {
-            // A face with three or more vertex indices
-            // std::cout << "Reading face " << i_f + 1 << "\n";
+    double result = static_cast<double>(mantissa);
+    if (exponent >= 0 && exponent <= 22) {
+        result *= powersOf10[exponent];
+    } else if (exponent < 0 && exponent >= -22) {
+        result /= powersOf10[-exponent];
+    } else {
+        result *= std::pow(10.0, exponent);
+    }
+    value = static_cast<float>(negative ? -result : result);
+    return true;
+}
 
-            int v1, v2, v3, n1, n2, n3, t1, t2, t3;
-            int numargs = sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d", &v1, &t1, &n1, &v2, &t2, &n2,
-                                 &v3, &t3, &n3);
-            if (numargs != 9) {  // Accept only triangles. Quads cause an error.
-                std::cerr << "Malformed face data found at vertex " << i_f + 1 << "\nAborting\n";
-                readerror = 1;
-                break;
-            }
-            //			printf("Read vertex data %d/%d/%d %d/%d/%d %d/%d/%d\n",
-            //			v1, t1, n1, v2, t2, n2, v3, t3, n3);
-            // Indices in OBJ files start at 1, but C++ arrays start at index 0.
-            --v1;
-            --v2;
-            --v3;
-            --n1;
-            --n2;
-            --n3;
-            --t1;
-            --t2;
-            --t3;
-
-            const int currentv = 8 * 3 * i_f;
-            vertexarray_[currentv] = verts[3 * v1];
-            vertexarray_[currentv + 1] = verts[3 * v1 + 1];
-            vertexarray_[currentv + 2] = verts[3 * v1 + 2];
-            vertexarray_[currentv + 3] = normals[3 * n1];
-            vertexarray_[currentv + 4] = normals[3 * n1 + 1];
-            vertexarray_[currentv + 5] = normals[3 * n1 + 2];
-            vertexarray_[currentv + 6] = texcoords[2 * t1];
-            vertexarray_[currentv + 7] = texcoords[2 * t1 + 1];
-            vertexarray_[currentv + 8] = verts[3 * v2];
-            vertexarray_[currentv + 9] = verts[3 * v2 + 1];
-            vertexarray_[currentv + 10] = verts[3 * v2 + 2];
-            vertexarray_[currentv + 11] = normals[3 * n2];
-            vertexarray_[currentv + 12] = normals[3 * n2 + 1];
-            vertexarray_[currentv + 13] = normals[3 * n2 + 2];
-            vertexarray_[currentv + 14] = texcoords[2 * t2];
-            vertexarray_[currentv + 15] = texcoords[2 * t2 + 1];
-            vertexarray_[currentv + 16] = verts[3 * v3];
-            vertexarray_[currentv + 17] = verts[3 * v3 + 1];
-            vertexarray_[currentv + 18] = verts[3 * v3 + 2];
-            vertexarray_[currentv + 19] = normals[3 * n3];
-            vertexarray_[currentv + 20] = normals[3 * n3 + 1];
-            vertexarray_[currentv + 21] = normals[3 * n3 + 2];
-            vertexarray_[currentv + 22] = texcoords[2 * t3];
-            vertexarray_[currentv + 23] = texcoords[2 * t3 + 1];
-            indexarray_[3 * i_f] = 3 * i_f;
-            indexarray_[3 * i_f + 1] = 3 * i_f + 1;
-            indexarray_[3 * i_f + 2] = 3 * i_f + 2;
-            i_f++;
-        }
-    }
-
-    // Clean up the temporary arrays we created
-    fclose(objfile);
+// An open addressing hash table from OBJ v/t/n index triplets to welded vertex indices
+class WeldTable {
+public:
+    explicit WeldTable(size_t expectedkeys) : size_(0) { rehash(2 * expectedkeys); }
 
-    if (readerror) {  // Delete corrupt data and bail out if a read error occured
-        std::cerr << "Mesh read error: No mesh data generated\n";
-        clean();
-        return;
+    // Return the vertex index of the triplet (v, t, n). A triplet that is not in the table
+    // yet is inserted with the index 'next', which is then returned.
+    GLuint insert(int v, int t, int n, int next) {
+        if (2 * (size_ + 1) > values_.size()) {  // Keep the load factor at or below 1/2
+            rehash(2 * values_.size());
+        }
+        size_t slot = hash(v, t, n) & mask_;
+        while (values_[slot] != empty) {
+            const int* key = &keys_[3 * slot];
+            if (key[0] == v && key[1] == t && key[2] == n) {
+                return values_[slot];
+            }
+            slot = (slot + 1) & mask_;
+        }
+        keys_[3 * slot] = v;
+        keys_[3 * slot + 1] = t;
+        keys_[3 * slot + 2] = n;
+        values_[slot] = static_cast<GLuint>(next);
+        size_++;
+        return values_[slot];
     }
 
-    // Generate one vertex array object (VAO) and bind it
-    glGenVertexArrays(1, &vao_);
-    glBindVertexArray(vao_);
-
-    // Generate two buffer IDs
-    glGenBuffers(1, &vertexbuffer_);
-    glGenBuffers(1, &indexbuffer_);
-
-    // Activate the vertex buffer
-    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer_);
-    // Present our vertex coordinates to OpenGL
-    glBufferData(GL_ARRAY_BUFFER, vertexarray_.size() * sizeof(GLfloat), vertexarray_.data(),
-                 GL_STATIC_DRAW);
-
-    // Specify how many attribute arrays we have in our VAO
-    glEnableVertexAttribArray(0);  // Vertex coordinates
-    glEnableVertexAttribArray(1);  // Normals
-    glEnableVertexAttribArray(2);  // Texture coordinates
-    // Specify how OpenGL should interpret the vertex buffer data:
-    // Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-    // Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-    // Type GL_FLOAT
-    // Not normalized (GL_FALSE)
-    // Stride 8 (interleaved array with 8 floats per vertex)
-    // Array buffer offset 0, 3, 6 (offset into first vertex)
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)0);  // xyz coordinates
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)(3 * sizeof(GLfloat)));  // normals
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat),
-                          (void*)(6 * sizeof(GLfloat)));  // texcoords
+private:
+    static constexpr GLuint empty = ~GLuint(0);
 
-    // Activate the index buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer_);
-    // Present our vertex indices to OpenGL
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexarray_.size() * sizeof(GLuint), indexarray_.data(),
-                 GL_STATIC_DRAW);
+    static size_t hash(int v, int t, int n) {
+        uint64_t h = static_cast<uint32_t>(v) * 0x9E3779B97F4A7C15ull;
+        h ^= static_cast<uint32_t>(t) * 0xC2B2AE3D27D4EB4Full;
+        h ^= static_cast<uint32_t>(n) * 0x165667B19E3779F9ull;
+        return static_cast<size_t>(h ^ (h >> 29));
+    }
 
-    // Deactivate (unbind) the VAO and the buffers again.
-    // Do NOT unbind the buffers while the VAO is still bound.
-    // The index buffer is an essential part of the VAO state.
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    void rehash(size_t minslots) {
+        size_t capacity = 16;
+        while (capacity < minslots) {
+            capacity *= 2;
+        }
+        std::vector<int> oldkeys(3 * capacity);
+        std::vector<GLuint> oldvalues(capacity, empty);
+        oldkeys.swap(keys_);
+        oldvalues.swap(values_);
+        mask_ = capacity - 1;
+        for (size_t i = 0; i < oldvalues.size(); i++) {
+            if (oldvalues[i] != empty) {
+                size_t slot = hash(oldkeys[3 * i], oldkeys[3 * i + 1], oldkeys[3 * i + 2]) & mask_;
+                while (values_[slot] != empty) {
+                    slot = (slot + 1) & mask_;
+                }
+                std::copy_n(&oldkeys[3 * i], 3, &keys_[3 * slot]);
+                values_[slot] = oldvalues[i];
+            }
+        }
+    }
 
-    return;
+    std::vector<int> keys_;
+    std::vector<GLuint> values_;
+    size_t mask_;
+    size_t size_;
+};
+
+// Negative face indices count back from the last element so far. They are stored as their
+// 1-based index within the chunk minus this, to be told from the absolute indices in the file
+// and resolved when the chunks are merged.
+constexpr int relativeIndex = 1 << 30;
+
+// Data parsed from one chunk of an OBJ file. Absolute face indices are kept exactly as they
+// appear in the file, and all indices are resolved against the arrays of all chunks when the
+// chunks are merged. The arrays are in the arena of the load.
+struct OBJChunk {
+    enum Error { None, Vertex, Normal, TexCoord, Face };
+
+    explicit OBJChunk(Arena& arena)
+        : verts(ArenaAllocator<float>(arena)), normals(ArenaAllocator<float>(arena)),
+          texcoords(ArenaAllocator<float>(arena)), corners(ArenaAllocator<int>(arena)),
+          polygons(ArenaAllocator<int>(arena)) {}
+
+    ArenaVector<float> verts;
+    ArenaVector<float> normals;
+    ArenaVector<float> texcoords;
+    ArenaVector<int> corners;   // v/t/n index triplets of all face corners, 0 for no t or n
+    ArenaVector<int> polygons;  // First corner and number of corners of faces with more than 3
+    int numfaces = 0;
+    int numtriangles = 0;  // n - 2 for each face with n corners
+
+    Error error = None;
+    int errorindex = 0;  // Number (within the chunk) of the element that could not be parsed
+};
+
+// Parse a face corner on the form v, v/t, v//n or v/t/n into the v/t/n triplet 'corner', with
+// 0 for a texture coordinate or normal that is not there. 'counts' are the numbers of vertices,
+// texture coordinates and normals of the chunk so far, which negative indices count back from.
+bool parseCorner(const char*& p, const char* end, const int counts[3], int corner[3]) {
+    corner[1] = corner[2] = 0;
+    for (int k = 0; k < 3; k++) {
+        if (k > 0 && !expectChar(p, end, '/')) {
+            break;
+        }
+        if (k == 1 && p < end && *p == '/') {
+            continue;  // v//n
+        }
+        int index;
+        if (!parseInt(p, end, index) || index == 0) {
+            return false;
+        }
+        corner[k] = (index > 0) ? index : counts[k] + index + 1 - relativeIndex;
+    }
+    return true;
 }
 
-/* Print data from a TriangleSoup object, for debugging purposes */
-void TriangleSoup::print() {
-    printf("TriangleSoup vertex data:\n\n");
-    for (int i = 0; i < nverts_; i++) {
-        printf("%d: %8.2f %8.2f %8.2f\n", i, vertexarray_[8 * i], vertexarray_[8 * i + 1],
-               vertexarray_[8 * i + 2]);
+// Parse all lines in [p, end) into a chunk. Stops at the first malformed line.
+void parseOBJChunk(const char* p, const char* end, OBJChunk& chunk) {
+    while (p < end) {
+        p = skipSpaces(p, end);
+        if (p == end) {
+            break;
+        }
+
+        // Find out what kind of data is on this line from its tag (one or two characters)
+        const char c0 = *p;
+        const char c1 = (p + 1 < end) ? p[1] : '\n';
+        if (c0 == 'v' && isSpace(c1)) {
+            // A vertex with three coordinates
+            p += 1;
+            float x, y, z;
+            if (!(parseFloat(p, end, x) && parseFloat(p, end, y) && parseFloat(p, end, z))) {
+                chunk.error = OBJChunk::Vertex;
+                chunk.errorindex = static_cast<int>(chunk.verts.size() / 3);
+                return;
+            }
+            chunk.verts.insert(chunk.verts.end(), {x, y, z});
+        } else if (c0 == 'v' && c1 == 'n') {
+            // A vertex normal with three components
+            p += 2;
+            float x, y, z;
+            if (!(parseFloat(p, end, x) && parseFloat(p, end, y) && parseFloat(p, end, z))) {
+                chunk.error = OBJChunk::Normal;
+                chunk.errorindex = static_cast<int>(chunk.normals.size() / 3);
+                return;
+            }
+            chunk.normals.insert(chunk.normals.end(), {x, y, z});
+        } else if (c0 == 'v' && c1 == 't') {
+            // A vertex texture coordinate, two components
+            p += 2;
+            float s, t;
+            if (!(parseFloat(p, end, s) && parseFloat(p, end, t))) {
+                chunk.error = OBJChunk::TexCoord;
+                chunk.errorindex = static_cast<int>(chunk.texcoords.size() / 2);
+                return;
+            }
+            chunk.texcoords.insert(chunk.texcoords.end(), {s, t});
+        } else if (c0 == 'f' && isSpace(c1)) {
+            // A face with three or more corners. Faces with more are triangulated after the
+            // merge, when the positions of all chunks are known.
+            p += 1;
+            const int counts[3] = {static_cast<int>(chunk.verts.size() / 3),
+                                   static_cast<int>(chunk.texcoords.size() / 2),
+                                   static_cast<int>(chunk.normals.size() / 3)};
+            const int first = static_cast<int>(chunk.corners.size() / 3);
+            int numcorners = 0;
+            bool valid = true;
+            while (valid && !atEndOfLine(p, end)) {
+                int corner[3];
+                valid = parseCorner(p, end, counts, corner);
+                chunk.corners.insert(chunk.corners.end(), corner, corner + 3);
+                numcorners++;
+            }
+            if (!valid || numcorners < 3) {
+                chunk.error = OBJChunk::Face;
+                chunk.errorindex = chunk.numfaces;
+                return;
+            }
+            if (numcorners > 3) {
+                chunk.polygons.insert(chunk.polygons.end(), {first, numcorners});
+            }
+            chunk.numfaces++;
+            chunk.numtriangles += numcorners - 2;
+        }
+        // Anything else (comments, groups, materials...) is ignored
+        p = skipLine(p, end);
     }
-    printf("\nTriangleSoup face index data:\n\n");
-    for (int i = 0; i < ntris_; i++) {
-        printf("%d: %d %d %d\n", i, indexarray_[3 * i], indexarray_[3 * i + 1],
-               indexarray_[3 * i + 2]);
+}
+
+// Resolve a face index of a chunk to a 0-based index into the merged arrays, with 'offset'
+// elements in the chunks before it. A missing index becomes -1.
+inline int resolveIndex(int index, int offset) {
+    if (index == 0) {
+        return -1;
     }
+    return (index < -relativeIndex / 2) ? offset + index + relativeIndex - 1 : index - 1;
 }
 
-/* Print information about a TriangleSoup object (stats and extents) */
-void TriangleSoup::printInfo() {
-    printf("TriangleSoup information:\n");
-    printf("vertices : %d\n", nverts_);
-    printf("triangles: %d\n", ntris_);
-    float xmin = vertexarray_[0];
-    float xmax = xmin;
-    float ymin = vertexarray_[1];
-    float ymax = ymin;
-    float zmin = vertexarray_[2];
-    float zmax = zmin;
-
-    for (int i = 1; i < nverts_; i++) {
-        const float x = vertexarray_[8 * i];
-        const float y = vertexarray_[8 * i + 1];
-        const float z = vertexarray_[8 * i + 2];
-        //         printf("x y z : %8.2f %8.2f %8.2f\n", x, y, z);
-
-        xmin = std::min(xmin, x);
-        xmax = std::max(xmax, x);
-        ymin = std::min(ymin, y);
-        ymax = std::max(ymax, y);
-        zmin = std::min(zmin, z);
-        zmax = std::max(zmax, z);
-    }
-    printf("xmin: %8.2f\n", xmin);
-    printf("xmax: %8.2f\n", xmax);
-    printf("ymin: %8.2f\n", ymin);
-    printf("ymax: %8.2f\n", ymax);
-    printf("zmin: %8.2f\n", zmin);
-    printf("zmax: %8.2f\n", zmax);
+// Split a polygon of n > 3 corners at the positions 'points' into n - 2 triangles, appended to
+// 'triangles' as corner numbers with the winding of the polygon. A convex polygon becomes a
+// fan. Others lose one ear at a time in the plane that they are most parallel to, which is
+// quadratic in n, but only for that polygon.
+void triangulatePolygon(const float* points, int n, std::vector<int>& triangles,
+                        std::vector<int>& links) {
+    // Newell's normal, and the two axes of the plane that it is closest to
+    float normal[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0, j = n - 1; i < n; j = i++) {
+        const float* a = &points[3 * j];
+        const float* b = &points[3 * i];
+        normal[0] += (a[1] - b[1]) * (a[2] + b[2]);
+        normal[1] += (a[2] - b[2]) * (a[0] + b[0]);
+        normal[2] += (a[0] - b[0]) * (a[1] + b[1]);
+    }
+    const float nx = std::fabs(normal[0]);
+    const float ny = std::fabs(normal[1]);
+    const float nz = std::fabs(normal[2]);
+    int axis = 2;
+    if (nx > ny && nx > nz) {
+        axis = 0;
+    } else if (ny > nz) {
+        axis = 1;
+    }
+    const int u = (axis + 1) % 3;
+    const int v = (axis + 2) % 3;
+    const float orientation = (normal[axis] < 0.0f) ? -1.0f : 1.0f;
+
+    // Twice the area of the triangle of corners a, b and c in the plane, positive if it turns
+    // the same way as the polygon
+    auto turn = [&](int a, int b, int c) {
+        const float* pa = &points[3 * a];
+        const float* pb = &points[3 * b];
+        const float* pc = &points[3 * c];
+        return orientation *
+               ((pb[u] - pa[u]) * (pc[v] - pa[v]) - (pb[v] - pa[v]) * (pc[u] - pa[u]));
+    };
+
+    bool convex = true;
+    for (int i = 0; i < n && convex; i++) {
+        convex = turn((i + n - 1) % n, i, (i + 1) % n) >= 0.0f;
+    }
+    if (convex) {
+        for (int i = 1; i + 1 < n; i++) {
+            triangles.insert(triangles.end(), {0, i, i + 1});
+        }
+        return;
+    }
+
+    // Ear clipping on a ring of the remaining corners
+    links.resize(2 * size_t(n));
+    int* const prev = links.data();
+    int* const next = prev + n;
+    for (int i = 0; i < n; i++) {
+        prev[i] = (i + n - 1) % n;
+        next[i] = (i + 1) % n;
+    }
+    int corner = 0;
+    int misses = 0;
+    for (int remaining = n; remaining > 3;) {
+        const int a = prev[corner];
+        const int b = corner;
+        const int c = next[corner];
+        // An ear turns the right way and has no other corner inside it or on its edges
+        bool ear = turn(a, b, c) > 0.0f;
+        for (int d = next[c]; ear && d != a; d = next[d]) {
+            ear = !(turn(a, b, d) >= 0.0f && turn(b, c, d) >= 0.0f && turn(c, a, d) >= 0.0f);
+        }
+        // A polygon without ears is degenerate, and then any corner is clipped
+        if (ear || misses >= remaining) {
+            triangles.insert(triangles.end(), {a, b, c});
+            next[a] = c;
+            prev[c] = a;
+            remaining--;
+            corner = a;
+            misses = 0;
+        } else {
+            corner = c;
+            misses++;
+        }
+    }
+    triangles.insert(triangles.end(), {prev[corner], corner, next[corner]});
 }
 
-/* Render the geometry in a TriangleSoup object */
+/* Call triangle(t, corners) for each triangle of the faces of a chunk, with t its number in the
+ * chunk and 'corners' the v/t/n triplets of its three corners, resolved into the merged arrays
+ * of 'counts' elements with the chunk's 'offsets' into them. A missing t or n is -1. Faces with
+ * more than three corners are triangulated with the merged positions 'verts'. Returns the
+ * number within the chunk of the first face with an index out of range, or -1 if none is. */
+template <typename Visitor>
+int forEachTriangle(const OBJChunk& chunk, const int offsets[3], const int counts[3],
+                    const float* verts, Visitor&& triangle) {
+    int face[9];                // The v/t/n triplets of the corners of a triangle
+    std::vector<int> polygon;   // and of a face with more corners
+    std::vector<float> points;
+    std::vector<int> triangles;
+    std::vector<int> links;
+    size_t nextpolygon = 0;  // The next face with more than three corners
+    int corner = 0;
+    int numtriangles = 0;
+    for (int f = 0; f < chunk.numfaces; f++) {
+        int n = 3;
+        int* resolved = face;
+        if (nextpolygon < chunk.polygons.size() && chunk.polygons[nextpolygon] == corner) {
+            n = chunk.polygons[nextpolygon + 1];
+            nextpolygon += 2;
+            polygon.resize(3 * size_t(n));
+            resolved = polygon.data();
+        }
+        const int* stored = &chunk.corners[3 * size_t(corner)];
+        for (int i = 0; i < 3 * n; i += 3) {
+            for (int k = 0; k < 3; k++) {
+                const int index = resolveIndex(stored[i + k], offsets[k]);
+                // Only a texture coordinate or normal may be missing
+                if (index >= counts[k] || (index < 0 && (k == 0 || stored[i + k] != 0))) {
+                    return f;
+                }
+                resolved[i + k] = index;
+            }
+        }
+        corner += n;
+        if (n == 3) {
+            triangle(numtriangles++, resolved);
+            continue;
+        }
+        points.resize(3 * size_t(n));
+        for (int i = 0; i < n; i++) {
+            std::copy_n(&verts[3 * size_t(resolved[3 * i])], 3, &points[3 * i]);
+        }
+        triangles.clear();
+        triangulatePolygon(points.data(), n, triangles, links);
+        for (size_t t = 0; t < triangles.size(); t += 3) {
+            int corners[9];
+            for (int k = 0; k < 3; k++) {
+                std::copy_n(&resolved[3 * size_t(triangles[t + k])], 3, &corners[3 * k]);
+            }
+            triangle(numtriangles++, corners);
+        }
+    }
+    return -1;
+}
+
+// The normal of the triangle at the positions of the corners, twice as long as its area
+inline void triangleNormal(const float* verts, const int corners[9], float normal[3]) {
+    const float* a = &verts[3 * size_t(corners[0])];
+    const float* b = &verts[3 * size_t(corners[3])];
+    const float* c = &verts[3 * size_t(corners[6])];
+    const float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    const float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+// Scale a vector to unit length, or make it 0,0,1 if it has no length
+inline void normalizeOrUp(float* n) {
+    const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length > 0.0f) {
+        n[0] /= length;
+        n[1] /= length;
+        n[2] /= length;
+    } else {
+        n[0] = n[1] = 0.0f;
+        n[2] = 1.0f;
+    }
+}
+
+// Write the 8 floats of each of the three unwelded vertices of a triangle to 'vertex'. Corners
+// without a normal get that of the triangle, and those without a texture coordinate get 0,0.
+void writeTriangle(const float* verts, const float* normals, const float* texcoords,
+                   const int corners[9], float* vertex) {
+    float facenormal[3];
+    if (corners[2] < 0 || corners[5] < 0 || corners[8] < 0) {
+        triangleNormal(verts, corners, facenormal);
+        normalizeOrUp(facenormal);
+    }
+    for (int k = 0; k < 3; k++, vertex += 8) {
+        const int vi = corners[3 * k];
+        const int ti = corners[3 * k + 1];
+        const int ni = corners[3 * k + 2];
+        const float* normal = (ni >= 0) ? &normals[3 * ni] : facenormal;
+        vertex[0] = verts[3 * vi];
+        vertex[1] = verts[3 * vi + 1];
+        vertex[2] = verts[3 * vi + 2];
+        vertex[3] = normal[0];
+        vertex[4] = normal[1];
+        vertex[5] = normal[2];
+        vertex[6] = (ti >= 0) ? texcoords[2 * ti] : 0.0f;
+        vertex[7] = (ti >= 0) ? texcoords[2 * ti + 1] : 0.0f;
+    }
+}
+
+// Print the error of a chunk, if it has one, with the numbers of the elements before it.
+// Returns true if it has one.
+bool reportChunkError(const OBJChunk& chunk, size_t vertoffset, size_t normaloffset,
+                      size_t texcoordoffset, size_t faceoffset) {
+    switch (chunk.error) {
+        case OBJChunk::Vertex:
+            std::cerr << "Malformed vertex data found at vertex "
+                      << vertoffset / 3 + chunk.errorindex + 1 << "\nAborting\n";
+            return true;
+        case OBJChunk::Normal:
+            std::cerr << "Malformed normal data found at normal"
+                      << normaloffset / 3 + chunk.errorindex + 1 << "\nAborting\n";
+            return true;
+        case OBJChunk::TexCoord:
+            std::cerr << "Malformed texcoord data found at texcoord "
+                      << texcoordoffset / 2 + chunk.errorindex + 1 << "\nAborting\n";
+            return true;
+        case OBJChunk::Face:
+            std::cerr << "Malformed face data found at face "
+                      << faceoffset + chunk.errorindex + 1 << "\nAborting\n";
+            return true;
+        default:
+            return false;
+    }
+}
+
+}  // namespace
+
+/*
+ * parseOBJ(), used by readOBJ()
+ *
+ * Load TriangleSoup geometry data from an OBJ file, without any OpenGL calls.
+ * The vertex array is on interleaved format. For each vertex, there
+ * are 8 floats: three for the vertex coordinates (x, y, z), three
+ * for the normal vector (n_x, n_y, n_z) and finally two for texture
+ * coordinates (s, t). The arrays are allocated by "new" inside the
+ * function and should be disposed of using "delete" when they are no longer
+ * needed. This is done by the method clean() called by the destructor.
+ * The file is memory mapped and split at line boundaries into chunks,
+ * which are parsed in parallel with the tokenizer functions above.
+ * The chunks are then merged in file order, so the result does not
+ * depend on the number of threads. The arrays of the chunks and of the
+ * merge are taken from an Arena and released together.
+ * Without welding, each face gets three vertices of its own. With welding,
+ * each unique v/t/n triplet becomes one vertex that is shared by all faces
+ * using it, and the index array refers to the shared vertices.
+ *
+ * Author: Stefan Gustavson (stegu@itn.liu.se) 2014.
+ * This code is in the public domain.
+ */
+bool TriangleSoup::parseOBJ(const std::string& filename, MeshData& data, unsigned int numthreads,
+                            bool weld, Arena* arena) {
+    TRACE_SCOPE("parseOBJ");
+    data = MeshData();
+    std::vector<GLfloat>& vertexarray = data.vertices;
+    std::vector<GLuint>& indexarray = data.indices;
+
+    // All temporary arrays are released at once with the arena
+    Arena localarena;
+    Arena& temp = (arena != nullptr) ? *arena : localarena;
+
+    const auto starttime = std::chrono::steady_clock::now();
+
+    // Map the whole file into memory
+    MappedFile objfile(filename);
+    if (!objfile.isOpen()) {
+        std::cerr << "File not found: " << filename << "\n";
+        return false;
+    }
+
+    const char* const begin = objfile.data();
+    const char* const end = begin + objfile.size();
+
+    // Split the file into chunks of at least 1 MB, ending at line boundaries.
+    // Use a few chunks per thread to even out the load between the threads.
+    ThreadPool& pool = ThreadPool::global();
+    numthreads = (numthreads == 0) ? pool.size() : std::min(numthreads, pool.size());
+    const size_t minchunksize = 1 << 20;
+    const size_t numchunks = std::clamp<size_t>(
+        objfile.size() / minchunksize, 1, (numthreads > 1) ? 4 * size_t{numthreads} : 1);
+
+    ArenaVector<const char*> splits(numchunks + 1, end, ArenaAllocator<const char*>(temp));
+    splits[0] = begin;
+    for (size_t c = 1; c < numchunks; c++) {
+        const char* p = begin + c * (objfile.size() / numchunks);
+        splits[c] = std::max(skipLine(std::max(p - 1, splits[c - 1]), end), splits[c - 1]);
+    }
+
+    ArenaVector<OBJChunk> chunks((ArenaAllocator<OBJChunk>(temp)));
+    chunks.reserve(numchunks);
+    for (size_t c = 0; c < numchunks; c++) {
+        chunks.emplace_back(temp);
+    }
+    auto parse = [&](int c) {
+        TRACE_SCOPE("parse OBJ chunk");
+        parseOBJChunk(splits[c], splits[c + 1], chunks[c]);
+    };
+    if (numthreads > 1) {
+        pool.parallelFor(static_cast<int>(numchunks), parse);
+    } else {
+        for (size_t c = 0; c < numchunks; c++) {
+            parse(static_cast<int>(c));
+        }
+    }
+
+    // Offsets of each chunk's data in the merged arrays
+    ArenaVector<size_t> vertoffset(numchunks + 1, 0, ArenaAllocator<size_t>(temp));
+    ArenaVector<size_t> normaloffset(numchunks + 1, 0, ArenaAllocator<size_t>(temp));
+    ArenaVector<size_t> texcoordoffset(numchunks + 1, 0, ArenaAllocator<size_t>(temp));
+    ArenaVector<size_t> faceoffset(numchunks + 1, 0, ArenaAllocator<size_t>(temp));
+    ArenaVector<size_t> triangleoffset(numchunks + 1, 0, ArenaAllocator<size_t>(temp));
+    for (size_t c = 0; c < numchunks; c++) {
+        vertoffset[c + 1] = vertoffset[c] + chunks[c].verts.size();
+        normaloffset[c + 1] = normaloffset[c] + chunks[c].normals.size();
+        texcoordoffset[c + 1] = texcoordoffset[c] + chunks[c].texcoords.size();
+        faceoffset[c + 1] = faceoffset[c] + size_t(chunks[c].numfaces);
+        triangleoffset[c + 1] = triangleoffset[c] + size_t(chunks[c].numtriangles);
+    }
+
+    const int numverts = static_cast<int>(vertoffset[numchunks] / 3);
+    const int numnormals = static_cast<int>(normaloffset[numchunks] / 3);
+    const int numtexcoords = static_cast<int>(texcoordoffset[numchunks] / 2);
+    const int numfaces = static_cast<int>(faceoffset[numchunks]);
+    const int numtriangles = static_cast<int>(triangleoffset[numchunks]);
+
+    // Report the first error in file order
+    int readerror = 0;
+    for (size_t c = 0; c < numchunks && !readerror; c++) {
+        readerror = reportChunkError(chunks[c], vertoffset[c], normaloffset[c],
+                                     texcoordoffset[c], faceoffset[c]);
+    }
+
+    if (!readerror) {
+        float* const verts = temp.allocate<float>(vertoffset[numchunks]);
+        float* const normals = temp.allocate<float>(normaloffset[numchunks]);
+        float* const texcoords = temp.allocate<float>(texcoordoffset[numchunks]);
+        if (!weld) {
+            vertexarray.resize(8 * 3 * size_t(numtriangles));
+        }
+        indexarray.resize(3 * size_t(numtriangles));
+
+        // Gather the attribute arrays of all chunks
+        auto gather = [&](int c) {
+            std::copy(chunks[c].verts.begin(), chunks[c].verts.end(), verts + vertoffset[c]);
+            std::copy(chunks[c].normals.begin(), chunks[c].normals.end(),
+                      normals + normaloffset[c]);
+            std::copy(chunks[c].texcoords.begin(), chunks[c].texcoords.end(),
+                      texcoords + texcoordoffset[c]);
+        };
+
+        // The v/t/n element counts, and the offsets of each chunk's elements, in the merged arrays
+        const int counts[3] = {numverts, numtexcoords, numnormals};
+        auto offsets = [&](size_t c, int* offset) {
+            offset[0] = static_cast<int>(vertoffset[c] / 3);
+            offset[1] = static_cast<int>(texcoordoffset[c] / 2);
+            offset[2] = static_cast<int>(normaloffset[c] / 3);
+        };
+
+        // Resolve the face indices and fill each chunk's range of the interleaved array.
+        // A face index that is out of range is recorded as the first bad face of its chunk.
+        ArenaVector<int> badface(numchunks, -1, ArenaAllocator<int>(temp));
+        auto resolve = [&](int c) {
+            int offset[3];
+            offsets(size_t(c), offset);
+            badface[c] = forEachTriangle(chunks[c], offset, counts, verts,
+                                         [&](int t, const int* corners) {
+                const size_t i_f = triangleoffset[c] + size_t(t);
+                writeTriangle(verts, normals, texcoords, corners, &vertexarray[24 * i_f]);
+                for (int k = 0; k < 3; k++) {
+                    indexarray[3 * i_f + k] = static_cast<GLuint>(3 * i_f + k);
+                }
+            });
+        };
+
+        // Welding: emit one vertex per unique v/t/n triplet, in order of first use,
+        // and let the index array refer to the shared vertices. Vertices without a normal
+        // get the area weighted sum of the normals of their triangles, normalized.
+        int numwelded = 0;
+        auto weldvertices = [&]() {
+            WeldTable table(static_cast<size_t>(std::max({numverts, numnormals, numtexcoords})));
+            vertexarray.clear();
+            vertexarray.reserve(8 * size_t(numverts));
+            std::vector<GLuint> summednormals;
+            bool valid = true;
+            for (size_t c = 0; c < numchunks && valid; c++) {
+                int offset[3];
+                offsets(c, offset);
+                badface[c] = forEachTriangle(chunks[c], offset, counts, verts,
+                                             [&](int t, const int* corners) {
+                    const size_t i_f = triangleoffset[c] + size_t(t);
+                    float facenormal[3];
+                    if (corners[2] < 0 || corners[5] < 0 || corners[8] < 0) {
+                        triangleNormal(verts, corners, facenormal);
+                    }
+                    for (int k = 0; k < 3; k++) {
+                        const int vi = corners[3 * k];
+                        const int ti = corners[3 * k + 1];
+                        const int ni = corners[3 * k + 2];
+                        const GLuint index = table.insert(vi, ti, ni, numwelded);
+                        if (index == static_cast<GLuint>(numwelded)) {  // A new vertex
+                            const float* normal = (ni >= 0) ? &normals[3 * ni] : facenormal;
+                            vertexarray.insert(vertexarray.end(),
+                                               {verts[3 * vi], verts[3 * vi + 1],
+                                                verts[3 * vi + 2], normal[0], normal[1],
+                                                normal[2], (ti >= 0) ? texcoords[2 * ti] : 0.0f,
+                                                (ti >= 0) ? texcoords[2 * ti + 1] : 0.0f});
+                            if (ni < 0) {
+                                summednormals.push_back(index);
+                            }
+                            numwelded++;
+                        } else if (ni < 0) {
+                            float* normal = &vertexarray[8 * size_t(index) + 3];
+                            normal[0] += facenormal[0];
+                            normal[1] += facenormal[1];
+                            normal[2] += facenormal[2];
+                        }
+                        indexarray[3 * i_f + k] = index;
+                    }
+                });
+                valid = badface[c] < 0;
+            }
+            for (const GLuint index : summednormals) {
+                normalizeOrUp(&vertexarray[8 * size_t(index) + 3]);
+            }
+        };
+
+        // All attributes must be gathered before any face is resolved,
+        // since faces may refer to data in any chunk.
+        if (numthreads > 1) {
+            pool.parallelFor(static_cast<int>(numchunks), gather);
+        } else {
+            for (size_t c = 0; c < numchunks; c++) {
+                gather(static_cast<int>(c));
+            }
+        }
+        if (weld) {
+            weldvertices();
+        } else if (numthreads > 1) {
+            pool.parallelFor(static_cast<int>(numchunks), resolve);
+        } else {
+            for (size_t c = 0; c < numchunks; c++) {
+                resolve(static_cast<int>(c));
+            }
+        }
+
+        for (size_t c = 0; c < numchunks && !readerror; c++) {
+            if (badface[c] >= 0) {
+                std::cerr << "Face index out of range found at face "
+                          << faceoffset[c] + badface[c] + 1 << "\nAborting\n";
+                readerror = 1;
+            }
+        }
+    }
+
+    if (readerror) {  // Delete corrupt data and bail out if a read error occured
+        std::cerr << "Mesh read error: No mesh data generated\n";
+        data = MeshData();
+        return false;
+    }
+
+    // A file without normals gets smooth ones, which are only shared by triangles that meet
+    // at less than the crease angle
+    if (numnormals == 0) {
+        TRACE_SCOPE("computeNormals");
+        mesh::computeNormals(vertexarray, 8, indexarray, objCreaseAngle,
+                             numthreads > 1 ? &pool : nullptr);
+    }
+    data.unweldedverts = weld ? 3 * numtriangles : 0;
+
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - starttime).count();
+    const double megabytes = static_cast<double>(objfile.size()) / (1024.0 * 1024.0);
+
+    std::cout << "loadObj(\"" << filename << "\"): found " << numverts << " vertices, "
+              << numnormals << " normals, " << numtexcoords << " texcoords, " << numfaces
+              << " faces, " << numtriangles << " triangles.\n";
+    printf("loadObj(\"%s\"): parsed %.2f MB in %.1f ms (%.1f MB/s, %zu chunks, %u threads)\n",
+           filename.c_str(), megabytes, 1000.0 * seconds,
+           (seconds > 0.0) ? megabytes / seconds : 0.0, numchunks, numthreads);
+
+    return true;
+}
+
+void TriangleSoup::readOBJ(const std::string& filename, unsigned int numthreads, bool weld,
+                           Arena* arena) {
+    TRACE_SCOPE("readOBJ");
+    // Delete any previous content in the TriangleSoup object
+    clean();
+    if (label_.empty()) {
+        label_ = filename;
+    }
+
+    MeshData data;
+    if (parseOBJ(filename, data, numthreads, weld, arena)) {
+        // Create the vertex array object and buffers, and send the arrays to OpenGL
+        createFromData(std::move(data));
+    }
+}
+
+/*
+ * Start loading an OBJ file that arrives over time. The geometry that the mesh has is kept
+ * until the first faces are there.
+ */
+void TriangleSoup::beginOBJ(const std::string& filename) {
+    std::shared_ptr<vfs::File> file = vfs::open(filename);
+    if (!file) {
+        std::cerr << "File not found: " << filename << "\n";
+        return;
+    }
+    if (label_.empty()) {
+        label_ = filename;
+    }
+    if (objstream_) {
+        retention_ = objstream_->retention;
+    }
+    objstream_ = std::make_unique<OBJStream>();
+    objstream_->file = std::move(file);
+    // The arrays grow with each part of the file, so they are kept until the end
+    objstream_->retention = retention_;
+    retention_ = Retention::Keep;
+}
+
+/*
+ * Parse the whole lines of the file that have arrived since the last call, with the parser of
+ * parseOBJ() on this thread, and upload the mesh with their faces. A face that refers to a
+ * vertex that has not been read yet is an error, as it is for parseOBJ().
+ */
+bool TriangleSoup::continueOBJ(size_t maxbytes) {
+    if (!objstream_) {
+        return false;
+    }
+    OBJStream& stream = *objstream_;
+    const vfs::File& file = *stream.file;
+    const bool complete = file.complete() || file.failed();  // Before the bytes that it has
+    const size_t available = file.available();
+    const char* const data = file.data();
+
+    // At most 'maxbytes' bytes up to the end of a line, or the first line if it is longer, and
+    // the last line without a newline once the file is complete
+    size_t end = std::min(available, stream.parsed + std::max<size_t>(maxbytes, 1));
+    if (end > stream.parsed && (!complete || end < available)) {
+        size_t line = end;
+        while (line > stream.parsed && data[line - 1] != '\n') {
+            line--;
+        }
+        if (line == stream.parsed) {
+            const void* newline = std::memchr(data + end, '\n', available - end);
+            line = (newline != nullptr) ? size_t(static_cast<const char*>(newline) - data) + 1
+                                        : (complete ? available : stream.parsed);
+        }
+        end = line;
+    }
+
+    bool ok = true;
+    if (end > stream.parsed) {
+        OBJChunk chunk(stream.arena);
+        parseOBJChunk(data + stream.parsed, data + end, chunk);
+        ok = !reportChunkError(chunk, stream.verts.size(), stream.normals.size(),
+                               stream.texcoords.size(), size_t(stream.numfaces));
+        const int offsets[3] = {static_cast<int>(stream.verts.size() / 3),
+                                static_cast<int>(stream.texcoords.size() / 2),
+                                static_cast<int>(stream.normals.size() / 3)};
+        stream.verts.insert(stream.verts.end(), chunk.verts.begin(), chunk.verts.end());
+        stream.normals.insert(stream.normals.end(), chunk.normals.begin(), chunk.normals.end());
+        stream.texcoords.insert(stream.texcoords.end(), chunk.texcoords.begin(),
+                                chunk.texcoords.end());
+        const int counts[3] = {static_cast<int>(stream.verts.size() / 3),
+                               static_cast<int>(stream.texcoords.size() / 2),
+                               static_cast<int>(stream.normals.size() / 3)};
+
+        if (ok && chunk.numtriangles > 0) {
+            if (!stream.started) {
+                // The first faces replace what the mesh had before
+                std::unique_ptr<OBJStream> keep = std::move(objstream_);
+                clean();
+                objstream_ = std::move(keep);
+                stream.started = true;
+            }
+            const size_t first = vertexarray_.size() / 8;
+            vertexarray_.resize(vertexarray_.size() + 24 * size_t(chunk.numtriangles));
+            indexarray_.resize(indexarray_.size() + 3 * size_t(chunk.numtriangles));
+            const int badface = forEachTriangle(chunk, offsets, counts, stream.verts.data(),
+                                                [&](int t, const int* corners) {
+                const size_t i = first + 3 * size_t(t);
+                writeTriangle(stream.verts.data(), stream.normals.data(),
+                              stream.texcoords.data(), corners, &vertexarray_[8 * i]);
+                for (size_t k = i; k < i + 3; k++) {
+                    indexarray_[k] = static_cast<GLuint>(k);
+                }
+            });
+            if (badface >= 0) {
+                std::cerr << "Face index out of range found at face "
+                          << stream.numfaces + badface + 1 << "\nAborting\n";
+                vertexarray_.resize(8 * first);  // The faces before the chunk are kept
+                indexarray_.resize(first);
+                ok = false;
+            } else {
+                stream.numfaces += chunk.numfaces;
+                nverts_ = static_cast<int>(vertexarray_.size() / 8);
+                ntris_ = static_cast<int>(indexarray_.size() / 3);
+                upload();
+            }
+        }
+        stream.parsed = end;
+        stream.arena.reset();
+    }
+
+    if (ok && !(complete && stream.parsed == available)) {
+        return true;  // More is to come
+    }
+    if (file.failed()) {
+        std::cerr << "loadObj(\"" << file.name() << "\"): the file stopped after "
+                  << stream.parsed << " bytes\n";
+    }
+    std::cout << "loadObj(\"" << file.name() << "\"): streamed " << stream.verts.size() / 3
+              << " vertices, " << stream.normals.size() / 3 << " normals, "
+              << stream.texcoords.size() / 2 << " texcoords, " << stream.numfaces
+              << " faces, " << ntris_ << " triangles.\n";
+    const Retention retention = stream.retention;
+    objstream_.reset();
+    setRetention(retention);
+    return false;
+}
+
+/* Take over parsed arrays and send them to OpenGL */
+void TriangleSoup::createFromData(MeshData&& data) {
+    TRACE_SCOPE("upload mesh");
+    clean();
+    vertexarray_ = std::move(data.vertices);
+    indexarray_ = std::move(data.indices);
+    nverts_ = static_cast<int>(vertexarray_.size() / 8);
+    ntris_ = static_cast<int>(indexarray_.size() / 3);
+    nunweldedverts_ = data.unweldedverts;
+    data = MeshData();
+    upload();
+}
+
+namespace {
+
+/*
+ * Header of the binary mesh format. The header is followed by the vertex data on the same
+ * interleaved format as vertexarray_, then by the index data, 16 bit for meshes with
+ * at most maxShortIndexVerts vertices and 32 bit otherwise, and last by the meshlets, if
+ * any, as an array of mesh::Meshlet. The blocks start at
+ * offsets that are multiples of meshFileAlignment, so they can be sent to OpenGL directly
+ * from a memory mapped file. All values are stored in the byte order of the writing machine,
+ * which is detected from the magic code and the version.
+ * In a compressed file, the vertex and index blocks are instead split into chunks of
+ * vertexchunk vertices and indexchunk triangles, coded with the meshoptimizer codecs of
+ * MeshCodec, so that the chunks can be decoded in parallel. Each block starts with a
+ * MeshFileChunk per chunk, and vertexbytes and indexbytes are the compressed sizes.
+ */
+struct MeshFileHeader {
+    char magic[8];           // "TNMMESH" and a null
+    uint32_t version;        // meshFileVersion
+    uint32_t flags;          // Bit 0: the mesh was welded, bit 1: it has meshlets
+    uint32_t numverts;       // Number of vertices
+    uint32_t numtris;        // Number of triangles
+    uint32_t vertexstride;   // Bytes per vertex
+    uint32_t indexsize;      // Bytes per index
+    uint64_t vertexoffset;   // Offset of the vertex data from the start of the file
+    uint64_t vertexbytes;    // Size of the vertex data in bytes
+    uint64_t indexoffset;    // Offset of the index data from the start of the file
+    uint64_t indexbytes;     // Size of the index data in bytes
+    uint64_t sourcesize;     // Size of the file the mesh was made from (0 if unknown)
+    int64_t sourcetime;      // Modification time of that file (0 if unknown)
+    uint32_t unweldedverts;  // Number of vertices before welding
+    uint32_t nummeshlets;    // Number of mesh::Meshlet structs, zero if there are none
+    uint64_t meshletoffset;  // Offset of the meshlets from the start of the file
+    uint32_t vertexchunk;    // Vertices per compressed chunk, zero if not compressed
+    uint32_t indexchunk;     // Triangles per compressed chunk, zero if not compressed
+    float boundsmin[3];      // The mesh::Bounds of the vertices, which a compressed file
+    float boundsmax[3];      // could only give after the decoding
+    float boundscenter[3];
+    float boundsradius;
+};
+
+// The table of chunks at the start of a compressed block
+struct MeshFileChunk {
+    uint64_t end;          // Offset of the end of the chunk from the start of the block
+    uint32_t firstvertex;  // The first new vertex of an index chunk, as of encodeIndexBuffer()
+    uint32_t reserved;
+};
+
+const char meshFileMagic[8] = {'T', 'N', 'M', 'M', 'E', 'S', 'H', '\0'};
+const uint32_t meshFileVersion = 4;  // 4: smooth normals for OBJ files without normals
+const uint64_t meshFileAlignment = 64;
+const uint32_t meshFileWelded = 1;
+const uint32_t meshFileMeshlets = 2;
+const uint32_t meshFileCompressed = 4;
+// Chunks of this many vertices or triangles, which take a thread a fraction of a millisecond
+const uint32_t meshFileChunkSize = 1 << 16;
+
+uint64_t alignMeshOffset(uint64_t offset) {
+    return (offset + meshFileAlignment - 1) / meshFileAlignment * meshFileAlignment;
+}
+
+// Read and check the header of a binary mesh file
+bool readMeshHeader(const MappedFile& file, MeshFileHeader& header) {
+    if (file.size() < sizeof(MeshFileHeader)) {
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(MeshFileHeader));
+    if (memcmp(header.magic, meshFileMagic, sizeof(meshFileMagic)) != 0 ||
+        header.version != meshFileVersion) {
+        return false;
+    }
+    // A compressed block holds at least its table of chunks
+    const bool compressed = (header.flags & meshFileCompressed) != 0;
+    const bool sizes =
+        compressed ? (header.vertexchunk > 0 && header.indexchunk > 0 &&
+                      header.vertexbytes >= (header.numverts + header.vertexchunk - 1) /
+                                                header.vertexchunk * sizeof(MeshFileChunk) &&
+                      header.indexbytes >= (header.numtris + header.indexchunk - 1) /
+                                               header.indexchunk * sizeof(MeshFileChunk))
+                   : (header.vertexbytes == uint64_t(header.numverts) * header.vertexstride &&
+                      header.indexbytes == 3 * uint64_t(header.numtris) * header.indexsize);
+    return header.vertexstride == 8 * sizeof(GLfloat) &&
+           (header.indexsize == sizeof(GLushort) || header.indexsize == sizeof(GLuint)) &&
+           sizes && header.vertexoffset + header.vertexbytes <= file.size() &&
+           header.indexoffset + header.indexbytes <= file.size() &&
+           (header.nummeshlets == 0 ||
+            header.meshletoffset + header.nummeshlets * sizeof(mesh::Meshlet) <= file.size());
+}
+
+/*
+ * Code 'count' vertices of 'size' bytes, or 'count' triangles of 32 bit indices, into a
+ * compressed block of chunks of 'chunksize' of them each, the chunks in parallel. The index
+ * chunks number their new vertices from one past the largest index of the chunks before,
+ * which is where the vertices of a welded mesh continue.
+ */
+std::vector<unsigned char> encodeMeshBlock(const void* data, size_t count, size_t size,
+                                           bool indices, size_t chunksize, size_t numverts) {
+    const size_t numchunks = (count + chunksize - 1) / chunksize;
+    std::vector<MeshFileChunk> table(numchunks, MeshFileChunk{0, 0, 0});
+    if (indices) {
+        const GLuint* index = static_cast<const GLuint*>(data);
+        GLuint next = 0;
+        for (size_t c = 0; c < numchunks; c++) {
+            table[c].firstvertex = next;
+            const size_t end = 3 * std::min(count, (c + 1) * chunksize);
+            for (size_t i = 3 * c * chunksize; i < end; i++) {
+                next = std::max(next, index[i] + 1);
+            }
+        }
+    }
+    std::vector<std::vector<unsigned char>> chunks(numchunks);
+    ThreadPool::global().parallelFor(static_cast<int>(numchunks), [&](int c) {
+        const size_t first = size_t(c) * chunksize;
+        const size_t n = std::min(count - first, chunksize);
+        std::vector<unsigned char>& chunk = chunks[c];
+        if (indices) {
+            chunk.resize(meshcodec::encodeIndexBufferBound(3 * n, numverts));
+            chunk.resize(meshcodec::encodeIndexBuffer(
+                chunk.data(), chunk.size(), static_cast<const GLuint*>(data) + 3 * first, 3 * n,
+                table[c].firstvertex));
+        } else {
+            chunk.resize(meshcodec::encodeVertexBufferBound(n, size));
+            chunk.resize(meshcodec::encodeVertexBuffer(
+                chunk.data(), chunk.size(), static_cast<const unsigned char*>(data) + first * size,
+                n, size));
+        }
+    });
+    std::vector<unsigned char> block(numchunks * sizeof(MeshFileChunk));
+    for (size_t c = 0; c < numchunks; c++) {
+        block.insert(block.end(), chunks[c].begin(), chunks[c].end());
+        table[c].end = block.size();
+    }
+    if (numchunks > 0) {
+        memcpy(block.data(), table.data(), numchunks * sizeof(MeshFileChunk));
+    }
+    return block;
+}
+
+/*
+ * Decode the compressed vertex or index block of a mesh file to 'out', which may be a mapped
+ * buffer, with the chunks in parallel. False if the block is damaged.
+ */
+bool decodeMeshBlock(const MappedFile& file, const MeshFileHeader& header, bool indices,
+                     unsigned char* out) {
+    const unsigned char* block = reinterpret_cast<const unsigned char*>(file.data()) +
+                                 (indices ? header.indexoffset : header.vertexoffset);
+    const uint64_t blockbytes = indices ? header.indexbytes : header.vertexbytes;
+    const size_t count = indices ? header.numtris : header.numverts;
+    const size_t chunksize = indices ? header.indexchunk : header.vertexchunk;
+    const size_t numchunks = (count + chunksize - 1) / chunksize;
+    std::vector<MeshFileChunk> table(numchunks);
+    if (numchunks > 0) {
+        memcpy(table.data(), block, numchunks * sizeof(MeshFileChunk));
+    }
+    std::atomic<bool> ok(true);
+    ThreadPool::global().parallelFor(static_cast<int>(numchunks), [&](int c) {
+        const uint64_t begin = (c == 0) ? numchunks * sizeof(MeshFileChunk) : table[c - 1].end;
+        const uint64_t end = table[c].end;
+        const size_t first = size_t(c) * chunksize;
+        const size_t n = std::min(count - first, chunksize);
+        bool decoded = false;
+        if (begin <= end && end <= blockbytes) {
+            decoded = indices ? meshcodec::decodeIndexBuffer(
+                                    out + 3 * first * header.indexsize, 3 * n, header.indexsize,
+                                    block + begin, end - begin, table[c].firstvertex)
+                              : meshcodec::decodeVertexBuffer(
+                                    out + first * header.vertexstride, n, header.vertexstride,
+                                    block + begin, end - begin);
+        }
+        if (!decoded) {
+            ok = false;
+        }
+    });
+    return ok;
+}
+
+}  // namespace
+
+/* Write the mesh to a binary file that can be loaded quickly with readBinary() */
+bool TriangleSoup::writeBinary(const std::string& filename, const std::string& sourcefile,
+                               bool compressed) const {
+    if (vertexarray_.empty()) {
+        std::cerr << "writeBinary(\"" << filename << "\"): no vertex data to write\n";
+        return false;
+    }
+
+    MeshFileHeader header = {};
+    memcpy(header.magic, meshFileMagic, sizeof(meshFileMagic));
+    header.version = meshFileVersion;
+    header.flags = ((nunweldedverts_ > 0) ? meshFileWelded : 0) |
+                   (meshlets_.empty() ? 0 : meshFileMeshlets) |
+                   (compressed ? meshFileCompressed : 0);
+    header.numverts = static_cast<uint32_t>(nverts_);
+    header.numtris = static_cast<uint32_t>(ntris_);
+    header.vertexstride = 8 * sizeof(GLfloat);
+    // Store 16 bit indices when they are used on the GPU, so they can be uploaded directly
+    const bool shortindices = (nverts_ <= maxShortIndexVerts);
+    header.indexsize = shortindices ? sizeof(GLushort) : sizeof(GLuint);
+
+    // The compressed blocks, or the arrays as they are
+    std::vector<unsigned char> vertexblock;
+    std::vector<unsigned char> indexblock;
+    std::vector<GLushort> indices;
+    const void* vertexdata = vertexarray_.data();
+    const void* indexdata = indexarray_.data();
+    header.vertexbytes = vertexarray_.size() * sizeof(GLfloat);
+    header.indexbytes = indexarray_.size() * header.indexsize;
+    if (compressed) {
+        header.vertexchunk = meshFileChunkSize;
+        header.indexchunk = meshFileChunkSize;
+        vertexblock = encodeMeshBlock(vertexarray_.data(), size_t(nverts_), header.vertexstride,
+                                      false, meshFileChunkSize, size_t(nverts_));
+        indexblock = encodeMeshBlock(indexarray_.data(), size_t(ntris_), 0, true,
+                                     meshFileChunkSize, size_t(nverts_));
+        vertexdata = vertexblock.data();
+        indexdata = indexblock.data();
+        header.vertexbytes = vertexblock.size();
+        header.indexbytes = indexblock.size();
+    } else if (shortindices) {
+        indices.assign(indexarray_.begin(), indexarray_.end());
+        indexdata = indices.data();
+    }
+    header.vertexoffset = alignMeshOffset(sizeof(MeshFileHeader));
+    header.indexoffset = alignMeshOffset(header.vertexoffset + header.vertexbytes);
+    header.unweldedverts = static_cast<uint32_t>(nunweldedverts_);
+    header.nummeshlets = static_cast<uint32_t>(meshlets_.size());
+    header.meshletoffset = alignMeshOffset(header.indexoffset + header.indexbytes);
+    std::copy_n(bounds_.min, 3, header.boundsmin);
+    std::copy_n(bounds_.max, 3, header.boundsmax);
+    std::copy_n(bounds_.center, 3, header.boundscenter);
+    header.boundsradius = bounds_.radius;
+    if (!sourcefile.empty()) {
+        util::fileStamp(sourcefile, header.sourcesize, header.sourcetime);
+    }
+
+    FILE* meshfile = fopen(filename.c_str(), "wb");
+    if (!meshfile) {
+        std::cerr << "writeBinary(\"" << filename << "\"): could not create file\n";
+        return false;
+    }
+
+    const char padding[meshFileAlignment] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, meshfile) == 1;
+    ok = ok && fwrite(padding, 1, header.vertexoffset - sizeof(header), meshfile) ==
+                   header.vertexoffset - sizeof(header);
+    ok = ok && fwrite(vertexdata, 1, header.vertexbytes, meshfile) == header.vertexbytes;
+    const uint64_t indexpadding = header.indexoffset - header.vertexoffset - header.vertexbytes;
+    ok = ok && fwrite(padding, 1, indexpadding, meshfile) == indexpadding;
+    ok = ok && fwrite(indexdata, 1, header.indexbytes, meshfile) == header.indexbytes;
+    if (!meshlets_.empty()) {
+        const uint64_t meshletpadding =
+            header.meshletoffset - header.indexoffset - header.indexbytes;
+        const size_t meshletbytes = meshlets_.size() * sizeof(mesh::Meshlet);
+        ok = ok && fwrite(padding, 1, meshletpadding, meshfile) == meshletpadding;
+        ok = ok && fwrite(meshlets_.data(), 1, meshletbytes, meshfile) == meshletbytes;
+    }
+    ok = (fclose(meshfile) == 0) && ok;
+
+    if (!ok) {
+        std::cerr << "writeBinary(\"" << filename << "\"): write error\n";
+        std::remove(filename.c_str());
+    }
+    return ok;
+}
+
+/*
+ * Load a mesh written by writeBinary(). The file is memory mapped and the vertex and index
+ * data are sent to OpenGL straight from the mapping, without copies in vertexarray_ or
+ * indexarray_. The CPU side arrays are therefore left empty. Compressed data is decoded
+ * by all threads straight into the mapped ranges of the buffers, unless it is needed on the
+ * CPU as well, for the Split layout or for picking, when it is decoded to memory first.
+ */
+bool TriangleSoup::readBinary(const std::string& filename) {
+    // Delete any previous content in the TriangleSoup object
+    clean();
+    if (label_.empty()) {
+        label_ = filename;
+    }
+
+    const auto starttime = std::chrono::steady_clock::now();
+
+    MappedFile meshfile(filename);
+    if (!meshfile.isOpen()) {
+        std::cerr << "File not found: " << filename << "\n";
+        return false;
+    }
+
+    MeshFileHeader header;
+    if (!readMeshHeader(meshfile, header)) {
+        std::cerr << "readBinary(\"" << filename << "\"): not a valid mesh file\n";
+        return false;
+    }
+
+    nverts_ = static_cast<int>(header.numverts);
+    ntris_ = static_cast<int>(header.numtris);
+    nunweldedverts_ = static_cast<int>(header.unweldedverts);
+    const mesh::Meshlet* meshlets =
+        reinterpret_cast<const mesh::Meshlet*>(meshfile.data() + header.meshletoffset);
+    meshlets_.assign(meshlets, meshlets + header.nummeshlets);
+    std::copy_n(header.boundsmin, 3, bounds_.min);
+    std::copy_n(header.boundsmax, 3, bounds_.max);
+    std::copy_n(header.boundscenter, 3, bounds_.center);
+    bounds_.radius = header.boundsradius;
+
+    const char* vertexdata = meshfile.data() + header.vertexoffset;
+    const char* indexdata = meshfile.data() + header.indexoffset;
+    const size_t vertexbytes = size_t(nverts_) * header.vertexstride;
+    const size_t indexbytes = 3 * size_t(ntris_) * header.indexsize;
+    const bool compressed = (header.flags & meshFileCompressed) != 0;
+    const bool mapped = compressed && vertexlayout_ != VertexLayout::Split &&
+                        retention_ != Retention::Picking;
+    std::vector<char> decoded;
+    if (compressed && !mapped) {
+        decoded.resize(vertexbytes + indexbytes);
+        unsigned char* out = reinterpret_cast<unsigned char*>(decoded.data());
+        if (!decodeMeshBlock(meshfile, header, false, out) ||
+            !decodeMeshBlock(meshfile, header, true, out + vertexbytes)) {
+            std::cerr << "readBinary(\"" << filename << "\"): damaged mesh data\n";
+            clean();
+            return false;
+        }
+        vertexdata = decoded.data();
+        indexdata = decoded.data() + vertexbytes;
+    }
+    // Null data leaves the ranges of the buffers to be written here
+    upload(mapped ? nullptr : vertexdata, vertexbytes, mapped ? nullptr : indexdata, indexbytes,
+           VertexFormat::Float,
+           (header.indexsize == sizeof(GLushort)) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+    if (mapped) {
+        // One range at a time, since both may be in the same buffer
+        bool ok = vertexbuffer_ && indexbuffer_;
+        for (int block = 0; block < 2 && ok; block++) {
+            const BufferAllocation& range = (block == 0) ? vertexbuffer_ : indexbuffer_;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, range.buffer);
+            void* out = glMapBufferRange(GL_COPY_WRITE_BUFFER, range.offset,
+                                         block == 0 ? vertexbytes : indexbytes,
+                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+            ok = out != nullptr &&
+                 decodeMeshBlock(meshfile, header, block == 1, static_cast<unsigned char*>(out));
+            ok = (out == nullptr || glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_TRUE) && ok;
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        if (!ok) {
+            std::cerr << "readBinary(\"" << filename << "\"): damaged mesh data\n";
+            clean();
+            return false;
+        }
+    }
+
+    // Only a mesh for picking keeps anything on the CPU, copied from the mapping
+    if (retention_ == Retention::Picking) {
+        const GLfloat* vertices = reinterpret_cast<const GLfloat*>(vertexdata);
+        positions_.resize(3 * size_t(nverts_));
+        for (size_t i = 0; i < size_t(nverts_); i++) {
+            std::copy_n(vertices + 8 * i, 3, &positions_[3 * i]);
+        }
+        const char* indices = indexdata;
+        if (header.indexsize == sizeof(GLushort)) {
+            const GLushort* shortindices = reinterpret_cast<const GLushort*>(indices);
+            indexarray_.assign(shortindices, shortindices + 3 * size_t(ntris_));
+        } else {
+            const GLuint* longindices = reinterpret_cast<const GLuint*>(indices);
+            indexarray_.assign(longindices, longindices + 3 * size_t(ntris_));
+        }
+        buildRayTree(positions_.data(), 3);
+    }
+
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - starttime).count();
+    printf("readBinary(\"%s\"): %d vertices, %d triangles in %.2f ms%s\n", filename.c_str(),
+           nverts_, ntris_, 1000.0 * seconds, compressed ? " (compressed)" : "");
+    return true;
+}
+
+/*
+ * Load an OBJ file through a binary cache file next to it (filename with ".tsmesh" added).
+ * The cache is used if it was made from the current version of the OBJ file with the same
+ * welding and meshlet settings, compressed or not. Otherwise the OBJ file is parsed and a new
+ * cache file is written.
+ */
+void TriangleSoup::readCachedOBJ(const std::string& filename, bool weld, bool meshlets,
+                                 Arena* arena, bool compressed) {
+    const std::string cachefile = filename + ".tsmesh";
+    if (label_.empty()) {
+        label_ = filename;  // Rather than the cache file
+    }
+
+    uint64_t sourcesize = 0;
+    int64_t sourcetime = 0;
+    const bool sourcefound = util::fileStamp(filename, sourcesize, sourcetime);
+
+    // A URL is cached by the virtual file system, and gets no cache file next to it
+    const bool local = !vfs::isRemote(filename);
+    if (local) {
+        MappedFile meshfile(cachefile);
+        MeshFileHeader header;
+        if (meshfile.isOpen() && readMeshHeader(meshfile, header) &&
+            (!sourcefound ||
+             (header.sourcesize == sourcesize && header.sourcetime == sourcetime)) &&
+            ((header.flags & meshFileWelded) != 0) == weld &&
+            ((header.flags & meshFileMeshlets) != 0) == meshlets) {
+            meshfile.close();
+            if (readBinary(cachefile)) {
+                return;
+            }
+        }
+    }
+
+    // The vertex array is needed for the meshlets and the cache file, and dropped after
+    const Retention retention = retention_;
+    retention_ = Retention::Keep;
+    readOBJ(filename, 0, weld, arena);
+    if (meshlets) {
+        buildMeshlets();
+    }
+    if (nverts_ > 0 && local) {
+        writeBinary(cachefile, filename, compressed);
+    }
+    setRetention(retention);
+}
+
+/*
+ * Load a primitive of a GLB file. The vertex attributes are sent to one range of the buffer
+ * pool as the parts of their buffer views that they cover, so that attributes interleaved in
+ * one view are sent once, and the attribute pointers take the types, strides and offsets of
+ * the file. Nothing is parsed or converted on the CPU but 8 bit indices, which the GPU may
+ * not draw from directly, and the positions for Retention::Picking.
+ */
+bool TriangleSoup::readGLB(const std::string& filename, int mesh, int primitive) {
+    // Delete any previous content in the TriangleSoup object
+    clean();
+    if (label_.empty()) {
+        label_ = filename;
+    }
+
+    const auto starttime = std::chrono::steady_clock::now();
+
+    GLBFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+    GLBFile::Primitive parts;
+    if (!file.primitive(mesh, primitive, parts)) {
+        std::cerr << "readGLB(\"" << filename << "\"): no primitive " << primitive
+                  << " in mesh " << mesh << "\n";
+        return false;
+    }
+    if (parts.mode != GL_TRIANGLES || parts.position < 0) {
+        std::cerr << "readGLB(\"" << filename << "\"): only triangle lists with positions "
+                  << "are supported\n";
+        return false;
+    }
+
+    // Attributes 0, 1 and 2 of vertex.glsl, with the components they need
+    const int accessors[3] = {parts.position, parts.normal, parts.texcoord};
+    const int components[3] = {3, 3, 2};
+    GLBFile::Accessor attributes[3];
+    unsigned int found = 0;
+    for (int a = 0; a < 3; a++) {
+        if (accessors[a] < 0) {
+            continue;
+        }
+        if (!file.accessor(accessors[a], attributes[a])) {
+            return false;
+        }
+        if (attributes[a].components != components[a] ||
+            attributes[a].componenttype == GL_UNSIGNED_INT ||
+            attributes[a].count != attributes[0].count) {
+            std::cerr << "readGLB(\"" << filename << "\"): vertex attribute " << a
+                      << " has an unsupported type or the wrong number of vertices\n";
+            return false;
+        }
+        found |= 1u << a;
+    }
+    const GLBFile::Accessor& position = attributes[0];
+    if (position.count == 0 || position.count > size_t(1) << 31) {
+        std::cerr << "readGLB(\"" << filename << "\"): no vertices, or too many\n";
+        return false;
+    }
+
+    // The index array as it is, except for 8 bit indices, or made up as 0, 1, 2, ...
+    GLBFile::Accessor indices;
+    std::vector<GLushort> shortindices;
+    std::vector<GLuint> sequentialindices;
+    const void* indexdata = nullptr;
+    size_t indexcount = 0;
+    GLenum indextype = GL_UNSIGNED_INT;
+    if (parts.indices >= 0) {
+        if (!file.accessor(parts.indices, indices)) {
+            return false;
+        }
+        const bool validtype = indices.componenttype == GL_UNSIGNED_BYTE ||
+                               indices.componenttype == GL_UNSIGNED_SHORT ||
+                               indices.componenttype == GL_UNSIGNED_INT;
+        if (indices.components != 1 || !validtype || indices.stride != indices.elementSize() ||
+            indices.count % 3 != 0) {
+            std::cerr << "readGLB(\"" << filename << "\"): not a valid triangle index array\n";
+            return false;
+        }
+        indexcount = indices.count;
+        if (indices.componenttype == GL_UNSIGNED_BYTE) {
+            shortindices.assign(indices.data, indices.data + indexcount);
+            indexdata = shortindices.data();
+            indextype = GL_UNSIGNED_SHORT;
+        } else {
+            indexdata = indices.data;
+            indextype = static_cast<GLenum>(indices.componenttype);
+        }
+    } else {
+        if (position.count % 3 != 0) {
+            std::cerr << "readGLB(\"" << filename << "\"): not a valid triangle list\n";
+            return false;
+        }
+        indexcount = position.count;
+        sequentialindices.resize(indexcount);
+        for (size_t i = 0; i < indexcount; i++) {
+            sequentialindices[i] = static_cast<GLuint>(i);
+        }
+        indexdata = sequentialindices.data();
+    }
+    const size_t indexbytes = indexcount * ((indextype == GL_UNSIGNED_SHORT) ? 2 : 4);
+
+    // The parts of the buffer views that the attributes cover, at multiples of 16 bytes
+    struct ViewRange {
+        int view;
+        const unsigned char* begin;
+        const unsigned char* end;
+        size_t offset;  // In the vertex range
+    };
+    std::vector<ViewRange> ranges;
+    for (int a = 0; a < 3; a++) {
+        if ((found & (1u << a)) == 0) {
+            continue;
+        }
+        const GLBFile::Accessor& accessor = attributes[a];
+        const unsigned char* begin = accessor.data;
+        const unsigned char* end = begin + (accessor.count - 1) * accessor.stride +
+                                   accessor.elementSize();
+        auto range = std::find_if(ranges.begin(), ranges.end(),
+                                  [&](const ViewRange& r) { return r.view == accessor.view; });
+        if (range == ranges.end()) {
+            ranges.push_back(ViewRange{accessor.view, begin, end, 0});
+        } else {
+            range->begin = std::min(range->begin, begin);
+            range->end = std::max(range->end, end);
+        }
+    }
+    size_t vertexbytes = 0;
+    for (ViewRange& range : ranges) {
+        range.offset = vertexbytes;
+        vertexbytes = (vertexbytes + size_t(range.end - range.begin) + 15) & ~size_t(15);
+    }
+
+    BufferPool& pool = BufferPool::global();
+    vertexbuffer_ = pool.allocate(vertexbytes);
+    indexbuffer_ = pool.allocate(indexbytes);
+    if (!vertexbuffer_ || !indexbuffer_) {
+        std::cerr << "readGLB(\"" << filename << "\"): out of buffer memory\n";
+        clean();
+        return false;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vertexbuffer_.buffer);
+    for (const ViewRange& range : ranges) {
+        glBufferSubData(GL_COPY_WRITE_BUFFER, vertexbuffer_.offset + range.offset,
+                        range.end - range.begin, range.begin);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, indexbuffer_.buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, indexbuffer_.offset, indexbytes, indexdata);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glGenVertexArrays(1, &vao_);
+    glstate::bindVertexArray(vao_);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer_.buffer);
+    for (int a = 0; a < 3; a++) {
+        if ((found & (1u << a)) == 0) {
+            glDisableVertexAttribArray(a);
+            continue;
+        }
+        const GLBFile::Accessor& accessor = attributes[a];
+        const ViewRange& range = *std::find_if(
+            ranges.begin(), ranges.end(),
+            [&](const ViewRange& r) { return r.view == accessor.view; });
+        const size_t offset =
+            vertexbuffer_.offset + range.offset + size_t(accessor.data - range.begin);
+        glEnableVertexAttribArray(a);
+        glVertexAttribPointer(a, accessor.components, static_cast<GLenum>(accessor.componenttype),
+                              accessor.normalized ? GL_TRUE : GL_FALSE,
+                              static_cast<GLsizei>(accessor.stride), (void*)offset);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer_.buffer);
+    glstate::bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    applyLabel();
+
+    nverts_ = static_cast<int>(position.count);
+    ntris_ = static_cast<int>(indexcount / 3);
+    indextype_ = indextype;
+    vertexstreamed_ = false;
+    gltfattributes_ = found;
+    file.meshTransform(mesh, positionoffset_, positionscale_);
+
+    // The bounds of the accessor, or of the positions if the file has none, as vertex.glsl
+    // decodes them
+    float low[3], high[3];
+    for (int c = 0; c < 3; c++) {
+        low[c] = position.min[c];
+        high[c] = position.max[c];
+    }
+    if (!position.hasbounds) {
+        for (int c = 0; c < 3; c++) {
+            low[c] = high[c] = position.get(0, c);
+        }
+        for (size_t i = 1; i < position.count; i++) {
+            for (int c = 0; c < 3; c++) {
+                low[c] = std::min(low[c], position.get(i, c));
+                high[c] = std::max(high[c], position.get(i, c));
+            }
+        }
+    }
+    float radius2 = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        const float a = positionscale_[c] * low[c] + positionoffset_[c];
+        const float b = positionscale_[c] * high[c] + positionoffset_[c];
+        bounds_.min[c] = std::min(a, b);
+        bounds_.max[c] = std::max(a, b);
+        bounds_.center[c] = 0.5f * (a + b);
+        radius2 += 0.25f * (b - a) * (b - a);
+    }
+    bounds_.radius = std::sqrt(radius2);
+
+    // Only a mesh for picking keeps anything on the CPU, decoded from the file
+    if (retention_ == Retention::Picking) {
+        positions_.resize(3 * position.count);
+        for (size_t i = 0; i < position.count; i++) {
+            for (int c = 0; c < 3; c++) {
+                positions_[3 * i + c] = positionscale_[c] * position.get(i, c) +
+                                        positionoffset_[c];
+            }
+        }
+        if (indextype == GL_UNSIGNED_SHORT) {
+            const GLushort* shorts = static_cast<const GLushort*>(indexdata);
+            indexarray_.assign(shorts, shorts + indexcount);
+        } else {
+            const GLuint* longs = static_cast<const GLuint*>(indexdata);
+            indexarray_.assign(longs, longs + indexcount);
+        }
+        buildRayTree(positions_.data(), 3);
+    }
+
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - starttime).count();
+    printf("readGLB(\"%s\"): %d vertices, %d triangles in %.2f ms\n", filename.c_str(), nverts_,
+           ntris_, 1000.0 * seconds);
+    return true;
+}
+
+/* Choose the vertex format on the GPU, and upload existing geometry again in that format */
+void TriangleSoup::setVertexFormat(VertexFormat format) {
+    if ((format != vertexformat_ || vertexstreamed_) && !vertexarray_.empty()) {
+        vertexformat_ = format;
+        upload();
+    }
+    vertexformat_ = format;
+    for (TriangleSoup& lod : lods_) {
+        lod.setVertexFormat(format);
+    }
+}
+
+TriangleSoup::VertexFormat TriangleSoup::vertexFormat() const { return vertexformat_; }
+
+/* Choose the order of the vertex data on the GPU, and upload existing geometry again */
+void TriangleSoup::setVertexLayout(VertexLayout layout) {
+    if ((layout != vertexlayout_ || vertexstreamed_) && !vertexarray_.empty()) {
+        vertexlayout_ = layout;
+        upload();
+    }
+    vertexlayout_ = layout;
+    for (TriangleSoup& lod : lods_) {
+        lod.setVertexLayout(layout);
+    }
+}
+
+TriangleSoup::VertexLayout TriangleSoup::vertexLayout() const { return vertexlayout_; }
+
+void TriangleSoup::setRetention(Retention retention) {
+    retention_ = retention;
+    applyRetention();
+    for (TriangleSoup& lod : lods_) {
+        lod.setRetention(retention);
+    }
+}
+
+TriangleSoup::Retention TriangleSoup::retention() const { return retention_; }
+
+void TriangleSoup::setRayQueries(bool enabled) {
+    if (!enabled) {
+        raytree_.reset();
+    } else if (!raytree_) {
+        raytree_ = std::make_unique<TriangleBVH>();
+        if (positions() != nullptr) {
+            buildRayTree(positions(), positionStride());
+        }
+    }
+}
+
+const TriangleBVH* TriangleSoup::rayTree() const { return raytree_.get(); }
+
+int TriangleSoup::intersect(const float origin[3], const float direction[3],
+                            float* distance) const {
+    TriangleBVH::Hit hit;
+    if (!raytree_ || !raytree_->intersect(origin, direction, hit)) {
+        return -1;
+    }
+    if (distance) {
+        *distance = hit.distance;
+    }
+    return hit.triangle;
+}
+
+/* Build the ray tree from positions that the retention may drop after this call */
+void TriangleSoup::buildRayTree(const GLfloat* positions, int stride) {
+    if (raytree_) {
+        TRACE_SCOPE("build ray tree");
+        raytree_->build(positions, stride, size_t(nverts_), indexarray_, &ThreadPool::global());
+    }
+}
+
+const std::vector<GLfloat>& TriangleSoup::vertices() const { return vertexarray_; }
+
+const std::vector<GLuint>& TriangleSoup::indices() const { return indexarray_; }
+
+const GLfloat* TriangleSoup::positions() const {
+    if (!vertexarray_.empty()) {
+        return vertexarray_.data();
+    }
+    return positions_.empty() ? nullptr : positions_.data();
+}
+
+int TriangleSoup::positionStride() const {
+    if (!vertexarray_.empty()) {
+        return 8;
+    }
+    return positions_.empty() ? 0 : 3;
+}
+
+const mesh::Bounds& TriangleSoup::bounds() const { return bounds_; }
+
+/* Reorder triangles and vertices to make the mesh faster to render */
+void TriangleSoup::optimize(bool overdraw) {
+    if (vertexarray_.empty() || indexarray_.empty()) {
+        std::cerr << "optimize(): the mesh has no CPU side data\n";
+        return;
+    }
+
+    const int cachesize = 16;  // A conservative estimate for current GPUs
+    const mesh::CacheStats before = mesh::analyzeVertexCache(indexarray_, nverts_, cachesize);
+
+    std::vector<int> clusters;
+    indexarray_ =
+        mesh::optimizeVertexCache(indexarray_, nverts_, cachesize, overdraw ? &clusters : nullptr);
+    if (overdraw) {
+        indexarray_ = mesh::optimizeOverdraw(indexarray_, vertexarray_, 8, clusters);
+    }
+    mesh::optimizeVertexFetch(vertexarray_, 8, indexarray_);
+
+    // Keep the statistics of the first optimization, later calls do not change the original
+    if (unoptimizedacmr_ == 0.0f) {
+        unoptimizedacmr_ = static_cast<float>(before.acmr);
+        unoptimizedatvr_ = static_cast<float>(before.atvr);
+    }
+
+    // The meshlets refer to the old triangle order
+    meshlets_.clear();
+
+    // Send the reordered arrays to OpenGL
+    upload();
+}
+
+/* Split the mesh into meshlets that can be culled separately */
+void TriangleSoup::buildMeshlets(int maxvertices, int maxtriangles) {
+    if (vertexarray_.empty() || indexarray_.empty()) {
+        std::cerr << "buildMeshlets(): the mesh has no CPU side data\n";
+        return;
+    }
+    meshlets_ = mesh::buildMeshlets(indexarray_, vertexarray_, 8, maxvertices, maxtriangles);
+    // Send the reordered indices to OpenGL
+    upload();
+}
+
+const std::vector<mesh::Meshlet>& TriangleSoup::meshlets() const { return meshlets_; }
+
+/* Render the meshlets inside the view frustum that face the eye */
+int TriangleSoup::renderMeshlets(const Mat4& P, const GLfloat* matrix) {
+    if (meshlets_.empty()) {
+        render();
+        return 0;
+    }
+    // The frustum and the eye in the coordinates of the vertices
+    Mat4 MV;
+    std::copy_n(matrix, 16, MV.m);
+    const Frustum frustum = Frustum::fromMatrix(P * MV);
+    const Mat4 inverse = affineInverse(MV);
+    const float* eye = &inverse.m[12];
+
+    // Consecutive visible meshlets are merged into one range of indices
+    const size_t indexsize = (indextype_ == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+    meshletcounts_.clear();
+    meshletoffsets_.clear();
+    GLuint end = ~GLuint(0);
+    int drawn = 0;
+    for (const mesh::Meshlet& meshlet : meshlets_) {
+        if (!frustum.intersectsSphere(meshlet.center, meshlet.radius) ||
+            mesh::meshletBackfacing(meshlet, eye)) {
+            continue;
+        }
+        if (meshlet.firstindex == end) {
+            meshletcounts_.back() += static_cast<GLsizei>(meshlet.numindices);
+        } else {
+            meshletcounts_.push_back(static_cast<GLsizei>(meshlet.numindices));
+            meshletoffsets_.push_back(
+                (const void*)(indexbuffer_.offset + meshlet.firstindex * indexsize));
+        }
+        end = meshlet.firstindex + meshlet.numindices;
+        drawn++;
+    }
+    if (drawn > 0) {
+        bindForDrawing();
+        glMultiDrawElements(GL_TRIANGLES, meshletcounts_.data(), indextype_,
+                            meshletoffsets_.data(), static_cast<GLsizei>(meshletcounts_.size()));
+        glstate::bindVertexArray(0);
+        drawcounts.draws++;
+        for (GLsizei count : meshletcounts_) {
+            drawcounts.triangles += count / 3;
+        }
+    }
+    return drawn;
+}
+
+/* Create coarser versions of the mesh for rendering at a distance */
+void TriangleSoup::generateLODs(int levels, float ratio) {
+    lods_.clear();
+    loderrors_.assign(1, 0.0f);
+    if (vertexarray_.empty() || indexarray_.empty()) {
+        std::cerr << "generateLODs(): the mesh has no CPU side data\n";
+        return;
+    }
+    ratio = std::clamp(ratio, 0.01f, 0.9f);
+
+    lods_.reserve(static_cast<size_t>(std::max(levels, 0)));
+    int previous = ntris_;
+    int segments = spheresegments_;
+    for (int level = 1; level <= levels; level++) {
+        TriangleSoup lod;
+        lod.vertexformat_ = vertexformat_;
+        lod.vertexlayout_ = vertexlayout_;
+        lod.retention_ = retention_;
+        float error = 0.0f;
+        if (spheresegments_ > 0) {
+            // The triangles grow with the square of the segments. The error is the largest
+            // distance from a flat triangle to the sphere, from the angle each one spans.
+            const int fewer = static_cast<int>(std::lround(double(segments) * std::sqrt(ratio)));
+            if (fewer < 2 || fewer >= segments) {
+                break;
+            }
+            segments = fewer;
+            lod.createSphere(sphereradius_, segments);
+            error = sphereradius_ * static_cast<float>(1.0 - std::cos(M_PI / (2 * segments)));
+        } else {
+            // Each level is simplified from the one before, which is faster than starting
+            // from the full mesh. The errors add up, so the sum bounds the distance.
+            const TriangleSoup& finer = (level == 1) ? *this : lods_.back();
+            const size_t target = 3 * static_cast<size_t>(float(previous) * ratio);
+            lod.indexarray_ =
+                mesh::simplify(finer.indexarray_, finer.vertexarray_, 8, target, &error);
+            error += loderrors_.back();
+            const size_t numindices = lod.indexarray_.size();
+            if (numindices == 0 || 10 * numindices > 27 * size_t(previous)) {
+                break;
+            }
+            // Keep only the vertices that are still used
+            lod.vertexarray_ = finer.vertexarray_;
+            lod.indexarray_ = mesh::optimizeVertexCache(lod.indexarray_, finer.nverts_);
+            mesh::optimizeVertexFetch(lod.vertexarray_, 8, lod.indexarray_);
+            const GLuint used =
+                1 + *std::max_element(lod.indexarray_.begin(), lod.indexarray_.end());
+            lod.vertexarray_.resize(8 * size_t(used));
+            lod.nverts_ = static_cast<int>(used);
+            lod.ntris_ = static_cast<int>(lod.indexarray_.size() / 3);
+            lod.upload();
+        }
+        previous = lod.ntris_;
+        lods_.push_back(std::move(lod));
+        loderrors_.push_back(error);
+    }
+}
+
+int TriangleSoup::lodCount() const { return 1 + static_cast<int>(lods_.size()); }
+
+TriangleSoup& TriangleSoup::lod(int level) {
+    if (level <= 0 || lods_.empty()) {
+        return *this;
+    }
+    return lods_[std::min(level, lodCount() - 1) - 1];
+}
+
+float TriangleSoup::lodError(int level) const {
+    if (level <= 0 || lods_.empty()) {
+        return 0.0f;
+    }
+    return loderrors_[std::min(level, lodCount() - 1)];
+}
+
+void TriangleSoup::setLODSelection(float pixelerror, int trianglebudget) {
+    lodpixelerror_ = std::max(pixelerror, 0.0f);
+    lodbudget_ = std::max(trianglebudget, 0);
+}
+
+/* Choose the coarsest level of each instance whose error is small enough on the screen */
+int TriangleSoup::selectLODs(const Mat4& P, const GLfloat* matrices, int count,
+                             int viewportheight, int* levels) const {
+    // Pixels per unit of the vertices at the nearest point of each bounding sphere.
+    // P.m[5] is the vertical scale of the projection, and P.m[11] is zero if it is
+    // orthographic, when the distance does not matter.
+    const bool perspective = (P.m[11] != 0.0f);
+    const float pixelsperunit = 0.5f * static_cast<float>(viewportheight) * std::fabs(P.m[5]);
+    std::vector<float> scales(count);
+    for (int i = 0; i < count; i++) {
+        const GLfloat* m = matrices + 16 * size_t(i);
+        float scale2 = 0.0f;
+        for (int column = 0; column < 3; column++) {
+            const GLfloat* c = m + 4 * column;
+            scale2 = std::max(scale2, c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+        }
+        const float scale = std::sqrt(scale2);
+        const float z = m[2] * bounds_.center[0] + m[6] * bounds_.center[1] +
+                        m[10] * bounds_.center[2] + m[14];
+        const float distance = -z - bounds_.radius * scale;
+        if (perspective && distance <= 0.0f) {
+            scales[i] = -1.0f;  // Close enough to always use the full mesh
+        } else {
+            scales[i] = scale * pixelsperunit / (perspective ? distance : 1.0f);
+        }
+    }
+
+    float pixelerror = lodpixelerror_;
+    int triangles = 0;
+    for (int attempt = 0; attempt < 24; attempt++) {
+        triangles = 0;
+        for (int i = 0; i < count; i++) {
+            int level = 0;
+            if (scales[i] >= 0.0f) {
+                while (level + 1 < lodCount() &&
+                       loderrors_[level + 1] * scales[i] <= pixelerror) {
+                    level++;
+                }
+            }
+            levels[i] = level;
+            triangles += (level == 0) ? ntris_ : lods_[level - 1].ntris_;
+        }
+        if (lodbudget_ == 0 || triangles <= lodbudget_) {
+            break;
+        }
+        pixelerror = std::max(2.0f * pixelerror, 1.0f);
+    }
+    return triangles;
+}
+
+int TriangleSoup::selectLOD(const Mat4& P, const GLfloat* matrix, int viewportheight) const {
+    int level = 0;
+    selectLODs(P, matrix, 1, viewportheight, &level);
+    return level;
+}
+
+/* Render the level of detail that suits the size of the mesh on the screen */
+void TriangleSoup::renderLOD(const Mat4& P, const GLfloat* matrix) {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    // Counted for this mesh, whichever level draws
+    const bool measured = beginStatistics(false);
+    lod(selectLOD(P, matrix, viewport[3])).render();
+    endStatistics(measured);
+}
+
+/* The same level as renderLOD(), for a depth pass */
+void TriangleSoup::renderLODDepth(const Mat4& P, const GLfloat* matrix) {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const bool measured = beginStatistics(true);
+    lod(selectLOD(P, matrix, viewport[3])).renderDepth();
+    endStatistics(measured);
+}
+
+/* Render instances grouped by level of detail, one instanced draw call per level */
+int TriangleSoup::renderInstancedLOD(const Mat4& P, const GLfloat* matrices, int count) {
+    if (count <= 0) {
+        return 0;
+    }
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    std::vector<int> levels(count);
+    const int triangles = selectLODs(P, matrices, count, viewport[3], levels.data());
+
+    // Counting sort of the matrices by level
+    std::vector<int> start(lodCount() + 1, 0);
+    for (int level : levels) {
+        start[level + 1]++;
+    }
+    for (int level = 0; level < lodCount(); level++) {
+        start[level + 1] += start[level];
+    }
+    std::vector<GLfloat> sorted(16 * size_t(count));
+    std::vector<int> fill(start.begin(), start.end() - 1);
+    for (int i = 0; i < count; i++) {
+        std::copy_n(matrices + 16 * size_t(i), 16, &sorted[16 * size_t(fill[levels[i]]++)]);
+    }
+
+    const bool measured = beginStatistics(false);
+    for (int level = 0; level < lodCount(); level++) {
+        const int instances = start[level + 1] - start[level];
+        if (instances > 0) {
+            TriangleSoup& mesh = lod(level);
+            mesh.setInstanceTransforms(&sorted[16 * size_t(start[level])], instances);
+            mesh.renderInstanced(instances);
+        }
+    }
+    endStatistics(measured);
+    return triangles;
+}
+
+TriangleSoup::DrawCounts TriangleSoup::drawCounts() { return drawcounts; }
+
+void TriangleSoup::resetDrawCounts() { drawcounts = DrawCounts(); }
+
+void TriangleSoup::setViewInstances(int views) { viewinstances = std::max(views, 1); }
+
+int TriangleSoup::viewInstances() { return viewinstances; }
+
+/* Print data from a TriangleSoup object, for debugging purposes */
+void TriangleSoup::print() {
+    const GLfloat* position = positions();
+    if ((position == nullptr || indexarray_.empty()) && nverts_ > 0) {
+        printf("TriangleSoup data is only stored on the GPU (%d vertices, %d triangles)\n",
+               nverts_, ntris_);
+        return;
+    }
+    const int stride = positionStride();
+    printf("TriangleSoup vertex data:\n\n");
+    for (int i = 0; i < nverts_; i++) {
+        const GLfloat* p = position + size_t(stride) * size_t(i);
+        printf("%d: %8.2f %8.2f %8.2f\n", i, p[0], p[1], p[2]);
+    }
+    printf("\nTriangleSoup face index data:\n\n");
+    for (int i = 0; i < ntris_; i++) {
+        printf("%d: %d %d %d\n", i, indexarray_[3 * i], indexarray_[3 * i + 1],
+               indexarray_[3 * i + 2]);
+    }
+}
+
+/* Print information about a TriangleSoup object (stats and extents) */
+void TriangleSoup::printInfo() {
+    printf("TriangleSoup information:\n");
+    printf("vertices : %d\n", nverts_);
+    printf("triangles: %d\n", ntris_);
+    printf("indices  : %d bit\n", (indextype_ == GL_UNSIGNED_SHORT) ? 16 : 32);
+    if (nunweldedverts_ > 0) {
+        printf("welded   : %d -> %d vertices (%.2f:1 reduction)\n", nunweldedverts_, nverts_,
+               (nverts_ > 0) ? static_cast<double>(nunweldedverts_) / nverts_ : 0.0);
+    }
+    printf("xmin: %8.2f\n", bounds_.min[0]);
+    printf("xmax: %8.2f\n", bounds_.max[0]);
+    printf("ymin: %8.2f\n", bounds_.min[1]);
+    printf("ymax: %8.2f\n", bounds_.max[1]);
+    printf("zmin: %8.2f\n", bounds_.min[2]);
+    printf("zmax: %8.2f\n", bounds_.max[2]);
+    printf("radius: %6.2f\n", bounds_.radius);
+    const size_t cpubytes = (vertexarray_.size() + positions_.size()) * sizeof(GLfloat) +
+                            indexarray_.size() * sizeof(GLuint);
+    const char* kept = !vertexarray_.empty() ? "vertices and indices"
+                       : !positions_.empty() ? "positions and indices"
+                       : !indexarray_.empty() ? "indices"
+                                              : "nothing";
+    printf("CPU data : %s (%.1f kB)\n", kept, static_cast<double>(cpubytes) / 1024.0);
+    if (raytree_ && !raytree_->empty()) {
+        printf("ray tree : %d nodes (%.1f kB), built in %.2f ms\n", raytree_->nodeCount(),
+               static_cast<double>(raytree_->memoryBytes()) / 1024.0, raytree_->buildTime());
+    }
+    if (!meshlets_.empty()) {
+        printf("meshlets : %zu, %.1f triangles each\n", meshlets_.size(),
+               static_cast<double>(ntris_) / static_cast<double>(meshlets_.size()));
+    }
+    for (size_t level = 0; level < lods_.size(); level++) {
+        printf("LOD %zu    : %d triangles, error %.4g\n", level + 1, lods_[level].ntris_,
+               loderrors_[level + 1]);
+    }
+    if (indexarray_.empty()) {
+        printf("(data is only stored on the GPU, no cache statistics available)\n");
+        return;
+    }
+    const mesh::CacheStats cache = mesh::analyzeVertexCache(indexarray_, nverts_);
+    if (unoptimizedacmr_ > 0.0f) {
+        printf("ACMR     : %.3f -> %.3f (optimized)\n", unoptimizedacmr_, cache.acmr);
+        printf("ATVR     : %.3f -> %.3f (optimized)\n", unoptimizedatvr_, cache.atvr);
+    } else {
+        printf("ACMR     : %.3f\n", cache.acmr);
+        printf("ATVR     : %.3f\n", cache.atvr);
+    }
+}
+
+void TriangleSoup::setLabel(const std::string& label) {
+    label_ = label;
+    applyLabel();
+}
+
+void TriangleSoup::applyLabel() {
+    if (label_.empty() || !gldebug::enabled()) {
+        return;
+    }
+    gldebug::label(GL_VERTEX_ARRAY, vao_, label_);
+    gldebug::label(GL_VERTEX_ARRAY, depthvao_, label_ + " (depth)");
+    gldebug::label(GL_VERTEX_ARRAY, skinnedvao_, label_ + " (skinned)");
+    gldebug::label(GL_BUFFER, instancebuffer_, label_ + " instances");
+    gldebug::label(GL_BUFFER, skinbuffer_, label_ + " skin");
+}
+
+/* Bind the VAO and set the constant attributes that tell the shader the vertex format */
+void TriangleSoup::bindForDrawing(bool depth, bool ownvertices) {
+    if (skinnedvao_ != 0 && !ownvertices) {
+        // Float vertices, the same for a depth pass
+        glstate::bindVertexArray(skinnedvao_);
+        glVertexAttrib4f(3, 1.0f, 1.0f, 1.0f, 0.0f);
+        glVertexAttrib3f(4, 0.0f, 0.0f, 0.0f);
+        return;
+    }
+    glstate::bindVertexArray((depth && depthvao_ != 0) ? depthvao_ : vao_);
+    // Tell vertex.glsl how to decode the vertex format. These attributes are not read
+    // from a buffer, so the values set here are used for all vertices.
+    const bool octahedral = (vertexformat_ != VertexFormat::Float && gltfattributes_ == 0);
+    glVertexAttrib4f(3, positionscale_[0], positionscale_[1], positionscale_[2],
+                     octahedral ? 1.0f : 0.0f);
+    glVertexAttrib3f(4, positionoffset_[0], positionoffset_[1], positionoffset_[2]);
+    // The attributes that a glTF file does not have, facing +z at the origin of the texture
+    if (gltfattributes_ != 0 && (gltfattributes_ & 2) == 0) {
+        glVertexAttrib4f(1, 0.0f, 0.0f, 1.0f, 0.0f);
+    }
+    if (gltfattributes_ != 0 && (gltfattributes_ & 4) == 0) {
+        glVertexAttrib2f(2, 0.0f, 0.0f);
+    }
+}
+
+/* Render the geometry in a TriangleSoup object */
 void TriangleSoup::render() {
-    glBindVertexArray(vao_);
-    glDrawElements(GL_TRIANGLES, 3 * ntris_, GL_UNSIGNED_INT, (void*)0);
-    // (mode, vertex count, type, element array buffer offset)
-    glBindVertexArray(0);
+    const bool measured = beginStatistics(false);
+    bindForDrawing();
+    if (viewinstances > 1) {
+        glDrawElementsInstanced(GL_TRIANGLES, 3 * ntris_, indextype_,
+                                (void*)indexbuffer_.offset, viewinstances);
+    } else {
+        glDrawElements(GL_TRIANGLES, 3 * ntris_, indextype_, (void*)indexbuffer_.offset);
+        // (mode, vertex count, type, element array buffer offset)
+    }
+    glstate::bindVertexArray(0);
+    drawcounts.draws++;
+    drawcounts.triangles += static_cast<long long>(ntris_) * viewinstances;
+    endStatistics(measured);
+}
+
+/* Render only the positions, for depth passes */
+void TriangleSoup::renderDepth() {
+    const bool measured = beginStatistics(true);
+    bindForDrawing(true);
+    if (viewinstances > 1) {
+        glDrawElementsInstanced(GL_TRIANGLES, 3 * ntris_, indextype_,
+                                (void*)indexbuffer_.offset, viewinstances);
+    } else {
+        glDrawElements(GL_TRIANGLES, 3 * ntris_, indextype_, (void*)indexbuffer_.offset);
+    }
+    glstate::bindVertexArray(0);
+    drawcounts.draws++;
+    drawcounts.triangles += static_cast<long long>(ntris_) * viewinstances;
+    endStatistics(measured);
+}
+
+/* Count the work of a draw for the label of the mesh, when PipelineStatistics counts meshes */
+bool TriangleSoup::beginStatistics(bool depth) const {
+    PipelineStatistics& statistics = PipelineStatistics::global();
+    if (statistics.mode() != PipelineStatistics::Mode::Meshes) {
+        return false;
+    }
+    const std::string& label = label_.empty() ? std::string("mesh") : label_;
+    statistics.begin(PipelineStatistics::Mode::Meshes, depth ? label + " (depth)" : label);
+    return true;
+}
+
+void TriangleSoup::endStatistics(bool measured) const {
+    if (measured) {
+        PipelineStatistics::global().end(PipelineStatistics::Mode::Meshes);
+    }
+}
+
+/* Read the vertices from a streaming buffer instead of the static vertex buffer */
+void TriangleSoup::setVertexStream(const StreamBuffer& stream, ptrdiff_t offset) {
+    if (vao_ == 0 || offset < 0) {
+        std::cerr << "setVertexStream(): no geometry, or no room in the stream buffer\n";
+        return;
+    }
+    setVertexPointers(vao_, stream.id(), VertexFormat::Float, VertexLayout::Interleaved,
+                      size_t(offset));
+    if (depthvao_ != 0) {
+        setVertexPointers(depthvao_, stream.id(), VertexFormat::Float,
+                          VertexLayout::Interleaved, size_t(offset), true);
+    }
+    glstate::bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    vertexformat_ = VertexFormat::Float;
+    vertexstreamed_ = true;
+    gltfattributes_ = 0;
+    for (int c = 0; c < 3; c++) {
+        positionscale_[c] = 1.0f;
+        positionoffset_[c] = 0.0f;
+    }
+}
+
+/* Set the instance matrix attributes of the bound VAO */
+void TriangleSoup::setInstancePointers() {
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer_);
+    // A mat4 attribute uses four consecutive locations, one per column.
+    // The divisor 1 advances the attribute once per instance instead of once per vertex.
+    for (int column = 0; column < 4; column++) {
+        const GLuint location = 5 + column;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat),
+                              (void*)(4 * column * sizeof(GLfloat)));
+        glVertexAttribDivisor(location, 1);
+    }
+}
+
+/* Set the bone attributes of the bound VAO: the indices as integers, the weights in [0, 1] */
+void TriangleSoup::setSkinPointers() {
+    glBindBuffer(GL_ARRAY_BUFFER, skinbuffer_);
+    glEnableVertexAttribArray(9);
+    glVertexAttribIPointer(9, 4, GL_UNSIGNED_BYTE, 8, nullptr);
+    glEnableVertexAttribArray(10);
+    glVertexAttribPointer(10, 4, GL_UNSIGNED_BYTE, GL_TRUE, 8, (void*)4);
+}
+
+/* Upload the bones and weights of every vertex, 8 bytes per vertex */
+void TriangleSoup::setSkin(const GLubyte* bones, const GLfloat* weights) {
+    if (vao_ == 0) {
+        std::cerr << "setSkin(): no geometry to skin\n";
+        return;
+    }
+    std::vector<GLubyte> skin(8 * size_t(nverts_));
+    for (size_t i = 0; i < size_t(nverts_); i++) {
+        const GLfloat* w = &weights[4 * i];
+        const float sum = w[0] + w[1] + w[2] + w[3];
+        for (size_t j = 0; j < 4; j++) {
+            skin[8 * i + j] = bones[4 * i + j];
+            const float weight = sum > 0.0f ? w[j] / sum : (j == 0 ? 1.0f : 0.0f);
+            skin[8 * i + 4 + j] = static_cast<GLubyte>(std::lrint(weight * 255.0f));
+        }
+    }
+    if (skinbuffer_ == 0) {
+        glGenBuffers(1, &skinbuffer_);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, skinbuffer_);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(skin.size()), skin.data(), GL_STATIC_DRAW);
+    gpumem::setBuffer(skinbuffer_, gpumem::Category::Mesh, skin.size());
+    applyLabel();
+    glstate::bindVertexArray(vao_);
+    setSkinPointers();
+    if (depthvao_ != 0) {
+        glstate::bindVertexArray(depthvao_);
+        setSkinPointers();
+    }
+    glstate::bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool TriangleSoup::skinned() const { return skinbuffer_ != 0; }
+
+/* Draw from another buffer of Float vertices, with a VAO of its own */
+void TriangleSoup::setSkinnedVertices(GLuint buffer) {
+    if (buffer == 0 || vao_ == 0) {
+        if (skinnedvao_ != 0) {
+            glstate::deleteVertexArrays(1, &skinnedvao_);
+            skinnedvao_ = 0;
+        }
+        return;
+    }
+    if (skinnedvao_ == 0) {
+        glGenVertexArrays(1, &skinnedvao_);
+        glstate::bindVertexArray(skinnedvao_);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer_.buffer);
+        if (instancebuffer_ != 0) {
+            setInstancePointers();
+        }
+    }
+    setVertexPointers(skinnedvao_, buffer, VertexFormat::Float, VertexLayout::Interleaved, 0);
+    applyLabel();
+    glstate::bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* Draw the vertices of the mesh as points, for transform feedback */
+void TriangleSoup::renderVertices() {
+    bindForDrawing(false, true);
+    glDrawArrays(GL_POINTS, 0, nverts_);
+    glstate::bindVertexArray(0);
+}
+
+int TriangleSoup::vertexCount() const { return nverts_; }
+
+/*
+ * Create the instance buffer and its attributes in the VAOs if needed, and make room for
+ * 'count' matrices. The buffer is left bound to GL_ARRAY_BUFFER if this returns true.
+ */
+bool TriangleSoup::bindInstanceBuffer(int count) {
+    if (vao_ == 0) {
+        std::cerr << "Instance transforms: no geometry to draw instances of\n";
+        return false;
+    }
+    const bool created = instancebuffer_ == 0;
+    if (created) {
+        glGenBuffers(1, &instancebuffer_);
+        glstate::bindVertexArray(vao_);
+        setInstancePointers();
+        if (depthvao_ != 0) {
+            glstate::bindVertexArray(depthvao_);
+            setInstancePointers();
+        }
+        if (skinnedvao_ != 0) {
+            glstate::bindVertexArray(skinnedvao_);
+            setInstancePointers();
+        }
+        glstate::bindVertexArray(0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer_);
+    if (created) {
+        applyLabel();  // The buffer is only an object once it is bound
+    }
+    if (count != ninstances_) {
+        glBufferData(GL_ARRAY_BUFFER, size_t(count) * 16 * sizeof(GLfloat), nullptr,
+                     GL_DYNAMIC_DRAW);
+        gpumem::setBuffer(instancebuffer_, gpumem::Category::Mesh,
+                          size_t(count) * 16 * sizeof(GLfloat));
+        ninstances_ = count;
+    }
+    return true;
+}
+
+/* Set the model-view matrices for instanced rendering, one matrix per instance */
+void TriangleSoup::setInstanceTransforms(const GLfloat* matrices, int count) {
+    count = std::max(count, 0);
+    if (bindInstanceBuffer(count)) {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size_t(count) * 16 * sizeof(GLfloat), matrices);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+/* Map the instance buffer, to write 'count' matrices directly into it */
+GLfloat* TriangleSoup::mapInstanceTransforms(int count) {
+    count = std::max(count, 0);
+    if (count == 0 || !bindInstanceBuffer(count)) {
+        return nullptr;
+    }
+    // The previous content is not needed, which lets the driver avoid waiting for the GPU
+    void* matrices = glMapBufferRange(GL_ARRAY_BUFFER, 0, size_t(count) * 16 * sizeof(GLfloat),
+                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return static_cast<GLfloat*>(matrices);
+}
+
+void TriangleSoup::unmapInstanceTransforms() {
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer_);
+    if (glUnmapBuffer(GL_ARRAY_BUFFER) == GL_FALSE) {
+        // The buffer content was lost (rare, e.g. on a display mode change)
+        std::cerr << "unmapInstanceTransforms(): instance data was corrupted\n";
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* Render many instances of the geometry in one draw call */
+void TriangleSoup::renderInstanced(int count) {
+    count = std::min(count, ninstances_);
+    if (count <= 0) {
+        return;
+    }
+    const bool measured = beginStatistics(false);
+    bindForDrawing();
+    glDrawElementsInstanced(GL_TRIANGLES, 3 * ntris_, indextype_, (void*)indexbuffer_.offset,
+                            count);
+    glstate::bindVertexArray(0);
+    drawcounts.draws++;
+    drawcounts.triangles += static_cast<long long>(ntris_) * count;
+    endStatistics(measured);
+}
+
+void TriangleSoup::renderInstancedDepth(int count) {
+    count = std::min(count, ninstances_);
+    if (count <= 0) {
+        return;
+    }
+    const bool measured = beginStatistics(true);
+    bindForDrawing(true);
+    glDrawElementsInstanced(GL_TRIANGLES, 3 * ntris_, indextype_, (void*)indexbuffer_.offset,
+                            count);
+    glstate::bindVertexArray(0);
+    drawcounts.draws++;
+    drawcounts.triangles += static_cast<long long>(ntris_) * count;
+    endStatistics(measured);
 }
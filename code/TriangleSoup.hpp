@@ -3,9 +3,43 @@
  *
  * Usage: The methods createXXX() create geometry from fixed arrays or procedural
  *        descriptions.
+ *        createPlane(), createCylinder(), createTorus() and createHeightfield() are built on
+ *        createGrid(), and make the same shapes as ProceduralGrid does on the GPU.
  *        The method loadOBJ() loads geometry from an OBJ file. Only the mesh is loaded. Material
- *        information is ignored. Only triangles are supported. OBJ files with quads are rejected.
+ *        information is ignored. Faces with more than three corners are triangulated, and
+ *        corners may be given as v, v/t, v//n or v/t/n, with negative indices counting back.
+ *        Missing normals are computed from the faces, and missing texture coordinates are 0.
+ *        beginOBJ() and continueOBJ() load an OBJ file a part at a time while it downloads.
+ *        The method readGLB() loads a primitive of a binary glTF file, whose vertex and index
+ *        arrays are sent to OpenGL as they are in the file, also when they are quantized.
  *        Call render() to draw the mesh in OpenGL.
+ *        To draw many copies of the mesh in one draw call, set one model-view matrix per copy
+ *        with setInstanceTransforms() and call renderInstanced() with the shader
+ *        vertex_instanced.glsl.
+ *        For depth only passes, setVertexLayout(VertexLayout::Split) stores the positions
+ *        apart from the other attributes, and renderDepth() reads only the positions.
+ *        For meshes that deform every frame, write the vertices to a StreamBuffer and point
+ *        the mesh at them with setVertexStream(). The index array stays static.
+ *        For skinned meshes, setSkin() adds bone indices and weights as vertex attributes
+ *        9 and 10, which vertex.glsl reads with the define SKINNED (see Skinning.hpp). A
+ *        SkinCache can instead skin the vertices once per frame into a buffer of its own,
+ *        which setSkinnedVertices() then draws in every pass.
+ *        generateLODs() adds coarser levels of detail: spheres are created again with fewer
+ *        segments, and other meshes are simplified with quadric error metrics. renderLOD()
+ *        and renderInstancedLOD() then choose a level per instance, the coarsest one whose
+ *        error covers at most setLODSelection() pixels on the screen, within a budget of
+ *        triangles per call. Impostor (Impostor.hpp) draws the instances that are only a few
+ *        pixels large as billboards instead, from views of the mesh baked into an atlas.
+ *        setRetention() drops the CPU copy of the vertex and index arrays after the upload,
+ *        or keeps only the positions and indices for picking.
+ *        setRayQueries() keeps a TriangleBVH of the triangles, built before the arrays are
+ *        dropped, and intersect() finds the triangle under a ray with it.
+ *        For large meshes, buildMeshlets() splits the triangles into small clusters with
+ *        their own bounds and normal cones, and renderMeshlets() skips the clusters outside
+ *        the view frustum or facing away from the eye, in one glMultiDrawElements() call.
+ *        The vertex and index arrays are ranges of the shared buffers of BufferPool::global()
+ *        instead of buffers of their own, so that loading and deleting many meshes does not
+ *        create and delete buffer objects.
  *
  * Authors: Stefan Gustavson (stegu@itn.liu.se) 2013-2014
  *          Martin Falk (martin.falk@liu.se) 2021
@@ -15,18 +49,60 @@
 #pragma once
 
 #include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstddef>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "BufferPool.hpp"
+#include "MeshProcessing.hpp"
+
+class Arena;
+class StreamBuffer;
+class TriangleBVH;
+struct Mat4;
+
 // A class to hold geometry data and send it off for rendering
 class TriangleSoup {
 public:
+    /* Formats for the vertex data on the GPU. The CPU side vertexarray_ is always float. */
+    enum class VertexFormat {
+        Float,            // Position, normal and texcoords as 8 floats (32 bytes per vertex)
+        PackedHalf,       // Half float position, octahedral normal in GL_INT_2_10_10_10_REV,
+                          // half float texcoords (16 bytes per vertex)
+        PackedQuantized,  // As PackedHalf, but the position is quantized to 16 bits per
+                          // component within the bounding box (16 bytes per vertex)
+    };
+
+    /* Order of the vertex data in the GPU buffer */
+    enum class VertexLayout {
+        Interleaved,  // Position, normal and texcoords of each vertex together
+        Split,        // The positions of all vertices, followed by the normals and texcoords
+                      // of all vertices. renderDepth() then fetches only the positions.
+    };
+
+    /* What is kept in CPU memory once the geometry is on the GPU */
+    enum class Retention {
+        Keep,     // The vertex and index arrays, for all methods that read or change them
+        Discard,  // Nothing but the bounds, the mesh only lives on the GPU
+        Picking,  // The positions, 3 floats per vertex, and the index array
+    };
+
     /* Constructor: initialize a triangleSoup object to all zeros */
     TriangleSoup();
 
     /* Destructor: clean up allocated data in a triangleSoup object */
     ~TriangleSoup();
 
+    /* Move the geometry and the GL objects to a new object, and leave 'other' empty. The
+     * GL objects are owned by one object at a time, so copies are not allowed. */
+    TriangleSoup(TriangleSoup&& other) noexcept;
+    TriangleSoup& operator=(TriangleSoup&& other) noexcept;
+
+    TriangleSoup(const TriangleSoup&) = delete;
+    TriangleSoup& operator=(const TriangleSoup&) = delete;
+
     /* Clean up allocated data in a triangleSoup object */
     void clean();
 
@@ -39,8 +115,198 @@ public:
     /* Create a sphere (approximated by polygon segments) */
     void createSphere(float radius, int segments);
 
-    /* Load geometry from an OBJ file */
-    void readOBJ(const std::string& filename);
+    /* Create a grid of columns x rows quads, for the generators below and others like them.
+     * vertex(i, j, v) is called for every vertex, with i in [0, columns] and j in
+     * [0, rows], and writes its 8 floats to v. The triangles are counterclockwise in (i, j).
+     * Large grids are generated in parallel, so 'vertex' must be thread safe. */
+    void createGrid(int columns, int rows,
+                    const std::function<void(int i, int j, GLfloat* v)>& vertex);
+
+    /* Create a plane of xsize x ysize in the xy plane, facing +z */
+    void createPlane(float xsize, float ysize, int columns = 1, int rows = 1);
+
+    /* Create an open cylinder around the z axis, without caps */
+    void createCylinder(float radius, float height, int segments, int rows = 1);
+
+    /* Create a torus around the z axis */
+    void createTorus(float majorradius, float minorradius, int majorsegments,
+                     int minorsegments);
+
+    /* Create a heightfield from width x height heights, stored row by row, covering
+     * xsize x ysize in the xy plane with z = zscale * height. The normals are estimated
+     * from the neighbouring heights. */
+    void createHeightfield(const float* heights, int width, int height, float xsize,
+                           float ysize, float zscale = 1.0f);
+
+    /* Load geometry from an OBJ file, parsed in parallel on numthreads threads.
+     * 0 uses all threads of the global thread pool, 1 parses on the calling thread only.
+     * With weld set, vertices with identical v/t/n indices are shared between faces.
+     * A file without any normals gets smooth normals from mesh::computeNormals(), with a
+     * crease angle of 60 degrees, and some vertices may be split for the creases.
+     * The temporary arrays of the parser are taken from 'arena' if given, which the caller
+     * may reset() after the call, and from an arena of the call otherwise. */
+    void readOBJ(const std::string& filename, unsigned int numthreads = 0, bool weld = false,
+                 Arena* arena = nullptr);
+
+    /* Load an OBJ file while it arrives, like a URL of the virtual file system (see
+     * VirtualFiles.hpp), so that the first faces are drawn long before the last ones are
+     * there. beginOBJ() opens the file, and each continueOBJ(), once per frame on the OpenGL
+     * thread, parses the whole lines of at most 'maxbytes' bytes that have arrived since the
+     * last call and uploads the mesh with their faces. The mesh keeps what it had until the
+     * first faces are there. The faces are not welded, and the retention applies once the
+     * whole file is loaded. continueOBJ() returns true while more of the file is to come, and
+     * false once it is all loaded, or has failed with the errors printed. */
+    void beginOBJ(const std::string& filename);
+    bool continueOBJ(size_t maxbytes = 4 << 20);
+
+    // The arrays of a mesh on the CPU, e.g. parsed by parseOBJ() on a loader thread
+    struct MeshData {
+        std::vector<GLfloat> vertices;  // 8 floats per vertex, as for vertices()
+        std::vector<GLuint> indices;
+        int unweldedverts = 0;          // Vertices before welding, zero if not welded
+    };
+
+    /* The parsing of readOBJ(), without OpenGL, for any thread. False if the file could not
+     * be read, with the errors printed. Give the data to createFromData() on the OpenGL
+     * thread. */
+    static bool parseOBJ(const std::string& filename, MeshData& data, unsigned int numthreads = 0,
+                         bool weld = false, Arena* arena = nullptr);
+
+    /* Create the mesh from parsed arrays, which are taken over */
+    void createFromData(MeshData&& data);
+
+    /* Load geometry from an OBJ file through a binary cache file, which is written
+     * after the first parse and memory mapped by later loads. With meshlets set, the parsed
+     * mesh is split with buildMeshlets(), and the meshlets are kept in the cache file.
+     * 'arena' is passed on to readOBJ(), and 'compressed' to writeBinary(). */
+    void readCachedOBJ(const std::string& filename, bool weld = false, bool meshlets = false,
+                       Arena* arena = nullptr, bool compressed = false);
+
+    /* Write the geometry to a binary mesh file. If sourcefile is given, its size and
+     * time stamp are recorded, so a stale cache file can be detected. With compressed set,
+     * the vertices and indices are coded with MeshCodec, in chunks that are decoded in
+     * parallel. Welded meshes compress best, the indices to a fraction of their size. */
+    bool writeBinary(const std::string& filename, const std::string& sourcefile = "",
+                     bool compressed = false) const;
+
+    /* Load geometry from a binary mesh file. The data is sent to OpenGL directly from the
+     * memory mapped file, or decoded into the mapped buffers if it is compressed, and is not
+     * kept in CPU memory, except for Retention::Picking. */
+    bool readBinary(const std::string& filename);
+
+    /* Load primitive 'primitive' of mesh 'mesh' of a binary glTF file (GLB). The position,
+     * normal and TEXCOORD_0 arrays and the index array are sent to OpenGL from the memory
+     * mapped file, or decoded first if they are compressed with EXT_meshopt_compression,
+     * in the formats they have in the file, which also covers the integer attributes of
+     * KHR_mesh_quantization. The translation and scaling of the node of the mesh become the
+     * decoding of the positions in vertex.glsl. The bounds come from the accessor bounds,
+     * and only Retention::Picking keeps anything on the CPU, as for readBinary(). Only
+     * triangle lists are supported. False if the file could not be loaded, with the errors
+     * printed. */
+    bool readGLB(const std::string& filename, int mesh = 0, int primitive = 0);
+
+    /* Choose the vertex format used on the GPU. Existing geometry is uploaded again. */
+    void setVertexFormat(VertexFormat format);
+
+    VertexFormat vertexFormat() const;
+
+    /* Choose the order of the vertex data on the GPU. Existing geometry is uploaded again. */
+    void setVertexLayout(VertexLayout layout);
+
+    VertexLayout vertexLayout() const;
+
+    /* Choose what is kept on the CPU after each upload to the GPU. Data that is dropped is
+     * released at once, and can not be brought back. optimize(), buildMeshlets(),
+     * generateLODs(), writeBinary() and MeshBatch need the vertex array, so call them
+     * before dropping it. The levels of detail get the same retention. */
+    void setRetention(Retention retention);
+
+    Retention retention() const;
+
+    /* Keep a TriangleBVH of the triangles for intersect(), or drop it. The tree is built at
+     * once from the positions on the CPU, if there are any, and again on the threads of
+     * ThreadPool::global() whenever the geometry is created or uploaded, before the
+     * retention drops the arrays, so it also serves meshes with Retention::Discard. The
+     * meshes of readBinary() and readGLB() only get a tree with Retention::Picking. */
+    void setRayQueries(bool enabled);
+
+    // The tree of setRayQueries(), or nullptr if it is not enabled
+    const TriangleBVH* rayTree() const;
+
+    /* The nearest triangle hit by the ray from 'origin' along 'direction', in the
+     * coordinates of the vertices, or -1 if none is or there is no tree. 'distance'
+     * receives the ray parameter of the hit. */
+    int intersect(const float origin[3], const float direction[3],
+                  float* distance = nullptr) const;
+
+    // The CPU side vertex array (8 floats per vertex: x y z nx ny nz s t) and index array.
+    // Both are empty for meshes loaded with readBinary(), which only live on the GPU, and
+    // the vertex array also for Retention::Discard and Retention::Picking.
+    const std::vector<GLfloat>& vertices() const;
+    const std::vector<GLuint>& indices() const;
+
+    // The positions kept on the CPU, x y z of every vertex with positionStride() floats
+    // from one vertex to the next: the vertex array, or the positions of Retention::Picking.
+    // nullptr and 0 if no positions are kept.
+    const GLfloat* positions() const;
+    int positionStride() const;
+
+    // Bounding box and sphere of the vertices, computed when the geometry is created.
+    // Available also for meshes loaded with readBinary().
+    const mesh::Bounds& bounds() const;
+
+    /* Reorder the triangles for post-transform vertex cache locality, and the vertices
+     * for fetch locality. With overdraw set, clusters of triangles are also sorted to
+     * reduce overdraw. The statistics before and after are shown by printInfo(). */
+    void optimize(bool overdraw = false);
+
+    /* Split the triangles into meshlets of at most 'maxvertices' vertices and
+     * 'maxtriangles' triangles, reordering the index array. Call this after optimize(),
+     * which removes the meshlets. */
+    void buildMeshlets(int maxvertices = 64, int maxtriangles = 124);
+
+    // The meshlets from buildMeshlets(), or from a binary mesh file. Empty if there are none.
+    const std::vector<mesh::Meshlet>& meshlets() const;
+
+    /* Render the meshlets that may be visible with the model-view matrix 'matrix' (16 floats)
+     * and the projection P, as render() does, with culling by the frustum and the normal
+     * cones. Renders everything if there are no meshlets. Returns the number of meshlets
+     * drawn. */
+    int renderMeshlets(const Mat4& P, const GLfloat* matrix);
+
+    /* Create up to 'levels' coarser versions of the mesh, each with about 'ratio' times the
+     * triangles of the one before. Stops early when the mesh cannot be simplified further.
+     * Call this after the geometry is complete, e.g. after optimize(). */
+    void generateLODs(int levels = 4, float ratio = 0.25f);
+
+    // Number of levels of detail, including the full mesh as level 0
+    int lodCount() const;
+
+    // The mesh of a level of detail, 0 for this mesh itself
+    TriangleSoup& lod(int level);
+
+    // Estimated distance between a level and the full mesh, in the units of the vertices
+    float lodError(int level) const;
+
+    /* Set how renderLOD() and renderInstancedLOD() choose levels: the largest error in pixels,
+     * and the most triangles to draw per call, 0 for no limit. With too many triangles, the
+     * pixel error is doubled until the instances fit, or all use the coarsest level. */
+    void setLODSelection(float pixelerror, int trianglebudget = 0);
+
+    /* The level of detail to draw with the model-view matrix 'matrix' (16 floats) and the
+     * projection P, in a viewport 'viewportheight' pixels high */
+    int selectLOD(const Mat4& P, const GLfloat* matrix, int viewportheight) const;
+
+    /* Render the level of detail chosen for the model-view matrix 'matrix' in the current
+     * viewport. The shader uniforms must be set for that matrix, as for render(). */
+    void renderLOD(const Mat4& P, const GLfloat* matrix);
+
+    // renderDepth() of the level that renderLOD() chooses, for a depth prepass
+    void renderLODDepth(const Mat4& P, const GLfloat* matrix);
+
+    /* Render 'count' instances with the model-view matrices 'matrices', with one instanced
+     * draw call per level of detail. Returns the number of triangles drawn. */
+    int renderInstancedLOD(const Mat4& P, const GLfloat* matrices, int count);
 
     /* Print data from a triangleSoup object, for debugging purposes */
     void print();
@@ -48,17 +314,160 @@ public:
     /* Print information about a triangleSoup object (stats and extents) */
     void printInfo();
 
+    /* Name the vertex arrays and buffers of the mesh in GL debug messages and debuggers
+     * (GLDebug.hpp). The loaders name a mesh after its file if it has no name yet. */
+    void setLabel(const std::string& label);
+
     /* Render the geometry in a triangleSoup object */
     void render();
 
+    /* Render the geometry for a depth only pass, such as a depth prepass or a shadow map.
+     * Only the positions are read from the vertex buffer, which saves most of the vertex
+     * fetch bandwidth with the Split layout. The other attributes have constant values. */
+    void renderDepth();
+
+    /* Read the vertices from 'stream' at 'offset', as returned by StreamBuffer::allocate(),
+     * instead of from the static vertex buffer. The stream holds the same number of vertices
+     * in the Float format, 8 floats each. Call this every frame after writing the vertices,
+     * and setVertexFormat() to go back to the static vertex buffer. */
+    void setVertexStream(const StreamBuffer& stream, ptrdiff_t offset);
+
+    /* Give every vertex up to 4 bones, 4 bone indices in 'bones' and 4 weights in
+     * 'weights' per vertex. The weights of a vertex are scaled to sum to one and stored
+     * with 8 bits each. Call this after the methods that reorder the vertices, like
+     * optimize(). The levels of detail are not skinned. */
+    void setSkin(const GLubyte* bones, const GLfloat* weights);
+
+    bool skinned() const;
+
+    /* Draw with the vertices in 'buffer', nverts Float vertices of 8 floats each at the
+     * start of it, instead of the vertex buffer of the mesh, until this is called with 0.
+     * renderVertices() still reads the vertex buffer of the mesh. A new upload() of the
+     * geometry also goes back to it. */
+    void setSkinnedVertices(GLuint buffer);
+
+    /* Draw every vertex of the vertex buffer once as a point, with the bone attributes of
+     * setSkin(), for transform feedback passes over the vertices like SkinCache */
+    void renderVertices();
+
+    int vertexCount() const;
+
+    /* Set the model-view matrices for renderInstanced(): 'count' matrices of 16 floats each in
+     * column major order, as for glUniformMatrix4fv(). They are sent to vertex attributes
+     * 5 to 8 with one matrix per instance. Call this after the geometry is created. */
+    void setInstanceTransforms(const GLfloat* matrices, int count);
+
+    /* Like setInstanceTransforms(), but return a pointer to write the 16 * count floats to,
+     * straight into the GPU buffer. Call unmapInstanceTransforms() before rendering. */
+    GLfloat* mapInstanceTransforms(int count);
+    void unmapInstanceTransforms();
+
+    /* Render 'count' instances of the geometry in one draw call. 'count' is limited to the
+     * number of matrices given to setInstanceTransforms(). */
+    void renderInstanced(int count);
+
+    /* renderDepth() for 'count' instances, as renderInstanced() */
+    void renderInstancedDepth(int count);
+
+    // Draw calls and triangles of all meshes, counted on the thread of the GL context
+    struct DrawCounts {
+        long long draws = 0;
+        long long triangles = 0;
+    };
+
+    /* The draws since the last resetDrawCounts(), e.g. once per frame for an overlay */
+    static DrawCounts drawCounts();
+    static void resetDrawCounts();
+
+    /* Draw every render() and renderDepth(), and so renderLOD(), as 'views' instances, for
+     * the MULTI_VIEW shaders of MultiView, which put instance i in view i. 1 draws once. */
+    static void setViewInstances(int views);
+    static int viewInstances();
+
 private:
+    struct OBJStream;
+
     void printError(const char* errtype, const char* errmsg);
 
+    // Create the VAO and buffers (if needed) and upload vertexarray_ and indexarray_, then
+    // drop what the retention does not keep
+    void upload();
+    void upload(const void* vertexdata, size_t vertexbytes, const void* indexdata,
+                size_t indexbytes, VertexFormat format, GLenum indextype);
+
+    // Point the attributes of 'vao' at vertices in 'buffer', only the positions if
+    // 'positiononly' is set
+    void setVertexPointers(GLuint vao, GLuint buffer, VertexFormat format, VertexLayout layout,
+                           size_t offset, bool positiononly = false);
+
+    // Point instance attributes 5 to 8 of the bound VAO at instancebuffer_
+    void setInstancePointers();
+
+    // Point the bone attributes 9 and 10 of the bound VAO at skinbuffer_
+    void setSkinPointers();
+
+    // Release the CPU side data that retention_ does not keep
+    void applyRetention();
+
+    // Build raytree_, if there is one, from the positions 'stride' floats apart and
+    // indexarray_
+    void buildRayTree(const GLfloat* positions, int stride);
+
+    // Put label_ on the GL objects of the mesh
+    void applyLabel();
+
+    /* Begin counting a draw in PipelineStatistics, true if it does; and end it if it did */
+    bool beginStatistics(bool depth) const;
+    void endStatistics(bool measured) const;
+
+    // Bind the VAO for a shading or a depth pass, and set the vertex format decoding
+    // attributes before a draw call. 'ownvertices' ignores setSkinnedVertices().
+    void bindForDrawing(bool depth = false, bool ownvertices = false);
+
+    // Create or resize the instance matrix buffer, and bind it to GL_ARRAY_BUFFER
+    bool bindInstanceBuffer(int count);
+
+    // Choose the level of detail for 'count' model-view matrices. Returns the total number
+    // of triangles.
+    int selectLODs(const Mat4& P, const GLfloat* matrices, int count, int viewportheight,
+                   int* levels) const;
+
     GLuint vao_;                        // Vertex array object, the main handle for geometry
+    GLuint depthvao_;                   // VAO with only the positions, for the Split layout
     int nverts_;                        // Number of vertices in the vertex array
     int ntris_;                         // Number of triangles in the index array (may be zero)
-    GLuint vertexbuffer_;               // Buffer ID to bind to GL_ARRAY_BUFFER
-    GLuint indexbuffer_;                // Buffer ID to bind to GL_ELEMENT_ARRAY_BUFFER
+    int nunweldedverts_;                // Number of vertices before welding (zero if not welded)
+    float unoptimizedacmr_;             // Cache miss ratio before optimize() (zero if not run)
+    float unoptimizedatvr_;             // Transformed vertex ratio before optimize()
+    BufferAllocation vertexbuffer_;     // Range of a BufferPool buffer with the vertices
+    BufferAllocation indexbuffer_;      // Range of a BufferPool buffer with the indices
+    GLenum indextype_;                  // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT in indexbuffer_
+    GLuint instancebuffer_;             // Buffer ID of the per instance model-view matrices
+    int ninstances_;                    // Number of matrices in instancebuffer_
+    GLuint skinbuffer_;                 // Bone indices and weights of setSkin(), or 0
+    GLuint skinnedvao_;                 // VAO of setSkinnedVertices(), or 0
     std::vector<GLfloat> vertexarray_;  // Vertex array on interleaved format: x y z nx ny nz s t
-    std::vector<GLuint> indexarray_;    // Element index array
+    std::vector<GLuint> indexarray_;    // Element index array (16 bit on the GPU if possible)
+    std::vector<GLfloat> positions_;    // x y z of each vertex, kept for Retention::Picking
+    Retention retention_;               // What is kept on the CPU after an upload
+    VertexFormat vertexformat_;         // Format of the vertex data in the vertex buffer
+    VertexLayout vertexlayout_;         // Order of the vertex data in the vertex buffer
+    bool vertexstreamed_;               // The vertices are read from a StreamBuffer
+    unsigned int gltfattributes_;       // Bit 1 << a for the attributes a that readGLB()
+                                        // found in the file, zero for other meshes
+    GLfloat positionscale_[3];          // Decoding of quantized positions on the GPU:
+    GLfloat positionoffset_[3];         // position = scale * stored position + offset
+    mesh::Bounds bounds_;               // Bounds of the vertices, for culling
+    float sphereradius_;                // createSphere() parameters, to create LODs again
+    int spheresegments_;                // (zero segments for other meshes)
+    std::vector<TriangleSoup> lods_;    // Levels of detail 1, 2, ...
+    std::vector<float> loderrors_;      // lodError() of each level, including level 0
+    float lodpixelerror_;               // Largest screen space error of the chosen level
+    int lodbudget_;                     // Most triangles per renderInstancedLOD(), or 0
+    std::vector<mesh::Meshlet> meshlets_;      // Clusters of consecutive triangles
+    std::vector<GLsizei> meshletcounts_;       // Index counts for renderMeshlets(), reused
+    std::vector<const void*> meshletoffsets_;  // Index buffer offsets for renderMeshlets()
+    std::unique_ptr<OBJStream> objstream_;     // The file of beginOBJ(), until it is loaded
+    std::unique_ptr<TriangleBVH> raytree_;     // Of setRayQueries(), or null
+    std::string label_;                        // Of setLabel(), kept by clean()
 };
@@ -0,0 +1,103 @@
+/*
+ * Ring buffered uniform buffer objects
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "UniformBuffers.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "GpuMemory.hpp"
+
+UniformRing::UniformRing(size_t framebytes, int numframes)
+    : framebytes_(framebytes)
+    , numframes_(std::max(numframes, 1))
+    , frame_(-1)
+    , buffer_(0)
+    , alignment_(256)
+    , fences_(numframes_, nullptr)
+    , uploaded_(0) {}
+
+UniformRing::~UniformRing() {
+    for (void* fence : fences_) {
+        if (fence) {
+            glDeleteSync(static_cast<GLsync>(fence));
+        }
+    }
+    if (glIsBuffer(buffer_)) {
+        gpumem::deleteBuffers(1, &buffer_);
+    }
+}
+
+void UniformRing::createBuffer() {
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment_);
+    alignment_ = std::max(alignment_, 1);
+    // Every region must start at a valid offset for glBindBufferRange()
+    framebytes_ = (framebytes_ + alignment_ - 1) / alignment_ * alignment_;
+    glGenBuffers(1, &buffer_);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+    glBufferData(GL_UNIFORM_BUFFER, framebytes_ * numframes_, nullptr, GL_DYNAMIC_DRAW);
+    gpumem::setBuffer(buffer_, gpumem::Category::Buffer, size_t(framebytes_) * numframes_);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    staging_.reserve(framebytes_);
+}
+
+void UniformRing::beginFrame() {
+    if (buffer_ == 0) {
+        createBuffer();
+    }
+    // The commands using the previous region have been issued; fence them
+    if (frame_ >= 0) {
+        fences_[frame_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    frame_ = (frame_ + 1) % numframes_;
+
+    // Normally the GPU finished with this region long ago, and this does not wait
+    if (fences_[frame_]) {
+        GLsync fence = static_cast<GLsync>(fences_[frame_]);
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (status == GL_TIMEOUT_EXPIRED) {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);  // 1 ms
+        }
+        glDeleteSync(fence);
+        fences_[frame_] = nullptr;
+    }
+    staging_.clear();
+    uploaded_ = 0;
+}
+
+ptrdiff_t UniformRing::push(const void* data, size_t bytes) {
+    if (frame_ < 0) {
+        beginFrame();
+    }
+    const size_t offset = (staging_.size() + alignment_ - 1) / alignment_ * alignment_;
+    if (offset + bytes > framebytes_) {
+        std::cerr << "UniformRing::push(): more than " << framebytes_
+                  << " bytes of uniform data in one frame\n";
+        return -1;
+    }
+    staging_.resize(offset + bytes);
+    const unsigned char* bytedata = static_cast<const unsigned char*>(data);
+    std::copy(bytedata, bytedata + bytes, staging_.begin() + offset);
+    return static_cast<ptrdiff_t>(frame_ * framebytes_ + offset);
+}
+
+void UniformRing::upload() {
+    if (frame_ < 0 || uploaded_ == staging_.size()) {
+        return;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer_);
+    glBufferSubData(GL_UNIFORM_BUFFER, frame_ * framebytes_ + uploaded_,
+                    staging_.size() - uploaded_, staging_.data() + uploaded_);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    uploaded_ = staging_.size();
+}
+
+void UniformRing::bind(GLuint binding, ptrdiff_t offset, size_t bytes) const {
+    if (offset >= 0) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer_, offset, bytes);
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ * Uniform buffer objects for the per frame and per object shader data.
+ *
+ * Usage: The shaders declare the uniform blocks FrameData (P, V, time) and ObjectData
+ *        (MV, R, material) with the std140 layout of FrameUniforms and ObjectUniforms below.
+ *        Shader::createShader() binds them to frameBlockBinding and objectBlockBinding.
+ *        Every frame, call UniformRing::beginFrame(), push() the frame data and the data of
+ *        all objects, and upload() everything at once. Then bind() the frame data once, and
+ *        the object data of each object before it is drawn.
+ *        The ring holds the data of several frames, so a frame never overwrites data that
+ *        the GPU may still be using for an earlier frame.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstddef>
+#include <vector>
+
+#include "Mat4.hpp"
+
+// Binding points of the uniform blocks
+constexpr GLuint frameBlockBinding = 0;
+constexpr GLuint objectBlockBinding = 1;
+constexpr GLuint textureBlockBinding = 2;   // TextureData, of TextureTable
+constexpr GLuint materialBlockBinding = 3;  // MaterialData, of MaterialTable
+constexpr GLuint viewBlockBinding = 4;      // ViewData, of MultiView
+
+// The uniform block FrameData, std140 layout
+struct FrameUniforms {
+    Mat4 P;           // Projection
+    Mat4 V;           // View transformation
+    float time;       // Seconds since the program was started
+    float unused[3];  // std140 pads the block to a multiple of 16 bytes
+};
+
+// The uniform block ObjectData, std140 layout
+struct ObjectUniforms {
+    Mat4 MV;                // Model-view transformation
+    Mat4 R;                 // Rotation, for the lab exercises
+    GLuint material = 0;    // Index in the MaterialTable
+    GLuint unused[3] = {};  // std140 pads the block to a multiple of 16 bytes
+};
+
+static_assert(sizeof(FrameUniforms) == 144, "FrameUniforms must match the std140 layout");
+static_assert(sizeof(ObjectUniforms) == 144, "ObjectUniforms must match the std140 layout");
+
+/* A uniform buffer used as a ring of one region per frame in flight */
+class UniformRing {
+public:
+    /* Constructor: 'framebytes' of uniform data per frame, for 'numframes' frames in flight */
+    explicit UniformRing(size_t framebytes = 1 << 20, int numframes = 3);
+
+    /* Destructor: delete the buffer and the fences */
+    ~UniformRing();
+
+    UniformRing(const UniformRing&) = delete;
+    UniformRing& operator=(const UniformRing&) = delete;
+
+    // Move to the next region. Waits only if the GPU is still using it, numframes frames later.
+    void beginFrame();
+
+    // Add data for this frame. Returns its offset in the buffer, for bind(), or -1 if the
+    // region for this frame is full.
+    ptrdiff_t push(const void* data, size_t bytes);
+
+    template <class T>
+    ptrdiff_t push(const T& value) {
+        return push(&value, sizeof(T));
+    }
+
+    // Send all data pushed this frame to the GPU with a single glBufferSubData()
+    void upload();
+
+    // Bind data returned by push() to a uniform block binding point
+    void bind(GLuint binding, ptrdiff_t offset, size_t bytes) const;
+
+private:
+    void createBuffer();
+
+    size_t framebytes_;                   // Size of the region of each frame
+    int numframes_;                       // Number of regions
+    int frame_;                           // Region of the current frame, -1 before the first
+    GLuint buffer_;                       // The uniform buffer
+    GLint alignment_;                     // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    std::vector<void*> fences_;           // GLsync objects, signalled when the GPU is done
+                                          // with each region
+    std::vector<unsigned char> staging_;  // Data pushed this frame
+    size_t uploaded_;                     // Bytes of staging_ already sent to the GPU
+};
@@ -10,17 +10,34 @@
 
 #include <GLFW/glfw3.h>
 #include <cstdio>
+#include <filesystem>
 #include <iostream>
+#include <unordered_map>
 
 namespace util {
 
-double displayFPS(GLFWwindow* window) {
-    static int frames = 0;
-    static double fps = 0.0;
+namespace {
+
+// The frames counted for a window since t0
+struct FPSCounter {
+    int frames = 0;
+    double fps = 0.0;
+    double t0 = -1.0;
+};
+
+}  // namespace
 
-    static double t0 = glfwGetTime();  // Gets number of seconds since glfwInit()
+double displayFPS(GLFWwindow* window) {
+    static std::unordered_map<GLFWwindow*, FPSCounter> counters;
+    FPSCounter& counter = counters[window];
+    int& frames = counter.frames;
+    double& fps = counter.fps;
+    double& t0 = counter.t0;
 
     double t = glfwGetTime();  // Get current time
+    if (t0 < 0.0) {
+        t0 = t;  // The first frame of this window
+    }
 
     // update fps only once every second
     if (t - t0 >= 1.0) {
@@ -42,4 +59,27 @@ double displayFPS(GLFWwindow* window) {
     return fps;
 }
 
+bool fileStamp(const std::string& filename, uint64_t& size, int64_t& time) {
+    std::error_code error;
+    const auto filesize = std::filesystem::file_size(filename, error);
+    if (error) {
+        return false;
+    }
+    const auto filetime = std::filesystem::last_write_time(filename, error);
+    if (error) {
+        return false;
+    }
+    size = static_cast<uint64_t>(filesize);
+    time = static_cast<int64_t>(filetime.time_since_epoch().count());
+    return true;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
 }  // namespace util
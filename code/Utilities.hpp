@@ -8,6 +8,10 @@
  */
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
 struct GLFWwindow;
 
 namespace util {
@@ -18,9 +22,23 @@ namespace util {
  * The time per frame is a better measure of performance than the
  * number of frames per second, so both are displayed.
  *
- * NOTE: This function doesn't work properly if you call it for multiple
- * windows. Call it only for one window, and only once every frame.
+ * Each window has its own count, so it can be called for several windows,
+ * once every frame for each, from the main thread like other GLFW functions.
+ * FrameProfiler (used by GLprimer.cpp) shows the same in the window title, and also
+ * keeps percentiles, GPU times and per scope times that can be read by the program.
  */
 double displayFPS(GLFWwindow* window);
 
+/*
+ * fileStamp() - Size and modification time of a file, to detect stale cache files.
+ * Returns false if the file was not found.
+ */
+bool fileStamp(const std::string& filename, uint64_t& size, int64_t& time);
+
+/*
+ * hashBytes() - 64 bit FNV-1a hash of 'size' bytes, continued from 'hash'.
+ * Used for the keys of cache files and to find files with the same contents.
+ */
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+
 }  // namespace util
@@ -0,0 +1,770 @@
+/*
+ * Files by name from local paths, URLs and mounted backends, with an HTTP/1.1 downloader
+ *
+ * This code is in the public domain.
+ */
+#include "VirtualFiles.hpp"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <utility>
+
+#include "Trace.hpp"
+#include "Utilities.hpp"
+
+namespace vfs {
+
+File::File(const std::string& name)
+    : name_(name), data_(nullptr), size_(0), available_(0), state_(Loading) {}
+
+const std::string& File::name() const { return name_; }
+
+const char* File::data() const { return data_.load(std::memory_order_acquire); }
+
+size_t File::size() const { return size_.load(std::memory_order_acquire); }
+
+size_t File::available() const { return available_.load(std::memory_order_acquire); }
+
+bool File::complete() const { return state_.load(std::memory_order_acquire) == Complete; }
+
+bool File::failed() const { return state_.load(std::memory_order_acquire) == Failed; }
+
+bool File::wait(size_t bytes) const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    arrived_.wait(lock, [&]() { return available() >= bytes || state_ != Loading; });
+    return available() >= bytes;
+}
+
+bool File::waitComplete() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    arrived_.wait(lock, [&]() { return state_ != Loading; });
+    return state_ == Complete;
+}
+
+bool File::map(const std::string& path) {
+    if (!mapped_.openLocal(path)) {
+        return false;
+    }
+    data_.store(mapped_.data(), std::memory_order_release);
+    size_.store(mapped_.size(), std::memory_order_release);
+    available_.store(mapped_.size(), std::memory_order_release);
+    finish(true);
+    return true;
+}
+
+void File::setData(const char* data, size_t size, std::shared_ptr<const void> owner) {
+    owner_ = std::move(owner);
+    data_.store(data, std::memory_order_release);
+    size_.store(size, std::memory_order_release);
+    available_.store(size, std::memory_order_release);
+    finish(true);
+}
+
+void File::reserve(size_t size) {
+    buffer_.resize(size);
+    data_.store(buffer_.data(), std::memory_order_release);
+    size_.store(size, std::memory_order_release);
+}
+
+bool File::append(const char* bytes, size_t count) {
+    const size_t offset = available();
+    if (count > buffer_.size() - offset) {
+        return false;
+    }
+    // Only the bytes after available() are written, which no reader looks at yet
+    std::memcpy(buffer_.data() + offset, bytes, count);
+    std::lock_guard<std::mutex> lock(mutex_);
+    available_.store(offset + count, std::memory_order_release);
+    arrived_.notify_all();
+    return true;
+}
+
+void File::finish(bool ok) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    state_.store((ok && available() == size()) ? Complete : Failed, std::memory_order_release);
+    arrived_.notify_all();
+}
+
+namespace {
+
+#ifdef _WIN32
+using Socket = SOCKET;
+const Socket noSocket = INVALID_SOCKET;
+void closeSocket(Socket socket) { closesocket(socket); }
+#else
+using Socket = int;
+const Socket noSocket = -1;
+void closeSocket(Socket socket) { ::close(socket); }
+#endif
+
+// Seconds that a connection may be silent before the download gives up
+const int socketTimeout = 15;
+
+// Flags of send(), so that a closed connection is an error and not a signal
+#ifdef MSG_NOSIGNAL
+const int sendFlags = MSG_NOSIGNAL;
+#else
+const int sendFlags = 0;
+#endif
+
+// A TCP connection with a read buffer, for the lines and bodies of HTTP responses
+class Connection {
+public:
+    Connection() : socket_(noSocket), begin_(0), end_(0) {}
+    ~Connection() { close(); }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    bool connect(const std::string& host, const std::string& port) {
+        close();
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+            return false;
+        }
+        for (addrinfo* a = addresses; a != nullptr && socket_ == noSocket; a = a->ai_next) {
+            const Socket s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (s == noSocket) {
+                continue;
+            }
+#ifdef _WIN32
+            const DWORD timeout = socketTimeout * 1000;
+#else
+            const timeval timeout = {socketTimeout, 0};
+#endif
+            const char* option = reinterpret_cast<const char*>(&timeout);
+            const auto optionsize = static_cast<socklen_t>(sizeof(timeout));
+            setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, option, optionsize);
+            setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, option, optionsize);
+#ifdef SO_NOSIGPIPE
+            const int nosigpipe = 1;
+            setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe, sizeof(nosigpipe));
+#endif
+            if (::connect(s, a->ai_addr, static_cast<socklen_t>(a->ai_addrlen)) == 0) {
+                socket_ = s;
+            } else {
+                closeSocket(s);
+            }
+        }
+        freeaddrinfo(addresses);
+        return socket_ != noSocket;
+    }
+
+    void close() {
+        if (socket_ != noSocket) {
+            closeSocket(socket_);
+        }
+        socket_ = noSocket;
+        begin_ = end_ = 0;
+    }
+
+    bool isOpen() const { return socket_ != noSocket; }
+
+    bool send(const std::string& text) {
+        size_t sent = 0;
+        while (sent < text.size()) {
+            const int count = static_cast<int>(std::min<size_t>(text.size() - sent, 1 << 16));
+            const auto result = ::send(socket_, text.data() + sent, count, sendFlags);
+            if (result <= 0) {
+                return false;
+            }
+            sent += static_cast<size_t>(result);
+        }
+        return true;
+    }
+
+    // Read a line into 'line', without the CR LF at its end. False at the end of the data.
+    bool readLine(std::string& line) {
+        line.clear();
+        while (line.size() < 16384) {
+            if (begin_ == end_ && !fill()) {
+                return false;
+            }
+            const char c = buffer_[begin_++];
+            if (c == '\n') {
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                return true;
+            }
+            line += c;
+        }
+        return false;
+    }
+
+    // Read up to 'count' bytes. Returns the number read, 0 at the end of the data.
+    size_t read(char* bytes, size_t count) {
+        if (begin_ == end_ && !fill()) {
+            return 0;
+        }
+        count = std::min(count, end_ - begin_);
+        std::memcpy(bytes, buffer_ + begin_, count);
+        begin_ += count;
+        return count;
+    }
+
+private:
+    bool fill() {
+        const auto count = recv(socket_, buffer_, static_cast<int>(sizeof(buffer_)), 0);
+        begin_ = 0;
+        end_ = (count > 0) ? static_cast<size_t>(count) : 0;
+        return end_ > 0;
+    }
+
+    Socket socket_;
+    char buffer_[1 << 16];
+    size_t begin_;
+    size_t end_;
+};
+
+// What the downloader needs of the status line and the headers of a response
+struct Response {
+    int status = 0;
+    long long length = -1;  // Content-Length, -1 if not given
+    bool chunked = false;   // Transfer-Encoding: chunked
+    bool close = false;     // The server closes the connection after the response
+    std::string etag;
+    long long rangefirst = -1;  // Content-Range, -1 if not given
+    long long rangetotal = -1;
+};
+
+std::string lowercase(std::string text) {
+    for (char& c : text) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return text;
+}
+
+bool readResponse(Connection& connection, Response& response) {
+    response = Response();
+    std::string line;
+    if (!connection.readLine(line) || line.compare(0, 5, "HTTP/") != 0 ||
+        line.find(' ') == std::string::npos) {
+        return false;
+    }
+    response.status = std::atoi(line.c_str() + line.find(' ') + 1);
+    response.close = line.compare(0, 8, "HTTP/1.0") == 0;
+    while (connection.readLine(line)) {
+        if (line.empty()) {
+            return true;
+        }
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        const std::string key = lowercase(line.substr(0, colon));
+        const size_t first = line.find_first_not_of(" \t", colon + 1);
+        const std::string value = (first == std::string::npos) ? "" : line.substr(first);
+        if (key == "content-length") {
+            response.length = std::atoll(value.c_str());
+        } else if (key == "transfer-encoding") {
+            response.chunked = lowercase(value).find("chunked") != std::string::npos;
+        } else if (key == "connection") {
+            response.close = lowercase(value) == "close";
+        } else if (key == "etag") {
+            response.etag = value;
+        } else if (key == "content-range") {
+            long long last;
+            if (std::sscanf(value.c_str(), "bytes %lld-%lld/%lld", &response.rangefirst, &last,
+                            &response.rangetotal) != 3 &&
+                std::sscanf(value.c_str(), "bytes */%lld", &response.rangetotal) != 1) {
+                response.rangefirst = response.rangetotal = -1;
+            }
+        }
+    }
+    return false;
+}
+
+using Sink = std::function<bool(const char*, size_t)>;
+
+// Pass 'count' bytes of the connection on to 'sink'
+bool copyBytes(Connection& connection, unsigned long long count, const Sink& sink) {
+    char block[1 << 16];
+    while (count > 0) {
+        const size_t read =
+            connection.read(block, static_cast<size_t>(std::min<unsigned long long>(
+                                       count, sizeof(block))));
+        if (read == 0 || !sink(block, read)) {
+            return false;
+        }
+        count -= read;
+    }
+    return true;
+}
+
+// Pass the body of 'response' on to 'sink', as it is sent: with a length, in chunks, or up
+// to the end of the connection
+bool readBody(Connection& connection, const Response& response, const Sink& sink) {
+    if (response.chunked) {
+        std::string line;
+        while (connection.readLine(line)) {
+            const unsigned long long size = std::strtoull(line.c_str(), nullptr, 16);
+            if (size == 0) {
+                while (connection.readLine(line) && !line.empty()) {
+                }
+                return true;
+            }
+            if (!copyBytes(connection, size, sink) || !connection.readLine(line)) {
+                return false;
+            }
+        }
+        return false;
+    }
+    if (response.length >= 0) {
+        return copyBytes(connection, static_cast<unsigned long long>(response.length), sink);
+    }
+    char block[1 << 16];
+    size_t read;
+    while ((read = connection.read(block, sizeof(block))) > 0) {
+        if (!sink(block, read)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Split "http://host[:port]/path" into the host, the port and the path, "/" if there is none
+bool parseURL(const std::string& url, std::string& host, std::string& port,
+              std::string& target) {
+    const std::string scheme = "http://";
+    if (url.compare(0, scheme.size(), scheme) != 0) {
+        return false;
+    }
+    const size_t start = scheme.size();
+    const size_t slash = std::min(url.find('/', start), url.size());
+    std::string authority = url.substr(start, slash - start);
+    target = (slash < url.size()) ? url.substr(slash) : "/";
+    port = "80";
+    const size_t bracket = authority.rfind(']');
+    const size_t colon = authority.rfind(':');
+    if (colon != std::string::npos && (bracket == std::string::npos || colon > bracket)) {
+        port = authority.substr(colon + 1);
+        authority.resize(colon);
+    }
+    if (authority.size() > 2 && authority.front() == '[' && authority.back() == ']') {
+        authority = authority.substr(1, authority.size() - 2);  // An IPv6 address
+    }
+    host = authority;
+    return !host.empty() && !port.empty() &&
+           port.find_first_not_of("0123456789") == std::string::npos;
+}
+
+std::string hexString(uint64_t value) {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(value));
+    return text;
+}
+
+// The record in the cache of a downloaded URL: the ETag of the server and the cache file
+struct CacheRecord {
+    std::string etag;
+    std::string contents;  // Name of the file in the cache directory
+};
+
+bool readRecord(const std::string& filename, const std::string& url, CacheRecord& record) {
+    std::ifstream in(filename);
+    std::string recordurl;
+    return std::getline(in, recordurl) && recordurl == url && std::getline(in, record.etag) &&
+           std::getline(in, record.contents) && !record.contents.empty();
+}
+
+void writeRecord(const std::string& filename, const std::string& url, const CacheRecord& record) {
+    std::ofstream out(filename, std::ios::trunc);
+    out << url << "\n" << record.etag << "\n" << record.contents << "\n";
+}
+
+struct Registry;
+Registry& registry();
+std::string cacheDirectory();
+
+// The loader thread of the downloads, which it makes one after the other
+class Downloader {
+public:
+    static Downloader& global() {
+        static Downloader downloader;
+        return downloader;
+    }
+
+    void add(std::shared_ptr<File> file, const std::string& url) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.emplace_back(std::move(file), url);
+        condition_.notify_one();
+    }
+
+    ~Downloader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            condition_.notify_one();
+        }
+        thread_.join();
+        for (auto& job : queue_) {
+            job.first->finish(false);
+        }
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+private:
+    Downloader() : stop_(false) {
+#ifdef _WIN32
+        WSADATA data;
+        WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+        thread_ = std::thread([this]() { loop(); });
+    }
+
+    void loop() {
+        TRACE_THREAD("downloads");
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            condition_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (stop_) {
+                return;
+            }
+            std::pair<std::shared_ptr<File>, std::string> job = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            const bool ok = download(job.first, job.second);
+            if (!job.first->complete()) {
+                job.first->finish(ok);
+            }
+            lock.lock();
+        }
+    }
+
+    bool download(const std::shared_ptr<File>& file, const std::string& url);
+
+    std::deque<std::pair<std::shared_ptr<File>, std::string>> queue_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+};
+
+/* Download 'url' into 'file' with range requests, and then into the cache. A cached copy is
+ * mapped instead when the server says that it is current, or can not be reached. */
+bool Downloader::download(const std::shared_ptr<File>& file, const std::string& url) {
+    std::string host, port, target;
+    parseURL(url, host, port, target);
+    const std::string hostheader = (port == "80") ? host : host + ":" + port;
+
+    const std::string directory = cacheDirectory();
+    const std::string key = hexString(util::hashBytes(url.data(), url.size()));
+    const std::string recordfile = directory + "/" + key + ".url";
+    CacheRecord record;
+    std::error_code error;
+    const bool cached = readRecord(recordfile, url, record) &&
+                        std::filesystem::is_regular_file(directory + "/" + record.contents,
+                                                         error);
+    auto useCache = [&](const char* reason) {
+        if (!cached || !file->map(directory + "/" + record.contents)) {
+            return false;
+        }
+        if (reason != nullptr) {
+            std::cerr << "vfs: " << reason << ", using the cached copy of '" << url << "'\n";
+        }
+        return true;
+    };
+
+    // The downloaded bytes also go to a part file in the cache, named by the URL
+    const std::string partfile = directory + "/" + key + ".part";
+    FILE* part = nullptr;
+    bool partok = false;
+    auto openPart = [&]() {
+        std::filesystem::create_directories(directory, error);
+        part = std::fopen(partfile.c_str(), "wb");
+        partok = part != nullptr;
+    };
+    const Sink sink = [&](const char* bytes, size_t count) {
+        partok = partok && std::fwrite(bytes, 1, count, part) == count;
+        return file->append(bytes, count);
+    };
+
+    Connection connection;
+    Response response;
+    std::string etag;
+    size_t total = 0;
+    bool retried = false;
+    bool done = false;
+    while (!done) {
+        if (stop_ || (file->available() > 0 && file.use_count() == 1)) {
+            break;  // Nobody reads the file any more
+        }
+        if (!connection.isOpen() && !connection.connect(host, port)) {
+            if (file->available() == 0 && useCache("the server can not be reached")) {
+                return true;
+            }
+            std::cerr << "vfs: could not connect to " << hostheader << " for '" << url << "'\n";
+            break;
+        }
+        const size_t offset = file->available();
+        std::string request = "GET " + target + " HTTP/1.1\r\nHost: " + hostheader +
+                              "\r\nRange: bytes=" + std::to_string(offset) + "-" +
+                              std::to_string(offset + rangeBytes - 1) + "\r\n";
+        if (offset == 0 && cached && !record.etag.empty()) {
+            request += "If-None-Match: " + record.etag + "\r\n";
+        }
+        if (offset > 0 && !etag.empty()) {
+            request += "If-Range: " + etag + "\r\n";  // The whole file again if it has changed
+        }
+        request += "\r\n";
+        if (!connection.send(request) || !readResponse(connection, response)) {
+            // The server may have closed a kept alive connection since the last range
+            connection.close();
+            if (!retried) {
+                retried = true;
+                continue;
+            }
+            std::cerr << "vfs: no response from " << hostheader << " for '" << url << "'\n";
+            break;
+        }
+        retried = false;
+
+        bool ok = false;
+        if (response.status == 304 && offset == 0 && useCache(nullptr)) {
+            return true;
+        } else if (response.status == 206 && response.rangefirst == static_cast<long long>(offset)
+                   && response.rangetotal >= 0) {
+            if (offset == 0) {
+                total = static_cast<size_t>(response.rangetotal);
+                etag = response.etag;
+                file->reserve(total);
+                openPart();
+            }
+            if (response.rangetotal != static_cast<long long>(total)) {
+                std::cerr << "vfs: '" << url << "' changed during the download\n";
+            } else {
+                ok = readBody(connection, response, sink);
+            }
+            done = ok && file->available() == total;
+        } else if (response.status == 416 && offset == 0 && response.rangetotal == 0) {
+            file->reserve(0);  // An empty file, which has no range
+            openPart();
+            ok = done = true;
+        } else if (response.status == 200 && offset == 0) {
+            // The server sends the whole file, and not a range
+            etag = response.etag;
+            openPart();
+            if (response.length >= 0 && !response.chunked) {
+                file->reserve(static_cast<size_t>(response.length));
+                ok = readBody(connection, response, sink);
+            } else {
+                // Without a length it can only be passed on once it is all there
+                std::vector<char> body;
+                ok = readBody(connection, response, [&](const char* bytes, size_t count) {
+                    body.insert(body.end(), bytes, bytes + count);
+                    return true;
+                });
+                file->reserve(body.size());
+                ok = ok && sink(body.data(), body.size());
+            }
+            done = ok;
+        } else if (offset == 0 && response.status >= 500 && useCache("the server failed")) {
+            return true;
+        } else if (offset > 0 && response.status == 200) {
+            std::cerr << "vfs: '" << url << "' changed during the download\n";
+        } else {
+            std::cerr << "vfs: HTTP status " << response.status << " for '" << url << "'\n";
+        }
+        if (!ok) {
+            break;
+        }
+        if (response.close) {
+            connection.close();
+        }
+    }
+
+    if (part != nullptr) {
+        partok = (std::fclose(part) == 0) && partok;
+    }
+    if (!done) {
+        std::filesystem::remove(partfile, error);
+        return false;
+    }
+
+    // The cache file is named by its contents, so that URLs with the same file share it
+    const uint64_t size = file->size();
+    record.etag = etag;
+    record.contents = hexString(util::hashBytes(file->data(), file->size(),
+                                                util::hashBytes(&size, sizeof(size))));
+    const std::string contents = directory + "/" + record.contents;
+    if (!partok) {
+        std::cerr << "vfs: could not write '" << partfile << "' to the cache\n";
+        std::filesystem::remove(partfile, error);
+    } else if (std::filesystem::exists(contents, error)) {
+        std::filesystem::remove(partfile, error);
+        writeRecord(recordfile, url, record);
+    } else {
+        std::filesystem::rename(partfile, contents, error);
+        if (!error) {
+            writeRecord(recordfile, url, record);
+        }
+    }
+    return true;
+}
+
+// Local paths after the file:// prefix
+class LocalBackend : public Backend {
+public:
+    std::shared_ptr<File> open(const std::string& name, const std::string& path) override {
+        auto file = std::make_shared<File>(name);
+        return file->map(path) ? file : nullptr;
+    }
+};
+
+// http:// URLs, downloaded in the background. A URL that is still downloading is shared.
+class HttpBackend : public Backend {
+public:
+    std::shared_ptr<File> open(const std::string& name, const std::string&) override {
+        std::string host, port, target;
+        if (!parseURL(name, host, port, target)) {
+            std::cerr << "vfs: invalid URL '" << name << "'\n";
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::shared_ptr<File> file = loading_[name].lock();
+        if (!file || file->failed()) {
+            file = std::make_shared<File>(name);
+            loading_[name] = file;
+            Downloader::global().add(file, name);
+        }
+        return file;
+    }
+
+private:
+    std::map<std::string, std::weak_ptr<File>> loading_;
+    std::mutex mutex_;
+};
+
+// https:// URLs, which would need TLS
+class HttpsBackend : public Backend {
+public:
+    std::shared_ptr<File> open(const std::string& name, const std::string&) override {
+        std::cerr << "vfs: '" << name << "' needs TLS, which this program is built without\n";
+        return nullptr;
+    }
+};
+
+struct Registry {
+    Registry() : cachedirectory("assetcache") {
+        mounts.emplace_back("file://", std::make_shared<LocalBackend>());
+        mounts.emplace_back("http://", std::make_shared<HttpBackend>());
+        mounts.emplace_back("https://", std::make_shared<HttpsBackend>());
+    }
+
+    // The mounts whose prefix 'name' starts with, longest first
+    std::vector<std::pair<std::string, std::shared_ptr<Backend>>> find(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::pair<std::string, std::shared_ptr<Backend>>> found;
+        for (const auto& mount : mounts) {
+            if (name.compare(0, mount.first.size(), mount.first) == 0) {
+                found.push_back(mount);
+            }
+        }
+        return found;
+    }
+
+    // True if a mount matches 'name', without the copies of find()
+    bool matches(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& mount : mounts) {
+            if (name.compare(0, mount.first.size(), mount.first) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::mutex mutex;
+    std::vector<std::pair<std::string, std::shared_ptr<Backend>>> mounts;  // Longest first
+    std::string cachedirectory;
+};
+
+Registry& registry() {
+    static Registry registry;
+    return registry;
+}
+
+std::string cacheDirectory() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.cachedirectory;
+}
+
+}  // namespace
+
+void mount(const std::string& prefix, std::shared_ptr<Backend> backend) {
+    unmount(prefix);
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.mounts.emplace_back(prefix, std::move(backend));
+    std::stable_sort(r.mounts.begin(), r.mounts.end(), [](const auto& a, const auto& b) {
+        return a.first.size() > b.first.size();
+    });
+}
+
+void unmount(const std::string& prefix) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.mounts.erase(std::remove_if(r.mounts.begin(), r.mounts.end(),
+                                  [&](const auto& mount) { return mount.first == prefix; }),
+                   r.mounts.end());
+}
+
+std::shared_ptr<File> open(const std::string& name) {
+    // The backends are called without the lock, as they may take long
+    for (const auto& mount : registry().find(name)) {
+        if (std::shared_ptr<File> file =
+                mount.second->open(name, name.substr(mount.first.size()))) {
+            return file;
+        }
+    }
+    auto file = std::make_shared<File>(name);
+    return file->map(name) ? file : nullptr;
+}
+
+bool isVirtual(const std::string& name) { return registry().matches(name); }
+
+bool isRemote(const std::string& name) {
+    return name.compare(0, 7, "http://") == 0 || name.compare(0, 8, "https://") == 0;
+}
+
+void setCacheDirectory(const std::string& directory) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.cachedirectory = directory;
+}
+
+}  // namespace vfs
@@ -0,0 +1,128 @@
+/*
+ * A virtual file system, which opens files by name from local paths, file:// and http:// URLs,
+ * and from the backends mounted for other prefixes, such as pack files.
+ *
+ * Usage: open() a name to get a File, of which data() holds the bytes [0, available()) from
+ *        the moment it is returned. The file grows until it is complete() or failed(), and
+ *        wait() blocks until enough of it is there. Local files are mapped and complete at
+ *        once. http:// files are downloaded one after the other by a loader thread, in
+ *        ranges of 'rangeBytes' with HTTP/1.1 range requests on one kept alive connection,
+ *        so loaders can start on the first range while the rest arrives, as
+ *        TriangleSoup::beginOBJ() does.
+ *        Downloads land in the cache directory of setCacheDirectory(), in a file named by the
+ *        hash of its contents, and a small record named by the hash of the URL gives the
+ *        contents and the ETag of the server for them. The next open() of the URL asks the
+ *        server if the ETag is still current, and maps the cached file if it is, or if the
+ *        server can not be reached. Files with the same contents are cached only once.
+ *        Downloads that nobody holds any more are dropped between two ranges.
+ *        MappedFile::open() takes the same names and waits for the whole file, so all
+ *        loaders that read through it, like Shader, Texture and TriangleSoup, take URLs too.
+ *        https:// needs a TLS library, which the program is not built with, and fails.
+ *        mount() adds a Backend for the names that start with a prefix, like a PackFile.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "MappedFile.hpp"
+
+namespace vfs {
+
+// Size of the range requests of a download
+constexpr size_t rangeBytes = 1 << 20;
+
+// A file that was opened, and may still be arriving
+class File {
+public:
+    /* Constructor: an empty file, for a backend to fill */
+    explicit File(const std::string& name);
+
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    // The name that the file was opened with
+    const std::string& name() const;
+
+    // The bytes of the file, of which the first available() are there. The pointer stays
+    // the same for the life of the file, once size() is known.
+    const char* data() const;
+    // Size of the whole file, 0 until it is known
+    size_t size() const;
+    size_t available() const;
+    bool complete() const;
+    bool failed() const;
+
+    /* Wait until at least 'bytes' bytes are available, or the file is complete or failed.
+     * True if the bytes are there. */
+    bool wait(size_t bytes) const;
+
+    /* Wait for the whole file. False if it failed. */
+    bool waitComplete() const;
+
+    // For the backends: map a local file as the whole contents. False if it can not be mapped.
+    bool map(const std::string& path);
+    // The 'size' bytes at 'data' as the whole contents, which 'owner' keeps alive
+    void setData(const char* data, size_t size, std::shared_ptr<const void> owner);
+    // Allocate the memory of a file of 'size' bytes, which then arrive with append()
+    void reserve(size_t size);
+    // Add the next bytes. False if they are more than reserve() made room for.
+    bool append(const char* bytes, size_t count);
+    // Finish the file, complete if 'ok' and the reserved size has arrived, failed otherwise
+    void finish(bool ok);
+
+private:
+    enum State { Loading, Complete, Failed };
+
+    std::string name_;
+    MappedFile mapped_;
+    std::vector<char> buffer_;          // Of the files that arrive, instead of the mapping
+    std::shared_ptr<const void> owner_;  // Of the data of setData()
+    std::atomic<const char*> data_;
+    std::atomic<size_t> size_;
+    std::atomic<size_t> available_;
+    std::atomic<int> state_;
+    mutable std::mutex mutex_;
+    mutable std::condition_variable arrived_;
+};
+
+// The files of the names that start with a prefix
+class Backend {
+public:
+    virtual ~Backend() = default;
+
+    /* The file of 'name', with 'path' the part after the prefix. nullptr if there is no such
+     * file, with the errors other than a missing file printed. */
+    virtual std::shared_ptr<File> open(const std::string& name, const std::string& path) = 0;
+};
+
+/* Use 'backend' for the names that start with 'prefix', which may be empty for all names. The
+ * longest matching prefix is asked first, and a backend without the file passes the name on to
+ * the next one, and in the end to the local file system. So a pack file mounted at "" is read
+ * before the loose files, which are still found when it does not have them. */
+void mount(const std::string& prefix, std::shared_ptr<Backend> backend);
+void unmount(const std::string& prefix);
+
+/* Open the file 'name', a local path or a URL. A download goes on in the background, and a
+ * local file is complete at once. nullptr if the file is not there, with the errors other
+ * than a missing file printed, as MappedFile::open() leaves those to the caller. */
+std::shared_ptr<File> open(const std::string& name);
+
+// True if 'name' is opened by a backend, and not only as a plain local path
+bool isVirtual(const std::string& name);
+
+// True for http:// and https:// URLs, which arrive over time
+bool isRemote(const std::string& name);
+
+/* The directory for downloaded files, "assetcache" in the working directory by default. It is
+ * created by the first download. */
+void setCacheDirectory(const std::string& directory);
+
+}  // namespace vfs
@@ -0,0 +1,666 @@
+/*
+ * Virtual texture with tiles loaded on demand from a memory mapped tile file
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+
+#include "VirtualTexture.hpp"
+
+#include "GLState.hpp"
+#include "GpuMemory.hpp"
+#include "Texture.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+struct TileFileHeader {
+    char magic[8];        // "TNMVTEX" and a null
+    uint32_t version;     // tileFileVersion
+    uint32_t width;       // Size of level 0 in texels
+    uint32_t height;
+    uint32_t tilesize;    // Texels per tile side, without the border
+    uint32_t border;      // Texels of border around each tile
+    uint32_t levels;      // Levels, the last one fits in a single tile
+    uint32_t numtiles;    // Tiles in all levels
+    uint32_t reserved;
+    uint64_t tileoffset;  // Offset of the first tile from the start of the file
+};
+
+const char tileFileMagic[8] = {'T', 'N', 'M', 'V', 'T', 'E', 'X', '\0'};
+const uint32_t tileFileVersion = 1;
+const uint64_t tileFileAlignment = 64;
+const int tileBorder = 1;
+
+// The feedback buffer is this many times smaller than the viewport in x and y
+const int feedbackDivisor = 8;
+
+int levelSize(int size, int level) { return std::max(size >> level, 1); }
+
+int tileCountFor(int size, int level, int tilesize) {
+    return (levelSize(size, level) + tilesize - 1) / tilesize;
+}
+
+// Levels until the image fits in one tile
+int levelCountFor(int width, int height, int tilesize) {
+    int levels = 1;
+    while (std::max(levelSize(width, levels - 1), levelSize(height, levels - 1)) > tilesize) {
+        levels++;
+    }
+    return levels;
+}
+
+}  // namespace
+
+VirtualTexture::VirtualTexture(int cachesize, int tilesperupdate)
+    : tiles_(nullptr),
+      width_(0),
+      height_(0),
+      tilesize_(0),
+      border_(0),
+      levels_(0),
+      cachesize_(std::max(cachesize, 1)),
+      tilesperupdate_(std::max(tilesperupdate, 1)),
+      sparse_(false),
+      sparselevels_(0),
+      indirectiondirty_(false),
+      feedbackcount_(0),
+      loadedtiles_(0),
+      texture_(0),
+      indirection_(0),
+      feedbackbuffer_(0),
+      feedbackcolor_(0),
+      feedbackdepth_(0),
+      readbackbuffer_(0),
+      readbackfence_(nullptr),
+      feedbackwidth_(0),
+      feedbackheight_(0),
+      readbackwidth_(0),
+      readbackheight_(0),
+      savedviewport_{0, 0, 0, 0},
+      savedframebuffer_(0),
+      savedreadframebuffer_(0),
+      savedprogram_(0) {}
+
+VirtualTexture::~VirtualTexture() {
+    if (readbackfence_) {
+        glDeleteSync(static_cast<GLsync>(readbackfence_));
+    }
+    if (glIsTexture(texture_)) {
+        glstate::deleteTextures(1, &texture_);
+    }
+    if (glIsTexture(indirection_)) {
+        glstate::deleteTextures(1, &indirection_);
+    }
+    if (glIsFramebuffer(feedbackbuffer_)) {
+        glDeleteFramebuffers(1, &feedbackbuffer_);
+    }
+    if (glIsRenderbuffer(feedbackcolor_)) {
+        gpumem::deleteRenderbuffers(1, &feedbackcolor_);
+    }
+    if (glIsRenderbuffer(feedbackdepth_)) {
+        gpumem::deleteRenderbuffers(1, &feedbackdepth_);
+    }
+    if (glIsBuffer(readbackbuffer_)) {
+        gpumem::deleteBuffers(1, &readbackbuffer_);
+    }
+}
+
+/*
+ * Write the tile file. Every level is cut into tiles of 'tilesize' x 'tilesize' texels plus a
+ * border copied from the neighbouring tiles, so bilinear filtering inside a slot of the cache
+ * gives the same result as in the whole image. Texels beyond the image edges repeat the edge.
+ * All tiles have the same size and are stored as BGRA, level by level and row by row, so a
+ * tile is found from its number alone.
+ */
+bool VirtualTexture::bake(const std::string& imagefile, const std::string& tilefile,
+                          int tilesize) {
+    if (tilesize < 1) {
+        std::cerr << "VirtualTexture::bake(\"" << tilefile << "\"): invalid tile size\n";
+        return false;
+    }
+    MappedFile file;
+    if (!file.open(imagefile)) {
+        std::cerr << "Could not open texture file ('" << imagefile << "')\n";
+        return false;
+    }
+    const Texture::ImageData image = Texture::loadImage(imagefile, file);
+    const GLubyte* pixels = image.levels.empty() ? image.pixels : image.levels[0].data;
+    if (pixels == nullptr) {
+        return false;
+    }
+    if (image.internalformat != GL_RGBA8) {
+        std::cerr << "VirtualTexture::bake(\"" << imagefile
+                  << "\"): compressed images are not supported\n";
+        return false;
+    }
+
+    // Level 0 as BGRA, then each level from the one below with a 2x2 box filter
+    const int width = static_cast<int>(image.width);
+    const int height = static_cast<int>(image.height);
+    const int levels = levelCountFor(width, height, tilesize);
+    const size_t bytesperpixel = (image.type == GL_RGBA) ? 4 : 3;
+    std::vector<std::vector<GLubyte>> level(levels);
+    level[0].resize(size_t(width) * size_t(height) * 4);
+    for (size_t i = 0; i < size_t(width) * size_t(height); i++) {
+        memcpy(&level[0][4 * i], pixels + i * bytesperpixel, 3);
+        level[0][4 * i + 3] = (bytesperpixel == 4) ? pixels[i * bytesperpixel + 3] : 255;
+    }
+    for (int l = 1; l < levels; l++) {
+        const int srcwidth = levelSize(width, l - 1);
+        const int srcheight = levelSize(height, l - 1);
+        const int dstwidth = levelSize(width, l);
+        const int dstheight = levelSize(height, l);
+        level[l].resize(size_t(dstwidth) * size_t(dstheight) * 4);
+        for (int y = 0; y < dstheight; y++) {
+            const int y0 = std::min(2 * y, srcheight - 1);
+            const int y1 = std::min(2 * y + 1, srcheight - 1);
+            for (int x = 0; x < dstwidth; x++) {
+                const int x0 = std::min(2 * x, srcwidth - 1);
+                const int x1 = std::min(2 * x + 1, srcwidth - 1);
+                const GLubyte* src = level[l - 1].data();
+                GLubyte* dst = &level[l][(size_t(y) * dstwidth + x) * 4];
+                for (int c = 0; c < 4; c++) {
+                    const int sum = src[(size_t(y0) * srcwidth + x0) * 4 + c] +
+                                    src[(size_t(y0) * srcwidth + x1) * 4 + c] +
+                                    src[(size_t(y1) * srcwidth + x0) * 4 + c] +
+                                    src[(size_t(y1) * srcwidth + x1) * 4 + c];
+                    dst[c] = static_cast<GLubyte>((sum + 2) / 4);
+                }
+            }
+        }
+    }
+
+    TileFileHeader header = {};
+    memcpy(header.magic, tileFileMagic, sizeof(tileFileMagic));
+    header.version = tileFileVersion;
+    header.width = image.width;
+    header.height = image.height;
+    header.tilesize = tilesize;
+    header.border = tileBorder;
+    header.levels = levels;
+    for (int l = 0; l < levels; l++) {
+        header.numtiles += tileCountFor(width, l, tilesize) * tileCountFor(height, l, tilesize);
+    }
+    header.tileoffset = (sizeof(header) + tileFileAlignment - 1) / tileFileAlignment *
+                        tileFileAlignment;
+
+    FILE* output = fopen(tilefile.c_str(), "wb");
+    if (!output) {
+        std::cerr << "VirtualTexture::bake(\"" << tilefile << "\"): could not create file\n";
+        return false;
+    }
+    const char padding[tileFileAlignment] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, output) == 1;
+    ok = ok && fwrite(padding, 1, header.tileoffset - sizeof(header), output) ==
+                   header.tileoffset - sizeof(header);
+
+    const int slotsize = tilesize + 2 * tileBorder;
+    std::vector<GLubyte> tile(size_t(slotsize) * size_t(slotsize) * 4);
+    for (int l = 0; l < levels && ok; l++) {
+        const int lwidth = levelSize(width, l);
+        const int lheight = levelSize(height, l);
+        for (int ty = 0; ty < tileCountFor(height, l, tilesize) && ok; ty++) {
+            for (int tx = 0; tx < tileCountFor(width, l, tilesize); tx++) {
+                for (int y = 0; y < slotsize; y++) {
+                    const int sy = std::clamp(ty * tilesize + y - tileBorder, 0, lheight - 1);
+                    for (int x = 0; x < slotsize; x++) {
+                        const int sx = std::clamp(tx * tilesize + x - tileBorder, 0, lwidth - 1);
+                        memcpy(&tile[(size_t(y) * slotsize + x) * 4],
+                               &level[l][(size_t(sy) * lwidth + sx) * 4], 4);
+                    }
+                }
+                ok = ok && fwrite(tile.data(), 1, tile.size(), output) == tile.size();
+            }
+        }
+    }
+    ok = (fclose(output) == 0) && ok;
+
+    if (!ok) {
+        std::cerr << "VirtualTexture::bake(\"" << tilefile << "\"): write error\n";
+        std::remove(tilefile.c_str());
+    }
+    return ok;
+}
+
+bool VirtualTexture::open(const std::string& tilefile, bool allowsparse) {
+    if (texture_ != 0) {
+        std::cerr << "VirtualTexture::open(\"" << tilefile << "\"): already open\n";
+        return false;
+    }
+    if (!file_.open(tilefile)) {
+        std::cerr << "Could not open tile file ('" << tilefile << "')\n";
+        return false;
+    }
+    TileFileHeader header = {};
+    bool valid = file_.size() >= sizeof(header);
+    if (valid) {
+        memcpy(&header, file_.data(), sizeof(header));
+        valid = memcmp(header.magic, tileFileMagic, sizeof(tileFileMagic)) == 0 &&
+                header.version == tileFileVersion && header.tilesize > 0 &&
+                header.levels > 0 && header.levels <= 32;
+    }
+    const uint64_t tilebytes = uint64_t(header.tilesize + 2 * header.border) *
+                               (header.tilesize + 2 * header.border) * 4;
+    if (!valid || header.tileoffset + header.numtiles * tilebytes > file_.size()) {
+        std::cerr << "VirtualTexture::open(\"" << tilefile << "\"): not a valid tile file\n";
+        file_.close();
+        return false;
+    }
+    tiles_ = reinterpret_cast<const unsigned char*>(file_.data()) + header.tileoffset;
+    width_ = static_cast<int>(header.width);
+    height_ = static_cast<int>(header.height);
+    tilesize_ = static_cast<int>(header.tilesize);
+    border_ = static_cast<int>(header.border);
+    levels_ = static_cast<int>(header.levels);
+    levelfirst_.assign(levels_ + 1, 0);
+    for (int level = 0; level < levels_; level++) {
+        levelfirst_[level + 1] = levelfirst_[level] + tilesX(level) * tilesY(level);
+        tilelevel_.insert(tilelevel_.end(), tilesX(level) * tilesY(level), level);
+    }
+    tileslot_.assign(levelfirst_[levels_], -1);
+    requested_.assign(levelfirst_[levels_], 0);
+
+    // A sparse texture needs tiles that are whole pages
+    GLint pagewidth = 0, pageheight = 0, maxsparsesize = 0;
+    if (allowsparse && GLEW_ARB_sparse_texture && GLEW_ARB_texture_storage) {
+        glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA8, GL_VIRTUAL_PAGE_SIZE_X_ARB, 1,
+                              &pagewidth);
+        glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA8, GL_VIRTUAL_PAGE_SIZE_Y_ARB, 1,
+                              &pageheight);
+        glGetIntegerv(GL_MAX_SPARSE_TEXTURE_SIZE_ARB, &maxsparsesize);
+    }
+    sparse_ = pagewidth > 0 && pageheight > 0 && tilesize_ % pagewidth == 0 &&
+              tilesize_ % pageheight == 0 && std::max(width_, height_) <= maxsparsesize;
+
+    glGenTextures(1, &texture_);
+    glstate::bindTexture(GL_TEXTURE_2D, texture_);
+    GLint numsparselevels = levels_;
+    if (sparse_) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SPARSE_ARB, GL_TRUE);
+        glTexStorage2D(GL_TEXTURE_2D, levels_, GL_RGBA8, width_, height_);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_NUM_SPARSE_LEVELS_ARB, &numsparselevels);
+        sparselevels_ = std::clamp(numsparselevels, 0, levels_);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_ - 1);
+        // No more pages are committed than the tiles of the cache
+        gpumem::setTexture(texture_, gpumem::Category::Texture,
+                           gpumem::textureBytes(GL_RGBA8, cachesize_ * tilesize_,
+                                                cachesize_ * tilesize_));
+    } else {
+        // One slot per tile, no mipmaps, as the tiles of all levels share the cache
+        GLint maxsize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxsize);
+        const int slotsize = tilesize_ + 2 * border_;
+        // The indirection stores slot coordinates in bytes
+        cachesize_ = std::max(std::min({cachesize_, maxsize / slotsize, 256}), 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cachesize_ * slotsize, cachesize_ * slotsize, 0,
+                     GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+        gpumem::setTexture(texture_, gpumem::Category::Texture,
+                           gpumem::textureBytes(GL_RGBA8, cachesize_ * slotsize,
+                                                cachesize_ * slotsize));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    slots_.assign(size_t(cachesize_) * size_t(cachesize_), Slot());
+
+    // One texel per tile in each mipmap level. Level 0 is rounded up to a power of two in x
+    // and y, so every mipmap level is at least as large as the tile grid of its level.
+    int indirectionwidth = 1, indirectionheight = 1;
+    while (indirectionwidth < tilesX(0)) {
+        indirectionwidth *= 2;
+    }
+    while (indirectionheight < tilesY(0)) {
+        indirectionheight *= 2;
+    }
+    glGenTextures(1, &indirection_);
+    glstate::bindTexture(GL_TEXTURE_2D, indirection_);
+    for (int level = 0; level < levels_; level++) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8UI, levelSize(indirectionwidth, level),
+                     levelSize(indirectionheight, level), 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE,
+                     nullptr);
+    }
+    gpumem::setTexture(indirection_, gpumem::Category::Texture,
+                       gpumem::textureBytes(GL_RGBA8UI, indirectionwidth, indirectionheight, 1,
+                                            levels_));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels_ - 1);
+    glstate::bindTexture(GL_TEXTURE_2D, 0);
+
+    // The coarsest level, and in a sparse texture the levels of the mip tail, which are
+    // committed as a whole, stay loaded
+    int firstpermanent = levels_ - 1;
+    if (sparse_ && sparselevels_ < levels_) {
+        firstpermanent = sparselevels_;
+        glstate::bindTexture(GL_TEXTURE_2D, texture_);
+        glTexPageCommitmentARB(GL_TEXTURE_2D, firstpermanent, 0, 0, 0,
+                               levelSize(width_, firstpermanent),
+                               levelSize(height_, firstpermanent), 1, GL_TRUE);
+        glstate::bindTexture(GL_TEXTURE_2D, 0);
+    }
+    for (int tile = levelfirst_[firstpermanent]; tile < levelfirst_[levels_]; tile++) {
+        if (!loadTile(tile, true)) {
+            std::cerr << "VirtualTexture::open(\"" << tilefile
+                      << "\"): the cache is too small for the coarsest levels\n";
+            return false;
+        }
+    }
+    updateIndirection();
+    return true;
+}
+
+void VirtualTexture::beginFeedback() {
+    glGetIntegerv(GL_VIEWPORT, savedviewport_);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedframebuffer_);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &savedreadframebuffer_);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &savedprogram_);
+
+    const int width = std::max(savedviewport_[2] / feedbackDivisor, 1);
+    const int height = std::max(savedviewport_[3] / feedbackDivisor, 1);
+    if (feedbackbuffer_ == 0) {
+        glGenFramebuffers(1, &feedbackbuffer_);
+        glGenRenderbuffers(1, &feedbackcolor_);
+        glGenRenderbuffers(1, &feedbackdepth_);
+        glGenBuffers(1, &readbackbuffer_);
+        feedbackshader_.createShader("vertex.glsl", "fragment_vt_feedback.glsl");
+    }
+    if (width != feedbackwidth_ || height != feedbackheight_) {
+        feedbackwidth_ = width;
+        feedbackheight_ = height;
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackcolor_);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16UI, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackdepth_);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        gpumem::setRenderbuffer(feedbackcolor_, gpumem::Category::RenderTarget,
+                                gpumem::textureBytes(GL_RGBA16UI, width, height));
+        gpumem::setRenderbuffer(feedbackdepth_, gpumem::Category::RenderTarget,
+                                gpumem::textureBytes(GL_DEPTH_COMPONENT24, width, height));
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, feedbackbuffer_);
+        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+                                  feedbackcolor_);
+        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
+                                  feedbackdepth_);
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, feedbackbuffer_);
+    glViewport(0, 0, width, height);
+    const GLuint clearcolor[4] = {0, 0, 0, 0};  // Alpha 0 marks pixels without the texture
+    glClearBufferuiv(GL_COLOR, 0, clearcolor);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    feedbackshader_.use();
+    feedbackshader_.setUniform("virtualSize", static_cast<GLfloat>(width_),
+                               static_cast<GLfloat>(height_));
+    feedbackshader_.setUniform("tileSize", static_cast<GLfloat>(tilesize_));
+    feedbackshader_.setUniform("maxLevel", levels_ - 1);
+    // The derivatives are 'feedbackDivisor' times larger than in the full size viewport
+    feedbackshader_.setUniform("lodBias", -std::log2(static_cast<float>(feedbackDivisor)));
+}
+
+void VirtualTexture::endFeedback() {
+    // Keep the previous readback if update() has not seen it yet
+    if (readbackfence_ == nullptr) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, feedbackbuffer_);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackbuffer_);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size_t(feedbackwidth_) * feedbackheight_ * 8, nullptr,
+                     GL_STREAM_READ);
+        gpumem::setBuffer(readbackbuffer_, gpumem::Category::Buffer,
+                          size_t(feedbackwidth_) * feedbackheight_ * 8);
+        glReadPixels(0, 0, feedbackwidth_, feedbackheight_, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT,
+                     nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readbackfence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readbackwidth_ = feedbackwidth_;
+        readbackheight_ = feedbackheight_;
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, savedframebuffer_);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, savedreadframebuffer_);
+    glViewport(savedviewport_[0], savedviewport_[1], savedviewport_[2], savedviewport_[3]);
+    glstate::useProgram(savedprogram_);
+}
+
+/*
+ * Read the feedback that the GPU has finished, and load the missing tiles. Every tile seen is
+ * requested together with the tiles of the coarser levels above it, so a tile that is drawn
+ * from a coarser level keeps that level in the cache, and the coarse tiles, which cover the
+ * most, are loaded first.
+ */
+void VirtualTexture::update() {
+    if (readbackfence_ == nullptr) {
+        return;
+    }
+    GLsync fence = static_cast<GLsync>(readbackfence_);
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        return;
+    }
+    glDeleteSync(fence);
+    readbackfence_ = nullptr;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackbuffer_);
+    const size_t pixelcount = size_t(readbackwidth_) * readbackheight_;
+    const GLushort* pixels = static_cast<const GLushort*>(
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixelcount * 8, GL_MAP_READ_BIT));
+    if (pixels == nullptr) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return;
+    }
+    feedbackcount_++;
+    std::vector<int> missing;
+    for (size_t i = 0; i < pixelcount; i++) {
+        const GLushort* pixel = pixels + 4 * i;
+        if (pixel[3] == 0 || pixel[2] >= levels_) {
+            continue;
+        }
+        int level = pixel[2];
+        int x = std::min<int>(pixel[0], tilesX(level) - 1);
+        int y = std::min<int>(pixel[1], tilesY(level) - 1);
+        for (; level < levels_; level++, x /= 2, y /= 2) {
+            const int tile = tileNumber(level, std::min(x, tilesX(level) - 1),
+                                        std::min(y, tilesY(level) - 1));
+            if (requested_[tile]) {
+                break;  // The coarser tiles are requested already
+            }
+            requested_[tile] = 1;
+            if (tileslot_[tile] >= 0) {
+                slots_[tileslot_[tile]].lastseen = feedbackcount_;
+            } else {
+                missing.push_back(tile);
+            }
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // Coarse levels first
+    std::sort(missing.begin(), missing.end(), [this](int a, int b) {
+        return tilelevel_[a] != tilelevel_[b] ? tilelevel_[a] > tilelevel_[b] : a < b;
+    });
+    int loaded = 0;
+    for (int tile : missing) {
+        requested_[tile] = 0;
+        if (loaded < tilesperupdate_ && loadTile(tile, false)) {
+            slots_[tileslot_[tile]].lastseen = feedbackcount_;
+            loaded++;
+        }
+    }
+    // Clear the requested flags of the tiles that were loaded already
+    for (const Slot& slot : slots_) {
+        if (slot.tile >= 0) {
+            requested_[slot.tile] = 0;
+        }
+    }
+    if (indirectiondirty_) {
+        updateIndirection();
+    }
+}
+
+/*
+ * Copy a tile from the mapped file into a free slot, or into the slot of the tile that was
+ * seen longest ago. The tiles seen in the latest feedback are in use and are never replaced.
+ */
+bool VirtualTexture::loadTile(int tile, bool permanent) {
+    int slot = -1;
+    for (int s = 0; s < static_cast<int>(slots_.size()); s++) {
+        const Slot& candidate = slots_[s];
+        if (candidate.tile < 0) {
+            slot = s;
+            break;
+        }
+        if (!candidate.permanent && candidate.lastseen < feedbackcount_ &&
+            (slot < 0 || candidate.lastseen < slots_[slot].lastseen)) {
+            slot = s;
+        }
+    }
+    if (slot < 0) {
+        return false;
+    }
+
+    const int level = tilelevel_[tile];
+    const int index = tile - levelfirst_[level];
+    const int x = (index % tilesX(level)) * tilesize_;
+    const int y = (index / tilesX(level)) * tilesize_;
+    const int slotsize = tilesize_ + 2 * border_;
+    const unsigned char* data = tiles_ + size_t(tile) * slotsize * slotsize * 4;
+
+    glstate::bindTexture(GL_TEXTURE_2D, texture_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if (sparse_) {
+        // Commit the pages of the tile, and leave out the border, which is not needed here
+        const int evicted = slots_[slot].tile;
+        if (evicted >= 0) {
+            const int elevel = tilelevel_[evicted];
+            const int eindex = evicted - levelfirst_[elevel];
+            const int ex = (eindex % tilesX(elevel)) * tilesize_;
+            const int ey = (eindex / tilesX(elevel)) * tilesize_;
+            glTexPageCommitmentARB(GL_TEXTURE_2D, elevel, ex, ey, 0,
+                                   std::min(tilesize_, levelSize(width_, elevel) - ex),
+                                   std::min(tilesize_, levelSize(height_, elevel) - ey), 1,
+                                   GL_FALSE);
+        }
+        const int width = std::min(tilesize_, levelSize(width_, level) - x);
+        const int height = std::min(tilesize_, levelSize(height_, level) - y);
+        if (level < sparselevels_) {  // The mip tail was committed by open()
+            glTexPageCommitmentARB(GL_TEXTURE_2D, level, x, y, 0, width, height, 1, GL_TRUE);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, slotsize);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, border_);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, border_);
+        glTexSubImage2D(GL_TEXTURE_2D, level, x, y, width, height, GL_BGRA, GL_UNSIGNED_BYTE,
+                        data);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cachesize_) * slotsize,
+                        (slot / cachesize_) * slotsize, slotsize, slotsize, GL_BGRA,
+                        GL_UNSIGNED_BYTE, data);
+    }
+    glstate::bindTexture(GL_TEXTURE_2D, 0);
+
+    if (slots_[slot].tile >= 0) {
+        tileslot_[slots_[slot].tile] = -1;
+    }
+    slots_[slot].tile = tile;
+    slots_[slot].permanent = permanent;
+    tileslot_[tile] = slot;
+    loadedtiles_++;
+    indirectiondirty_ = true;
+    return true;
+}
+
+/*
+ * For every tile, the finest loaded level among the tile and the tiles above it, and the
+ * slot of that tile. Computed from the coarsest level down, where every tile that is not
+ * loaded inherits the entry of the tile above it.
+ */
+void VirtualTexture::updateIndirection() {
+    std::vector<GLubyte> above, entries;
+    glstate::bindTexture(GL_TEXTURE_2D, indirection_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = levels_ - 1; level >= 0; level--) {
+        const int tilesx = tilesX(level);
+        const int tilesy = tilesY(level);
+        const int abovetilesx = (level + 1 < levels_) ? tilesX(level + 1) : 1;
+        const int abovetilesy = (level + 1 < levels_) ? tilesY(level + 1) : 1;
+        entries.assign(size_t(tilesx) * tilesy * 4, 0);
+        for (int y = 0; y < tilesy; y++) {
+            for (int x = 0; x < tilesx; x++) {
+                GLubyte* entry = &entries[(size_t(y) * tilesx + x) * 4];
+                const int slot = tileslot_[tileNumber(level, x, y)];
+                if (slot >= 0) {
+                    entry[0] = static_cast<GLubyte>(slot % cachesize_);
+                    entry[1] = static_cast<GLubyte>(slot / cachesize_);
+                    entry[2] = static_cast<GLubyte>(level);
+                } else if (!above.empty()) {
+                    const int ax = std::min(x / 2, abovetilesx - 1);
+                    const int ay = std::min(y / 2, abovetilesy - 1);
+                    memcpy(entry, &above[(size_t(ay) * abovetilesx + ax) * 4], 4);
+                }
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, tilesx, tilesy, GL_RGBA_INTEGER,
+                        GL_UNSIGNED_BYTE, entries.data());
+        std::swap(above, entries);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glstate::bindTexture(GL_TEXTURE_2D, 0);
+    indirectiondirty_ = false;
+}
+
+void VirtualTexture::bind(GLuint program, int unit) const {
+    glstate::activeTexture(GL_TEXTURE0 + unit);
+    glstate::bindTexture(GL_TEXTURE_2D, texture_);
+    glstate::activeTexture(GL_TEXTURE0 + unit + 1);
+    glstate::bindTexture(GL_TEXTURE_2D, indirection_);
+    glstate::activeTexture(GL_TEXTURE0);
+
+    const int slotsize = tilesize_ + 2 * border_;
+    glUniform1i(glGetUniformLocation(program, "virtualTexture"), unit);
+    glUniform1i(glGetUniformLocation(program, "indirection"), unit + 1);
+    glUniform2f(glGetUniformLocation(program, "virtualSize"), static_cast<GLfloat>(width_),
+                static_cast<GLfloat>(height_));
+    glUniform1f(glGetUniformLocation(program, "tileSize"), static_cast<GLfloat>(tilesize_));
+    glUniform1f(glGetUniformLocation(program, "tileBorder"), static_cast<GLfloat>(border_));
+    glUniform1f(glGetUniformLocation(program, "slotSize"), static_cast<GLfloat>(slotsize));
+    glUniform1f(glGetUniformLocation(program, "physicalSize"),
+                static_cast<GLfloat>(cachesize_ * slotsize));
+    glUniform1i(glGetUniformLocation(program, "maxLevel"), levels_ - 1);
+    glUniform1i(glGetUniformLocation(program, "sparseMode"), sparse_ ? 1 : 0);
+}
+
+int VirtualTexture::tilesX(int level) const { return tileCountFor(width_, level, tilesize_); }
+
+int VirtualTexture::tilesY(int level) const { return tileCountFor(height_, level, tilesize_); }
+
+int VirtualTexture::tileNumber(int level, int x, int y) const {
+    return levelfirst_[level] + y * tilesX(level) + x;
+}
+
+bool VirtualTexture::sparse() const { return sparse_; }
+
+int VirtualTexture::residentTiles() const {
+    return static_cast<int>(std::count_if(slots_.begin(), slots_.end(),
+                                          [](const Slot& slot) { return slot.tile >= 0; }));
+}
+
+int VirtualTexture::tileCount() const { return levelfirst_.empty() ? 0 : levelfirst_.back(); }
+
+int64_t VirtualTexture::loadedTiles() const { return loadedtiles_; }
+
+int VirtualTexture::width() const { return width_; }
+
+int VirtualTexture::height() const { return height_; }
+
+int VirtualTexture::levels() const { return levels_; }
@@ -0,0 +1,134 @@
+/*
+ * A virtual texture for images larger than the GPU memory, of which only the visible tiles
+ * are loaded.
+ *
+ * Usage: bake() an image once into a tile file, which holds every mipmap level cut into
+ *        square tiles with a border of one texel. open() maps the tile file.
+ *        Every frame, draw the objects that use the texture between beginFeedback() and
+ *        endFeedback(). That renders them with the shader vertex.glsl and
+ *        fragment_vt_feedback.glsl into a small buffer, where each pixel records the tile and
+ *        level it samples. The buffer is read back through a pixel buffer object and a fence,
+ *        and update() reads it one or more frames later, without waiting. Missing tiles are
+ *        loaded from the mapped file, coarse levels first, up to 'tilesperupdate' per update().
+ *        Tiles are kept in a cache of 'cachesize' x 'cachesize' tiles, and the least recently
+ *        seen tiles are replaced.
+ *        Draw the objects with a shader that samples the texture with sampleVirtual() from
+ *        fragment_virtual.glsl, after bind() with that shader in use.
+ *        With ARB_sparse_texture, the texture is a sparse texture of the full size and tiles
+ *        are committed and uncommitted one by one. Otherwise the cache is a physical texture
+ *        with one slot per tile, and an indirection texture with one texel per tile and level
+ *        tells the shader where each tile is. In both cases a tile that is not loaded yet is
+ *        drawn from the finest loaded level above it. The coarsest level is always loaded.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>  // To use OpenGL datatypes
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MappedFile.hpp"
+#include "Shader.hpp"
+
+class VirtualTexture {
+public:
+    /* Constructor: a cache of 'cachesize' x 'cachesize' tiles, and at most 'tilesperupdate'
+     * tiles loaded by each update(). Nothing is created before open(). */
+    explicit VirtualTexture(int cachesize = 16, int tilesperupdate = 16);
+
+    /* Destructor: delete textures, buffers and fences */
+    ~VirtualTexture();
+
+    VirtualTexture(const VirtualTexture&) = delete;
+    VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+    /* Cut a TGA or uncompressed DDS image and its mipmaps into tiles of 'tilesize' texels,
+     * and write them to the tile file 'tilefile'. The whole image is decoded in memory. */
+    static bool bake(const std::string& imagefile, const std::string& tilefile,
+                     int tilesize = 128);
+
+    /* Map a tile file and create the textures. With 'allowsparse' false, the physical and
+     * indirection textures are used even if ARB_sparse_texture is supported. */
+    bool open(const std::string& tilefile, bool allowsparse = true);
+
+    // Start and end the feedback pass, around the draw calls of the objects
+    void beginFeedback();
+    void endFeedback();
+
+    // Read the latest finished feedback, and load and replace tiles
+    void update();
+
+    /* Bind the textures to units 'unit' and 'unit' + 1, and set the uniforms of
+     * fragment_virtual.glsl in 'program', which must be in use */
+    void bind(GLuint program, int unit = 0) const;
+
+    // True if the texture is a sparse texture
+    bool sparse() const;
+
+    // Number of tiles loaded now, number of tiles in all levels, and tiles loaded in total
+    int residentTiles() const;
+    int tileCount() const;
+    int64_t loadedTiles() const;
+
+    // Size of level 0 in texels, and the number of levels
+    int width() const;
+    int height() const;
+    int levels() const;
+
+private:
+    struct Slot {
+        int tile = -1;          // The tile in the slot, or -1
+        uint64_t lastseen = 0;  // Feedback count when the tile was last seen
+        bool permanent = false;
+    };
+
+    // Tiles of a level in x and y, and the number of the first tile of the level
+    int tilesX(int level) const;
+    int tilesY(int level) const;
+    int tileNumber(int level, int x, int y) const;
+
+    // Load a tile into a free or the least recently seen slot. False if no slot was free.
+    bool loadTile(int tile, bool permanent);
+
+    // Recompute and upload the finest loaded level for every tile
+    void updateIndirection();
+
+    MappedFile file_;
+    const unsigned char* tiles_;  // First tile in the mapped file
+    int width_;
+    int height_;
+    int tilesize_;
+    int border_;
+    int levels_;
+    std::vector<int> levelfirst_;          // Number of the first tile of each level
+    std::vector<int> tilelevel_;           // Level of each tile
+    std::vector<int> tileslot_;            // Slot of each tile, or -1
+    std::vector<Slot> slots_;
+    std::vector<unsigned char> requested_;  // Tiles seen in the feedback, by tile number
+    int cachesize_;
+    int tilesperupdate_;
+    bool sparse_;
+    int sparselevels_;  // Levels of the sparse texture before the mip tail
+    bool indirectiondirty_;
+    uint64_t feedbackcount_;
+    int64_t loadedtiles_;
+
+    GLuint texture_;      // The sparse texture, or the physical texture of the cache
+    GLuint indirection_;  // Slot and loaded level per tile, one mip level per level
+    Shader feedbackshader_;
+    GLuint feedbackbuffer_;  // Framebuffer of the feedback pass
+    GLuint feedbackcolor_;
+    GLuint feedbackdepth_;
+    GLuint readbackbuffer_;  // PBO for the feedback pixels
+    void* readbackfence_;    // GLsync, signalled when the pixels are in the PBO
+    int feedbackwidth_;
+    int feedbackheight_;
+    int readbackwidth_;       // Size of the pixels in the PBO
+    int readbackheight_;
+    GLint savedviewport_[4];  // State restored by endFeedback()
+    GLint savedframebuffer_;
+    GLint savedreadframebuffer_;
+    GLint savedprogram_;
+};
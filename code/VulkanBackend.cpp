@@ -0,0 +1,1168 @@
+/*
+ * A Vulkan renderer with pooled device memory, a pipeline cache and parallel recording
+ *
+ * This code is in the public domain.
+ */
+#include <glad/vulkan.h>  // Before GLFW, which declares its Vulkan functions after it
+
+#include "VulkanBackend.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <map>
+
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+
+namespace {
+
+constexpr VkDeviceSize blockBytes = VkDeviceSize(64) << 20;
+constexpr int framesInFlight = 2;
+
+bool check(VkResult result, const char* what) {
+    if (result != VK_SUCCESS) {
+        std::cerr << "VulkanBackend: " << what << " failed (VkResult " << result << ")\n";
+        return false;
+    }
+    return true;
+}
+
+// The glad loader asks GLFW, which found the Vulkan loader library
+GLADapiproc loadFunction(const char* name, void* instance) {
+    return reinterpret_cast<GLADapiproc>(
+        glfwGetInstanceProcAddress(static_cast<VkInstance>(instance), name));
+}
+
+// A range of a memory block
+struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    int block = -1;           // In MemoryPool, -1 if there is no allocation
+    void* mapped = nullptr;   // The range, in host visible memory
+};
+
+/* Blocks of device memory of one memory type each, whose free ranges are kept by offset,
+ * and merged with their neighbours when a range is given back. Buffers and images take
+ * blocks of their own, so that they never share a page as bufferImageGranularity demands.
+ * Requests of more than a quarter of a block get a block of their own, which is freed
+ * with them. */
+class MemoryPool {
+public:
+    void init(VkDevice device, VkPhysicalDevice gpu) {
+        device_ = device;
+        vkGetPhysicalDeviceMemoryProperties(gpu, &properties_);
+    }
+
+    bool allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags flags,
+                  bool image, Allocation& allocation) {
+        const int type = findType(requirements.memoryTypeBits, flags);
+        if (type < 0) {
+            std::cerr << "VulkanBackend: no memory type for the resource\n";
+            return false;
+        }
+        const bool dedicated = requirements.size > blockBytes / 4;
+        if (!dedicated) {
+            for (size_t b = 0; b < blocks_.size(); b++) {
+                Block& block = blocks_[b];
+                if (block.memory != VK_NULL_HANDLE && !block.dedicated &&
+                    block.type == uint32_t(type) && block.image == image &&
+                    take(block, requirements, allocation)) {
+                    allocation.block = static_cast<int>(b);
+                    return true;
+                }
+            }
+        }
+        Block block;
+        block.type = uint32_t(type);
+        block.image = image;
+        block.dedicated = dedicated;
+        block.size = dedicated ? requirements.size : blockBytes;
+        VkMemoryAllocateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        info.allocationSize = block.size;
+        info.memoryTypeIndex = block.type;
+        if (!check(vkAllocateMemory(device_, &info, nullptr, &block.memory),
+                   "vkAllocateMemory()")) {
+            return false;
+        }
+        if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            if (!check(vkMapMemory(device_, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped),
+                       "vkMapMemory()")) {
+                vkFreeMemory(device_, block.memory, nullptr);
+                return false;
+            }
+        }
+        block.free[0] = block.size;
+        // Reuse the slot of a freed dedicated block
+        size_t b = 0;
+        while (b < blocks_.size() && blocks_[b].memory != VK_NULL_HANDLE) {
+            b++;
+        }
+        if (b == blocks_.size()) {
+            blocks_.push_back(Block());
+        }
+        blocks_[b] = std::move(block);
+        take(blocks_[b], requirements, allocation);
+        allocation.block = static_cast<int>(b);
+        return true;
+    }
+
+    void free(Allocation& allocation) {
+        if (allocation.block < 0) {
+            return;
+        }
+        Block& block = blocks_[allocation.block];
+        VkDeviceSize offset = allocation.offset;
+        VkDeviceSize size = allocation.size;
+        auto next = block.free.lower_bound(offset);
+        if (next != block.free.end() && offset + size == next->first) {
+            size += next->second;
+            next = block.free.erase(next);
+        }
+        bool merged = false;
+        if (next != block.free.begin()) {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset) {
+                previous->second += size;
+                merged = true;
+            }
+        }
+        if (!merged) {
+            block.free[offset] = size;
+        }
+        if (block.dedicated) {
+            vkFreeMemory(device_, block.memory, nullptr);
+            block = Block();
+        }
+        allocation = Allocation();
+    }
+
+    void destroy() {
+        for (Block& block : blocks_) {
+            if (block.memory != VK_NULL_HANDLE) {
+                vkFreeMemory(device_, block.memory, nullptr);
+            }
+        }
+        blocks_.clear();
+    }
+
+    VkDeviceSize bytes() const {
+        VkDeviceSize total = 0;
+        for (const Block& block : blocks_) {
+            total += block.memory != VK_NULL_HANDLE ? block.size : 0;
+        }
+        return total;
+    }
+
+private:
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        uint32_t type = 0;
+        bool image = false;
+        bool dedicated = false;
+        VkDeviceSize size = 0;
+        void* mapped = nullptr;
+        std::map<VkDeviceSize, VkDeviceSize> free;  // Offset and size of the free ranges
+    };
+
+    int findType(uint32_t bits, VkMemoryPropertyFlags flags) const {
+        for (uint32_t i = 0; i < properties_.memoryTypeCount; i++) {
+            if ((bits & (1u << i)) && (properties_.memoryTypes[i].propertyFlags & flags) == flags) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    // The first free range that fits, split around the aligned allocation
+    static bool take(Block& block, const VkMemoryRequirements& requirements,
+                     Allocation& allocation) {
+        const VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+        for (auto it = block.free.begin(); it != block.free.end(); ++it) {
+            const VkDeviceSize first = it->first;
+            const VkDeviceSize end = first + it->second;
+            const VkDeviceSize start = (first + alignment - 1) / alignment * alignment;
+            if (start + requirements.size > end) {
+                continue;
+            }
+            block.free.erase(it);
+            if (start > first) {
+                block.free[first] = start - first;
+            }
+            if (start + requirements.size < end) {
+                block.free[start + requirements.size] = end - start - requirements.size;
+            }
+            allocation.memory = block.memory;
+            allocation.offset = start;
+            allocation.size = requirements.size;
+            allocation.mapped =
+                block.mapped ? static_cast<char*>(block.mapped) + start : nullptr;
+            return true;
+        }
+        return false;
+    }
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties properties_ = {};
+    std::vector<Block> blocks_;
+};
+
+// A buffer with its memory
+struct Buffer {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    Allocation memory;
+};
+
+// The vertices, and the indices after them, in one buffer
+struct Mesh {
+    Buffer buffer;
+    VkDeviceSize indexoffset = 0;
+    uint32_t indexcount = 0;
+};
+
+// The command buffers and the synchronisation of one frame in flight
+struct Frame {
+    VkCommandPool pool = VK_NULL_HANDLE;
+    VkCommandBuffer primary = VK_NULL_HANDLE;
+    std::vector<VkCommandPool> chunkpools;  // One per chunk of draws, recorded in parallel
+    std::vector<VkCommandBuffer> chunks;    // Secondary command buffers
+    VkFence fence = VK_NULL_HANDLE;         // Signalled when the GPU is done with the frame
+    VkSemaphore acquired = VK_NULL_HANDLE;  // The swapchain image may be drawn into
+    VkSemaphore rendered = VK_NULL_HANDLE;  // The image may be presented
+};
+
+// Push constants of vulkan_vertex.glsl
+struct DrawConstants {
+    Mat4 MVP;
+    Mat4 MV;
+};
+
+static_assert(sizeof(DrawConstants) == 128, "Vulkan guarantees 128 bytes of push constants");
+
+// The header that vkGetPipelineCacheData() writes first
+struct PipelineCacheHeader {
+    uint32_t length;
+    uint32_t version;
+    uint32_t vendor;
+    uint32_t device;
+    uint8_t uuid[VK_UUID_SIZE];
+};
+
+}  // namespace
+
+struct VulkanBackend::State {
+    GLFWwindow* window = nullptr;
+    VkInstance instance = VK_NULL_HANDLE;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    VkPhysicalDevice gpu = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties properties = {};
+    VkDevice device = VK_NULL_HANDLE;
+    uint32_t queuefamily = 0;
+    VkQueue queue = VK_NULL_HANDLE;
+    MemoryPool memory;
+    VkPipelineCache pipelinecache = VK_NULL_HANDLE;
+    VkCommandPool uploadpool = VK_NULL_HANDLE;
+
+    VkSurfaceFormatKHR surfaceformat = {};
+    VkFormat depthformat = VK_FORMAT_UNDEFINED;
+    VkRenderPass renderpass = VK_NULL_HANDLE;
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    VkExtent2D extent = {0, 0};
+    std::vector<VkImage> images;
+    std::vector<VkImageView> views;
+    std::vector<VkFramebuffer> framebuffers;
+    VkImage depthimage = VK_NULL_HANDLE;
+    Allocation depthmemory;
+    VkImageView depthview = VK_NULL_HANDLE;
+
+    VkPipelineLayout pipelinelayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+
+    Frame frames[framesInFlight];
+    int frame = 0;
+    std::vector<Mesh> meshes;
+
+    // A buffer of 'size' bytes with memory of 'flags'
+    bool createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags flags,
+                      Buffer& buffer) {
+        VkBufferCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        info.size = size;
+        info.usage = usage;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        if (!check(vkCreateBuffer(device, &info, nullptr, &buffer.buffer), "vkCreateBuffer()")) {
+            return false;
+        }
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device, buffer.buffer, &requirements);
+        if (!memory.allocate(requirements, flags, false, buffer.memory) ||
+            !check(vkBindBufferMemory(device, buffer.buffer, buffer.memory.memory,
+                                      buffer.memory.offset),
+                   "vkBindBufferMemory()")) {
+            destroyBuffer(buffer);
+            return false;
+        }
+        return true;
+    }
+
+    void destroyBuffer(Buffer& buffer) {
+        if (buffer.buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(device, buffer.buffer, nullptr);
+        }
+        memory.free(buffer.memory);
+        buffer = Buffer();
+    }
+};
+
+VulkanBackend::VulkanBackend() {}
+
+VulkanBackend::~VulkanBackend() { destroy(); }
+
+bool VulkanBackend::supported() { return glfwVulkanSupported() == GLFW_TRUE; }
+
+bool VulkanBackend::create(GLFWwindow* window, const std::string& pipelinecachefile) {
+    TRACE_SCOPE("create Vulkan device");
+    destroy();
+    if (!supported()) {
+        std::cerr << "VulkanBackend: GLFW found no Vulkan loader\n";
+        return false;
+    }
+    pipelinecachefile_ = pipelinecachefile;
+    state_.reset(new State());
+    State& s = *state_;
+    s.window = window;
+
+    // The functions without an instance first, and those of the instance after
+    if (!gladLoadVulkanUserPtr(nullptr, loadFunction, nullptr)) {
+        std::cerr << "VulkanBackend: the Vulkan functions could not be loaded\n";
+        destroy();
+        return false;
+    }
+    uint32_t extensioncount = 0;
+    const char** extensions = glfwGetRequiredInstanceExtensions(&extensioncount);
+    if (extensions == nullptr) {
+        std::cerr << "VulkanBackend: Vulkan can not draw to the windows of this platform\n";
+        destroy();
+        return false;
+    }
+    VkApplicationInfo application = {};
+    application.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    application.pApplicationName = "GLprimer";
+    application.apiVersion = VK_API_VERSION_1_1;
+    VkInstanceCreateInfo instanceinfo = {};
+    instanceinfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceinfo.pApplicationInfo = &application;
+    instanceinfo.enabledExtensionCount = extensioncount;
+    instanceinfo.ppEnabledExtensionNames = extensions;
+    if (!check(vkCreateInstance(&instanceinfo, nullptr, &s.instance), "vkCreateInstance()")) {
+        destroy();
+        return false;
+    }
+    gladLoadVulkanUserPtr(nullptr, loadFunction, s.instance);
+    if (!check(glfwCreateWindowSurface(s.instance, window, nullptr, &s.surface),
+               "glfwCreateWindowSurface()")) {
+        destroy();
+        return false;
+    }
+
+    // A Vulkan 1.1 device with a queue that draws and presents to the surface, and the
+    // first discrete GPU if there are several
+    uint32_t gpucount = 0;
+    vkEnumeratePhysicalDevices(s.instance, &gpucount, nullptr);
+    std::vector<VkPhysicalDevice> gpus(gpucount);
+    vkEnumeratePhysicalDevices(s.instance, &gpucount, gpus.data());
+    for (VkPhysicalDevice gpu : gpus) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(gpu, &properties);
+        if (properties.apiVersion < VK_API_VERSION_1_1) {
+            continue;
+        }
+        uint32_t count = 0;
+        vkEnumerateDeviceExtensionProperties(gpu, nullptr, &count, nullptr);
+        std::vector<VkExtensionProperties> available(count);
+        vkEnumerateDeviceExtensionProperties(gpu, nullptr, &count, available.data());
+        const bool swapchain =
+            std::any_of(available.begin(), available.end(), [](const VkExtensionProperties& e) {
+                return strcmp(e.extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0;
+            });
+        if (!swapchain) {
+            continue;
+        }
+        vkGetPhysicalDeviceQueueFamilyProperties(gpu, &count, nullptr);
+        std::vector<VkQueueFamilyProperties> families(count);
+        vkGetPhysicalDeviceQueueFamilyProperties(gpu, &count, families.data());
+        for (uint32_t f = 0; f < count; f++) {
+            VkBool32 present = VK_FALSE;
+            vkGetPhysicalDeviceSurfaceSupportKHR(gpu, f, s.surface, &present);
+            if (!(families[f].queueFlags & VK_QUEUE_GRAPHICS_BIT) || !present) {
+                continue;
+            }
+            if (s.gpu == VK_NULL_HANDLE ||
+                (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
+                 s.properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)) {
+                s.gpu = gpu;
+                s.properties = properties;
+                s.queuefamily = f;
+            }
+            break;
+        }
+    }
+    if (s.gpu == VK_NULL_HANDLE) {
+        std::cerr << "VulkanBackend: no Vulkan 1.1 device can draw to the window\n";
+        destroy();
+        return false;
+    }
+    gladLoadVulkanUserPtr(s.gpu, loadFunction, s.instance);
+
+    const float priority = 1.0f;
+    VkDeviceQueueCreateInfo queueinfo = {};
+    queueinfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueinfo.queueFamilyIndex = s.queuefamily;
+    queueinfo.queueCount = 1;
+    queueinfo.pQueuePriorities = &priority;
+    const char* deviceextensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    VkDeviceCreateInfo deviceinfo = {};
+    deviceinfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceinfo.queueCreateInfoCount = 1;
+    deviceinfo.pQueueCreateInfos = &queueinfo;
+    deviceinfo.enabledExtensionCount = 1;
+    deviceinfo.ppEnabledExtensionNames = deviceextensions;
+    if (!check(vkCreateDevice(s.gpu, &deviceinfo, nullptr, &s.device), "vkCreateDevice()")) {
+        destroy();
+        return false;
+    }
+    vkGetDeviceQueue(s.device, s.queuefamily, 0, &s.queue);
+    s.memory.init(s.device, s.gpu);
+    std::cout << "Vulkan device:    " << s.properties.deviceName << "\n";
+
+    // The cache of an earlier run, if the same driver on the same device wrote it
+    MappedFile cachefile;
+    VkPipelineCacheCreateInfo cacheinfo = {};
+    cacheinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    if (!pipelinecachefile_.empty() && cachefile.open(pipelinecachefile_) &&
+        cachefile.size() >= sizeof(PipelineCacheHeader)) {
+        PipelineCacheHeader header;
+        memcpy(&header, cachefile.data(), sizeof(header));
+        if (header.vendor == s.properties.vendorID && header.device == s.properties.deviceID &&
+            memcmp(header.uuid, s.properties.pipelineCacheUUID, VK_UUID_SIZE) == 0) {
+            cacheinfo.initialDataSize = cachefile.size();
+            cacheinfo.pInitialData = cachefile.data();
+        }
+    }
+    if (!check(vkCreatePipelineCache(s.device, &cacheinfo, nullptr, &s.pipelinecache),
+               "vkCreatePipelineCache()")) {
+        destroy();
+        return false;
+    }
+    cachefile.close();
+
+    // The formats of the render pass, which stay the same when the swapchain is recreated
+    uint32_t formatcount = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(s.gpu, s.surface, &formatcount, nullptr);
+    std::vector<VkSurfaceFormatKHR> formats(formatcount);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(s.gpu, s.surface, &formatcount, formats.data());
+    if (formats.empty()) {
+        std::cerr << "VulkanBackend: the surface has no formats\n";
+        destroy();
+        return false;
+    }
+    // Not sRGB, as the default framebuffer of the OpenGL path
+    s.surfaceformat = formats[0];
+    for (const VkSurfaceFormatKHR& format : formats) {
+        if (format.format == VK_FORMAT_B8G8R8A8_UNORM ||
+            format.format == VK_FORMAT_R8G8B8A8_UNORM) {
+            s.surfaceformat = format;
+            break;
+        }
+    }
+    for (VkFormat format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32,
+                            VK_FORMAT_D24_UNORM_S8_UINT}) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(s.gpu, format, &properties);
+        if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+            s.depthformat = format;
+            break;
+        }
+    }
+
+    VkAttachmentDescription attachments[2] = {};
+    attachments[0].format = s.surfaceformat.format;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attachments[1] = attachments[0];
+    attachments[1].format = s.depthformat;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    VkAttachmentReference color = {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkAttachmentReference depth = {1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color;
+    subpass.pDepthStencilAttachment = &depth;
+    // The attachments are written after the last frame that used them is done with them
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                              VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                              VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    VkRenderPassCreateInfo passinfo = {};
+    passinfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    passinfo.attachmentCount = 2;
+    passinfo.pAttachments = attachments;
+    passinfo.subpassCount = 1;
+    passinfo.pSubpasses = &subpass;
+    passinfo.dependencyCount = 1;
+    passinfo.pDependencies = &dependency;
+    if (s.depthformat == VK_FORMAT_UNDEFINED ||
+        !check(vkCreateRenderPass(s.device, &passinfo, nullptr, &s.renderpass),
+               "vkCreateRenderPass()")) {
+        destroy();
+        return false;
+    }
+
+    // A command pool for each chunk of each frame, so that the chunks are recorded on
+    // any thread without locks
+    const unsigned int chunks = std::max(ThreadPool::global().size(), 1u);
+    VkCommandPoolCreateInfo poolinfo = {};
+    poolinfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolinfo.queueFamilyIndex = s.queuefamily;
+    poolinfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    VkCommandBufferAllocateInfo bufferinfo = {};
+    bufferinfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    bufferinfo.commandBufferCount = 1;
+    VkFenceCreateInfo fenceinfo = {};
+    fenceinfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceinfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    VkSemaphoreCreateInfo semaphoreinfo = {};
+    semaphoreinfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    bool ok = check(vkCreateCommandPool(s.device, &poolinfo, nullptr, &s.uploadpool),
+                    "vkCreateCommandPool()");
+    for (Frame& frame : s.frames) {
+        ok = ok && check(vkCreateCommandPool(s.device, &poolinfo, nullptr, &frame.pool),
+                         "vkCreateCommandPool()");
+        bufferinfo.commandPool = frame.pool;
+        bufferinfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        ok = ok && check(vkAllocateCommandBuffers(s.device, &bufferinfo, &frame.primary),
+                         "vkAllocateCommandBuffers()");
+        frame.chunkpools.assign(chunks, VK_NULL_HANDLE);
+        frame.chunks.assign(chunks, VK_NULL_HANDLE);
+        for (unsigned int c = 0; c < chunks && ok; c++) {
+            ok = check(vkCreateCommandPool(s.device, &poolinfo, nullptr, &frame.chunkpools[c]),
+                       "vkCreateCommandPool()");
+            bufferinfo.commandPool = frame.chunkpools[c];
+            bufferinfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            ok = ok && check(vkAllocateCommandBuffers(s.device, &bufferinfo, &frame.chunks[c]),
+                             "vkAllocateCommandBuffers()");
+        }
+        ok = ok && check(vkCreateFence(s.device, &fenceinfo, nullptr, &frame.fence),
+                         "vkCreateFence()");
+        ok = ok && check(vkCreateSemaphore(s.device, &semaphoreinfo, nullptr, &frame.acquired),
+                         "vkCreateSemaphore()");
+        ok = ok && check(vkCreateSemaphore(s.device, &semaphoreinfo, nullptr, &frame.rendered),
+                         "vkCreateSemaphore()");
+    }
+    if (!ok || !createSwapchain()) {
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+bool VulkanBackend::createSwapchain() {
+    State& s = *state_;
+    VkSurfaceCapabilitiesKHR capabilities;
+    if (!check(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(s.gpu, s.surface, &capabilities),
+               "vkGetPhysicalDeviceSurfaceCapabilitiesKHR()")) {
+        return false;
+    }
+    VkExtent2D extent = capabilities.currentExtent;
+    if (extent.width == UINT32_MAX) {
+        // The surface takes the size of the swapchain
+        int width = 0;
+        int height = 0;
+        glfwGetFramebufferSize(s.window, &width, &height);
+        extent.width = std::min(std::max(uint32_t(std::max(width, 0)),
+                                         capabilities.minImageExtent.width),
+                                capabilities.maxImageExtent.width);
+        extent.height = std::min(std::max(uint32_t(std::max(height, 0)),
+                                          capabilities.minImageExtent.height),
+                                 capabilities.maxImageExtent.height);
+    }
+    s.extent = extent;
+    if (extent.width == 0 || extent.height == 0) {
+        return true;  // Minimized, drawFrame() tries again
+    }
+    uint32_t imagecount = capabilities.minImageCount + 1;
+    if (capabilities.maxImageCount > 0) {
+        imagecount = std::min(imagecount, capabilities.maxImageCount);
+    }
+    VkSwapchainCreateInfoKHR info = {};
+    info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    info.surface = s.surface;
+    info.minImageCount = imagecount;
+    info.imageFormat = s.surfaceformat.format;
+    info.imageColorSpace = s.surfaceformat.colorSpace;
+    info.imageExtent = extent;
+    info.imageArrayLayers = 1;
+    info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    info.preTransform = capabilities.currentTransform;
+    info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    info.presentMode = VK_PRESENT_MODE_FIFO_KHR;  // The only one every driver has
+    info.clipped = VK_TRUE;
+    if (!check(vkCreateSwapchainKHR(s.device, &info, nullptr, &s.swapchain),
+               "vkCreateSwapchainKHR()")) {
+        s.swapchain = VK_NULL_HANDLE;
+        return false;
+    }
+    vkGetSwapchainImagesKHR(s.device, s.swapchain, &imagecount, nullptr);
+    s.images.resize(imagecount);
+    vkGetSwapchainImagesKHR(s.device, s.swapchain, &imagecount, s.images.data());
+
+    VkImageViewCreateInfo viewinfo = {};
+    viewinfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewinfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewinfo.subresourceRange.levelCount = 1;
+    viewinfo.subresourceRange.layerCount = 1;
+
+    // The depth buffer, from the memory pool
+    VkImageCreateInfo depthinfo = {};
+    depthinfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    depthinfo.imageType = VK_IMAGE_TYPE_2D;
+    depthinfo.format = s.depthformat;
+    depthinfo.extent = {extent.width, extent.height, 1};
+    depthinfo.mipLevels = 1;
+    depthinfo.arrayLayers = 1;
+    depthinfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthinfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    depthinfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    depthinfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (!check(vkCreateImage(s.device, &depthinfo, nullptr, &s.depthimage), "vkCreateImage()")) {
+        return false;
+    }
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(s.device, s.depthimage, &requirements);
+    if (!s.memory.allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true,
+                           s.depthmemory) ||
+        !check(vkBindImageMemory(s.device, s.depthimage, s.depthmemory.memory,
+                                 s.depthmemory.offset),
+               "vkBindImageMemory()")) {
+        return false;
+    }
+    viewinfo.image = s.depthimage;
+    viewinfo.format = s.depthformat;
+    viewinfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (!check(vkCreateImageView(s.device, &viewinfo, nullptr, &s.depthview),
+               "vkCreateImageView()")) {
+        return false;
+    }
+
+    viewinfo.format = s.surfaceformat.format;
+    viewinfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    s.views.assign(imagecount, VK_NULL_HANDLE);
+    s.framebuffers.assign(imagecount, VK_NULL_HANDLE);
+    for (uint32_t i = 0; i < imagecount; i++) {
+        viewinfo.image = s.images[i];
+        if (!check(vkCreateImageView(s.device, &viewinfo, nullptr, &s.views[i]),
+                   "vkCreateImageView()")) {
+            return false;
+        }
+        const VkImageView views[2] = {s.views[i], s.depthview};
+        VkFramebufferCreateInfo framebufferinfo = {};
+        framebufferinfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferinfo.renderPass = s.renderpass;
+        framebufferinfo.attachmentCount = 2;
+        framebufferinfo.pAttachments = views;
+        framebufferinfo.width = extent.width;
+        framebufferinfo.height = extent.height;
+        framebufferinfo.layers = 1;
+        if (!check(vkCreateFramebuffer(s.device, &framebufferinfo, nullptr, &s.framebuffers[i]),
+                   "vkCreateFramebuffer()")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void VulkanBackend::destroySwapchain() {
+    State& s = *state_;
+    for (VkFramebuffer framebuffer : s.framebuffers) {
+        if (framebuffer != VK_NULL_HANDLE) {
+            vkDestroyFramebuffer(s.device, framebuffer, nullptr);
+        }
+    }
+    for (VkImageView view : s.views) {
+        if (view != VK_NULL_HANDLE) {
+            vkDestroyImageView(s.device, view, nullptr);
+        }
+    }
+    s.framebuffers.clear();
+    s.views.clear();
+    s.images.clear();
+    if (s.depthview != VK_NULL_HANDLE) {
+        vkDestroyImageView(s.device, s.depthview, nullptr);
+        s.depthview = VK_NULL_HANDLE;
+    }
+    if (s.depthimage != VK_NULL_HANDLE) {
+        vkDestroyImage(s.device, s.depthimage, nullptr);
+        s.depthimage = VK_NULL_HANDLE;
+    }
+    s.memory.free(s.depthmemory);
+    if (s.swapchain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(s.device, s.swapchain, nullptr);
+        s.swapchain = VK_NULL_HANDLE;
+    }
+}
+
+void VulkanBackend::destroy() {
+    if (!state_) {
+        return;
+    }
+    State& s = *state_;
+    if (s.device != VK_NULL_HANDLE) {
+        vkDeviceWaitIdle(s.device);
+        // Kept for the next run. Not an error if it can not be written.
+        size_t size = 0;
+        if (s.pipelinecache != VK_NULL_HANDLE && !pipelinecachefile_.empty() &&
+            vkGetPipelineCacheData(s.device, s.pipelinecache, &size, nullptr) == VK_SUCCESS &&
+            size > 0) {
+            std::vector<char> data(size);
+            vkGetPipelineCacheData(s.device, s.pipelinecache, &size, data.data());
+            FILE* output = fopen(pipelinecachefile_.c_str(), "wb");
+            if (output) {
+                const bool ok = fwrite(data.data(), 1, size, output) == size;
+                if (fclose(output) != 0 || !ok) {
+                    std::remove(pipelinecachefile_.c_str());
+                }
+            }
+        }
+        for (Mesh& mesh : s.meshes) {
+            s.destroyBuffer(mesh.buffer);
+        }
+        s.meshes.clear();
+        if (s.pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(s.device, s.pipeline, nullptr);
+        }
+        if (s.pipelinelayout != VK_NULL_HANDLE) {
+            vkDestroyPipelineLayout(s.device, s.pipelinelayout, nullptr);
+        }
+        destroySwapchain();
+        if (s.renderpass != VK_NULL_HANDLE) {
+            vkDestroyRenderPass(s.device, s.renderpass, nullptr);
+        }
+        // Destroying a pool frees its command buffers
+        for (Frame& frame : s.frames) {
+            for (VkCommandPool pool : frame.chunkpools) {
+                if (pool != VK_NULL_HANDLE) {
+                    vkDestroyCommandPool(s.device, pool, nullptr);
+                }
+            }
+            if (frame.pool != VK_NULL_HANDLE) {
+                vkDestroyCommandPool(s.device, frame.pool, nullptr);
+            }
+            if (frame.fence != VK_NULL_HANDLE) {
+                vkDestroyFence(s.device, frame.fence, nullptr);
+            }
+            if (frame.acquired != VK_NULL_HANDLE) {
+                vkDestroySemaphore(s.device, frame.acquired, nullptr);
+            }
+            if (frame.rendered != VK_NULL_HANDLE) {
+                vkDestroySemaphore(s.device, frame.rendered, nullptr);
+            }
+        }
+        if (s.uploadpool != VK_NULL_HANDLE) {
+            vkDestroyCommandPool(s.device, s.uploadpool, nullptr);
+        }
+        if (s.pipelinecache != VK_NULL_HANDLE) {
+            vkDestroyPipelineCache(s.device, s.pipelinecache, nullptr);
+        }
+        s.memory.destroy();
+        vkDestroyDevice(s.device, nullptr);
+    }
+    if (s.surface != VK_NULL_HANDLE) {
+        vkDestroySurfaceKHR(s.instance, s.surface, nullptr);
+    }
+    if (s.instance != VK_NULL_HANDLE) {
+        vkDestroyInstance(s.instance, nullptr);
+    }
+    state_.reset();
+}
+
+int VulkanBackend::addMesh(const std::vector<float>& vertices,
+                           const std::vector<unsigned int>& indices) {
+    TRACE_SCOPE("upload mesh");
+    if (!state_) {
+        std::cerr << "VulkanBackend::addMesh(): create() the backend first\n";
+        return -1;
+    }
+    const size_t nverts = vertices.size() / 8;
+    if (vertices.size() % 8 != 0 || indices.empty() || indices.size() % 3 != 0 ||
+        *std::max_element(indices.begin(), indices.end()) >= nverts) {
+        std::cerr << "VulkanBackend::addMesh(): not 8 floats per vertex and triangles of "
+                     "valid indices\n";
+        return -1;
+    }
+    State& s = *state_;
+    const VkDeviceSize vertexbytes = vertices.size() * sizeof(float);
+    const VkDeviceSize indexbytes = indices.size() * sizeof(unsigned int);
+    Mesh mesh;
+    mesh.indexoffset = vertexbytes;
+    mesh.indexcount = static_cast<uint32_t>(indices.size());
+    Buffer staging;
+    if (!s.createBuffer(vertexbytes + indexbytes,
+                        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.buffer) ||
+        !s.createBuffer(vertexbytes + indexbytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        staging)) {
+        s.destroyBuffer(mesh.buffer);
+        return -1;
+    }
+    memcpy(staging.memory.mapped, vertices.data(), vertexbytes);
+    memcpy(static_cast<char*>(staging.memory.mapped) + vertexbytes, indices.data(), indexbytes);
+
+    // Copied to device memory by the GPU, which is waited for
+    VkCommandBufferAllocateInfo bufferinfo = {};
+    bufferinfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    bufferinfo.commandPool = s.uploadpool;
+    bufferinfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    bufferinfo.commandBufferCount = 1;
+    VkCommandBuffer commands = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    VkFenceCreateInfo fenceinfo = {};
+    fenceinfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    bool ok = check(vkAllocateCommandBuffers(s.device, &bufferinfo, &commands),
+                    "vkAllocateCommandBuffers()") &&
+              check(vkCreateFence(s.device, &fenceinfo, nullptr, &fence), "vkCreateFence()");
+    if (ok) {
+        VkCommandBufferBeginInfo begin = {};
+        begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commands, &begin);
+        VkBufferCopy region = {0, 0, vertexbytes + indexbytes};
+        vkCmdCopyBuffer(commands, staging.buffer, mesh.buffer.buffer, 1, &region);
+        vkEndCommandBuffer(commands);
+        VkSubmitInfo submit = {};
+        submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit.commandBufferCount = 1;
+        submit.pCommandBuffers = &commands;
+        ok = check(vkQueueSubmit(s.queue, 1, &submit, fence), "vkQueueSubmit()") &&
+             check(vkWaitForFences(s.device, 1, &fence, VK_TRUE, UINT64_MAX),
+                   "vkWaitForFences()");
+    }
+    if (fence != VK_NULL_HANDLE) {
+        vkDestroyFence(s.device, fence, nullptr);
+    }
+    if (commands != VK_NULL_HANDLE) {
+        vkFreeCommandBuffers(s.device, s.uploadpool, 1, &commands);
+    }
+    s.destroyBuffer(staging);
+    if (!ok) {
+        s.destroyBuffer(mesh.buffer);
+        return -1;
+    }
+    s.meshes.push_back(mesh);
+    return static_cast<int>(s.meshes.size()) - 1;
+}
+
+bool VulkanBackend::createPipeline(const std::string& vertexfile,
+                                   const std::string& fragmentfile) {
+    TRACE_SCOPE("create pipeline");
+    if (!state_) {
+        std::cerr << "VulkanBackend::createPipeline(): create() the backend first\n";
+        return false;
+    }
+    State& s = *state_;
+    VkShaderModule modules[2] = {VK_NULL_HANDLE, VK_NULL_HANDLE};
+    const std::string* files[2] = {&vertexfile, &fragmentfile};
+    bool ok = true;
+    for (int i = 0; i < 2 && ok; i++) {
+        MappedFile file;
+        if (!file.open(*files[i]) || file.size() == 0 || file.size() % 4 != 0) {
+            std::cerr << "VulkanBackend: no SPIR-V in '" << *files[i]
+                      << "', which the build makes with glslangValidator\n";
+            ok = false;
+            break;
+        }
+        // Copied, as the code must be aligned to 4 bytes
+        std::vector<uint32_t> code(file.size() / 4);
+        memcpy(code.data(), file.data(), file.size());
+        VkShaderModuleCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        info.codeSize = file.size();
+        info.pCode = code.data();
+        ok = check(vkCreateShaderModule(s.device, &info, nullptr, &modules[i]),
+                   "vkCreateShaderModule()");
+    }
+
+    if (ok && s.pipelinelayout == VK_NULL_HANDLE) {
+        VkPushConstantRange constants = {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawConstants)};
+        VkPipelineLayoutCreateInfo layoutinfo = {};
+        layoutinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutinfo.pushConstantRangeCount = 1;
+        layoutinfo.pPushConstantRanges = &constants;
+        ok = check(vkCreatePipelineLayout(s.device, &layoutinfo, nullptr, &s.pipelinelayout),
+                   "vkCreatePipelineLayout()");
+    }
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (ok) {
+        VkPipelineShaderStageCreateInfo stages[2] = {};
+        for (int i = 0; i < 2; i++) {
+            stages[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            stages[i].stage = i == 0 ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_FRAGMENT_BIT;
+            stages[i].module = modules[i];
+            stages[i].pName = "main";
+        }
+        // The interleaved vertices of TriangleSoup: xyz, normal, st
+        VkVertexInputBindingDescription binding = {0, 8 * sizeof(float),
+                                                   VK_VERTEX_INPUT_RATE_VERTEX};
+        VkVertexInputAttributeDescription attributes[3] = {
+            {0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0},
+            {1, 0, VK_FORMAT_R32G32B32_SFLOAT, 3 * sizeof(float)},
+            {2, 0, VK_FORMAT_R32G32_SFLOAT, 6 * sizeof(float)},
+        };
+        VkPipelineVertexInputStateCreateInfo input = {};
+        input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        input.vertexBindingDescriptionCount = 1;
+        input.pVertexBindingDescriptions = &binding;
+        input.vertexAttributeDescriptionCount = 3;
+        input.pVertexAttributeDescriptions = attributes;
+        VkPipelineInputAssemblyStateCreateInfo assembly = {};
+        assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        // Set when drawing, so that the pipeline outlives the swapchain
+        VkPipelineViewportStateCreateInfo viewport = {};
+        viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewport.viewportCount = 1;
+        viewport.scissorCount = 1;
+        const VkDynamicState dynamic[2] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamicinfo = {};
+        dynamicinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicinfo.dynamicStateCount = 2;
+        dynamicinfo.pDynamicStates = dynamic;
+        VkPipelineRasterizationStateCreateInfo raster = {};
+        raster.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        raster.polygonMode = VK_POLYGON_MODE_FILL;
+        raster.cullMode = VK_CULL_MODE_NONE;
+        raster.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        raster.lineWidth = 1.0f;
+        VkPipelineMultisampleStateCreateInfo multisample = {};
+        multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        VkPipelineDepthStencilStateCreateInfo depth = {};
+        depth.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depth.depthTestEnable = VK_TRUE;
+        depth.depthWriteEnable = VK_TRUE;
+        depth.depthCompareOp = VK_COMPARE_OP_LESS;
+        VkPipelineColorBlendAttachmentState blend = {};
+        blend.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                               VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        VkPipelineColorBlendStateCreateInfo blendinfo = {};
+        blendinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        blendinfo.attachmentCount = 1;
+        blendinfo.pAttachments = &blend;
+        VkGraphicsPipelineCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        info.stageCount = 2;
+        info.pStages = stages;
+        info.pVertexInputState = &input;
+        info.pInputAssemblyState = &assembly;
+        info.pViewportState = &viewport;
+        info.pRasterizationState = &raster;
+        info.pMultisampleState = &multisample;
+        info.pDepthStencilState = &depth;
+        info.pColorBlendState = &blendinfo;
+        info.pDynamicState = &dynamicinfo;
+        info.layout = s.pipelinelayout;
+        info.renderPass = s.renderpass;
+        info.subpass = 0;
+        ok = check(vkCreateGraphicsPipelines(s.device, s.pipelinecache, 1, &info, nullptr,
+                                             &pipeline),
+                   "vkCreateGraphicsPipelines()");
+    }
+    for (VkShaderModule module : modules) {
+        if (module != VK_NULL_HANDLE) {
+            vkDestroyShaderModule(s.device, module, nullptr);
+        }
+    }
+    if (!ok) {
+        return false;
+    }
+    if (s.pipeline != VK_NULL_HANDLE) {
+        vkDeviceWaitIdle(s.device);  // The frames in flight may still use the old one
+        vkDestroyPipeline(s.device, s.pipeline, nullptr);
+    }
+    s.pipeline = pipeline;
+    return true;
+}
+
+bool VulkanBackend::drawFrame(const Mat4& P, const std::vector<Draw>& draws) {
+    TRACE_SCOPE("draw frame");
+    if (!state_ || state_->pipeline == VK_NULL_HANDLE) {
+        std::cerr << "VulkanBackend::drawFrame(): no device or no pipeline\n";
+        return false;
+    }
+    State& s = *state_;
+    int width = 0;
+    int height = 0;
+    glfwGetFramebufferSize(s.window, &width, &height);
+    if (s.swapchain == VK_NULL_HANDLE || uint32_t(width) != s.extent.width ||
+        uint32_t(height) != s.extent.height) {
+        vkDeviceWaitIdle(s.device);
+        destroySwapchain();
+        if (!createSwapchain()) {
+            return false;
+        }
+        if (s.swapchain == VK_NULL_HANDLE) {
+            return true;  // Minimized, nothing to draw into
+        }
+    }
+
+    Frame& frame = s.frames[s.frame];
+    if (!check(vkWaitForFences(s.device, 1, &frame.fence, VK_TRUE, UINT64_MAX),
+               "vkWaitForFences()")) {
+        return false;
+    }
+    uint32_t image = 0;
+    VkResult result = vkAcquireNextImageKHR(s.device, s.swapchain, UINT64_MAX, frame.acquired,
+                                            VK_NULL_HANDLE, &image);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        s.extent = {0, 0};  // Recreated by the next frame
+        return true;
+    }
+    if (result != VK_SUBOPTIMAL_KHR && !check(result, "vkAcquireNextImageKHR()")) {
+        return false;
+    }
+    vkResetFences(s.device, 1, &frame.fence);
+
+    // Each chunk of draws is recorded on some thread of the pool into a secondary command
+    // buffer of its own, which continues the render pass of the primary one
+    const size_t chunks = frame.chunks.size();
+    const size_t perchunk = (draws.size() + chunks - 1) / chunks;
+    const int used = perchunk > 0 ? static_cast<int>((draws.size() + perchunk - 1) / perchunk)
+                                  : 0;
+    const Mat4* projection = &P;
+    ThreadPool::global().parallelFor(used, [&](int c) {
+        TRACE_SCOPE("record commands");
+        vkResetCommandPool(s.device, frame.chunkpools[c], 0);
+        VkCommandBuffer commands = frame.chunks[c];
+        VkCommandBufferInheritanceInfo inheritance = {};
+        inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritance.renderPass = s.renderpass;
+        inheritance.subpass = 0;
+        inheritance.framebuffer = s.framebuffers[image];
+        VkCommandBufferBeginInfo begin = {};
+        begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                      VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        begin.pInheritanceInfo = &inheritance;
+        vkBeginCommandBuffer(commands, &begin);
+        // Flipped, so that y points up in clip space as in OpenGL
+        VkViewport viewport = {0.0f, float(s.extent.height), float(s.extent.width),
+                               -float(s.extent.height), 0.0f, 1.0f};
+        VkRect2D scissor = {{0, 0}, s.extent};
+        vkCmdSetViewport(commands, 0, 1, &viewport);
+        vkCmdSetScissor(commands, 0, 1, &scissor);
+        vkCmdBindPipeline(commands, VK_PIPELINE_BIND_POINT_GRAPHICS, s.pipeline);
+        int bound = -1;
+        const size_t end = std::min(draws.size(), (size_t(c) + 1) * perchunk);
+        for (size_t d = size_t(c) * perchunk; d < end; d++) {
+            const Draw& draw = draws[d];
+            if (draw.mesh < 0 || draw.mesh >= static_cast<int>(s.meshes.size())) {
+                continue;
+            }
+            const Mesh& mesh = s.meshes[draw.mesh];
+            if (draw.mesh != bound) {
+                const VkDeviceSize offset = 0;
+                vkCmdBindVertexBuffers(commands, 0, 1, &mesh.buffer.buffer, &offset);
+                vkCmdBindIndexBuffer(commands, mesh.buffer.buffer, mesh.indexoffset,
+                                     VK_INDEX_TYPE_UINT32);
+                bound = draw.mesh;
+            }
+            const DrawConstants constants = {*projection * draw.MV, draw.MV};
+            vkCmdPushConstants(commands, s.pipelinelayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                               sizeof(constants), &constants);
+            vkCmdDrawIndexed(commands, mesh.indexcount, 1, 0, 0, 0);
+        }
+        vkEndCommandBuffer(commands);
+    });
+
+    vkResetCommandPool(s.device, frame.pool, 0);
+    VkCommandBufferBeginInfo begin = {};
+    begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(frame.primary, &begin);
+    VkClearValue clear[2] = {};
+    clear[1].depthStencil = {1.0f, 0};
+    VkRenderPassBeginInfo pass = {};
+    pass.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    pass.renderPass = s.renderpass;
+    pass.framebuffer = s.framebuffers[image];
+    pass.renderArea = {{0, 0}, s.extent};
+    pass.clearValueCount = 2;
+    pass.pClearValues = clear;
+    vkCmdBeginRenderPass(frame.primary, &pass, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    if (used > 0) {
+        vkCmdExecuteCommands(frame.primary, uint32_t(used), frame.chunks.data());
+    }
+    vkCmdEndRenderPass(frame.primary);
+    vkEndCommandBuffer(frame.primary);
+
+    const VkPipelineStageFlags wait = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkSubmitInfo submit = {};
+    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit.waitSemaphoreCount = 1;
+    submit.pWaitSemaphores = &frame.acquired;
+    submit.pWaitDstStageMask = &wait;
+    submit.commandBufferCount = 1;
+    submit.pCommandBuffers = &frame.primary;
+    submit.signalSemaphoreCount = 1;
+    submit.pSignalSemaphores = &frame.rendered;
+    if (!check(vkQueueSubmit(s.queue, 1, &submit, frame.fence), "vkQueueSubmit()")) {
+        return false;
+    }
+    VkPresentInfoKHR present = {};
+    present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present.waitSemaphoreCount = 1;
+    present.pWaitSemaphores = &frame.rendered;
+    present.swapchainCount = 1;
+    present.pSwapchains = &s.swapchain;
+    present.pImageIndices = &image;
+    result = vkQueuePresentKHR(s.queue, &present);
+    s.frame = (s.frame + 1) % framesInFlight;
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+        s.extent = {0, 0};
+        return true;
+    }
+    return check(result, "vkQueuePresentKHR()");
+}
+
+int VulkanBackend::width() const { return state_ ? static_cast<int>(state_->extent.width) : 0; }
+
+int VulkanBackend::height() const {
+    return state_ ? static_cast<int>(state_->extent.height) : 0;
+}
+
+size_t VulkanBackend::memoryBytes() const {
+    return state_ ? static_cast<size_t>(state_->memory.bytes()) : 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * A Vulkan renderer for the meshes of the program, the alternative to the OpenGL path on
+ * platforms where the GL driver costs more CPU time than the drawing.
+ *
+ * Usage: Create the window with the hint GLFW_CLIENT_API set to GLFW_NO_API, and call
+ *        create() with it, which is false, with a message, if there is no Vulkan 1.1 driver
+ *        with a queue that can draw to the window. The program then falls back to OpenGL,
+ *        as GLprimer does for "--backend vulkan". The Vulkan functions are loaded through
+ *        GLFW with the glad loader that GLFW ships, so nothing of Vulkan is needed to build.
+ *        addMesh() uploads the vertex and index arrays of a TriangleSoup, 8 floats per
+ *        vertex as TriangleSoup::vertices(), and createPipeline() the SPIR-V of
+ *        vulkan_vertex.glsl and vulkan_fragment.glsl, which the build compiles when it finds
+ *        glslangValidator. drawFrame() then draws a list of meshes with their matrices.
+ *        The device memory is taken in blocks of 64 MB per memory type and handed out by
+ *        a free list to the buffers and images, so a mesh is not an allocation of its own.
+ *        The pipelines are created through a pipeline cache that is read from a file by
+ *        create() and written back by the destructor, so the driver compiles the shaders
+ *        once. The draws are split into one secondary command buffer per thread of
+ *        ThreadPool::global(), recorded in parallel from command pools of their own, and
+ *        executed by one primary command buffer. Two frames are in flight.
+ *        Use the object on one thread only. drawFrame() waits for the frame that used the
+ *        same command buffers two frames earlier.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Mat4.hpp"
+
+class VulkanBackend {
+public:
+    // A mesh of addMesh() with its model-view matrix
+    struct Draw {
+        int mesh;
+        Mat4 MV;
+    };
+
+    VulkanBackend();
+
+    /* Destructor: write the pipeline cache and destroy everything, after the GPU is done */
+    ~VulkanBackend();
+
+    VulkanBackend(const VulkanBackend&) = delete;
+    VulkanBackend& operator=(const VulkanBackend&) = delete;
+
+    // True if GLFW found a Vulkan loader
+    static bool supported();
+
+    /* Create the instance, the device and the swapchain for 'window'. The pipeline cache is
+     * read from 'pipelinecachefile' if it exists and was written by the same driver. */
+    bool create(GLFWwindow* window, const std::string& pipelinecachefile);
+
+    /* Upload a mesh of 8 floats per vertex (xyz, normal, st) and triangle indices. Returns
+     * the mesh for Draw, -1 on failure. */
+    int addMesh(const std::vector<float>& vertices, const std::vector<unsigned int>& indices);
+
+    /* Create the pipeline from the SPIR-V files of a vertex and a fragment shader */
+    bool createPipeline(const std::string& vertexfile, const std::string& fragmentfile);
+
+    /* Draw 'draws' with the projection 'P' into the next image of the swapchain, and
+     * present it. False if the device was lost or there is no pipeline. */
+    bool drawFrame(const Mat4& P, const std::vector<Draw>& draws);
+
+    // Width and height of the swapchain images
+    int width() const;
+    int height() const;
+
+    // Bytes of device memory taken by the memory blocks
+    size_t memoryBytes() const;
+
+private:
+    struct State;
+
+    bool createSwapchain();
+    void destroySwapchain();
+    void destroy();
+
+    std::unique_ptr<State> state_;
+    std::string pipelinecachefile_;
+};
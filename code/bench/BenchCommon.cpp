@@ -0,0 +1,84 @@
+/*
+ * Helpers shared by the benchmark programs
+ *
+ * This code is in the public domain.
+ */
+#if defined(WIN32) && !defined(_USE_MATH_DEFINES)
+#define _USE_MATH_DEFINES
+#endif
+
+#include <GL/glew.h>
+
+#include "BenchCommon.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+
+namespace bench {
+
+GLFWwindow* createContext(const char* title) {
+    if (!glfwInit()) {
+        std::cerr << "Unable to initialise GLFW\n";
+        return nullptr;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);  // Only for the context
+    GLFWwindow* window = glfwCreateWindow(64, 64, title, nullptr, nullptr);
+    if (!window) {
+        std::cerr << "Unable to create a GL context\n";
+        glfwTerminate();
+        return nullptr;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);  // Nothing is shown, but no vsync in any case
+    glewExperimental = GL_TRUE;
+    if (glewInit() != GLEW_OK) {
+        std::cerr << "Unable to initialise GLEW\n";
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return nullptr;
+    }
+    return window;
+}
+
+bool writeSphereOBJ(const std::string& filename, int segments) {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file) {
+        std::cerr << "Could not create " << filename << "\n";
+        return false;
+    }
+    const int rings = segments / 2;
+    for (int j = 0; j <= rings; j++) {
+        const double theta = M_PI * j / rings;
+        for (int i = 0; i <= segments; i++) {
+            const double phi = 2.0 * M_PI * i / segments;
+            const double x = sin(theta) * cos(phi);
+            const double y = cos(theta);
+            const double z = sin(theta) * sin(phi);
+            fprintf(file, "v %.6f %.6f %.6f\nvn %.6f %.6f %.6f\nvt %.6f %.6f\n", x, y, z, x,
+                    y, z, double(i) / segments, 1.0 - double(j) / rings);
+        }
+    }
+    for (int j = 0; j < rings; j++) {
+        for (int i = 0; i < segments; i++) {
+            const int a = j * (segments + 1) + i + 1;  // OBJ indices start at 1
+            const int b = a + segments + 1;
+            fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, a + 1, a + 1,
+                    a + 1);
+            fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a + 1, a + 1, a + 1, b, b, b,
+                    b + 1, b + 1, b + 1);
+        }
+    }
+    return fclose(file) == 0;
+}
+
+std::string temporaryFile(const std::string& name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+}  // namespace bench
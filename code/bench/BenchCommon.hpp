@@ -0,0 +1,24 @@
+/*
+ * Helpers shared by the benchmark programs in this directory
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <string>
+
+namespace bench {
+
+/* Create a hidden window for an OpenGL 3.3 core context, make it current without vsync and
+ * initialise GLEW. Returns nullptr, after printing why, if that fails. */
+GLFWwindow* createContext(const char* title);
+
+/* Write a UV sphere with positions, normals and texture coordinates as an OBJ file, with
+ * about segments * segments triangles */
+bool writeSphereOBJ(const std::string& filename, int segments);
+
+// A file name in the temporary directory
+std::string temporaryFile(const std::string& name);
+
+}  // namespace bench
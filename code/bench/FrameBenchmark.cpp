@@ -0,0 +1,438 @@
+/*
+ * tnm046-bench: renders scripted scenes for a fixed number of frames and writes the frame
+ * times as JSON, to compare the performance of two builds.
+ *
+ * Usage: tnm046-bench [--scene <scene>]... [--frames <n>] [--warmup <n>] [--size <w>x<h>]
+ *                     [--obj <file>] [--aa <mode>]... [--output <file.json>]
+ *        The results go to tnm046-bench.json unless --output says otherwise; standard output
+ *        has the log of the OBJ loader. Build with CMAKE_BUILD_TYPE=Release.
+ *        Scenes: "boxes:<count>", "sphere:<segments>", "obj", and the scenes of the other
+ *        modules listed in Scenes.hpp. Without --scene, a default set of scenes is run.
+ *        "obj" loads the file given with --obj, or a large generated sphere. Run it from the
+ *        directory with the shaders, like tnm046-labs.
+ *        Every scene is drawn into an offscreen framebuffer of a fixed size, with vsync off
+ *        and with the time advancing by exactly 1/60 s per frame, so every run draws the
+ *        same frames. After the warmup frames, the CPU time to issue each frame and its GPU
+ *        time are measured by a FrameProfiler, and the minimum, median and 99th percentile
+ *        are written, along with the frame interval and the time to set up the scene.
+ *        With --aa, each scene is run once for each anti-aliasing mode, "off", "fxaa",
+ *        "smaa" or "taa" (AntiAliasing.hpp). The scene is then drawn into textures, the
+ *        anti-aliasing draws it into the framebuffer, and its GPU time is written as
+ *        aa_gpu_ms, apart from gpu_ms of the scene. The quality is the PSNR in dB of the
+ *        last frame against the same frame drawn at 4 x 4 times the size and averaged down.
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "AntiAliasing.hpp"
+#include "BenchCommon.hpp"
+#include "FrameProfiler.hpp"
+#include "Framebuffer.hpp"
+#include "GLState.hpp"
+#include "Mat4.hpp"
+#include "MaterialTable.hpp"
+#include "PostProcess.hpp"
+#include "ReprojectionCache.hpp"
+#include "Scenes.hpp"
+#include "Shader.hpp"
+#include "UniformBuffers.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+const float timeStep = 1.0f / 60.0f;  // Seconds of animation per frame
+const int referenceScale = 4;          // Of the reference frame of --aa, in each direction
+const float clearColor[4] = {0.3f, 0.3f, 0.3f, 0.0f};
+
+// A texture of 'format' for a target of the anti-aliasing, bilinear unless it is a depth
+GLuint createTarget(GLenum format, int width, int height) {
+    const bool depth = format == GL_DEPTH_COMPONENT24;
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glstate::bindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(format), width, height, 0,
+                 depth ? GL_DEPTH_COMPONENT : GL_RGBA, depth ? GL_UNSIGNED_INT : GL_UNSIGNED_BYTE,
+                 nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    return texture;
+}
+
+// A framebuffer of the color textures 'colors', and 'depth' if it is not 0
+GLuint createFramebuffer(const std::vector<GLuint>& colors, GLuint depth) {
+    GLuint framebuffer = 0;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    std::vector<GLenum> buffers;
+    for (size_t i = 0; i < colors.size(); i++) {
+        const GLenum attachment = GL_COLOR_ATTACHMENT0 + static_cast<GLenum>(i);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, colors[i], 0);
+        buffers.push_back(attachment);
+    }
+    if (depth != 0) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+    }
+    glDrawBuffers(static_cast<GLsizei>(buffers.size()), buffers.data());
+    return framebuffer;
+}
+
+// The textures and framebuffers that a scene is drawn into before its anti-aliasing
+struct AntiAliasingTargets {
+    GLuint color = 0;    // Scene
+    GLuint depth = 0;
+    GLuint motion = 0;   // TAA
+    GLuint edges = 0;    // SMAA
+    GLuint weights = 0;
+    GLuint smoothed = 0;
+    GLuint scene = 0;    // Framebuffers of the scene, and of the three passes of SMAA
+    GLuint edgepass = 0;
+    GLuint weightpass = 0;
+    GLuint blendpass = 0;
+
+    AntiAliasingTargets(AntiAliasing::Mode mode, int width, int height) {
+        color = createTarget(GL_RGBA8, width, height);
+        depth = createTarget(GL_DEPTH_COMPONENT24, width, height);
+        if (mode == AntiAliasing::Mode::TAA) {
+            motion = createTarget(AntiAliasing::motionFormat, width, height);
+            scene = createFramebuffer({color, motion}, depth);
+        } else {
+            scene = createFramebuffer({color}, depth);
+        }
+        if (mode == AntiAliasing::Mode::SMAA) {
+            edges = createTarget(AntiAliasing::edgesFormat, width, height);
+            weights = createTarget(AntiAliasing::weightsFormat, width, height);
+            smoothed = createTarget(GL_RGBA8, width, height);
+            edgepass = createFramebuffer({edges}, 0);
+            weightpass = createFramebuffer({weights}, 0);
+            blendpass = createFramebuffer({smoothed}, 0);
+        }
+    }
+
+    ~AntiAliasingTargets() {
+        const GLuint framebuffers[4] = {scene, edgepass, weightpass, blendpass};
+        const GLuint textures[6] = {color, depth, motion, edges, weights, smoothed};
+        glDeleteFramebuffers(4, framebuffers);
+        glstate::deleteTextures(6, textures);
+    }
+
+    AntiAliasingTargets(const AntiAliasingTargets&) = delete;
+    AntiAliasingTargets& operator=(const AntiAliasingTargets&) = delete;
+};
+
+/* Draw 'warmup' + 'frames' frames of a scene, measuring the last 'frames'. Without
+ * anti-aliasing, the scene is drawn into 'framebuffer' directly. With it, into the
+ * textures of AntiAliasingTargets, with 'motionshader' for TAA, and the anti-aliasing
+ * draws it into 'framebuffer', in the scope "aa". */
+void runScene(bench::Scene& scene, Shader& shader, Shader& motionshader,
+              Framebuffer& framebuffer, AntiAliasing::Mode mode, int warmup, int frames, FrameProfiler& profiler) {
+    // Room for the uniforms of every draw, at the largest offset alignment there is
+    UniformRing uniforms(256 * (scene.draws.size() + 1));
+    // All draws in the default material
+    MaterialTable materials;
+    materials.upload();
+    const int width = framebuffer.width();
+    const int height = framebuffer.height();
+    const Mat4 P = bench::sceneProjection(width, height);
+    std::vector<ptrdiff_t> objectdata;
+
+    const bool antialiased = mode != AntiAliasing::Mode::Off;
+    const bool taa = mode == AntiAliasing::Mode::TAA;
+    std::unique_ptr<AntiAliasingTargets> targets;
+    if (antialiased) {
+        targets = std::make_unique<AntiAliasingTargets>(mode, width, height);
+    }
+    AntiAliasing antialiasing(mode);
+    ReprojectionCache motion;  // The matrices of the last frame for TAA
+    PostProcess present;       // Into the framebuffer, with FXAA or as it is
+    present.setEffects(mode == AntiAliasing::Mode::FXAA ? unsigned(PostProcess::FXAA) : 0u);
+    Shader& sceneshader = taa ? motionshader : shader;
+    const float nomotion[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+
+    for (int f = 0; f < warmup + frames; f++) {
+        if (f >= warmup) {
+            profiler.beginFrame();
+            profiler.beginScope("frame");
+        }
+        const float time = float(f) * timeStep;
+        if (!antialiased) {
+            framebuffer.bind();
+            glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            bench::drawScene(scene, shader, uniforms, materials, P, time, objectdata);
+        } else {
+            antialiasing.beginFrame(width, height, width, height);
+            glBindFramebuffer(GL_FRAMEBUFFER, targets->scene);
+            glViewport(0, 0, width, height);
+            glClearBufferfv(GL_COLOR, 0, clearColor);
+            if (taa) {
+                glClearBufferfv(GL_COLOR, 1, nomotion);
+                motion.beginFrame(width, height);
+                sceneshader.use();
+                antialiasing.applyMotion(sceneshader);
+            }
+            glClear(GL_DEPTH_BUFFER_BIT);
+            bench::drawScene(scene, sceneshader, uniforms, materials, antialiasing.jitter(P),
+                             time, objectdata, taa ? &motion : nullptr);
+        }
+        if (f >= warmup) {
+            profiler.endScope();
+        }
+        if (antialiased) {
+            if (f >= warmup) {
+                profiler.beginScope("aa");
+            }
+            GLuint result = targets->color;
+            if (mode == AntiAliasing::Mode::SMAA) {
+                glBindFramebuffer(GL_FRAMEBUFFER, targets->edgepass);
+                antialiasing.detectEdges(targets->color);
+                glBindFramebuffer(GL_FRAMEBUFFER, targets->weightpass);
+                antialiasing.computeWeights(targets->edges);
+                glBindFramebuffer(GL_FRAMEBUFFER, targets->blendpass);
+                antialiasing.blend(targets->color, targets->weights);
+                result = targets->smoothed;
+            } else if (taa) {
+                glBindFramebuffer(GL_FRAMEBUFFER, antialiasing.historyFramebuffer());
+                antialiasing.resolve(targets->color, targets->motion);
+                result = antialiasing.history();
+            }
+            framebuffer.bind();
+            present.apply(result, width, height);
+            if (f >= warmup) {
+                profiler.endScope();
+            }
+        }
+        glFlush();
+    }
+    // Wait for the GPU, and read the queries of the last frames
+    glFinish();
+    profiler.beginFrame();
+}
+
+// The RGB of the bound read framebuffer of 'width' x 'height'
+std::vector<unsigned char> readPixels(int width, int height) {
+    std::vector<unsigned char> pixels(size_t(width) * size_t(height) * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    return pixels;
+}
+
+/* The PSNR in dB of 'pixels', the last frame of a run of 'frames' frames after 'warmup', of
+ * 'width' x 'height', against that frame drawn referenceScale times as large in each
+ * direction and averaged down */
+double referencePSNR(bench::Scene& scene, Shader& shader,
+                     const std::vector<unsigned char>& pixels, int width, int height,
+                     int warmup, int frames) {
+    const int scale = referenceScale;
+    Framebuffer reference;
+    if (!reference.create(width * scale, height * scale)) {
+        return 0.0;
+    }
+    UniformRing uniforms(256 * (scene.draws.size() + 1));
+    MaterialTable materials;
+    materials.upload();
+    std::vector<ptrdiff_t> objectdata;
+    reference.bind();
+    glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    bench::drawScene(scene, shader, uniforms, materials, bench::sceneProjection(width, height),
+                     float(warmup + frames - 1) * timeStep, objectdata);
+    const std::vector<unsigned char> large = readPixels(width * scale, height * scale);
+
+    double squares = 0.0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < 3; c++) {
+                int sum = 0;
+                for (int j = 0; j < scale; j++) {
+                    const size_t row = size_t(y * scale + j) * size_t(width * scale);
+                    for (int i = 0; i < scale; i++) {
+                        sum += large[(row + size_t(x * scale + i)) * 3 + size_t(c)];
+                    }
+                }
+                const double difference =
+                    double(sum) / double(scale * scale) -
+                    double(pixels[(size_t(y) * size_t(width) + size_t(x)) * 3 + size_t(c)]);
+                squares += difference * difference;
+            }
+        }
+    }
+    const double mse = squares / (double(width) * double(height) * 3.0);
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+// Write min, median and p99 of a measurement
+void writeStatistics(FILE* file, const char* name, double min, double median, double p99) {
+    fprintf(file, "\"%s\": {\"min\": %.4f, \"median\": %.4f, \"p99\": %.4f}", name, min, median,
+            p99);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> scenenames;
+    int frames = 300;
+    int warmup = 30;
+    int width = 1280;
+    int height = 720;
+    std::string objfile;
+    std::string outputfile = "tnm046-bench.json";
+    std::vector<AntiAliasing::Mode> aamodes;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        if (option == "--scene") {
+            scenenames.push_back(argv[i + 1]);
+        } else if (option == "--frames") {
+            frames = std::max(std::atoi(argv[i + 1]), 1);
+        } else if (option == "--warmup") {
+            warmup = std::max(std::atoi(argv[i + 1]), 0);
+        } else if (option == "--size") {
+            if (sscanf(argv[i + 1], "%dx%d", &width, &height) != 2 || width <= 0 ||
+                height <= 0) {
+                std::cerr << "Invalid size '" << argv[i + 1] << "', expected e.g. 1280x720\n";
+                return 1;
+            }
+        } else if (option == "--obj") {
+            objfile = argv[i + 1];
+        } else if (option == "--output") {
+            outputfile = argv[i + 1];
+        } else if (option == "--aa") {
+            AntiAliasing::Mode mode;
+            if (!AntiAliasing::parseMode(argv[i + 1], mode)) {
+                std::cerr << "Unknown anti-aliasing mode '" << argv[i + 1] << "'\n";
+                return 1;
+            }
+            aamodes.push_back(mode);
+        } else {
+            std::cerr << "Unknown option '" << option << "'\n";
+            return 1;
+        }
+    }
+    if (scenenames.empty()) {
+        scenenames = {"boxes:1",     "boxes:100",    "boxes:10000", "sphere:10",
+                      "sphere:100", "sphere:1000", "obj"};
+    }
+
+    // The quality is only measured when the modes are compared
+    const bool quality = !aamodes.empty();
+    if (aamodes.empty()) {
+        aamodes.push_back(AntiAliasing::Mode::Off);
+    }
+
+    GLFWwindow* window = bench::createContext("tnm046-bench");
+    if (!window) {
+        return 1;
+    }
+
+    int result = 0;
+    {
+        Shader shader;
+        shader.createShader("vertex.glsl", "fragment.glsl");
+        Shader motionshader;
+        if (std::find(aamodes.begin(), aamodes.end(), AntiAliasing::Mode::TAA) != aamodes.end()) {
+            motionshader.createShader("vertex.glsl", "fragment.glsl", "MOTION_VECTORS");
+        }
+        Framebuffer framebuffer;
+        if (!framebuffer.create(width, height)) {
+            glfwTerminate();
+            return 1;
+        }
+        glEnable(GL_DEPTH_TEST);
+
+        // The generated OBJ file, unless one was given
+        std::string generatedobj;
+        for (const std::string& name : scenenames) {
+            if (name == "obj" && objfile.empty()) {
+                generatedobj = bench::temporaryFile("tnm046-bench-sphere.obj");
+                if (!bench::writeSphereOBJ(generatedobj, 1000)) {
+                    return 1;
+                }
+                objfile = generatedobj;
+            }
+        }
+
+        FILE* file = fopen(outputfile.c_str(), "w");
+        if (!file) {
+            std::cerr << "Could not create " << outputfile << "\n";
+            return 1;
+        }
+        fprintf(file, "{\n  \"renderer\": \"%s\",\n  \"version\": \"%s\",\n",
+                reinterpret_cast<const char*>(glGetString(GL_RENDERER)),
+                reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+        fprintf(file, "  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %d,\n", width, height,
+                frames);
+        fprintf(file, "  \"warmup\": %d,\n  \"scenes\": [", warmup);
+        bool first = true;
+        for (const std::string& name : scenenames) {
+            bench::Scene scene;
+            if (!bench::createScene(name, objfile, scene)) {
+                result = 1;
+                continue;
+            }
+            for (AntiAliasing::Mode mode : aamodes) {
+                FrameProfiler profiler(frames);
+                runScene(scene, shader, motionshader, framebuffer, mode, warmup, frames,
+                         profiler);
+                std::cerr << name;
+                if (quality) {
+                    std::cerr << " (" << AntiAliasing::modeName(mode) << ")";
+                }
+                std::cerr << ": " << profiler.frameTimePercentile(50.0) << " ms per frame\n";
+
+                fprintf(file,
+                        "%s\n    {\"name\": \"%s\", \"draws\": %zu, \"triangles\": %lld, ",
+                        first ? "" : ",", name.c_str(), scene.draws.size(), scene.triangles);
+                fprintf(file, "\"load_ms\": %.4f,\n     ", scene.loadtime);
+                writeStatistics(file, "frame_ms", profiler.frameTimePercentile(0.0),
+                                profiler.frameTimePercentile(50.0),
+                                profiler.frameTimePercentile(99.0));
+                fprintf(file, ",\n     ");
+                writeStatistics(file, "cpu_ms", profiler.scopeCPUPercentile("frame", 0.0),
+                                profiler.scopeCPUPercentile("frame", 50.0),
+                                profiler.scopeCPUPercentile("frame", 99.0));
+                fprintf(file, ",\n     ");
+                writeStatistics(file, "gpu_ms", profiler.scopeGPUPercentile("frame", 0.0),
+                                profiler.scopeGPUPercentile("frame", 50.0),
+                                profiler.scopeGPUPercentile("frame", 99.0));
+                if (quality) {
+                    framebuffer.bind();
+                    const std::vector<unsigned char> pixels = readPixels(width, height);
+                    const double psnr =
+                        referencePSNR(scene, shader, pixels, width, height, warmup, frames);
+                    fprintf(file, ",\n     \"aa\": \"%s\", \"psnr_db\": %.3f",
+                            AntiAliasing::modeName(mode), psnr);
+                    if (mode != AntiAliasing::Mode::Off) {
+                        fprintf(file, ",\n     ");
+                        writeStatistics(file, "aa_gpu_ms",
+                                        profiler.scopeGPUPercentile("aa", 0.0),
+                                        profiler.scopeGPUPercentile("aa", 50.0),
+                                        profiler.scopeGPUPercentile("aa", 99.0));
+                    }
+                }
+                fprintf(file, "}");
+                first = false;
+            }
+        }
+        fprintf(file, "\n  ]\n}\n");
+        fclose(file);
+        if (!generatedobj.empty()) {
+            std::remove(generatedobj.c_str());
+        }
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return result;
+}
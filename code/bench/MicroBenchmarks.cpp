@@ -0,0 +1,568 @@
+/*
+ * tnm046-microbench: times small CPU side kernels in isolation, to judge changes to them
+ * like SIMD code or allocators.
+ *
+ * Usage: tnm046-microbench [--filter <text>] [--min-time <seconds>] [--json <file>]
+ *        Run it from the directory with the shaders and textures, like tnm046-labs.
+ *        Every benchmark is a function that runs its kernel while State::keepRunning() is
+ *        true. The number of iterations is first grown until a run takes --min-time (0.1 s
+ *        by default), and then the benchmark is run 5 times with that count. The minimum
+ *        and median time per iteration are reported, and the throughput for benchmarks
+ *        that process a known number of bytes. The minimum is the most stable number to
+ *        compare between commits; a large gap to the median means a noisy machine.
+ *        Benchmarks that create meshes upload them as well, so they need a GL context,
+ *        which is created in a hidden window. They are skipped if there is none.
+ *        Build with CMAKE_BUILD_TYPE=Release to get numbers that mean something.
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "BenchCommon.hpp"
+#include "Arena.hpp"
+#include "LightClusters.hpp"
+#include "Mat4.hpp"
+#include "MappedFile.hpp"
+#include "MeshCodec.hpp"
+#include "MeshProcessing.hpp"
+#include "RenderQueue.hpp"
+#include "SceneGraph.hpp"
+#include "ThreadPool.hpp"
+#include "Texture.hpp"
+#include "TriangleBVH.hpp"
+#include "TriangleSoup.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// In Shader.cpp, without a declaration in Shader.hpp
+std::string_view readFile(const std::string& filename, Arena& arena);
+
+// Access to the TGA loader of Texture, which is private
+struct TextureBenchmark {
+    static size_t loadTGA(const std::string& filename, const MappedFile& file) {
+        const Texture::ImageData image = Texture::loadTGA(filename, file);
+        return static_cast<size_t>(image.width) * image.height;
+    }
+};
+
+namespace {
+
+// Keep the compiler from optimizing away a value that is never used
+template <typename T>
+void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+/* What a benchmark function gets: loop while keepRunning() is true */
+class State {
+public:
+    explicit State(long long iterations) : remaining_(iterations), bytes_(0) {}
+
+    bool keepRunning() { return remaining_-- > 0; }
+
+    // Bytes processed per iteration, for the throughput
+    void setBytesPerIteration(size_t bytes) { bytes_ = bytes; }
+    size_t bytesPerIteration() const { return bytes_; }
+
+private:
+    long long remaining_;
+    size_t bytes_;
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<void(State&)> function;
+    bool needsGL;
+};
+
+struct Result {
+    std::string name;
+    long long iterations;
+    double minimum;  // Nanoseconds per iteration
+    double median;
+    double bytespersecond;  // 0 if unknown
+};
+
+// Seconds that one run of 'iterations' iterations takes, and the bytes per iteration set
+double timeRun(const Benchmark& benchmark, long long iterations, size_t& bytes) {
+    State state(iterations);
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    benchmark.function(state);
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    bytes = state.bytesPerIteration();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+Result run(const Benchmark& benchmark, double mintime) {
+    const int repetitions = 5;
+    size_t bytes = 0;
+    long long iterations = 1;
+    for (;;) {
+        const double seconds = timeRun(benchmark, iterations, bytes);
+        if (seconds >= mintime || iterations >= (1LL << 40)) {
+            break;
+        }
+        // Aim a little above mintime, but grow at most 100 times per step
+        const double factor = (seconds > 0.0) ? 1.2 * mintime / seconds : 100.0;
+        iterations = static_cast<long long>(double(iterations) * std::clamp(factor, 2.0, 100.0));
+    }
+    std::vector<double> times;
+    for (int r = 0; r < repetitions; r++) {
+        times.push_back(1e9 * timeRun(benchmark, iterations, bytes) / double(iterations));
+    }
+    std::sort(times.begin(), times.end());
+    Result result;
+    result.name = benchmark.name;
+    result.iterations = iterations;
+    result.minimum = times.front();
+    result.median = times[times.size() / 2];
+    result.bytespersecond = (bytes > 0) ? 1e9 * double(bytes) / result.minimum : 0.0;
+    return result;
+}
+
+size_t fileSize(const std::string& filename) {
+    MappedFile file(filename);
+    return file.size();
+}
+
+// A wavy grid of 2 million triangles and its ray tree, made once for the ray benchmarks
+struct RayGrid {
+    std::vector<GLfloat> positions;
+    std::vector<GLuint> indices;
+    TriangleBVH tree;
+};
+
+const RayGrid& rayGrid() {
+    static RayGrid* grid = nullptr;
+    if (!grid) {
+        grid = new RayGrid;
+        const int size = 1001;
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                const float s = float(x) / float(size - 1);
+                const float t = float(y) / float(size - 1);
+                const float z = 0.05f * std::sin(40.0f * s) * std::cos(30.0f * t);
+                grid->positions.insert(grid->positions.end(), {s, t, z});
+            }
+        }
+        for (int y = 0; y + 1 < size; y++) {
+            for (int x = 0; x + 1 < size; x++) {
+                const GLuint i = GLuint(y * size + x);
+                grid->indices.insert(grid->indices.end(),
+                                     {i, i + 1, i + size, i + 1, i + size + 1, i + size});
+            }
+        }
+        grid->tree.build(grid->positions.data(), 3, size * size, grid->indices,
+                         &ThreadPool::global());
+    }
+    return *grid;
+}
+
+std::vector<Benchmark> benchmarks(const std::string& objfile) {
+    std::vector<Benchmark> list;
+
+    // Matrices
+    list.push_back({"mat4/multiply", [](State& state) {
+                        Mat4 a = Mat4::rotationX(0.1f);
+                        const Mat4 b = Mat4::rotationY(0.2f);
+                        while (state.keepRunning()) {
+                            a = a * b;
+                            doNotOptimize(a);
+                        }
+                    }, false});
+    list.push_back({"mat4/rotationX", [](State& state) {
+                        float angle = 0.0f;
+                        while (state.keepRunning()) {
+                            const Mat4 m = Mat4::rotationX(angle);
+                            doNotOptimize(m);
+                            angle += 0.001f;
+                        }
+                    }, false});
+    list.push_back({"mat4/perspective", [](State& state) {
+                        float fov = 1.0f;
+                        while (state.keepRunning()) {
+                            const Mat4 m = Mat4::perspective(fov, 1.5f, 0.1f, 100.0f);
+                            doNotOptimize(m);
+                            fov += 1e-6f;
+                        }
+                    }, false});
+    list.push_back({"mat4/trs", [](State& state) {
+                        float angle = 0.0f;
+                        while (state.keepRunning()) {
+                            const Mat4 m =
+                                Mat4::trs(1.0f, 2.0f, 3.0f, angle, 0.5f, 0.25f, 1.0f, 2.0f, 1.0f);
+                            doNotOptimize(m);
+                            angle += 0.001f;
+                        }
+                    }, false});
+    list.push_back({"mat4/affineInverse", [](State& state) {
+                        Mat4 m = Mat4::trs(1.0f, 2.0f, 3.0f, 0.3f, 0.5f, 0.25f, 1.0f, 2.0f, 1.0f);
+                        while (state.keepRunning()) {
+                            m = affineInverse(m);
+                            doNotOptimize(m);
+                        }
+                    }, false});
+
+    // Mesh generation and loading
+    for (int segments : {10, 100, 1000}) {
+        list.push_back({"mesh/createSphere/" + std::to_string(segments), [segments](State& state) {
+                            while (state.keepRunning()) {
+                                TriangleSoup sphere;
+                                sphere.createSphere(1.0f, segments);
+                            }
+                        }, true});
+    }
+    for (unsigned int threads : {1u, 0u}) {
+        const std::string name = (threads == 1) ? "mesh/readOBJ/1thread" : "mesh/readOBJ";
+        list.push_back({name, [objfile, threads](State& state) {
+                            state.setBytesPerIteration(fileSize(objfile));
+                            Arena arena;  // Reused by every load, as by a loader
+                            while (state.keepRunning()) {
+                                TriangleSoup mesh;
+                                mesh.readOBJ(objfile, threads, false, &arena);
+                                arena.reset();
+                            }
+                        }, true});
+    }
+
+    // Decoding the compressed vertices and indices of the welded mesh, as readBinary() does
+    // for each chunk of a compressed mesh file, with the throughput of the decoded data
+    for (const bool indices : {false, true}) {
+        const std::string name =
+            indices ? "meshcodec/decodeIndexBuffer" : "meshcodec/decodeVertexBuffer";
+        list.push_back({name, [objfile, indices](State& state) {
+                            TriangleSoup::MeshData data;
+                            if (!TriangleSoup::parseOBJ(objfile, data, 0, true)) {
+                                return;
+                            }
+                            const size_t numverts = data.vertices.size() / 8;
+                            const size_t count = indices ? data.indices.size() : numverts;
+                            const size_t size = indices ? sizeof(GLuint) : 8 * sizeof(GLfloat);
+                            std::vector<unsigned char> encoded(
+                                indices ? meshcodec::encodeIndexBufferBound(count, numverts)
+                                        : meshcodec::encodeVertexBufferBound(count, size));
+                            encoded.resize(
+                                indices ? meshcodec::encodeIndexBuffer(
+                                              encoded.data(), encoded.size(),
+                                              data.indices.data(), count)
+                                        : meshcodec::encodeVertexBuffer(
+                                              encoded.data(), encoded.size(),
+                                              data.vertices.data(), count, size));
+                            std::vector<unsigned char> decoded(count * size);
+                            state.setBytesPerIteration(decoded.size());
+                            while (state.keepRunning()) {
+                                const bool ok =
+                                    indices ? meshcodec::decodeIndexBuffer(
+                                                  decoded.data(), count, size, encoded.data(),
+                                                  encoded.size())
+                                            : meshcodec::decodeVertexBuffer(
+                                                  decoded.data(), count, size, encoded.data(),
+                                                  encoded.size());
+                                doNotOptimize(ok);
+                            }
+                        }, false});
+    }
+
+    // Smooth normals and tangents of a welded, wavy grid of 2 million triangles on all
+    // threads. The normals are computed into a copy of the arrays, which is timed too.
+    for (const bool tangents : {false, true}) {
+        const std::string name = tangents ? "mesh/computeTangents" : "mesh/computeNormals";
+        list.push_back({name, [tangents](State& state) {
+                            const int size = 1001;
+                            std::vector<GLfloat> vertices;
+                            std::vector<GLuint> indices;
+                            for (int y = 0; y < size; y++) {
+                                for (int x = 0; x < size; x++) {
+                                    const float s = float(x) / float(size - 1);
+                                    const float t = float(y) / float(size - 1);
+                                    const float z =
+                                        0.05f * std::sin(40.0f * s) * std::cos(30.0f * t);
+                                    vertices.insert(vertices.end(),
+                                                    {s, t, z, 0.0f, 0.0f, 1.0f, s, t});
+                                }
+                            }
+                            for (int y = 0; y + 1 < size; y++) {
+                                for (int x = 0; x + 1 < size; x++) {
+                                    const GLuint i = GLuint(y * size + x);
+                                    indices.insert(indices.end(),
+                                                   {i, i + 1, i + size, i + 1, i + size + 1,
+                                                    i + size});
+                                }
+                            }
+                            ThreadPool& pool = ThreadPool::global();
+                            mesh::computeNormals(vertices, 8, indices, 60.0f, &pool);
+                            std::vector<GLfloat> result;
+                            while (state.keepRunning()) {
+                                if (tangents) {
+                                    mesh::computeTangents(vertices, 8, indices, result, &pool);
+                                } else {
+                                    result = vertices;
+                                    std::vector<GLuint> resultindices = indices;
+                                    mesh::computeNormals(result, 8, resultindices, 60.0f, &pool);
+                                }
+                                doNotOptimize(result[0]);
+                            }
+                        }, false});
+    }
+
+    // The vertex adjacency and the edges of a grid of 2 million triangles on all threads
+    list.push_back({"mesh/buildAdjacency", [](State& state) {
+                        const int size = 1001;
+                        std::vector<GLuint> indices;
+                        for (int y = 0; y + 1 < size; y++) {
+                            for (int x = 0; x + 1 < size; x++) {
+                                const GLuint i = GLuint(y * size + x);
+                                indices.insert(indices.end(), {i, i + 1, i + size, i + 1,
+                                                               i + size + 1, i + size});
+                            }
+                        }
+                        ThreadPool& pool = ThreadPool::global();
+                        while (state.keepRunning()) {
+                            const mesh::Adjacency adjacency =
+                                mesh::buildAdjacency(indices, size * size, nullptr, &pool);
+                            const std::vector<mesh::Edge> edges =
+                                mesh::buildEdges(adjacency, indices, nullptr, &pool);
+                            doNotOptimize(edges[0]);
+                        }
+                    }, false});
+
+    // The ray tree of a wavy grid of 2 million triangles built on all threads, and the
+    // nearest hits of rays from above in rows as from a camera, one ray per iteration
+    list.push_back({"ray/build", [](State& state) {
+                        const RayGrid& grid = rayGrid();
+                        TriangleBVH tree;
+                        while (state.keepRunning()) {
+                            tree.build(grid.positions.data(), 3, grid.positions.size() / 3,
+                                       grid.indices, &ThreadPool::global());
+                            doNotOptimize(tree);
+                        }
+                    }, false});
+    list.push_back({"ray/intersect", [](State& state) {
+                        const TriangleBVH& tree = rayGrid().tree;
+                        const float origin[3] = {0.5f, 0.5f, 2.0f};
+                        int ray = 0;
+                        while (state.keepRunning()) {
+                            const float direction[3] = {float(ray % 512) / 1024.0f - 0.25f,
+                                                        float(ray / 512) / 1024.0f - 0.25f,
+                                                        -1.0f};
+                            TriangleBVH::Hit hit;
+                            tree.intersect(origin, direction, hit);
+                            doNotOptimize(hit);
+                            ray = (ray + 1) % (512 * 512);
+                        }
+                    }, false});
+
+    // Light assignment to clusters, with the lights spread through the frustum
+    for (int count : {64, 256, 1024, 4096}) {
+        list.push_back({"lights/assign/" + std::to_string(count), [count](State& state) {
+                            std::vector<PointLight> lights;
+                            for (int i = 0; i < count; i++) {
+                                const float t = float(i) / float(count);
+                                lights.push_back({{20.0f * t - 10.0f, 6.0f * std::sin(40.0f * t),
+                                                   -1.0f - 50.0f * t},
+                                                  1.0f, {1.0f, 1.0f, 1.0f}, 1.0f});
+                            }
+                            const Mat4 P = Mat4::perspective(1.0f, 16.0f / 9.0f, 0.1f, 100.0f);
+                            LightClusters clusters;
+                            while (state.keepRunning()) {
+                                clusters.assign(lights, P);
+                                doNotOptimize(clusters.assignedCount());
+                            }
+                        }, false});
+    }
+
+    // Building and sorting the draw queue of a frame, with 64 shaders, 256 textures and
+    // 1024 meshes and a tenth of the draws transparent
+    for (int count : {1000, 100000}) {
+        list.push_back({"renderqueue/sort/" + std::to_string(count), [count](State& state) {
+                            RenderQueue queue;
+                            uint32_t random = 12345;
+                            auto next = [&random]() {
+                                random = random * 1664525u + 1013904223u;
+                                return random >> 8;
+                            };
+                            while (state.keepRunning()) {
+                                queue.clear();
+                                for (int i = 0; i < count; i++) {
+                                    const auto pass = (i % 10 == 0)
+                                                          ? RenderQueue::Pass::Transparent
+                                                          : RenderQueue::Pass::Opaque;
+                                    const float depth = float(next() % 100000) * 0.001f;
+                                    queue.push(RenderQueue::makeKey(pass, next() % 64,
+                                                                    next() % 256, next() % 1024,
+                                                                    depth),
+                                               uint32_t(i));
+                                }
+                                queue.sort();
+                                doNotOptimize(queue.draws().front().payload);
+                            }
+                        }, false});
+    }
+
+    // Scene graph updates of a tree of 100000 nodes, 10 children per node, with bounds on
+    // the leaves: everything moved, one subtree of 1111 nodes moved, and everything on all
+    // threads
+    for (const char* variant : {"all", "subtree", "all/parallel"}) {
+        list.push_back({std::string("scenegraph/update/") + variant, [variant](State& state) {
+                            SceneGraph scene;
+                            mesh::Bounds bounds;
+                            bounds.radius = 1.0f;
+                            for (int i = 0; i < 100000; i++) {
+                                const SceneGraph::Node node =
+                                    scene.add(i == 0 ? SceneGraph::none : (i - 1) / 10);
+                                scene.setTranslation(node, 1.0f, 0.0f, 0.0f);
+                                if (i >= 11111) {
+                                    scene.setBounds(node, bounds);
+                                }
+                            }
+                            const bool all = std::string(variant) != "subtree";
+                            ThreadPool* pool = std::string(variant) == "all/parallel"
+                                                   ? &ThreadPool::global()
+                                                   : nullptr;
+                            float angle = 0.0f;
+                            while (state.keepRunning()) {
+                                scene.setRotation(all ? 0 : 111, angle, 0.0f, 0.0f);
+                                scene.update(pool);
+                                doNotOptimize(scene.updatedCount());
+                                angle += 0.001f;
+                            }
+                        }, false});
+    }
+
+    // Files
+    list.push_back({"texture/loadUncompressedTGA", [](State& state) {
+                        // The pixels of an uncompressed file are used where they are mapped,
+                        // so this is the cost of mapping the file and reading the header
+                        const std::string filename = "textures/trex.tga";
+                        while (state.keepRunning()) {
+                            MappedFile file(filename);
+                            const size_t pixels = TextureBenchmark::loadTGA(filename, file);
+                            doNotOptimize(pixels);
+                        }
+                    }, false});
+    list.push_back({"texture/swapRedBlue", [](State& state) {
+                        MappedFile file("textures/trex.tga");
+                        std::vector<GLubyte> pixels(file.data(), file.data() + file.size());
+                        const size_t count = pixels.size() / 3;
+                        state.setBytesPerIteration(count * 3);
+                        while (state.keepRunning()) {
+                            Texture::swapRedBlue(pixels.data(), count, 3);
+                            doNotOptimize(pixels[0]);
+                        }
+                    }, false});
+    list.push_back({"shader/readFile", [](State& state) {
+                        state.setBytesPerIteration(fileSize("fragment.glsl"));
+                        Arena arena;
+                        while (state.keepRunning()) {
+                            const std::string_view source = readFile("fragment.glsl", arena);
+                            doNotOptimize(source);
+                            arena.reset();
+                        }
+                    }, false});
+    return list;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    double mintime = 0.1;
+    std::string jsonfile;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        if (option == "--filter") {
+            filter = argv[i + 1];
+        } else if (option == "--min-time") {
+            mintime = std::max(std::atof(argv[i + 1]), 0.001);
+        } else if (option == "--json") {
+            jsonfile = argv[i + 1];
+        } else {
+            std::cerr << "Unknown option '" << option << "'\n";
+            return 1;
+        }
+    }
+
+    const std::string objfile = bench::temporaryFile("tnm046-microbench.obj");
+    GLFWwindow* window = bench::createContext("tnm046-microbench");
+    std::vector<Result> results;
+    {
+        std::vector<Benchmark> list = benchmarks(objfile);
+        bool needsobj = false;
+        for (const Benchmark& benchmark : list) {
+            const bool selected = benchmark.name.find(filter) != std::string::npos;
+            if (selected && benchmark.name.find("readOBJ") != std::string::npos) {
+                needsobj = true;
+            }
+        }
+        // About 4 MB of OBJ text
+        if (needsobj && !bench::writeSphereOBJ(objfile, 200)) {
+            return 1;
+        }
+
+        for (const Benchmark& benchmark : list) {
+            if (benchmark.name.find(filter) == std::string::npos) {
+                continue;
+            }
+            if (benchmark.needsGL && !window) {
+                std::cerr << benchmark.name << ": skipped, no GL context\n";
+                continue;
+            }
+            results.push_back(run(benchmark, mintime));
+        }
+        if (needsobj) {
+            std::remove(objfile.c_str());
+        }
+    }
+
+    printf("\n%-32s %14s %14s %12s %12s\n", "Benchmark", "Min ns", "Median ns", "MB/s",
+           "Iterations");
+    for (const Result& result : results) {
+        printf("%-32s %14.1f %14.1f ", result.name.c_str(), result.minimum, result.median);
+        if (result.bytespersecond > 0.0) {
+            printf("%12.1f ", result.bytespersecond / 1e6);
+        } else {
+            printf("%12s ", "");
+        }
+        printf("%12lld\n", result.iterations);
+    }
+
+    if (!jsonfile.empty()) {
+        FILE* file = fopen(jsonfile.c_str(), "w");
+        if (!file) {
+            std::cerr << "Could not create " << jsonfile << "\n";
+            return 1;
+        }
+        fprintf(file, "{\n  \"benchmarks\": [");
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& result = results[i];
+            fprintf(file,
+                    "%s\n    {\"name\": \"%s\", \"iterations\": %lld, \"min_ns\": %.3f, "
+                    "\"median_ns\": %.3f, \"bytes_per_second\": %.0f}",
+                    (i > 0) ? "," : "", result.name.c_str(), result.iterations, result.minimum,
+                    result.median, result.bytespersecond);
+        }
+        fprintf(file, "\n  ]\n}\n");
+        fclose(file);
+    }
+
+    if (window) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+    return 0;
+}
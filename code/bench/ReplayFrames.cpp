@@ -0,0 +1,220 @@
+/*
+ * tnm046-replay: draws the frames of a draw capture of tnm046-labs again, without its
+ * simulation, input or render thread, to profile the GPU work of a run offline and compare
+ * it frame for frame across builds and drivers.
+ *
+ * Usage: tnm046-replay --capture <file.draws> [--loops <n>] [--output <file.csv>]
+ *        Record the capture with tnm046-labs --drawcapture <file.draws>, and replay it
+ *        from the directory with the shaders and the mesh files, as the meshes are made
+ *        again from their sources (DrawCapture.hpp). The frames are drawn into an offscreen
+ *        framebuffer of their recorded size, in the order of the recorded render queue:
+ *        the depth pass with the depth shader, the opaque pass with the main shader, and the
+ *        transparent pass with the main shader, blended. Each pass is a profiler scope, and
+ *        the frame and scope times of every frame, of every loop, go to the CSV file
+ *        (tnm046-replay.csv unless --output says otherwise). The median frame time is
+ *        printed at the end.
+ *        What is not in the render queue is not replayed: the shadow cascades, the
+ *        particles, the streamed mesh and the passes after the scene. A skinned mesh is
+ *        drawn in its rest pose, and the LOD levels are chosen again from the recorded
+ *        projection.
+ *
+ * This code is in the public domain.
+ */
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "BenchCommon.hpp"
+#include "DrawCapture.hpp"
+#include "FrameProfiler.hpp"
+#include "Framebuffer.hpp"
+#include "LightClusters.hpp"
+#include "MaterialTable.hpp"
+#include "RenderQueue.hpp"
+#include "Shader.hpp"
+#include "TriangleSoup.hpp"
+#include "UniformBuffers.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const float clearColor[4] = {0.3f, 0.3f, 0.3f, 0.0f};
+
+const char* passScopes[4] = {"depth", "opaque", "transparent", "overlay"};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string capturefile;
+    std::string outputfile = "tnm046-replay.csv";
+    int loops = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        if (option == "--capture") {
+            capturefile = argv[i + 1];
+        } else if (option == "--loops") {
+            loops = std::max(std::atoi(argv[i + 1]), 1);
+        } else if (option == "--output") {
+            outputfile = argv[i + 1];
+        } else {
+            std::cerr << "Unknown option '" << option << "'\n";
+            return 1;
+        }
+    }
+    if (capturefile.empty()) {
+        std::cerr << "Usage: tnm046-replay --capture <file.draws> [--loops <n>] "
+                     "[--output <file.csv>]\n";
+        return 1;
+    }
+
+    // All frames are read first, so that the file is not read while the frames are timed
+    DrawReplay replay;
+    if (!replay.open(capturefile)) {
+        return 1;
+    }
+    std::vector<CapturedFrame> frames;
+    std::vector<std::vector<Material>> framematerials;  // Of each frame
+    bool lights = false;
+    CapturedFrame frame;
+    while (replay.readFrame(frame)) {
+        lights = lights || !frame.lights.empty();
+        frames.push_back(frame);
+        framematerials.push_back(replay.materials());
+    }
+    if (frames.empty()) {
+        std::cerr << capturefile << " has no frames\n";
+        return 1;
+    }
+
+    GLFWwindow* window = bench::createContext("tnm046-replay");
+    if (!window) {
+        return 1;
+    }
+
+    int result = 0;
+    {
+        const std::vector<std::string>& sources = replay.meshes();
+        std::vector<TriangleSoup> meshes(sources.size());
+        std::vector<bool> created(sources.size(), false);
+        for (size_t i = 0; i < sources.size(); i++) {
+            created[i] = DrawReplay::createMesh(sources[i], meshes[i]);
+            if (!created[i]) {
+                std::cerr << "Could not make mesh " << i << " from '" << sources[i]
+                          << "', its draws are skipped\n";
+            }
+        }
+        Shader shader;
+        shader.createShader("vertex.glsl", "fragment.glsl", lights ? "CLUSTERED_LIGHTS" : "");
+        Shader depthshader;
+        depthshader.createShader("vertex_depth.glsl", "fragment_depth.glsl");
+        UniformRing uniforms;
+        MaterialTable materials;
+        LightClusters lightclusters;
+        Framebuffer framebuffer;
+        FrameProfiler profiler(static_cast<int>(frames.size()) * loops + 1);
+        std::vector<ptrdiff_t> objectdata;
+
+        for (int loop = 0; loop < loops; loop++) {
+            for (size_t f = 0; f < frames.size(); f++) {
+                const CapturedFrame& captured = frames[f];
+                if (framebuffer.width() != captured.width ||
+                    framebuffer.height() != captured.height) {
+                    if (!framebuffer.create(captured.width, captured.height)) {
+                        result = 1;
+                        break;
+                    }
+                }
+                // The table is as large as the largest recorded, the rest as recorded
+                const std::vector<Material>& recorded = framematerials[f];
+                for (size_t m = 0; m < recorded.size(); m++) {
+                    if (static_cast<int>(m) < materials.size()) {
+                        materials.set(static_cast<int>(m), recorded[m]);
+                    } else {
+                        materials.add(recorded[m]);
+                    }
+                }
+
+                profiler.beginFrame();
+                framebuffer.bind();
+                glEnable(GL_DEPTH_TEST);
+                glDepthMask(GL_TRUE);
+                glDisable(GL_BLEND);
+                glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                uniforms.beginFrame();
+                const ptrdiff_t framedata = uniforms.push(captured.uniforms);
+                objectdata.clear();
+                for (const ObjectUniforms& object : captured.objects) {
+                    objectdata.push_back(uniforms.push(object));
+                }
+                uniforms.upload();
+                uniforms.bind(frameBlockBinding, framedata, sizeof(FrameUniforms));
+                materials.upload();
+                materials.bind(materialBlockBinding);
+                if (lights) {
+                    lightclusters.assign(captured.lights, captured.uniforms.P);
+                    lightclusters.upload();
+                    lightclusters.apply(shader);
+                }
+
+                // The draws in the recorded order, with a scope for each pass
+                int pass = -1;
+                for (size_t d = 0; d < captured.keys.size(); d++) {
+                    const int drawpass = static_cast<int>(RenderQueue::pass(captured.keys[d]));
+                    if (drawpass != pass) {
+                        if (pass >= 0) {
+                            profiler.endScope();
+                        }
+                        pass = drawpass;
+                        profiler.beginScope(passScopes[pass & 3]);
+                        const bool transparent = pass >= int(RenderQueue::Pass::Transparent);
+                        (pass == int(RenderQueue::Pass::Depth) ? depthshader : shader).use();
+                        glDepthMask(transparent ? GL_FALSE : GL_TRUE);
+                        if (transparent) {
+                            glEnable(GL_BLEND);
+                            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                        }
+                    }
+                    const uint32_t payload = captured.payloads[d];
+                    if (payload >= captured.objects.size()) {
+                        continue;
+                    }
+                    const uint32_t mesh = captured.meshes[payload];
+                    if (mesh >= meshes.size() || !created[mesh]) {
+                        continue;
+                    }
+                    uniforms.bind(objectBlockBinding, objectdata[payload],
+                                  sizeof(ObjectUniforms));
+                    const GLfloat* matrix = captured.objects[payload].MV.m;
+                    if (pass == int(RenderQueue::Pass::Depth)) {
+                        meshes[mesh].renderLODDepth(captured.uniforms.P, matrix);
+                    } else {
+                        meshes[mesh].renderLOD(captured.uniforms.P, matrix);
+                    }
+                }
+                if (pass >= 0) {
+                    profiler.endScope();
+                }
+                glFlush();
+            }
+        }
+        // Wait for the GPU, and read the queries of the last frames
+        glFinish();
+        profiler.beginFrame();
+
+        std::cerr << capturefile << ": " << frames.size() << " frames, "
+                  << profiler.frameTimePercentile(50.0) << " ms per frame\n";
+        if (!profiler.writeCSV(outputfile)) {
+            std::cerr << "Could not write " << outputfile << "\n";
+            result = 1;
+        }
+    }
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return result;
+}
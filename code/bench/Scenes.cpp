@@ -0,0 +1,362 @@
+/*
+ * The scripted scenes of the benchmarks
+ *
+ * This code is in the public domain.
+ */
+#if defined(WIN32) && !defined(_USE_MATH_DEFINES)
+#define _USE_MATH_DEFINES
+#endif
+
+#include <GL/glew.h>
+
+#include "Scenes.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+
+#include "GLState.hpp"
+#include "Impostor.hpp"
+#include "MaterialTable.hpp"
+#include "ProceduralGrid.hpp"
+#include "ReprojectionCache.hpp"
+#include "Shader.hpp"
+#include "Terrain.hpp"
+#include "Texture.hpp"
+#include "TextureArray.hpp"
+#include "TextureTable.hpp"
+#include "UniformBuffers.hpp"
+#include "VirtualTexture.hpp"
+
+namespace bench {
+
+namespace {
+
+// The images of the textured scenes, which are run from the directory with the shaders
+const char* const textureFiles[] = {"textures/earth.tga", "textures/moon.tga",
+                                    "textures/pyramid.tga", "textures/sun.tga",
+                                    "textures/trex.tga"};
+
+// A square grid of 'count' boxes in one shape, each drawn with a draw call of its own
+void addBoxGrid(Scene& scene, int count) {
+    const int side = static_cast<int>(std::ceil(std::sqrt(double(count))));
+    const float spacing = 4.0f / float(side);
+    scene.shapes.emplace_back();
+    TriangleSoup& box = scene.shapes.back();
+    box.createBox(0.6f * spacing, 0.6f * spacing, 0.6f * spacing);
+    for (int i = 0; i < count; i++) {
+        const float x = (float(i % side) + 0.5f) * spacing - 2.0f;
+        const float y = (float(i / side) + 0.5f) * spacing - 2.0f;
+        scene.draws.push_back({&box, Mat4::translation(x, y, -3.0f)});
+    }
+}
+
+// The draws of the grid, each with the image (draw number modulo the number of images) of
+// a TextureArray, whose layer and place in the layer go to the uniforms of TEXTURE_ARRAY
+void addTextureArray(Scene& scene) {
+    auto images = std::make_shared<TextureArray>();
+    for (const char* file : textureFiles) {
+        images->add(file);
+    }
+    if (images->entryCount() == 0 || !images->build()) {
+        std::cerr << "The images of scene '" << scene.name << "' could not be loaded\n";
+        return;
+    }
+    auto shader = std::make_shared<Shader>();
+    shader->createShader("vertex.glsl", "fragment.glsl", "TEXTURE_ARRAY");
+    scene.render = [images, shader](Scene& grid, UniformRing& uniforms,
+                                    const std::vector<ptrdiff_t>& objectdata, const Mat4&,
+                                    float) {
+        shader->use();
+        glstate::activeTexture(GL_TEXTURE0);
+        glstate::bindTexture(GL_TEXTURE_2D_ARRAY, images->id());
+        for (size_t i = 0; i < grid.draws.size(); i++) {
+            const TextureArray::Entry& entry =
+                images->entry(static_cast<int>(i % size_t(images->entryCount())));
+            shader->setUniform("textureTransform", entry.scale[0], entry.scale[1],
+                               entry.offset[0], entry.offset[1]);
+            shader->setUniform("textureLayer", float(entry.layer));
+            uniforms.bind(objectBlockBinding, objectdata[i], sizeof(ObjectUniforms));
+            grid.draws[i].shape->render();
+        }
+    };
+}
+
+// The textures of the "bindless" scene, with the table declared after them so that their
+// handles are made non-resident before the textures are deleted
+struct BindlessTextures {
+    std::deque<Texture> textures;
+    TextureTable table;
+    std::vector<GLuint> indices;  // In the table, of each texture
+};
+
+// The draws of the grid, each with one of the images as a texture of its own, picked by its
+// index in a TextureTable of bindless handles with no texture bound between the draws
+void addTextureTable(Scene& scene) {
+    if (!TextureTable::supported()) {
+        std::cerr << "Scene '" << scene.name << "' needs ARB_bindless_texture\n";
+        return;
+    }
+    auto images = std::make_shared<BindlessTextures>();
+    for (const char* file : textureFiles) {
+        images->textures.emplace_back(file);
+        const int index = images->textures.back().id() != 0
+                              ? images->table.add(images->textures.back().id())
+                              : -1;
+        if (index < 0) {
+            std::cerr << "The images of scene '" << scene.name << "' could not be loaded\n";
+            return;
+        }
+        images->indices.push_back(static_cast<GLuint>(index));
+    }
+    images->table.upload();
+    auto shader = std::make_shared<Shader>();
+    shader->createShader("vertex.glsl", "fragment.glsl", "BINDLESS");
+    scene.render = [images, shader](Scene& grid, UniformRing& uniforms,
+                                    const std::vector<ptrdiff_t>& objectdata, const Mat4&,
+                                    float) {
+        shader->use();
+        images->table.bind(textureBlockBinding);
+        for (size_t i = 0; i < grid.draws.size(); i++) {
+            shader->setUniform("textureIndex", images->indices[i % images->indices.size()]);
+            uniforms.bind(objectBlockBinding, objectdata[i], sizeof(ObjectUniforms));
+            grid.draws[i].shape->render();
+        }
+    };
+}
+
+// The draw of the sphere with its image as a VirtualTexture of small tiles, of which the
+// cache holds fewer than there are, after a feedback pass of the sphere every frame
+void addVirtualTexture(Scene& scene) {
+    const std::string imagefile = "textures/earth.tga";
+    const std::string tilefile = imagefile + ".tiles";
+    auto texture = std::make_shared<VirtualTexture>(8);
+    if ((!std::filesystem::exists(tilefile) && !VirtualTexture::bake(imagefile, tilefile, 32)) ||
+        !texture->open(tilefile)) {
+        return;
+    }
+    auto shader = std::make_shared<Shader>();
+    shader->createShader("vertex.glsl", "fragment_virtual.glsl");
+    scene.render = [texture, shader](Scene& sphere, UniformRing& uniforms,
+                                     const std::vector<ptrdiff_t>& objectdata, const Mat4&,
+                                     float) {
+        uniforms.bind(objectBlockBinding, objectdata[0], sizeof(ObjectUniforms));
+        texture->beginFeedback();
+        sphere.draws[0].shape->render();
+        texture->endFeedback();
+        texture->update();  // With the feedback of an earlier frame
+        shader->use();
+        texture->bind(shader->id());
+        sphere.draws[0].shape->render();
+    };
+}
+
+// One draw of a torus of 'side' x 'side' quads from a ProceduralGrid, whose vertices are
+// computed in the vertex shader, in place of a shape
+void addProceduralGrid(Scene& scene, int side) {
+    auto grid = std::make_shared<ProceduralGrid>();
+    if (!grid->create(ProceduralGrid::Shape::Torus, side, side)) {
+        return;
+    }
+    grid->setSize(1.0f, 0.4f);
+    scene.draws.push_back({nullptr, Mat4::translation(0.0f, 0.0f, -3.0f)});
+    scene.triangles = grid->triangles();
+    scene.render = [grid](Scene&, UniformRing& uniforms, const std::vector<ptrdiff_t>& objectdata,
+                          const Mat4&, float) {
+        uniforms.bind(objectBlockBinding, objectdata[0], sizeof(ObjectUniforms));
+        grid->render();
+    };
+}
+
+// The instances of the "impostors" scene: their places, and their model-view matrices of
+// the frame with the fade of Impostor::render()
+struct ImpostorField {
+    Impostor impostor;
+    std::vector<Mat4> placements;
+    std::vector<GLfloat> matrices;
+};
+
+// A square field of 'count' tori that recedes from the camera, drawn as instances with the
+// levels of detail of the torus near the camera and as billboards of an Impostor far from
+// it, cross-faded at the switch between the two
+void addImpostorField(Scene& scene, int count) {
+    scene.shapes.emplace_back();
+    TriangleSoup& torus = scene.shapes.back();
+    torus.createTorus(0.3f, 0.1f, 48, 24);
+    torus.generateLODs();
+    auto field = std::make_shared<ImpostorField>();
+    if (!field->impostor.bake(torus)) {
+        std::cerr << "The impostor of scene '" << scene.name << "' could not be baked\n";
+        return;
+    }
+    auto shader = std::make_shared<Shader>();
+    shader->createShader("vertex_instanced.glsl", "fragment.glsl", "LOD_FADE");
+    const int side = static_cast<int>(std::ceil(std::sqrt(double(count))));
+    for (int i = 0; i < count; i++) {
+        const float x = (float(i % side) - 0.5f * float(side - 1)) * 0.8f;
+        const float z = -1.5f - float(i / side) * 0.8f;
+        field->placements.push_back(Mat4::translation(x, -0.5f, z));
+    }
+    field->matrices.resize(16 * field->placements.size());
+    // For the material in the object data, without a shape of its own
+    scene.draws.push_back({nullptr, Mat4::translation(0.0f, 0.0f, -3.0f)});
+    // At the full detail, of which the levels of detail and the billboards draw less
+    scene.triangles = static_cast<long long>(torus.indices().size() / 3) * count;
+    scene.render = [field, shader](Scene& tori, UniformRing& uniforms,
+                                   const std::vector<ptrdiff_t>& objectdata, const Mat4& P,
+                                   float time) {
+        const Mat4 rotation = spin(time);
+        for (size_t i = 0; i < field->placements.size(); i++) {
+            const Mat4 MV = field->placements[i] * rotation;
+            std::copy(MV.data(), MV.data() + 16, &field->matrices[16 * i]);
+        }
+        uniforms.bind(objectBlockBinding, objectdata[0], sizeof(ObjectUniforms));
+        shader->use();
+        field->impostor.render(tori.shapes[0], *shader, P, field->matrices.data(),
+                               static_cast<int>(field->placements.size()));
+    };
+}
+
+// The terrain of the "terrain" scene, declared after its heightmap, which must outlive it
+struct TerrainHeights {
+    Texture heightmap;
+    Terrain terrain;
+};
+
+// A Terrain with the red channel of an image as its heights, facing the camera like the
+// other scenes, with the patches chosen again for its place every frame
+void addTerrain(Scene& scene) {
+    auto heights = std::make_shared<TerrainHeights>();
+    heights->heightmap.createTexture(textureFiles[0]);
+    if (heights->heightmap.id() == 0) {
+        std::cerr << "The heightmap of scene '" << scene.name << "' could not be loaded\n";
+        return;
+    }
+    heights->terrain.setSize(4.0f, 4.0f, 0.4f);
+    heights->terrain.setHeightmap(&heights->heightmap);
+    auto shader = std::make_shared<Shader>();
+    shader->createShader("vertex.glsl", "fragment.glsl", "TERRAIN");
+    scene.draws.push_back({nullptr, Mat4::translation(0.0f, 0.0f, -3.0f)});
+    scene.render = [heights, shader](Scene& terrain, UniformRing& uniforms,
+                                     const std::vector<ptrdiff_t>& objectdata, const Mat4& P,
+                                     float time) {
+        heights->terrain.select(P, terrain.draws[0].M * spin(time));
+        uniforms.bind(objectBlockBinding, objectdata[0], sizeof(ObjectUniforms));
+        shader->use();
+        // Those of the last frame, as they depend on the view
+        terrain.triangles = heights->terrain.render(*shader);
+    };
+}
+
+}  // namespace
+
+bool createScene(const std::string& name, const std::string& objfile, Scene& scene) {
+    scene.name = name;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const size_t colon = name.find(':');
+    const std::string kind = name.substr(0, colon);
+    const int count = (colon != std::string::npos) ? std::atoi(name.c_str() + colon + 1) : 0;
+
+    if (kind == "boxes" && count > 0) {
+        addBoxGrid(scene, count);
+    } else if (kind == "textures" && count > 0) {
+        addBoxGrid(scene, count);
+        addTextureArray(scene);
+        if (!scene.render) {
+            return false;
+        }
+    } else if (kind == "bindless" && count > 0) {
+        addBoxGrid(scene, count);
+        addTextureTable(scene);
+        if (!scene.render) {
+            return false;
+        }
+    } else if (kind == "virtual" && colon == std::string::npos) {
+        scene.shapes.emplace_back();
+        scene.shapes[0].createSphere(1.0f, 64);
+        scene.draws.push_back({&scene.shapes[0], Mat4::translation(0.0f, 0.0f, -3.0f)});
+        addVirtualTexture(scene);
+        if (!scene.render) {
+            return false;
+        }
+    } else if (kind == "grid" && count > 0) {
+        addProceduralGrid(scene, count);
+        if (!scene.render) {
+            return false;
+        }
+    } else if (kind == "impostors" && count > 0) {
+        addImpostorField(scene, count);
+        if (!scene.render) {
+            return false;
+        }
+    } else if (kind == "terrain" && colon == std::string::npos) {
+        addTerrain(scene);
+        if (!scene.render) {
+            return false;
+        }
+    } else if (kind == "sphere" && count > 0) {
+        scene.shapes.emplace_back();
+        scene.shapes[0].createSphere(1.0f, count);
+        scene.draws.push_back({&scene.shapes[0], Mat4::translation(0.0f, 0.0f, -3.0f)});
+    } else if (kind == "obj" && colon == std::string::npos) {
+        scene.shapes.emplace_back();
+        scene.shapes[0].readOBJ(objfile);
+        scene.draws.push_back({&scene.shapes[0], Mat4::translation(0.0f, 0.0f, -3.0f)});
+    } else {
+        std::cerr << "Unknown scene '" << name << "'\n";
+        return false;
+    }
+    scene.loadtime = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    for (const SceneDraw& draw : scene.draws) {
+        if (!draw.shape) {
+            continue;  // Counted by the scene
+        }
+        scene.triangles += static_cast<long long>(draw.shape->indices().size() / 3);
+    }
+    return true;
+}
+
+Mat4 sceneProjection(int width, int height) {
+    return Mat4::perspective(float(M_PI) / 3.0f, float(width) / float(height), 0.1f, 100.0f);
+}
+
+Mat4 spin(float time) {
+    return Mat4::rotationY(time * float(M_PI) / 4.0f) *
+           Mat4::rotationX(time * float(M_PI) / 8.0f);
+}
+
+void drawScene(Scene& scene, Shader& shader, UniformRing& uniforms, MaterialTable& materials,
+               const Mat4& P, float time, std::vector<ptrdiff_t>& objectdata,
+               ReprojectionCache* motion) {
+    shader.use();
+    uniforms.beginFrame();
+    const ptrdiff_t framedata = uniforms.push(FrameUniforms{P, Mat4::identity(), time, {}});
+    const Mat4 rotation = spin(time);
+    objectdata.clear();
+    for (const SceneDraw& draw : scene.draws) {
+        objectdata.push_back(uniforms.push(ObjectUniforms{draw.M * rotation, rotation}));
+    }
+    uniforms.upload();
+
+    uniforms.bind(frameBlockBinding, framedata, sizeof(FrameUniforms));
+    materials.bind(materialBlockBinding);
+    if (scene.render) {
+        scene.render(scene, uniforms, objectdata, P, time);
+        return;
+    }
+    for (size_t i = 0; i < scene.draws.size(); i++) {
+        uniforms.bind(objectBlockBinding, objectdata[i], sizeof(ObjectUniforms));
+        if (motion) {
+            motion->setDraw(shader, i, scene.draws[i].shape, P * scene.draws[i].M * rotation);
+        }
+        scene.draws[i].shape->render();
+    }
+}
+
+}  // namespace bench
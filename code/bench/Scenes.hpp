@@ -0,0 +1,92 @@
+/*
+ * The scripted scenes of the benchmarks, in the library tnm046-scenes that tnm046-bench
+ * draws them from and that the Autotuner of tnm046-labs measures with.
+ *
+ * Usage: createScene() makes the shapes and the draws of a scene from its name, and
+ *        drawScene() draws it at a time with a projection into the bound framebuffer, with
+ *        a shader of vertex.glsl and fragment.glsl. The draws stand in a row at z = -3, in
+ *        view space, and each frame turns them by spin().
+ *        Scenes: "boxes:<count>" - a square grid of boxes, each drawn with a draw call of
+ *                                  its own
+ *                "sphere:<segments>" - one sphere
+ *                "obj" - one mesh from an OBJ file
+ *                "textures:<count>" - the grid of boxes, each with one of the images of
+ *                                     textures/, all from one TextureArray
+ *                "bindless:<count>" - the grid of boxes, each with one of the images of
+ *                                     textures/ as a texture of its own, from a
+ *                                     TextureTable of bindless handles, where
+ *                                     ARB_bindless_texture is supported
+ *                "virtual" - a sphere with textures/earth.tga as a VirtualTexture, from
+ *                            the tile file textures/earth.tga.tiles, which is baked when
+ *                            it is missing, in a cache that holds only part of the tiles
+ *                "grid:<quads>" - a torus of <quads> x <quads> quads from a ProceduralGrid,
+ *                                 generated in the vertex shader without any buffers
+ *                "impostors:<count>" - a field of tori that recedes from the camera, drawn
+ *                                      with TriangleSoup::renderInstancedLOD() near it and
+ *                                      as billboards of an Impostor far from it, with a
+ *                                      cross-fade at the switch
+ *                "terrain" - a Terrain with the red channel of textures/earth.tga as its
+ *                            heights, drawn with the TERRAIN variant of vertex.glsl
+ *        The scenes of the other modules draw with shaders of their own, without a
+ *        MOTION_VECTORS variant, and keep the objects of those modules in the Scene.
+ *        The library holds only the scenes. The modules that they draw with are compiled
+ *        into each program that links it.
+ *
+ * This code is in the public domain.
+ */
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Mat4.hpp"
+#include "TriangleSoup.hpp"
+
+class MaterialTable;
+class ReprojectionCache;
+class Shader;
+class UniformRing;
+
+namespace bench {
+
+// One draw of a scene: a shape and its model transformation, before the animated rotation
+struct SceneDraw {
+    TriangleSoup* shape;  // Null for a draw that only the render function of the scene draws
+    Mat4 M;
+};
+
+struct Scene {
+    std::string name;
+    std::deque<TriangleSoup> shapes;  // Which do not move when more are added
+    std::vector<SceneDraw> draws;
+    double loadtime = 0.0;  // Milliseconds to create the shapes
+    long long triangles = 0;  // Of the last frame for "terrain", whose patches change
+    // Draws the draws in place of TriangleSoup::render(), for the scenes of the other
+    // modules. drawScene() calls it with the frame and the object data of each draw in
+    // 'uniforms', at the offsets 'objectdata'.
+    std::function<void(Scene& scene, UniformRing& uniforms,
+                       const std::vector<ptrdiff_t>& objectdata, const Mat4& P, float time)>
+        render;
+};
+
+/* Create the shapes and draws of the scene 'name' into 'scene', with 'objfile' for "obj".
+ * False, after printing why, for an unknown scene or one whose files do not load. */
+bool createScene(const std::string& name, const std::string& objfile, Scene& scene);
+
+// The projection of the scenes, for a framebuffer of 'width' x 'height'
+Mat4 sceneProjection(int width, int height);
+
+// The model transformations of the draws at 'time' are their M times this
+Mat4 spin(float time);
+
+/* Draw the draws of a scene at 'time' with the projection 'P', into the bound framebuffer.
+ * 'uniforms' needs room for the uniforms of every draw and one more. With 'motion', the
+ * matrices of the draws go to it for the MOTION_VECTORS variant. */
+void drawScene(Scene& scene, Shader& shader, UniformRing& uniforms, MaterialTable& materials,
+               const Mat4& P, float time, std::vector<ptrdiff_t>& objectdata,
+               ReprojectionCache* motion = nullptr);
+
+}  // namespace bench
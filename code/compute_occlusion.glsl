@@ -0,0 +1,98 @@
+#version 430 core
+
+// Occlusion culling for MeshBatch::renderOcclusionCulled(), one invocation per draw.
+// Phase 0 selects the draws that were visible in the last frame, to draw them first.
+// Phase 1 tests all draws against the frustum and a Hi-Z pyramid of that depth, remembers
+// which are visible, and selects the visible ones that phase 0 did not draw.
+// The selected matrices are appended to the instance range of their draw command.
+
+layout(local_size_x = 64) in;
+
+struct DrawCommand {
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer Matrices { mat4 matrices[]; };
+layout(std430, binding = 1) writeonly buffer Selected { mat4 selected[]; };
+layout(std430, binding = 2) buffer Commands { DrawCommand commands[]; };
+layout(std430, binding = 3) readonly buffer DrawCommandIndex { uint commandIndex[]; };
+layout(std430, binding = 4) readonly buffer Bounds { vec4 bounds[]; };  // min, max per command
+layout(std430, binding = 5) buffer Visibility { uint visible[]; };
+
+uniform mat4 P;
+uniform int phase;
+uniform uint numDraws;
+uniform sampler2D hiz;  // HiZBuffer, the farthest depth of each region in every level
+
+// True if the box of draw 'i' may be visible
+bool testDraw(uint i, mat4 PMV, vec3 bmin, vec3 bmax) {
+	// The box corners in clip space, and their screen rectangle and nearest depth
+	vec3 ndcmin = vec3(1.0);
+	vec3 ndcmax = vec3(-1.0);
+	ivec3 below = ivec3(0), above = ivec3(0);  // Corners beyond each clip plane
+	bool behind = false;
+	for (int k = 0; k < 8; k++) {
+		vec3 corner = vec3((k & 1) != 0 ? bmax.x : bmin.x, (k & 2) != 0 ? bmax.y : bmin.y,
+		                   (k & 4) != 0 ? bmax.z : bmin.z);
+		vec4 clip = PMV * vec4(corner, 1.0);
+		below += ivec3(lessThan(clip.xyz, -clip.www));
+		above += ivec3(greaterThan(clip.xyz, clip.www));
+		if (clip.w <= 0.0) {
+			behind = true;  // The box crosses the eye plane, so keep it
+			continue;
+		}
+		vec3 ndc = clip.xyz / clip.w;
+		ndcmin = min(ndcmin, ndc);
+		ndcmax = max(ndcmax, ndc);
+	}
+	// Frustum: outside if all corners are beyond the same clip plane
+	if (any(equal(below, ivec3(8))) || any(equal(above, ivec3(8)))) {
+		return false;
+	}
+	if (behind) {
+		return true;
+	}
+
+	// Occlusion: the level where the rectangle covers at most 2x2 texels
+	ivec2 size = textureSize(hiz, 0);
+	vec2 pmin = clamp(ndcmin.xy * 0.5 + 0.5, 0.0, 1.0) * vec2(size);
+	vec2 pmax = clamp(ndcmax.xy * 0.5 + 0.5, 0.0, 1.0) * vec2(size);
+	float extent = max(max(pmax.x - pmin.x, pmax.y - pmin.y), 1.0);
+	int level = min(int(ceil(log2(extent))), textureQueryLevels(hiz) - 1);
+	ivec2 lsize = textureSize(hiz, level);
+	// Texels at the odd edge of a level also cover the pixels beyond it
+	ivec2 tmin = min(ivec2(pmin) >> level, lsize - 1);
+	ivec2 tmax = min(ivec2(pmax) >> level, lsize - 1);
+	float farthest = 0.0;
+	for (int y = tmin.y; y <= tmax.y; y++) {
+		for (int x = tmin.x; x <= tmax.x; x++) {
+			farthest = max(farthest, texelFetch(hiz, ivec2(x, y), level).r);
+		}
+	}
+	float nearest = ndcmin.z * 0.5 + 0.5;
+	return nearest <= farthest;
+}
+
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	if (i >= numDraws) {
+		return;
+	}
+	uint c = commandIndex[i];
+	bool select;
+	if (phase == 0) {
+		select = visible[i] != 0u;
+	} else {
+		bool isvisible = testDraw(i, P * matrices[i], bounds[2 * c].xyz, bounds[2 * c + 1].xyz);
+		select = isvisible && visible[i] == 0u;
+		visible[i] = isvisible ? 1u : 0u;
+	}
+	if (select) {
+		uint slot = atomicAdd(commands[c].instanceCount, 1u);
+		selected[commands[c].baseInstance + slot] = matrices[i];
+	}
+}
@@ -0,0 +1,12 @@
+// An ordered dither for cross-fades without blending: a threshold from 0 to 15/16 for each
+// pixel of a 4 x 4 Bayer matrix. A surface that keeps the pixels whose threshold is below
+// a fraction and one that keeps the rest cover each pixel once between them, as the
+// LOD_FADE meshes and the billboards of Impostor (Impostor.hpp) do.
+// Included by the fragment shaders that fade.
+
+float ditherThreshold() {
+	const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+	                                  3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+	ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;
+	return bayer[pixel.y * 4 + pixel.x] / 16.0;
+}
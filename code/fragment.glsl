@@ -1,34 +1,295 @@
 #version 330 core
 
+#ifdef BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
+#ifdef OIT_LISTS
+#extension GL_ARB_shader_image_load_store : require
+#extension GL_ARB_shader_atomic_counters : require
+layout(early_fragment_tests) in;  // Only the fragments in front of the opaque surfaces
+#endif
+
 in vec3 interpolatedNormal;
 in vec2 st;
 in vec3 lightDirection;
 
-out vec4 finalcolor;
+#ifdef OIT_WEIGHTED
+layout(location = 0) out vec4 finalcolor;  // Weighted color sum, and the transparency product
+layout(location = 1) out float oitWeight;  // Weight sum
+#elif defined(PICKING)
+// The object and the triangle of the pixel, for PickBuffer (PickBuffer.hpp)
+layout(location = 0) out vec4 finalcolor;
+layout(location = 1) out uvec2 pickId;
+uniform uint objectId;  // The object + 1, as 0 is no object
+#else
+layout(location = 0) out vec4 finalcolor;
+#endif
+#ifdef MOTION_VECTORS
+// The motion since the last frame, for the TAA of AntiAliasing (AntiAliasing.hpp), in the
+// target after those above
+#ifdef PICKING
+layout(location = 2) out vec2 motion;
+#else
+layout(location = 1) out vec2 motion;
+#endif
+uniform vec2 jitterDelta;  // The jitter of this frame less that of the last one
+#endif
+
+#include "uniforms.glsl"
+#include "materials.glsl"
+
+#ifdef LOD_FADE
+// The cross-fade to the billboards of Impostor (Impostor.hpp), from vertex.glsl
+#include "dither.glsl"
+flat in float lodFade;
+#endif
+
+#ifdef TEXTURED
+uniform sampler2D tex;  // Multiplies the ambient and diffuse colors
+#elif defined(TEXTURE_ARRAY)
+// The images of a TextureArray (TextureArray.hpp), and where the one of the draw is in it
+uniform sampler2DArray textureArray;
+uniform vec4 textureTransform;  // Scale and offset of st in the layer
+uniform float textureLayer;
+#elif defined(BINDLESS)
+// The handles of TextureTable, two in each uvec4, and the one that multiplies the colors
+layout(std140) uniform TextureData {
+	uvec4 textureHandles[1024];
+};
+uniform uint textureIndex;
+#endif
+
+in vec3 viewPosition;  // For CLUSTERED_LIGHTS and SHADOWS
+
+#ifdef WIREFRAME
+// The edges of the triangles, from geometry_wireframe.glsl. Only the edges are drawn, with
+// the shading of the surface and blended by their coverage of the pixel, or with
+// WIREFRAME_OVERLAY also defined in WIREFRAME_COLOR over the shaded surface.
+#ifndef WIREFRAME_WIDTH
+#define WIREFRAME_WIDTH 1.0  // In pixels
+#endif
+#ifndef WIREFRAME_COLOR
+#define WIREFRAME_COLOR vec3(0.0, 0.0, 0.0)
+#endif
+in vec3 barycentric;
+
+// How much of the pixel the nearest edge covers, with a filter of one pixel for the
+// antialiasing. fwidth() gives the change of each coordinate per pixel, so the distance to
+// the edge where the coordinate is 0 is the coordinate over it, in pixels.
+float wireCoverage() {
+	vec3 distances = barycentric / max(fwidth(barycentric), vec3(1e-6));
+	float distance = min(min(distances.x, distances.y), distances.z);
+	return clamp(0.5 * WIREFRAME_WIDTH + 0.5 - distance, 0.0, 1.0);
+}
+#endif
+
+#if defined(REPROJECTION) || defined(MOTION_VECTORS)
+uniform vec2 renderSize;     // Pixels of this frame
+in vec4 previousPosition;    // In the clip space of the last frame, from ReprojectionCache
+
+// The motion from the last frame in texture coordinates, applied to the center of the
+// pixel, since lines and points are not interpolated there
+vec2 screenMotion() {
+	vec4 clip = P * vec4(viewPosition, 1.0);
+	return 0.5 * (clip.xy / clip.w - previousPosition.xy / previousPosition.w);
+}
+#endif
+
+#ifdef REPROJECTION
+// The shading of the last frame from ReprojectionCache (ReprojectionCache.hpp)
+uniform sampler2D historyColor;
+uniform sampler2D historyDepth;
+uniform vec2 historyScale;   // From the texture coordinates of the last frame to the cache
+uniform int refreshPixel;    // Of each 4 x 4 block, the pixel that is shaded in any case
+uniform float drawHistory;   // 1.0 if the draw was in the last frame
+
+// Distance from the camera of a depth in the depth buffer
+float viewDistance(float depth) {
+	return P[3][2] / (2.0 * depth - 1.0 + P[2][2]);
+}
+
+// The color of this surface in the last frame, if it was visible there
+bool reproject(out vec3 color) {
+	ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;
+	if (drawHistory == 0.0 || pixel.y * 4 + pixel.x == refreshPixel ||
+	    previousPosition.w <= 0.0) {
+		return false;
+	}
+	vec2 position = gl_FragCoord.xy / renderSize - screenMotion();
+	if (any(lessThan(position, vec2(0.0))) || any(greaterThan(position, vec2(1.0)))) {
+		return false;  // Outside the last frame
+	}
+	vec2 coord = position * historyScale;
+	// Hidden by another surface in the last frame, whose distance was w
+	float distance = previousPosition.w;
+	if (abs(viewDistance(texture(historyDepth, coord).r) - distance) > 0.01 * distance) {
+		return false;
+	}
+	color = texture(historyColor, coord).rgb;
+	return true;
+}
+#endif
+
+#if defined(OIT_WEIGHTED) || defined(OIT_LISTS)
+// Order independent transparency from Transparency (Transparency.hpp)
+uniform float opacity;
+#endif
+
+#ifdef OIT_WEIGHTED
+// Add this fragment to the sums, weighted to favor the near and opaque fragments
+// (McGuire and Bavoil 2013, equation 10)
+void writeTransparent(vec3 color) {
+	float w = clamp(pow(min(1.0, opacity * 10.0) + 0.01, 3.0) * 1e8 *
+	                pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3);
+	finalcolor = vec4(color * opacity * w, opacity);
+	oitWeight = opacity * w;
+}
+#endif
+
+#ifdef OIT_LISTS
+layout(r32ui) uniform coherent uimage2D oitHeads;         // First fragment of each pixel
+layout(rgba32ui) uniform writeonly uimageBuffer oitNodes;  // Color, depth and next fragment
+layout(binding = 0, offset = 0) uniform atomic_uint oitCount;
+uniform uint oitMaxNodes;
+
+// Put this fragment at the head of the list of its pixel, if there is room for it
+void writeTransparent(vec3 color) {
+	uint node = atomicCounterIncrement(oitCount);
+	if (node < oitMaxNodes) {
+		uint next = imageAtomicExchange(oitHeads, ivec2(gl_FragCoord.xy), node);
+		uvec4 rgba = uvec4(round(clamp(vec4(color, opacity), 0.0, 1.0) * 255.0));
+		uint bits = rgba.r | (rgba.g << 8) | (rgba.b << 16) | (rgba.a << 24);
+		imageStore(oitNodes, int(node), uvec4(bits, floatBitsToUint(gl_FragCoord.z), next, 0u));
+	}
+	finalcolor = vec4(0.0);  // Not written, the color writes are off
+}
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+// Point lights sorted into clusters of the view frustum by LightClusters (LightClusters.hpp)
+uniform samplerBuffer lightData;       // Position and radius, then color and intensity
+uniform usamplerBuffer lightIndices;   // The light lists of all clusters
+uniform usamplerBuffer lightClusters;  // Offset and count of the list of each cluster
+uniform vec3 clusterGrid;              // Tiles in x and y, and slices in depth
+uniform vec2 clusterDepth;             // The slice is log(distance) * x + y
 
-uniform float time;
-uniform mat4 M;
-uniform mat4 R;
+// Phong shading with the lights of the cluster of this fragment
+vec3 clusteredLights(vec3 N, vec3 kd, vec3 ks, float n) {
+	vec4 clip = P * vec4(viewPosition, 1.0);
+	ivec3 grid = ivec3(clusterGrid);
+	ivec2 tile = clamp(ivec2((clip.xy / clip.w * 0.5 + 0.5) * clusterGrid.xy), ivec2(0),
+	                   grid.xy - 1);
+	int slice = clamp(int(log(-viewPosition.z) * clusterDepth.x + clusterDepth.y), 0,
+	                  grid.z - 1);
+	uvec2 list = texelFetch(lightClusters, (slice * grid.y + tile.y) * grid.x + tile.x).xy;
+
+	vec3 V = normalize(-viewPosition);
+	vec3 color = vec3(0.0);
+	for (uint i = 0u; i < list.y; i++) {
+		int light = int(texelFetch(lightIndices, int(list.x + i)).x);
+		vec4 positionradius = texelFetch(lightData, 2 * light);
+		vec4 colorintensity = texelFetch(lightData, 2 * light + 1);
+		vec3 L = positionradius.xyz - viewPosition;
+		float d = length(L);
+		L /= d;
+		float falloff = clamp(1.0 - d / positionradius.w, 0.0, 1.0);
+		float dotNL = max(dot(N, L), 0.0);
+		float dotRV = dotNL > 0.0 ? max(dot(reflect(-L, N), V), 0.0) : 0.0;
+		color += colorintensity.rgb * colorintensity.a * falloff * falloff *
+		         (kd * dotNL + ks * pow(dotRV, n));
+	}
+	return color;
+}
+#endif
+
+#ifdef SHADOWS
+// Cascaded shadow maps of the directional light from ShadowCascades (ShadowCascades.hpp)
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 shadowMatrix0;  // From view space to the texture and depth of each cascade
+uniform mat4 shadowMatrix1;
+uniform mat4 shadowMatrix2;
+uniform mat4 shadowMatrix3;
+uniform vec4 cascadeEnds;    // Distance from the camera where each cascade ends
+uniform float cascadeCount;
+
+// 1.0 where the light reaches this fragment, 0.0 in the shadow
+float shadow() {
+	int cascade = int(dot(vec4(greaterThan(vec4(-viewPosition.z), cascadeEnds)), vec4(1.0)));
+	if (cascade >= int(cascadeCount)) {
+		return 1.0;  // Beyond the last cascade
+	}
+	mat4 matrix = cascade == 0 ? shadowMatrix0 : cascade == 1 ? shadowMatrix1 :
+	              cascade == 2 ? shadowMatrix2 : shadowMatrix3;
+	vec3 coord = (matrix * vec4(viewPosition, 1.0)).xyz;
+	return texture(shadowMap, vec4(coord.xy, float(cascade), coord.z));
+}
+#endif
 
 void main() {
-		//vec3 lightDirection = vec3(1.0, 1.0, 1.0);
-		//float shading = dot(interpolatedNormal, lightDirection);
-		//shading = max(0.0, shading);  // Clamp negative values to 0.0
-		//finalcolor = vec4(vec3(shading), 1.0);
-		
+#ifdef LOD_FADE
+		if (ditherThreshold() < lodFade) {
+			discard;  // The pixels that the impostor covers
+		}
+#endif
+#ifdef WIREFRAME
+		float wire = wireCoverage();
+#ifndef WIREFRAME_OVERLAY
+		if (wire == 0.0) {
+			discard;  // Inside the triangle
+		}
+#endif
+#endif
+#ifdef PICKING
+		pickId = uvec2(objectId, uint(gl_PrimitiveID));
+#endif
+#ifdef MOTION_VECTORS
+		// Without the jitter, which is not motion, and off the view where the surface was
+		// behind the camera
+		motion = previousPosition.w > 0.0 ? screenMotion() - jitterDelta : vec2(2.0);
+#endif
+#ifdef REPROJECTION
+		vec3 reprojected;
+		if (reproject(reprojected)) {
+			finalcolor = vec4(reprojected, 1.0);
+			return;
+		}
+#endif
+#ifdef DIFFUSE_ONLY
+		// Plain diffuse shading in gray
+		float shading = dot(normalize(interpolatedNormal), normalize(lightDirection));
+		shading = max(0.0, shading);  // Clamp negative values to 0.0
+		finalcolor = vec4(vec3(shading), 1.0);
+#else
 		vec3 V = vec3(0.0, 0.0, 1.0);
 		V = normalize(V);
 		vec3 L = normalize(lightDirection);
 		vec3 N = normalize(interpolatedNormal);
 
-		vec3 Ia = vec3(0.5, 0.5, 0.5);
-		vec3 ka = vec3(0.5, 0.0, 0.0);
-		vec3 Id = vec3(1.0, 1.0, 1.0);
-		vec3 kd = vec3(0.5, 0.0, 0.0);
-		vec3 Is = vec3(1.0, 1.0, 1.0);
-		vec3 ks = vec3(1.0, 1.0, 1.0);
+		// The material of the draw, from the table of all materials
+		Material m = materials[material];
+		vec3 Ia = illumination[0].rgb;
+		vec3 ka = m.ka;
+		vec3 Id = illumination[1].rgb;
+		vec3 kd = m.kd;
+		vec3 Is = illumination[2].rgb;
+		vec3 ks = m.ks;
+#if defined(TEXTURED) || defined(TEXTURE_ARRAY) || defined(BINDLESS)
+#ifdef BINDLESS
+		uvec4 pair = textureHandles[textureIndex / 2u];
+		sampler2D tex = sampler2D((textureIndex & 1u) == 0u ? pair.xy : pair.zw);
+#endif
+#ifdef TEXTURE_ARRAY
+		vec3 texcolor = texture(textureArray,
+		                        vec3(st * textureTransform.xy + textureTransform.zw,
+		                             textureLayer)).rgb;
+#else
+		vec3 texcolor = texture(tex, st).rgb;
+#endif
+		ka *= texcolor;
+		kd *= texcolor;
+#endif
 
-		float n = 10.0;
+		float n = m.n;
 		
 		// vec3 L is the light direction
 		// vec3 V is the view direction - (0,0,1) in view space
@@ -47,7 +308,24 @@ void main() {
 		float dotNL = max(dot(N,L), 0.0); //If negative, set to zero
 		float dotRV = max(dot(Ref,V), 0.0);
 		if(dotNL == 0.0) dotRV = 0.0;
-		vec3 shadedcolor = Ia*ka + Id*kd *dotNL + Is*ks *pow(dotRV, n);
+#ifdef SHADOWS
+		float lit = shadow();
+#else
+		float lit = 1.0;
+#endif
+		vec3 shadedcolor = Ia*ka + lit * (Id*kd *dotNL + Is*ks *pow(dotRV, n));
+#ifdef CLUSTERED_LIGHTS
+		shadedcolor += clusteredLights(N, kd, ks, n);
+#endif
+#if defined(WIREFRAME) && defined(WIREFRAME_OVERLAY)
+		shadedcolor = mix(shadedcolor, WIREFRAME_COLOR, wire);
+#endif
+#if defined(OIT_WEIGHTED) || defined(OIT_LISTS)
+		writeTransparent(shadedcolor);
+#elif defined(WIREFRAME) && !defined(WIREFRAME_OVERLAY)
+		finalcolor = vec4(shadedcolor, wire);  // Blended by GLprimer
+#else
 		finalcolor = vec4 (shadedcolor, 1.0);
-
+#endif
+#endif
 }
@@ -0,0 +1,45 @@
+#version 330 core
+
+// The bloom of PostProcess (PostProcess.hpp), at a half or a quarter of the resolution.
+// With DOWNSAMPLE, the colors of the scene over the threshold, averaged down to the
+// viewport. Without, one direction of a Gaussian blur of 9 texels, in 5 bilinear taps.
+
+uniform sampler2D source;
+uniform vec2 sourceSize;  // DOWNSAMPLE: the size of the scene in texels, at the lower left
+uniform vec2 targetSize;  // The size of the viewport in pixels
+uniform float threshold;  // DOWNSAMPLE: the brightness where the bloom starts
+uniform vec2 direction;   // Blur: (1, 0) across or (0, 1) down
+
+out vec4 finalcolor;
+
+#ifdef DOWNSAMPLE
+void main() {
+	vec2 texel = 1.0 / vec2(textureSize(source, 0));
+	vec2 position = gl_FragCoord.xy / targetSize * sourceSize;
+	// Four bilinear taps a quarter of the footprint of the pixel from its center, which
+	// average the 2x2 or 4x4 texels under it
+	vec2 offset = 0.25 * sourceSize / targetSize;
+	vec2 low = vec2(0.5);
+	vec2 high = sourceSize - 0.5;
+	vec3 color = 0.25 * (
+		texture(source, clamp(position + vec2(-offset.x, -offset.y), low, high) * texel).rgb +
+		texture(source, clamp(position + vec2(offset.x, -offset.y), low, high) * texel).rgb +
+		texture(source, clamp(position + vec2(-offset.x, offset.y), low, high) * texel).rgb +
+		texture(source, clamp(position + vec2(offset.x, offset.y), low, high) * texel).rgb);
+	float brightness = max(color.r, max(color.g, color.b));
+	finalcolor = vec4(color * max(brightness - threshold, 0.0) / max(brightness, 1e-4), 1.0);
+}
+#else
+void main() {
+	vec2 texel = 1.0 / vec2(textureSize(source, 0));
+	vec2 uv = gl_FragCoord.xy / targetSize;
+	vec2 offset = direction * texel;
+	// The weights and offsets of a 9 texel binomial kernel, merged in pairs of texels
+	vec3 color = 0.2270270270 * texture(source, uv).rgb;
+	color += 0.3162162162 * (texture(source, uv + 1.3846153846 * offset).rgb +
+	                         texture(source, uv - 1.3846153846 * offset).rgb);
+	color += 0.0702702703 * (texture(source, uv + 3.2307692308 * offset).rgb +
+	                         texture(source, uv - 3.2307692308 * offset).rgb);
+	finalcolor = vec4(color, 1.0);
+}
+#endif
@@ -0,0 +1,6 @@
+#version 330 core
+
+// Depth only: nothing is written but the depth of the rasterizer, so no color is computed.
+
+void main() {
+}
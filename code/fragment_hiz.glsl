@@ -0,0 +1,22 @@
+#version 330 core
+
+// Reduction of one level of the Hi-Z pyramid (HiZBuffer.cpp) to the next. Each texel gets the
+// farthest depth of the 2x2 texels below it, or up to 3x3 at the edge of a level of odd size.
+
+// Only the level below is visible, as the base and max level of the texture
+uniform sampler2D depthTexture;
+
+void main() {
+	ivec2 size = textureSize(depthTexture, 0);
+	ivec2 p = 2 * ivec2(gl_FragCoord.xy);
+	int nx = ((size.x & 1) == 1 && p.x + 3 == size.x) ? 3 : 2;
+	int ny = ((size.y & 1) == 1 && p.y + 3 == size.y) ? 3 : 2;
+	float depth = 0.0;
+	for (int y = 0; y < ny; y++) {
+		for (int x = 0; x < nx; x++) {
+			ivec2 q = min(p + ivec2(x, y), size - 1);
+			depth = max(depth, texelFetch(depthTexture, q, 0).r);
+		}
+	}
+	gl_FragDepth = depth;
+}
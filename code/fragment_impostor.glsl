@@ -0,0 +1,69 @@
+#version 330 core
+
+// The billboards of Impostor (Impostor.hpp), shaded like fragment.glsl with the color and
+// the normal of the atlas views. With BAKE defined, the views that go into the atlases.
+
+#ifdef BAKE
+in vec3 bakedNormal;
+in vec2 st;
+
+uniform sampler2D tex;   // Multiplies the color, if textured is 1
+uniform float textured;
+
+layout(location = 0) out vec4 color;   // The texture color, and the coverage
+layout(location = 1) out vec4 normal;  // From -1..1 to 0..1
+
+void main() {
+	color = vec4(textured > 0.5 ? texture(tex, st).rgb : vec3(1.0), 1.0);
+	normal = vec4(normalize(bakedNormal) * 0.5 + 0.5, 1.0);
+}
+#else
+in vec2 viewCoords[4];
+flat in vec2 cells[4];
+flat in vec4 weights;
+flat in mat3 normalMatrix;
+flat in float fade;
+
+uniform sampler2D colorAtlas;
+uniform sampler2D normalAtlas;
+uniform float views;
+
+out vec4 finalcolor;
+
+#include "uniforms.glsl"
+#include "materials.glsl"
+#include "dither.glsl"
+
+void main() {
+	if (ditherThreshold() >= 1.0 - fade) {
+		discard;  // The pixels that the mesh covers while they cross-fade
+	}
+	// The views are black with no coverage outside the mesh, so the colors are weighted by
+	// the coverage already, and the normals are 0 there
+	vec4 color = vec4(0.0);
+	vec3 normal = vec3(0.0);
+	for (int i = 0; i < 4; i++) {
+		vec2 coord = (cells[i] + clamp(viewCoords[i], 0.0, 1.0)) / views;
+		color += weights[i] * texture(colorAtlas, coord);
+		normal += weights[i] * (texture(normalAtlas, coord).xyz * 2.0 - 1.0);
+	}
+	if (color.a < 0.5) {
+		discard;  // Outside the silhouette
+	}
+	vec3 texcolor = color.rgb / color.a;
+
+	vec3 V = vec3(0.0, 0.0, 1.0);
+	vec3 L = normalize(vec3(1.0, 0.8, 1.0));  // lightDirection of vertex.glsl
+	vec3 N = normalize(normalMatrix * normal);
+	Material m = materials[material];
+	vec3 ka = m.ka * texcolor;
+	vec3 kd = m.kd * texcolor;
+	vec3 Ref = 2.0 * dot(N, L) * N - L;
+	float dotNL = max(dot(N, L), 0.0);
+	float dotRV = dotNL > 0.0 ? max(dot(Ref, V), 0.0) : 0.0;
+	vec3 shadedcolor = illumination[0].rgb * ka +
+	                   illumination[1].rgb * kd * dotNL +
+	                   illumination[2].rgb * m.ks * pow(dotRV, m.n);
+	finalcolor = vec4(shadedcolor, 1.0);
+}
+#endif
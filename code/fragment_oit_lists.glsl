@@ -0,0 +1,55 @@
+#version 330 core
+#extension GL_ARB_shader_image_load_store : require
+
+// The lists of transparent fragments from Transparency (Transparency.hpp), sorted by depth
+// and blended over the opaque surfaces with glBlendFunc(GL_ONE, GL_SRC_ALPHA). The lists
+// are emptied for the next frame.
+
+#define MAX_FRAGMENTS 16  // Transparency::maxfragments
+#define LIST_END 0xffffffffu
+
+layout(r32ui) uniform coherent uimage2D heads;
+layout(rgba32ui) uniform readonly uimageBuffer nodes;
+
+out vec4 finalcolor;
+
+vec4 unpackColor(uint bits) {
+	return vec4(uvec4(bits, bits >> 8, bits >> 16, bits >> 24) & 0xffu) / 255.0;
+}
+
+void main() {
+	uint node = imageAtomicExchange(heads, ivec2(gl_FragCoord.xy), LIST_END);
+	if (node == LIST_END) {
+		discard;  // No transparent surfaces here
+	}
+
+	// The nearest MAX_FRAGMENTS fragments, sorted from near to far by insertion
+	vec4 colors[MAX_FRAGMENTS];
+	float depths[MAX_FRAGMENTS];
+	int count = 0;
+	while (node != LIST_END) {
+		uvec4 fragment = imageLoad(nodes, int(node));
+		node = fragment.z;
+		float depth = uintBitsToFloat(fragment.y);
+		if (count == MAX_FRAGMENTS && depth >= depths[MAX_FRAGMENTS - 1]) {
+			continue;
+		}
+		int i = min(count, MAX_FRAGMENTS - 1);
+		for (; i > 0 && depths[i - 1] > depth; i--) {
+			colors[i] = colors[i - 1];
+			depths[i] = depths[i - 1];
+		}
+		colors[i] = unpackColor(fragment.x);
+		depths[i] = depth;
+		count = min(count + 1, MAX_FRAGMENTS);
+	}
+
+	// Over, from back to front
+	vec3 color = vec3(0.0);
+	float transmittance = 1.0;
+	for (int i = count - 1; i >= 0; i--) {
+		color = colors[i].rgb * colors[i].a + color * (1.0 - colors[i].a);
+		transmittance *= 1.0 - colors[i].a;
+	}
+	finalcolor = vec4(color, transmittance);
+}
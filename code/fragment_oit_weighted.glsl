@@ -0,0 +1,23 @@
+#version 330 core
+
+// The weighted sums of the transparent fragments from Transparency (Transparency.hpp),
+// divided into a mean color and blended over the opaque surfaces with
+// glBlendFunc(GL_ONE, GL_SRC_ALPHA)
+
+uniform sampler2D accumulation;  // Weighted color sum, and the product of the transparencies
+uniform sampler2D weights;       // Weight sum
+
+out vec4 finalcolor;
+
+void main() {
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec4 sum = texelFetch(accumulation, pixel, 0);
+	float revealage = sum.a;
+	if (revealage >= 1.0) {
+		discard;  // No transparent surfaces here
+	}
+	float weight = texelFetch(weights, pixel, 0).r;
+	// The sums of half floats can overflow with many layers
+	vec3 color = min(sum.rgb, vec3(65504.0)) / max(weight, 1e-5);
+	finalcolor = vec4(color * (1.0 - revealage), revealage);
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+// The widgets of Overlay: the font atlas, which has a white texel for the shapes, times the
+// color of the vertex, blended over the frame
+
+uniform sampler2D font;  // Coverage in red
+
+in vec2 st;
+in vec4 color;
+
+out vec4 finalcolor;
+
+void main() {
+	finalcolor = vec4(color.rgb, color.a * texture(font, st).r);
+}
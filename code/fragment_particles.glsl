@@ -0,0 +1,18 @@
+#version 330 core
+
+// Soft round point sprites, added to the color that is there, from hot to cool as they age
+
+in float fade;
+
+out vec4 finalcolor;
+
+void main() {
+	vec2 offset = gl_PointCoord * 2.0 - 1.0;
+	float r2 = dot(offset, offset);
+	if (r2 > 1.0) {
+		discard;
+	}
+	float alpha = 0.3 * (1.0 - r2) * fade;  // Many particles add up
+	vec3 color = mix(vec3(0.8, 0.2, 0.05), vec3(1.0, 0.8, 0.4), fade);
+	finalcolor = vec4(color * alpha, alpha);
+}
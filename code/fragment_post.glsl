@@ -0,0 +1,92 @@
+#version 330 core
+
+// The effects after the main pass in one program (PostProcess.hpp), with a define for each
+// one that is on: BLOOM, TONEMAP, GRADE, GAMMA, FXAA and VIGNETTE, applied in that order
+
+uniform sampler2D source;  // The scene in its lower left corner
+uniform vec2 sourceSize;   // The size of the scene in texels
+uniform vec2 targetSize;   // The size of the viewport in pixels
+
+uniform sampler2D bloom;       // The blurred bright colors, over the whole texture
+uniform float bloomIntensity;
+uniform float exposure;
+uniform vec3 gain;
+uniform float saturation;
+uniform float contrast;
+uniform float vignette;
+
+out vec4 finalcolor;
+
+// The final color of the scene at 'uv', from 0 to 1 over the scene, before the effects
+// that need the pixels around it
+vec3 display(vec2 uv) {
+	vec2 texel = 1.0 / vec2(textureSize(source, 0));
+	vec2 position = clamp(uv * sourceSize, vec2(0.5), sourceSize - 0.5) * texel;
+	vec3 color = texture(source, position).rgb;
+#ifdef BLOOM
+	color += bloomIntensity * texture(bloom, uv).rgb;
+#endif
+#ifdef TONEMAP
+	// The ACES filmic curve, as fitted by Krzysztof Narkowicz
+	color *= exposure;
+	color = clamp(color * (2.51 * color + 0.03) / (color * (2.43 * color + 0.59) + 0.14),
+	              0.0, 1.0);
+#endif
+#ifdef GRADE
+	color *= gain;
+	color = mix(vec3(dot(color, vec3(0.2126, 0.7152, 0.0722))), color, saturation);
+	color = max((color - 0.5) * contrast + 0.5, 0.0);
+#endif
+#ifdef GAMMA
+	color = pow(clamp(color, 0.0, 1.0), vec3(1.0 / 2.2));
+#endif
+	return color;
+}
+
+#ifdef FXAA
+float luma(vec3 color) {
+	return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+// FXAA of Timothy Lottes, the fast version: blend along the edge through the pixel, found
+// from the lumas of the four diagonal neighbors
+vec3 antialias(vec2 uv) {
+	vec2 texel = 1.0 / sourceSize;
+	vec3 center = display(uv);
+	float lumanw = luma(display(uv + vec2(-1.0, 1.0) * texel));
+	float lumane = luma(display(uv + vec2(1.0, 1.0) * texel));
+	float lumasw = luma(display(uv + vec2(-1.0, -1.0) * texel));
+	float lumase = luma(display(uv + vec2(1.0, -1.0) * texel));
+	float lumam = luma(center);
+	float lumamin = min(lumam, min(min(lumanw, lumane), min(lumasw, lumase)));
+	float lumamax = max(lumam, max(max(lumanw, lumane), max(lumasw, lumase)));
+	if (lumamax - lumamin < max(0.0312, 0.125 * lumamax)) {
+		return center;  // No edge here
+	}
+
+	vec2 direction = vec2(-((lumanw + lumane) - (lumasw + lumase)),
+	                      (lumanw + lumasw) - (lumane + lumase));
+	float reduce = max((lumanw + lumane + lumasw + lumase) * 0.25 * 0.125, 1.0 / 128.0);
+	float scale = 1.0 / (min(abs(direction.x), abs(direction.y)) + reduce);
+	direction = clamp(direction * scale, -8.0, 8.0) * texel;
+	vec3 near = 0.5 * (display(uv + direction * (1.0 / 3.0 - 0.5)) +
+	                   display(uv + direction * (2.0 / 3.0 - 0.5)));
+	vec3 far = 0.5 * near + 0.25 * (display(uv - direction * 0.5) +
+	                                display(uv + direction * 0.5));
+	float lumafar = luma(far);
+	return (lumafar < lumamin || lumafar > lumamax) ? near : far;
+}
+#endif
+
+void main() {
+	vec2 uv = gl_FragCoord.xy / targetSize;
+#ifdef FXAA
+	vec3 color = antialias(uv);
+#else
+	vec3 color = display(uv);
+#endif
+#ifdef VIGNETTE
+	color *= pow(16.0 * uv.x * uv.y * (1.0 - uv.x) * (1.0 - uv.y), vignette);
+#endif
+	finalcolor = vec4(color, 1.0);
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+// A copy of the color and depth of a frame into ReprojectionCache (ReprojectionCache.hpp),
+// for the next frame to reuse
+
+uniform sampler2D color;
+uniform sampler2D depth;
+
+out vec4 finalcolor;
+
+void main() {
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	finalcolor = texelFetch(color, pixel, 0);
+	gl_FragDepth = texelFetch(depth, pixel, 0).r;
+}
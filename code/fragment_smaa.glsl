@@ -0,0 +1,153 @@
+#version 330 core
+
+// The three passes of SMAA (AntiAliasing.hpp), by their define:
+// EDGES finds the edges between each pixel and its left and top neighbors, into r and g.
+// WEIGHTS follows the edges of each pixel to their ends, and writes how much the pixel and
+// the neighbor across each edge take of each other's color: r is the pixel towards its top
+// neighbor, g that neighbor towards the pixel, b the pixel towards its left neighbor and a
+// that neighbor towards the pixel.
+// BLEND mixes each pixel with its neighbors by those weights.
+
+uniform sampler2D source;  // The scene in its lower left corner, for EDGES and BLEND
+uniform sampler2D edges;   // For WEIGHTS
+uniform sampler2D weights; // For BLEND
+uniform vec2 renderSize;   // The size of the scene in texels
+
+const float threshold = 0.1;  // Of the luma difference across an edge
+const int maxSearch = 16;     // AntiAliasing::maxSearch
+
+out vec4 finalcolor;
+
+ivec2 clampPixel(ivec2 pixel) {
+	return clamp(pixel, ivec2(0), ivec2(renderSize) - 1);
+}
+
+#ifdef EDGES
+// The luma of the colors compressed from 0 to 1, so that it works on half floats too
+float luma(ivec2 pixel) {
+	vec3 color = texelFetch(source, clampPixel(pixel), 0).rgb;
+	return dot(color / (1.0 + color), vec3(0.2126, 0.7152, 0.0722));
+}
+
+void main() {
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float center = luma(pixel);
+	float left = luma(pixel + ivec2(-1, 0));
+	float top = luma(pixel + ivec2(0, 1));
+	vec2 delta = abs(center - vec2(left, top));
+	vec2 found = step(threshold, delta);
+	if (found.x + found.y == 0.0) {
+		finalcolor = vec4(0.0);
+		return;
+	}
+	// Local contrast adaptation: an edge next to a much stronger one is left to it
+	float right = abs(center - luma(pixel + ivec2(1, 0)));
+	float bottom = abs(center - luma(pixel + ivec2(0, -1)));
+	float leftleft = abs(left - luma(pixel + ivec2(-2, 0)));
+	float toptop = abs(top - luma(pixel + ivec2(0, 2)));
+	float strongest = max(max(max(delta.x, delta.y), max(right, bottom)),
+	                      max(leftleft, toptop));
+	found *= step(strongest, 2.0 * delta);
+	finalcolor = vec4(found, 0.0, 0.0);
+}
+#endif
+
+#ifdef WEIGHTS
+vec2 edgesAt(ivec2 pixel) {
+	if (any(lessThan(pixel, ivec2(0))) || any(greaterThanEqual(pixel, ivec2(renderSize)))) {
+		return vec2(0.0);
+	}
+	return texelFetch(edges, pixel, 0).rg;
+}
+
+// Pixels from 'pixel' to the end of the edge 'channel' of the pixels in 'direction' from
+// it, or maxSearch if it goes on further
+int search(ivec2 pixel, ivec2 direction, int channel) {
+	int steps = 0;
+	while (steps < maxSearch && edgesAt(pixel + (steps + 1) * direction)[channel] > 0.5) {
+		steps++;
+	}
+	return steps;
+}
+
+// Where the line of an edge leaves an end: half a pixel to the side of the crossing edge
+// there, if it is on one side only. 'positive' is the side of the neighbor.
+float endHeight(float positive, float negative, int steps) {
+	if (steps == maxSearch) {
+		return 0.0;  // The end is too far to tell
+	}
+	return 0.5 * (step(0.5, positive) - step(0.5, negative));
+}
+
+// The height of the line through an edge, at the middle of the pixel 'before' pixels from
+// its start and 'after' pixels from its end. The line goes from 'start' at the start to the
+// middle of the edge, and on from there to 'end' at the end, which makes the L, Z and U
+// shapes of MLAA. Its height is the area of the pixel on the other side of the edge.
+float lineHeight(int before, int after, float start, float end) {
+	float middle = 0.5 * float(before + after + 1);
+	float x = float(before) + 0.5;
+	return x < middle ? start * (1.0 - x / middle) : end * (x - middle) / middle;
+}
+
+void main() {
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec2 e = edgesAt(pixel);
+	vec4 result = vec4(0.0);
+	if (e.y > 0.5) {
+		// The edge on top, from left to right, with the crossing edges above and below
+		int before = search(pixel, ivec2(-1, 0), 1);
+		int after = search(pixel, ivec2(1, 0), 1);
+		int first = pixel.x - before;
+		int last = pixel.x + after + 1;
+		float start = endHeight(edgesAt(ivec2(first, pixel.y + 1)).r,
+		                        edgesAt(ivec2(first, pixel.y)).r, before);
+		float end = endHeight(edgesAt(ivec2(last, pixel.y + 1)).r,
+		                      edgesAt(ivec2(last, pixel.y)).r, after);
+		float height = lineHeight(before, after, start, end);
+		result.rg = vec2(max(-height, 0.0), max(height, 0.0));
+	}
+	if (e.x > 0.5) {
+		// The edge on the left, from bottom to top, with the crossing edges left and right
+		int before = search(pixel, ivec2(0, -1), 0);
+		int after = search(pixel, ivec2(0, 1), 0);
+		int first = pixel.y - before - 1;
+		int last = pixel.y + after;
+		float start = endHeight(edgesAt(ivec2(pixel.x - 1, first)).g,
+		                        edgesAt(ivec2(pixel.x, first)).g, before);
+		float end = endHeight(edgesAt(ivec2(pixel.x - 1, last)).g,
+		                      edgesAt(ivec2(pixel.x, last)).g, after);
+		float height = lineHeight(before, after, start, end);
+		result.ba = vec2(max(-height, 0.0), max(height, 0.0));
+	}
+	finalcolor = result;
+}
+#endif
+
+#ifdef BLEND
+void main() {
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec4 center = texelFetch(source, pixel, 0);
+	vec4 w = texelFetch(weights, pixel, 0);
+	// Up, down, left and right
+	vec4 blend = vec4(w.r, texelFetch(weights, clampPixel(pixel + ivec2(0, -1)), 0).g, w.b,
+	                  texelFetch(weights, clampPixel(pixel + ivec2(1, 0)), 0).a);
+	float vertical = blend.x + blend.y;
+	float horizontal = blend.z + blend.w;
+	if (vertical + horizontal == 0.0) {
+		finalcolor = center;
+		return;
+	}
+	// Only the stronger direction, as in SMAA, so that a pixel is not blurred both ways
+	vec3 color;
+	if (vertical >= horizontal) {
+		color = center.rgb * (1.0 - vertical) +
+		        blend.x * texelFetch(source, clampPixel(pixel + ivec2(0, 1)), 0).rgb +
+		        blend.y * texelFetch(source, clampPixel(pixel + ivec2(0, -1)), 0).rgb;
+	} else {
+		color = center.rgb * (1.0 - horizontal) +
+		        blend.z * texelFetch(source, clampPixel(pixel + ivec2(-1, 0)), 0).rgb +
+		        blend.w * texelFetch(source, clampPixel(pixel + ivec2(1, 0)), 0).rgb;
+	}
+	finalcolor = vec4(color, center.a);
+}
+#endif
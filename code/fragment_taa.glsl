@@ -0,0 +1,58 @@
+#version 330 core
+
+// The resolve of TAA (AntiAliasing.hpp): this frame, drawn with a jitter of less than a
+// pixel, blended into the history of the frames before it, where the motion vectors say
+// each pixel was in the last frame
+
+uniform sampler2D source;    // The scene in its lower left corner
+uniform sampler2D motion;    // Of each pixel of the scene, in texture coordinates of the scene
+uniform sampler2D history;   // The last result, in its lower left corner
+uniform vec2 renderSize;     // The size of the scene in texels
+uniform vec2 historySize;    // The size of the last result in texels
+uniform float historyWeight; // Of the history in the result, 0 without history
+
+out vec4 finalcolor;
+
+// YCoCg, in which the colors around a pixel make a tighter box than in RGB
+vec3 toYCoCg(vec3 c) {
+	return vec3(0.25 * c.r + 0.5 * c.g + 0.25 * c.b, 0.5 * c.r - 0.5 * c.b,
+	            -0.25 * c.r + 0.5 * c.g - 0.25 * c.b);
+}
+
+vec3 fromYCoCg(vec3 c) {
+	return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z);
+}
+
+void main() {
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec4 center = texelFetch(source, pixel, 0);
+	// The box of the colors around the pixel in this frame
+	vec3 current = toYCoCg(center.rgb);
+	vec3 low = current;
+	vec3 high = current;
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			ivec2 neighbor = clamp(pixel + ivec2(x, y), ivec2(0), ivec2(renderSize) - 1);
+			vec3 color = toYCoCg(texelFetch(source, neighbor, 0).rgb);
+			low = min(low, color);
+			high = max(high, color);
+		}
+	}
+
+	vec2 uv = gl_FragCoord.xy / renderSize;
+	vec2 previous = uv - texelFetch(motion, pixel, 0).xy;
+	float weight = historyWeight;
+	if (any(lessThan(previous, vec2(0.0))) || any(greaterThan(previous, vec2(1.0)))) {
+		weight = 0.0;  // Outside the view in the last frame
+	}
+	vec2 position = clamp(previous * historySize, vec2(0.5), historySize - 0.5);
+	vec3 last = toYCoCg(texture(history, position / vec2(textureSize(history, 0))).rgb);
+	// What the history has that is not around the pixel now was hidden or has changed
+	last = clamp(last, low, high);
+
+	// Weighted by the inverse luma, so that a bright pixel in one frame does not flicker
+	float currentweight = (1.0 - weight) / (1.0 + current.x);
+	float lastweight = weight / (1.0 + last.x);
+	vec3 color = (current * currentweight + last * lastweight) / (currentweight + lastweight);
+	finalcolor = vec4(fromYCoCg(color), center.a);
+}
@@ -0,0 +1,32 @@
+#version 330 core
+
+// The scene drawn at a lower resolution, scaled up to the viewport by DynamicResolution
+// (DynamicResolution.hpp), and sharpened where the bilinear filter blurs it
+
+uniform sampler2D source;  // The scene in its lower left corner
+uniform vec2 sourceSize;   // The size of the scene in texels
+uniform vec2 targetSize;   // The size of the viewport in pixels
+uniform float sharpness;   // 0.0 for bilinear filtering only
+
+out vec4 finalcolor;
+
+// Bilinear, without reaching outside the scene
+vec3 sampleScene(vec2 position, vec2 texel) {
+	return texture(source, clamp(position, 0.5 * texel, (sourceSize - 0.5) * texel)).rgb;
+}
+
+void main() {
+	vec2 texel = 1.0 / vec2(textureSize(source, 0));
+	vec2 position = gl_FragCoord.xy / targetSize * sourceSize * texel;
+	vec3 center = sampleScene(position, texel);
+	vec3 north = sampleScene(position + vec2(0.0, texel.y), texel);
+	vec3 south = sampleScene(position - vec2(0.0, texel.y), texel);
+	vec3 east = sampleScene(position + vec2(texel.x, 0.0), texel);
+	vec3 west = sampleScene(position - vec2(texel.x, 0.0), texel);
+
+	// Unsharp mask, limited to the colors around the pixel
+	vec3 sharpened = center + sharpness * (center - 0.25 * (north + south + east + west));
+	vec3 low = min(center, min(min(north, south), min(east, west)));
+	vec3 high = max(center, max(max(north, south), max(east, west)));
+	finalcolor = vec4(clamp(sharpened, low, high), 1.0);
+}
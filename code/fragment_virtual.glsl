@@ -0,0 +1,54 @@
+#version 330 core
+
+// Diffuse lighting of a VirtualTexture, drawn from its finest loaded tiles.
+// VirtualTexture::bind() sets the uniforms.
+
+in vec3 interpolatedNormal;
+in vec2 st;
+in vec3 lightDirection;
+
+out vec4 finalcolor;
+
+uniform sampler2D virtualTexture;  // Sparse texture, or the cache of tiles in slots
+uniform usampler2D indirection;   // Slot xy and loaded level for each tile of each level
+uniform vec2 virtualSize;          // Size of level 0 in texels
+uniform float tileSize;
+uniform float tileBorder;
+uniform float slotSize;      // Tile size with its border
+uniform float physicalSize;  // Size of the cache texture
+uniform int maxLevel;
+uniform int sparseMode;
+
+vec2 levelSize(int level) {
+	return max(floor(virtualSize / float(1 << level)), vec2(1.0));
+}
+
+vec4 sampleVirtual(vec2 uv) {
+	uv = clamp(uv, 0.0, 1.0);
+	vec2 texel = uv * virtualSize;
+	vec2 dx = dFdx(texel);
+	vec2 dy = dFdy(texel);
+	float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+	int level = clamp(int(lod), 0, maxLevel);
+	ivec2 tile = ivec2(uv * levelSize(level) / tileSize);
+	tile = min(tile, textureSize(indirection, level) - 1);
+	uvec4 entry = texelFetch(indirection, tile, level);
+	int loaded = int(entry.b);
+	if (sparseMode != 0) {
+		return textureLod(virtualTexture, uv, max(lod, float(loaded)));
+	}
+	// The position in the tile of the loaded level, and in its slot of the cache
+	vec2 position = uv * levelSize(loaded);
+	vec2 loadedtile = min(floor(position / tileSize), ceil(levelSize(loaded) / tileSize) - 1.0);
+	vec2 intile = position - loadedtile * tileSize;
+	vec2 physical = vec2(entry.rg) * slotSize + tileBorder + intile;
+	return textureLod(virtualTexture, physical / physicalSize, 0.0);
+}
+
+void main() {
+	vec3 L = normalize(lightDirection);
+	vec3 N = normalize(interpolatedNormal);
+	vec4 color = sampleVirtual(st);
+	float diffuse = max(dot(N, L), 0.0);
+	finalcolor = vec4(color.rgb * (0.3 + 0.7 * diffuse), color.a);
+}
@@ -0,0 +1,26 @@
+#version 330 core
+
+// Feedback pass of VirtualTexture: the tile and level that each pixel samples.
+// Rendered into a buffer smaller than the viewport, which lodBias makes up for.
+
+in vec3 interpolatedNormal;
+in vec2 st;
+in vec3 lightDirection;
+
+out uvec4 feedback;  // Tile x, tile y, level, and 1 where the texture is drawn
+
+uniform vec2 virtualSize;  // Size of level 0 in texels
+uniform float tileSize;
+uniform int maxLevel;
+uniform float lodBias;
+
+void main() {
+	vec2 texel = clamp(st, 0.0, 1.0) * virtualSize;
+	vec2 dx = dFdx(texel);
+	vec2 dy = dFdy(texel);
+	float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + lodBias;
+	int level = clamp(int(lod), 0, maxLevel);
+	vec2 levelsize = max(floor(virtualSize / float(1 << level)), vec2(1.0));
+	vec2 tile = floor(clamp(st, 0.0, 1.0) * levelsize / tileSize);
+	feedback = uvec4(uvec2(tile), uint(level), 1u);
+}
@@ -0,0 +1,43 @@
+#version 330 core
+
+// Passes the triangles of vertex.glsl on to fragment.glsl with the barycentric coordinates of
+// each vertex, from which fragment.glsl finds how far a fragment is from the nearest edge,
+// for the WIREFRAME and WIREFRAME_OVERLAY variants. vertex.glsl names its outputs with the
+// prefix vertex_ when WIREFRAME is defined, so that they can go out here under their names.
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec3 vertex_interpolatedNormal[];
+in vec2 vertex_st[];
+in vec3 vertex_lightDirection[];
+in vec3 vertex_viewPosition[];
+#if defined(REPROJECTION) || defined(MOTION_VECTORS)
+in vec4 vertex_previousPosition[];
+#endif
+
+out vec3 interpolatedNormal;
+out vec2 st;
+out vec3 lightDirection;
+out vec3 viewPosition;
+#if defined(REPROJECTION) || defined(MOTION_VECTORS)
+out vec4 previousPosition;
+#endif
+out vec3 barycentric;
+
+void main() {
+	for (int i = 0; i < 3; i++) {
+		interpolatedNormal = vertex_interpolatedNormal[i];
+		st = vertex_st[i];
+		lightDirection = vertex_lightDirection[i];
+		viewPosition = vertex_viewPosition[i];
+#if defined(REPROJECTION) || defined(MOTION_VECTORS)
+		previousPosition = vertex_previousPosition[i];
+#endif
+		barycentric = vec3(i == 0, i == 1, i == 2);
+		gl_Position = gl_in[i].gl_Position;
+		gl_PrimitiveID = gl_PrimitiveIDIn;  // For PICKING
+		EmitVertex();
+	}
+	EndPrimitive();
+}
@@ -0,0 +1,14 @@
+// The Phong materials of MaterialTable (MaterialTable.hpp), which ObjectData.material of
+// uniforms.glsl indexes. Included by the shaders that shade.
+
+struct Material {
+	vec3 ka;   // Ambient reflection color
+	float n;   // Shininess
+	vec3 kd;   // Diffuse reflection color
+	vec3 ks;   // Specular reflection color
+};
+
+layout(std140) uniform MaterialData {
+	vec4 illumination[3];     // Ia, Id and Is of the light
+	Material materials[256];  // MaterialTable::maxMaterials
+};
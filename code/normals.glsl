@@ -0,0 +1,26 @@
+// Decoding of the normals of TriangleSoup's packed vertex formats.
+// With OCTAHEDRAL_NORMALS or PLAIN_NORMALS defined, only that format is compiled in.
+// Otherwise PositionScale.w > 0.5 selects the octahedral decoding, as set by
+// TriangleSoup::render().
+
+// Like sign(), but never zero, so normals on the octahedron edges decode correctly
+vec2 signNotZero(vec2 v) {
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 decodeNormal(vec4 normal, float octahedral) {
+#if defined(PLAIN_NORMALS)
+	return normal.xyz;
+#else
+#if !defined(OCTAHEDRAL_NORMALS)
+	if (octahedral < 0.5) {
+		return normal.xyz;
+	}
+#endif
+	vec3 n = vec3(normal.xy, 1.0 - abs(normal.x) - abs(normal.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+	}
+	return n;
+#endif
+}
@@ -0,0 +1,51 @@
+// Morph targets and skinning (see Skinning.hpp), included by the vertex shaders that deform
+// the vertices. morph() and skin() do nothing unless MORPHED and SKINNED are defined.
+
+#ifdef SKINNED
+// The bones of the vertex and their weights, set by TriangleSoup::setSkin()
+layout(location = 9) in uvec4 BoneIndices;
+layout(location = 10) in vec4 BoneWeights;
+
+uniform samplerBuffer bones;  // The matrices of BonePalette, 4 texels each
+uniform int firstBone;        // Of the draw in the palette
+
+mat4 boneMatrix(uint bone) {
+	int texel = 4 * (firstBone + int(bone));
+	return mat4(texelFetch(bones, texel), texelFetch(bones, texel + 1),
+	            texelFetch(bones, texel + 2), texelFetch(bones, texel + 3));
+}
+#endif
+
+#ifdef MORPHED
+uniform samplerBuffer morphTargets;  // Position and normal offsets, 2 texels per vertex
+uniform vec4 morphWeights;           // Of the targets of MorphTargets, up to 4
+uniform int morphVertexCount;        // In each target
+#endif
+
+// Add the weighted offsets of the morph targets of vertex 'vertex'
+void morph(int vertex, inout vec3 position, inout vec3 normal) {
+#ifdef MORPHED
+	for (int target = 0; target < 4; target++) {
+		float weight = morphWeights[target];
+		if (weight != 0.0) {
+			int texel = 2 * (target * morphVertexCount + vertex);
+			position += weight * texelFetch(morphTargets, texel).xyz;
+			normal += weight * texelFetch(morphTargets, texel + 1).xyz;
+		}
+	}
+#endif
+}
+
+// Move the position and the normal with the blend of the matrices of the bones
+void skin(inout vec3 position, inout vec3 normal) {
+#ifdef SKINNED
+	mat4 skinning = BoneWeights.x * boneMatrix(BoneIndices.x) +
+	                BoneWeights.y * boneMatrix(BoneIndices.y) +
+	                BoneWeights.z * boneMatrix(BoneIndices.z) +
+	                BoneWeights.w * boneMatrix(BoneIndices.w);
+	// The 8 bit weights may not sum to exactly one
+	skinning /= dot(BoneWeights, vec4(1.0));
+	position = (skinning * vec4(position, 1.0)).xyz;
+	normal = mat3(skinning) * normal;
+#endif
+}
@@ -0,0 +1,12 @@
+// Uniform blocks, filled in by the program through UniformRing (see UniformBuffers.hpp).
+// Included by the shaders that need them.
+layout(std140) uniform FrameData {
+	mat4 P;      // Projection
+	mat4 V;      // View transformation
+	float time;  // Seconds since the program was started
+};
+layout(std140) uniform ObjectData {
+	mat4 MV;        // Model-view transformation
+	mat4 R;         // Rotation
+	uint material;  // Index in MaterialData, of materials.glsl
+};
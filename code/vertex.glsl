@@ -1,28 +1,164 @@
 #version 330 core
 
+// With INSTANCED defined, each instance has its own model-view matrix, which replaces MV in
+// the ObjectData block, for TriangleSoup::renderInstanced() and MeshBatch::render().
+// With LOD_FADE defined as well, the matrix has the fade of the instance in [0][3], where
+// Impostor::render() puts it, which goes to the fragment shader.
+// With TERRAIN defined, the vertex is a point of the grid of a patch of Terrain (Terrain.hpp),
+// from its index, with the height from the heightmap.
+// With SKINNED and MORPHED defined, the vertices are deformed by bones and morph targets
+// first, as in skinning.glsl.
+// With REPROJECTION or MOTION_VECTORS defined, the position in the last frame goes to the
+// fragment shader too, for ReprojectionCache (ReprojectionCache.hpp).
+// With WIREFRAME defined, the outputs go to geometry_wireframe.glsl, which passes them on to
+// the fragment shader under the names they have here.
+// With MULTI_VIEW defined, each instance of a draw is the mesh in one of the views of
+// MultiView or the eyes of Stereo (views.glsl), and goes to the viewport of that view with
+// MULTI_VIEW_VIEWPORTS, or to its layer with MULTI_VIEW_LAYERS. With MULTI_VIEW_OVR=<n>, the
+// view is gl_ViewID_OVR of a multiview framebuffer of n views instead.
+// The shading is that of the view of P and MV, only the position on the screen is the view's.
+
+#ifdef MULTI_VIEW_VIEWPORTS
+#extension GL_ARB_viewport_array : enable
+#endif
+#if defined(MULTI_VIEW_VIEWPORTS) || defined(MULTI_VIEW_LAYERS)
+#extension GL_ARB_shader_viewport_layer_array : require
+#endif
+#ifdef MULTI_VIEW_OVR
+#extension GL_OVR_multiview : require
+#endif
+
+#ifdef WIREFRAME
+#define interpolatedNormal vertex_interpolatedNormal
+#define st vertex_st
+#define lightDirection vertex_lightDirection
+#define viewPosition vertex_viewPosition
+#define previousPosition vertex_previousPosition
+#endif
+
 layout(location = 0) in vec3 Position;
 /*LABB 3*/
-layout(location = 1) in vec3 Normal;
+layout(location = 1) in vec4 Normal;
 layout(location = 2) in vec2 TexCoord;
+// Decoding of TriangleSoup's packed vertex formats, set by TriangleSoup::render().
+// xyz is the scale of the position, w > 0.5 means that the normal is octahedral encoded.
+layout(location = 3) in vec4 PositionScale;
+layout(location = 4) in vec3 PositionOffset;
+#ifdef INSTANCED
+// Model-view matrix of the instance, set by TriangleSoup::setInstanceTransforms()
+layout(location = 5) in mat4 InstanceMatrix;
+#endif
 
 out vec3 interpolatedNormal;
 out vec2 st;
 out vec3 lightDirection;
+out vec3 viewPosition;  // For the point lights of CLUSTERED_LIGHTS
+#if defined(INSTANCED) && defined(LOD_FADE)
+flat out float lodFade;  // How much of the instance is left to its impostor
+#endif
+#ifdef TERRAIN
+// The patch of the instance: the corner and the size of its node, and the distances where its
+// morph starts and ends, set by Terrain::render()
+layout(location = 5) in vec4 TerrainPatch;
+layout(location = 6) in vec4 TerrainMorph;
+uniform sampler2D heightmap;  // Heights in the red channel, over the whole terrain
+uniform vec4 terrainSize;     // Width, depth, height scale, and quads along the grid
+uniform vec3 cameraPosition;  // In the coordinates of the terrain
+#endif
+#if defined(REPROJECTION) || defined(MOTION_VECTORS)
+uniform mat4 reprojection;  // Projection and model-view matrix of the last frame
+out vec4 previousPosition;  // In the clip space of the last frame
+#endif
 
-uniform float time;
-uniform mat4 R, MV, P;
+// The same as in vertex_depth.glsl, for a depth prepass
+invariant gl_Position;
 
+#include "uniforms.glsl"
+#include "normals.glsl"
+#include "skinning.glsl"
+#ifdef MULTI_VIEW
+#include "views.glsl"
+#endif
+
+#ifdef TERRAIN
+// The height at a point of the terrain. The corners of the terrain are at the centers of the
+// corner texels, as for the Heightfield of vertex_grid.glsl.
+float terrainHeight(vec2 xy) {
+	vec2 size = vec2(textureSize(heightmap, 0));
+	vec2 uv = clamp(xy / terrainSize.xy + 0.5, 0.0, 1.0);
+	return terrainSize.z * textureLod(heightmap, (uv * (size - 1.0) + 0.5) / size, 0.0).r;
+}
+
+// The vertex of the grid of the patch. In the outer part of the range of its level, the odd
+// vertices move onto the even ones before them, which leaves the grid of the next coarser
+// level where the patch meets it (Strugar 2010).
+void terrainVertex(out vec3 position, out vec3 normal) {
+	float quads = terrainSize.w;
+	int side = int(quads) + 1;
+	vec2 cell = vec2(gl_VertexID % side, gl_VertexID / side);
+	vec2 xy = TerrainPatch.xy + cell / quads * TerrainPatch.zw;
+	float eyeDistance = length(vec3(xy, terrainHeight(xy)) - cameraPosition);
+	float morphing = clamp((eyeDistance - TerrainMorph.x) / (TerrainMorph.y - TerrainMorph.x), 0.0,
+	                       1.0);
+	cell -= mod(cell, 2.0) * morphing;
+	xy = TerrainPatch.xy + cell / quads * TerrainPatch.zw;
+	position = vec3(xy, terrainHeight(xy));
+
+	// Normal from central differences of the heights, one texel apart
+	vec2 texel = terrainSize.xy / max(vec2(textureSize(heightmap, 0)) - 1.0, vec2(1.0));
+	vec2 dx = vec2(texel.x, 0.0);
+	vec2 dy = vec2(0.0, texel.y);
+	float dhdx = (terrainHeight(xy + dx) - terrainHeight(xy - dx)) / (2.0 * texel.x);
+	float dhdy = (terrainHeight(xy + dy) - terrainHeight(xy - dy)) / (2.0 * texel.y);
+	normal = normalize(vec3(-dhdx, -dhdy, 1.0));
+}
+#endif
 
 void main() {
-    //gl_Position = T * vec4(Position, 1.0);
-	//gl_Position = R * vec4(Position, abs(sin(time)));
-	//gl_Position = MV * vec4(Position, 1.0);
-	
-	
-	vec3 transformedNormal = mat3(MV) * Normal;
+#ifdef INSTANCED
+	mat4 modelview = InstanceMatrix;
+#ifdef LOD_FADE
+	// The bottom row of a model-view matrix is 0 0 0 1 without the fade
+	lodFade = modelview[0][3];
+	modelview[0][3] = 0.0;
+#endif
+#else
+	mat4 modelview = MV;
+#endif
+#ifdef TERRAIN
+	vec3 position;
+	vec3 normal;
+	terrainVertex(position, normal);
+#else
+	vec3 position = Position * PositionScale.xyz + PositionOffset;
+	vec3 normal = decodeNormal(Normal, PositionScale.w);
+	morph(gl_VertexID, position, normal);
+	skin(position, normal);
+#endif
+	vec3 transformedNormal = mat3(modelview) * normal;
 	interpolatedNormal = normalize(transformedNormal);
 	lightDirection =  vec3(1.0, 0.8, 1.0);
-	gl_Position = P * MV * vec4(Position, 1.0); // Special, required output
-	
+	vec4 viewpos = modelview * vec4(position, 1.0);
+	viewPosition = viewpos.xyz;
+#ifdef MULTI_VIEW
+	int view = viewIndex();
+	gl_Position = viewP[view] * (viewOffset[view] * viewpos);
+#ifdef MULTI_VIEW_VIEWPORTS
+	gl_ViewportIndex = view;
+#endif
+#ifdef MULTI_VIEW_LAYERS
+	gl_Layer = view;
+#endif
+#else
+	gl_Position = P * viewpos; // Special, required output
+#endif
+#if defined(REPROJECTION) || defined(MOTION_VECTORS)
+	previousPosition = reprojection * vec4(position, 1.0);
+#endif
+
+#ifdef TERRAIN
+	st = position.xy / terrainSize.xy + 0.5;
+#else
 	st = TexCoord; // Will also be interpolated across the triangle
+#endif
 }
@@ -0,0 +1,32 @@
+#version 330 core
+
+// The positions only, for depth passes with TriangleSoup::renderDepth(), like a depth prepass.
+// gl_Position is computed as in vertex.glsl, and is invariant in both, so that the shading
+// pass after the prepass finds exactly the same depths with glDepthFunc(GL_EQUAL).
+// SKINNED and MORPHED deform the positions as in vertex.glsl.
+
+layout(location = 0) in vec3 Position;
+layout(location = 3) in vec4 PositionScale;
+layout(location = 4) in vec3 PositionOffset;
+#ifdef INSTANCED
+layout(location = 5) in mat4 InstanceMatrix;
+#endif
+
+invariant gl_Position;
+
+#include "uniforms.glsl"
+#include "skinning.glsl"
+
+void main() {
+#ifdef INSTANCED
+	mat4 modelview = InstanceMatrix;
+#else
+	mat4 modelview = MV;
+#endif
+	vec3 position = Position * PositionScale.xyz + PositionOffset;
+	vec3 normal = vec3(0.0);  // Not needed
+	morph(gl_VertexID, position, normal);
+	skin(position, normal);
+	vec4 viewpos = modelview * vec4(position, 1.0);
+	gl_Position = P * viewpos;
+}
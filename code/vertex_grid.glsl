@@ -0,0 +1,71 @@
+#version 330 core
+
+// The vertices of a ProceduralGrid, computed from gl_VertexID and gl_InstanceID without any
+// vertex attributes. Each instance is one row of quads, drawn as a triangle strip of
+// 2 * (columns + 1) vertices. One of PLANE, CYLINDER, TORUS or HEIGHTFIELD is defined, and
+// the surface is evaluated at (u, v) in [0,1]^2 with the same formulas as the CPU side
+// generators in TriangleSoup.
+
+out vec3 interpolatedNormal;
+out vec2 st;
+out vec3 lightDirection;
+out vec3 viewPosition;
+
+#include "uniforms.glsl"
+
+uniform vec2 gridSize;   // Columns and rows of quads
+uniform vec2 shapeSize;  // Width and depth, radius and height, or major and minor radius
+#ifdef HEIGHTFIELD
+uniform sampler2D heightmap;  // Heights in the red channel, over the whole grid
+uniform float heightScale;
+#endif
+
+const float PI = 3.14159265358979;
+
+#ifdef HEIGHTFIELD
+// The height at (u, v). The corners of the grid are at the centers of the corner texels, so
+// a grid of (width - 1) x (height - 1) quads has one vertex on every texel.
+float height(vec2 uv) {
+	vec2 size = vec2(textureSize(heightmap, 0));
+	return heightScale * textureLod(heightmap, (uv * (size - 1.0) + 0.5) / size, 0.0).r;
+}
+#endif
+
+void main() {
+	// Even vertices of the strip are on the upper edge of the row, which makes the triangles
+	// counterclockwise in (u, v)
+	vec2 cell = vec2(gl_VertexID >> 1, gl_InstanceID + 1 - (gl_VertexID & 1));
+	vec2 uv = cell / gridSize;
+
+	vec3 position;
+	vec3 normal;
+#if defined(PLANE)
+	position = vec3((uv - 0.5) * shapeSize, 0.0);
+	normal = vec3(0.0, 0.0, 1.0);
+#elif defined(HEIGHTFIELD)
+	// Normal from central differences of the heights, one grid cell apart
+	vec2 du = vec2(1.0 / gridSize.x, 0.0);
+	vec2 dv = vec2(0.0, 1.0 / gridSize.y);
+	float dhdx = (height(uv + du) - height(uv - du)) / (2.0 * du.x * shapeSize.x);
+	float dhdy = (height(uv + dv) - height(uv - dv)) / (2.0 * dv.y * shapeSize.y);
+	position = vec3((uv - 0.5) * shapeSize, height(uv));
+	normal = normalize(vec3(-dhdx, -dhdy, 1.0));
+#elif defined(CYLINDER)
+	float phi = uv.x * 2.0 * PI;
+	normal = vec3(cos(phi), sin(phi), 0.0);
+	position = vec3(shapeSize.x * normal.xy, (uv.y - 0.5) * shapeSize.y);
+#elif defined(TORUS)
+	float phi = uv.x * 2.0 * PI;    // Around the z axis
+	float theta = uv.y * 2.0 * PI;  // Around the tube
+	vec3 radial = vec3(cos(phi), sin(phi), 0.0);
+	normal = cos(theta) * radial + vec3(0.0, 0.0, sin(theta));
+	position = shapeSize.x * radial + shapeSize.y * normal;
+#endif
+
+	interpolatedNormal = normalize(mat3(MV) * normal);
+	lightDirection = vec3(1.0, 0.8, 1.0);
+	vec4 viewpos = MV * vec4(position, 1.0);
+	viewPosition = viewpos.xyz;
+	gl_Position = P * viewpos;
+	st = uv;
+}
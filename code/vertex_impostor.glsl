@@ -0,0 +1,101 @@
+#version 330 core
+
+// The billboards of Impostor (Impostor.hpp), one per instance, which show the four atlas
+// views around the direction to the camera. With BAKE defined, the views of the mesh that
+// go into the atlases.
+
+#include "normals.glsl"
+
+#ifdef BAKE
+layout(location = 0) in vec3 Position;
+layout(location = 1) in vec4 Normal;
+layout(location = 2) in vec2 TexCoord;
+// Decoding of TriangleSoup's packed vertex formats, as in vertex.glsl
+layout(location = 3) in vec4 PositionScale;
+layout(location = 4) in vec3 PositionOffset;
+
+uniform mat4 bakeMatrix;  // From the mesh to the clip space of the view
+
+out vec3 bakedNormal;  // In the coordinates of the mesh
+out vec2 st;
+
+void main() {
+	vec3 position = Position * PositionScale.xyz + PositionOffset;
+	bakedNormal = decodeNormal(Normal, PositionScale.w);
+	st = TexCoord;
+	gl_Position = bakeMatrix * vec4(position, 1.0);
+}
+#else
+// Model-view matrix of the instance, with the fade in [0][3]
+layout(location = 5) in mat4 InstanceMatrix;
+
+uniform vec4 bounds;  // Center and radius of the mesh
+uniform float views;  // Views along each side of the atlas
+
+out vec2 viewCoords[4];  // Where the billboard is in each view, from 0 to 1 across it
+flat out vec2 cells[4];  // The views, in cells of the atlas
+flat out vec4 weights;   // Of the views
+flat out mat3 normalMatrix;
+flat out float fade;     // How much of the billboard is left to the mesh
+
+#include "uniforms.glsl"
+
+// The octahedral map of the directions to [-1, 1]^2, with y up. octahedralDecode() is the
+// same as in Impostor.cpp.
+vec2 octahedralEncode(vec3 d) {
+	d /= abs(d.x) + abs(d.y) + abs(d.z);
+	vec2 p = d.xz;
+	if (d.y < 0.0) {
+		p = (1.0 - abs(p.yx)) * signNotZero(p);
+	}
+	return p;
+}
+
+vec3 octahedralDecode(vec2 p) {
+	vec3 d = vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y);
+	if (d.y < 0.0) {
+		d.xz = (1.0 - abs(d.zx)) * signNotZero(d.xz);
+	}
+	return normalize(d);
+}
+
+// The right and up axes of the view from direction d, as in Impostor.cpp
+void viewAxes(vec3 d, out vec3 right, out vec3 up) {
+	right = normalize(cross(abs(d.y) < 0.999 ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, 1.0), d));
+	up = cross(d, right);
+}
+
+void main() {
+	mat4 modelview = InstanceMatrix;
+	fade = modelview[0][3];
+	modelview[0][3] = 0.0;
+	vec3 center = bounds.xyz;
+	float radius = bounds.w;
+
+	// A square around the bounding sphere that faces the camera, in the coordinates of the
+	// mesh. P[2][3] is 0 for an orthographic projection, which looks along -z.
+	vec3 viewCenter = (modelview * vec4(center, 1.0)).xyz;
+	vec3 toCamera = P[2][3] != 0.0 ? -viewCenter : vec3(0.0, 0.0, 1.0);
+	vec3 direction = normalize(inverse(mat3(modelview)) * toCamera);
+	vec3 right, up;
+	viewAxes(direction, right, up);
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+	vec3 offset = (right * corner.x + up * corner.y) * radius;
+	gl_Position = P * (modelview * vec4(center + offset, 1.0));
+
+	// The four views around the direction, weighted bilinearly. The corner is projected
+	// into each view along its direction, as if the mesh were flat through the center.
+	vec2 grid = (octahedralEncode(direction) * 0.5 + 0.5) * (views - 1.0);
+	vec2 base = clamp(floor(grid), vec2(0.0), vec2(views - 2.0));
+	vec2 f = clamp(grid - base, 0.0, 1.0);
+	weights = vec4((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y);
+	for (int i = 0; i < 4; i++) {
+		vec2 cell = base + vec2(i & 1, i >> 1);
+		vec3 viewRight, viewUp;
+		viewAxes(octahedralDecode(cell / (views - 1.0) * 2.0 - 1.0), viewRight, viewUp);
+		cells[i] = cell;
+		viewCoords[i] = vec2(dot(offset, viewRight), dot(offset, viewUp)) / (2.0 * radius) + 0.5;
+	}
+	normalMatrix = mat3(modelview);
+}
+#endif
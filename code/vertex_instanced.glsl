@@ -0,0 +1,6 @@
+#version 330 core
+
+// vertex.glsl for TriangleSoup::renderInstanced() and MeshBatch::render(), the same as the
+// variant with INSTANCED defined
+#define INSTANCED 1
+#include "vertex.glsl"
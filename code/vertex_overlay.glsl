@@ -0,0 +1,19 @@
+#version 330 core
+
+// The widgets of Overlay (Overlay.hpp), in pixels from the upper left corner of the window
+
+layout(location = 0) in vec2 Position;
+layout(location = 1) in vec2 TexCoord;
+layout(location = 2) in vec4 Color;  // Normalized from bytes
+
+uniform vec2 viewportSize;  // Pixels
+
+out vec2 st;
+out vec4 color;
+
+void main() {
+	vec2 position = Position / viewportSize * 2.0 - 1.0;
+	gl_Position = vec4(position.x, -position.y, 0.0, 1.0);
+	st = TexCoord;
+	color = Color;
+}
@@ -0,0 +1,28 @@
+#version 330 core
+
+// The particles of ParticleSystem (ParticleSystem.hpp) as point sprites, smaller further
+// away. Those that are not born yet are outside the view.
+
+layout(location = 0) in vec4 PositionAge;
+layout(location = 1) in vec4 VelocityLifetime;
+
+#include "uniforms.glsl"
+
+uniform float size;            // Diameter in the units of the model-view matrix
+uniform float viewportHeight;  // Pixels
+
+out float fade;  // 1.0 when the particle is born, 0.0 at the end of its life
+
+void main() {
+	if (PositionAge.w < 0.0) {
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		gl_PointSize = 1.0;
+		fade = 0.0;
+		return;
+	}
+	vec4 viewpos = MV * vec4(PositionAge.xyz, 1.0);
+	gl_Position = P * viewpos;
+	// P[1][1] is the cotangent of half the field of view
+	gl_PointSize = max(size * P[1][1] * 0.5 * viewportHeight / max(-viewpos.z, 1e-3), 1.0);
+	fade = clamp(1.0 - PositionAge.w / VelocityLifetime.w, 0.0, 1.0);
+}
@@ -0,0 +1,66 @@
+#version 330 core
+
+// One time step of the particles of ParticleSystem (ParticleSystem.hpp). Each particle is a
+// point whose next state is captured with transform feedback; nothing is drawn.
+
+layout(location = 0) in vec4 PositionAge;
+layout(location = 1) in vec4 VelocityLifetime;
+
+uniform float timestep;
+uniform float seed;             // Different in every step
+uniform vec3 emitterPosition;
+uniform vec3 emitterVelocity;
+uniform float spread;           // Largest random part of the velocity of a new particle
+uniform vec3 gravity;
+uniform float lifetime;
+
+out vec4 positionAge;
+out vec4 velocityLifetime;
+
+// A 32 bit integer hash (Chris Wellons' lowbias32)
+uint hash(uint x) {
+	x ^= x >> 16u;
+	x *= 0x7feb352du;
+	x ^= x >> 15u;
+	x *= 0x846ca68bu;
+	x ^= x >> 16u;
+	return x;
+}
+
+// A random number in [0, 1), and the next state
+float random(inout uint state) {
+	state = hash(state);
+	return float(state >> 8u) * (1.0 / 16777216.0);
+}
+
+void main() {
+	vec3 position = PositionAge.xyz;
+	vec3 velocity = VelocityLifetime.xyz;
+	float life = VelocityLifetime.w;
+	float age = PositionAge.w + timestep;
+	if (PositionAge.w >= 0.0) {
+		velocity += gravity * timestep;
+		position += velocity * timestep;
+	}
+
+	// Born for the first time, or again when the lifetime is over
+	bool born = PositionAge.w < 0.0 && age >= 0.0;
+	if (age >= life) {
+		age -= life;
+		born = true;
+	}
+	if (born) {
+		uint state = hash(uint(gl_VertexID) ^ hash(floatBitsToUint(seed)));
+		// A random direction in the unit ball
+		vec3 direction;
+		do {
+			direction = vec3(random(state), random(state), random(state)) * 2.0 - 1.0;
+		} while (dot(direction, direction) > 1.0);
+		velocity = emitterVelocity + spread * direction;
+		life = lifetime * (0.75 + 0.25 * random(state));
+		// Where it is after the part of the step since it was born
+		position = emitterPosition + velocity * age;
+	}
+	positionAge = vec4(position, age);
+	velocityLifetime = vec4(velocity, life);
+}
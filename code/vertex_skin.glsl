@@ -0,0 +1,28 @@
+#version 330 core
+
+// The skinning pass of SkinCache (Skinning.hpp): every vertex of a mesh, drawn as a point
+// with TriangleSoup::renderVertices(), is morphed and skinned as in vertex.glsl, and
+// captured with transform feedback as a vertex of the Float format. Nothing is drawn.
+
+layout(location = 0) in vec3 Position;
+layout(location = 1) in vec4 Normal;
+layout(location = 2) in vec2 TexCoord;
+layout(location = 3) in vec4 PositionScale;
+layout(location = 4) in vec3 PositionOffset;
+
+out vec3 skinnedPosition;
+out vec3 skinnedNormal;
+out vec2 skinnedTexCoord;
+
+#include "normals.glsl"
+#include "skinning.glsl"
+
+void main() {
+	vec3 position = Position * PositionScale.xyz + PositionOffset;
+	vec3 normal = decodeNormal(Normal, PositionScale.w);
+	morph(gl_VertexID, position, normal);
+	skin(position, normal);
+	skinnedPosition = position;
+	skinnedNormal = normalize(normal);
+	skinnedTexCoord = TexCoord;
+}
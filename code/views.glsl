@@ -0,0 +1,23 @@
+// The views of MultiView (MultiView.hpp) and the eyes of Stereo (Stereo.hpp), for the
+// MULTI_VIEW variants of vertex.glsl. Instance i of a draw is in view viewFirst + i % viewCount,
+// or, with MULTI_VIEW_OVR, the vertex shader runs for each view of the framebuffer.
+
+#ifdef MULTI_VIEW_OVR
+layout(num_views = MULTI_VIEW_OVR) in;
+#endif
+
+layout(std140) uniform ViewData {
+	mat4 viewP[4];       // Projection of each view, MultiView::maxViews
+	mat4 viewOffset[4];  // From the view space of P and MV to that of each view
+	int viewCount;       // Views drawn by the instances of one draw
+	int viewFirst;       // The view of the first instance
+};
+
+// The view of this vertex, from its instance or its view
+int viewIndex() {
+#ifdef MULTI_VIEW_OVR
+	return viewFirst + int(gl_ViewID_OVR);
+#else
+	return viewFirst + gl_InstanceID % viewCount;
+#endif
+}
@@ -0,0 +1,31 @@
+#version 450
+
+// The fragment shader of VulkanBackend, the Phong shading of fragment.glsl
+
+layout(location = 0) in vec3 interpolatedNormal;
+layout(location = 1) in vec2 st;
+layout(location = 2) in vec3 lightDirection;
+
+layout(location = 0) out vec4 finalcolor;
+
+void main() {
+	vec3 V = vec3(0.0, 0.0, 1.0);
+	vec3 L = normalize(lightDirection);
+	vec3 N = normalize(interpolatedNormal);
+
+	vec3 Ia = vec3(0.5, 0.5, 0.5);
+	vec3 ka = vec3(0.5, 0.0, 0.0);
+	vec3 Id = vec3(1.0, 1.0, 1.0);
+	vec3 kd = vec3(0.5, 0.0, 0.0);
+	vec3 Is = vec3(1.0, 1.0, 1.0);
+	vec3 ks = vec3(1.0, 1.0, 1.0);
+	float n = 10.0;
+
+	vec3 Ref = 2.0 * dot(N, L) * N - L;
+	float dotNL = max(dot(N, L), 0.0);
+	float dotRV = max(dot(Ref, V), 0.0);
+	if (dotNL == 0.0) {
+		dotRV = 0.0;
+	}
+	finalcolor = vec4(Ia * ka + Id * kd * dotNL + Is * ks * pow(dotRV, n), 1.0);
+}
@@ -0,0 +1,27 @@
+#version 450
+
+// The vertex shader of VulkanBackend, the Phong shading of vertex.glsl without the variants.
+// Compiled to SPIR-V (vulkan_vertex.spv) by the build when glslangValidator is found.
+
+layout(location = 0) in vec3 Position;
+layout(location = 1) in vec3 Normal;
+layout(location = 2) in vec2 TexCoord;
+
+// Per draw, as VulkanBackend::Draw
+layout(push_constant) uniform DrawData {
+	mat4 MVP;  // Projection and model-view transformation
+	mat4 MV;   // Model-view transformation
+};
+
+layout(location = 0) out vec3 interpolatedNormal;
+layout(location = 1) out vec2 st;
+layout(location = 2) out vec3 lightDirection;
+
+void main() {
+	interpolatedNormal = normalize(mat3(MV) * Normal);
+	lightDirection = vec3(1.0, 0.8, 1.0);
+	st = TexCoord;
+	gl_Position = MVP * vec4(Position, 1.0);
+	// The projection of Mat4 maps depth to [-1,1], and Vulkan clips to [0,1]
+	gl_Position.z = 0.5 * (gl_Position.z + gl_Position.w);
+}